@@ -0,0 +1,245 @@
+#include "bench.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+
+#ifndef VERSION
+#define VERSION "unknown"
+#endif
+#ifndef BENCH_COMMIT
+#define BENCH_COMMIT "unknown"
+#endif
+
+#define BENCH_MIN_BATCHES   5
+#define BENCH_MAX_BATCHES   1024
+
+uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void bench_init(bench_t *b) {
+    memset(b, 0, sizeof(*b));
+    b->duration_ms = BENCH_DEFAULT_MS;
+}
+
+void bench_free(bench_t *b) {
+    free(b->results);
+    b->results = NULL;
+    b->count = b->cap = 0;
+}
+
+bool bench_selected(const bench_t *b, const char *name, const char *params) {
+    if (!b->filter || !*b->filter) return true;
+    char full[2 * BENCH_NAME_MAX + 1];
+    snprintf(full, sizeof(full), "%s/%s", name, params ? params : "");
+    return strstr(full, b->filter) != NULL;
+}
+
+static int bench_cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t bench_time_batch(bench_t *b, bench_fn_t fn, void *arg, uint64_t iters) {
+    uint64_t start = bench_now_ns();
+    b->sink += fn(arg, iters);
+    return bench_now_ns() - start;
+}
+
+const bench_result_t *bench_run(bench_t *b, const char *name, const char *params,
+                                bench_fn_t fn, void *arg) {
+    if (!bench_selected(b, name, params)) return NULL;
+
+    // Grow the batch tenfold until it is long enough to scale from
+    uint64_t iters = 1;
+    for (;;) {
+        uint64_t t = bench_time_batch(b, fn, arg, iters);
+        if (t >= BENCH_BATCH_NS / 10 || iters >= (1ull << 40)) {
+            uint64_t scaled = t ? iters * BENCH_BATCH_NS / t : iters;
+            iters = scaled ? scaled : 1;
+            break;
+        }
+        iters *= 10;
+    }
+
+    static double per_op[BENCH_MAX_BATCHES];
+    uint32_t batches = 0;
+    uint64_t total_iters = 0;
+    uint64_t deadline = bench_now_ns() + (uint64_t)b->duration_ms * 1000000ull;
+    while (batches < BENCH_MAX_BATCHES &&
+           (batches < BENCH_MIN_BATCHES || bench_now_ns() < deadline)) {
+        uint64_t t = bench_time_batch(b, fn, arg, iters);
+        per_op[batches++] = (double)t / (double)iters;
+        total_iters += iters;
+    }
+    qsort(per_op, batches, sizeof(per_op[0]), bench_cmp_double);
+
+    if (b->count == b->cap) {
+        size_t cap = b->cap ? b->cap * 2 : 64;
+        bench_result_t *r = realloc(b->results, cap * sizeof(*r));
+        if (!r) return NULL;
+        b->results = r;
+        b->cap = cap;
+    }
+
+    bench_result_t *r = &b->results[b->count++];
+    memset(r, 0, sizeof(*r));
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    snprintf(r->params, sizeof(r->params), "%s", params ? params : "");
+    r->iters = total_iters;
+    r->batches = batches;
+    r->ns_per_op = per_op[batches / 2];
+    r->ns_min = per_op[0];
+    r->ops_per_sec = r->ns_per_op > 0 ? 1e9 / r->ns_per_op : 0;
+
+    if (!b->quiet) {
+        printf("%-28s %-30s %10.1f ns/op %10.1f min %14.0f ops/s\n",
+               r->name, r->params, r->ns_per_op, r->ns_min, r->ops_per_sec);
+        fflush(stdout);
+    }
+    return r;
+}
+
+static void bench_json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') fprintf(f, "\\%c", c);
+        else if (c < 0x20) fprintf(f, "\\u%04x", c);
+        else fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+static void bench_cpu_model(char *out, size_t len) {
+    snprintf(out, len, "unknown");
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    if (!f) return;
+
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "model name", 10) != 0) continue;
+        char *v = strchr(line, ':');
+        if (!v) break;
+        v++;
+        while (*v == ' ' || *v == '\t') v++;
+        v[strcspn(v, "\n")] = '\0';
+        snprintf(out, len, "%s", v);
+        break;
+    }
+    fclose(f);
+}
+
+void bench_json_meta(FILE *f, const char *suite) {
+    struct utsname u;
+    if (uname(&u) < 0) memset(&u, 0, sizeof(u));
+    char cpu[128];
+    bench_cpu_model(cpu, sizeof(cpu));
+    char when[32];
+    time_t now = time(NULL);
+    struct tm tm;
+    strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%SZ", gmtime_r(&now, &tm));
+
+    fprintf(f, "  \"suite\": ");
+    bench_json_string(f, suite);
+    fprintf(f, ",\n  \"version\": ");
+    bench_json_string(f, VERSION);
+    fprintf(f, ",\n  \"commit\": ");
+    bench_json_string(f, BENCH_COMMIT);
+    fprintf(f, ",\n  \"compiler\": ");
+    bench_json_string(f, __VERSION__);
+    fprintf(f, ",\n  \"kernel\": ");
+    bench_json_string(f, u.release);
+    fprintf(f, ",\n  \"arch\": ");
+    bench_json_string(f, u.machine);
+    fprintf(f, ",\n  \"cpu\": ");
+    bench_json_string(f, cpu);
+    fprintf(f, ",\n  \"cpus\": %ld,\n  \"time\": \"%s\"", sysconf(_SC_NPROCESSORS_ONLN), when);
+}
+
+int bench_write_json(const bench_t *b, const char *path) {
+    // Written to the side and renamed, so a reader never sees half a file
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "w");
+    if (!f) return -1;
+
+    fprintf(f, "{\n");
+    bench_json_meta(f, "micro");
+    fprintf(f, ",\n  \"duration_ms\": %u,\n  \"results\": [", b->duration_ms);
+    for (size_t i = 0; i < b->count; i++) {
+        const bench_result_t *r = &b->results[i];
+        fprintf(f, "%s\n    {\"name\": ", i ? "," : "");
+        bench_json_string(f, r->name);
+        fprintf(f, ", \"params\": ");
+        bench_json_string(f, r->params);
+        fprintf(f, ", \"iters\": %llu, \"batches\": %u, \"ns_per_op\": %.3f, "
+                   "\"ns_min\": %.3f, \"ops_per_sec\": %.0f}",
+                (unsigned long long)r->iters, r->batches, r->ns_per_op, r->ns_min, r->ops_per_sec);
+    }
+    fprintf(f, "\n  ]\n}\n");
+
+    if (fclose(f) != 0 || rename(tmp, path) < 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+void bench_hist_reset(bench_hist_t *h) {
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+static inline uint32_t bench_hist_bucket(uint64_t v) {
+    if (v >= (1ull << BENCH_HIST_MAX_BITS)) v = (1ull << BENCH_HIST_MAX_BITS) - 1;
+    if (v < BENCH_HIST_SUB) return (uint32_t)v;
+    uint32_t shift = 63 - __builtin_clzll(v) - BENCH_HIST_SUB_BITS;
+    return (shift + 1) * BENCH_HIST_SUB + (uint32_t)((v >> shift) - BENCH_HIST_SUB);
+}
+
+static inline uint64_t bench_hist_highest(uint32_t idx) {
+    if (idx < BENCH_HIST_SUB) return idx;
+    uint32_t shift = idx / BENCH_HIST_SUB - 1;
+    uint64_t sub = idx % BENCH_HIST_SUB + BENCH_HIST_SUB;
+    return ((sub + 1) << shift) - 1;
+}
+
+void bench_hist_record(bench_hist_t *h, uint64_t value) {
+    h->buckets[bench_hist_bucket(value)]++;
+    h->count++;
+    h->sum += value;
+    if (value < h->min) h->min = value;
+    if (value > h->max) h->max = value;
+}
+
+void bench_hist_merge(bench_hist_t *dst, const bench_hist_t *src) {
+    for (uint32_t i = 0; i < BENCH_HIST_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->min < dst->min) dst->min = src->min;
+    if (src->max > dst->max) dst->max = src->max;
+}
+
+uint64_t bench_hist_percentile(const bench_hist_t *h, double pct) {
+    if (!h->count) return 0;
+    double want = (double)h->count * pct / 100.0;
+    uint64_t rank = (uint64_t)want;
+    if ((double)rank < want || rank < 1) rank++;
+    if (rank > h->count) rank = h->count;
+
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < BENCH_HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            uint64_t v = bench_hist_highest(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
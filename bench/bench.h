@@ -0,0 +1,89 @@
+#ifndef BENCH_BENCH_H
+#define BENCH_BENCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Microbenchmark harness. A benchmark is a function that runs its
+// operation iters times and returns something derived from the results,
+// so the compiler cannot drop the work. bench_run() sizes a batch to
+// about BENCH_BATCH_NS, then times batches for the run's duration and
+// reports the median and fastest batch per operation. Results collect in
+// the bench_t and are written out as one JSON document.
+#define BENCH_BATCH_NS      (10 * 1000 * 1000ull)
+#define BENCH_DEFAULT_MS    300
+#define BENCH_NAME_MAX      64
+
+typedef uint64_t (*bench_fn_t)(void *arg, uint64_t iters);
+
+typedef struct bench_result {
+    char name[BENCH_NAME_MAX];
+    char params[BENCH_NAME_MAX];
+    uint64_t iters;
+    uint32_t batches;
+    double ns_per_op;           // median batch
+    double ns_min;              // fastest batch
+    double ops_per_sec;
+} bench_result_t;
+
+typedef struct bench {
+    const char *filter;         // substring of "name/params", NULL for all
+    uint32_t duration_ms;
+    bool quiet;
+    bench_result_t *results;
+    size_t count;
+    size_t cap;
+    uint64_t sink;
+} bench_t;
+
+void bench_init(bench_t *b);
+void bench_free(bench_t *b);
+bool bench_selected(const bench_t *b, const char *name, const char *params);
+// Skipped when the filter rules it out; the result stays in b
+const bench_result_t *bench_run(bench_t *b, const char *name, const char *params,
+                                bench_fn_t fn, void *arg);
+int bench_write_json(const bench_t *b, const char *path);
+
+uint64_t bench_now_ns(void);
+
+// Latency histogram with HdrHistogram's layout: exact below
+// BENCH_HIST_SUB, then BENCH_HIST_SUB buckets per power of two, so
+// any recorded value is reported within 1/BENCH_HIST_SUB of itself.
+// Values past 2^BENCH_HIST_MAX_BITS ns (about 18 minutes) are clamped.
+#define BENCH_HIST_SUB_BITS 7
+#define BENCH_HIST_SUB      (1u << BENCH_HIST_SUB_BITS)
+#define BENCH_HIST_MAX_BITS 40
+#define BENCH_HIST_BUCKETS  ((BENCH_HIST_MAX_BITS - BENCH_HIST_SUB_BITS + 1) * BENCH_HIST_SUB)
+
+typedef struct bench_hist {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[BENCH_HIST_BUCKETS];
+} bench_hist_t;
+
+void bench_hist_reset(bench_hist_t *h);
+void bench_hist_record(bench_hist_t *h, uint64_t value);
+void bench_hist_merge(bench_hist_t *dst, const bench_hist_t *src);
+uint64_t bench_hist_percentile(const bench_hist_t *h, double pct);
+
+// Suites in bench_cxx.cpp: RequestRouter and DatabasePool
+void bench_cxx_router(bench_t *b);
+void bench_cxx_db_pool(bench_t *b);
+
+// Writes the fields every result file starts with: suite, version,
+// commit, compiler, host, cpus and time, without the braces around them
+void bench_json_meta(FILE *f, const char *suite);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,163 @@
+#include "bench.h"
+#include "core/request_router.hpp"
+#include "database/db_pool.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <array>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace ultrabalancer;
+using ultrabalancer::database::BackendRole;
+using ultrabalancer::database::DatabasePool;
+
+namespace {
+
+constexpr uint32_t kPaths = 1024;   // a power of two, picked with a mask
+
+struct RouterBench {
+    RequestRouter router;
+    std::vector<std::string> paths;
+    std::array<HeaderRef, 4> headers{{
+        {"host", "api.example.com"},
+        {"user-agent", "bench/1.0"},
+        {"accept", "application/json"},
+        {"x-tenant", "blue"},
+    }};
+};
+
+uint64_t router_fn(void* arg, uint64_t iters) {
+    auto* r = static_cast<RouterBench*>(arg);
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < iters; i++) {
+        const std::string& path = r->paths[(i * 7) & (kPaths - 1)];
+        auto target = r->router.route_request("GET", path, std::span<const HeaderRef>(r->headers));
+        sum += reinterpret_cast<uintptr_t>(target.get());
+    }
+    return sum;
+}
+
+// Prefix routes per service plus a few exact, header and regex routes,
+// the mix a typical API gateway config has
+void router_setup(RouterBench& r, uint32_t services) {
+    std::vector<std::shared_ptr<Route>> routes;
+    char buf[96];
+    for (uint32_t s = 0; s < services; s++) {
+        std::snprintf(buf, sizeof(buf), "svc%u", s);
+        auto route = std::make_shared<Route>(buf);
+        std::snprintf(buf, sizeof(buf), "/api/v1/svc%u/", s);
+        route->add_rule(std::make_shared<RouteRule>(RouteRule::MatchType::PREFIX, buf));
+        std::snprintf(buf, sizeof(buf), "pool%u", s);
+        route->add_target(std::make_shared<RouteTarget>(buf, 100));
+        route->set_priority(10);
+        routes.push_back(route);
+    }
+
+    auto health = std::make_shared<Route>("health");
+    health->add_rule(std::make_shared<RouteRule>(RouteRule::MatchType::EXACT, "/healthz"));
+    health->add_target(std::make_shared<RouteTarget>("local", 100));
+    health->set_priority(100);
+    routes.push_back(health);
+
+    auto tenant = std::make_shared<Route>("tenant-green");
+    tenant->add_rule(std::make_shared<RouteRule>(RouteRule::MatchType::HEADER, "x-tenant:green"));
+    tenant->add_target(std::make_shared<RouteTarget>("green", 100));
+    tenant->set_priority(50);
+    routes.push_back(tenant);
+
+    auto assets = std::make_shared<Route>("assets");
+    assets->add_rule(std::make_shared<RouteRule>(RouteRule::MatchType::REGEX, "\\.(css|js|png)$"));
+    assets->add_target(std::make_shared<RouteTarget>("static", 100));
+    routes.push_back(assets);
+
+    r.router.replace_routes(std::move(routes), "default");
+
+    r.paths.clear();
+    for (uint32_t i = 0; i < kPaths; i++) {
+        switch (i % 8) {
+            case 0: r.paths.emplace_back("/healthz"); break;
+            case 1: r.paths.emplace_back("/static/app." + std::to_string(i) + ".js"); break;
+            case 2: r.paths.emplace_back("/unrouted/" + std::to_string(i)); break;
+            default:
+                r.paths.emplace_back("/api/v1/svc" + std::to_string(i % services) + "/items/" +
+                                     std::to_string(i));
+                break;
+        }
+    }
+}
+
+uint64_t db_pool_fn(void* arg, uint64_t iters) {
+    auto* pool = static_cast<DatabasePool*>(arg);
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < iters; i++) {
+        auto conn = pool->acquire(DB_QUERY_WRITE);
+        if (!conn) continue;
+        sum += static_cast<uint64_t>(conn.value()->fd());
+        pool->release(std::move(conn.value()));
+    }
+    return sum;
+}
+
+uint64_t db_pool_read_fn(void* arg, uint64_t iters) {
+    auto* pool = static_cast<DatabasePool*>(arg);
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < iters; i++) {
+        auto conn = pool->acquire(DB_QUERY_READ);
+        if (!conn) continue;
+        sum += static_cast<uint64_t>(conn.value()->fd());
+        pool->release(std::move(conn.value()));
+    }
+    return sum;
+}
+
+}  // namespace
+
+extern "C" void bench_cxx_router(bench_t* b) {
+    const uint32_t counts[] = {10, 100, 1000};
+    char params[BENCH_NAME_MAX];
+
+    for (uint32_t n : counts) {
+        std::snprintf(params, sizeof(params), "routes=%u", n + 3);
+        if (!bench_selected(b, "RequestRouter::route_request", params)) continue;
+
+        auto r = std::make_unique<RouterBench>();
+        router_setup(*r, n);
+        bench_run(b, "RequestRouter::route_request", params, router_fn, r.get());
+    }
+}
+
+extern "C" void bench_cxx_db_pool(bench_t* b) {
+    if (!bench_selected(b, "DatabasePool::acquire", "write,primary=1") &&
+        !bench_selected(b, "DatabasePool::acquire", "read,replicas=4"))
+        return;
+
+    // Connects complete in the listen backlog, so nothing has to accept
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in sa{};
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t salen = sizeof(sa);
+    if (lfd < 0 || bind(lfd, reinterpret_cast<sockaddr*>(&sa), sizeof(sa)) < 0 ||
+        listen(lfd, 128) < 0 || getsockname(lfd, reinterpret_cast<sockaddr*>(&sa), &salen) < 0) {
+        std::perror("DatabasePool bench listener");
+        if (lfd >= 0) close(lfd);
+        return;
+    }
+    uint16_t port = ntohs(sa.sin_port);
+
+    {
+        DatabasePool pool(64, 0, 64, std::chrono::seconds(3600), std::chrono::seconds(600));
+        (void)pool.add_backend("127.0.0.1", port, BackendRole::Primary, DB_PROTOCOL_POSTGRESQL);
+        for (int i = 0; i < 4; i++)
+            (void)pool.add_backend("127.0.0.1", port, BackendRole::Replica, DB_PROTOCOL_POSTGRESQL);
+
+        bench_run(b, "DatabasePool::acquire", "write,primary=1", db_pool_fn, &pool);
+        bench_run(b, "DatabasePool::acquire", "read,replicas=4", db_pool_read_fn, &pool);
+    }
+    close(lfd);
+}
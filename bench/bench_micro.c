@@ -0,0 +1,356 @@
+#include "bench.h"
+#include "core/loadbalancer.h"
+#include "core/lb_memory.h"
+#include "core/lb_clock.h"
+#include "core/lb_rcu.h"
+#include "http/http.h"
+#include "cache/cache.h"
+#include "stick_tables.h"
+#include "utils/buffer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+
+#define BENCH_KEYS 4096     // a power of two, keys are picked with a mask
+
+static const uint32_t bench_backend_counts[] = { 10, 100, 1000, 4096 };
+
+static const struct {
+    lb_algorithm_t algo;
+    const char *name;
+} bench_algos[] = {
+    { LB_ALGO_ROUNDROBIN,     "roundrobin" },
+    { LB_ALGO_LEASTCONN,      "leastconn" },
+    { LB_ALGO_LEASTCONN_P2C,  "leastconn_p2c" },
+    { LB_ALGO_PEAK_EWMA,      "peak_ewma" },
+    { LB_ALGO_SOURCE,         "source" },
+    { LB_ALGO_STICKY,         "weighted" },
+    { LB_ALGO_RANDOM,         "random" },
+};
+
+// --- lb_select_backend ---
+
+// Every backend UP with a spread of weights and open connections, and
+// the tables that the hash and weighted algorithms read already built
+static loadbalancer_t *bench_lb_new(lb_algorithm_t algo, uint32_t n) {
+    loadbalancer_t *lb = calloc(1, sizeof(*lb));
+    if (!lb) return NULL;
+    lb->algorithm = algo;
+
+    char host[32];
+    for (uint32_t i = 0; i < n; i++) {
+        snprintf(host, sizeof(host), "10.%u.%u.%u", i >> 16, (i >> 8) & 255, i & 255);
+        if (lb_add_backend(lb, host, 80, 1 + i % 4) < 0) break;
+        backend_t *b = lb->backends[i];
+        lb_backend_set_state(lb, b, BACKEND_UP);
+        for (uint32_t c = 0; c < i % 8; c++)
+            lb_backend_conn_get(lb, b);
+        lb_backend_observe_latency(b, 100000 + (i * 7919u) % 900000, lb_now_ns());
+    }
+
+    if (algo == LB_ALGO_SOURCE) {
+        consistent_hash_t *ch = consistent_hash_create(MAGLEV_DEFAULT_SIZE);
+        for (uint32_t i = 0; ch && i < lb->backend_count; i++)
+            consistent_hash_add(ch, lb->backends[i]);
+        if (ch) consistent_hash_sync(ch);
+        lb->consistent_hash = ch;
+    } else if (algo == LB_ALGO_STICKY) {
+        lb->wrr = lb_wrr_create();
+        if (lb->wrr) lb_wrr_sync(lb->wrr, lb->backends, lb->backend_count);
+    }
+    return lb;
+}
+
+static void bench_lb_free(loadbalancer_t *lb) {
+    consistent_hash_destroy(lb->consistent_hash);
+    lb_wrr_destroy(lb->wrr);
+    for (uint32_t i = 0; i < lb->backend_count; i++) {
+        pthread_spin_destroy(&lb->backends[i]->lock);
+        free(lb->backends[i]);
+    }
+    free(lb);
+}
+
+static uint64_t bench_select_fn(void *arg, uint64_t iters) {
+    loadbalancer_t *lb = arg;
+    struct sockaddr_in addr = { .sin_family = AF_INET };
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < iters; i++) {
+        addr.sin_addr.s_addr = (uint32_t)(i * 2654435761u);
+        sum += (uintptr_t)lb_select_backend(lb, &addr);
+    }
+    lb_rcu_quiescent();
+    return sum;
+}
+
+static void bench_select(bench_t *b) {
+    char params[BENCH_NAME_MAX];
+    for (size_t a = 0; a < sizeof(bench_algos) / sizeof(bench_algos[0]); a++) {
+        for (size_t c = 0; c < sizeof(bench_backend_counts) / sizeof(bench_backend_counts[0]); c++) {
+            snprintf(params, sizeof(params), "%s,backends=%u", bench_algos[a].name,
+                     bench_backend_counts[c]);
+            if (!bench_selected(b, "lb_select_backend", params)) continue;
+
+            loadbalancer_t *lb = bench_lb_new(bench_algos[a].algo, bench_backend_counts[c]);
+            if (!lb) continue;
+            bench_run(b, "lb_select_backend", params, bench_select_fn, lb);
+            bench_lb_free(lb);
+        }
+    }
+}
+
+// --- consistent_hash_get ---
+
+typedef struct {
+    consistent_hash_t *ch;
+    char keys[BENCH_KEYS][24];
+} bench_chash_t;
+
+static uint64_t bench_chash_fn(void *arg, uint64_t iters) {
+    bench_chash_t *c = arg;
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < iters; i++)
+        sum += (uintptr_t)consistent_hash_get(c->ch, c->keys[i & (BENCH_KEYS - 1)]);
+    lb_rcu_quiescent();
+    return sum;
+}
+
+static void bench_chash(bench_t *b) {
+    static backend_t backends[1000];
+    static bench_chash_t c;
+    const uint32_t counts[] = { 10, 100, 1000 };
+    char params[BENCH_NAME_MAX];
+
+    for (uint32_t k = 0; k < BENCH_KEYS; k++)
+        snprintf(c.keys[k], sizeof(c.keys[k]), "session-%08x", k * 2654435761u);
+
+    for (size_t n = 0; n < sizeof(counts) / sizeof(counts[0]); n++) {
+        snprintf(params, sizeof(params), "backends=%u", counts[n]);
+        if (!bench_selected(b, "consistent_hash_get", params)) continue;
+
+        c.ch = consistent_hash_create(MAGLEV_DEFAULT_SIZE);
+        if (!c.ch) continue;
+        for (uint32_t i = 0; i < counts[n]; i++) {
+            memset(&backends[i], 0, sizeof(backends[i]));
+            snprintf(backends[i].host, sizeof(backends[i].host), "10.1.%u.%u", i >> 8, i & 255);
+            backends[i].port = 80;
+            backends[i].weight = 1;
+            backends[i].state = BACKEND_UP;
+            consistent_hash_add(c.ch, &backends[i]);
+        }
+        consistent_hash_sync(c.ch);
+        bench_run(b, "consistent_hash_get", params, bench_chash_fn, &c);
+        consistent_hash_destroy(c.ch);
+    }
+}
+
+// --- HTTP parsing ---
+
+typedef struct {
+    char req[8192];
+    struct buffer buf;
+    http_msg_t msg;
+    int64_t hdr_start;
+} bench_http_t;
+
+static void bench_http_init(bench_http_t *h, int extra) {
+    int len = snprintf(h->req, sizeof(h->req),
+                       "GET /api/v1/products/8812?view=full&lang=en HTTP/1.1\r\n"
+                       "Host: shop.example.com\r\n"
+                       "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"
+                       "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+                       "Accept-Language: en-US,en;q=0.5\r\n"
+                       "Accept-Encoding: gzip, deflate, br\r\n"
+                       "Referer: https://shop.example.com/catalog\r\n"
+                       "Cookie: session=7f3a9c2e41b8d6f0; theme=dark; cart=3\r\n"
+                       "Connection: keep-alive\r\n"
+                       "Upgrade-Insecure-Requests: 1\r\n"
+                       "Cache-Control: max-age=0\r\n"
+                       "X-Request-Id: 5b8e7c1d-2f4a-4e6b-9c3d-8a1f0e2b7d64\r\n");
+    for (int i = 0; i < extra; i++)
+        len += snprintf(h->req + len, sizeof(h->req) - len, "X-Trace-%d: hop-%d\r\n", i, i);
+    len += snprintf(h->req + len, sizeof(h->req) - len, "\r\n");
+
+    h->buf = (struct buffer){ .area = h->req, .size = sizeof(h->req), .data = (size_t)len };
+    memset(&h->msg, 0, sizeof(h->msg));
+    http_msg_reset(&h->msg);
+    http_parse_request_line(&h->msg, h->buf.area, h->buf.data);
+    h->hdr_start = h->msg.next;
+}
+
+static uint64_t bench_http_headers_fn(void *arg, uint64_t iters) {
+    bench_http_t *h = arg;
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < iters; i++) {
+        http_msg_reset(&h->msg);
+        h->msg.next = h->hdr_start;
+        h->msg.msg_state = HTTP_MSG_HDR_FIRST;
+        sum += http_parse_headers(&h->msg, &h->buf) + h->msg.hdr_count;
+    }
+    return sum;
+}
+
+static uint64_t bench_http_msg_fn(void *arg, uint64_t iters) {
+    bench_http_t *h = arg;
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < iters; i++) {
+        http_msg_reset(&h->msg);
+        sum += http_msg_analyzer(&h->msg, &h->buf) + h->msg.hdr_count;
+    }
+    return sum;
+}
+
+static void bench_http(bench_t *b) {
+    static bench_http_t h;
+    const int extras[] = { 0, 40 };     // 11 headers, and enough to spill
+    char params[BENCH_NAME_MAX];
+
+    for (size_t i = 0; i < sizeof(extras) / sizeof(extras[0]); i++) {
+        bench_http_init(&h, extras[i]);
+        snprintf(params, sizeof(params), "headers=%d,bytes=%zu", 11 + extras[i], h.buf.data);
+        bench_run(b, "http_parse_headers", params, bench_http_headers_fn, &h);
+        bench_run(b, "http_msg_analyzer", params, bench_http_msg_fn, &h);
+        http_msg_release(&h.msg);
+    }
+}
+
+// --- cache_lookup ---
+
+typedef struct {
+    cache_t *cache;
+    char keys[BENCH_KEYS][32];
+} bench_cache_t;
+
+static uint64_t bench_cache_fn(void *arg, uint64_t iters) {
+    bench_cache_t *c = arg;
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < iters; i++)
+        sum += (uintptr_t)cache_lookup(c->cache, c->keys[(i * 7) & (BENCH_KEYS - 1)]);
+    lb_rcu_quiescent();
+    return sum;
+}
+
+static void bench_cache(bench_t *b) {
+    if (!bench_selected(b, "cache_lookup", "entries=4096,hit") &&
+        !bench_selected(b, "cache_lookup", "entries=4096,miss"))
+        return;
+
+    static bench_cache_t c;
+    static char body[512];
+    c.cache = cache_create("bench", 64u << 20, 4096);
+    if (!c.cache) return;
+
+    for (uint32_t k = 0; k < BENCH_KEYS; k++) {
+        snprintf(c.keys[k], sizeof(c.keys[k]), "/static/img/%u.png", k);
+        cache_key_t key;
+        cache_key_str(&key, c.keys[k]);
+        cache_entry_t *e = cache_entry_new();
+        if (!e || cache_entry_set_data(c.cache, e, &key, body, sizeof(body)) < 0 ||
+            cache_insert(c.cache, c.keys[k], e) < 0) {
+            if (e) cache_entry_put(e);
+        }
+    }
+    bench_run(b, "cache_lookup", "entries=4096,hit", bench_cache_fn, &c);
+
+    for (uint32_t k = 0; k < BENCH_KEYS; k++)
+        snprintf(c.keys[k], sizeof(c.keys[k]), "/static/css/%u.css", k);
+    bench_run(b, "cache_lookup", "entries=4096,miss", bench_cache_fn, &c);
+
+    cache_destroy(c.cache);
+    lb_rcu_reclaim();
+}
+
+// --- stktable_lookup ---
+
+typedef struct {
+    stick_table_t *t;
+    uint32_t count;
+} bench_stk_t;
+
+static uint64_t bench_stk_fn(void *arg, uint64_t iters) {
+    bench_stk_t *s = arg;
+    stick_key_t key = { .type = STKTABLE_TYPE_IP };
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < iters; i++) {
+        key.data.ipv4.s_addr = htonl(0x0a000000u + (uint32_t)((i * 2654435761u) % s->count));
+        sum += (uintptr_t)stktable_lookup(s->t, &key);
+    }
+    lb_rcu_quiescent();
+    return sum;
+}
+
+static void bench_stktable(bench_t *b) {
+    const uint32_t counts[] = { 1000, 100000 };
+    char params[BENCH_NAME_MAX];
+
+    for (size_t n = 0; n < sizeof(counts) / sizeof(counts[0]); n++) {
+        snprintf(params, sizeof(params), "ip,entries=%u", counts[n]);
+        if (!bench_selected(b, "stktable_lookup", params)) continue;
+
+        bench_stk_t s = { .count = counts[n] };
+        s.t = stktable_new("bench", STKTABLE_TYPE_IP, counts[n] * 2, 3600 * 1000);
+        if (!s.t) continue;
+        stick_key_t key = { .type = STKTABLE_TYPE_IP };
+        for (uint32_t i = 0; i < counts[n]; i++) {
+            key.data.ipv4.s_addr = htonl(0x0a000000u + i);
+            stktable_get(s.t, &key);
+        }
+        bench_run(b, "stktable_lookup", params, bench_stk_fn, &s);
+        stktable_free(s.t);
+        lb_rcu_reclaim();
+    }
+}
+
+static void bench_usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-o results.json] [-f filter] [-d ms] [-q]\n"
+            "  -o FILE    write the results as JSON to FILE\n"
+            "  -f TEXT    only run benchmarks whose name/params contain TEXT\n"
+            "  -d MS      time spent measuring each benchmark (default %d)\n"
+            "  -q         no per-benchmark output\n",
+            prog, BENCH_DEFAULT_MS);
+}
+
+int main(int argc, char **argv) {
+    bench_t b;
+    bench_init(&b);
+    const char *out = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "o:f:d:qh")) != -1) {
+        switch (opt) {
+            case 'o': out = optarg; break;
+            case 'f': b.filter = optarg; break;
+            case 'd': b.duration_ms = (uint32_t)atoi(optarg); break;
+            case 'q': b.quiet = true; break;
+            default:
+                bench_usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    // Workers are RCU readers and so is this thread; tables read here
+    // stay put until the quiescent state at the end of each batch
+    lb_rcu_register();
+
+    bench_select(&b);
+    bench_chash(&b);
+    bench_http(&b);
+    bench_cache(&b);
+    bench_stktable(&b);
+    bench_cxx_router(&b);
+    bench_cxx_db_pool(&b);
+
+    lb_rcu_unregister();
+
+    int rc = 0;
+    if (out && bench_write_json(&b, out) < 0) {
+        perror(out);
+        rc = 1;
+    } else if (out && !b.quiet) {
+        printf("Results written to %s (%zu benchmarks)\n", out, b.count);
+    }
+    bench_free(&b);
+    return rc;
+}
@@ -0,0 +1,320 @@
+// Backend for load tests: answers every HTTP request with a fixed
+// response, or echoes TCP bytes back. One epoll loop per thread, each on
+// its own SO_REUSEPORT listener, so the kernel spreads connections and
+// threads share nothing.
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define ECHO_BUF        16384
+#define ECHO_EVENTS     256
+
+typedef enum { ECHO_HTTP, ECHO_TCP } echo_mode_t;
+
+typedef struct {
+    const char *bind_addr;
+    uint16_t port;
+    int threads;
+    echo_mode_t mode;
+    size_t body_size;
+} echo_opts_t;
+
+typedef struct {
+    int fd;
+    bool close_after;
+    size_t in_len;              // HTTP: bytes of an incomplete request
+    uint64_t body_left;         // HTTP: request body still to skip
+    uint64_t out_left;          // bytes of responses not yet sent
+    size_t out_off;             // HTTP: offset into the response
+    char buf[ECHO_BUF];         // HTTP: request head; TCP: unsent echo
+} echo_conn_t;
+
+static echo_opts_t opts = {
+    .bind_addr = "0.0.0.0",
+    .port = 9000,
+    .threads = 4,
+    .mode = ECHO_HTTP,
+    .body_size = 128,
+};
+
+static char *echo_response;
+static size_t echo_response_len;
+static atomic_bool echo_stop;
+
+static void echo_on_signal(int sig) {
+    (void)sig;
+    atomic_store(&echo_stop, true);
+}
+
+static int echo_listen(void) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+
+    struct sockaddr_in sa = { .sin_family = AF_INET, .sin_port = htons(opts.port) };
+    if (inet_pton(AF_INET, opts.bind_addr, &sa.sin_addr) != 1 ||
+        bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 || listen(fd, 4096) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void echo_close(echo_conn_t *c) {
+    close(c->fd);
+    free(c);
+}
+
+// Sends queued responses, cycling through the one prebuilt response.
+// Returns 1 when everything went out, 0 when the socket is full.
+static int echo_flush_http(echo_conn_t *c) {
+    while (c->out_left) {
+        size_t chunk = echo_response_len - c->out_off;
+        if (chunk > c->out_left) chunk = c->out_left;
+        ssize_t n = send(c->fd, echo_response + c->out_off, chunk, MSG_NOSIGNAL);
+        if (n < 0) return errno == EAGAIN ? 0 : -1;
+        c->out_left -= n;
+        c->out_off = (c->out_off + n) % echo_response_len;
+    }
+    return 1;
+}
+
+static int echo_flush_tcp(echo_conn_t *c) {
+    while (c->out_left) {
+        ssize_t n = send(c->fd, c->buf + c->out_off, c->out_left, MSG_NOSIGNAL);
+        if (n < 0) return errno == EAGAIN ? 0 : -1;
+        c->out_left -= n;
+        c->out_off += n;
+    }
+    c->out_off = 0;
+    return 1;
+}
+
+static uint64_t echo_content_length(const char *head, size_t len) {
+    const char *p = head;
+    const char *end = head + len;
+    while (p < end) {
+        const char *eol = memchr(p, '\n', end - p);
+        if (!eol) break;
+        if (eol - p > 15 && strncasecmp(p, "content-length:", 15) == 0)
+            return strtoull(p + 15, NULL, 10);
+        p = eol + 1;
+    }
+    return 0;
+}
+
+static bool echo_wants_close(const char *head, size_t len) {
+    const char *p = head;
+    const char *end = head + len;
+    while (p < end) {
+        const char *eol = memchr(p, '\n', end - p);
+        if (!eol) break;
+        if (eol - p > 11 && strncasecmp(p, "connection:", 11) == 0) {
+            const char *v = p + 11;
+            while (*v == ' ') v++;
+            return strncasecmp(v, "close", 5) == 0;
+        }
+        p = eol + 1;
+    }
+    return false;
+}
+
+// Counts the complete requests in what arrived, pipelined or not; each
+// gets one response
+static int echo_consume_http(echo_conn_t *c, const char *data, size_t len) {
+    while (len) {
+        if (c->body_left) {
+            size_t n = len < c->body_left ? len : c->body_left;
+            c->body_left -= n;
+            data += n;
+            len -= n;
+            continue;
+        }
+
+        size_t room = sizeof(c->buf) - c->in_len;
+        size_t take = len < room ? len : room;
+        memcpy(c->buf + c->in_len, data, take);
+        size_t old = c->in_len;
+        c->in_len += take;
+
+        // A head that ended inside the bytes looked at before cannot
+        // end again, so only the new bytes plus three of context matter
+        size_t from = old > 3 ? old - 3 : 0;
+        char *hend = memmem(c->buf + from, c->in_len - from, "\r\n\r\n", 4);
+        if (!hend) {
+            if (c->in_len == sizeof(c->buf)) return -1;     // head too large
+            return 0;
+        }
+
+        size_t head_len = hend + 4 - c->buf;
+        c->body_left = echo_content_length(c->buf, head_len);
+        if (echo_wants_close(c->buf, head_len)) c->close_after = true;
+        c->out_left += echo_response_len;
+
+        size_t used = head_len - old;
+        c->in_len = 0;
+        data += used;
+        len -= used;
+        if (c->close_after) break;
+    }
+    return 0;
+}
+
+static void echo_set_events(int epfd, echo_conn_t *c, uint32_t events) {
+    struct epoll_event ev = { .events = events, .data.ptr = c };
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+static void echo_on_event(int epfd, echo_conn_t *c, uint32_t events) {
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        echo_close(c);
+        return;
+    }
+
+    if (opts.mode == ECHO_TCP) {
+        // Nothing is read while an echo is still going out
+        int rc = echo_flush_tcp(c);
+        if (rc < 0) { echo_close(c); return; }
+        if (rc == 0) { echo_set_events(epfd, c, EPOLLOUT); return; }
+
+        ssize_t n = recv(c->fd, c->buf, sizeof(c->buf), 0);
+        if (n == 0 || (n < 0 && errno != EAGAIN)) { echo_close(c); return; }
+        if (n > 0) {
+            c->out_left = n;
+            rc = echo_flush_tcp(c);
+            if (rc < 0) { echo_close(c); return; }
+        }
+        echo_set_events(epfd, c, c->out_left ? EPOLLOUT : EPOLLIN);
+        return;
+    }
+
+    char data[ECHO_BUF];
+    while (!c->close_after) {
+        ssize_t n = recv(c->fd, data, sizeof(data), 0);
+        if (n == 0 || (n < 0 && errno != EAGAIN)) { echo_close(c); return; }
+        if (n < 0) break;
+        if (echo_consume_http(c, data, n) < 0) { echo_close(c); return; }
+        if ((size_t)n < sizeof(data)) break;
+    }
+
+    int rc = echo_flush_http(c);
+    if (rc < 0 || (rc == 1 && c->close_after)) { echo_close(c); return; }
+    echo_set_events(epfd, c, rc ? EPOLLIN : EPOLLIN | EPOLLOUT);
+}
+
+static void echo_accept(int epfd, int lfd) {
+    for (;;) {
+        int fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        echo_conn_t *c = calloc(1, sizeof(*c));
+        if (!c) { close(fd); continue; }
+        c->fd = fd;
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) echo_close(c);
+    }
+}
+
+static void *echo_thread(void *arg) {
+    (void)arg;
+    int lfd = echo_listen();
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (lfd < 0 || epfd < 0) {
+        perror("lb_echo: listen");
+        exit(1);
+    }
+
+    // The listener is told apart by a NULL pointer
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev);
+
+    struct epoll_event events[ECHO_EVENTS];
+    while (!atomic_load(&echo_stop)) {
+        int n = epoll_wait(epfd, events, ECHO_EVENTS, 200);
+        for (int i = 0; i < n; i++) {
+            if (!events[i].data.ptr) echo_accept(epfd, lfd);
+            else echo_on_event(epfd, events[i].data.ptr, events[i].events);
+        }
+    }
+    close(epfd);
+    close(lfd);
+    return NULL;
+}
+
+static void echo_usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-b addr] [-p port] [-t threads] [-m http|tcp] [-s body_bytes]\n"
+            "  -b ADDR    address to bind (default %s)\n"
+            "  -p PORT    port to listen on (default %u)\n"
+            "  -t N       event loop threads (default %d)\n"
+            "  -m MODE    http: fixed 200 response; tcp: echo bytes back (default http)\n"
+            "  -s BYTES   HTTP response body size (default %zu)\n",
+            prog, opts.bind_addr, opts.port, opts.threads, opts.body_size);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "b:p:t:m:s:h")) != -1) {
+        switch (opt) {
+            case 'b': opts.bind_addr = optarg; break;
+            case 'p': opts.port = (uint16_t)atoi(optarg); break;
+            case 't': opts.threads = atoi(optarg); break;
+            case 'm':
+                if (strcmp(optarg, "http") == 0) opts.mode = ECHO_HTTP;
+                else if (strcmp(optarg, "tcp") == 0) opts.mode = ECHO_TCP;
+                else { echo_usage(argv[0]); return 1; }
+                break;
+            case 's': opts.body_size = strtoull(optarg, NULL, 10); break;
+            default:
+                echo_usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (opts.threads < 1) opts.threads = 1;
+
+    char head[128];
+    int hlen = snprintf(head, sizeof(head),
+                        "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: %zu\r\n\r\n",
+                        opts.body_size);
+    echo_response_len = hlen + opts.body_size;
+    echo_response = malloc(echo_response_len);
+    if (!echo_response) return 1;
+    memcpy(echo_response, head, hlen);
+    memset(echo_response + hlen, 'x', opts.body_size);
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, echo_on_signal);
+    signal(SIGTERM, echo_on_signal);
+
+    pthread_t *th = calloc(opts.threads, sizeof(*th));
+    for (int i = 0; i < opts.threads; i++)
+        pthread_create(&th[i], NULL, echo_thread, NULL);
+    printf("lb_echo: %s mode on %s:%u, %d threads\n", opts.mode == ECHO_HTTP ? "http" : "tcp",
+           opts.bind_addr, opts.port, opts.threads);
+    fflush(stdout);
+    for (int i = 0; i < opts.threads; i++)
+        pthread_join(th[i], NULL);
+
+    free(th);
+    free(echo_response);
+    return 0;
+}
@@ -0,0 +1,594 @@
+// Closed-loop load generator. Every connection keeps exactly one request
+// in flight and sends the next one only when the previous answer is
+// complete, so the offered load follows the server instead of piling up
+// in socket buffers, and a request's latency is the time from its first
+// byte sent to its last byte received. One epoll loop per thread; every
+// thread keeps its own counters and histogram, and they are merged once
+// at the end.
+#include "bench.h"
+#include <errno.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LG_HEAD_MAX     8192
+#define LG_RBUF         65536
+#define LG_EVENTS       256
+
+typedef enum { LG_HTTP, LG_TCP } lg_mode_t;
+
+typedef enum {
+    LG_CONNECTING,
+    LG_SENDING,
+    LG_RECEIVING,
+} lg_state_t;
+
+typedef struct {
+    int fd;
+    lg_state_t state;
+    uint64_t start_ns;
+    size_t out_off;
+    // HTTP response parsing
+    bool head_done;
+    bool chunked;
+    bool close_after;
+    int status;
+    size_t head_len;
+    uint64_t body_left;
+    uint64_t tail;              // last bytes seen, for the chunked terminator
+    char head[LG_HEAD_MAX];
+    // TCP: echo bytes still expected
+    uint64_t echo_left;
+} lg_conn_t;
+
+typedef struct {
+    int id;
+    pthread_t thread;
+    uint32_t nconns;
+    lg_conn_t *conns;
+    char rbuf[LG_RBUF];
+
+    uint64_t requests;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t connect_errors;
+    uint64_t io_errors;
+    uint64_t parse_errors;
+    uint64_t status[6];         // index = status / 100
+    bench_hist_t hist;
+} lg_thread_t;
+
+static struct {
+    const char *target;
+    const char *path;
+    const char *out;
+    int threads;
+    int conns;
+    double duration_s;
+    double warmup_s;
+    lg_mode_t mode;
+    size_t size;
+} opts = {
+    .path = "/",
+    .threads = 4,
+    .conns = 64,
+    .duration_s = 10,
+    .warmup_s = 1,
+    .mode = LG_HTTP,
+    .size = 64,
+};
+
+static struct sockaddr_storage lg_addr;
+static socklen_t lg_addrlen;
+static char *lg_request;
+static size_t lg_request_len;
+
+// Completions only count while measuring is set; stop ends the loops
+static atomic_bool lg_measuring;
+static atomic_bool lg_stop;
+
+static void lg_on_signal(int sig) {
+    (void)sig;
+    atomic_store(&lg_stop, true);
+}
+
+static void lg_reset_response(lg_conn_t *c) {
+    c->head_done = false;
+    c->chunked = false;
+    c->close_after = false;
+    c->status = 0;
+    c->head_len = 0;
+    c->body_left = 0;
+    c->tail = 0;
+    c->echo_left = lg_request_len;
+}
+
+static int lg_watch(int epfd, lg_conn_t *c, int op, uint32_t events) {
+    struct epoll_event ev = { .events = events, .data.ptr = c };
+    return epoll_ctl(epfd, op, c->fd, &ev);
+}
+
+static int lg_connect(lg_thread_t *t, int epfd, lg_conn_t *c) {
+    c->fd = socket(lg_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c->fd < 0) return -1;
+
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(c->fd, (struct sockaddr *)&lg_addr, lg_addrlen) < 0 && errno != EINPROGRESS) {
+        t->connect_errors++;
+        close(c->fd);
+        c->fd = -1;
+        return -1;
+    }
+    c->state = LG_CONNECTING;
+    return lg_watch(epfd, c, EPOLL_CTL_ADD, EPOLLOUT);
+}
+
+static void lg_reconnect(lg_thread_t *t, int epfd, lg_conn_t *c) {
+    if (c->fd >= 0) close(c->fd);
+    c->fd = -1;
+    // A refused connect is retried by the next loop pass, not spun on
+    if (lg_connect(t, epfd, c) < 0 && c->fd >= 0) {
+        close(c->fd);
+        c->fd = -1;
+    }
+}
+
+// Writes what is left of the request; true when all of it is out
+static int lg_send(lg_thread_t *t, int epfd, lg_conn_t *c) {
+    while (c->out_off < lg_request_len) {
+        ssize_t n = send(c->fd, lg_request + c->out_off, lg_request_len - c->out_off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno != EAGAIN) return -1;
+            // Reads go on while sending, so a peer that answers early
+            // (an echo of a large payload) cannot fill both directions
+            if (c->state != LG_SENDING) {
+                c->state = LG_SENDING;
+                lg_watch(epfd, c, EPOLL_CTL_MOD, EPOLLIN | EPOLLOUT);
+            }
+            return 0;
+        }
+        if (atomic_load_explicit(&lg_measuring, memory_order_relaxed)) t->bytes_out += n;
+        c->out_off += n;
+    }
+    if (c->state != LG_RECEIVING) {
+        c->state = LG_RECEIVING;
+        lg_watch(epfd, c, EPOLL_CTL_MOD, EPOLLIN);
+    }
+    return 1;
+}
+
+static int lg_start_request(lg_thread_t *t, int epfd, lg_conn_t *c) {
+    lg_reset_response(c);
+    c->out_off = 0;
+    c->start_ns = bench_now_ns();
+    return lg_send(t, epfd, c);
+}
+
+static bool lg_header_value(const char *head, size_t len, const char *name, const char **val) {
+    size_t nlen = strlen(name);
+    const char *p = head;
+    const char *end = head + len;
+    while (p < end) {
+        const char *eol = memchr(p, '\n', end - p);
+        if (!eol) break;
+        if ((size_t)(eol - p) > nlen && strncasecmp(p, name, nlen) == 0) {
+            const char *v = p + nlen;
+            while (*v == ' ' || *v == '\t') v++;
+            *val = v;
+            return true;
+        }
+        p = eol + 1;
+    }
+    return false;
+}
+
+// Parses the status line and the headers that decide where the body ends
+static int lg_parse_head(lg_conn_t *c) {
+    if (c->head_len < 12 || strncmp(c->head, "HTTP/1.", 7) != 0) return -1;
+    c->status = atoi(c->head + 9);
+    if (c->status < 100 || c->status > 599) return -1;
+
+    const char *v;
+    if (lg_header_value(c->head, c->head_len, "transfer-encoding:", &v) &&
+        strncasecmp(v, "chunked", 7) == 0)
+        c->chunked = true;
+    else if (lg_header_value(c->head, c->head_len, "content-length:", &v))
+        c->body_left = strtoull(v, NULL, 10);
+    else if (c->status >= 200 && c->status != 204 && c->status != 304)
+        return -1;              // read-until-close bodies do not fit a closed loop
+
+    if (lg_header_value(c->head, c->head_len, "connection:", &v) &&
+        strncasecmp(v, "close", 5) == 0)
+        c->close_after = true;
+    return 0;
+}
+
+// Feeds received bytes to the response; 1 when it is complete
+static int lg_consume_http(lg_conn_t *c, const char *data, size_t len) {
+    if (!c->head_done) {
+        size_t room = sizeof(c->head) - 1 - c->head_len;
+        size_t take = len < room ? len : room;
+        size_t old = c->head_len;
+        memcpy(c->head + c->head_len, data, take);
+        c->head_len += take;
+        c->head[c->head_len] = '\0';
+
+        size_t from = old > 3 ? old - 3 : 0;
+        char *hend = memmem(c->head + from, c->head_len - from, "\r\n\r\n", 4);
+        if (!hend) return c->head_len == sizeof(c->head) - 1 ? -1 : 0;
+
+        size_t used = (size_t)(hend + 4 - c->head) - old;
+        c->head_len = hend + 4 - c->head;
+        c->head_done = true;
+        if (lg_parse_head(c) < 0) return -1;
+        c->tail = 0x0d0a;       // the body starts as if after a chunk
+        data += used;
+        len -= used;
+    }
+
+    if (c->chunked) {
+        // Only the last chunk is looked for: "0\r\n\r\n" after the CRLF
+        // that ends the previous chunk. Chunk data that happens to hold
+        // the same bytes would end the response early, which a benchmark
+        // backend does not send.
+        for (size_t i = 0; i < len; i++) {
+            c->tail = (c->tail << 8) | (uint8_t)data[i];
+            if ((c->tail & 0xffffffffffffffull) == 0x0d0a300d0a0d0aull) return 1;
+        }
+        return 0;
+    }
+
+    if (len >= c->body_left) {
+        c->body_left = 0;
+        return 1;
+    }
+    c->body_left -= len;
+    return 0;
+}
+
+static void lg_complete(lg_thread_t *t, lg_conn_t *c, uint64_t now) {
+    if (!atomic_load_explicit(&lg_measuring, memory_order_relaxed)) return;
+    t->requests++;
+    bench_hist_record(&t->hist, now - c->start_ns);
+    if (opts.mode == LG_HTTP) t->status[c->status / 100]++;
+}
+
+static void lg_on_event(lg_thread_t *t, int epfd, lg_conn_t *c, uint32_t events) {
+    if (c->state == LG_CONNECTING) {
+        int err = 0;
+        socklen_t elen = sizeof(err);
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &elen);
+        if (err || (events & (EPOLLERR | EPOLLHUP))) {
+            t->connect_errors++;
+            close(c->fd);
+            c->fd = -1;
+            return;
+        }
+        if (lg_start_request(t, epfd, c) < 0) goto io_error;
+        return;
+    }
+
+    if (events & EPOLLERR) goto io_error;
+
+    if (c->state == LG_SENDING && (events & EPOLLOUT)) {
+        if (lg_send(t, epfd, c) < 0) goto io_error;
+    }
+    if (!(events & (EPOLLIN | EPOLLHUP))) return;
+
+    for (;;) {
+        ssize_t n = recv(c->fd, t->rbuf, sizeof(t->rbuf), 0);
+        if (n < 0 && errno == EAGAIN) return;
+        if (n <= 0) goto io_error;
+        if (atomic_load_explicit(&lg_measuring, memory_order_relaxed)) t->bytes_in += n;
+
+        int done;
+        if (opts.mode == LG_HTTP) {
+            done = lg_consume_http(c, t->rbuf, n);
+            if (done < 0) {
+                t->parse_errors++;
+                lg_reconnect(t, epfd, c);
+                return;
+            }
+        } else {
+            c->echo_left -= (uint64_t)n < c->echo_left ? (uint64_t)n : c->echo_left;
+            done = c->echo_left == 0;
+        }
+        if (!done) continue;
+
+        lg_complete(t, c, bench_now_ns());
+        // An answer that beat the rest of its request leaves the stream
+        // out of step, so the connection starts over
+        if (c->close_after || c->state == LG_SENDING) {
+            lg_reconnect(t, epfd, c);
+            return;
+        }
+        if (lg_start_request(t, epfd, c) < 0) goto io_error;
+        return;
+    }
+
+io_error:
+    t->io_errors++;
+    lg_reconnect(t, epfd, c);
+}
+
+static void *lg_thread(void *arg) {
+    lg_thread_t *t = arg;
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) return NULL;
+
+    for (uint32_t i = 0; i < t->nconns; i++) {
+        t->conns[i].fd = -1;
+        lg_connect(t, epfd, &t->conns[i]);
+    }
+
+    struct epoll_event events[LG_EVENTS];
+    uint64_t last_retry = bench_now_ns();
+    while (!atomic_load(&lg_stop)) {
+        int n = epoll_wait(epfd, events, LG_EVENTS, 50);
+        for (int i = 0; i < n; i++)
+            lg_on_event(t, epfd, events[i].data.ptr, events[i].events);
+
+        // Connections that failed are retried at most every 100ms
+        uint64_t now = bench_now_ns();
+        if (now - last_retry > 100000000ull) {
+            last_retry = now;
+            for (uint32_t i = 0; i < t->nconns; i++)
+                if (t->conns[i].fd < 0) lg_connect(t, epfd, &t->conns[i]);
+        }
+    }
+
+    for (uint32_t i = 0; i < t->nconns; i++)
+        if (t->conns[i].fd >= 0) close(t->conns[i].fd);
+    close(epfd);
+    return NULL;
+}
+
+static int lg_resolve(const char *target) {
+    char host[256];
+    const char *colon = strrchr(target, ':');
+    if (!colon || colon == target || (size_t)(colon - target) >= sizeof(host)) return -1;
+    memcpy(host, target, colon - target);
+    host[colon - target] = '\0';
+
+    // [::1]:80 style literals
+    char *h = host;
+    size_t hl = strlen(h);
+    if (h[0] == '[' && h[hl - 1] == ']') {
+        h[hl - 1] = '\0';
+        h++;
+    }
+
+    struct addrinfo hints = { .ai_socktype = SOCK_STREAM }, *res;
+    if (getaddrinfo(h, colon + 1, &hints, &res) != 0) return -1;
+    memcpy(&lg_addr, res->ai_addr, res->ai_addrlen);
+    lg_addrlen = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
+
+static int lg_build_request(void) {
+    if (opts.mode == LG_TCP) {
+        lg_request_len = opts.size ? opts.size : 1;
+        lg_request = malloc(lg_request_len);
+        if (!lg_request) return -1;
+        for (size_t i = 0; i < lg_request_len; i++)
+            lg_request[i] = (char)('a' + i % 26);
+        return 0;
+    }
+
+    const char *colon = strrchr(opts.target, ':');
+    int hostlen = (int)(colon - opts.target);
+    size_t cap = strlen(opts.path) + hostlen + 128;
+    lg_request = malloc(cap);
+    if (!lg_request) return -1;
+    lg_request_len = snprintf(lg_request, cap,
+                              "GET %s HTTP/1.1\r\nHost: %.*s\r\nUser-Agent: lb_loadgen\r\n\r\n",
+                              opts.path, hostlen, opts.target);
+    return 0;
+}
+
+static void lg_sleep(double seconds) {
+    uint64_t end = bench_now_ns() + (uint64_t)(seconds * 1e9);
+    while (!atomic_load(&lg_stop)) {
+        uint64_t now = bench_now_ns();
+        if (now >= end) break;
+        uint64_t left = end - now;
+        if (left > 100000000ull) left = 100000000ull;
+        struct timespec ts = { .tv_sec = 0, .tv_nsec = (long)left };
+        nanosleep(&ts, NULL);
+    }
+}
+
+typedef struct {
+    uint64_t requests, bytes_in, bytes_out;
+    uint64_t connect_errors, io_errors, parse_errors;
+    uint64_t status[6];
+    bench_hist_t hist;
+} lg_totals_t;
+
+static const double lg_pcts[] = { 50, 75, 90, 99, 99.9, 99.99 };
+static const char *const lg_pct_names[] = { "p50", "p75", "p90", "p99", "p999", "p9999" };
+#define LG_NPCTS (sizeof(lg_pcts) / sizeof(lg_pcts[0]))
+
+static int lg_write_json(const lg_totals_t *tot, double elapsed) {
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", opts.out);
+    FILE *f = fopen(tmp, "w");
+    if (!f) return -1;
+
+    const bench_hist_t *h = &tot->hist;
+    fprintf(f, "{\n");
+    bench_json_meta(f, "loadgen");
+    fprintf(f, ",\n  \"target\": \"%s\",\n  \"mode\": \"%s\",\n", opts.target,
+            opts.mode == LG_HTTP ? "http" : "tcp");
+    if (opts.mode == LG_HTTP) fprintf(f, "  \"path\": \"%s\",\n", opts.path);
+    else fprintf(f, "  \"size\": %zu,\n", opts.size);
+    fprintf(f, "  \"threads\": %d,\n  \"connections\": %d,\n  \"duration_s\": %.3f,\n",
+            opts.threads, opts.conns, elapsed);
+    fprintf(f, "  \"requests\": %llu,\n  \"requests_per_sec\": %.1f,\n",
+            (unsigned long long)tot->requests, elapsed > 0 ? tot->requests / elapsed : 0);
+    fprintf(f, "  \"bytes_in\": %llu,\n  \"bytes_out\": %llu,\n",
+            (unsigned long long)tot->bytes_in, (unsigned long long)tot->bytes_out);
+    fprintf(f, "  \"errors\": {\"connect\": %llu, \"io\": %llu, \"parse\": %llu},\n",
+            (unsigned long long)tot->connect_errors, (unsigned long long)tot->io_errors,
+            (unsigned long long)tot->parse_errors);
+    if (opts.mode == LG_HTTP)
+        fprintf(f, "  \"status\": {\"1xx\": %llu, \"2xx\": %llu, \"3xx\": %llu, \"4xx\": %llu, \"5xx\": %llu},\n",
+                (unsigned long long)tot->status[1], (unsigned long long)tot->status[2],
+                (unsigned long long)tot->status[3], (unsigned long long)tot->status[4],
+                (unsigned long long)tot->status[5]);
+    fprintf(f, "  \"latency_ns\": {\"min\": %llu, \"mean\": %.0f",
+            (unsigned long long)(h->count ? h->min : 0), h->count ? (double)h->sum / h->count : 0);
+    for (size_t i = 0; i < LG_NPCTS; i++)
+        fprintf(f, ", \"%s\": %llu", lg_pct_names[i],
+                (unsigned long long)bench_hist_percentile(h, lg_pcts[i]));
+    fprintf(f, ", \"max\": %llu}\n}\n", (unsigned long long)h->max);
+
+    if (fclose(f) != 0 || rename(tmp, opts.out) < 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+static void lg_report(const lg_totals_t *tot, double elapsed) {
+    const bench_hist_t *h = &tot->hist;
+    printf("  %llu requests in %.2fs, %.1f MB read, %.1f MB written\n",
+           (unsigned long long)tot->requests, elapsed, tot->bytes_in / 1e6, tot->bytes_out / 1e6);
+    printf("  Requests/sec: %12.1f\n", elapsed > 0 ? tot->requests / elapsed : 0);
+    printf("  Transfer/sec: %12.2f MB in, %.2f MB out\n",
+           elapsed > 0 ? tot->bytes_in / elapsed / 1e6 : 0,
+           elapsed > 0 ? tot->bytes_out / elapsed / 1e6 : 0);
+    printf("  Errors: connect %llu, io %llu, parse %llu\n",
+           (unsigned long long)tot->connect_errors, (unsigned long long)tot->io_errors,
+           (unsigned long long)tot->parse_errors);
+    if (opts.mode == LG_HTTP && tot->requests != tot->status[2])
+        printf("  Non-2xx responses: %llu\n", (unsigned long long)(tot->requests - tot->status[2]));
+
+    printf("  Latency (us):  min %.1f  mean %.1f", (h->count ? h->min : 0) / 1e3,
+           h->count ? (double)h->sum / h->count / 1e3 : 0);
+    printf("  max %.1f\n ", h->max / 1e3);
+    for (size_t i = 0; i < LG_NPCTS; i++)
+        printf(" %s %.1f", lg_pct_names[i], bench_hist_percentile(h, lg_pcts[i]) / 1e3);
+    printf("\n");
+}
+
+static void lg_usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [options] host:port\n"
+            "  -t N       threads (default %d)\n"
+            "  -c N       connections in total, spread over the threads (default %d)\n"
+            "  -d SEC     measured duration (default %.0f)\n"
+            "  -w SEC     warmup before measuring (default %.0f)\n"
+            "  -m MODE    http: GET requests; tcp: payloads echoed back (default http)\n"
+            "  -p PATH    HTTP request path (default %s)\n"
+            "  -s BYTES   TCP payload size (default %zu)\n"
+            "  -o FILE    write results as JSON to FILE\n",
+            prog, opts.threads, opts.conns, opts.duration_s, opts.warmup_s, opts.path, opts.size);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "t:c:d:w:m:p:s:o:h")) != -1) {
+        switch (opt) {
+            case 't': opts.threads = atoi(optarg); break;
+            case 'c': opts.conns = atoi(optarg); break;
+            case 'd': opts.duration_s = atof(optarg); break;
+            case 'w': opts.warmup_s = atof(optarg); break;
+            case 'm':
+                if (strcmp(optarg, "http") == 0) opts.mode = LG_HTTP;
+                else if (strcmp(optarg, "tcp") == 0) opts.mode = LG_TCP;
+                else { lg_usage(argv[0]); return 1; }
+                break;
+            case 'p': opts.path = optarg; break;
+            case 's': opts.size = strtoull(optarg, NULL, 10); break;
+            case 'o': opts.out = optarg; break;
+            default:
+                lg_usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc - 1) {
+        lg_usage(argv[0]);
+        return 1;
+    }
+    opts.target = argv[optind];
+    if (opts.threads < 1) opts.threads = 1;
+    if (opts.conns < opts.threads) opts.conns = opts.threads;
+
+    if (lg_resolve(opts.target) < 0) {
+        fprintf(stderr, "lb_loadgen: cannot resolve %s\n", opts.target);
+        return 1;
+    }
+    if (lg_build_request() < 0) return 1;
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, lg_on_signal);
+    signal(SIGTERM, lg_on_signal);
+
+    printf("Running %.0fs test @ %s (%s), %d threads, %d connections\n", opts.duration_s,
+           opts.target, opts.mode == LG_HTTP ? "http" : "tcp", opts.threads, opts.conns);
+    fflush(stdout);
+
+    lg_thread_t *threads = calloc(opts.threads, sizeof(*threads));
+    if (!threads) return 1;
+    for (int i = 0; i < opts.threads; i++) {
+        lg_thread_t *t = &threads[i];
+        t->id = i;
+        t->nconns = opts.conns / opts.threads + (i < opts.conns % opts.threads);
+        t->conns = calloc(t->nconns, sizeof(*t->conns));
+        if (!t->conns) return 1;
+        bench_hist_reset(&t->hist);
+        pthread_create(&t->thread, NULL, lg_thread, t);
+    }
+
+    lg_sleep(opts.warmup_s);
+    uint64_t start = bench_now_ns();
+    atomic_store(&lg_measuring, true);
+    lg_sleep(opts.duration_s);
+    atomic_store(&lg_measuring, false);
+    double elapsed = (bench_now_ns() - start) / 1e9;
+    atomic_store(&lg_stop, true);
+
+    static lg_totals_t tot;
+    bench_hist_reset(&tot.hist);
+    for (int i = 0; i < opts.threads; i++) {
+        lg_thread_t *t = &threads[i];
+        pthread_join(t->thread, NULL);
+        tot.requests += t->requests;
+        tot.bytes_in += t->bytes_in;
+        tot.bytes_out += t->bytes_out;
+        tot.connect_errors += t->connect_errors;
+        tot.io_errors += t->io_errors;
+        tot.parse_errors += t->parse_errors;
+        for (int s = 0; s < 6; s++) tot.status[s] += t->status[s];
+        bench_hist_merge(&tot.hist, &t->hist);
+        free(t->conns);
+    }
+    free(threads);
+
+    lg_report(&tot, elapsed);
+    int rc = 0;
+    if (opts.out) {
+        if (lg_write_json(&tot, elapsed) < 0) {
+            fprintf(stderr, "lb_loadgen: cannot write %s\n", opts.out);
+            rc = 1;
+        } else {
+            printf("  Results written to %s\n", opts.out);
+        }
+    }
+    free(lg_request);
+    return rc;
+}
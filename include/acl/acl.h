@@ -8,8 +8,12 @@
 #include <pcre.h>
 #endif
 #include <netinet/in.h>
+#ifdef __cplusplus
+#include <atomic>
+#endif
 
 struct session;
+struct acl_lpm;
 struct stream;
 
 #define ACL_TEST_F_VOL_TEST    0x00000001
@@ -33,6 +37,16 @@ struct stream;
 #define ACL_SET_PATH           0x0400
 #define ACL_SET_QUERY          0x0800
 
+// acl_pattern flags
+#define ACL_PAT_F_IPV6         0x0001
+
+// acl_expr flags
+#define ACL_EXPR_F_LPM         0x0001   // IP patterns compiled into expr->lpm
+
+// IP expressions with at least this many patterns, or any "-f" list file,
+// match through a compiled prefix set instead of a pattern scan
+#define ACL_LPM_MIN_PATTERNS   32
+
 typedef enum {
     ACL_MATCH_FOUND,
     ACL_MATCH_BOOL,
@@ -104,6 +118,16 @@ typedef struct acl_expr {
     struct eb_root pattern_tree;
     acl_match_t match_type;
     int flags;
+    uint32_t smp_slot;          // sample cache slot shared by same fetch + args
+    struct list list;           // member of acl->expr_list
+    char **files;               // "-f" pattern files, reread by acl_expr_reload()
+    int file_count;
+    // Published for lock-free matching; readers are RCU readers
+#ifdef __cplusplus
+    std::atomic<struct acl_lpm *> lpm;
+#else
+    struct acl_lpm *_Atomic lpm;
+#endif
     struct acl_expr *next;
 } acl_expr_t;
 
@@ -115,14 +139,60 @@ typedef struct acl {
     struct acl *next;
 } acl_t;
 
+// A condition compiles to a flat program over one boolean register:
+// EXPR sets it from an expression, NOT inverts it, and the jumps skip
+// what can no longer change the outcome, so `a b || c` never evaluates
+// b once a is false, nor c once a and b are true.
+enum acl_opcode {
+    ACL_OP_EXPR,        // r = exprs[arg] matches
+    ACL_OP_SET,         // r = arg
+    ACL_OP_NOT,         // r = !r
+    ACL_OP_JT,          // if r, pc = arg
+    ACL_OP_JF,          // if !r, pc = arg
+    ACL_OP_END          // result is r
+};
+
+typedef struct acl_insn {
+    uint32_t op;
+    uint32_t arg;
+} acl_insn_t;
+
 typedef struct acl_cond {
     struct list suites;
     int requires;
     int use;
     const char *file;
     int line;
+
+    acl_insn_t *code;
+    uint32_t code_len;
+    acl_expr_t **exprs;
+    uint32_t expr_count;
+    struct acl *anon;           // "{ ... }" ACLs owned by this condition
 } acl_cond_t;
 
+// Samples fetched while evaluating a stream's rules, one entry per fetch
+// slot. An entry is valid when its stamp equals gen, so a reset is O(1).
+typedef struct acl_smp_entry {
+    uint32_t stamp;
+    int found;
+    struct sample smp;
+} acl_smp_entry_t;
+
+typedef struct acl_smp_cache {
+    uint32_t gen;
+    uint32_t size;
+    acl_smp_entry_t *ent;
+} acl_smp_cache_t;
+
+// Direction passed to fetches as `opt`
+#define SMP_OPT_DIR_REQ     0
+#define SMP_OPT_DIR_RES     1
+
+// apply_http_*_rules results
+#define ACL_RULES_DENY      0
+#define ACL_RULES_CONT      1
+
 typedef struct http_req_rule {
     struct list list;
     struct acl_cond *cond;
@@ -189,6 +259,10 @@ typedef struct http_res_rule {
             struct sample_expr *expr;
             char *varname;
         } capid;
+        struct {
+            int status;
+            char *reason;
+        } deny;
     } arg;
 } http_res_rule_t;
 
@@ -198,13 +272,40 @@ typedef struct tcp_rule {
     uint16_t action;
 } tcp_rule_t;
 
-acl_t* acl_find(struct list *head, const char *name);
+void acl_init(void);
+
+acl_t* acl_find(acl_t *head, const char *name);
+// Parses "<criterion>[(<arg>,...)] <pattern>..."; the pattern list ends at
+// the first NULL entry or, when nested in a condition, at a "}". For IP
+// criteria, "-f <file>" adds the file's patterns, one per line.
 acl_expr_t* acl_expr_parse(const char **args, char **err);
-acl_cond_t* acl_cond_parse(const char **args, struct list *known_acl, char **err);
+// Appends expr to the named ACL in *head, creating it first if needed.
+// Several lines naming the same ACL are ORed, as in "acl" config lines.
+acl_t* acl_add_expr(acl_t **head, const char *name, acl_expr_t *expr);
+// Compiles "[if|unless] [!]acl ... [|| [!]acl ...]". ACLs side by side
+// are ANDed, "||" (or "or") has the lowest precedence, and
+// "{ <criterion> <pattern>... }" declares an anonymous ACL in place.
+acl_cond_t* acl_cond_parse(const char **args, acl_t *known_acl, char **err);
+void acl_expr_free(acl_expr_t *expr);
 
+// Rereads an IP expression's files into a new prefix set and swaps it in
+// atomically; on error the current set stays. acl_reload() does it for
+// every expression with files and returns how many it reloaded, or -1.
+int acl_expr_reload(acl_expr_t *expr, char **err);
+int acl_reload(acl_t *head, char **err);
+void acl_cond_free(acl_cond_t *cond);
+
+// Returns 1 when cond holds (or is NULL). Samples are memoized in
+// strm->acl_cache, so each fetch runs once per stream however many rules
+// test it; with no stream they are memoized for this call only.
 int acl_exec_cond(acl_cond_t *cond, struct proxy *px, struct session *sess,
                   struct stream *strm, unsigned int opt);
 
+// Forgets the memoized samples, e.g. when the request they came from is
+// rewritten or the stream moves on to its next transaction
+void acl_smp_cache_reset(struct stream *strm);
+void acl_smp_cache_free(struct stream *strm);
+
 int acl_match_str(struct sample *smp, acl_pattern_t *pattern);
 int acl_match_beg(struct sample *smp, acl_pattern_t *pattern);
 int acl_match_end(struct sample *smp, acl_pattern_t *pattern);
@@ -0,0 +1,41 @@
+#ifndef ACL_ACL_LPM_H
+#define ACL_ACL_LPM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <netinet/in.h>
+
+// Compiled IP prefix set for ACLs with large address lists. Prefixes are
+// staged with acl_lpm_add4/6 and acl_lpm_build() then freezes the set;
+// a built set is read-only and may be shared by any number of threads.
+//
+// IPv4 uses DIR-24-8: a 2^24-entry table indexed by the top 24 address
+// bits holds "no match", "match", or the index of a 256-bit bitmap for
+// the low 8 bits, so a lookup is one table read plus at most one bit
+// test. IPv6 uses a multibit trie of 256-way nodes, one address byte per
+// level, so a lookup touches at most 16 nodes. Neither depends on how
+// many prefixes the set holds.
+//
+// ACLs only ask whether any prefix covers an address, so overlapping
+// prefixes merge and no per-prefix value is kept.
+typedef struct acl_lpm acl_lpm_t;
+
+acl_lpm_t *acl_lpm_new(void);
+void acl_lpm_free(acl_lpm_t *lpm);
+
+// Stage a prefix; addresses are in network byte order. Returns 0, or -1
+// on a bad length or allocation failure.
+int acl_lpm_add4(acl_lpm_t *lpm, struct in_addr addr, int len);
+int acl_lpm_add6(acl_lpm_t *lpm, const struct in6_addr *addr, int len);
+
+// Compiles the staged prefixes and drops them. Returns 0 or -1.
+int acl_lpm_build(acl_lpm_t *lpm);
+
+bool acl_lpm_lookup4(const acl_lpm_t *lpm, struct in_addr addr);
+bool acl_lpm_lookup6(const acl_lpm_t *lpm, const struct in6_addr *addr);
+
+// Prefixes added since the set was created
+size_t acl_lpm_count(const acl_lpm_t *lpm);
+
+#endif
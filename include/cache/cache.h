@@ -5,12 +5,18 @@
 #include <stdbool.h>
 #include <time.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <sys/types.h>
 #include <zlib.h>
 #include "core/common.h"
+#include "core/lb_utils.h"
 
 struct stream;
 struct channel;
 struct http_txn;
+struct http_msg;
+struct buffer;
+struct cache_slab;
 
 #define CACHE_F_SHARED        0x00000001
 #define CACHE_F_PRIVATE       0x00000002
@@ -23,16 +29,121 @@ struct http_txn;
 #define CACHE_F_S_MAXAGE      0x00000100
 #define CACHE_F_COMPRESSED    0x00000200
 #define CACHE_F_BROTLI        0x00000400
+#define CACHE_F_SWR           0x00000800
+#define CACHE_F_NEGOTIATED    0x00001000    // identity body; encodings are ours to serve
+
+// cache_check_request() results
+#define CACHE_MISS            0   // go to the backend
+#define CACHE_HIT             1   // send s->cache_hit
+#define CACHE_FILL            2   // go to the backend and store the response; others may park on it
+#define CACHE_PARKED          3   // a fetch is under way: wait for the waker, then send
+                                  // s->cache_hit, or go to the backend if there is none
+#define CACHE_HIT_REFRESH     4   // send s->cache_hit, which is stale, then fetch
+                                  // and store a fresh copy without forwarding it
+
+// Caches are split into CACHE_SHARDS independent shards chosen by the
+// top bits of the key hash. Each shard evicts with S3-FIFO: new objects
+// enter a small FIFO queue (a tenth of the shard) and only move to the
+// main queue if they were hit while there, so a crawl of one-hit objects
+// cycles through the small queue without pushing out the working set.
+// Keys evicted from the small queue are remembered in a ghost table and
+// go straight to the main queue when they come back. A hit only bumps a
+// 2-bit frequency counter; the main queue is a CLOCK that gives each
+// counted hit one more pass.
+//
+// Lookups take no lock. Index chains are read under lb_rcu and removed
+// entries are freed through lb_rcu_retire(), so an entry returned by
+// cache_lookup() stays valid until the caller's next quiescent state.
+// To keep it longer, e.g. while a hit is being sent, take a reference
+// with cache_entry_get() before then; the cache holds one of its own and
+// the object's memory is only released when the last one is put.
+//
+// With a slab attached (cache/cache_slab.h) object data lives in the
+// slab rather than on the heap and cache_entry_send() hands it to the
+// socket with sendfile().
+// Keys are never built as strings on the request path. cache_key_build()
+// feeds method, Host and URI where they lie in the request buffer through
+// a streaming 128-bit murmur3; lookups compare hash and length, and only
+// then the parts against the one text copy an entry keeps. A response
+// with Vary is stored per variant: the entry keeps the Vary list and a
+// hash of the normalized values the request had for it, and a lookup
+// only takes an entry whose variant hash its own request reproduces.
+#define CACHE_KEY_PARTS       3
+
+typedef struct cache_key {
+    uint64_t hash[2];
+    uint32_t len;               // of the text, parts joined by spaces
+    uint32_t nparts;
+    struct {
+        const char *ptr;
+        uint32_t len;
+    } part[CACHE_KEY_PARTS];
+
+    // Request headers Vary is matched against, NULL to take any variant
+    const struct http_msg *msg;
+    const struct buffer *buf;
+
+    lb_hash128_t st;
+} cache_key_t;
+
+#define CACHE_SHARD_BITS      4
+#define CACHE_SHARDS          (1u << CACHE_SHARD_BITS)
+#define CACHE_FREQ_MAX        3
+
+enum cache_queue {
+    CACHE_Q_NONE,
+    CACHE_Q_SMALL,
+    CACHE_Q_MAIN,
+};
+
+// Compressed copies of an identity response, produced once per object:
+// inline when it is stored, or by the cache's compressor thread at a
+// quality too slow for the request path. Each holds a rewritten header
+// block (Content-Encoding, Content-Length, Vary) followed by the encoded
+// body, and is served instead of the identity copy to clients whose
+// Accept-Encoding takes it. Accept-Encoding then no longer splits the
+// object into per-header-value entries.
+enum cache_enc {
+    CACHE_ENC_GZIP,
+    CACHE_ENC_BR,
+    CACHE_ENCS
+};
+
+#define CACHE_COMP_MIN        256     // bodies smaller than this stay identity
+#define CACHE_COMP_GZIP_LEVEL 6       // inline
+#define CACHE_COMP_BR_QUALITY 5
+#define CACHE_COMP_BG_GZIP    9       // compressor thread
+#define CACHE_COMP_BG_BR      11
+
+typedef struct cache_variant {
+    struct {
+        char *ptr;
+        size_t len;
+        size_t alloc;
+    } data;
+    struct cache_slab *slab;
+    uint64_t slab_off;
+} cache_variant_t;
 
 typedef struct cache_entry {
     char *key;
-    uint32_t key_hash;
+    uint32_t key_hash;          // top half of key_h[0]
+    uint32_t key_len;
+    uint64_t key_h[2];
+    uint64_t vary_hash;         // of the request's values for the headers in vary
 
     struct {
         char *ptr;
         size_t len;
         size_t alloc;
     } data;
+    struct cache_slab *slab;    // where data.ptr points, NULL for the heap
+    uint64_t slab_off;
+    uint32_t hdr_len;           // of the header block at the start of data
+
+    // Set once and kept for the entry's life
+    cache_variant_t *_Atomic variants[CACHE_ENCS];
+    struct cache_entry *comp_next;      // compressor queue
 
     struct {
         uint16_t status;
@@ -43,8 +154,8 @@ typedef struct cache_entry {
     uint32_t flags;
     time_t created;
     time_t expires;
-    time_t last_access;
-    uint32_t access_count;
+    time_t stale_until;         // served stale, with one refresh running, until then
+    uint32_t swr;               // stale-while-revalidate from the response
     uint32_t size;
 
     char *etag;
@@ -52,39 +163,89 @@ typedef struct cache_entry {
     char *vary;
 
     pthread_rwlock_t lock;
+    _Atomic uint32_t refs;
+
+    _Atomic uint8_t freq;       // hits since it last moved, capped at CACHE_FREQ_MAX
+    uint8_t queue;              // enum cache_queue
 
-    struct cache_entry *hash_next;
-    struct cache_entry *lru_prev;
-    struct cache_entry *lru_next;
+    struct cache_entry *_Atomic hash_next;
+    struct cache_entry *q_prev; // toward the queue head (newer)
+    struct cache_entry *q_next; // toward the tail (older)
 } cache_entry_t;
 
+typedef struct cache_fifo {
+    cache_entry_t *head;
+    cache_entry_t *tail;
+    uint64_t bytes;
+    uint32_t count;
+} cache_fifo_t;
+
+// A fetch of a missing or stale object. Requests missing the same key
+// meanwhile park on it instead of going to the backend too.
+typedef struct cache_pending {
+    uint64_t key_h[2];
+    struct cache_shard *shard;
+    struct stream *owner;
+    struct stream *waiters;     // linked through cache_wait_next
+    time_t started;
+    struct cache_pending *next;
+} cache_pending_t;
+
+typedef struct cache_shard {
+    pthread_spinlock_t lock;            // writers only
+    uint32_t mask;
+    cache_entry_t *_Atomic *table;
+
+    cache_fifo_t small;
+    cache_fifo_t main;
+    uint64_t max_bytes;
+    uint32_t max_entries;
+
+    uint32_t *ghost;                    // key hashes evicted from small, 0 when free
+    uint32_t ghost_mask;
+
+    cache_pending_t *pending;
+} __attribute__((aligned(64))) cache_shard_t;
+
 typedef struct cache {
     char *name;
     uint32_t max_size;
-    uint32_t current_size;
+    _Atomic uint32_t current_size;
     uint32_t max_object_size;
     uint32_t max_age;
-    uint32_t entry_count;
+    uint32_t stale_while_revalidate;    // default stale window, seconds
+    uint32_t fill_timeout;              // seconds before a fetch stops collapsing misses
+    _Atomic uint32_t entry_count;
     uint32_t max_entries;
 
-    struct {
-        cache_entry_t **table;
-        uint32_t size;
-        uint32_t mask;
-        pthread_spinlock_t *locks;
-    } hash;
+    cache_shard_t *shards;
+    struct cache_slab *slab;
+
+    // Resumes a parked stream; called with a shard locked, so it must
+    // only schedule the stream (possibly on another thread), not run it
+    void (*wake)(struct stream *s);
 
     struct {
-        cache_entry_t *head;
+        pthread_t thread;
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        cache_entry_t *head;            // holding a reference each
         cache_entry_t *tail;
-        pthread_spinlock_t lock;
-    } lru;
+        bool running;
+        bool stop;
+    } comp;
 
     struct {
         _Atomic uint64_t hits;
         _Atomic uint64_t misses;
         _Atomic uint64_t inserts;
         _Atomic uint64_t evictions;
+        _Atomic uint64_t promotions;    // small to main
+        _Atomic uint64_t ghost_hits;
+        _Atomic uint64_t stale_hits;
+        _Atomic uint64_t collapsed;     // misses parked on another's fetch
+        _Atomic uint64_t compressed;    // variants produced
+        _Atomic uint64_t comp_hits;     // hits served a variant
         _Atomic uint64_t bytes_in;
         _Atomic uint64_t bytes_out;
     } stats;
@@ -95,11 +256,31 @@ typedef struct cache {
     struct cache *next;
 } cache_t;
 
+// Streaming response compression. The encoder behind a context comes
+// from a per-thread pool: compression_end() hands it back and the next
+// compression_init() on that thread resets it instead of building one
+// (deflateReset(), ZSTD_CCtx_reset()). Brotli encoders cannot be reset,
+// so theirs allocate from a per-thread cache of freed blocks instead,
+// which a new encoder of the same quality finds at the sizes it needs.
+//
+// With compression_adaptive set, the level asked for is the level when
+// the thread has CPU to spare; as its CPU use over the last
+// COMP_LOAD_PERIOD_MS climbs from COMP_LOAD_LOW to COMP_LOAD_HIGH percent
+// the level drops toward 1, trading ratio for latency under load.
+#define COMP_POOL_MAX           8       // idle encoders kept per type and thread
+#define COMP_BLOCKS_MAX_BYTES   (16u << 20)
+#define COMP_LOAD_PERIOD_MS     100
+#define COMP_LOAD_LOW           70
+#define COMP_LOAD_HIGH          95
+
+typedef struct comp_engine comp_engine_t;
+
+extern bool compression_adaptive;
+
 typedef struct compression_ctx {
     int type;
-    int level;
-    z_stream zstrm;
-    void *brotli_state;
+    int level;                  // in effect, after adapting
+    comp_engine_t *eng;
 
     struct buffer *in;
     struct buffer *out;
@@ -111,11 +292,69 @@ typedef struct compression_ctx {
 cache_t* cache_create(const char *name, uint32_t max_size, uint32_t max_object_size);
 void cache_destroy(cache_t *cache);
 
+void cache_key_init(cache_key_t *key);
+void cache_key_add(cache_key_t *key, const char *ptr, size_t len);
+void cache_key_done(cache_key_t *key);
+// Method, Host and URI of txn, whose headers lie in buf; -1 without a URI
+int cache_key_build(cache_key_t *key, struct http_txn *txn, const struct buffer *buf);
+// A key of one part, for admin and by-name access
+void cache_key_str(cache_key_t *key, const char *str);
+uint64_t cache_vary_hash(const char *vary, const struct http_msg *msg, const struct buffer *buf);
+
+// By-name lookups take any variant and cache_delete() drops them all
 cache_entry_t* cache_lookup(cache_t *cache, const char *key);
 int cache_insert(cache_t *cache, const char *key, cache_entry_t *entry);
+int cache_insert_key(cache_t *cache, const cache_key_t *key, cache_entry_t *entry);
 void cache_delete(cache_t *cache, const char *key);
 void cache_purge(cache_t *cache);
 
+// Stores object data in slab from now on; the slab must outlive the cache
+void cache_set_slab(cache_t *cache, struct cache_slab *slab);
+
+// A new entry holding one reference, for cache_insert() to take over
+cache_entry_t* cache_entry_new(void);
+// Copies the object into the cache's storage, evicting from key's shard
+// if the slab is full; -1 if there is still no room
+int cache_entry_set_data(cache_t *cache, cache_entry_t *entry, const cache_key_t *key,
+                         const void *src, size_t len);
+cache_entry_t* cache_entry_get(cache_entry_t *entry);
+void cache_entry_put(cache_entry_t *entry);
+
+// Produces the missing variants of entry, at the given gzip level and
+// brotli quality; 0 if it now has all it is going to get
+int cache_entry_precompress(cache_t *cache, cache_entry_t *entry, int gzip_level, int br_quality);
+// Moves compression of stored entries to a thread at the background
+// levels; until it reaches them, entries are served identity
+int cache_compressor_start(cache_t *cache);
+void cache_compressor_stop(cache_t *cache);
+// Hands entry to the compressor thread; false if none is running
+bool cache_compressor_queue(cache_t *cache, cache_entry_t *entry);
+// The variant of entry the request behind msg takes, NULL for identity
+const cache_variant_t* cache_pick_variant(cache_entry_t *entry, const struct http_msg *msg,
+                                          const struct buffer *buf);
+
+// Sends the object from *off on, advancing it; like write(), -1 with
+// errno set on error, EAGAIN included
+ssize_t cache_entry_send(cache_entry_t *entry, int fd, size_t *off);
+
+// Without a waker, misses are never parked
+void cache_set_waker(cache_t *cache, void (*wake)(struct stream *s));
+
+// The lookup behind cache_check_request(), by key; returns CACHE_*
+int cache_serve(cache_t *cache, struct stream *s, const cache_key_t *key);
+// Ends the fetch s owns with entry, or NULL if nothing was stored, and
+// wakes the requests parked on it
+void cache_fill_finish(cache_t *cache, struct stream *s, cache_entry_t *entry);
+// Drops whatever s holds in cache: hit, fetch or parking. Call it before
+// freeing a stream that used the cache
+void cache_stream_done(cache_t *cache, struct stream *s);
+
+// Drives the hit cache_check_request() left on s, in the representation
+// picked for it (s->cache_variant): 1 once it is all sent,
+// 0 if fd would block, -1 on error. The reference goes with 1 and -1
+int cache_send_hit(struct stream *s, int fd);
+void cache_release_hit(struct stream *s);
+
 int cache_check_request(struct stream *s, struct channel *req, struct channel *res);
 int cache_check_response(struct stream *s, struct channel *res);
 int cache_store_response(struct stream *s, struct channel *res);
@@ -125,15 +364,19 @@ bool cache_entry_is_fresh(cache_entry_t *entry, time_t now);
 int cache_entry_needs_revalidation(cache_entry_t *entry);
 
 uint32_t cache_hash_key(const char *key);
-char* cache_build_key(struct http_txn *txn);
-char* cache_build_vary_key(struct http_txn *txn, const char *vary);
 
-void cache_update_lru(cache_t *cache, cache_entry_t *entry);
-void cache_evict_lru(cache_t *cache);
 
 int compression_init(compression_ctx_t *ctx, int type, int level);
+// 1 once a COMP_FINISH call has flushed everything, 0 for more, -1 on error
 int compression_process(compression_ctx_t *ctx, struct buffer *in, struct buffer *out, int flags);
 void compression_end(compression_ctx_t *ctx);
+// Frees this thread's pooled encoders and blocks, e.g. before it exits
+void compression_pool_flush(void);
+
+// level scaled for a thread at load percent CPU
+int compression_scale_level(int level, uint32_t load);
+// This thread's CPU use, percent, sampled every COMP_LOAD_PERIOD_MS
+uint32_t compression_thread_load(void);
 
 int compress_http_response(struct stream *s, struct channel *res);
 int decompress_http_response(struct stream *s, struct channel *res);
@@ -0,0 +1,55 @@
+#ifndef CACHE_CACHE_SLAB_H
+#define CACHE_CACHE_SLAB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+// Storage for cached objects in one large shared mapping instead of the
+// heap. The mapping is backed by a file descriptor, so a hit can go to
+// the client with sendfile() straight from the slab, with no copy through
+// user space:
+//   - without a path the backing is a memfd, on hugepages when the system
+//     has them reserved (RAM tier);
+//   - with a path it is that file, e.g. on an NVMe drive (warm tier), and
+//     the page cache decides what stays in memory.
+//
+// The mapping is cut into CACHE_SLAB_PAGE pages. A page is given to one
+// power-of-two size class the first time that class runs out and is never
+// handed back, as in memcached; freed chunks go on their class's free
+// list. Objects larger than a page are not stored.
+#define CACHE_SLAB_PAGE         (1u << 20)
+#define CACHE_SLAB_MIN_SHIFT    8
+#define CACHE_SLAB_CLASSES      (20 - CACHE_SLAB_MIN_SHIFT + 1)
+
+typedef struct cache_slab {
+    int fd;
+    char *base;
+    size_t size;
+    bool hugepages;
+
+    pthread_mutex_t lock;
+    size_t next_page;                           // first page never carved
+    uint64_t free_list[CACHE_SLAB_CLASSES];     // offset + 1 of a free chunk, 0 if none
+
+    struct {
+        uint64_t chunks_used;
+        uint64_t bytes_used;                    // chunk sizes, not object sizes
+        uint64_t alloc_failures;
+    } stats;
+} cache_slab_t;
+
+// size is rounded down to whole pages; NULL on failure
+cache_slab_t* cache_slab_open(const char *path, size_t size);
+void cache_slab_close(cache_slab_t *slab);
+
+// Offset of a chunk holding at least len bytes, or -1 when full
+int64_t cache_slab_alloc(cache_slab_t *slab, size_t len);
+void cache_slab_free(cache_slab_t *slab, uint64_t off, size_t len);
+
+static inline void* cache_slab_ptr(cache_slab_t *slab, uint64_t off) {
+    return slab->base + off;
+}
+
+#endif
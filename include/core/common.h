@@ -172,6 +172,8 @@ static inline unsigned int tick_add(unsigned int t, unsigned int d) {
 #define COMP_TYPE_GZIP      1
 #define COMP_TYPE_DEFLATE   2
 #define COMP_TYPE_BROTLI    3
+#define COMP_TYPE_ZSTD      4       // with USE_ZSTD
+#define COMP_TYPES          5
 
 #define COMP_FINISH         1
 
@@ -0,0 +1,137 @@
+#ifndef LB_ALLOC_H
+#define LB_ALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Size-classed allocator for the data path. Sizes up to LB_ALLOC_SMALL_MAX
+// round up to one of LB_ALLOC_CLASSES classes: 16-byte steps to 128, then
+// four per power of two, so rounding wastes at most 25%. Each thread keeps
+// a free list per class and allocates and frees on it without locking or
+// atomics. A list that runs dry takes a batch of objects from the class's
+// central pool, and one that grows past two batches hands a batch back,
+// so the central lock is taken once per batch rather than per object.
+// A thread's lists return to the central pools when it exits.
+//
+// Central pools and the region being carved are kept per NUMA node, and
+// a thread uses those of the node lb_alloc_set_node() gave it (node 0
+// until then), so a batch one worker hands back only goes to workers on
+// the same node. An object freed by a thread on another node joins that
+// thread's pool; with sharded workers that is rare.
+//
+// Memory comes from 2 MB regions, aligned so each can be backed by one
+// transparent huge page, and is carved into 64 KB pages. A region's header
+// records the class of each page, which is how lb_free() finds an object's
+// class without being told its size. Larger allocations are mapped on
+// their own. Small-object memory is kept for reuse, not returned to the
+// system.
+#define LB_ALLOC_SMALL_MAX      65536
+#define LB_ALLOC_CLASSES        44
+#define LB_ALLOC_PAGE_SHIFT     16
+#define LB_ALLOC_REGION_SHIFT   21
+
+typedef struct lb_alloc_stats {
+    uint64_t regions;
+    uint64_t large_allocs;      // live
+    uint64_t large_bytes;
+    uint64_t central_gets;      // batches taken by threads
+    uint64_t central_puts;      // batches handed back
+} lb_alloc_stats_t;
+
+void* lb_alloc(size_t size);
+void* lb_calloc(size_t n, size_t size);
+void* lb_realloc(void* ptr, size_t size);
+void lb_free(void* ptr);
+char* lb_strdup(const char* s);
+size_t lb_alloc_usable_size(const void* ptr);
+
+size_t lb_alloc_class_size(int cls);
+// Class for size, or -1 above LB_ALLOC_SMALL_MAX
+int lb_alloc_class_of(size_t size);
+
+// Returns the calling thread's cached objects to the central pools
+void lb_alloc_thread_flush(void);
+// Makes the calling thread use node's pools (lb_topology_pin() calls it)
+void lb_alloc_set_node(int node);
+void lb_alloc_get_stats(lb_alloc_stats_t* out);
+
+// Bump arena for memory that lives as long as one request. Allocation is
+// a pointer increment; lb_arena_reset() rewinds to the first chunk in
+// O(1) and keeps every chunk for the next request. lb_arena_mark() and
+// lb_arena_release() do the same for a nested scope.
+typedef struct lb_arena_chunk {
+    struct lb_arena_chunk* next;
+    size_t size;
+    char data[];
+} lb_arena_chunk_t;
+
+typedef struct lb_arena {
+    lb_arena_chunk_t* first;
+    lb_arena_chunk_t* cur;
+    char* ptr;
+    char* end;
+    size_t chunk_size;
+} lb_arena_t;
+
+typedef struct lb_arena_mark {
+    lb_arena_chunk_t* chunk;
+    char* ptr;
+} lb_arena_mark_t;
+
+#define LB_ARENA_CHUNK  16384
+#define LB_ARENA_ALIGN  16
+
+typedef enum {
+    LB_ARENA_HTTP = 0,          // parser state of one message
+    LB_ARENA_ACL,               // samples evaluated by one rule set
+    LB_ARENA_COUNT
+} lb_arena_id_t;
+
+void lb_arena_init(lb_arena_t* arena, size_t chunk_size);
+void lb_arena_destroy(lb_arena_t* arena);
+void* lb_arena_alloc_slow(lb_arena_t* arena, size_t size);
+char* lb_arena_strndup(lb_arena_t* arena, const char* s, size_t len);
+// The calling thread's arena for a subsystem
+lb_arena_t* lb_arena_local(lb_arena_id_t id);
+
+static inline void* lb_arena_alloc(lb_arena_t* arena, size_t size) {
+    size = (size + LB_ARENA_ALIGN - 1) & ~(size_t)(LB_ARENA_ALIGN - 1);
+    if (__builtin_expect((size_t)(arena->end - arena->ptr) >= size, 1)) {
+        void* p = arena->ptr;
+        arena->ptr += size;
+        return p;
+    }
+    return lb_arena_alloc_slow(arena, size);
+}
+
+static inline void lb_arena_reset(lb_arena_t* arena) {
+    arena->cur = arena->first;
+    arena->ptr = arena->first ? arena->first->data : NULL;
+    arena->end = arena->first ? arena->first->data + arena->first->size : NULL;
+}
+
+static inline lb_arena_mark_t lb_arena_mark(const lb_arena_t* arena) {
+    lb_arena_mark_t m = { arena->cur, arena->ptr };
+    return m;
+}
+
+static inline void lb_arena_release(lb_arena_t* arena, lb_arena_mark_t m) {
+    if (!m.chunk) {
+        lb_arena_reset(arena);
+        return;
+    }
+    arena->cur = m.chunk;
+    arena->ptr = m.ptr;
+    arena->end = m.chunk->data + m.chunk->size;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef LB_CLOCK_H
+#define LB_CLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Cached per-thread time. An event loop calls lb_clock_update() once per
+// iteration, right after it wakes up, and everything it runs until the
+// next wakeup reads that snapshot through lb_now_*() instead of asking
+// the kernel. Threads that never call lb_clock_update() are not stale:
+// their lb_now_*() reads the clock directly.
+//
+// lb_clock_precise_ns() is for the few places that need the exact time
+// in the middle of an iteration. With an invariant TSC it extrapolates
+// from the iteration's snapshot with one rdtsc; otherwise it falls back
+// to clock_gettime().
+typedef struct lb_clock {
+    uint64_t ns;        // CLOCK_MONOTONIC
+    uint64_t ms;
+    time_t sec;         // wall clock seconds, as time(NULL)
+    uint64_t tsc;       // TSC at the snapshot, when usable
+    bool valid;
+} lb_clock_t;
+
+extern __thread lb_clock_t lb_clock;
+
+void lb_clock_update(void);
+
+// Drops the snapshot; later reads on this thread go to the clock again
+void lb_clock_release(void);
+
+uint64_t lb_clock_precise_ns(void);
+
+// Whether lb_clock_precise_ns() runs on the TSC
+bool lb_clock_tsc_usable(void);
+
+uint64_t lb_clock_read_ns(void);
+time_t lb_clock_read_sec(void);
+
+static inline uint64_t lb_now_ns(void) {
+    return __builtin_expect(lb_clock.valid, 1) ? lb_clock.ns : lb_clock_read_ns();
+}
+
+static inline uint64_t lb_now_ms(void) {
+    return __builtin_expect(lb_clock.valid, 1) ? lb_clock.ms : lb_clock_read_ns() / 1000000;
+}
+
+static inline time_t lb_now_sec(void) {
+    return __builtin_expect(lb_clock.valid, 1) ? lb_clock.sec : lb_clock_read_sec();
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
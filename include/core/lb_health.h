@@ -7,4 +7,8 @@ void* health_check_thread(void* arg);
 void* stats_thread(void* arg);
 void check_backend_health(loadbalancer_t* lb, backend_t* backend);
 
+// One probe verdict for a backend; true when its state changed
+bool lb_health_report(loadbalancer_t* lb, backend_t* backend, bool passed,
+                      uint64_t rtt_ns, const char* why);
+
 #endif
\ No newline at end of file
@@ -2,42 +2,130 @@
 #define LB_MEMORY_H
 
 #include "lb_types.h"
+#include "lb_alloc.h"
 #include <stddef.h>
 
-typedef struct memory_chunk {
-    size_t size;
-    struct memory_chunk* next;
-} memory_chunk_t;
+// Fixed-size object slab owned by one worker thread. Objects are carved out
+// of large chunks; the owner allocates and frees without locking, other
+// threads hand objects back through a lock-free remote-free stack that the
+// owner reclaims in one swap when its local free list runs dry.
+typedef struct slab_chunk {
+    struct slab_chunk* next;
+} slab_chunk_t;
 
-typedef struct memory_pool {
-    void* base;
-    size_t size;
-    size_t used;
+typedef struct slab_free_obj {
+    struct slab_free_obj* next;
+} slab_free_obj_t;
+
+typedef struct slab {
+    size_t obj_size;
+    uint32_t objs_per_chunk;
+    slab_free_obj_t* free_list;
+    slab_chunk_t* chunks;
+    uint64_t in_use;
+#ifdef __cplusplus
+    std::atomic<slab_free_obj_t*> remote_free;
+#else
+    _Atomic(slab_free_obj_t*) remote_free;
+#endif
+} slab_t;
+
+slab_t* slab_create(size_t obj_size, uint32_t objs_per_chunk);
+void slab_destroy(slab_t* slab);
+void* slab_alloc(slab_t* slab);
+void slab_free(slab_t* slab, void* obj);
+void slab_free_remote(slab_t* slab, void* obj);
+
+// Shared pool of I/O buffers in power-of-four size classes. Buffers are only
+// held while data is in flight. Classes up to LB_ALLOC_SMALL_MAX come from
+// the allocator's thread caches; larger ones keep a bounded shared cache of
+// free buffers so steady-state traffic never maps memory.
+#define BUFFER_POOL_CLASSES   5
+#define BUFFER_POOL_MIN_SHIFT 12      // 4 KB smallest class
+#define BUFFER_POOL_MAX_CACHED 1024   // per class
+
+typedef struct buffer_pool_class {
     pthread_spinlock_t lock;
-    struct memory_chunk* free_list;
-} memory_pool_t;
+    slab_free_obj_t* free_list;
+    uint32_t cached;
+} __attribute__((aligned(CACHE_LINE_SIZE))) buffer_pool_class_t;
 
-memory_pool_t* memory_pool_create(size_t size);
-void memory_pool_destroy(memory_pool_t* pool);
-void* memory_pool_alloc(memory_pool_t* pool, size_t size);
-void memory_pool_free(memory_pool_t* pool, void* ptr, size_t size);
+typedef struct lb_buffer_pool {
+    buffer_pool_class_t classes[BUFFER_POOL_CLASSES];
+} lb_buffer_pool_t;
 
-typedef struct hash_node {
-    uint64_t hash;
+lb_buffer_pool_t* buffer_pool_create(void);
+void buffer_pool_destroy(lb_buffer_pool_t* pool);
+uint8_t* buffer_pool_get(lb_buffer_pool_t* pool, size_t min_size, size_t* capacity);
+void buffer_pool_put(lb_buffer_pool_t* pool, uint8_t* buf, size_t capacity);
+
+// Maglev consistent hashing. Lookups index a flat table of backends that
+// is rebuilt off the hot path whenever the set of UP backends or their
+// weights change, then published with an RCU pointer swap; readers must be
+// registered with lb_rcu_register(). A backend going down only remaps the
+// slots it owned.
+#define MAGLEV_DEFAULT_SIZE 65537   // prime, well above 100x the backends
+
+typedef struct maglev_member {
     backend_t* backend;
-    struct hash_node* next;
-} hash_node_t;
+    uint32_t offset;
+    uint32_t skip;
+    uint32_t weight;        // as of the last build, 0 when not UP
+} maglev_member_t;
+
+typedef struct maglev_table {
+    uint32_t size;
+    uint32_t count;         // UP backends in the table
+    backend_t* entry[];
+} maglev_table_t;
 
 typedef struct consistent_hash {
-    hash_node_t** table;
+#ifdef __cplusplus
+    std::atomic<maglev_table_t*> table;
+#else
+    _Atomic(maglev_table_t*) table;
+#endif
     uint32_t size;
-    uint32_t virtual_nodes;
-    pthread_spinlock_t lock;
+    uint32_t member_count;
+    maglev_member_t members[MAX_BACKENDS];
+    pthread_mutex_t lock;   // writers only
 } consistent_hash_t;
 
-consistent_hash_t* consistent_hash_create(uint32_t size, uint32_t virtual_nodes);
+consistent_hash_t* consistent_hash_create(uint32_t size);
 void consistent_hash_add(consistent_hash_t* ch, backend_t* backend);
+// Rebuild if backend states or weights moved since the last build
+bool consistent_hash_sync(consistent_hash_t* ch);
+void consistent_hash_rebuild(consistent_hash_t* ch);
+backend_t* consistent_hash_lookup(consistent_hash_t* ch, uint64_t hash);
 backend_t* consistent_hash_get(consistent_hash_t* ch, const char* key);
 void consistent_hash_destroy(consistent_hash_t* ch);
 
+// Smooth weighted round-robin (nginx) expanded into a flat schedule of
+// sum(weight) slots, so a pick is one atomic increment and an index. The
+// schedule is rebuilt by lb_wrr_sync() when backend states or weights
+// change and published with RCU like the Maglev table.
+#define WRR_MAX_SCHEDULE 65536
+
+typedef struct wrr_schedule {
+    uint32_t length;
+    backend_t* slots[];
+} wrr_schedule_t;
+
+typedef struct lb_wrr {
+#ifdef __cplusplus
+    std::atomic<wrr_schedule_t*> schedule;
+    std::atomic<uint32_t> cursor;
+#else
+    _Atomic(wrr_schedule_t*) schedule;
+    _Atomic uint32_t cursor;
+#endif
+    uint32_t weights[MAX_BACKENDS];     // as of the last build, 0 when not UP
+    pthread_mutex_t lock;               // writers only
+} lb_wrr_t;
+
+lb_wrr_t* lb_wrr_create(void);
+bool lb_wrr_sync(lb_wrr_t* wrr, backend_t** backends, uint32_t count);
+backend_t* lb_wrr_next(lb_wrr_t* wrr);
+void lb_wrr_destroy(lb_wrr_t* wrr);
+
 #endif
\ No newline at end of file
@@ -16,4 +16,50 @@ int handle_backend_data(loadbalancer_t* lb, lb_connection_t* conn);
 void* worker_thread(void* arg);
 void* worker_thread_v2(void* arg);
 
+// Backend address cache (src/network/lb_dns.c). Workers only read the
+// published address; names are refreshed by dns_resolver_thread() as their
+// DNS TTL expires.
+int lb_dns_resolve_backend(backend_t* backend);
+int lb_dns_backend_addr(const backend_t* backend, struct sockaddr_storage* addr, socklen_t* len);
+void* dns_resolver_thread(void* arg);
+
+// Builds the calling worker's timer wheel, stats and idle upstream pools.
+// Run by each worker right after lb_topology_pin(); a second call is a
+// no-op. Sets worker->init_state for main_lb_start() to wait on.
+int lb_net_worker_init(lb_worker_t* worker);
+void lb_net_upstream_pools_destroy(loadbalancer_t* lb);
+
+// Helpers shared with the HTTP/2 frontend (src/network/lb_net.c)
+int lb_net_connect_to_backend(backend_t* backend);
+int lb_net_upstream_checkout(lb_worker_t* worker, backend_t* backend);
+bool lb_net_upstream_checkin(lb_worker_t* worker, backend_t* backend, int fd);
+int lb_net_backlog_append(loadbalancer_t* lb, uint8_t** buf, size_t* size,
+                          size_t* capacity, const char* data, size_t len);
+void lb_net_backlog_release(loadbalancer_t* lb, uint8_t** buf, size_t* capacity);
+
+// HTTP/1.1 keep-alive framing of one direction (src/network/lb_net.c).
+// Counts complete messages in t and clears conn->upstream_reusable on
+// anything it cannot frame; returns the bytes consumed.
+size_t lb_net_track(lb_connection_t* conn, http_track_t* t, const char* data,
+                    size_t len, bool response, bool one_message);
+
+// HTTP/2 frontend (src/network/lb_h2.c), entered from L7 connections when
+// config.http2 is set. lb_h2_probe() returns 1 once the connection has
+// switched (prior-knowledge preface or h2c Upgrade), 0 for HTTP/1.x, -1
+// while more bytes are needed and -2 on error. The rest follow the
+// handle_* convention: 1 keep going, 0 close cleanly, -1 error.
+int lb_h2_probe(loadbalancer_t* lb, lb_connection_t* conn);
+int lb_h2_client_read(loadbalancer_t* lb, lb_connection_t* conn);
+int lb_h2_client_write(loadbalancer_t* lb, lb_connection_t* conn);
+int lb_h2_upstream_event(loadbalancer_t* lb, epoll_data_wrapper_t* wrapper, uint32_t events);
+bool lb_h2_busy(const lb_connection_t* conn);
+void lb_h2_close(lb_connection_t* conn);
+void lb_h2_free(lb_connection_t* conn);
+
+// io_uring engine (src/network/lb_uring.c). lb_uring_supported() is false
+// when built without USE_IO_URING or when the running kernel lacks
+// multishot accept/recv and provided buffer rings.
+bool lb_uring_supported(void);
+void* worker_thread_uring(void* arg);
+
 #endif
\ No newline at end of file
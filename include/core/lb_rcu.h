@@ -0,0 +1,32 @@
+#ifndef LB_RCU_H
+#define LB_RCU_H
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Quiescent-state based reclamation for read-mostly shared tables.
+// Readers (worker threads) register once and call lb_rcu_quiescent()
+// between requests, typically once per event loop iteration; a pointer
+// loaded from an RCU-published slot stays valid until then. Writers
+// publish a replacement with an atomic store and hand the old object to
+// lb_rcu_retire(), which frees it once every online reader has passed a
+// quiescent state. Reads cost nothing beyond the pointer load.
+#define LB_RCU_MAX_READERS 1024
+
+int lb_rcu_register(void);
+void lb_rcu_unregister(void);
+void lb_rcu_quiescent(void);
+// True when the calling thread is a registered reader
+bool lb_rcu_online(void);
+
+void lb_rcu_retire(void* ptr, void (*free_fn)(void*));
+void lb_rcu_reclaim(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
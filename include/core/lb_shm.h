@@ -0,0 +1,37 @@
+#ifndef LB_SHM_H
+#define LB_SHM_H
+
+#include "lb_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Backend state shared by ultrabalancer processes on one host, for
+// example several SO_REUSEPORT instances on the same port. The processes
+// open the same POSIX shared memory segment, and whichever one takes its
+// flock() becomes the leader. The leader runs the health checks and
+// publishes state, latency and connection counts for every backend. The
+// others map the segment read-only and adopt what it publishes. If the
+// leader exits, the kernel drops its lock and the next process to try
+// takes over.
+#define LB_SHM_STALE_MS 2000    // heartbeat age after which followers probe again
+
+typedef struct lb_shm lb_shm_t;
+
+lb_shm_t* lb_shm_open(const char* name);
+void lb_shm_close(lb_shm_t* shm);
+
+bool lb_shm_try_lead(lb_shm_t* shm);
+void lb_shm_publish(lb_shm_t* shm, loadbalancer_t* lb);
+
+// Follower side. Returns the number of backends whose state changed, or
+// -1 when the leader has gone quiet for more than stale_ms. In that case
+// the caller should probe on its own.
+int lb_shm_follow(lb_shm_t* shm, loadbalancer_t* lb, uint32_t stale_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef LB_STATS_H
+#define LB_STATS_H
+
+#include "core/lb_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Data-path counters. Worker threads bind their own lb_worker_stats_t
+// once and bump it with uncontended relaxed stores; any other thread falls
+// back to atomic RMWs on lb->global_stats and backend->stats. Readers get
+// totals from lb_stats_snapshot()/lb_stats_backend_bytes().
+typedef struct lb_stats_snapshot {
+    uint64_t total_requests;
+    uint64_t failed_requests;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    int64_t active_connections;
+} lb_stats_snapshot_t;
+
+extern __thread lb_worker_stats_t* lb_stats_local;
+
+int lb_stats_init(lb_worker_stats_t* stats, uint32_t backend_slots);
+void lb_stats_release(lb_worker_stats_t* stats);
+void lb_stats_bind(lb_worker_stats_t* stats);
+
+void lb_stats_snapshot(loadbalancer_t* lb, lb_stats_snapshot_t* out);
+void lb_stats_backend_bytes(loadbalancer_t* lb, backend_t* backend,
+                            uint64_t* bytes_in, uint64_t* bytes_out);
+
+#define LB_STAT_BUMP(ctr, n) \
+    atomic_store_explicit(&(ctr), atomic_load_explicit(&(ctr), memory_order_relaxed) + (n), \
+                          memory_order_relaxed)
+
+#define LB_STAT_ADD(lb, field, n) do {                          \
+    lb_worker_stats_t* s_ = lb_stats_local;                     \
+    if (__builtin_expect(s_ != NULL, 1)) {                      \
+        LB_STAT_BUMP(s_->field, n);                             \
+    } else {                                                    \
+        atomic_fetch_add(&(lb)->global_stats.field, (n));       \
+    }                                                           \
+} while (0)
+
+// Bytes relayed through one backend, dir 0 = to it, 1 = from it
+static inline void lb_stat_backend_bytes(backend_t* backend, int dir, uint64_t n) {
+    lb_worker_stats_t* s = lb_stats_local;
+    if (__builtin_expect(s != NULL && backend->slot < s->backend_slots, 1)) {
+        LB_STAT_BUMP(s->backend_bytes[backend->slot * 2 + dir], n);
+    } else if (dir == 0) {
+        atomic_fetch_add(&backend->stats.bytes_in, n);
+    } else {
+        atomic_fetch_add(&backend->stats.bytes_out, n);
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef LB_TIMER_H
+#define LB_TIMER_H
+
+#include "lb_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Hierarchical timing wheel owned by a single thread. Four levels of 256
+// slots at LB_TIMER_TICK_MS resolution cover about 497 days; scheduling,
+// cancelling and expiring a timer are all O(1), and timers further out
+// cascade down one level each time the level below wraps.
+#define LB_TIMER_TICK_MS 10
+#define LB_TIMER_BITS    8
+#define LB_TIMER_SLOTS   (1 << LB_TIMER_BITS)
+#define LB_TIMER_LEVELS  4
+
+typedef struct lb_timer_wheel {
+    uint64_t now;       // current tick
+    uint32_t count;     // pending timers
+    lb_timer_t slots[LB_TIMER_LEVELS][LB_TIMER_SLOTS];  // list heads
+} lb_timer_wheel_t;
+
+typedef void (*lb_timer_fn)(lb_timer_t* timer, void* arg);
+
+lb_timer_wheel_t* lb_timer_wheel_create(uint64_t now_ms);
+void lb_timer_wheel_destroy(lb_timer_wheel_t* wheel);
+
+// Arm (or re-arm) a timer to fire once the wheel reaches expires_ms
+void lb_timer_schedule(lb_timer_wheel_t* wheel, lb_timer_t* timer, uint64_t expires_ms);
+void lb_timer_cancel(lb_timer_wheel_t* wheel, lb_timer_t* timer);
+
+// Move the wheel to now_ms and call fn for every timer that came due.
+// Expired timers are unlinked before fn runs, so fn may re-arm or free
+// them. Returns the number of timers fired.
+uint32_t lb_timer_advance(lb_timer_wheel_t* wheel, uint64_t now_ms, lb_timer_fn fn, void* arg);
+
+static inline void lb_timer_init(lb_timer_t* timer) {
+    timer->next = timer->prev = NULL;
+    timer->expires = 0;
+}
+
+static inline bool lb_timer_pending(const lb_timer_t* timer) {
+    return timer->next != NULL;
+}
+
+// Absolute expiry in ms of a pending timer (tick resolution)
+static inline uint64_t lb_timer_expires_ms(const lb_timer_t* timer) {
+    return timer->expires * LB_TIMER_TICK_MS;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
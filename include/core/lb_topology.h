@@ -0,0 +1,47 @@
+#ifndef LB_TOPOLOGY_H
+#define LB_TOPOLOGY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Worker placement. lb_topology_detect() lists the CPUs this process may
+// run on in the order workers should take them: one per physical core,
+// NUMA node by node, then the SMT siblings. An explicit CPU list or the
+// IRQ affinity of a NIC's queues can replace that order, so worker N
+// runs where RX queue N is serviced. lb_topology_pin() binds the calling
+// thread to its CPU and makes its later allocations prefer that CPU's
+// node, including the lb_alloc() pools it draws from.
+#define LB_TOPO_MAX_CPUS 1024
+
+typedef struct lb_cpu {
+    int cpu;
+    int core;       // core_id within the package
+    int package;
+    int node;       // NUMA node, 0 on non-NUMA machines
+} lb_cpu_t;
+
+typedef struct lb_topology {
+    uint32_t count;
+    uint32_t nodes;         // highest node id seen + 1
+    lb_cpu_t cpus[LB_TOPO_MAX_CPUS];
+} lb_topology_t;
+
+int lb_topology_detect(lb_topology_t* topo);
+int lb_topology_from_list(lb_topology_t* topo, const char* list);
+int lb_topology_from_irqs(lb_topology_t* topo, const char* ifname);
+
+static inline const lb_cpu_t* lb_topology_worker_cpu(const lb_topology_t* topo, uint32_t worker_id) {
+    return topo->count ? &topo->cpus[worker_id % topo->count] : NULL;
+}
+
+int lb_topology_pin(int cpu, int node);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -36,7 +36,9 @@ typedef enum {
     LB_ALGO_HDR,
     LB_ALGO_RDP_COOKIE,
     LB_ALGO_RANDOM,
-    LB_ALGO_STICKY
+    LB_ALGO_STICKY,
+    LB_ALGO_LEASTCONN_P2C,
+    LB_ALGO_PEAK_EWMA
 } lb_algorithm_t;
 
 typedef enum {
@@ -76,23 +78,49 @@ typedef struct backend {
     char host[256];
     uint16_t port;
     int sockfd;
+    uint32_t slot;              // index in lb->backends and lb->view
 
 #ifdef __cplusplus
     std::atomic<backend_state_t> state;
-    std::atomic<uint32_t> active_conns;
     std::atomic<uint32_t> total_conns;
     std::atomic<uint32_t> failed_conns;
     std::atomic<uint32_t> weight;
     std::atomic<uint64_t> last_check_ns;
-    std::atomic<uint64_t> response_time_ns;
+    std::atomic<uint64_t> check_rtt_ns;
+    std::atomic<uint64_t> up_since_ns;
+    std::atomic<uint64_t> ewma_cost_ns;
+    std::atomic<uint64_t> ewma_stamp_ns;
+    std::atomic<uint32_t> pending_requests;
+    std::atomic<uint32_t> outlier_consecutive;
+    std::atomic<uint64_t> outlier_window;
+    std::atomic<uint32_t> outlier_requests[2];
+    std::atomic<uint32_t> outlier_errors[2];
+    std::atomic<uint32_t> outlier_ejections;
+    std::atomic<uint64_t> outlier_readmit_ns;
+    std::atomic<uint64_t> ejected_until_ns;
 #else
     _Atomic backend_state_t state;
-    _Atomic uint32_t active_conns;
     _Atomic uint32_t total_conns;
     _Atomic uint32_t failed_conns;
     _Atomic uint32_t weight;
     _Atomic uint64_t last_check_ns;
-    _Atomic uint64_t response_time_ns;
+    _Atomic uint64_t check_rtt_ns;      // last passed health probe, connect to verdict
+    _Atomic uint64_t up_since_ns;       // last DOWN -> UP, 0 if never up
+    // Peak-EWMA of time to first response byte, and requests still
+    // waiting for one (lb_backend_observe_latency)
+    _Atomic uint64_t ewma_cost_ns;
+    _Atomic uint64_t ewma_stamp_ns;
+    _Atomic uint32_t pending_requests;
+    // Passive outlier detection (lb_outlier_report): connect failures and
+    // resets in a row, and requests/5xx per window, indexed by the
+    // window number's parity so the previous window is still readable
+    _Atomic uint32_t outlier_consecutive;
+    _Atomic uint64_t outlier_window;
+    _Atomic uint32_t outlier_requests[2];
+    _Atomic uint32_t outlier_errors[2];
+    _Atomic uint32_t outlier_ejections;     // backoff exponent
+    _Atomic uint64_t outlier_readmit_ns;
+    _Atomic uint64_t ejected_until_ns;      // 0 while admitted
 #endif
 
     stats_t stats;
@@ -101,21 +129,124 @@ typedef struct backend {
     void* conn_pool;
     struct backend* next;
 
+    // Resolved address published by the resolver thread (lb_dns.c) under
+    // a seqlock: odd addr_seq means an update is in progress
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+#ifdef __cplusplus
+    std::atomic<uint32_t> addr_seq;
+#else
+    _Atomic uint32_t addr_seq;
+#endif
+    bool addr_dynamic;          // host is a name, not a literal address
+    uint64_t addr_expires_ns;   // resolver thread only
+
     uint8_t __padding[CACHE_LINE_SIZE - (sizeof(void*) % CACHE_LINE_SIZE)];
 } backend_t;
 
 typedef enum {
     SOCKET_TYPE_CLIENT,
     SOCKET_TYPE_BACKEND,
-    SOCKET_TYPE_LISTEN
+    SOCKET_TYPE_LISTEN,
+    SOCKET_TYPE_H2_STREAM   // backend socket of one HTTP/2 stream
 } socket_type_t;
 
 typedef struct epoll_data_wrapper {
     socket_type_t type;
     void* conn;
     int fd;
+    uint32_t events;    // Registered interest in edge-triggered mode
 } epoll_data_wrapper_t;
 
+typedef struct cleanup_queue {
+    struct lb_connection* queue[CLEANUP_QUEUE_SIZE];
+#ifdef __cplusplus
+    std::atomic<uint32_t> head;
+    std::atomic<uint32_t> tail;
+    std::mutex lock;
+#else
+    _Atomic uint32_t head;
+    _Atomic uint32_t tail;
+    pthread_mutex_t lock;
+#endif
+} cleanup_queue_t;
+
+struct loadbalancer;
+
+// Intrusive timing wheel entry (see core/lb_timer.h); expires is in ticks
+typedef struct lb_timer {
+    struct lb_timer* next;
+    struct lb_timer* prev;
+    uint64_t expires;
+} lb_timer_t;
+
+// Counters owned by one worker thread (see core/lb_stats.h). Only the
+// owning thread writes them, with a relaxed load and store rather than a
+// locked RMW; readers sum every worker's block.
+typedef struct lb_worker_stats {
+#ifdef __cplusplus
+    std::atomic<uint64_t> total_requests;
+    std::atomic<uint64_t> failed_requests;
+    std::atomic<uint64_t> bytes_in;
+    std::atomic<uint64_t> bytes_out;
+    std::atomic<int64_t> active_connections;
+    std::atomic<uint64_t>* backend_bytes;   // [slot * 2 + 0/1]: in/out
+#else
+    _Atomic uint64_t total_requests;
+    _Atomic uint64_t failed_requests;
+    _Atomic uint64_t bytes_in;
+    _Atomic uint64_t bytes_out;
+    _Atomic int64_t active_connections;     // opened minus closed here
+    _Atomic uint64_t* backend_bytes;        // [slot * 2 + 0/1]: in/out
+#endif
+    uint32_t backend_slots;
+} __attribute__((aligned(CACHE_LINE_SIZE))) lb_worker_stats_t;
+
+// Per-worker event loop state. In sharded mode each worker owns its epoll
+// instance and SO_REUSEPORT listen socket, and every connection it accepts
+// stays on it until close. In shared mode epfd/listen_fd alias the
+// loadbalancer's single instance.
+typedef struct lb_worker {
+    struct loadbalancer* lb;
+    uint32_t id;
+    int cpu;                // pinned CPU, -1 when unpinned
+    int numa_node;
+    int epfd;
+    int listen_fd;
+    bool owns_listener;
+    epoll_data_wrapper_t listen_wrapper;
+    cleanup_queue_t* cleanup_queue;
+    struct slab* conn_slab;
+    // Made by the worker itself once pinned (lb_net_worker_init), so their
+    // pages are first touched on, and placed on, the worker's node
+    struct lb_timer_wheel* timers;
+    lb_worker_stats_t stats;
+    struct upstream_pool* upstream_pools;   // [backend_t::slot], NULL without pooling
+    uint32_t upstream_pool_count;           // backends attached later have none
+#ifdef __cplusplus
+    std::atomic<int> init_state;
+#else
+    _Atomic int init_state;                 // 0 while setting up, 1 ready, -1 failed
+#endif
+} lb_worker_t;
+
+// HTTP/1.1 message framing state for one direction of a connection
+enum {
+    HTTP_TRACK_IDLE = 0,
+    HTTP_TRACK_BODY,
+    HTTP_TRACK_CHUNK_SIZE,
+    HTTP_TRACK_CHUNK_EXT,
+    HTTP_TRACK_CHUNK_DATA,
+    HTTP_TRACK_CHUNK_END,
+    HTTP_TRACK_TRAILERS,
+};
+
+typedef struct http_track {
+    uint8_t state;
+    uint32_t messages;      // complete messages seen
+    uint64_t remaining;     // body/chunk bytes left, or trailer line length
+} http_track_t;
+
 typedef struct lb_connection {
     int client_fd;
     int backend_fd;
@@ -147,37 +278,131 @@ typedef struct lb_connection {
     bool keep_alive;
     bool is_websocket;
     bool is_http2;
-
-    epoll_data_wrapper_t* client_wrapper;
-    epoll_data_wrapper_t* backend_wrapper;
+    bool h2_probed;                 // first bytes checked for HTTP/2
+    struct lb_h2_session* h2;       // streams of an HTTP/2 client
+
+    // L4 zero-copy forwarding: socket -> pipe -> socket per direction
+    bool splice_enabled;
+    bool client_eof;
+    bool backend_eof;
+    int splice_c2b[2];
+    int splice_b2c[2];
+    size_t splice_c2b_len;
+    size_t splice_b2c_len;
+
+    // Edge-triggered mode: sockets stay registered with EPOLLET and epoll is
+    // only touched when the wanted interest set changes
+    bool edge_triggered;
+
+    // Reading from a peer pauses while the backlog it feeds is full. Needs
+    // a single owning worker, which may re-arm either socket.
+    bool backpressure;
+    bool client_read_paused;
+    bool backend_read_paused;
+
+    // Upstream keep-alive: HTTP/1.1 framing seen on the copy path, so the
+    // backend socket is only pooled at a clean message boundary
+    bool upstream_reusable;
+    http_track_t req_track;
+    http_track_t resp_track;
+
+    // L7 mode: every request goes to a backend picked for it, one exchange
+    // at a time so pipelined responses return in order. The first l7_fwd
+    // bytes of to_backend_buffer belong to the request in flight; what
+    // follows waits for the next exchange.
+    bool l7;
+    bool l7_tunnel;         // framing not understood, plain forwarding from here on
+    size_t l7_fwd;
+
+    // Connect/read/write/keep-alive timeout on the owning worker's wheel.
+    // Activity only moves deadline_ms; the timer is re-armed lazily when
+    // it fires early, or right away if the deadline moved closer.
+    bool timeouts;
+    lb_timer_t timer;
+    uint64_t deadline_ms;
+
+    // When the request now waiting on the backend was forwarded; 0 once
+    // the first response byte came back
+    uint64_t request_sent_ns;
+    int backend_errno;      // last send/recv error on the backend socket
+
+    // Embedded so a connection is a single slab object
+    epoll_data_wrapper_t client_wrapper;
+    epoll_data_wrapper_t backend_wrapper;
+
+    lb_worker_t* worker;
 } lb_connection_t;
 
+// Idle upstream sockets one worker keeps for one backend. Each worker has
+// an array of these indexed by backend_t::slot, so checkout and checkin
+// never take a lock.
+#define UPSTREAM_POOL_MAX 32
+
+typedef struct upstream_pool {
+    int fds[UPSTREAM_POOL_MAX];
+    uint64_t idle_since_ns[UPSTREAM_POOL_MAX];
+    uint32_t count;
+} __attribute__((aligned(CACHE_LINE_SIZE))) upstream_pool_t;
+
 typedef struct {
     uint32_t connect_timeout_ms;
     uint32_t read_timeout_ms;
     uint32_t write_timeout_ms;
     uint32_t keepalive_timeout_ms;
+    uint32_t upstream_idle_timeout_ms;
     uint32_t health_check_interval_ms;
+    uint32_t health_check_timeout_ms;
     uint32_t max_connections;
     uint32_t health_check_fail_threshold;
+    uint32_t accept_batch;
+    uint32_t slow_start_ms;         // weight ramp after DOWN -> UP, 0 = off
+    uint32_t outlier_consecutive;   // connect errors/resets to eject, 0 = off
+    uint32_t outlier_error_pct;     // 5xx/error share to eject, 0 = off
+    uint32_t outlier_min_requests;  // per window, before the share counts
+    uint32_t outlier_window_ms;
+    uint32_t outlier_ejection_ms;   // first ejection; doubles on each repeat
+    uint32_t outlier_max_ejection_ms;
+    uint32_t outlier_max_pct;       // never eject more than this share
+    bool slow_start_exp;            // exponential instead of linear ramp
     bool tcp_nodelay;
     bool so_reuseport;
+    bool worker_sharding;
+    bool splice_forwarding;
+    bool io_uring;
+    bool upstream_keepalive;
+    bool l7_mode;                   // balance HTTP/1.1 requests, not connections
+    bool http2;                     // accept HTTP/2 on L7 connections
+    bool edge_triggered;
     bool defer_accept;
     bool health_check_enabled;
+    bool cpu_pinning;
+    uint8_t health_check_type;      // check_type_t: TCP, HTTP, MYSQL or REDIS
+    const char* health_check_uri;   // HTTP probe path, NULL for "/"
+    const char* shared_state;       // shm segment shared with sibling processes
+    const char* cpu_list;           // explicit worker CPUs, in worker order
+    const char* irq_iface;          // follow this NIC's queue IRQ affinity
 } config_t;
 
-typedef struct cleanup_queue {
-    lb_connection_t* queue[CLEANUP_QUEUE_SIZE];
+// Selection view: the per-backend fields every algorithm reads, packed by
+// backend slot so a scan over thousands of backends walks a few dozen
+// contiguous lines instead of one backend_t each. up and weight mirror
+// backend_t::state/weight and are only written through
+// lb_backend_set_state()/lb_backend_set_weight(); conns is the one copy of
+// the active connection count. warming marks backends still inside their
+// slow-start window.
+typedef struct {
 #ifdef __cplusplus
-    std::atomic<uint32_t> head;
-    std::atomic<uint32_t> tail;
-    std::mutex lock;
+    std::atomic<uint64_t> up[MAX_BACKENDS / 64];
+    std::atomic<uint64_t> warming[MAX_BACKENDS / 64];
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> weight[MAX_BACKENDS];
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> conns[MAX_BACKENDS];
 #else
-    _Atomic uint32_t head;
-    _Atomic uint32_t tail;
-    pthread_mutex_t lock;
+    _Atomic uint64_t up[MAX_BACKENDS / 64];
+    _Atomic uint64_t warming[MAX_BACKENDS / 64];
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t weight[MAX_BACKENDS];
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t conns[MAX_BACKENDS];
 #endif
-} cleanup_queue_t;
+} __attribute__((aligned(CACHE_LINE_SIZE))) lb_backend_view_t;
 
 typedef struct loadbalancer {
     int epfd;
@@ -186,10 +411,13 @@ typedef struct loadbalancer {
 
     backend_t* backends[MAX_BACKENDS];
     uint32_t backend_count;
+    lb_backend_view_t view;
 #ifdef __cplusplus
     std::atomic<uint32_t> round_robin_idx;
+    std::atomic<uint32_t> outlier_ejected;
 #else
     _Atomic uint32_t round_robin_idx;
+    _Atomic uint32_t outlier_ejected;       // backends ejected right now
 #endif
 
     lb_algorithm_t algorithm;
@@ -203,9 +431,11 @@ typedef struct loadbalancer {
 
     uint32_t worker_threads;
     pthread_t* workers;
+    lb_worker_t* worker_ctx;
 
-    void* memory_pool;
     void* consistent_hash;
+    struct lb_wrr* wrr;
+    struct lb_buffer_pool* buffer_pool;
 
     config_t config;
 
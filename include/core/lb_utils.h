@@ -13,6 +13,27 @@ static inline uint64_t get_time_ns(void) {
     return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 }
 
+// Per-thread xorshift64* generator, seeded on first use. Cheap enough for
+// the selection path and free of the lock glibc's rand() takes.
+static inline uint64_t lb_rand64(void) {
+    static __thread uint64_t state;
+    uint64_t x = state;
+    if (unlikely(x == 0)) {
+        x = get_time_ns() ^ (uint64_t)(uintptr_t)&state;
+        x = x ? x : 0x9e3779b97f4a7c15ULL;
+    }
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    state = x;
+    return x * 0x2545f4914f6cdd1dULL;
+}
+
+// Uniform in [0, n) without a division
+static inline uint32_t lb_rand_range(uint32_t n) {
+    return (uint32_t)(((lb_rand64() >> 32) * n) >> 32);
+}
+
 static inline void atomic_min(atomic_uint_fast64_t* var, uint64_t val) {
     uint64_t old = atomic_load(var);
     while (old > val && !atomic_compare_exchange_weak(var, &old, val));
@@ -20,4 +41,17 @@ static inline void atomic_min(atomic_uint_fast64_t* var, uint64_t val) {
 
 uint64_t murmur3_64(const void* key, size_t len, uint64_t seed);
 
+// Streaming MurmurHash3 x64_128: pieces fed one after the other hash the
+// same as their concatenation, so a key can be hashed where it lies
+typedef struct lb_hash128 {
+    uint64_t h1, h2;
+    uint64_t total;
+    uint8_t tail[16];
+    uint32_t tail_len;
+} lb_hash128_t;
+
+void lb_hash128_init(lb_hash128_t* st, uint64_t seed);
+void lb_hash128_update(lb_hash128_t* st, const void* data, size_t len);
+void lb_hash128_final(const lb_hash128_t* st, uint64_t out[2]);
+
 #endif
\ No newline at end of file
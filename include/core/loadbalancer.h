@@ -6,6 +6,7 @@
 #include "lb_network.h"
 #include "lb_health.h"
 #include "lb_utils.h"
+#include <string.h>
 
 loadbalancer_t* lb_create(uint16_t port, lb_algorithm_t algorithm);
 void lb_destroy(loadbalancer_t* lb);
@@ -16,4 +17,62 @@ void lb_stop(loadbalancer_t* lb);
 
 backend_t* lb_select_backend(loadbalancer_t* lb, struct sockaddr_in* client_addr);
 
+// Selection view upkeep (lb->view)
+void lb_backend_attach(loadbalancer_t* lb, backend_t* backend);
+void lb_backend_set_state(loadbalancer_t* lb, backend_t* backend, backend_state_t state);
+void lb_backend_set_weight(loadbalancer_t* lb, backend_t* backend, uint32_t weight);
+
+#define LB_SLOW_START_FULL 65536
+uint32_t lb_slow_start_factor(loadbalancer_t* lb, backend_t* backend, uint64_t now_ns);
+
+static inline bool lb_backend_slot_up(loadbalancer_t* lb, uint32_t slot) {
+    uint64_t word = atomic_load_explicit(&lb->view.up[slot >> 6], memory_order_relaxed);
+    return (word >> (slot & 63)) & 1;
+}
+
+static inline uint32_t lb_backend_conns(loadbalancer_t* lb, backend_t* backend) {
+    return atomic_load_explicit(&lb->view.conns[backend->slot], memory_order_relaxed);
+}
+
+static inline void lb_backend_conn_get(loadbalancer_t* lb, backend_t* backend) {
+    atomic_fetch_add_explicit(&lb->view.conns[backend->slot], 1, memory_order_relaxed);
+}
+
+static inline void lb_backend_conn_put(loadbalancer_t* lb, backend_t* backend) {
+    atomic_fetch_sub_explicit(&lb->view.conns[backend->slot], 1, memory_order_relaxed);
+}
+
+// Latency tracking for LB_ALGO_PEAK_EWMA. The proxy marks a request as
+// sent when client bytes reach the backend and answered on the first
+// response byte; abort drops a request that never got one.
+#define PEAK_EWMA_DECAY_NS    10e9
+#define PEAK_EWMA_PENALTY_NS  (UINT64_MAX >> 16)
+
+void lb_backend_observe_latency(backend_t* b, uint64_t rtt_ns, uint64_t now_ns);
+uint64_t lb_backend_ewma_load(backend_t* b, uint64_t now_ns);
+void lb_request_sent(lb_connection_t* conn);
+void lb_request_answered(lb_connection_t* conn);
+void lb_request_abort(lb_connection_t* conn);
+
+// Passive outlier detection. The data path reports how each exchange with
+// a backend went; too many connect failures/resets in a row, or too high
+// an error share within a window, ejects it from selection at once. The
+// health thread re-admits it with lb_outlier_sweep() once its ejection
+// (doubling with every repeat) runs out.
+typedef enum {
+    LB_OUTCOME_OK,
+    LB_OUTCOME_CONNECT_FAIL,
+    LB_OUTCOME_RESET,
+    LB_OUTCOME_5XX
+} lb_outcome_t;
+
+void lb_outlier_report(loadbalancer_t* lb, backend_t* backend, lb_outcome_t outcome);
+void lb_outlier_sweep(loadbalancer_t* lb, uint64_t now_ns);
+
+// Outcome of a response from its first bytes: a 5xx status line or not
+static inline lb_outcome_t lb_response_outcome(const char* data, size_t len) {
+    if (len >= 12 && memcmp(data, "HTTP/1.", 7) == 0 && data[9] == '5') return LB_OUTCOME_5XX;
+    return LB_OUTCOME_OK;
+}
+
 #endif
\ No newline at end of file
@@ -24,6 +24,8 @@
 #define SRV_CHECKED        0x0020
 #define SRV_AGENT_CHECKED  0x0040
 
+#define SRV_EWGHT_SCALE    256      // cur_eweight units per unit of weight
+
 typedef struct server {
     char *id;
     char *hostname;
@@ -58,6 +60,7 @@ typedef struct server {
 
     struct server *next;
     struct server *track;
+    struct proxy *proxy;
 
 #ifdef __cplusplus
     std::atomic<uint64_t> counters[64];
@@ -167,6 +170,14 @@ typedef struct stream {
 
     struct http_txn *txn;
     struct hlua *hlua;
+    struct acl_smp_cache *acl_cache;    // samples memoized by ACL evaluation
+    struct cache_entry *cache_hit;      // being sent, with a reference held
+    const struct cache_variant *cache_variant;  // encoding of it sent, NULL for identity
+    size_t cache_sent;
+    struct cache_pending *cache_fill;   // fetch this stream makes for the others
+    struct cache_pending *cache_parked; // fetch this stream waits on
+    struct cache_shard *cache_parked_shard; // lock it before reading cache_parked
+    struct stream *cache_wait_next;
 
     struct list list;
 
@@ -190,12 +201,41 @@ int proxy_start(proxy_t *px);
 void proxy_stop(proxy_t *px);
 void proxy_pause(proxy_t *px);
 void proxy_resume(proxy_t *px);
+void proxy_add_server(proxy_t *px, server_t *srv);
+void proxy_update_usable(proxy_t *px);
+
+// Consistent hash ring point: servers get CHASH_POINTS_PER_WEIGHT points
+// per unit of weight, placed by hashing "<server id>-<n>"
+#define CHASH_POINTS_PER_WEIGHT 40
+#define CHASH_MAX_WEIGHT 256
+#define CHASH_DEFAULT_BALANCE_FACTOR 125
+
+typedef struct chash_point {
+    uint64_t hash;
+    server_t *srv;
+} chash_point_t;
+
+typedef struct srv_usable {
+    uint32_t count;
+    uint32_t ring_size;
+    chash_point_t *ring;            // sorted by hash, same allocation
+    server_t *srv[];
+} srv_usable_t;
+
+server_t* select_server_roundrobin(proxy_t *px);
+server_t* select_server_leastconn(proxy_t *px);
+server_t* select_server_source(proxy_t *px, uint32_t hash);
+server_t* select_server_chash(proxy_t *px, uint64_t hash);
+server_t* select_server_uri(proxy_t *px, const char *uri, size_t len);
 
 server_t* server_new(const char *name);
 void server_free(server_t *srv);
 int server_parse_addr(server_t *srv, const char *addr);
 void server_set_state(server_t *srv, int state);
+void server_set_weight(server_t *srv, uint32_t weight);
 int server_is_usable(server_t *srv);
+uint32_t server_eweight(server_t *srv, time_t now);
+int server_slowstart_admit(server_t *srv, time_t now);
 
 listener_t* listener_new(const char *name, const char *addr, int port);
 void listener_free(listener_t *l);
@@ -0,0 +1,69 @@
+#ifndef CORE_RATE_LIMITER_HPP
+#define CORE_RATE_LIMITER_HPP
+
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <string_view>
+
+namespace ultrabalancer {
+
+// GCRA (generic cell rate algorithm) limiter. The whole state is one
+// theoretical arrival time (TAT) in nanoseconds. A request at `now` is
+// allowed when TAT - now <= burst tolerance, and then pushes TAT forward
+// by one emission interval. The update is a CAS loop; no lock is taken.
+class GcraLimiter {
+public:
+    // `burst` requests may arrive back to back. Beyond that, requests are
+    // admitted at rate_per_sec.
+    GcraLimiter(double rate_per_sec, uint32_t burst);
+
+    bool allow() { return allow(now_ns()); }
+    bool allow(uint64_t now) { return allow(tat_, now); }
+
+    // Same decision against an external TAT cell; used by KeyedGcraLimiter
+    bool allow(std::atomic<uint64_t>& tat, uint64_t now) const;
+
+    uint64_t emission_ns() const { return emission_ns_; }
+    uint64_t tolerance_ns() const { return tolerance_ns_; }
+
+    static uint64_t now_ns();
+
+private:
+    uint64_t emission_ns_;
+    uint64_t tolerance_ns_;
+    std::atomic<uint64_t> tat_{0};
+};
+
+// Per-client GCRA. One TAT cell per client key lives in a fixed-size,
+// open-addressed table of atomics. A cell whose TAT has passed holds no
+// state, so a new key may claim it. When every slot in a key's probe
+// window is live, the key shares its home cell. That over-limits the
+// colliding clients rather than letting a flood of fresh keys bypass
+// the limit.
+class KeyedGcraLimiter {
+public:
+    KeyedGcraLimiter(double rate_per_sec, uint32_t burst, uint32_t slots);
+
+    bool allow(std::string_view key) { return allow(key, GcraLimiter::now_ns()); }
+    bool allow(std::string_view key, uint64_t now);
+
+    size_t slots() const { return mask_ + 1; }
+    const GcraLimiter& rule() const { return rule_; }
+
+private:
+    static constexpr uint32_t kProbe = 8;
+
+    struct alignas(16) Cell {
+        std::atomic<uint64_t> key{0};       // hash of the client key, 0 when free
+        std::atomic<uint64_t> tat{0};
+    };
+
+    GcraLimiter rule_;
+    std::unique_ptr<Cell[]> cells_;
+    uint64_t mask_;
+};
+
+}
+
+#endif
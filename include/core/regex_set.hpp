@@ -0,0 +1,88 @@
+#ifndef CORE_REGEX_SET_HPP
+#define CORE_REGEX_SET_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <bitset>
+
+namespace ultrabalancer {
+
+// A set of regular expressions matched together in one pass. Each pattern
+// is anchored at both ends, as with std::regex_match. The patterns are
+// compiled into one Thompson NFA and then into a DFA over byte classes.
+// If the DFA would exceed its state budget, matching simulates the NFA
+// instead. Either way, the cost is linear in the input.
+//
+// Supported: literals, '.', [...] classes with ranges and negation,
+// \d \w \s and their negations, groups, alternation, and the * + ? {n,m}
+// quantifiers (greedy or lazy). ^ and $ are allowed only at the very start
+// or end of a pattern. Backreferences, lookaround and \b are not compiled;
+// add() rejects them so the caller can keep a backtracking fallback.
+class RegexSet {
+public:
+    static constexpr int unsupported = -1;
+
+    // Returns the pattern's id (ids are dense, from 0), or unsupported
+    int add(std::string_view pattern);
+    void compile();
+
+    size_t size() const { return patterns_; }
+    bool uses_dfa() const { return !dfa_next_.empty(); }
+
+    // Sets bit `id` in the returned bitmap for every pattern that matches
+    // the whole input. The bitmap has (size() + 63) / 64 words. It belongs
+    // to the set or to the calling thread, and is valid until this thread
+    // next calls match().
+    const uint64_t* match(std::string_view input) const;
+
+    static bool test(const uint64_t* bits, int id) {
+        return (bits[id >> 6] >> (id & 63)) & 1;
+    }
+
+private:
+    enum Op : uint8_t { BYTE, SPLIT, MATCH };
+
+    struct State {
+        Op op;
+        uint32_t out{0};
+        uint32_t out1{0};
+        uint32_t set{0};            // BYTE: index into sets_; MATCH: pattern id
+    };
+
+    struct Node;
+    struct Frag;
+    class Parser;
+
+    uint32_t add_state(Op op, uint32_t set = 0);
+    Frag emit(const std::vector<Node>& ast, uint32_t n);
+    // Upper bound on the states emit() creates for n, saturating at limit
+    static size_t nfa_size(const std::vector<Node>& ast, uint32_t n, size_t limit);
+    void patch(const std::vector<uint32_t>& holes, uint32_t target);
+    // Adds s and everything reachable from it through SPLITs to list. A
+    // state is skipped when mark[state] == gen, so callers can reuse mark.
+    void closure(std::vector<uint32_t>& list, std::vector<uint32_t>& mark, uint32_t gen,
+                 std::vector<uint32_t>& stack, uint32_t s) const;
+    void build_dfa();
+    const uint64_t* match_nfa(std::string_view input) const;
+
+    std::vector<State> states_;
+    std::vector<std::bitset<256>> sets_;
+    std::vector<uint32_t> starts_;      // entry state of each pattern
+    uint32_t patterns_{0};
+    unsigned words_{1};
+
+    uint8_t byte_class_[256]{};
+    uint32_t classes_{1};
+
+    // DFA: row per state, column per byte class. State 0 is dead.
+    std::vector<uint32_t> dfa_next_;
+    std::vector<uint64_t> dfa_accept_;
+    uint32_t dfa_start_{0};
+    std::vector<uint64_t> empty_;
+};
+
+}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef CORE_REQUEST_ROUTER_H
+#define CORE_REQUEST_ROUTER_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Match types for router_add_rule(); same order as RouteRule::MatchType
+enum router_match {
+    ROUTER_MATCH_EXACT = 0,
+    ROUTER_MATCH_PREFIX,
+    ROUTER_MATCH_REGEX,
+    ROUTER_MATCH_HEADER,        // pattern is "name:value"
+    ROUTER_MATCH_METHOD,
+    ROUTER_MATCH_QUERY_PARAM,
+};
+
+void* create_request_router(void);
+void destroy_request_router(void* router);
+
+void router_add_route(void* router, const char* name, int priority);
+// Both return 0, or -1 when the route does not exist
+int router_add_rule(void* router, const char* route, int type, const char* pattern);
+int router_add_target(void* router, const char* route, const char* backend, int weight);
+void router_set_default_backend(void* router, const char* backend);
+
+// Backend name for the request, or NULL. headers_json is ignored. The
+// string stays valid until the next call on this thread.
+const char* router_route_request(void* router, const char* method,
+                                 const char* path, const char* headers_json);
+// GCRA limits: burst back-to-back requests, then rps. burst <= 0 means rps.
+void router_enable_rate_limit(void* router, const char* route_name, int rps, int burst);
+void router_enable_client_rate_limit(void* router, const char* route_name, int rps, int burst);
+// 1 when allowed, 0 when limited
+int router_check_rate_limit(void* router, const char* route_name);
+int router_check_client_rate_limit(void* router, const char* route_name, const char* client_key);
+
+// Routing counters as JSON; returns the length written, or -1
+int router_get_stats(void* router, char* buffer, size_t buffer_size);
+void router_reset_stats(void* router);
+
+// Process-wide router registry. configure applies a JSON document (see
+// RouterManager::configure_from_json) atomically and returns 0, or -1
+// when it is malformed. get returns a router owned by the registry.
+int router_manager_configure(const char* json);
+void* router_manager_get(const char* name);
+int router_manager_export(char* buffer, size_t buffer_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,18 +1,31 @@
 #ifndef CORE_REQUEST_ROUTER_HPP
 #define CORE_REQUEST_ROUTER_HPP
 
+#include <cstdint>
 #include <string>
+#include <string_view>
+#include <span>
 #include <vector>
 #include <memory>
 #include <regex>
 #include <functional>
 #include <unordered_map>
 #include <shared_mutex>
+#include <mutex>
+#include <atomic>
 
 #include "core/proxy.h"
+#include "core/regex_set.hpp"
+#include "core/rate_limiter.hpp"
 
 namespace ultrabalancer {
 
+// One request header as seen by the router; points into the request
+struct HeaderRef {
+    std::string_view name;
+    std::string_view value;
+};
+
 class RouteRule {
 public:
     enum class MatchType {
@@ -28,23 +41,73 @@ public:
     ~RouteRule() = default;
 
     bool matches(const std::string& path, const std::unordered_map<std::string, std::string>& headers) const;
+    bool matches(std::string_view method, std::string_view path, std::span<const HeaderRef> headers) const;
 
     void set_weight(int weight) { weight_ = weight; }
     int get_weight() const { return weight_; }
 
+    MatchType get_type() const { return type_; }
+    const std::string& get_pattern() const { return pattern_; }
+
 private:
     MatchType type_;
     std::string pattern_;
+    size_t header_sep_{std::string::npos};  // ':' in a HEADER "name:value"
     std::regex regex_;
     int weight_{100};
 };
 
+// Dense, process-wide ids for request-path counters. Every Route and
+// RouteTarget takes one at construction; the name is kept for get_stats().
+enum class StatKind : uint8_t { INTERNAL, ROUTE, TARGET };
+
+uint32_t stat_register(StatKind kind, const std::string& name);
+StatKind stat_kind(uint32_t id);
+std::string stat_name(uint32_t id);
+
+// Counters indexed by stat id. Each thread increments its own shard, so
+// the request path does no locked instruction and shares no cache line.
+// snapshot() sums the shards. Counts survive the threads that made them.
+class ShardedCounters {
+public:
+    static constexpr uint32_t kChunk = 1024;
+    static constexpr uint32_t kChunks = 1024;
+
+    ShardedCounters();
+    ~ShardedCounters();
+
+    void add(uint32_t id, uint64_t n = 1) {
+        if (id >= kChunk * kChunks) return;
+        std::atomic<uint64_t>* chunk = local()->chunks[id / kChunk].load(std::memory_order_relaxed);
+        if (!chunk) chunk = grow(id / kChunk);
+        auto& slot = chunk[id % kChunk];
+        // Only this thread writes the slot
+        slot.store(slot.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    std::vector<uint64_t> snapshot() const;
+
+private:
+    struct Shard {
+        std::atomic<std::atomic<uint64_t>*> chunks[kChunks]{};
+        ~Shard();
+    };
+
+    Shard* local();
+    std::atomic<uint64_t>* grow(uint32_t chunk);
+
+    uint64_t uid_;
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+};
+
 class RouteTarget {
 public:
     RouteTarget(const std::string& backend_name, int weight = 100);
 
     const std::string& get_backend() const { return backend_name_; }
     int get_weight() const { return weight_; }
+    uint32_t stats_id() const { return stats_id_; }
 
     void set_retry_policy(int max_retries, std::chrono::milliseconds timeout);
     bool should_retry(int attempt) const;
@@ -52,6 +115,7 @@ public:
 private:
     std::string backend_name_;
     int weight_;
+    uint32_t stats_id_;
     int max_retries_{3};
     std::chrono::milliseconds retry_timeout_{1000};
 };
@@ -66,16 +130,34 @@ public:
     bool matches(const std::string& path, const std::unordered_map<std::string, std::string>& headers) const;
     std::shared_ptr<RouteTarget> select_target() const;
 
+    const std::vector<std::shared_ptr<RouteRule>>& get_rules() const { return rules_; }
+    const std::vector<std::shared_ptr<RouteTarget>>& get_targets() const { return targets_; }
+
     void set_priority(int priority) { priority_ = priority; }
     int get_priority() const { return priority_; }
 
     const std::string& get_name() const { return name_; }
+    uint32_t stats_id() const { return stats_id_; }
 
     void enable_circuit_breaker(int error_threshold, std::chrono::seconds reset_timeout);
     bool is_circuit_open() const;
 
+    // Limiters are resolved onto the route so the request path needs no
+    // lookup. Replacing one keeps the old object alive for readers still
+    // holding it.
+    void set_rate_limiter(std::shared_ptr<GcraLimiter> limiter);
+    void set_client_rate_limiter(std::shared_ptr<KeyedGcraLimiter> limiter);
+    std::shared_ptr<GcraLimiter> rate_limiter() const;
+    std::shared_ptr<KeyedGcraLimiter> client_rate_limiter() const;
+
+    // True when the route's limiter, and the client's when a key is given
+    // and per-client limiting is configured, admit the request
+    bool allow_request() const;
+    bool allow_request(std::string_view client_key) const;
+
 private:
     std::string name_;
+    uint32_t stats_id_;
     std::vector<std::shared_ptr<RouteRule>> rules_;
     std::vector<std::shared_ptr<RouteTarget>> targets_;
     int priority_{0};
@@ -87,30 +169,122 @@ private:
     mutable std::atomic<int> errors_{0};
     int error_threshold_{50};
     mutable std::atomic<bool> circuit_open_{false};
-    mutable std::chrono::steady_clock::time_point circuit_open_time_;
+    mutable std::atomic<uint64_t> circuit_open_ns_{0};    // lb_now_ns() when it opened
     std::chrono::seconds circuit_reset_timeout_{30};
     mutable std::shared_mutex circuit_mutex_;
 
     mutable std::atomic<size_t> round_robin_index_{0};
+
+    std::atomic<GcraLimiter*> limiter_{nullptr};
+    std::atomic<KeyedGcraLimiter*> client_limiter_{nullptr};
+    std::shared_ptr<GcraLimiter> limiter_current_;
+    std::shared_ptr<KeyedGcraLimiter> client_limiter_current_;
+    std::vector<std::shared_ptr<void>> limiter_refs_;
+    mutable std::mutex limiter_mutex_;
 };
 
+// Immutable lookup structure built from a route set. The first EXACT or
+// PREFIX rule of each route keys it into a radix trie over the path; its
+// other rules stay attached as predicates. Routes without a path rule are
+// checked in priority order, but only ahead of the best trie match.
+// REGEX rules are compiled together into one RegexSet, run at most once
+// per lookup. The rules are copied in at build time, so editing a Route
+// afterwards does not affect a table readers may be using.
+class CompiledRoutes {
+public:
+    static constexpr uint32_t npos = UINT32_MAX;
+
+    CompiledRoutes(std::vector<std::shared_ptr<Route>> routes,
+                   std::shared_ptr<RouteTarget> default_target);
+
+    // Index of the highest-priority route at or after `from` that matches,
+    // or npos. Does not allocate.
+    uint32_t first_match(std::string_view method, std::string_view path,
+                         std::span<const HeaderRef> headers, uint32_t from = 0) const;
+
+    const Route& route(uint32_t index) const { return *routes_[index]; }
+    size_t size() const { return routes_.size(); }
+    const std::shared_ptr<RouteTarget>& default_target() const { return default_target_; }
+
+private:
+    struct Node {
+        uint32_t label;             // offset of the edge label in labels_
+        uint32_t label_len;
+        uint32_t child;             // children are contiguous, ordered by first byte
+        uint32_t child_count;
+        uint32_t exact;             // ranges of candidates_ ending at this node,
+        uint32_t exact_count;       // each sorted by priority
+        uint32_t prefix;
+        uint32_t prefix_count;
+    };
+
+    struct Lookup {
+        std::string_view method;
+        std::string_view path;
+        std::span<const HeaderRef> headers;
+        const uint64_t* regex_hits;         // filled on first REGEX rule
+    };
+
+    bool predicates_match(uint32_t index, Lookup& req) const;
+    uint32_t best_of(uint32_t begin, uint32_t count, uint32_t from, uint32_t best,
+                     Lookup& req) const;
+
+    std::vector<std::shared_ptr<Route>> routes_;    // in priority order
+    std::vector<uint32_t> key_rule_;                // per route: rule used as the trie key, npos if none
+    std::vector<uint32_t> rule_base_;               // per route: first entry in rules_, plus an end
+    std::vector<std::shared_ptr<RouteRule>> rules_;
+    std::vector<int> rule_regex_;                   // per rule: RegexSet id, or unsupported
+    RegexSet regex_;
+    std::vector<Node> nodes_;
+    std::vector<uint32_t> candidates_;
+    std::vector<uint32_t> linear_;                  // routes without a path key
+    std::string labels_;
+    std::shared_ptr<RouteTarget> default_target_;
+};
+
+// Request-path state is an immutable Snapshot published through an atomic
+// pointer and reclaimed with lb_rcu, so lookups take no lock. Writers
+// serialize on config_mutex_, build a new snapshot to the side and swap
+// it in; readers keep whichever one they loaded.
 class RequestRouter {
 public:
     RequestRouter();
-    ~RequestRouter() = default;
+    ~RequestRouter();
 
     void add_route(std::shared_ptr<Route> route);
     void remove_route(const std::string& name);
 
+    // Replace the whole configuration in one publish. Routes are ordered
+    // by priority; equal priorities keep their order in the vector.
+    void replace_routes(std::vector<std::shared_ptr<Route>> routes, const std::string& default_backend);
+
+    // Rebuild the lookup structure. add_route(), remove_route() and
+    // set_default_backend() do this themselves; call it after changing the
+    // rules of a route that is already in the router.
+    void compile();
+
     std::shared_ptr<RouteTarget> route_request(
         const std::string& method,
         const std::string& path,
         const std::unordered_map<std::string, std::string>& headers);
 
+    std::shared_ptr<RouteTarget> route_request(
+        std::string_view method,
+        std::string_view path,
+        std::span<const HeaderRef> headers);
+
+    std::shared_ptr<Route> find_route(const std::string& name) const;
+    std::vector<std::shared_ptr<Route>> get_routes() const;
+    std::string get_default_backend() const;
+
     void set_default_backend(const std::string& backend);
 
-    void enable_rate_limiting(const std::string& route_name, int requests_per_second);
+    // burst defaults to one second's worth of requests
+    void enable_rate_limiting(const std::string& route_name, int requests_per_second, int burst = 0);
+    void enable_client_rate_limiting(const std::string& route_name, int requests_per_second,
+                                     int burst = 0, uint32_t slots = 65536);
     bool check_rate_limit(const std::string& route_name);
+    bool check_rate_limit(const std::string& route_name, std::string_view client_key);
 
     struct RoutingStats {
         std::unordered_map<std::string, uint64_t> route_hits;
@@ -124,34 +298,36 @@ public:
     void reset_stats();
 
 private:
-    std::vector<std::shared_ptr<Route>> routes_;
-    std::string default_backend_;
-    mutable std::shared_mutex routes_mutex_;
-
-    // Cache default backend target to avoid repeated allocations
-    std::atomic<RouteTarget*> default_backend_target_;
+    using LimiterMap = std::unordered_map<std::string, std::shared_ptr<GcraLimiter>>;
+    using ClientLimiterMap = std::unordered_map<std::string, std::shared_ptr<KeyedGcraLimiter>>;
 
-    struct RateLimiter {
-        int tokens;
-        int max_tokens;
-        std::chrono::steady_clock::time_point last_refill;
-        std::mutex mutex;
+    struct Snapshot {
+        CompiledRoutes routes;
+        LimiterMap rate_limiters;
+        ClientLimiterMap client_limiters;
     };
 
-    std::unordered_map<std::string, std::unique_ptr<RateLimiter>> rate_limiters_;
-    mutable std::mutex rate_limiters_mutex_;
+    std::atomic<const Snapshot*> snapshot_;
 
-    // Internal stats use atomics for lock-free updates
-    struct InternalStats {
-        std::atomic<uint64_t> total_requests{0};
-        std::atomic<uint64_t> routed_requests{0};
-        std::atomic<uint64_t> default_route_hits{0};
-        std::unordered_map<std::string, uint64_t> backend_selections;
-    };
-    mutable InternalStats stats_;
+    // Writer-side state, guarded by config_mutex_. Routes hold their
+    // limiters directly; the maps attach them to routes added later and
+    // serve the by-name checks.
+    std::vector<std::shared_ptr<Route>> routes_;
+    std::string default_backend_;
+    std::shared_ptr<RouteTarget> default_target_;
+    LimiterMap rate_limiters_;
+    ClientLimiterMap client_limiters_;
+    mutable std::mutex config_mutex_;
+
+    void compile_locked();
+
+    // Request-path counters; reset_stats() moves the baseline instead of
+    // writing into other threads' shards
+    ShardedCounters stats_;
+    std::vector<uint64_t> stats_baseline_;
     mutable std::mutex stats_mutex_;
 
-    void refill_tokens(RateLimiter* limiter, int tokens_per_second);
+    void attach_limiters_locked(Route& route);
 };
 
 class RouterManager {
@@ -161,18 +337,26 @@ public:
     std::shared_ptr<RequestRouter> get_router(const std::string& name);
     void register_router(const std::string& name, std::shared_ptr<RequestRouter> router);
 
-    void configure_from_json(const std::string& json_config);
+    // Build every router in the document to the side, then publish them.
+    // A router that already exists gets its routes replaced in place, so
+    // holders of its shared_ptr see the new table. Routers not named are
+    // left alone. Returns false, changing nothing, on a malformed document.
+    // See export_config_json() for the format.
+    bool configure_from_json(const std::string& json_config);
     std::string export_config_json() const;
 
 private:
     RouterManager() = default;
-    ~RouterManager() = default;
+    ~RouterManager();
 
     RouterManager(const RouterManager&) = delete;
     RouterManager& operator=(const RouterManager&) = delete;
 
-    std::unordered_map<std::string, std::shared_ptr<RequestRouter>> routers_;
-    mutable std::shared_mutex mutex_;
+    using RouterMap = std::unordered_map<std::string, std::shared_ptr<RequestRouter>>;
+
+    // Published like RequestRouter's snapshot; writers hold mutex_
+    std::atomic<const RouterMap*> routers_{new RouterMap};
+    mutable std::mutex mutex_;
 };
 
 }
@@ -12,6 +12,60 @@
 extern "C" {
 #endif
 
+// Health and replication lag of every backend in a pool, probed from one
+// thread. Probes are non-blocking and run concurrently, so a slow or dead
+// backend delays nothing but its own result, and every backend is seen
+// each check_interval_ms even at sub-second intervals.
+//
+// With credentials set, each backend keeps one authenticated connection.
+// Replicas answer the lag query, the primary "SELECT 0". Without them
+// only reachability is probed, and lag counts as 0. A replica whose
+// probe fails gets lag UINT64_MAX, so reads leave it at once. A backend
+// is marked down after DB_HEALTH_FAILS_DOWN failures in a row, and up
+// again after one success.
+//
+// PostgreSQL: trust, cleartext and MD5 authentication; SCRAM is not
+// supported. MySQL: mysql_native_password, and caching_sha2_password
+// while its fast path applies. Redis is probed for reachability only.
+#define DB_HEALTH_FAILS_DOWN    3
+#define DB_HEALTH_MAX_PROBES    64
+#define DB_HEALTH_BUF_SIZE      4096
+
+typedef enum {
+    DB_PROBE_IDLE = 0,          // no connection
+    DB_PROBE_CONNECTING,
+    DB_PROBE_AUTH,
+    DB_PROBE_READY,             // authenticated, waiting for the next round
+    DB_PROBE_QUERY
+} db_probe_state_t;
+
+typedef struct {
+    uint64_t backend_id;
+    char host[256];
+    uint16_t port;
+    db_backend_role_t role;
+    db_protocol_type_t protocol;
+
+    int fd;
+    db_probe_state_t state;
+    uint64_t next_ms;           // next round
+    uint64_t deadline_ms;       // for the step in progress
+    uint32_t fails;
+    bool healthy;
+
+    uint8_t in[DB_HEALTH_BUF_SIZE];
+    size_t in_len;
+    uint8_t out[512];
+    size_t out_len;
+    size_t out_off;
+
+    uint8_t seq;                // MySQL packet sequence
+    uint8_t phase;              // MySQL result set parsing
+    bool failed;                // PostgreSQL ErrorResponse seen
+    bool have_value;
+    double value;
+} db_probe_t;
+
 typedef struct {
     db_pool_t* pool;
     atomic_bool running;
@@ -19,8 +73,22 @@ typedef struct {
     uint32_t timeout_ms;
     uint32_t max_lag_ms;
     pthread_t thread;
+
+    char user[64];
+    char password[128];
+    char database[64];
+    char* lag_query[DB_PROTOCOL_REDIS + 1];     // NULL for the default
+
+    db_probe_t* probes;         // probe thread only
+    uint32_t probe_count;
+
+    struct {
+        _Atomic uint64_t rounds;
+        _Atomic uint64_t failures;
+    } stats;
 } db_health_checker_t;
 
+// max_lag_ms becomes the pool's bound for read routing
 db_health_checker_t* db_health_checker_create(db_pool_t* pool,
                                                 uint32_t check_interval_ms,
                                                 uint32_t timeout_ms,
@@ -28,11 +96,18 @@ db_health_checker_t* db_health_checker_create(db_pool_t* pool,
 
 void db_health_checker_destroy(db_health_checker_t* checker);
 
+// Before start; database NULL for the user's default
+int db_health_checker_set_auth(db_health_checker_t* checker, const char* user,
+                               const char* password, const char* database);
+// A query whose first column is the lag in milliseconds
+int db_health_checker_set_lag_query(db_health_checker_t* checker,
+                                    db_protocol_type_t protocol, const char* sql);
+
 int db_health_checker_start(db_health_checker_t* checker);
 void db_health_checker_stop(db_health_checker_t* checker);
 
+// Blocking reachability check of one backend
 int db_health_check_backend(db_backend_t* backend);
-uint64_t db_health_check_replication_lag(db_backend_t* backend);
 
 #ifdef __cplusplus
 }
@@ -28,6 +28,7 @@ typedef struct db_connection_t {
     time_t last_used;
     uint32_t query_count;
     uint64_t backend_id;
+    void* handle;                   // the pool's connection, until released
     struct db_connection_t* next;
 } db_connection_t;
 
@@ -74,8 +75,27 @@ void db_pool_release(db_pool_t* pool, db_connection_t* conn);
 
 db_backend_t* db_pool_select_backend(db_pool_t* pool, db_query_type_t query_type);
 
+// Snapshot of up to max backends, in the order they were added
+uint32_t db_pool_get_backends(db_pool_t* pool, db_backend_t* out, uint32_t max);
+// From the health checker; lag_ms UINT64_MAX when unknown
+void db_pool_set_backend_state(db_pool_t* pool, uint64_t backend_id,
+                               bool healthy, uint64_t lag_ms);
+// Reads go to the least loaded healthy replica at most lag_ms behind,
+// else to the primary. 5000 by default.
+void db_pool_set_max_replica_lag(db_pool_t* pool, uint64_t lag_ms);
+
 int db_pool_validate_connection(db_connection_t* conn);
 
+// Prepared statements known to exist on the server side of conn. They
+// stay with the backend connection across releases, and go when it is
+// closed. Keys are hashes of the statement name and of its text:
+// 1 when name is prepared as text, -1 when prepared as something else,
+// 0 when not prepared.
+int db_pool_conn_prepared(db_connection_t* conn, uint64_t name_hash, uint64_t text_hash);
+void db_pool_conn_set_prepared(db_connection_t* conn, uint64_t name_hash, uint64_t text_hash);
+// name_hash 0 forgets them all
+void db_pool_conn_forget_prepared(db_connection_t* conn, uint64_t name_hash);
+
 void db_pool_cleanup_idle(db_pool_t* pool);
 
 int db_pool_get_stats(db_pool_t* pool, char* buffer, size_t buffer_size);
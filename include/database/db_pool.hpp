@@ -4,13 +4,13 @@
 #include <memory>
 #include <string>
 #include <vector>
-#include <unordered_map>
+#include <array>
 #include <mutex>
-#include <shared_mutex>
 #include <atomic>
 #include <chrono>
 #include <optional>
 #include <variant>
+#include <utility>
 #include "db_protocol.h"
 
 template<typename E>
@@ -105,6 +105,11 @@ public:
     void set_transaction(bool in_tx) noexcept { in_transaction_ = in_tx; }
     [[nodiscard]] bool validate();
 
+    // Server-side prepared statements, as (name hash, text hash)
+    [[nodiscard]] int prepared(uint64_t name_hash, uint64_t text_hash) const noexcept;
+    void set_prepared(uint64_t name_hash, uint64_t text_hash);
+    void forget_prepared(uint64_t name_hash) noexcept;
+
 private:
     int fd_;
     db_protocol_type_t protocol_;
@@ -113,6 +118,7 @@ private:
     std::chrono::steady_clock::time_point created_at_;
     std::chrono::steady_clock::time_point last_used_;
     ConnectionState state_;
+    std::vector<std::pair<uint64_t, uint64_t>> prepared_;
 };
 
 class Backend {
@@ -148,8 +154,49 @@ private:
     std::atomic<uint32_t> active_connections_{0};
 };
 
+// Idle connections of one backend. A Treiber stack over a fixed array of
+// slots: a connection goes into a slot taken from the free list and the
+// slot is pushed on the idle list. Both list heads carry a tag next to the
+// slot index, bumped on every change, so a pop that raced with a pop and a
+// push of the same slot fails its CAS instead of corrupting the list. Slots
+// are never freed, so a stale read of a slot's link is harmless.
+class IdleStack {
+public:
+    explicit IdleStack(uint32_t capacity);
+    ~IdleStack();
+
+    IdleStack(const IdleStack&) = delete;
+    IdleStack& operator=(const IdleStack&) = delete;
+
+    // Hands conn back when the stack is full
+    [[nodiscard]] std::unique_ptr<Connection> push(std::unique_ptr<Connection> conn) noexcept;
+    [[nodiscard]] std::unique_ptr<Connection> pop() noexcept;
+    [[nodiscard]] uint32_t size() const noexcept { return size_.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr uint32_t kNil = UINT32_MAX;
+
+    struct Slot {
+        std::atomic<uint32_t> next{kNil};
+        Connection* conn = nullptr;
+    };
+
+    uint32_t take(std::atomic<uint64_t>& list) noexcept;
+    void put(std::atomic<uint64_t>& list, uint32_t idx) noexcept;
+
+    std::unique_ptr<Slot[]> slots_;
+    alignas(64) std::atomic<uint64_t> idle_;
+    alignas(64) std::atomic<uint64_t> free_;
+    std::atomic<uint32_t> size_{0};
+};
+
 class DatabasePool {
 public:
+    static constexpr uint32_t kMaxBackends = 64;
+    // A connection idle for less than this is handed out without the
+    // recv() probe; one that died in the meantime fails its first query.
+    static constexpr std::chrono::seconds kValidateAfter{1};
+
     DatabasePool(uint32_t max_connections, uint32_t min_idle, uint32_t max_idle,
                  std::chrono::seconds max_lifetime, std::chrono::seconds idle_timeout);
     ~DatabasePool();
@@ -175,14 +222,34 @@ public:
     [[nodiscard]] std::string get_stats_json() const;
 
     [[nodiscard]] Backend* get_backend_by_id(uint64_t id) const noexcept;
+    [[nodiscard]] Backend* get_backend_at(uint32_t index) const noexcept;
+    [[nodiscard]] uint32_t backend_count() const noexcept {
+        return backend_count_.load(std::memory_order_acquire);
+    }
+
+    // Replicas further behind than this serve no reads
+    void set_max_replica_lag(std::chrono::milliseconds lag) noexcept {
+        max_replica_lag_ms_.store(lag.count(), std::memory_order_relaxed);
+    }
 
 private:
     [[nodiscard]] std::unique_ptr<Connection> create_new_connection(Backend* backend);
     [[nodiscard]] Backend* select_primary();
     [[nodiscard]] Backend* select_replica();
+    [[nodiscard]] IdleStack* idle_stack(uint64_t backend_id) const noexcept;
+    void close_connection(std::unique_ptr<Connection> conn) noexcept;
+
+    struct BackendSlot {
+        BackendSlot(std::unique_ptr<Backend> b, uint32_t max_idle)
+            : backend(std::move(b)), idle(max_idle) {}
+        std::unique_ptr<Backend> backend;
+        IdleStack idle;
+    };
 
-    std::vector<std::unique_ptr<Backend>> backends_;
-    std::unordered_map<uint64_t, std::vector<std::unique_ptr<Connection>>> idle_connections_;
+    // Backend ids are 1-based slot indexes. Slots are filled once and never
+    // moved, and backend_count_ publishes them, so lookups take no lock.
+    std::array<std::unique_ptr<BackendSlot>, kMaxBackends> backends_;
+    std::atomic<uint32_t> backend_count_{0};
 
     uint32_t max_connections_;
     uint32_t min_idle_;
@@ -190,11 +257,11 @@ private:
     std::chrono::seconds max_lifetime_;
     std::chrono::seconds idle_timeout_;
 
-    std::atomic<uint64_t> next_backend_id_{1};
     std::atomic<uint32_t> total_connections_{0};
+    std::atomic<uint64_t> max_replica_lag_ms_{5000};
 
     ConnectionStats stats_;
-    mutable std::shared_mutex mutex_;
+    std::mutex mutex_;          // add_backend() against itself
 };
 
 }
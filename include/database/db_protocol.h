@@ -48,4 +48,23 @@ db_query_type_t db_protocol_classify_query(const char* query, size_t length);
 
 bool db_protocol_is_handshake(const uint8_t* data, size_t length, db_protocol_type_t protocol);
 
+// SQL-level prepared statements: PREPARE name ..., EXECUTE name ...,
+// DEALLOCATE [PREPARE] name and DROP PREPARE name. name points into
+// query, quotes included; name_len is 0 for DEALLOCATE ALL.
+typedef enum {
+    DB_PREPARED_NONE = 0,
+    DB_PREPARED_PREPARE,
+    DB_PREPARED_EXECUTE,
+    DB_PREPARED_DEALLOCATE
+} db_prepared_op_t;
+
+db_prepared_op_t db_protocol_parse_prepared(const char* query, size_t length,
+                                            const char** name, size_t* name_len);
+
+// Sends sql as one simple query (PostgreSQL 'Q', MySQL COM_QUERY) on a
+// connection with no reply outstanding, and reads the whole reply.
+// Blocks for at most timeout_ms. 0 when the server reported no error.
+int db_protocol_run_query(int fd, db_protocol_type_t protocol,
+                          const char* sql, size_t length, int timeout_ms);
+
 #endif
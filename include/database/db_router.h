@@ -5,31 +5,112 @@
 #include "db_pool.h"
 #include <stdint.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <time.h>
 
-typedef struct {
+// Sessions are spread over shards by a hash of the client session id.
+// Each shard has its own lock, a chained hash table, and an idle list of
+// its sessions outside a transaction, least recently used first. Finding
+// a session and evicting one are O(1), and workers touching different
+// shards never meet. A shard holds max_sessions / DB_ROUTER_SHARDS
+// sessions (rounded up) and evicts only its own.
+#define DB_ROUTER_SHARDS 16
+
+// How client sessions map onto backend connections.
+//
+// DB_ROUTER_SESSION: a session sticks to its backend once it starts a
+// transaction or sets a variable. Each query leases a connection from the
+// pool, and the caller gives it back with db_pool_release().
+//
+// DB_ROUTER_TRANSACTION: like pgbouncer's transaction pooling. A session
+// holds a backend connection for one statement, or from BEGIN until the
+// statement that ends the transaction, so a few backend connections serve
+// many clients. The caller must hand every connection back with
+// db_router_release(), which keeps it leased while a transaction is open.
+// After SET the session's state lives on one connection, so the session
+// keeps that connection until db_router_end_session().
+//
+// SQL-level prepared statements are recorded per session. EXECUTE on a
+// connection that does not have the statement prepares it there first,
+// with a synchronous round trip of at most DB_ROUTER_PREPARE_TIMEOUT_MS.
+// A session's statements are assumed to run one at a time.
+typedef enum {
+    DB_ROUTER_SESSION = 0,
+    DB_ROUTER_TRANSACTION
+} db_router_mode_t;
+
+#define DB_ROUTER_PREPARE_TIMEOUT_MS 1000
+
+typedef struct db_prepared_t {
+    uint64_t name_hash;
+    uint64_t text_hash;
+    char* name;                         // as written, for DEALLOCATE
+    char* sql;                          // the PREPARE statement itself
+    size_t sql_len;
+    struct db_prepared_t* next;
+} db_prepared_t;
+
+typedef struct db_session_t {
     uint64_t session_id;
     uint64_t backend_id;
     bool in_transaction;
+    bool pinned;                        // transaction mode after SET
     time_t last_activity;
+    uint64_t last_write_ms;             // monotonic, for read-your-writes
+    db_connection_t* lease;             // transaction mode, while held
+    db_prepared_t* prepared;
+    struct db_session_t* hash_next;     // bucket chain, or the free list
+    struct db_session_t* lru_prev;      // idle list; unlinked while busy
+    struct db_session_t* lru_next;
 } db_session_t;
 
+typedef struct {
+    pthread_mutex_t lock;
+    db_session_t** buckets;
+    uint32_t mask;
+    uint32_t count;
+    uint32_t capacity;
+    db_session_t* free;
+    db_session_t* lru_head;             // next to evict
+    db_session_t* lru_tail;
+} __attribute__((aligned(64))) db_router_shard_t;
+
 typedef struct db_router_t {
     db_pool_t* pool;
-    db_session_t* sessions;
-    uint32_t session_count;
+    db_session_t* sessions;             // every slot, carved up between shards
     uint32_t max_sessions;
-    void* mutex;
+    db_router_mode_t mode;
+    uint32_t ryw_window_ms;
+    db_router_shard_t shards[DB_ROUTER_SHARDS];
+
+    struct {
+        _Atomic uint64_t leases;        // transaction mode, connections leased
+        _Atomic uint64_t reprepares;
+        _Atomic uint64_t reprepare_failures;
+    } stats;
 } db_router_t;
 
 db_router_t* db_router_create(db_pool_t* pool, uint32_t max_sessions);
 void db_router_destroy(db_router_t* router);
+// Set before the first query
+void db_router_set_mode(db_router_t* router, db_router_mode_t mode);
+// Read-your-writes: for window_ms after a session writes or commits, its
+// reads go to the primary, which a replica may not have caught up with.
+// Pick it above the replicas' usual lag. 0, the default, turns it off.
+void db_router_set_read_your_writes(db_router_t* router, uint32_t window_ms);
 
 db_connection_t* db_router_route_query(db_router_t* router,
                                         const uint8_t* query_data,
                                         size_t query_length,
                                         uint64_t client_session_id);
 
+// Hands back a connection from db_router_route_query() once its reply has
+// been read. Needed in transaction mode; in session mode it amounts to
+// db_pool_release().
+void db_router_release(db_router_t* router, uint64_t client_session_id,
+                       db_connection_t* conn);
+
 void db_router_end_session(db_router_t* router, uint64_t client_session_id);
 
 int db_router_get_stats(db_router_t* router, char* buffer, size_t buffer_size);
@@ -181,6 +181,13 @@ int check_ldap(check_t *check);
 int check_ssl(check_t *check);
 int check_external(check_t *check);
 
+// Protocol halves of the probes above, shared with the event-driven
+// checker in health.c
+int check_probe_request(const check_t *check, char *buf, size_t size, bool keepalive);
+bool check_probe_expects_response(const check_t *check);
+check_status_t check_probe_response(const check_t *check, const char *buf, size_t len,
+                                    size_t *consumed, char *desc, size_t desc_size);
+
 int process_check_result(check_t *check);
 void set_server_check_status(check_t *check, check_status_t status, const char *desc);
 void set_server_up(check_t *check);
@@ -0,0 +1,136 @@
+#ifndef HTTP_H2_H
+#define HTTP_H2_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include "core/common.h"
+
+// HTTP/2 framing (RFC 9113) and HPACK (RFC 7541) for the frontend in
+// src/network/lb_h2.c. Nothing here does I/O or allocates: frames are
+// encoded into caller buffers and header blocks decode into a fixed
+// hpack_headers_t.
+
+#define H2_PREFACE          "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LEN      24
+#define H2_FRAME_HDR_LEN    9
+#define H2_DEFAULT_FRAME    16384
+#define H2_MAX_FRAME        16777215
+#define H2_DEFAULT_WINDOW   65535
+#define H2_MAX_WINDOW       0x7fffffff
+
+enum h2_frame_type {
+    H2_FT_DATA = 0,
+    H2_FT_HEADERS,
+    H2_FT_PRIORITY,
+    H2_FT_RST_STREAM,
+    H2_FT_SETTINGS,
+    H2_FT_PUSH_PROMISE,
+    H2_FT_PING,
+    H2_FT_GOAWAY,
+    H2_FT_WINDOW_UPDATE,
+    H2_FT_CONTINUATION,
+};
+
+#define H2_F_END_STREAM     0x01
+#define H2_F_ACK            0x01
+#define H2_F_END_HEADERS    0x04
+#define H2_F_PADDED         0x08
+#define H2_F_PRIORITY       0x20
+
+enum h2_error {
+    H2_NO_ERROR = 0,
+    H2_PROTOCOL_ERROR,
+    H2_INTERNAL_ERROR,
+    H2_FLOW_CONTROL_ERROR,
+    H2_SETTINGS_TIMEOUT,
+    H2_STREAM_CLOSED,
+    H2_FRAME_SIZE_ERROR,
+    H2_REFUSED_STREAM,
+    H2_CANCEL,
+    H2_COMPRESSION_ERROR,
+    H2_CONNECT_ERROR,
+    H2_ENHANCE_YOUR_CALM,
+    H2_INADEQUATE_SECURITY,
+    H2_HTTP_1_1_REQUIRED,
+};
+
+enum h2_setting {
+    H2_SET_HEADER_TABLE_SIZE = 1,
+    H2_SET_ENABLE_PUSH,
+    H2_SET_MAX_CONCURRENT_STREAMS,
+    H2_SET_INITIAL_WINDOW_SIZE,
+    H2_SET_MAX_FRAME_SIZE,
+    H2_SET_MAX_HEADER_LIST_SIZE,
+};
+
+void h2_frame_decode(const uint8_t* p, struct h2_frame* frm);
+uint8_t* h2_frame_encode(uint8_t* p, uint32_t len, uint8_t type, uint8_t flags, uint32_t sid);
+
+// HPACK dynamic table. Entries live in a byte ring; RFC 7541 accounts
+// 32 bytes of overhead per entry, so the bytes actually stored always fit
+// in HPACK_TABLE_SIZE.
+#define HPACK_TABLE_SIZE    4096
+#define HPACK_MAX_ENTRIES   (HPACK_TABLE_SIZE / 32)
+
+typedef struct hpack_table {
+    uint32_t max_size;          // current limit, at most HPACK_TABLE_SIZE
+    uint32_t size;              // RFC 7541 size of the entries held
+    uint32_t count;
+    uint32_t newest;            // ent[] slot of dynamic index 62
+    uint32_t head;              // arena offset the next entry is written at
+    struct {
+        uint16_t pos;
+        uint16_t nlen;
+        uint16_t vlen;
+    } ent[HPACK_MAX_ENTRIES];
+    char arena[HPACK_TABLE_SIZE];
+} hpack_table_t;
+
+// One decoded header block. Names and values are copied into buf, which is
+// also the SETTINGS_MAX_HEADER_LIST_SIZE limit the frontend advertises.
+#define HPACK_LIST_MAX      16384
+#define HPACK_HDR_MAX       128
+
+typedef struct hpack_hdr {
+    uint16_t name;
+    uint16_t nlen;
+    uint16_t value;
+    uint16_t vlen;
+} hpack_hdr_t;
+
+typedef struct hpack_headers {
+    uint32_t count;
+    uint32_t used;
+    hpack_hdr_t h[HPACK_HDR_MAX];
+    char buf[HPACK_LIST_MAX];
+} hpack_headers_t;
+
+void hpack_table_init(hpack_table_t* t);
+void hpack_table_resize(hpack_table_t* t, uint32_t max_size);
+
+// Decode a complete header block. Returns 0, or -1 on a compression
+// error, which is fatal for the connection (the table is out of sync).
+int hpack_decode(hpack_table_t* t, const uint8_t* p, size_t len, hpack_headers_t* out);
+
+// Append one header field to out. Fields found in the static or dynamic
+// table are sent as an index; others as literals, entered into the
+// table when index is set. Returns the bytes written, 0 if cap is short.
+size_t hpack_encode(hpack_table_t* t, uint8_t* out, size_t cap,
+                    const char* name, size_t nlen, const char* value, size_t vlen, bool index);
+size_t hpack_encode_table_size(uint8_t* out, size_t cap, uint32_t size);
+
+// Huffman-coded string literal (RFC 7541 Appendix B). Returns the decoded
+// length, or -1 when the input is not a valid code or does not fit.
+ssize_t hpack_huffman_decode(const uint8_t* p, size_t len, char* out, size_t cap);
+
+static inline const char* hpack_name(const hpack_headers_t* hs, uint32_t i) {
+    return hs->buf + hs->h[i].name;
+}
+
+static inline const char* hpack_value(const hpack_headers_t* hs, uint32_t i) {
+    return hs->buf + hs->h[i].value;
+}
+
+#endif
@@ -3,11 +3,13 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <sys/types.h>
 #include "core/common.h"
 
 struct stream;
 struct channel;
+struct lb_arena;
 
 #define HTTP_MSG_RQBEFORE     0x00000001
 #define HTTP_MSG_RQMETH       0x00000002
@@ -22,6 +24,8 @@ struct channel;
 #define HTTP_MSG_CHUNK_CRLF   0x00000400
 #define HTTP_MSG_DONE         0x00000800
 #define HTTP_MSG_ERROR        0x00001000
+#define HTTP_MSG_DATA         0x00002000    // Content-Length body, chunk_len bytes left
+#define HTTP_MSG_TRAILERS     0x00004000
 
 #define HTTP_METH_OPTIONS     0x0001
 #define HTTP_METH_GET         0x0002
@@ -33,6 +37,35 @@ struct channel;
 #define HTTP_METH_CONNECT     0x0080
 #define HTTP_METH_PATCH       0x0100
 
+// Offset/length of a piece of a message in the buffer it was parsed
+// from (struct buffer::area)
+typedef struct http_slice {
+    uint32_t pos;
+    uint32_t len;
+} http_slice_t;
+
+typedef struct http_hdr {
+    http_slice_t n;
+    http_slice_t v;
+} http_hdr_t;
+
+// Headers routing and ACLs ask for, indexed as they are parsed
+enum http_known_hdr {
+    HTTP_HDR_HOST,
+    HTTP_HDR_CONTENT_LENGTH,
+    HTTP_HDR_CONNECTION,
+    HTTP_HDR_UPGRADE,
+    HTTP_HDR_TRANSFER_ENCODING,
+    HTTP_HDR_KNOWN,
+    HTTP_HDR_OTHER = HTTP_HDR_KNOWN
+};
+
+// Headers kept inside http_msg_t; a message with more spills the rest
+// into an array it keeps across http_msg_reset(). A message given an
+// arena takes the array from it instead and drops it on reset, since the
+// arena is reset with the request.
+#define HTTP_HDR_INLINE 32
+
 typedef struct http_msg {
     uint32_t msg_state;
     uint32_t flags;
@@ -57,14 +90,24 @@ typedef struct http_msg {
         int32_t len;
     } som, eom;
 
-    int64_t sov;
+    int64_t sov;                        // where the body starts, once the headers are in
     int64_t next;
 
     uint32_t meth;
-    char *uri;
-    size_t uri_len;
+    http_slice_t uri;
+
+    uint32_t hdr_count;
+    uint32_t spill_cap;
+    http_hdr_t *spill;                  // headers HTTP_HDR_INLINE and up
+    struct lb_arena *arena;             // optional, survives http_msg_reset()
+    uint16_t known[HTTP_HDR_KNOWN];     // 1 + index of the first one, 0 if absent
+    http_hdr_t hdrs[HTTP_HDR_INLINE];
 } http_msg_t;
 
+// http_txn flags
+#define TX_REQ_RULES_DONE     0x00000001    // http-request rules evaluated
+#define TX_RES_RULES_DONE     0x00000002    // http-response rules evaluated
+
 typedef struct http_txn {
     uint16_t status;
     uint32_t flags;
@@ -91,20 +134,6 @@ typedef struct http_txn {
     struct http_req_rule *rules;
 } http_txn_t;
 
-typedef struct http_hdr {
-    struct {
-        char *ptr;
-        size_t len;
-    } n;
-
-    struct {
-        char *ptr;
-        size_t len;
-    } v;
-
-    struct http_hdr *next;
-} http_hdr_t;
-
 typedef struct h1_conn {
     uint32_t flags;
     struct buffer ibuf;
@@ -160,6 +189,14 @@ int http_parse_status_line(http_msg_t *msg, char *data, size_t len);
 int http_parse_headers(http_msg_t *msg, struct buffer *buf);
 int http_parse_chunk_size(http_msg_t *msg, struct buffer *buf);
 
+// Bodies are framed as they arrive: in the data states msg->next moves over
+// whatever payload the buffer holds and chunk_len counts what is still to
+// come, so nothing waits for a whole chunk. Bytes before msg->next are
+// framed and may be forwarded; http_msg_consume() then rebases the message
+// once the caller drops them from the front of the buffer. Header slices
+// point into the head, so only consume past it once they are no longer used.
+void http_msg_consume(http_msg_t *msg, size_t n);
+
 int http_process_request(struct stream *s, struct channel *req);
 int http_process_response(struct stream *s, struct channel *res);
 int http_process_tarpit(struct stream *s, struct channel *req);
@@ -170,7 +207,25 @@ int http_wait_for_response(struct stream *s, struct channel *rep);
 void http_txn_reset_req(http_txn_t *txn);
 void http_txn_reset_res(http_txn_t *txn);
 
-int http_header_add_tail(http_msg_t *msg, http_hdr_t *hdr);
+void http_msg_reset(http_msg_t *msg);
+void http_msg_release(http_msg_t *msg);
+
+int http_known_hdr_id(const char *name, size_t len);
+
+static inline const http_hdr_t *http_msg_hdr(const http_msg_t *msg, uint32_t i) {
+    return i < HTTP_HDR_INLINE ? &msg->hdrs[i] : &msg->spill[i - HTTP_HDR_INLINE];
+}
+
+// First header of a well-known kind, or NULL; no scan, no allocation
+static inline const http_hdr_t *http_msg_known(const http_msg_t *msg, enum http_known_hdr id) {
+    return msg->known[id] ? http_msg_hdr(msg, msg->known[id] - 1) : NULL;
+}
+
+const http_hdr_t *http_msg_find(const http_msg_t *msg, const struct buffer *buf, const char *name);
+
+static inline const char *http_slice_ptr(const struct buffer *buf, http_slice_t s) {
+    return buf->area + s.pos;
+}
 int http_header_add(http_msg_t *msg, const char *name, const char *value);
 int http_header_del(http_msg_t *msg, const char *name);
 char* http_header_get(http_msg_t *msg, const char *name);
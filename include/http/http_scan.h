@@ -0,0 +1,22 @@
+#ifndef HTTP_HTTP_SCAN_H
+#define HTTP_HTTP_SCAN_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Vectorised delimiter search for the HTTP/1.x header parser. It uses
+// AVX2 (32 bytes per step) or SSE4.2 (16) when the build targets them
+// and a table lookup otherwise. Every scan returns the first byte in
+// [p, end) that stops it, or end when there is none.
+
+// First byte that is not an RFC 9110 tchar, i.e. the end of a method or
+// header name
+const char* http_scan_token(const char* p, const char* end);
+
+// First control character other than HTAB (CR, LF, or one no field value
+// may contain)
+const char* http_scan_ctl(const char* p, const char* end);
+
+bool http_is_tchar(unsigned char c);
+
+#endif
@@ -9,6 +9,9 @@
 #include <openssl/engine.h>
 #include <openssl/ocsp.h>
 #include "core/common.h"
+#include "ssl/ssl_session.h"
+#include "ssl/ssl_async.h"
+#include "ssl/ssl_sni.h"
 
 struct server;
 
@@ -19,6 +22,8 @@ struct server;
 
 #define SSL_SOCK_FL_SSL_STARTED      0x00000001
 #define SSL_SOCK_FL_HANDSHAKE_DONE   0x00000002
+#define SSL_SOCK_FL_KTLS_TX          0x00000004  // the kernel encrypts what we send
+#define SSL_SOCK_FL_KTLS_RX          0x00000008
 
 typedef struct ssl_bind_conf {
     SSL_CTX *ctx;
@@ -35,6 +40,7 @@ typedef struct ssl_bind_conf {
 
     int verify;
     int verify_depth;
+    int ktls;                   // hand the session keys to the kernel
 
     struct {
         char *cert;
@@ -45,13 +51,29 @@ typedef struct ssl_bind_conf {
     } *sni_ctx;
     int sni_ctx_count;
 
+    // Per-name certificates from a directory, looked up by hash
+    char *crt_dir;
+    unsigned int sni_cache_size;    // SSL_CTXs built at once
+    ssl_sni_t *sni;
+
     DH *dh_params;
 
     struct {
         unsigned int lifetime;
         unsigned int size;
+        char *shm;              // shared across processes under this name
     } session_cache;
 
+    struct {
+        char *keys_file;
+        char *secret_file;
+        unsigned int rotate;
+    } tickets;
+
+    // Built by the first ssl_ctx_new() and shared by the SNI contexts
+    ssl_tickets_t *ticket_keys;
+    ssl_sess_cache_t *sess_cache;
+
     struct ssl_bind_conf *next;
 } ssl_bind_conf_t;
 
@@ -78,6 +100,11 @@ typedef struct ssl_sock_ctx {
     struct wait_event wait_event;
     struct wait_event *recv_wait;
     struct wait_event *send_wait;
+
+    // Handshake step queued with ssl_async_handshake()
+    struct ssl_async *async;
+    struct ssl_sock_ctx *async_next;
+    int async_ret;
 } ssl_sock_ctx_t;
 
 typedef struct tls_version {
@@ -110,6 +137,18 @@ int ssl_sock_recv(struct connection *conn, void *buf, size_t len, int flags);
 int ssl_sock_send(struct connection *conn, const void *buf, size_t len, int flags);
 int ssl_sock_close(struct connection *conn);
 
+// Kernel TLS. With ktls set on the bind, OpenSSL installs the negotiated
+// keys into the socket at the end of the handshake when the kernel and
+// the cipher allow it. From then on the kernel encrypts what is written
+// to the socket, so ssl_sock_send() goes straight to send(), and
+// ssl_sock_ktls_fd() hands callers the socket for sendfile() or splice().
+// A NIC with TLS offload then does the encryption itself. Reads stay on
+// SSL_read() even with kTLS RX: the kernel decrypts, but records that are
+// not application data (alerts, tickets, key updates) still need OpenSSL.
+int ssl_sock_ktls_fd(struct connection *conn);
+// Sends len bytes of in_fd from off; through user space without kTLS TX
+ssize_t ssl_sock_sendfile(struct connection *conn, int in_fd, off_t off, size_t len);
+
 int ssl_sock_get_alpn(struct connection *conn, const char **str, int *len);
 const char* ssl_sock_get_sni(struct connection *conn);
 int ssl_sock_get_cert_used(struct connection *conn);
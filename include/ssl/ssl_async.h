@@ -0,0 +1,69 @@
+#ifndef SSL_SSL_ASYNC_H
+#define SSL_SSL_ASYNC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+struct connection;
+struct ssl_sock_ctx;
+
+// TLS handshakes off the event loop. The signing and key agreement in a
+// full handshake take hundreds of microseconds, and an event loop that
+// runs them inline stalls every other connection it serves. So handshake
+// steps run on a shared pool of crypto threads. The default provider's
+// private key operations never yield, so OpenSSL's own async jobs
+// (SSL_MODE_ASYNC) would not help without a hardware engine.
+//
+// Each worker has an ssl_async_t, whose eventfd it adds to its epoll set.
+// ssl_async_handshake() queues the connection's next handshake step, that
+// is one SSL_accept() or SSL_connect() call, and returns right away. When
+// the step is done the connection goes on the worker's completion list
+// and the eventfd fires. The worker then calls ssl_async_complete(). It
+// calls back once per connection with what ssl_sock_handshake() returned:
+//   1   the handshake is done;
+//   0   it needs I/O, and CO_FL_WAIT_RD or CO_FL_WAIT_WR says which;
+//   -1  it failed.
+// Between queueing and the callback, the connection belongs to the
+// crypto thread and the worker must not touch it.
+#define SSL_CRYPTO_THREADS_MAX  64
+
+typedef struct ssl_crypto_pool {
+    pthread_t threads[SSL_CRYPTO_THREADS_MAX];
+    int nthreads;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct ssl_sock_ctx *head, *tail;
+    bool stop;
+
+    struct {
+        _Atomic uint64_t steps;
+        _Atomic uint32_t queued;
+    } stats;
+} ssl_crypto_pool_t;
+
+typedef struct ssl_async {
+    ssl_crypto_pool_t *pool;
+    int fd;                     // eventfd, readable with completions waiting
+    pthread_mutex_t lock;
+    struct ssl_sock_ctx *done;
+    uint32_t in_flight;         // owner thread only
+} ssl_async_t;
+
+typedef void (*ssl_async_cb_t)(struct connection *conn, int ret, void *arg);
+
+// threads <= 0 for one per two CPUs
+ssl_crypto_pool_t* ssl_crypto_pool_new(int threads);
+void ssl_crypto_pool_free(ssl_crypto_pool_t *pool);
+
+ssl_async_t* ssl_async_new(ssl_crypto_pool_t *pool);
+void ssl_async_free(ssl_async_t *a);
+
+// -1 when the step could not be queued; the connection is still ours
+int ssl_async_handshake(ssl_async_t *a, struct connection *conn);
+// Callbacks for the steps finished so far; returns how many
+int ssl_async_complete(ssl_async_t *a, ssl_async_cb_t cb, void *arg);
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef SSL_SSL_SESSION_H
+#define SSL_SSL_SESSION_H
+
+#include <openssl/ssl.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+
+// TLS session resumption that carries across processes and nodes.
+//
+// Tickets: the server hands the client its session state encrypted under
+// a ticket key, so whichever process holds that key can resume it. The
+// keys come from one of:
+//   - a keys file with one base64 key of 80 bytes per line: 16 bytes of
+//     name, 32 of AES key, 32 of HMAC key, as nginx and haproxy use. The
+//     first key encrypts and the others only decrypt. The file is read
+//     again when it changes, so rotating means pushing a new file to
+//     every node, with the new key first and the previous ones after it;
+//   - a shared secret. Every node derives the key for each rotation
+//     period itself, as HMAC-SHA256(secret, period number), so nodes with
+//     the same secret rotate together without exchanging anything. The
+//     current period's key encrypts. The previous and next periods' keys
+//     decrypt, for tickets issued just before a rotation and for clocks
+//     that are a little apart;
+//   - nothing: random keys, rotated on the same schedule but known only
+//     to this process.
+// A ticket decrypted with a key that no longer encrypts is renewed.
+//
+// Session ID cache, for clients without tickets: sessions are stored DER
+// encoded in a POSIX shared memory segment, so a session set up by one
+// SO_REUSEPORT process resumes in another on the same host. Each bucket
+// holds SSL_SESS_WAYS sessions and replaces the one closest to expiry.
+// Buckets are guarded by a seqlock, and a writer takes it by making the
+// sequence odd. If a process dies mid-write, that one bucket stops
+// caching until the segment is recreated.
+#define SSL_TICKET_KEYS_MAX     8
+#define SSL_TICKET_KEY_SIZE     80
+#define SSL_TICKET_ROTATE_SEC   3600
+#define SSL_TICKET_CHECK_SEC    10      // keys file change check
+
+#define SSL_SESS_WAYS           4
+#define SSL_SESS_DER_MAX        1968
+
+typedef struct ssl_ticket_key {
+    unsigned char name[16];
+    unsigned char aes[32];
+    unsigned char hmac[32];
+} ssl_ticket_key_t;
+
+typedef struct ssl_ticket_keys {
+    int count;                  // keys[0] encrypts
+    ssl_ticket_key_t keys[SSL_TICKET_KEYS_MAX];
+} ssl_ticket_keys_t;
+
+typedef struct ssl_tickets {
+    _Atomic(ssl_ticket_keys_t *) keys;      // RCU-published
+    char *path;
+    unsigned char *secret;
+    size_t secret_len;
+    unsigned int rotate;
+
+    _Atomic bool updating;
+    _Atomic int64_t next_update;
+    int64_t period;             // derived and random keys: period in use
+    struct timespec mtime;      // keys file
+
+    struct {
+        _Atomic uint64_t issued;
+        _Atomic uint64_t resumed;
+        _Atomic uint64_t renewed;       // resumed with an older key
+        _Atomic uint64_t unknown;
+    } stats;
+} ssl_tickets_t;
+
+// Random keys rotated every rotate seconds (0 for SSL_TICKET_ROTATE_SEC)
+// until a keys file or a secret is given
+ssl_tickets_t* ssl_tickets_new(unsigned int rotate);
+void ssl_tickets_free(ssl_tickets_t *t);
+
+int ssl_tickets_load_file(ssl_tickets_t *t, const char *path);
+// At least 16 bytes; ssl_tickets_load_secret() reads them from a file
+int ssl_tickets_set_secret(ssl_tickets_t *t, const void *secret, size_t len);
+int ssl_tickets_load_secret(ssl_tickets_t *t, const char *path);
+
+// Rotates or reloads the keys when due. The ticket callback calls this
+// itself, so a timer is only needed to reload the keys file when no
+// handshakes are happening. Returns 1 when the keys changed.
+int ssl_tickets_update(ssl_tickets_t *t, time_t now);
+
+int ssl_ctx_set_tickets(SSL_CTX *ctx, ssl_tickets_t *t);
+
+typedef struct ssl_sess_cache ssl_sess_cache_t;
+
+typedef struct ssl_sess_cache_stats {
+    uint64_t stores;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t too_big;
+    uint64_t busy;              // bucket locked by another writer
+} ssl_sess_cache_stats_t;
+
+// Opens the segment shared by every process using the same name. The
+// segment holds about size sessions; NULL on failure.
+ssl_sess_cache_t* ssl_sess_cache_open(const char *name, uint32_t size);
+void ssl_sess_cache_close(ssl_sess_cache_t *c);
+void ssl_sess_cache_get_stats(ssl_sess_cache_t *c, ssl_sess_cache_stats_t *out);
+
+// Serves ctx's session ID lookups from c only, instead of OpenSSL's
+// per-process cache
+int ssl_ctx_set_sess_cache(SSL_CTX *ctx, ssl_sess_cache_t *c);
+
+#endif
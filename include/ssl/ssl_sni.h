@@ -0,0 +1,98 @@
+#ifndef SSL_SSL_SNI_H
+#define SSL_SSL_SNI_H
+
+#include <openssl/ssl.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+struct ssl_bind_conf;
+
+// Certificate selection by SNI for large numbers of hosted names. The
+// index is an open-addressing hash table keyed by lowercase hostname.
+// Wildcard certificates are keyed by the part after "*.", so a lookup
+// costs at most two probes: the exact name, then the name without its
+// first label. It is published under RCU, and a handshake reads it
+// without locks.
+//
+// Certificates come from a directory with one PEM file per name. Each
+// file holds the chain and the key, and its name is the hostname plus
+// ".pem". Wildcards are written "*.example.com.pem" or "_.example.com.pem".
+// Loading the directory only lists it. An entry's SSL_CTX is built on its
+// first handshake, from the bind's settings and the file.
+//
+// At most max_built contexts exist at once. Built entries sit in a CLOCK
+// ring, an approximation of LRU: a hit sets a bit instead of taking a
+// lock, and eviction gives entries with the bit set one more pass. An
+// evicted entry is rebuilt on its next handshake.
+//
+// ssl_sni_reload() lists the directory again and swaps the index in.
+// New, changed and removed files take effect without a restart.
+// Unchanged entries keep their built context. Reloads run at the caller's
+// pace, typically from ssl_sni_update() on a timer: listing thousands of
+// files has no place inside a handshake.
+#define SSL_SNI_MAX_BUILT       1024
+#define SSL_SNI_CHECK_SEC       10
+
+typedef struct ssl_sni_entry {
+    char *name;                 // lowercase, without the "*." of a wildcard
+    uint32_t len;
+    char *path;                 // chain and key; NULL for a pinned context
+    struct timespec mtime;
+    bool wildcard;
+    bool dead;                  // left out by a reload, and retired
+    bool on_clock;
+    _Atomic bool referenced;
+    _Atomic(SSL_CTX *) ctx;
+    struct ssl_sni_entry *clock_next;
+} ssl_sni_entry_t;
+
+typedef struct ssl_sni_index {
+    uint32_t mask;
+    uint32_t count;
+    ssl_sni_entry_t **slots;
+    ssl_sni_entry_t *entries[];
+} ssl_sni_index_t;
+
+typedef struct ssl_sni {
+    _Atomic(ssl_sni_index_t *) index;       // RCU-published
+    struct ssl_bind_conf *conf;             // settings for built contexts
+    char *dir;
+
+    pthread_mutex_t lock;       // the clock ring, index swaps
+    ssl_sni_entry_t *clock_head, *clock_tail;
+    uint32_t built;
+    uint32_t max_built;
+
+    _Atomic int64_t next_check;
+    struct timespec dir_mtime;
+
+    struct {
+        _Atomic uint64_t hits;
+        _Atomic uint64_t misses;
+        _Atomic uint64_t builds;
+        _Atomic uint64_t evictions;
+        _Atomic uint64_t failures;      // a file that would not load
+    } stats;
+} ssl_sni_t;
+
+// max_built 0 for SSL_SNI_MAX_BUILT
+ssl_sni_t* ssl_sni_new(struct ssl_bind_conf *conf, uint32_t max_built);
+void ssl_sni_free(ssl_sni_t *sni);
+
+// Pins ctx under name ("*.example.com" for a wildcard); never evicted
+int ssl_sni_add(ssl_sni_t *sni, const char *name, SSL_CTX *ctx);
+
+// Number of entries, or -1 with the index left as it was
+int ssl_sni_load_dir(ssl_sni_t *sni, const char *dir);
+int ssl_sni_reload(ssl_sni_t *sni);
+// Reloads when the directory changed, at most every SSL_SNI_CHECK_SEC;
+// returns 1 after a reload
+int ssl_sni_update(ssl_sni_t *sni, time_t now);
+
+// Switches ssl to the context for servername; false when none matches
+bool ssl_sni_select(ssl_sni_t *sni, SSL *ssl, const char *servername);
+
+#endif
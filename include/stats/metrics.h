@@ -0,0 +1,46 @@
+#ifndef STATS_METRICS_H
+#define STATS_METRICS_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// C interface to ultrabalancer::MetricsAggregator. Timers take
+// nanoseconds and report milliseconds.
+typedef enum {
+    METRICS_COUNTER = 0,
+    METRICS_GAUGE,
+    METRICS_HISTOGRAM,
+    METRICS_TIMER
+} metrics_type_t;
+
+typedef struct metrics_metric metrics_metric_t;
+
+// Resolve once at setup, then record without locks or lookups. The
+// metric lives as long as the process.
+metrics_metric_t* metrics_register(const char* name, metrics_type_t type);
+void metrics_increment(metrics_metric_t* metric, double value);
+void metrics_set(metrics_metric_t* metric, double value);
+void metrics_record_ns(metrics_metric_t* metric, uint64_t nanoseconds);
+
+// By name: a lookup per call
+void metrics_increment_counter(const char* name, double value);
+void metrics_set_gauge(const char* name, double value);
+void metrics_record_timer_ns(const char* name, uint64_t nanoseconds);
+
+uint64_t metrics_get_counter(const char* name);
+double metrics_get_gauge(const char* name);
+double metrics_get_timer_mean(const char* name);
+void metrics_get_percentiles(const char* name, double* p50, double* p95, double* p99);
+
+// stats_struct receives a MetricsAggregator::Stats
+void metrics_get_stats(void* stats_struct);
+void metrics_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
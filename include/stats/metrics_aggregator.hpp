@@ -8,60 +8,156 @@
 #include <vector>
 #include <thread>
 #include <mutex>
+#include <shared_mutex>
+#include <array>
 #include <memory>
 #include <algorithm>
 
+#include "core/lb_clock.h"
+
 namespace ultrabalancer {
 
-template<typename T>
-class RingBuffer {
+// Log-linear histogram of nanosecond values, as in HdrHistogram. Values
+// below 128 have a bucket each; above, every power of two is split into
+// 64 buckets, so a bucket's width is under 1.6% of its values. Values
+// past 2^41 ns (about 36 minutes) land in the last bucket.
+//
+// Recording is one relaxed increment in the calling thread's shard.
+// Threads are spread over kShards shards, each allocated on first use;
+// a read merges them, in time proportional to the bucket count.
+class HdrHistogram {
 public:
-    explicit RingBuffer(size_t size)
-        : size_(size), buffer_(size), head_(0), tail_(0), full_(false) {}
+    static constexpr unsigned kSubBits = 6;
+    static constexpr unsigned kSub = 1u << kSubBits;
+    static constexpr unsigned kMaxBits = 41;
+    static constexpr size_t kBuckets = (kMaxBits - kSubBits + 1) * kSub;
+    static constexpr size_t kShards = 16;
+
+    HdrHistogram() = default;
+    ~HdrHistogram() {
+        for (auto& s : shards_) delete s.load(std::memory_order_relaxed);
+    }
 
-    void push(const T& item) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        buffer_[head_] = item;
+    HdrHistogram(const HdrHistogram&) = delete;
+    HdrHistogram& operator=(const HdrHistogram&) = delete;
 
-        if (full_) {
-            tail_ = (tail_ + 1) % size_;
-        }
+    void record(uint64_t ns) {
+        Shard* s = shard();
+        s->buckets[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+        s->count.fetch_add(1, std::memory_order_relaxed);
+        s->sum.fetch_add(ns, std::memory_order_relaxed);
 
-        head_ = (head_ + 1) % size_;
-        full_ = head_ == tail_;
+        uint64_t max = s->max.load(std::memory_order_relaxed);
+        while (max < ns &&
+               !s->max.compare_exchange_weak(max, ns, std::memory_order_relaxed));
     }
 
-    std::vector<T> get_all() const {
-        std::lock_guard<std::mutex> lock(mutex_);
-        std::vector<T> result;
+    uint64_t count() const {
+        uint64_t n = 0;
+        for (const auto& p : shards_)
+            if (const Shard* s = p.load(std::memory_order_acquire))
+                n += s->count.load(std::memory_order_relaxed);
+        return n;
+    }
 
-        if (full_) {
-            result.reserve(size_);
-            for (size_t i = tail_; i != head_; i = (i + 1) % size_) {
-                result.push_back(buffer_[i]);
-            }
-        } else {
-            result.reserve(head_);
-            for (size_t i = 0; i < head_; ++i) {
-                result.push_back(buffer_[i]);
+    uint64_t sum() const {
+        uint64_t n = 0;
+        for (const auto& p : shards_)
+            if (const Shard* s = p.load(std::memory_order_acquire))
+                n += s->sum.load(std::memory_order_relaxed);
+        return n;
+    }
+
+    // Nanoseconds at each percentile (0-100), 0 when empty. A value is
+    // the top of its bucket, capped at the largest value recorded.
+    std::vector<uint64_t> percentiles(const std::vector<double>& percentiles) const {
+        std::vector<uint64_t> merged(kBuckets, 0);
+        uint64_t total = 0, max = 0;
+        for (const auto& p : shards_) {
+            const Shard* s = p.load(std::memory_order_acquire);
+            if (!s) continue;
+            for (size_t i = 0; i < kBuckets; ++i) {
+                uint64_t c = s->buckets[i].load(std::memory_order_relaxed);
+                merged[i] += c;
+                total += c;
             }
+            max = std::max(max, s->max.load(std::memory_order_relaxed));
         }
 
+        std::vector<uint64_t> result(percentiles.size(), 0);
+        if (total == 0) return result;
+
+        for (size_t j = 0; j < percentiles.size(); ++j) {
+            double p = std::clamp(percentiles[j], 0.0, 100.0);
+            uint64_t rank = static_cast<uint64_t>(total * p / 100.0) + 1;
+            if (rank > total) rank = total;
+
+            uint64_t seen = 0;
+            size_t i = 0;
+            for (; i < kBuckets - 1; ++i) {
+                seen += merged[i];
+                if (seen >= rank) break;
+            }
+            result[j] = std::min(highest_in(i), max);
+        }
         return result;
     }
 
+    // Racing recorders may keep a sample or two
+    void reset() {
+        for (auto& p : shards_) {
+            Shard* s = p.load(std::memory_order_acquire);
+            if (!s) continue;
+            for (auto& b : s->buckets) b.store(0, std::memory_order_relaxed);
+            s->count.store(0, std::memory_order_relaxed);
+            s->sum.store(0, std::memory_order_relaxed);
+            s->max.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    static size_t bucket_of(uint64_t ns) {
+        if (ns < 2 * kSub) return ns;
+        unsigned top = 63 - __builtin_clzll(ns);
+        if (top >= kMaxBits) return kBuckets - 1;
+        unsigned shift = top - kSubBits;
+        return shift * kSub + (ns >> shift);
+    }
+
+    static uint64_t highest_in(size_t bucket) {
+        if (bucket < 2 * kSub) return bucket;
+        unsigned shift = bucket / kSub - 1;
+        uint64_t lowest = static_cast<uint64_t>(bucket - shift * kSub) << shift;
+        return lowest + (uint64_t{1} << shift) - 1;
+    }
+
 private:
-    size_t size_;
-    std::vector<T> buffer_;
-    size_t head_;
-    size_t tail_;
-    bool full_;
-    mutable std::mutex mutex_;
-};
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sum{0};
+        std::atomic<uint64_t> max{0};
+        std::atomic<uint64_t> buckets[kBuckets] = {};
+    };
+
+    static size_t thread_slot() {
+        static std::atomic<size_t> next{0};
+        thread_local size_t slot = next.fetch_add(1, std::memory_order_relaxed) % kShards;
+        return slot;
+    }
+
+    Shard* shard() {
+        auto& p = shards_[thread_slot()];
+        Shard* s = p.load(std::memory_order_acquire);
+        if (s) return s;
+
+        Shard* fresh = new Shard();
+        if (p.compare_exchange_strong(s, fresh, std::memory_order_acq_rel,
+                                      std::memory_order_acquire))
+            return fresh;
+        delete fresh;
+        return s;
+    }
 
-struct TimeSeries {
-    std::chrono::steady_clock::time_point timestamp;
-    double value;
+    std::array<std::atomic<Shard*>, kShards> shards_{};
 };
 
 class Metric {
@@ -74,7 +170,7 @@ public:
     };
 
     Metric(const std::string& name, Type type)
-        : name_(name), type_(type), count_(0), sum_(0), min_(0), max_(0) {}
+        : name_(name), type_(type), count_(0), sum_(0), min_(0), max_(0), gauge_value_(0) {}
 
     void increment(double value = 1.0) {
         count_.fetch_add(1, std::memory_order_relaxed);
@@ -87,52 +183,53 @@ public:
     }
 
     void record_time(std::chrono::nanoseconds duration) {
-        double ms = duration.count() / 1000000.0;
-        increment(ms);
-        time_series_.push({std::chrono::steady_clock::now(), ms});
+        histogram_.record(duration.count() > 0 ? static_cast<uint64_t>(duration.count()) : 0);
     }
 
+    // Timers report milliseconds
     double get_mean() const {
+        if (timed()) {
+            uint64_t c = histogram_.count();
+            return c ? (histogram_.sum() / 1000000.0) / c : 0.0;
+        }
         uint64_t c = count_.load(std::memory_order_relaxed);
         if (c == 0) return 0.0;
         return (sum_.load(std::memory_order_relaxed) / 1000000.0) / c;
     }
 
     uint64_t get_count() const {
-        return count_.load(std::memory_order_relaxed);
+        return timed() ? histogram_.count() : count_.load(std::memory_order_relaxed);
     }
 
     double get_gauge() const {
         return gauge_value_.load(std::memory_order_relaxed);
     }
 
-    std::vector<TimeSeries> get_time_series() const {
-        return time_series_.get_all();
-    }
-
     std::vector<double> get_percentiles(const std::vector<double>& percentiles) const {
-        auto series = time_series_.get_all();
-        if (series.empty()) return std::vector<double>(percentiles.size(), 0.0);
-
-        std::vector<double> values;
-        values.reserve(series.size());
-        for (const auto& ts : series) {
-            values.push_back(ts.value);
-        }
-
-        std::sort(values.begin(), values.end());
-
+        auto ns = histogram_.percentiles(percentiles);
         std::vector<double> result;
-        for (double p : percentiles) {
-            size_t idx = static_cast<size_t>(values.size() * p / 100.0);
-            if (idx >= values.size()) idx = values.size() - 1;
-            result.push_back(values[idx]);
+        result.reserve(ns.size());
+        for (uint64_t v : ns) {
+            result.push_back(v / 1000000.0);
         }
-
         return result;
     }
 
+    void reset() {
+        count_.store(0, std::memory_order_relaxed);
+        sum_.store(0, std::memory_order_relaxed);
+        min_.store(0, std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+        gauge_value_.store(0, std::memory_order_relaxed);
+        histogram_.reset();
+    }
+
+    const std::string& name() const { return name_; }
+    Type type() const { return type_; }
+
 private:
+    bool timed() const { return type_ == TIMER || type_ == HISTOGRAM; }
+
     void update_min_max(double value) {
         double current_min = min_.load(std::memory_order_relaxed);
         while (current_min > value &&
@@ -150,13 +247,38 @@ private:
     std::atomic<double> min_;
     std::atomic<double> max_;
     std::atomic<double> gauge_value_;
-    RingBuffer<TimeSeries> time_series_{10000};
+    HdrHistogram histogram_;
+};
+
+// A registered metric. Resolve names once, at setup; recording through a
+// handle takes no lock and does no lookup. Metrics live as long as the
+// aggregator, so a handle never dangles. reset_stats() zeroes them in place.
+class MetricHandle {
+public:
+    MetricHandle() = default;
+    explicit MetricHandle(Metric* metric) : metric_(metric) {}
+
+    void increment(double value = 1.0) const { if (metric_) metric_->increment(value); }
+    void set(double value) const { if (metric_) metric_->set(value); }
+    void record_time(std::chrono::nanoseconds duration) const {
+        if (metric_) metric_->record_time(duration);
+    }
+
+    Metric* get() const { return metric_; }
+    explicit operator bool() const { return metric_ != nullptr; }
+
+private:
+    Metric* metric_ = nullptr;
 };
 
 class MetricsAggregator {
 public:
     static MetricsAggregator& instance();
 
+    // Finds or creates; a metric keeps the type it was created with
+    MetricHandle register_metric(const std::string& name, Metric::Type type);
+
+    // Lookup per call; prefer handles on hot paths
     void increment_counter(const std::string& name, double value = 1.0);
     void set_gauge(const std::string& name, double value);
     void record_timer(const std::string& name, std::chrono::nanoseconds duration);
@@ -187,29 +309,38 @@ private:
     MetricsAggregator(const MetricsAggregator&) = delete;
     MetricsAggregator& operator=(const MetricsAggregator&) = delete;
 
-    std::shared_ptr<Metric> get_or_create(const std::string& name, Metric::Type type);
+    Metric* get_or_create(const std::string& name, Metric::Type type);
 
-    mutable std::mutex mutex_;
+    mutable std::shared_mutex mutex_;
     std::unordered_map<std::string, std::shared_ptr<Metric>> metrics_;
+
+    MetricHandle requests_total_;
+    MetricHandle requests_success_;
+    MetricHandle requests_failed_;
+    MetricHandle response_time_;
+    MetricHandle connections_active_;
+    MetricHandle bytes_in_;
+    MetricHandle bytes_out_;
 };
 
+// Times its scope into a handle resolved with register_metric(). Reads the
+// precise clock: lb_now_ns() is fixed for a whole event-loop iteration, so
+// a scope that opens and closes inside one would record 0.
 class ScopedTimer {
 public:
-    ScopedTimer(const std::string& metric_name)
-        : metric_name_(metric_name),
-          start_time_(std::chrono::steady_clock::now()) {}
+    explicit ScopedTimer(MetricHandle metric)
+        : metric_(metric),
+          start_ns_(lb_clock_precise_ns()) {}
 
     ~ScopedTimer() {
-        auto duration = std::chrono::steady_clock::now() - start_time_;
-        MetricsAggregator::instance().record_timer(metric_name_,
-            std::chrono::duration_cast<std::chrono::nanoseconds>(duration));
+        metric_.record_time(std::chrono::nanoseconds(lb_clock_precise_ns() - start_ns_));
     }
 
 private:
-    std::string metric_name_;
-    std::chrono::steady_clock::time_point start_time_;
+    MetricHandle metric_;
+    uint64_t start_ns_;
 };
 
 }
 
-#endif
\ No newline at end of file
+#endif
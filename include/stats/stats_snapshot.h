@@ -0,0 +1,98 @@
+#ifndef STATS_STATS_SNAPSHOT_H
+#define STATS_STATS_SNAPSHOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+struct channel;
+
+// Scrape output for every proxy and server, rendered away from the
+// workers. Each format is compiled once into a template. Metric names,
+// escaped label sets and JSON punctuation become preformatted text, and
+// rendering only writes numbers between the pieces. A renderer thread
+// fills back buffers every interval_ms and swaps them with the ones
+// scrapes read, so a scrape is one copy with no formatting. The price is
+// up to interval_ms of staleness.
+//
+// Templates point at proxies and servers. After adding or removing any,
+// call stats_snapshot_rebuild(), and free removed ones only after it
+// returns.
+//
+// STATS_SNAP_BINARY is for collectors. It is a stats_snap_header_t, then
+// one uint64_t in host byte order per Prometheus sample. Samples come in
+// the order STATS_SNAP_LAYOUT lists them, one series per line. The layout
+// changes only with the header's generation.
+#define STATS_SNAP_MAGIC        0x53534255u     // "UBSS"
+#define STATS_SNAP_VERSION      1
+#define STATS_SNAP_INTERVAL_MS  1000
+
+typedef enum {
+    STATS_SNAP_PROMETHEUS = 0,
+    STATS_SNAP_JSON,
+    STATS_SNAP_BINARY,
+    STATS_SNAP_LAYOUT,
+    STATS_SNAP_FORMATS
+} stats_snap_format_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_len;
+    uint32_t generation;
+    uint32_t count;
+    uint64_t time_ms;           // wall clock at rendering
+} stats_snap_header_t;
+
+typedef struct stats_snap_template stats_snap_template_t;
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} stats_snap_buf_t;
+
+typedef struct stats_snapshot {
+    pthread_mutex_t lock;       // templates, back buffers, rendering
+    stats_snap_template_t *prom;
+    stats_snap_template_t *json;
+    stats_snap_buf_t back[STATS_SNAP_FORMATS];
+    uint32_t generation;
+
+    pthread_rwlock_t swap;      // front buffers
+    stats_snap_buf_t front[STATS_SNAP_FORMATS];
+
+    uint32_t interval_ms;
+    atomic_bool running;
+    pthread_t thread;
+
+    struct {
+        _Atomic uint64_t renders;
+        _Atomic uint64_t render_ns;     // last render
+        _Atomic uint64_t scrapes;
+        _Atomic uint64_t overflows;     // output larger than the channel
+    } stats;
+} stats_snapshot_t;
+
+// interval_ms 0 for STATS_SNAP_INTERVAL_MS. Builds and renders once.
+stats_snapshot_t* stats_snapshot_new(uint32_t interval_ms);
+void stats_snapshot_free(stats_snapshot_t *snap);
+
+int stats_snapshot_rebuild(stats_snapshot_t *snap);
+int stats_snapshot_render(stats_snapshot_t *snap);
+
+int stats_snapshot_start(stats_snapshot_t *snap);
+void stats_snapshot_stop(stats_snapshot_t *snap);
+
+// Appends the last rendering; -1 when it does not fit in chn
+int stats_snapshot_dump(stats_snapshot_t *snap, stats_snap_format_t fmt,
+                        struct channel *chn);
+
+// stats_dump_prometheus() and stats_dump_json_to_buffer() copy from this
+// snapshot when one is set, and render on the spot otherwise
+void stats_snapshot_set_default(stats_snapshot_t *snap);
+int stats_snapshot_dump_default(stats_snap_format_t fmt, struct channel *chn);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef STICK_PEERS_H
+#define STICK_PEERS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "stick_tables.h"
+
+// Replication of stick tables between load balancer nodes. Every node
+// lists the same peers, itself included; the entry named like the local
+// node gives the address to listen on. Between two nodes there is one
+// persistent TCP connection, opened by the one whose name sorts first.
+//
+// Changes are not sent per request. Updating an entry only queues it on
+// its table's sync list (once, however often it changes), and every
+// flush interval the sync thread sends each queued entry's accumulated
+// changes to all connected peers in one batch per table. When a
+// connection comes up, both ends first send their whole tables.
+//
+// Wire format: messages are [u8 type][u32 length, big endian][payload].
+// Integers in payloads are LEB128 varints unless noted.
+//   HELLO   version, node name
+//   UPDATE  table id, key type, u32 entry count (big endian), then per
+//   RESYNC  entry: key length, key bytes, data type mask, one value per
+//           mask bit from the lowest. UPDATE values are deltas since the
+//           previous flush (the server id is its new value); RESYNC
+//           values are current totals.
+// Strings are a varint length followed by the bytes.
+#define STK_PEERS_VERSION       1
+#define STK_PEERS_FLUSH_MS      100
+#define STK_PEERS_MAX           32
+
+typedef struct stk_peers stk_peers_t;
+
+typedef struct stk_peers_stats {
+    uint64_t connects;
+    uint64_t resyncs_sent;
+    uint64_t messages_sent;
+    uint64_t updates_sent;
+    uint64_t updates_received;
+    uint64_t errors;
+} stk_peers_stats_t;
+
+stk_peers_t* stk_peers_new(const char *local, uint32_t flush_ms);
+void stk_peers_free(stk_peers_t *ps);
+
+// addr is "host:port"; -1 on a bad address or too many peers
+int stk_peers_add(stk_peers_t *ps, const char *name, const char *addr);
+
+// Replicates t through ps; tables match between nodes by id
+int stk_peers_attach(stk_peers_t *ps, stick_table_t *t);
+
+// Starts the sync thread, listening on the local peer's address
+int stk_peers_start(stk_peers_t *ps);
+void stk_peers_stop(stk_peers_t *ps);
+
+// Peers with a connection past the handshake
+uint32_t stk_peers_connected(stk_peers_t *ps);
+void stk_peers_get_stats(stk_peers_t *ps, stk_peers_stats_t *out);
+
+#endif
@@ -6,6 +6,14 @@
 #include <time.h>
 #include <pthread.h>
 #include <netinet/in.h>
+#include <stdatomic.h>
+#include "core/common.h"
+#include "core/lb_clock.h"
+
+struct session;
+struct server;
+struct proxy;
+struct stk_peers;
 
 #define STKTABLE_TYPE_IP        0x01
 #define STKTABLE_TYPE_IPV6      0x02
@@ -27,6 +35,38 @@
 #define STKTABLE_DATA_SERVER_ID 0x800
 #define STKTABLE_DATA_GPC0      0x1000
 #define STKTABLE_DATA_GPC1      0x2000
+#define STKTABLE_DATA_BITS      14
+
+// Data types replicated to peers. Counters and rates travel as the
+// events added since the last flush, the server id as its value;
+// conn_cur and the gpc counters stay local.
+#define STKTABLE_SYNC_MASK      (STKTABLE_DATA_CONN_CNT | STKTABLE_DATA_CONN_RATE | \
+                                 STKTABLE_DATA_SESS_CNT | STKTABLE_DATA_SESS_RATE | \
+                                 STKTABLE_DATA_HTTP_REQ_CNT | STKTABLE_DATA_HTTP_REQ_RATE | \
+                                 STKTABLE_DATA_HTTP_ERR_CNT | STKTABLE_DATA_HTTP_ERR_RATE | \
+                                 STKTABLE_DATA_BYTES_IN | STKTABLE_DATA_BYTES_OUT | \
+                                 STKTABLE_DATA_SERVER_ID)
+
+// String and binary keys up to this size live inside the entry and the
+// table slot, so finding one never leaves the table's own memory
+#define STKTABLE_KEY_INLINE     32
+
+// A table is split into independently locked open-addressing shards,
+// picked by the top bits of the key hash
+#define STKTABLE_SHARD_BITS     6
+#define STKTABLE_SHARDS         (1u << STKTABLE_SHARD_BITS)
+
+// Expiry runs off a hashed wheel of one-second buckets per shard. An
+// entry sits in bucket expire % STKTABLE_WHEEL_SLOTS; entries due more
+// than one turn ahead stay put and are skipped as the wheel passes.
+#define STKTABLE_WHEEL_SLOTS    256
+
+// Entries stktable_expire() visits per shard and call, so one pass
+// holds a shard lock for a bounded time even on huge tables
+#define STKTABLE_EXPIRE_BUDGET  1024
+
+// Window of the *_rate counters unless the table sets its own
+#define STKTABLE_RATE_PERIOD    10000
 
 typedef struct stick_key {
     int type;
@@ -45,60 +85,136 @@ typedef struct stick_key {
     } data;
 } stick_key_t;
 
+// Event rate over a sliding window of `period` milliseconds. Each of the
+// two cells packs a period number (high 32 bits) and the events counted
+// in it (low 32 bits); the cell for period p is slot p & 1, so starting
+// a period overwrites only the one before last. An update is one atomic
+// add once the current period has started, and a reader gets both
+// periods from two loads with no lock: a cell whose stamp is not the
+// current or previous period counts as zero.
+typedef struct stk_rate {
+    _Atomic uint64_t cell[2];
+} stk_rate_t;
+
+#define STK_RATE_TICK(c)   ((uint32_t)((c) >> 32))
+#define STK_RATE_COUNT(c)  ((uint32_t)(c))
+
+static inline uint64_t stk_rate_now_ms(void) {
+    return lb_now_ms();
+}
+
+static inline void stk_rate_add_at(stk_rate_t *r, uint32_t period, uint32_t n, uint64_t now) {
+    uint32_t tick = now / period;
+    _Atomic uint64_t *cell = &r->cell[tick & 1];
+    uint64_t cur = atomic_load_explicit(cell, memory_order_relaxed);
+
+    while (STK_RATE_TICK(cur) != tick) {
+        // First event of this period: restamp the cell. A loser of the
+        // race reloads and adds to the winner's count.
+        uint64_t fresh = (uint64_t)tick << 32 | n;
+        if (atomic_compare_exchange_weak_explicit(cell, &cur, fresh, memory_order_relaxed,
+                                                  memory_order_relaxed))
+            return;
+    }
+    atomic_fetch_add_explicit(cell, n, memory_order_relaxed);
+}
+
+// Events in the last `period` ms: the current period's count plus the
+// previous one's weighted by how much of it is still inside the window
+static inline uint32_t stk_rate_read_at(const stk_rate_t *r, uint32_t period, uint64_t now) {
+    uint32_t tick = now / period;
+    uint64_t cur = atomic_load_explicit(&r->cell[tick & 1], memory_order_relaxed);
+    uint64_t prev = atomic_load_explicit(&r->cell[(tick - 1) & 1], memory_order_relaxed);
+
+    uint64_t c = STK_RATE_TICK(cur) == tick ? STK_RATE_COUNT(cur) : 0;
+    uint64_t p = STK_RATE_TICK(prev) == tick - 1 ? STK_RATE_COUNT(prev) : 0;
+    uint32_t elapsed = now % period;
+    return c + (p * (period - elapsed) + period / 2) / period;
+}
+
+static inline void stk_rate_add(stk_rate_t *r, uint32_t period, uint32_t n) {
+    stk_rate_add_at(r, period, n, stk_rate_now_ms());
+}
+
+static inline uint32_t stk_rate_read(const stk_rate_t *r, uint32_t period) {
+    return stk_rate_read_at(r, period, stk_rate_now_ms());
+}
+
 typedef struct stick_counter {
     _Atomic uint32_t conn_cnt;
     _Atomic uint32_t conn_cur;
-    _Atomic uint32_t conn_rate;
+    stk_rate_t conn_rate;
     _Atomic uint32_t sess_cnt;
-    _Atomic uint32_t sess_rate;
+    stk_rate_t sess_rate;
     _Atomic uint32_t http_req_cnt;
-    _Atomic uint32_t http_req_rate;
+    stk_rate_t http_req_rate;
     _Atomic uint32_t http_err_cnt;
-    _Atomic uint32_t http_err_rate;
+    stk_rate_t http_err_rate;
     _Atomic uint64_t bytes_in;
     _Atomic uint64_t bytes_out;
     _Atomic uint32_t server_id;
     _Atomic uint32_t gpc0;
     _Atomic uint32_t gpc1;
-
-    struct {
-        time_t conn_rate_ts;
-        time_t sess_rate_ts;
-        time_t http_req_rate_ts;
-        time_t http_err_rate_ts;
-    } last_update;
 } stick_counter_t;
 
+// Entries keep their address for their whole life; once removed from
+// the table they are freed through lb_rcu, so a pointer returned by a
+// lookup stays valid until the caller's next quiescent state. Holding
+// one longer takes a reference (stksess_track).
 typedef struct stick_entry {
-    stick_key_t key;
+    stick_key_t key;            // string/binary bytes point into key_buf when they fit
     stick_counter_t counters;
 
     time_t expire;
     time_t last_access;
-    uint32_t ref_cnt;
+    _Atomic uint32_t ref_cnt;   // an entry with references is never evicted
 
-    struct eb32_node node;
-    struct list list;
+    uint64_t hash;
+    struct list list;           // shard LRU, most recently used first
+    struct list wheel;          // expiry bucket
+    uint8_t key_buf[STKTABLE_KEY_INLINE];
 
-    pthread_rwlock_t lock;
+    // Peer sync: changes since the last flush, indexed by data type bit.
+    // A dirty entry sits once on its table's sync list and holds a
+    // reference until the flush has sent it.
+    _Atomic uint32_t sync_dirty;
+    struct stick_entry *sync_next;
+    _Atomic uint64_t sync_pend[STKTABLE_DATA_BITS];
 } stick_entry_t;
 
+struct stktable_slot;
+
+// SwissTable-style map: one control byte per slot holds 7 bits of the
+// hash (or EMPTY / DELETED), and a probe compares a whole group of
+// control bytes at once before touching any slot
+typedef struct stktable_shard {
+    pthread_spinlock_t lock;
+    uint32_t cap;               // slots, a power of two
+    uint32_t count;
+    uint32_t growth_left;       // inserts before the next rehash
+    uint32_t limit;             // this shard's share of the table size
+    uint8_t *ctrl;
+    struct stktable_slot *slots;
+    struct list lru;
+
+    time_t wheel_now;           // last second fully expired
+    struct list wheel[STKTABLE_WHEEL_SLOTS];
+} __attribute__((aligned(64))) stktable_shard_t;
+
 typedef struct stick_table {
     char *id;
     int type;
     uint32_t size;
-    uint32_t current;
+    _Atomic uint32_t current;
     uint32_t expire;
     uint32_t data_types;
+    uint32_t rate_period;       // ms window of the *_rate counters
 
-    struct eb_root keys;
-    struct list lru;
+    uint64_t seed;
+    stktable_shard_t *shards;
 
-    struct {
-        uint32_t size;
-        stick_entry_t **entries;
-        pthread_spinlock_t *locks;
-    } hash;
+    struct stk_peers *peers;    // set while replicated
+    struct stick_entry *_Atomic sync_head;
 
     struct {
         _Atomic uint64_t lookups;
@@ -109,7 +225,6 @@ typedef struct stick_table {
         _Atomic uint64_t expires;
     } stats;
 
-    pthread_rwlock_t lock;
     struct stick_table *next;
 } stick_table_t;
 
@@ -145,12 +260,19 @@ typedef struct stick_match {
 stick_table_t* stktable_new(const char *id, int type, uint32_t size, uint32_t expire);
 void stktable_free(stick_table_t *t);
 
+// stktable_lookup refreshes the entry's LRU position and expiry;
+// stktable_lookup_key only finds it
 stick_entry_t* stktable_lookup(stick_table_t *t, stick_key_t *key);
 stick_entry_t* stktable_lookup_key(stick_table_t *t, stick_key_t *key);
 stick_entry_t* stktable_get(stick_table_t *t, stick_key_t *key);
 stick_entry_t* stktable_set(stick_table_t *t, stick_entry_t *entry);
 
 void stktable_touch(stick_table_t *t, stick_entry_t *entry);
+// Maintenance pass, to be run about once a second: expires what came
+// due on each shard's wheel and evicts least recently used entries from
+// shards over their limit, both within STKTABLE_EXPIRE_BUDGET. Work left
+// over carries to the next call. Inserts only evict on their own once a
+// shard is half again over its limit, and then only at constant cost.
 void stktable_expire(stick_table_t *t);
 void stktable_purge(stick_table_t *t);
 
@@ -158,8 +280,36 @@ int stktable_update_key(stick_table_t *t, stick_key_t *key, int data_type, void
 int stktable_inc_counter(stick_table_t *t, stick_key_t *key, int counter);
 int stktable_dec_counter(stick_table_t *t, stick_key_t *key, int counter);
 
+// Current value of a *_RATE counter over the table's rate_period, or -1
+// for another data type
+int stktable_read_rate(stick_table_t *t, stick_entry_t *entry, int data_type);
+
 void stktable_data_cast(void *data, int type, int value);
 
+// Peer sync. stktable_sync_take() detaches the entries changed since the
+// last call, oldest first, linked through sync_next; each must be passed
+// to stktable_sync_done() once its changes are sent.
+// Read an entry's sync_next before collecting it: once collected it may
+// be queued again. stktable_sync_collect() takes the pending changes: it returns
+// the mask of data types that changed and fills vals by bit index.
+stick_entry_t* stktable_sync_take(stick_table_t *t);
+uint32_t stktable_sync_collect(stick_entry_t *entry, uint64_t vals[STKTABLE_DATA_BITS]);
+void stktable_sync_done(stick_entry_t *entry);
+
+// Current values for a full resync, same layout as stktable_sync_collect
+uint32_t stktable_sync_snapshot(stick_table_t *t, stick_entry_t *entry,
+                                uint64_t vals[STKTABLE_DATA_BITS]);
+
+// Calls fn on every entry, with its shard locked; fn must not call back
+// into the table
+void stktable_walk(stick_table_t *t, void (*fn)(stick_entry_t *entry, void *arg), void *arg);
+
+// Applies changes received from a peer without queueing them for
+// replication again. A delta adds to counters and rates; a full resync
+// raises them to at least the peer's value.
+int stktable_sync_apply(stick_table_t *t, stick_key_t *key, uint32_t mask,
+                        const uint64_t vals[STKTABLE_DATA_BITS], bool full);
+
 int stksess_track(struct session *sess, stick_table_t *t, stick_key_t *key);
 void stksess_untrack(struct session *sess, stick_table_t *t);
 struct server* stksess_get_server(struct session *sess, stick_table_t *t);
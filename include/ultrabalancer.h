@@ -83,10 +83,32 @@ typedef struct proxy {
     struct cache *cache;
 
     struct list http_req_rules;
+    struct list http_res_rules;
     struct proxy *default_backend;
 
     lb_algorithm_t lb_algo;
     int (*lb_algo_func)(struct proxy *);
+    char *lb_hdr;                   // header hashed by LB_ALGO_HDR
+    uint32_t hash_balance_factor;   // hash load bound, % of average (0: off)
+
+    // Servers whose state allows traffic, republished by
+    // proxy_update_usable() on every state or weight change. Readers must
+    // be registered RCU readers (see core/lb_rcu.h).
+#ifdef __cplusplus
+    std::atomic<struct srv_usable *> usable;
+#else
+    struct srv_usable *_Atomic usable;
+#endif
+    pthread_mutex_t usable_lock;
+
+    // Round-robin cursor on its own line, away from the read-mostly fields
+    struct {
+#ifdef __cplusplus
+        std::atomic<uint32_t> idx;
+#else
+        _Atomic uint32_t idx;
+#endif
+    } __attribute__((aligned(CACHE_LINE_SIZE))) rr;
 
     struct proxy *next;
 
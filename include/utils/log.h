@@ -12,10 +12,27 @@
 #define LOG_INFO    6
 #define LOG_DEBUG   7
 
+#define LOG_FMT __attribute__((format(printf, 1, 2)))
+
 void log_init(const char *ident, int level);
-void log_error(const char *fmt, ...);
-void log_warning(const char *fmt, ...);
-void log_info(const char *fmt, ...);
-void log_debug(const char *fmt, ...);
 
-#endif
\ No newline at end of file
+// Asynchronous mode: every thread logs into its own ring buffer and a
+// writer thread drains them to stderr. Before log_start() and after
+// log_stop() lines are written synchronously.
+int log_start(void);
+void log_stop(void);
+
+void log_error(const char *fmt, ...) LOG_FMT;
+void log_warning(const char *fmt, ...) LOG_FMT;
+void log_info(const char *fmt, ...) LOG_FMT;
+void log_debug(const char *fmt, ...) LOG_FMT;
+
+// Data path debug logging is compiled out unless built with LOG_DEBUG=1.
+// The dead branch keeps the format string checked in release builds.
+#ifdef LB_LOG_DEBUG
+#define LB_DEBUG(...) log_debug(__VA_ARGS__)
+#else
+#define LB_DEBUG(...) do { if (0) log_debug(__VA_ARGS__); } while (0)
+#endif
+
+#endif
@@ -1,25 +1,106 @@
 #include "acl/acl.h"
+#include "acl/acl_lpm.h"
+#include "core/lb_alloc.h"
+#include "core/lb_rcu.h"
 #include "core/proxy.h"
 #include "http/http.h"
+#include "config/config.h"
 #include "utils/log.h"
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
 #include <ctype.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <arpa/inet.h>
+#include <stddef.h>
+#ifndef USE_PCRE
+#include <regex.h>
+#endif
 
 static struct acl_keyword acl_keywords[256];
 static int acl_keywords_count = 0;
 
+typedef int (*acl_fetch_fn)(struct proxy *px, struct session *sess, void *l7,
+                            unsigned int opt, const struct arg *args,
+                            struct sample *smp);
+
+// Distinct (fetch, arguments) pairs seen by acl_expr_parse. An
+// expression's smp_slot indexes this table and every stream's sample
+// cache, so "path_beg", "path_end" and "path" all share one slot.
+struct acl_smp_slot {
+    acl_fetch_fn fetch;
+    char *args;                 // arguments joined with ',', "" when none
+};
+
+static struct acl_smp_slot *acl_smp_slots;
+static uint32_t acl_smp_slot_count;
+static uint32_t acl_smp_slot_cap;
+
+// Fetchers get the stream as l7. The transaction is the stream's when it
+// has one, the session's otherwise.
+static struct http_txn *acl_txn(struct session *sess, void *l7) {
+    struct stream *strm = l7;
+    if (strm && strm->txn)
+        return strm->txn;
+    return sess ? sess->txn : NULL;
+}
+
+// Request buffer the parsed message's slices point into, or NULL
+static const struct buffer *acl_req_buf(struct http_txn *txn, void *l7) {
+    struct stream *strm = l7;
+    if (!strm || !strm->req || !strm->req->buf.area || !txn->req.uri.len)
+        return NULL;
+    return &strm->req->buf;
+}
+
+// Request URI: the slice the parser recorded, or txn->uri when the
+// transaction was built without a parsed message
+static int acl_req_uri(struct http_txn *txn, void *l7, const char **ptr, size_t *len) {
+    const struct buffer *buf = acl_req_buf(txn, l7);
+    if (buf) {
+        *ptr = http_slice_ptr(buf, txn->req.uri);
+        *len = txn->req.uri.len;
+        return 1;
+    }
+    if (!txn->uri)
+        return 0;
+
+    *ptr = txn->uri;
+    *len = txn->uri_len ? txn->uri_len : strlen(txn->uri);
+    return 1;
+}
+
+// IPv4-mapped IPv6 addresses come out as IPv4, so IPv4 lists match
+// clients of dual-stack listeners
+static int acl_smp_addr(const struct sockaddr_storage *ss, struct sample *smp) {
+    if (ss->ss_family == AF_INET6) {
+        const struct in6_addr *a6 = &((const struct sockaddr_in6 *)ss)->sin6_addr;
+        if (IN6_IS_ADDR_V4MAPPED(a6)) {
+            smp->data.type = SMP_T_IPV4;
+            memcpy(&smp->data.u.ipv4, &a6->s6_addr[12], 4);
+        } else {
+            smp->data.type = SMP_T_IPV6;
+            smp->data.u.ipv6 = *a6;
+        }
+        return 1;
+    }
+
+    smp->data.type = SMP_T_IPV4;
+    smp->data.u.ipv4 = ((const struct sockaddr_in *)ss)->sin_addr;
+    return 1;
+}
+
 static int fetch_src(struct proxy *px, struct session *sess, void *l7,
                     unsigned int opt, const struct arg *args,
                     struct sample *smp) {
     if (!sess || !sess->cli_conn)
         return 0;
 
-    struct sockaddr_in *addr = (struct sockaddr_in *)&sess->cli_conn->addr.from;
-    smp->data.type = SMP_T_IPV4;
-    smp->data.u.ipv4 = addr->sin_addr;
-    return 1;
+    return acl_smp_addr(&sess->cli_conn->addr.from, smp);
 }
 
 static int fetch_dst(struct proxy *px, struct session *sess, void *l7,
@@ -28,87 +109,114 @@ static int fetch_dst(struct proxy *px, struct session *sess, void *l7,
     if (!sess || !sess->cli_conn)
         return 0;
 
-    struct sockaddr_in *addr = (struct sockaddr_in *)&sess->cli_conn->addr.to;
-    smp->data.type = SMP_T_IPV4;
-    smp->data.u.ipv4 = addr->sin_addr;
-    return 1;
+    return acl_smp_addr(&sess->cli_conn->addr.to, smp);
 }
 
 static int fetch_path(struct proxy *px, struct session *sess, void *l7,
                      unsigned int opt, const struct arg *args,
                      struct sample *smp) {
-    struct http_txn *txn = sess->txn;
-    if (!txn || !txn->uri)
+    struct http_txn *txn = acl_txn(sess, l7);
+    const char *uri;
+    size_t len;
+    if (!txn || !acl_req_uri(txn, l7, &uri, &len))
         return 0;
 
-    char *path = txn->uri;
-    char *end = strchr(path, '?');
+    const char *end = memchr(uri, '?', len);
 
     smp->data.type = SMP_T_STR;
-    smp->data.u.str.ptr = path;
-    smp->data.u.str.len = end ? (end - path) : strlen(path);
+    smp->data.u.str.ptr = (char *)uri;
+    smp->data.u.str.len = end ? (size_t)(end - uri) : len;
     return 1;
 }
 
 static int fetch_hdr(struct proxy *px, struct session *sess, void *l7,
                     unsigned int opt, const struct arg *args,
                     struct sample *smp) {
-    struct http_txn *txn = sess->txn;
+    struct http_txn *txn = acl_txn(sess, l7);
     if (!txn || !args || args[0].type != ARGT_STR)
         return 0;
 
-    char *hdr = http_header_get(&txn->req, args[0].data.str.ptr);
+    const struct buffer *buf = acl_req_buf(txn, l7);
+    if (!buf)
+        return 0;
+
+    const http_hdr_t *hdr = http_msg_find(&txn->req, buf, args[0].data.str.ptr);
     if (!hdr)
         return 0;
 
     smp->data.type = SMP_T_STR;
-    smp->data.u.str.ptr = hdr;
-    smp->data.u.str.len = strlen(hdr);
+    smp->data.u.str.ptr = (char *)http_slice_ptr(buf, hdr->v);
+    smp->data.u.str.len = hdr->v.len;
     return 1;
 }
 
+// Method names by HTTP_METH_* bit, for transactions without a parsed
+// request line
+static const char *const acl_meth_names[] = {
+    "OPTIONS", "GET", "HEAD", "POST", "PUT", "DELETE", "TRACE", "CONNECT", "PATCH"
+};
+
 static int fetch_method(struct proxy *px, struct session *sess, void *l7,
                        unsigned int opt, const struct arg *args,
                        struct sample *smp) {
-    struct http_txn *txn = sess->txn;
+    struct http_txn *txn = acl_txn(sess, l7);
     if (!txn)
         return 0;
 
-    smp->data.type = SMP_T_METH;
-    smp->data.u.meth = txn->meth;
+    // Matched as a string, so unknown methods can be tested too
+    const struct buffer *buf = acl_req_buf(txn, l7);
+    if (buf && txn->req.som.len > 0) {
+        smp->data.u.str.ptr = buf->area + txn->req.som.pos;
+        smp->data.u.str.len = txn->req.som.len;
+    } else {
+        uint32_t meth = txn->meth ? txn->meth : txn->req.meth;
+        if (!meth)
+            return 0;
+        unsigned bit = __builtin_ctz(meth);
+        if (bit >= sizeof(acl_meth_names) / sizeof(acl_meth_names[0]))
+            return 0;
+        smp->data.u.str.ptr = (char *)acl_meth_names[bit];
+        smp->data.u.str.len = strlen(acl_meth_names[bit]);
+    }
+
+    smp->data.type = SMP_T_STR;
     return 1;
 }
 
 static int fetch_url_param(struct proxy *px, struct session *sess, void *l7,
                           unsigned int opt, const struct arg *args,
                           struct sample *smp) {
-    struct http_txn *txn = sess->txn;
-    if (!txn || !txn->uri || !args || args[0].type != ARGT_STR)
+    struct http_txn *txn = acl_txn(sess, l7);
+    const char *uri;
+    size_t len;
+    if (!txn || !args || args[0].type != ARGT_STR || !acl_req_uri(txn, l7, &uri, &len))
         return 0;
 
-    char *query = strchr(txn->uri, '?');
-    if (!query)
+    const char *end = uri + len;
+    const char *p = memchr(uri, '?', len);
+    if (!p)
         return 0;
 
-    query++;
+    p++;
     const char *param = args[0].data.str.ptr;
     size_t param_len = strlen(param);
 
-    char *p = query;
-    while (*p) {
-        if (strncmp(p, param, param_len) == 0 && p[param_len] == '=') {
+    while (p < end) {
+        const char *amp = memchr(p, '&', end - p);
+        const char *stop = amp ? amp : end;
+
+        if ((size_t)(stop - p) > param_len && memcmp(p, param, param_len) == 0 &&
+            p[param_len] == '=') {
             p += param_len + 1;
-            char *end = strchr(p, '&');
 
             smp->data.type = SMP_T_STR;
-            smp->data.u.str.ptr = p;
-            smp->data.u.str.len = end ? (end - p) : strlen(p);
+            smp->data.u.str.ptr = (char *)p;
+            smp->data.u.str.len = stop - p;
             return 1;
         }
 
-        p = strchr(p, '&');
-        if (!p) break;
-        p++;
+        if (!amp) break;
+        p = amp + 1;
     }
 
     return 0;
@@ -163,12 +271,39 @@ int acl_match_reg(struct sample *smp, acl_pattern_t *pattern) {
 
     return ret >= 0;
 #else
-    log_warning("PCRE regex matching not available");
-    return 0;
+    // regexec() wants a C string; samples are slices of the request
+    char stack[512];
+    size_t len = smp->data.u.str.len;
+    if (len < sizeof(stack)) {
+        memcpy(stack, smp->data.u.str.ptr, len);
+        stack[len] = '\0';
+        return regexec(pattern->val.reg.regex, stack, 0, NULL, 0) == 0;
+    }
+
+    lb_arena_t *arena = lb_arena_local(LB_ARENA_ACL);
+    lb_arena_mark_t mark = lb_arena_mark(arena);
+    char *str = lb_arena_strndup(arena, smp->data.u.str.ptr, len);
+    int ret = str && regexec(pattern->val.reg.regex, str, 0, NULL, 0) == 0;
+    lb_arena_release(arena, mark);
+    return ret;
 #endif
 }
 
 int acl_match_ip(struct sample *smp, acl_pattern_t *pattern) {
+    if (pattern->flags & ACL_PAT_F_IPV6) {
+        if (smp->data.type != SMP_T_IPV6)
+            return 0;
+
+        const uint8_t *addr = smp->data.u.ipv6.s6_addr;
+        const uint8_t *pat = pattern->val.ipv6.addr.s6_addr;
+        const uint8_t *mask = pattern->val.ipv6.mask.s6_addr;
+        for (int i = 0; i < 16; i++) {
+            if ((addr[i] & mask[i]) != (pat[i] & mask[i]))
+                return 0;
+        }
+        return 1;
+    }
+
     if (smp->data.type != SMP_T_IPV4)
         return 0;
 
@@ -225,24 +360,50 @@ int pattern_parse_ip(const char **text, acl_pattern_t *pattern, int *opaque) {
     memcpy(addr_str, start, end - start);
     addr_str[end - start] = '\0';
 
-    if (inet_pton(AF_INET, addr_str, &pattern->val.ipv4.addr) != 1)
+    int v6 = memchr(addr_str, ':', end - start) != NULL;
+    int max = v6 ? 128 : 32;
+    int cidr = max;
+
+    if (v6) {
+        if (inet_pton(AF_INET6, addr_str, &pattern->val.ipv6.addr) != 1)
+            return 0;
+        pattern->flags |= ACL_PAT_F_IPV6;
+    } else if (inet_pton(AF_INET, addr_str, &pattern->val.ipv4.addr) != 1) {
         return 0;
+    }
 
     if (*end == '/') {
-        end++;
-        int cidr = strtol(end, (char **)&end, 10);
-        if (cidr < 0 || cidr > 32)
+        const char *digits = ++end;
+        cidr = strtol(digits, (char **)&end, 10);
+        if (end == digits || cidr < 0 || cidr > max)
             return 0;
+    }
 
-        pattern->val.ipv4.mask.s_addr = htonl(~((1U << (32 - cidr)) - 1));
+    if (v6) {
+        for (int i = 0; i < 16; i++) {
+            int bits = cidr - i * 8;
+            pattern->val.ipv6.mask.s6_addr[i] =
+                bits >= 8 ? 0xff : bits > 0 ? (uint8_t)(0xff << (8 - bits)) : 0;
+        }
     } else {
-        pattern->val.ipv4.mask.s_addr = 0xFFFFFFFF;
+        pattern->val.ipv4.mask.s_addr = cidr ? htonl(~0U << (32 - cidr)) : 0;
     }
 
     *text = end;
     return 1;
 }
 
+// Prefix length of a pattern parsed by pattern_parse_ip
+static int acl_pattern_cidr(const acl_pattern_t *pattern) {
+    if (!(pattern->flags & ACL_PAT_F_IPV6))
+        return __builtin_popcount(pattern->val.ipv4.mask.s_addr);
+
+    int len = 0;
+    for (int i = 0; i < 16; i++)
+        len += __builtin_popcount(pattern->val.ipv6.mask.s6_addr[i]);
+    return len;
+}
+
 int pattern_parse_reg(const char **text, acl_pattern_t *pattern, int *opaque) {
 #ifdef USE_PCRE
     const char *error;
@@ -271,122 +432,862 @@ int pattern_parse_reg(const char **text, acl_pattern_t *pattern, int *opaque) {
     *text = end;
     return 1;
 #else
-    log_error("PCRE regex parsing not available (library not compiled)");
-    return 0;
+    // Without PCRE, POSIX extended regexes, still case-insensitive
+    const char *start = *text;
+    const char *end = start;
+
+    while (*end && !isspace(*end))
+        end++;
+
+    char *regex_str = strndup(start, end - start);
+    regex_t *re = malloc(sizeof(*re));
+    if (!regex_str || !re) {
+        free(regex_str);
+        free(re);
+        return 0;
+    }
+
+    int ret = regcomp(re, regex_str, REG_EXTENDED | REG_ICASE | REG_NOSUB);
+    free(regex_str);
+
+    if (ret != 0) {
+        char msg[128];
+        regerror(ret, re, msg, sizeof(msg));
+        log_error("Failed to compile regex: %s", msg);
+        free(re);
+        return 0;
+    }
+
+    pattern->val.reg.regex = re;
+    *text = end;
+    return 1;
 #endif
 }
 
-acl_t* acl_find(struct list *head, const char *name) {
-    if (!name) {
+static void acl_set_err(char **err, const char *fmt, ...) {
+    if (!err)
+        return;
+
+    char msg[256];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+    *err = strdup(msg);
+}
+
+acl_t* acl_find(acl_t *head, const char *name) {
+    if (!name)
         return NULL;
-    }
 
-    // DESIGN ISSUE: This function signature is incompatible with actual ACL storage.
-    // - ACLs are stored as simple linked list: struct acl *next
-    // - Function expects: struct list *head (circular doubly-linked list container)
-    // - Cannot safely cast struct list * to acl_t * (different memory layout)
-    //
-    // Proper fix would be either:
-    // 1. Change signature to: acl_t* acl_find(acl_t *head, const char *name)
-    // 2. Change ACL storage to use embedded struct list instead of *next pointer
-    //
-    // Current implementation returns NULL to avoid memory corruption.
-    // Callers expecting ACL lookup will need to be updated to use proxy->acl_list directly.
+    for (acl_t *acl = head; acl; acl = acl->next) {
+        if (strcmp(acl->name, name) == 0)
+            return acl;
+    }
+    return NULL;
+}
 
-    (void)head;  // Suppress unused parameter warning
+static acl_keyword_t *acl_find_keyword(const char *kw, size_t len) {
+    for (int i = 0; i < acl_keywords_count; i++) {
+        if (strlen(acl_keywords[i].kw) == len && strncmp(acl_keywords[i].kw, kw, len) == 0)
+            return &acl_keywords[i];
+    }
     return NULL;
 }
 
-acl_expr_t* acl_expr_parse(const char **args, char **err) {
-    acl_expr_t *expr = calloc(1, sizeof(*expr));
+static int acl_smp_slot_get(acl_fetch_fn fetch, const char *args, uint32_t *slot) {
+    for (uint32_t i = 0; i < acl_smp_slot_count; i++) {
+        if (acl_smp_slots[i].fetch == fetch && strcmp(acl_smp_slots[i].args, args) == 0) {
+            *slot = i;
+            return 1;
+        }
+    }
+
+    if (acl_smp_slot_count == acl_smp_slot_cap) {
+        uint32_t cap = acl_smp_slot_cap ? acl_smp_slot_cap * 2 : 16;
+        struct acl_smp_slot *slots = realloc(acl_smp_slots, cap * sizeof(*slots));
+        if (!slots)
+            return 0;
+        acl_smp_slots = slots;
+        acl_smp_slot_cap = cap;
+    }
+
+    char *copy = strdup(args);
+    if (!copy)
+        return 0;
+
+    acl_smp_slots[acl_smp_slot_count].fetch = fetch;
+    acl_smp_slots[acl_smp_slot_count].args = copy;
+    *slot = acl_smp_slot_count++;
+    return 1;
+}
+
+static void acl_pattern_free(const acl_keyword_t *kw, acl_pattern_t *pattern) {
+    if (kw->parse == pattern_parse_str) {
+        free(pattern->val.str.str);
+    } else if (kw->parse == pattern_parse_reg && pattern->val.reg.regex) {
+#ifdef USE_PCRE
+        pcre_free(pattern->val.reg.regex);
+        if (pattern->val.reg.extra)
+            pcre_free(pattern->val.reg.extra);
+#else
+        regfree(pattern->val.reg.regex);
+        free(pattern->val.reg.regex);
+#endif
+    }
+    free(pattern);
+}
+
+void acl_expr_free(acl_expr_t *expr) {
     if (!expr)
-        return NULL;
+        return;
 
-    expr->patterns.n = &expr->patterns;
-    expr->patterns.p = &expr->patterns;
+    struct list *l = expr->patterns.n;
+    while (l != &expr->patterns) {
+        struct list *next = l->n;
+        acl_pattern_free(expr->keyword, LIST_ELEM(l, acl_pattern_t, list));
+        l = next;
+    }
 
-    expr->kw = strdup(args[0]);
+    if (expr->args) {
+        for (struct arg *arg = expr->args; arg->type != ARGT_STOP; arg++)
+            free(arg->data.str.ptr);
+        free(expr->args);
+    }
+    for (int i = 0; i < expr->file_count; i++)
+        free(expr->files[i]);
+    free(expr->files);
+    acl_lpm_free(atomic_load_explicit(&expr->lpm, memory_order_relaxed));
+    free(expr->kw);
+    free(expr);
+}
+
+// One pattern per line; blank lines and "#" comments are skipped
+static int acl_lpm_load_file(acl_lpm_t *lpm, const char *path, char **err) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        acl_set_err(err, "Cannot open '%s': %s", path, strerror(errno));
+        return -1;
+    }
+
+    char *line = NULL;
+    size_t cap = 0;
+    int line_num = 0, ret = 0;
+
+    while (getline(&line, &cap, f) >= 0) {
+        line_num++;
+
+        char *p = line;
+        while (isspace((unsigned char)*p))
+            p++;
+        if (*p == '#' || *p == '\0')
+            continue;
+
+        const char *text = p;
+        acl_pattern_t pattern = {0};
+        if (!pattern_parse_ip(&text, &pattern, NULL) ||
+            (*text && !isspace((unsigned char)*text) && *text != '#')) {
+            acl_set_err(err, "Invalid address at %s:%d", path, line_num);
+            ret = -1;
+            break;
+        }
 
-    for (int i = 0; acl_keywords[i].kw; i++) {
-        if (strcmp(acl_keywords[i].kw, expr->kw) == 0) {
-            expr->keyword = &acl_keywords[i];
+        int len = acl_pattern_cidr(&pattern);
+        if ((pattern.flags & ACL_PAT_F_IPV6 ? acl_lpm_add6(lpm, &pattern.val.ipv6.addr, len)
+                                            : acl_lpm_add4(lpm, pattern.val.ipv4.addr, len)) < 0) {
+            acl_set_err(err, "Out of memory");
+            ret = -1;
             break;
         }
     }
 
-    if (!expr->keyword) {
-        *err = strdup("Unknown ACL keyword");
-        free(expr->kw);
-        free(expr);
+    free(line);
+    fclose(f);
+    return ret;
+}
+
+// Prefix set of an IP expression: its inline patterns plus its files
+static acl_lpm_t *acl_build_lpm(const acl_expr_t *expr, char **err) {
+    acl_lpm_t *lpm = acl_lpm_new();
+    if (!lpm) {
+        acl_set_err(err, "Out of memory");
         return NULL;
     }
 
-    args++;
+    for (const struct list *l = expr->patterns.n; l != &expr->patterns; l = l->n) {
+        const acl_pattern_t *pattern = LIST_ELEM(l, acl_pattern_t, list);
+        int len = acl_pattern_cidr(pattern);
+        if ((pattern->flags & ACL_PAT_F_IPV6 ? acl_lpm_add6(lpm, &pattern->val.ipv6.addr, len)
+                                             : acl_lpm_add4(lpm, pattern->val.ipv4.addr, len)) < 0) {
+            acl_set_err(err, "Out of memory");
+            goto fail;
+        }
+    }
+
+    for (int i = 0; i < expr->file_count; i++) {
+        if (acl_lpm_load_file(lpm, expr->files[i], err) < 0)
+            goto fail;
+    }
 
-    while (*args) {
+    if (acl_lpm_build(lpm) < 0) {
+        acl_set_err(err, "Out of memory");
+        goto fail;
+    }
+    return lpm;
+
+fail:
+    acl_lpm_free(lpm);
+    return NULL;
+}
+
+static void acl_lpm_retire(void *lpm) {
+    acl_lpm_free(lpm);
+}
+
+// Serializes reloads; readers never take it
+static pthread_mutex_t acl_reload_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int acl_expr_reload(acl_expr_t *expr, char **err) {
+    if (!(expr->flags & ACL_EXPR_F_LPM)) {
+        acl_set_err(err, "'%s' has no compiled address list", expr->kw);
+        return -1;
+    }
+
+    pthread_mutex_lock(&acl_reload_lock);
+    acl_lpm_t *fresh = acl_build_lpm(expr, err);
+    if (fresh) {
+        acl_lpm_t *old = atomic_exchange_explicit(&expr->lpm, fresh, memory_order_acq_rel);
+        lb_rcu_retire(old, acl_lpm_retire);
+    }
+    pthread_mutex_unlock(&acl_reload_lock);
+
+    return fresh ? 0 : -1;
+}
+
+int acl_reload(acl_t *head, char **err) {
+    int reloaded = 0;
+
+    for (acl_t *acl = head; acl; acl = acl->next) {
+        for (struct list *l = acl->expr_list.n; l != &acl->expr_list; l = l->n) {
+            acl_expr_t *expr = LIST_ELEM(l, acl_expr_t, list);
+            if (!expr->file_count)
+                continue;
+            if (acl_expr_reload(expr, err) < 0)
+                return -1;
+            reloaded++;
+        }
+    }
+    return reloaded;
+}
+
+// "(a,b)" following a criterion becomes an ARGT_STOP-terminated array of
+// strings
+static struct arg *acl_parse_args(const char *open, const char *close) {
+    int count = close > open + 1;
+    for (const char *p = open + 1; p < close; p++)
+        count += *p == ',';
+
+    struct arg *args = calloc(count + 1, sizeof(*args));
+    if (!args)
+        return NULL;
+
+    const char *p = open + 1;
+    for (int i = 0; i < count; i++) {
+        const char *end = memchr(p, ',', close - p);
+        if (!end)
+            end = close;
+
+        args[i].type = ARGT_STR;
+        args[i].data.str.ptr = strndup(p, end - p);
+        args[i].data.str.len = end - p;
+        if (!args[i].data.str.ptr) {
+            args[i].type = ARGT_STOP;
+            for (struct arg *arg = args; arg->type != ARGT_STOP; arg++)
+                free(arg->data.str.ptr);
+            free(args);
+            return NULL;
+        }
+        p = end + 1;
+    }
+    return args;
+}
+
+acl_expr_t* acl_expr_parse(const char **args, char **err) {
+    if (!args || !args[0]) {
+        acl_set_err(err, "Missing ACL criterion");
+        return NULL;
+    }
+
+    if (!acl_keywords_count)
+        acl_init();
+
+    const char *open = strchr(args[0], '(');
+    const char *close = open ? strchr(open, ')') : NULL;
+    if (open && (!close || close[1])) {
+        acl_set_err(err, "Malformed argument list in '%s'", args[0]);
+        return NULL;
+    }
+
+    acl_keyword_t *kw = acl_find_keyword(args[0], open ? (size_t)(open - args[0]) : strlen(args[0]));
+    if (!kw) {
+        acl_set_err(err, "Unknown ACL keyword '%s'", args[0]);
+        return NULL;
+    }
+
+    acl_expr_t *expr = calloc(1, sizeof(*expr));
+    if (!expr) {
+        acl_set_err(err, "Out of memory");
+        return NULL;
+    }
+
+    expr->patterns.n = expr->patterns.p = &expr->patterns;
+    expr->list.n = expr->list.p = &expr->list;
+    expr->keyword = kw;
+    expr->kw = strdup(args[0]);
+
+    char *arg_text = open ? strndup(open + 1, close - open - 1) : NULL;
+    if (open)
+        expr->args = acl_parse_args(open, close);
+
+    if (!expr->kw || (open && (!arg_text || !expr->args)) ||
+        !acl_smp_slot_get(kw->fetch, arg_text ? arg_text : "", &expr->smp_slot)) {
+        free(arg_text);
+        acl_set_err(err, "Out of memory");
+        acl_expr_free(expr);
+        return NULL;
+    }
+    free(arg_text);
+
+    int patterns = 0;
+    for (args++; *args && strcmp(*args, "}") != 0; args++) {
+        if (strcmp(*args, "-f") == 0) {
+            if (kw->parse != pattern_parse_ip) {
+                acl_set_err(err, "'-f' pattern files are only supported for IP criteria");
+                acl_expr_free(expr);
+                return NULL;
+            }
+
+            char **files = realloc(expr->files, (expr->file_count + 1) * sizeof(*files));
+            if (!args[1] || !files || !(files[expr->file_count] = strdup(args[1]))) {
+                if (files)
+                    expr->files = files;
+                acl_set_err(err, args[1] ? "Out of memory" : "Missing file after '-f'");
+                acl_expr_free(expr);
+                return NULL;
+            }
+            expr->files = files;
+            expr->file_count++;
+            args++;
+            continue;
+        }
+
+        const char *text = *args;
         acl_pattern_t *pattern = calloc(1, sizeof(*pattern));
-        if (!pattern)
-            break;
 
-        if (!expr->keyword->parse(args, pattern, NULL)) {
+        if (!pattern || !kw->parse(&text, pattern, NULL)) {
+            acl_set_err(err, "Invalid pattern '%s' for '%s'", *args, expr->kw);
             free(pattern);
-            break;
+            acl_expr_free(expr);
+            return NULL;
         }
 
         LIST_ADDQ(&expr->patterns, &pattern->list);
+        patterns++;
+    }
+
+    if (kw->parse == pattern_parse_ip && (expr->file_count || patterns >= ACL_LPM_MIN_PATTERNS)) {
+        acl_lpm_t *lpm = acl_build_lpm(expr, err);
+        if (!lpm) {
+            acl_expr_free(expr);
+            return NULL;
+        }
+        atomic_store_explicit(&expr->lpm, lpm, memory_order_release);
+        expr->flags |= ACL_EXPR_F_LPM;
     }
 
     return expr;
 }
 
-acl_cond_t* acl_cond_parse(const char **args, struct list *known_acl, char **err) {
-    acl_cond_t *cond = calloc(1, sizeof(*cond));
+acl_t* acl_add_expr(acl_t **head, const char *name, acl_expr_t *expr) {
+    acl_t *acl = acl_find(*head, name);
+    if (!acl) {
+        acl = calloc(1, sizeof(*acl));
+        if (!acl)
+            return NULL;
+
+        acl->name = strdup(name);
+        if (!acl->name) {
+            free(acl);
+            return NULL;
+        }
+        acl->expr_list.n = acl->expr_list.p = &acl->expr_list;
+        acl->next = *head;
+        *head = acl;
+    }
+
+    LIST_ADDQ(&acl->expr_list, &expr->list);
+    acl->requires |= expr->keyword->requires;
+    return acl;
+}
+
+// Condition compiler state. Pending forward jumps are chained through
+// their arg fields (index + 1, 0 ends a chain) until acl_patch() points
+// them all at the next instruction.
+struct acl_prog {
+    acl_cond_t *cond;
+    uint32_t code_cap;
+    uint32_t exprs_cap;
+    int failed;
+};
+
+static uint32_t acl_emit(struct acl_prog *pg, uint32_t op, uint32_t arg) {
+    acl_cond_t *cond = pg->cond;
+    if (cond->code_len == pg->code_cap) {
+        uint32_t cap = pg->code_cap ? pg->code_cap * 2 : 16;
+        acl_insn_t *code = realloc(cond->code, cap * sizeof(*code));
+        if (!code) {
+            pg->failed = 1;
+            return 0;
+        }
+        cond->code = code;
+        pg->code_cap = cap;
+    }
+
+    cond->code[cond->code_len].op = op;
+    cond->code[cond->code_len].arg = arg;
+    return cond->code_len++;
+}
+
+static void acl_emit_jump(struct acl_prog *pg, uint32_t op, uint32_t *chain) {
+    uint32_t at = acl_emit(pg, op, *chain);
+    if (!pg->failed)
+        *chain = at + 1;
+}
+
+static void acl_patch(struct acl_prog *pg, uint32_t chain) {
+    while (chain) {
+        acl_insn_t *insn = &pg->cond->code[chain - 1];
+        chain = insn->arg;
+        insn->arg = pg->cond->code_len;
+    }
+}
+
+static uint32_t acl_expr_index(struct acl_prog *pg, acl_expr_t *expr) {
+    acl_cond_t *cond = pg->cond;
+    for (uint32_t i = 0; i < cond->expr_count; i++) {
+        if (cond->exprs[i] == expr)
+            return i;
+    }
+
+    if (cond->expr_count == pg->exprs_cap) {
+        uint32_t cap = pg->exprs_cap ? pg->exprs_cap * 2 : 8;
+        acl_expr_t **exprs = realloc(cond->exprs, cap * sizeof(*exprs));
+        if (!exprs) {
+            pg->failed = 1;
+            return 0;
+        }
+        cond->exprs = exprs;
+        pg->exprs_cap = cap;
+    }
+
+    cond->exprs[cond->expr_count] = expr;
+    return cond->expr_count++;
+}
+
+// An ACL holds when any of its expressions does
+static void acl_compile_acl(struct acl_prog *pg, acl_t *acl, int neg) {
+    uint32_t matched = 0;
+    int n = 0;
+
+    for (struct list *l = acl->expr_list.n; l != &acl->expr_list; l = l->n) {
+        acl_expr_t *expr = LIST_ELEM(l, acl_expr_t, list);
+        if (n++)
+            acl_emit_jump(pg, ACL_OP_JT, &matched);
+        acl_emit(pg, ACL_OP_EXPR, acl_expr_index(pg, expr));
+    }
+    if (!n)
+        acl_emit(pg, ACL_OP_SET, 0);
+
+    if (!pg->failed)
+        acl_patch(pg, matched);
+    if (neg)
+        acl_emit(pg, ACL_OP_NOT, 0);
+}
+
+void acl_cond_free(acl_cond_t *cond) {
     if (!cond)
+        return;
+
+    acl_t *acl = cond->anon;
+    while (acl) {
+        acl_t *next = acl->next;
+        struct list *l = acl->expr_list.n;
+        while (l != &acl->expr_list) {
+            struct list *next = l->n;
+            acl_expr_free(LIST_ELEM(l, acl_expr_t, list));
+            l = next;
+        }
+        free(acl->name);
+        free(acl);
+        acl = next;
+    }
+
+    free(cond->code);
+    free(cond->exprs);
+    free(cond);
+}
+
+acl_cond_t* acl_cond_parse(const char **args, acl_t *known_acl, char **err) {
+    acl_cond_t *cond = calloc(1, sizeof(*cond));
+    if (!cond) {
+        acl_set_err(err, "Out of memory");
         return NULL;
+    }
+
+    cond->suites.n = cond->suites.p = &cond->suites;
+
+    int unless = 0;
+    if (*args && (strcmp(*args, "if") == 0 || strcmp(*args, "unless") == 0)) {
+        unless = (*args)[0] == 'u';
+        args++;
+    }
 
-    cond->suites.n = &cond->suites;
-    cond->suites.p = &cond->suites;
+    struct acl_prog pg = { .cond = cond };
+    uint32_t term_false = 0;    // jumps out of the current term once it fails
+    uint32_t cond_true = 0;     // jumps to the end once a term holds
+    int terms = 0, factors = 0, anon = 0;
 
     while (*args) {
-        if (strcmp(*args, "if") == 0 || strcmp(*args, "unless") == 0) {
-            args++;
+        const char *tok = *args++;
+
+        if (strcmp(tok, "||") == 0 || strcmp(tok, "or") == 0) {
+            if (!factors) {
+                acl_set_err(err, "Missing ACL before '%s'", tok);
+                goto fail;
+            }
+            acl_patch(&pg, term_false);
+            term_false = 0;
+            factors = 0;
             continue;
         }
 
-        const char *name = *args++;
-        acl_t *acl = acl_find(known_acl, name);
+        int neg = tok[0] == '!';
+        if (neg && !*++tok) {
+            tok = *args++;
+            if (!tok) {
+                acl_set_err(err, "Missing ACL after '!'");
+                goto fail;
+            }
+        }
 
-        if (!acl) {
-            *err = strdup("Unknown ACL");
-            free(cond);
-            return NULL;
+        acl_t *acl;
+        if (strcmp(tok, "{") == 0) {
+            acl_expr_t *expr = acl_expr_parse(args, err);
+            if (!expr)
+                goto fail;
+
+            while (*args && strcmp(*args, "}") != 0)
+                args++;
+            if (!*args) {
+                acl_expr_free(expr);
+                acl_set_err(err, "Missing '}' closing an anonymous ACL");
+                goto fail;
+            }
+            args++;
+
+            char name[32];
+            snprintf(name, sizeof(name), "{%d}", anon++);
+            acl = acl_add_expr(&cond->anon, name, expr);
+            if (!acl) {
+                acl_expr_free(expr);
+                acl_set_err(err, "Out of memory");
+                goto fail;
+            }
+        } else {
+            acl = acl_find(known_acl, tok);
+            if (!acl) {
+                acl_set_err(err, "Unknown ACL '%s'", tok);
+                goto fail;
+            }
         }
 
+        if (factors)
+            acl_emit_jump(&pg, ACL_OP_JF, &term_false);
+        else if (terms++)
+            acl_emit_jump(&pg, ACL_OP_JT, &cond_true);
+        factors++;
+
+        acl_compile_acl(&pg, acl, neg);
         cond->requires |= acl->requires;
         cond->use |= acl->use;
     }
 
+    if (!factors) {
+        acl_set_err(err, terms ? "Missing ACL after '||'" : "Empty condition");
+        goto fail;
+    }
+
+    if (!pg.failed) {
+        acl_patch(&pg, term_false);
+        acl_patch(&pg, cond_true);
+    }
+    if (unless)
+        acl_emit(&pg, ACL_OP_NOT, 0);
+    acl_emit(&pg, ACL_OP_END, 0);
+
+    if (pg.failed) {
+        acl_set_err(err, "Out of memory");
+        goto fail;
+    }
     return cond;
+
+fail:
+    acl_cond_free(cond);
+    return NULL;
+}
+
+// Cache for evaluations without a stream, fresh on every call
+static __thread acl_smp_cache_t acl_local_cache;
+
+static void acl_cache_bump(acl_smp_cache_t *cache) {
+    if (++cache->gen == 0) {
+        memset(cache->ent, 0, cache->size * sizeof(*cache->ent));
+        cache->gen = 1;
+    }
+}
+
+static acl_smp_cache_t *acl_stream_cache(struct stream *strm) {
+    if (!strm) {
+        acl_cache_bump(&acl_local_cache);
+        return &acl_local_cache;
+    }
+
+    if (!strm->acl_cache) {
+        strm->acl_cache = lb_calloc(1, sizeof(*strm->acl_cache));
+        if (!strm->acl_cache)
+            return NULL;
+        strm->acl_cache->gen = 1;
+    }
+    return strm->acl_cache;
+}
+
+static acl_smp_entry_t *acl_cache_entry(acl_smp_cache_t *cache, uint32_t slot) {
+    if (slot >= cache->size) {
+        uint32_t size = acl_smp_slot_count > slot ? acl_smp_slot_count : slot + 1;
+        acl_smp_entry_t *ent = lb_realloc(cache->ent, size * sizeof(*ent));
+        if (!ent)
+            return NULL;
+
+        memset(ent + cache->size, 0, (size - cache->size) * sizeof(*ent));
+        cache->ent = ent;
+        cache->size = size;
+    }
+    return &cache->ent[slot];
+}
+
+void acl_smp_cache_reset(struct stream *strm) {
+    if (strm && strm->acl_cache)
+        acl_cache_bump(strm->acl_cache);
+}
+
+void acl_smp_cache_free(struct stream *strm) {
+    if (!strm || !strm->acl_cache)
+        return;
+
+    lb_free(strm->acl_cache->ent);
+    lb_free(strm->acl_cache);
+    strm->acl_cache = NULL;
+}
+
+// The prefix set can be swapped by a reload at any time; threads that are
+// not RCU readers already join for the lookup
+static int acl_match_lpm(const acl_expr_t *expr, const struct sample *smp) {
+    bool transient = !lb_rcu_online();
+    if (transient) {
+        while (lb_rcu_register() < 0)
+            sched_yield();
+    }
+
+    const acl_lpm_t *lpm = atomic_load_explicit(&expr->lpm, memory_order_acquire);
+    int ret = 0;
+    if (smp->data.type == SMP_T_IPV4)
+        ret = acl_lpm_lookup4(lpm, smp->data.u.ipv4);
+    else if (smp->data.type == SMP_T_IPV6)
+        ret = acl_lpm_lookup6(lpm, &smp->data.u.ipv6);
+
+    if (transient)
+        lb_rcu_unregister();
+    return ret;
+}
+
+static int acl_eval_expr(const acl_expr_t *expr, struct proxy *px, struct session *sess,
+                         struct stream *strm, unsigned int opt, acl_smp_cache_t *cache) {
+    acl_smp_entry_t *ent = cache ? acl_cache_entry(cache, expr->smp_slot) : NULL;
+    struct sample local;
+    struct sample *smp;
+    int found;
+
+    if (ent && ent->stamp == cache->gen) {
+        smp = &ent->smp;
+        found = ent->found;
+    } else {
+        smp = ent ? &ent->smp : &local;
+        memset(smp, 0, sizeof(*smp));
+        found = expr->keyword->fetch(px, sess, strm, opt, expr->args, smp);
+        if (ent) {
+            ent->found = found;
+            ent->stamp = cache->gen;
+        }
+    }
+
+    if (!found)
+        return 0;
+
+    if (expr->flags & ACL_EXPR_F_LPM)
+        return acl_match_lpm(expr, smp);
+
+    // No pattern: the sample's presence is the test
+    if (expr->patterns.n == &expr->patterns)
+        return 1;
+
+    for (const struct list *l = expr->patterns.n; l != &expr->patterns; l = l->n) {
+        if (expr->keyword->match(smp, LIST_ELEM(l, acl_pattern_t, list)))
+            return 1;
+    }
+    return 0;
 }
 
 int acl_exec_cond(acl_cond_t *cond, struct proxy *px, struct session *sess,
                   struct stream *strm, unsigned int opt) {
-    if (!cond)
+    if (!cond || !cond->code)
         return 1;
 
-    return 1;
+    if (!sess && strm)
+        sess = strm->sess;
+
+    acl_smp_cache_t *cache = acl_stream_cache(strm);
+    const acl_insn_t *code = cond->code;
+    uint32_t pc = 0;
+    int r = 0;
+
+    for (;;) {
+        const acl_insn_t *insn = &code[pc++];
+        switch (insn->op) {
+            case ACL_OP_EXPR:
+                r = acl_eval_expr(cond->exprs[insn->arg], px, sess, strm, opt, cache);
+                break;
+            case ACL_OP_SET:
+                r = insn->arg;
+                break;
+            case ACL_OP_NOT:
+                r = !r;
+                break;
+            case ACL_OP_JT:
+                if (r) pc = insn->arg;
+                break;
+            case ACL_OP_JF:
+                if (!r) pc = insn->arg;
+                break;
+            default:
+                return r;
+        }
+    }
 }
 
+// Access rules (allow, deny, tarpit) stop at the first match; the first
+// matching use_backend picks the backend. Rewrite actions are not
+// evaluated here.
 int apply_http_req_rules(struct stream *s, struct channel *req, struct proxy *px) {
-    return 1;
+    struct http_txn *txn = s->txn;
+    int decided = 0, routed = 0;
+
+    if (!px || !px->http_req_rules.n)
+        return ACL_RULES_CONT;
+
+    for (struct list *l = px->http_req_rules.n; l != &px->http_req_rules; l = l->n) {
+        http_req_rule_t *rule = LIST_ELEM(l, http_req_rule_t, list);
+        switch (rule->action) {
+            case ACL_ALLOW:
+            case ACL_DENY:
+            case ACL_TARPIT:
+                if (decided) continue;
+                break;
+            case ACL_USE_BACKEND:
+                if (routed) continue;
+                break;
+            default:
+                continue;
+        }
+
+        if (rule->cond && !acl_exec_cond(rule->cond, px, s->sess, s, SMP_OPT_DIR_REQ))
+            continue;
+
+        switch (rule->action) {
+            case ACL_ALLOW:
+                decided = 1;
+                break;
+            case ACL_DENY:
+                if (txn)
+                    txn->status = rule->arg.deny.status ? rule->arg.deny.status : 403;
+                return ACL_RULES_DENY;
+            case ACL_TARPIT:
+                s->flags |= SF_TARPIT;
+                if (txn)
+                    txn->status = 500;
+                return ACL_RULES_DENY;
+            case ACL_USE_BACKEND: {
+                struct proxy *be = proxy_find_by_name(rule->arg.backend.name);
+                if (be) {
+                    s->be = be;
+                    routed = 1;
+                }
+                break;
+            }
+        }
+    }
+
+    return ACL_RULES_CONT;
 }
 
+static int apply_http_res_rules_px(struct stream *s, struct proxy *px) {
+    struct http_txn *txn = s->txn;
+
+    if (!px || !px->http_res_rules.n)
+        return ACL_RULES_CONT;
+
+    for (struct list *l = px->http_res_rules.n; l != &px->http_res_rules; l = l->n) {
+        http_res_rule_t *rule = LIST_ELEM(l, http_res_rule_t, list);
+        if (rule->action != ACL_ALLOW && rule->action != ACL_DENY)
+            continue;
+        if (rule->cond && !acl_exec_cond(rule->cond, px, s->sess, s, SMP_OPT_DIR_RES))
+            continue;
+
+        if (rule->action == ACL_ALLOW)
+            break;
+
+        if (txn)
+            txn->status = rule->arg.deny.status ? rule->arg.deny.status : 502;
+        return ACL_RULES_DENY;
+    }
+
+    return ACL_RULES_CONT;
+}
+
+// Backend rules first, then the frontend's
 int apply_http_res_rules(struct stream *s, struct channel *res) {
-    return 1;
+    if (apply_http_res_rules_px(s, s->be) == ACL_RULES_DENY)
+        return ACL_RULES_DENY;
+    if (s->fe != s->be)
+        return apply_http_res_rules_px(s, s->fe);
+    return ACL_RULES_CONT;
 }
 
 void acl_register_keywords(acl_keyword_t *kw_list) {
     for (int i = 0; kw_list[i].kw; i++) {
+        if (acl_keywords_count == (int)(sizeof(acl_keywords) / sizeof(acl_keywords[0]))) {
+            log_error("Too many ACL keywords, ignoring '%s'", kw_list[i].kw);
+            continue;
+        }
         acl_keywords[acl_keywords_count++] = kw_list[i];
     }
 }
@@ -401,10 +1302,19 @@ static acl_keyword_t builtin_keywords[] = {
     {"path_reg",   pattern_parse_reg,  acl_match_reg,  fetch_path, 0, 0},
     {"hdr",        pattern_parse_str,  acl_match_str,  fetch_hdr, 0, 0},
     {"method",     pattern_parse_str,  acl_match_str,  fetch_method, 0, 0},
+    {"hdr_beg",    pattern_parse_str,  acl_match_beg,  fetch_hdr, 0, 0},
+    {"hdr_end",    pattern_parse_str,  acl_match_end,  fetch_hdr, 0, 0},
+    {"hdr_sub",    pattern_parse_str,  acl_match_sub,  fetch_hdr, 0, 0},
+    {"hdr_reg",    pattern_parse_reg,  acl_match_reg,  fetch_hdr, 0, 0},
     {"url_param",  pattern_parse_str,  acl_match_str,  fetch_url_param, 0, 0},
     {NULL, NULL, NULL, NULL, 0, 0}
 };
 
-void acl_init() {
+void acl_init(void) {
+    static int done;
+    if (done)
+        return;
+
+    done = 1;
     acl_register_keywords(builtin_keywords);
 }
\ No newline at end of file
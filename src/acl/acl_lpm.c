@@ -0,0 +1,280 @@
+#include "acl/acl_lpm.h"
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+// tbl24 values and IPv6 trie entries: no prefix covers the range, one
+// does, or REF(i) for the i-th second-level bitmap or trie node
+#define LPM_NONE    0
+#define LPM_HIT     1
+#define LPM_REF(i)  ((uint32_t)(i) + 2)
+
+#define LPM_TBL24_SIZE (1u << 24)
+
+struct lpm_prefix4 {
+    uint32_t addr;              // host byte order, masked to len
+    uint8_t len;
+};
+
+struct lpm_prefix6 {
+    struct in6_addr addr;       // masked to len
+    uint8_t len;
+};
+
+// Low 8 bits of the addresses under one tbl24 entry
+typedef struct lpm_tbl8 {
+    uint64_t bits[4];
+} lpm_tbl8_t;
+
+typedef struct lpm_node6 {
+    uint32_t e[256];
+} lpm_node6_t;
+
+struct acl_lpm {
+    uint32_t *tbl24;            // NULL without IPv4 prefixes
+    lpm_tbl8_t *tbl8;
+    uint32_t tbl8_count;
+    uint32_t tbl8_cap;
+
+    lpm_node6_t *nodes;         // root is node 0; NULL without IPv6 prefixes
+    uint32_t node_count;
+    uint32_t node_cap;
+
+    struct lpm_prefix4 *stage4;
+    size_t stage4_count;
+    size_t stage4_cap;
+    struct lpm_prefix6 *stage6;
+    size_t stage6_count;
+    size_t stage6_cap;
+
+    size_t count;
+};
+
+acl_lpm_t *acl_lpm_new(void) {
+    return calloc(1, sizeof(acl_lpm_t));
+}
+
+void acl_lpm_free(acl_lpm_t *lpm) {
+    if (!lpm)
+        return;
+
+    free(lpm->tbl24);
+    free(lpm->tbl8);
+    free(lpm->nodes);
+    free(lpm->stage4);
+    free(lpm->stage6);
+    free(lpm);
+}
+
+size_t acl_lpm_count(const acl_lpm_t *lpm) {
+    return lpm->count;
+}
+
+static int lpm_grow(void **arr, size_t *cap, size_t need, size_t elem) {
+    if (need <= *cap)
+        return 0;
+
+    size_t n = *cap ? *cap * 2 : 64;
+    while (n < need)
+        n *= 2;
+
+    void *p = realloc(*arr, n * elem);
+    if (!p)
+        return -1;
+    *arr = p;
+    *cap = n;
+    return 0;
+}
+
+int acl_lpm_add4(acl_lpm_t *lpm, struct in_addr addr, int len) {
+    if (len < 0 || len > 32)
+        return -1;
+    if (lpm_grow((void **)&lpm->stage4, &lpm->stage4_cap, lpm->stage4_count + 1,
+                 sizeof(*lpm->stage4)) < 0)
+        return -1;
+
+    uint32_t mask = len ? ~0u << (32 - len) : 0;
+    struct lpm_prefix4 *p = &lpm->stage4[lpm->stage4_count++];
+    p->addr = ntohl(addr.s_addr) & mask;
+    p->len = len;
+    lpm->count++;
+    return 0;
+}
+
+int acl_lpm_add6(acl_lpm_t *lpm, const struct in6_addr *addr, int len) {
+    if (len < 0 || len > 128)
+        return -1;
+    if (lpm_grow((void **)&lpm->stage6, &lpm->stage6_cap, lpm->stage6_count + 1,
+                 sizeof(*lpm->stage6)) < 0)
+        return -1;
+
+    struct lpm_prefix6 *p = &lpm->stage6[lpm->stage6_count++];
+    p->addr = *addr;
+    p->len = len;
+    for (int i = 0; i < 16; i++) {
+        int bits = len - i * 8;
+        if (bits >= 8)
+            continue;
+        p->addr.s6_addr[i] &= bits > 0 ? (uint8_t)(0xff << (8 - bits)) : 0;
+    }
+    lpm->count++;
+    return 0;
+}
+
+static int lpm_cmp4(const void *a, const void *b) {
+    return ((const struct lpm_prefix4 *)a)->len - ((const struct lpm_prefix4 *)b)->len;
+}
+
+static int lpm_cmp6(const void *a, const void *b) {
+    return ((const struct lpm_prefix6 *)a)->len - ((const struct lpm_prefix6 *)b)->len;
+}
+
+// Prefixes go in shortest first: a longer one under a range already
+// marked LPM_HIT adds nothing, so no bitmap or node is ever orphaned
+static int lpm_build4(acl_lpm_t *lpm) {
+    lpm->tbl24 = calloc(LPM_TBL24_SIZE, sizeof(*lpm->tbl24));
+    if (!lpm->tbl24)
+        return -1;
+
+    qsort(lpm->stage4, lpm->stage4_count, sizeof(*lpm->stage4), lpm_cmp4);
+
+    for (size_t i = 0; i < lpm->stage4_count; i++) {
+        const struct lpm_prefix4 *p = &lpm->stage4[i];
+        uint32_t idx = p->addr >> 8;
+
+        if (p->len <= 24) {
+            uint32_t n = 1u << (24 - p->len);
+            for (uint32_t j = 0; j < n; j++)
+                lpm->tbl24[idx + j] = LPM_HIT;
+            continue;
+        }
+
+        uint32_t e = lpm->tbl24[idx];
+        if (e == LPM_HIT)
+            continue;
+        if (e == LPM_NONE) {
+            size_t cap = lpm->tbl8_cap;
+            if (lpm_grow((void **)&lpm->tbl8, &cap, lpm->tbl8_count + 1, sizeof(*lpm->tbl8)) < 0)
+                return -1;
+            lpm->tbl8_cap = cap;
+            memset(&lpm->tbl8[lpm->tbl8_count], 0, sizeof(*lpm->tbl8));
+            e = LPM_REF(lpm->tbl8_count++);
+            lpm->tbl24[idx] = e;
+        }
+
+        lpm_tbl8_t *t = &lpm->tbl8[e - 2];
+        uint32_t low = p->addr & 0xff;
+        uint32_t n = 1u << (32 - p->len);
+        for (uint32_t b = low; b < low + n; b++)
+            t->bits[b >> 6] |= 1ULL << (b & 63);
+    }
+    return 0;
+}
+
+static int lpm_node6_new(acl_lpm_t *lpm, uint32_t *id) {
+    size_t cap = lpm->node_cap;
+    if (lpm_grow((void **)&lpm->nodes, &cap, lpm->node_count + 1, sizeof(*lpm->nodes)) < 0)
+        return -1;
+    lpm->node_cap = cap;
+    memset(&lpm->nodes[lpm->node_count], 0, sizeof(*lpm->nodes));
+    *id = lpm->node_count++;
+    return 0;
+}
+
+static int lpm_build6(acl_lpm_t *lpm) {
+    uint32_t root;
+    if (lpm_node6_new(lpm, &root) < 0)
+        return -1;
+
+    qsort(lpm->stage6, lpm->stage6_count, sizeof(*lpm->stage6), lpm_cmp6);
+
+    for (size_t i = 0; i < lpm->stage6_count; i++) {
+        const struct lpm_prefix6 *p = &lpm->stage6[i];
+        uint32_t node = root;
+
+        for (int d = 0; d < 16; d++) {
+            int rem = p->len - d * 8;
+            uint8_t b = p->addr.s6_addr[d];
+
+            // The prefix ends in this byte: cover every entry it expands to
+            if (rem <= 8) {
+                uint32_t n = 1u << (8 - rem);
+                for (uint32_t j = 0; j < n; j++)
+                    lpm->nodes[node].e[(b & ~(n - 1)) + j] = LPM_HIT;
+                break;
+            }
+
+            uint32_t e = lpm->nodes[node].e[b];
+            if (e == LPM_HIT)
+                break;
+            if (e == LPM_NONE) {
+                uint32_t child;
+                if (lpm_node6_new(lpm, &child) < 0)
+                    return -1;
+                e = LPM_REF(child);
+                lpm->nodes[node].e[b] = e;
+            }
+            node = e - 2;
+        }
+    }
+    return 0;
+}
+
+int acl_lpm_build(acl_lpm_t *lpm) {
+    if (lpm->stage4_count && !lpm->tbl24 && lpm_build4(lpm) < 0)
+        return -1;
+    if (lpm->stage6_count && !lpm->nodes && lpm_build6(lpm) < 0)
+        return -1;
+
+    free(lpm->stage4);
+    free(lpm->stage6);
+    lpm->stage4 = NULL;
+    lpm->stage6 = NULL;
+    lpm->stage4_count = lpm->stage4_cap = 0;
+    lpm->stage6_count = lpm->stage6_cap = 0;
+
+    // Give back the slack left by doubling
+    if (lpm->tbl8_count) {
+        lpm_tbl8_t *t = realloc(lpm->tbl8, lpm->tbl8_count * sizeof(*t));
+        if (t) {
+            lpm->tbl8 = t;
+            lpm->tbl8_cap = lpm->tbl8_count;
+        }
+    }
+    if (lpm->node_count) {
+        lpm_node6_t *n = realloc(lpm->nodes, lpm->node_count * sizeof(*n));
+        if (n) {
+            lpm->nodes = n;
+            lpm->node_cap = lpm->node_count;
+        }
+    }
+    return 0;
+}
+
+bool acl_lpm_lookup4(const acl_lpm_t *lpm, struct in_addr addr) {
+    if (!lpm->tbl24)
+        return false;
+
+    uint32_t a = ntohl(addr.s_addr);
+    uint32_t e = lpm->tbl24[a >> 8];
+    if (e <= LPM_HIT)
+        return e == LPM_HIT;
+
+    const lpm_tbl8_t *t = &lpm->tbl8[e - 2];
+    uint32_t low = a & 0xff;
+    return (t->bits[low >> 6] >> (low & 63)) & 1;
+}
+
+bool acl_lpm_lookup6(const acl_lpm_t *lpm, const struct in6_addr *addr) {
+    if (!lpm->nodes)
+        return false;
+
+    uint32_t node = 0;
+    for (int d = 0; d < 16; d++) {
+        uint32_t e = lpm->nodes[node].e[addr->s6_addr[d]];
+        if (e <= LPM_HIT)
+            return e == LPM_HIT;
+        node = e - 2;
+    }
+    return false;
+}
@@ -1,5 +1,10 @@
 #include "cache/cache.h"
 #include "core/proxy.h"
+#include "core/lb_alloc.h"
+#include "core/lb_clock.h"
+#include "core/lb_rcu.h"
+#include "core/lb_utils.h"
+#include "cache/cache_slab.h"
 #include "http/http.h"
 #include "utils/log.h"
 #include "utils/buffer.h"
@@ -7,8 +12,16 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdatomic.h>
+#include <sched.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
 #include <brotli/encode.h>
 #include <brotli/decode.h>
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
 
 
 // claude help meeeeeee :3 
@@ -17,6 +30,15 @@
 static cache_t *caches = NULL;
 static pthread_rwlock_t caches_lock = PTHREAD_RWLOCK_INITIALIZER;
 
+static uint32_t cache_pow2(uint32_t n) {
+    uint32_t p = 64;
+    while (p < n && p < (1u << 30))
+        p <<= 1;
+    return p;
+}
+
+static void cache_shard_free(cache_shard_t *sh);
+
 cache_t* cache_create(const char *name, uint32_t max_size, uint32_t max_object_size) {
     cache_t *cache = calloc(1, sizeof(*cache));
     if (!cache) return NULL;
@@ -25,32 +47,45 @@ cache_t* cache_create(const char *name, uint32_t max_size, uint32_t max_object_s
     cache->max_size = max_size;
     cache->max_object_size = max_object_size;
     cache->max_age = 3600;  /* Default 1 hour */
+    cache->fill_timeout = 10;
     cache->max_entries = max_size / 1024;  /* Rough estimate */
 
-    /* Initialize hash table - use prime number for better distribution */
-    cache->hash.size = 16381;  /* Prime number */
-    cache->hash.mask = cache->hash.size - 1;
-    cache->hash.table = calloc(cache->hash.size, sizeof(cache_entry_t*));
-    cache->hash.locks = calloc(cache->hash.size, sizeof(pthread_spinlock_t));
-
-    if (!cache->hash.table || !cache->hash.locks) {
-        free(cache->hash.table);
-        free((void*)cache->hash.locks);
+    cache->shards = aligned_alloc(64, CACHE_SHARDS * sizeof(*cache->shards));
+    if (!cache->name || !cache->shards) {
+        free(cache->shards);
         free(cache->name);
         free(cache);
         return NULL;
     }
-
-    /* Initialize per-bucket locks for fine-grained concurrency */
-    for (uint32_t i = 0; i < cache->hash.size; i++) {
-        pthread_spin_init(&cache->hash.locks[i], PTHREAD_PROCESS_PRIVATE);
+    memset(cache->shards, 0, CACHE_SHARDS * sizeof(*cache->shards));
+
+    /* Power-of-two index per shard, sized for its share of the entries */
+    uint32_t per_shard = cache->max_entries / CACHE_SHARDS + 1;
+    for (uint32_t i = 0; i < CACHE_SHARDS; i++) {
+        cache_shard_t *sh = &cache->shards[i];
+        uint32_t buckets = cache_pow2(per_shard);
+
+        pthread_spin_init(&sh->lock, PTHREAD_PROCESS_PRIVATE);
+        sh->mask = buckets - 1;
+        sh->table = calloc(buckets, sizeof(*sh->table));
+        sh->ghost_mask = buckets - 1;
+        sh->ghost = calloc(buckets, sizeof(*sh->ghost));
+        sh->max_bytes = max_size / CACHE_SHARDS;
+        sh->max_entries = per_shard;
+
+        if (!sh->table || !sh->ghost) {
+            for (uint32_t j = 0; j <= i; j++)
+                cache_shard_free(&cache->shards[j]);
+            free(cache->shards);
+            free(cache->name);
+            free(cache);
+            return NULL;
+        }
     }
 
-    /* Initialize LRU list */
-    cache->lru.head = cache->lru.tail = NULL;
-    pthread_spin_init(&cache->lru.lock, PTHREAD_PROCESS_PRIVATE);
-
     pthread_rwlock_init(&cache->lock, NULL);
+    pthread_mutex_init(&cache->comp.lock, NULL);
+    pthread_cond_init(&cache->comp.cond, NULL);
 
     /* Add to global list */
     pthread_rwlock_wrlock(&caches_lock);
@@ -64,106 +99,804 @@ cache_t* cache_create(const char *name, uint32_t max_size, uint32_t max_object_s
     return cache;
 }
 
-/* Jenkins hash function for cache keys */
+#define CACHE_KEY_SEED 0x63616368
+
+void cache_key_init(cache_key_t *key) {
+    lb_hash128_init(&key->st, CACHE_KEY_SEED);
+    key->len = 0;
+    key->nparts = 0;
+    key->msg = NULL;
+    key->buf = NULL;
+}
+
+/* Parts are joined by a space in the stored key: none of them can hold
+ * one, so two different keys never concatenate to the same text */
+void cache_key_add(cache_key_t *key, const char *ptr, size_t len) {
+    if (key->nparts) {
+        lb_hash128_update(&key->st, " ", 1);
+        key->len++;
+    }
+    lb_hash128_update(&key->st, ptr, len);
+    key->part[key->nparts].ptr = ptr;
+    key->part[key->nparts].len = len;
+    key->nparts++;
+    key->len += len;
+}
+
+void cache_key_done(cache_key_t *key) {
+    lb_hash128_final(&key->st, key->hash);
+}
+
+void cache_key_str(cache_key_t *key, const char *str) {
+    cache_key_init(key);
+    cache_key_add(key, str, strlen(str));
+    cache_key_done(key);
+}
+
+static const char *cache_meth_name(uint32_t meth) {
+    switch (meth) {
+    case HTTP_METH_GET:  return "GET";
+    case HTTP_METH_HEAD: return "HEAD";
+    default:             return "OTHER";
+    }
+}
+
+int cache_key_build(cache_key_t *key, struct http_txn *txn, const struct buffer *buf) {
+    if (!txn || !txn->uri) return -1;
+
+    const char *meth = cache_meth_name(txn->meth);
+    cache_key_init(key);
+    cache_key_add(key, meth, strlen(meth));
+
+    const http_hdr_t *host = http_msg_known(&txn->req, HTTP_HDR_HOST);
+    if (host)
+        cache_key_add(key, http_slice_ptr(buf, host->v), host->v.len);
+    else
+        cache_key_add(key, "", 0);
+
+    cache_key_add(key, txn->uri, txn->uri_len ? txn->uri_len : strlen(txn->uri));
+    cache_key_done(key);
+
+    key->msg = &txn->req;
+    key->buf = buf;
+    return 0;
+}
+
+/* Hash of the request's values for the headers a Vary lists. Values are
+ * compared case-insensitively and without whitespace, and an absent
+ * header differs from an empty one. */
+static uint64_t cache_vary_hash_ex(const char *vary, const struct http_msg *msg,
+                                   const struct buffer *buf, bool skip_ae) {
+    lb_hash128_t st;
+    lb_hash128_init(&st, CACHE_KEY_SEED);
+
+    const char *p = vary;
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',')
+            p++;
+        const char *name = p;
+        while (*p && *p != ',' && *p != ' ' && *p != '\t')
+            p++;
+        size_t len = p - name;
+        if (!len || len >= 64)
+            continue;
+
+        char lname[64];
+        for (size_t i = 0; i < len; i++)
+            lname[i] = tolower((unsigned char)name[i]);
+        lname[len] = '\0';
+        /* Negotiated by the cache itself, see cache_pick_variant() */
+        if (skip_ae && strcmp(lname, "accept-encoding") == 0)
+            continue;
+        lb_hash128_update(&st, lname, len + 1);
+
+        const http_hdr_t *hdr = msg ? http_msg_find(msg, buf, lname) : NULL;
+        if (!hdr) {
+            lb_hash128_update(&st, "\1", 1);
+            continue;
+        }
+
+        const char *v = http_slice_ptr(buf, hdr->v);
+        char norm[64];
+        size_t n = 0;
+        for (uint32_t i = 0; i < hdr->v.len; i++) {
+            if (v[i] == ' ' || v[i] == '\t')
+                continue;
+            norm[n++] = tolower((unsigned char)v[i]);
+            if (n == sizeof(norm)) {
+                lb_hash128_update(&st, norm, n);
+                n = 0;
+            }
+        }
+        lb_hash128_update(&st, norm, n);
+        lb_hash128_update(&st, "\0", 1);
+    }
+
+    uint64_t h[2];
+    lb_hash128_final(&st, h);
+    return h[0];
+}
+
+uint64_t cache_vary_hash(const char *vary, const struct http_msg *msg, const struct buffer *buf) {
+    return cache_vary_hash_ex(vary, msg, buf, false);
+}
+
+static uint64_t cache_entry_vary_hash(const cache_entry_t *e, const struct http_msg *msg,
+                                      const struct buffer *buf) {
+    return cache_vary_hash_ex(e->vary, msg, buf, e->flags & CACHE_F_NEGOTIATED);
+}
+
+/* The top bits pick the shard and the low bits the bucket */
+static inline uint32_t cache_key_hash32(const cache_key_t *key) {
+    return (uint32_t)(key->hash[0] >> 32);
+}
+
 uint32_t cache_hash_key(const char *key) {
-    uint32_t hash = 0;
+    cache_key_t k;
+    cache_key_str(&k, key);
+    return cache_key_hash32(&k);
+}
 
-    while (*key) {
-        hash += *key++;
-        hash += (hash << 10);
-        hash ^= (hash >> 6);
+/* Hash and length first; the stored text only to rule out a collision */
+static bool cache_key_match(const cache_entry_t *e, const cache_key_t *key) {
+    if (e->key_h[0] != key->hash[0] || e->key_h[1] != key->hash[1] || e->key_len != key->len)
+        return false;
+
+    const char *t = e->key;
+    for (uint32_t i = 0; i < key->nparts; i++) {
+        if (i && *t++ != ' ')
+            return false;
+        if (memcmp(t, key->part[i].ptr, key->part[i].len) != 0)
+            return false;
+        t += key->part[i].len;
     }
+    return true;
+}
 
-    hash += (hash << 3);
-    hash ^= (hash >> 11);
-    hash += (hash << 15);
+/* Whether e is the variant the request behind key wants. Keys without
+ * request headers (by-string lookups) take any. */
+static bool cache_vary_match(const cache_entry_t *e, const cache_key_t *key) {
+    if (!e->vary || !key->buf)
+        return true;
+    return cache_entry_vary_hash(e, key->msg, key->buf) == e->vary_hash;
+}
 
-    return hash;
+static inline cache_shard_t *cache_shard(cache_t *cache, uint32_t hash) {
+    return &cache->shards[hash >> (32 - CACHE_SHARD_BITS)];
 }
 
-char* cache_build_key(struct http_txn *txn) {
-    if (!txn || !txn->uri) return NULL;
+cache_entry_t* cache_entry_new(void) {
+    cache_entry_t *entry = lb_calloc(1, sizeof(*entry));
+    if (!entry) return NULL;
 
-    /* Build cache key from method + host + uri + vary headers */
-    char key[2048];
-    int len = 0;
+    pthread_rwlock_init(&entry->lock, NULL);
+    atomic_init(&entry->refs, 1);
+    return entry;
+}
+
+cache_entry_t* cache_entry_get(cache_entry_t *entry) {
+    atomic_fetch_add_explicit(&entry->refs, 1, memory_order_relaxed);
+    return entry;
+}
 
-    /* Add method */
-    len += snprintf(key + len, sizeof(key) - len, "%u:", txn->meth);
+void cache_entry_put(cache_entry_t *entry) {
+    if (atomic_fetch_sub_explicit(&entry->refs, 1, memory_order_acq_rel) != 1)
+        return;
 
-    /* Add host header if present */
-    char *host = http_header_get(&txn->req, "Host");
-    if (host) {
-        len += snprintf(key + len, sizeof(key) - len, "%s:", host);
+    if (entry->slab)
+        cache_slab_free(entry->slab, entry->slab_off, entry->data.alloc);
+    else
+        lb_free(entry->data.ptr);
+    for (int i = 0; i < CACHE_ENCS; i++) {
+        cache_variant_t *v = atomic_load_explicit(&entry->variants[i], memory_order_relaxed);
+        if (!v) continue;
+        if (v->slab)
+            cache_slab_free(v->slab, v->slab_off, v->data.alloc);
+        else
+            lb_free(v->data.ptr);
+        lb_free(v);
     }
+    lb_free(entry->key);
+    lb_free(entry->etag);
+    lb_free(entry->vary);
+    pthread_rwlock_destroy(&entry->lock);
+    lb_free(entry);
+}
 
-    /* Add URI */
-    len += snprintf(key + len, sizeof(key) - len, "%s", txn->uri);
+/* Drops the cache's reference once no reader can still find the entry */
+static void cache_entry_free(void *ptr) {
+    cache_entry_put(ptr);
+}
+
+/* Finds key for a lookup. With stale set, entries past their expiry are
+ * still returned until stale_until, flagged in *stale; with ref set, the
+ * caller gets a reference taken inside the read-side section. */
+static cache_entry_t* cache_find(cache_t *cache, const cache_key_t *key,
+                                 bool ref, bool *stale) {
+    uint32_t hash = cache_key_hash32(key);
+    cache_shard_t *sh = cache_shard(cache, hash);
+
+    /* Workers are RCU readers already; anyone else is one for the walk */
+    bool transient = !lb_rcu_online();
+    if (transient) {
+        while (lb_rcu_register() < 0)
+            sched_yield();
+    }
 
-    /* TODO: Add vary header values */
+    cache_entry_t *entry = atomic_load_explicit(&sh->table[hash & sh->mask], memory_order_acquire);
+    while (entry) {
+        if (cache_key_match(entry, key) && cache_vary_match(entry, key))
+            break;
+        entry = atomic_load_explicit(&entry->hash_next, memory_order_acquire);
+    }
 
-    return strdup(key);
+    time_t now = lb_now_sec();
+    bool allow_stale = stale;
+    if (stale)
+        *stale = false;
+    if (entry && entry->expires <= now) {
+        if (allow_stale && entry->stale_until > now)
+            *stale = true;
+        else
+            entry = NULL;
+    }
+
+    if (entry) {
+        /* The whole cost of a hit on the eviction policy: a racy
+         * saturating counter, no list to reorder */
+        uint8_t f = atomic_load_explicit(&entry->freq, memory_order_relaxed);
+        if (f < CACHE_FREQ_MAX)
+            atomic_store_explicit(&entry->freq, f + 1, memory_order_relaxed);
+        if (ref)
+            cache_entry_get(entry);
+    }
+
+    if (transient)
+        lb_rcu_unregister();
+
+    atomic_fetch_add_explicit(entry ? &cache->stats.hits : &cache->stats.misses, 1,
+                              memory_order_relaxed);
+    if (stale && *stale)
+        atomic_fetch_add_explicit(&cache->stats.stale_hits, 1, memory_order_relaxed);
+    return entry;
 }
 
 cache_entry_t* cache_lookup(cache_t *cache, const char *key) {
-    uint32_t hash = cache_hash_key(key);
-    uint32_t idx = hash & cache->hash.mask;
+    cache_key_t k;
+    cache_key_str(&k, key);
+    return cache_find(cache, &k, false, NULL);
+}
 
-    /* Per-bucket locking for better concurrency */
-    pthread_spin_lock(&cache->hash.locks[idx]);
+static void fifo_push(cache_fifo_t *q, cache_entry_t *e) {
+    e->q_prev = NULL;
+    e->q_next = q->head;
+    if (q->head)
+        q->head->q_prev = e;
+    q->head = e;
+    if (!q->tail)
+        q->tail = e;
+    q->bytes += e->size;
+    q->count++;
+}
 
-    cache_entry_t *entry = cache->hash.table[idx];
-    while (entry) {
-        if (entry->key_hash == hash && strcmp(entry->key, key) == 0) {
-            /* Check if entry is still valid */
-            time_t now = time(NULL);
-            if (entry->expires > now) {
-                entry->last_access = now;
-                entry->access_count++;
-
-                atomic_fetch_add(&cache->stats.hits, 1);
-                pthread_spin_unlock(&cache->hash.locks[idx]);
-
-                /* Update LRU position */
-                cache_update_lru(cache, entry);
-
-                return entry;
-            } else {
-                /* Entry expired */
-                atomic_fetch_add(&cache->stats.misses, 1);
-                pthread_spin_unlock(&cache->hash.locks[idx]);
-                return NULL;
+static void fifo_remove(cache_fifo_t *q, cache_entry_t *e) {
+    if (e->q_prev)
+        e->q_prev->q_next = e->q_next;
+    else
+        q->head = e->q_next;
+    if (e->q_next)
+        e->q_next->q_prev = e->q_prev;
+    else
+        q->tail = e->q_prev;
+    e->q_prev = e->q_next = NULL;
+    q->bytes -= e->size;
+    q->count--;
+}
+
+static inline cache_fifo_t *cache_queue_of(cache_shard_t *sh, cache_entry_t *e) {
+    return e->queue == CACHE_Q_SMALL ? &sh->small : &sh->main;
+}
+
+static inline uint32_t *cache_ghost_slot(cache_shard_t *sh, uint32_t hash) {
+    return &sh->ghost[hash & sh->ghost_mask];
+}
+
+/* Takes an entry out of the index and its queue; the shard is locked */
+static void cache_unlink(cache_t *cache, cache_shard_t *sh, cache_entry_t *victim) {
+    cache_entry_t *_Atomic *p = &sh->table[victim->key_hash & sh->mask];
+    cache_entry_t *cur;
+    while ((cur = atomic_load_explicit(p, memory_order_relaxed))) {
+        if (cur == victim) {
+            /* Readers already on the victim still reach its successor */
+            atomic_store_explicit(p, atomic_load_explicit(&victim->hash_next, memory_order_relaxed),
+                                  memory_order_release);
+            break;
+        }
+        p = &cur->hash_next;
+    }
+
+    fifo_remove(cache_queue_of(sh, victim), victim);
+    victim->queue = CACHE_Q_NONE;
+
+    atomic_fetch_sub_explicit(&cache->current_size, victim->size, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&cache->entry_count, 1, memory_order_relaxed);
+}
+
+static void cache_drop(cache_t *cache, cache_shard_t *sh, cache_entry_t *victim) {
+    cache_unlink(cache, sh, victim);
+    atomic_fetch_add_explicit(&cache->stats.evictions, 1, memory_order_relaxed);
+    log_debug("Evicted cache entry: key=%s, size=%u", victim->key, victim->size);
+    lb_rcu_retire(victim, cache_entry_free);
+}
+
+/* Main queue: a CLOCK over a FIFO. An entry hit since its last pass goes
+ * round again with one hit less; the first one without hits goes. */
+static void cache_evict_main(cache_t *cache, cache_shard_t *sh) {
+    cache_entry_t *e;
+    while ((e = sh->main.tail)) {
+        uint8_t f = atomic_load_explicit(&e->freq, memory_order_relaxed);
+        if (!f) {
+            cache_drop(cache, sh, e);
+            return;
+        }
+        atomic_store_explicit(&e->freq, f - 1, memory_order_relaxed);
+        fifo_remove(&sh->main, e);
+        fifo_push(&sh->main, e);
+    }
+}
+
+/* Small queue: an entry hit while it was here earns a place in the main
+ * queue; the rest leave, remembered only by the ghost table */
+static void cache_evict_small(cache_t *cache, cache_shard_t *sh) {
+    cache_entry_t *e;
+    while ((e = sh->small.tail)) {
+        if (atomic_load_explicit(&e->freq, memory_order_relaxed)) {
+            fifo_remove(&sh->small, e);
+            atomic_store_explicit(&e->freq, 0, memory_order_relaxed);
+            e->queue = CACHE_Q_MAIN;
+            fifo_push(&sh->main, e);
+            atomic_fetch_add_explicit(&cache->stats.promotions, 1, memory_order_relaxed);
+            continue;
+        }
+
+        *cache_ghost_slot(sh, e->key_hash) = e->key_hash | 1;
+        cache_drop(cache, sh, e);
+        return;
+    }
+    cache_evict_main(cache, sh);
+}
+
+static void cache_evict(cache_t *cache, cache_shard_t *sh) {
+    if (sh->small.bytes > sh->max_bytes / 10 || !sh->main.tail)
+        cache_evict_small(cache, sh);
+    else
+        cache_evict_main(cache, sh);
+}
+
+void cache_set_slab(cache_t *cache, cache_slab_t *slab) {
+    cache->slab = slab;
+    if (slab && cache->max_object_size > CACHE_SLAB_PAGE)
+        cache->max_object_size = CACHE_SLAB_PAGE;
+}
+
+/* Room for len bytes of object data, in the slab if there is one */
+static char* cache_alloc_bytes(cache_t *cache, uint32_t hash, size_t len,
+                               cache_slab_t **slab_out, uint64_t *off_out) {
+    cache_slab_t *slab = cache->slab;
+
+    *slab_out = NULL;
+    if (!slab)
+        return lb_alloc(len);
+
+    int64_t off = cache_slab_alloc(slab, len);
+    if (off < 0) {
+        /* Chunks come back once their grace period ends and the last
+         * send is done, so a full slab may not have room right away */
+        cache_shard_t *sh = cache_shard(cache, hash);
+        pthread_spin_lock(&sh->lock);
+        for (int i = 0; i < 8 && (sh->small.tail || sh->main.tail); i++)
+            cache_evict(cache, sh);
+        pthread_spin_unlock(&sh->lock);
+        off = cache_slab_alloc(slab, len);
+        if (off < 0) return NULL;
+    }
+    *slab_out = slab;
+    *off_out = off;
+    return cache_slab_ptr(slab, off);
+}
+
+int cache_entry_set_data(cache_t *cache, cache_entry_t *entry, const cache_key_t *key,
+                         const void *src, size_t len) {
+    entry->data.ptr = cache_alloc_bytes(cache, cache_key_hash32(key), len,
+                                        &entry->slab, &entry->slab_off);
+    if (!entry->data.ptr) return -1;
+
+    memcpy(entry->data.ptr, src, len);
+    entry->data.len = entry->data.alloc = len;
+    entry->size = len;
+    return 0;
+}
+
+static bool cache_memcasemem(const char *p, size_t len, const char *needle) {
+    size_t n = strlen(needle);
+    for (size_t i = 0; i + n <= len; i++) {
+        if (strncasecmp(p + i, needle, n) == 0)
+            return true;
+    }
+    return false;
+}
+
+/* Identity header block with the encoding's framing swapped in */
+static size_t cache_variant_headers(const cache_entry_t *e, const char *enc, size_t body_len,
+                                    char *out, size_t cap) {
+    const char *p = e->data.ptr;
+    const char *end = p + e->hdr_len;
+    size_t n = 0;
+    bool first = true, vary_ae = false;
+
+    while (p < end) {
+        const char *eol = memchr(p, '\n', end - p);
+        const char *next = eol ? eol + 1 : end;
+        size_t len = (eol ? eol : end) - p;
+        if (len && p[len - 1] == '\r')
+            len--;
+        if (!len)
+            break;
+
+        if (!first) {
+            if ((len >= 15 && strncasecmp(p, "Content-Length:", 15) == 0) ||
+                (len >= 17 && strncasecmp(p, "Content-Encoding:", 17) == 0)) {
+                p = next;
+                continue;
             }
+            if (len >= 5 && strncasecmp(p, "Vary:", 5) == 0 &&
+                cache_memcasemem(p, len, "accept-encoding"))
+                vary_ae = true;
         }
-        entry = entry->hash_next;
+        if (n + len + 2 > cap)
+            return 0;
+        memcpy(out + n, p, len);
+        n += len;
+        out[n++] = '\r';
+        out[n++] = '\n';
+        first = false;
+        p = next;
+    }
+
+    int w = snprintf(out + n, cap - n, "Content-Encoding: %s\r\nContent-Length: %zu\r\n%s\r\n",
+                     enc, body_len, vary_ae ? "" : "Vary: Accept-Encoding\r\n");
+    if (w < 0 || (size_t)w >= cap - n)
+        return 0;
+    return n + w;
+}
+
+static const char *const cache_enc_names[CACHE_ENCS] = {
+    [CACHE_ENC_GZIP] = "gzip",
+    [CACHE_ENC_BR] = "br",
+};
+
+static size_t cache_compress_gzip(const char *in, size_t len, char **out, int level) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return 0;
+
+    size_t cap = deflateBound(&zs, len);
+    *out = lb_alloc(cap);
+    size_t n = 0;
+    if (*out) {
+        zs.next_in = (Bytef *)in;
+        zs.avail_in = len;
+        zs.next_out = (Bytef *)*out;
+        zs.avail_out = cap;
+        if (deflate(&zs, Z_FINISH) == Z_STREAM_END)
+            n = zs.total_out;
+    }
+    deflateEnd(&zs);
+    return n;
+}
+
+static size_t cache_compress_br(const char *in, size_t len, char **out, int quality) {
+    size_t n = BrotliEncoderMaxCompressedSize(len);
+    *out = n ? lb_alloc(n) : NULL;
+    if (!*out)
+        return 0;
+    if (!BrotliEncoderCompress(quality, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, len,
+                               (const uint8_t *)in, &n, (uint8_t *)*out))
+        return 0;
+    return n;
+}
+
+/* Stores one variant and publishes it; the first to get there wins */
+static int cache_variant_add(cache_t *cache, cache_entry_t *e, int enc, int level) {
+    const char *body = e->data.ptr + e->hdr_len;
+    size_t body_len = e->data.len - e->hdr_len;
+    char *zbody = NULL;
+    size_t zlen = enc == CACHE_ENC_GZIP ? cache_compress_gzip(body, body_len, &zbody, level)
+                                        : cache_compress_br(body, body_len, &zbody, level);
+
+    /* Not worth a copy if it does not shrink */
+    if (!zlen || zlen >= body_len) {
+        lb_free(zbody);
+        return zlen ? 0 : -1;
     }
 
-    atomic_fetch_add(&cache->stats.misses, 1);
-    pthread_spin_unlock(&cache->hash.locks[idx]);
+    char hdrs[8192];
+    size_t hlen = cache_variant_headers(e, cache_enc_names[enc], zlen, hdrs, sizeof(hdrs));
+    cache_variant_t *v = hlen ? lb_calloc(1, sizeof(*v)) : NULL;
+    if (v)
+        v->data.ptr = cache_alloc_bytes(cache, e->key_hash, hlen + zlen, &v->slab, &v->slab_off);
+    if (!v || !v->data.ptr) {
+        lb_free(v);
+        lb_free(zbody);
+        return -1;
+    }
+    memcpy(v->data.ptr, hdrs, hlen);
+    memcpy(v->data.ptr + hlen, zbody, zlen);
+    v->data.len = v->data.alloc = hlen + zlen;
+    lb_free(zbody);
+
+    cache_variant_t *expected = NULL;
+    if (!atomic_compare_exchange_strong_explicit(&e->variants[enc], &expected, v,
+                                                 memory_order_release, memory_order_relaxed)) {
+        if (v->slab)
+            cache_slab_free(v->slab, v->slab_off, v->data.alloc);
+        else
+            lb_free(v->data.ptr);
+        lb_free(v);
+        return 0;
+    }
+
+    /* Charged to the entry, and to its queue if it is already in one */
+    cache_shard_t *sh = cache_shard(cache, e->key_hash);
+    pthread_spin_lock(&sh->lock);
+    if (e->queue != CACHE_Q_NONE) {
+        cache_queue_of(sh, e)->bytes += v->data.len;
+        atomic_fetch_add_explicit(&cache->current_size, v->data.len, memory_order_relaxed);
+    }
+    e->size += v->data.len;
+    pthread_spin_unlock(&sh->lock);
+
+    atomic_fetch_add_explicit(&cache->stats.compressed, 1, memory_order_relaxed);
+    return 0;
+}
+
+int cache_entry_precompress(cache_t *cache, cache_entry_t *entry, int gzip_level, int br_quality) {
+    if (!(entry->flags & CACHE_F_NEGOTIATED))
+        return 0;
+
+    int ret = 0;
+    if (!atomic_load_explicit(&entry->variants[CACHE_ENC_BR], memory_order_acquire))
+        ret |= cache_variant_add(cache, entry, CACHE_ENC_BR, br_quality);
+    if (!atomic_load_explicit(&entry->variants[CACHE_ENC_GZIP], memory_order_acquire))
+        ret |= cache_variant_add(cache, entry, CACHE_ENC_GZIP, gzip_level);
+    return ret;
+}
+
+/* q=0 (and 0.0...) refuses a coding; anything else takes it */
+static bool cache_ae_refused(const char *p, const char *end) {
+    while (p < end && *p != ',') {
+        if (*p == ';') {
+            p++;
+            while (p < end && (*p == ' ' || *p == '\t'))
+                p++;
+            if (end - p >= 2 && (p[0] == 'q' || p[0] == 'Q') && p[1] == '=') {
+                p += 2;
+                if (p < end && *p == '0') {
+                    p++;
+                    if (p < end && *p == '.')
+                        p++;
+                    while (p < end && *p == '0')
+                        p++;
+                    return p == end || *p == ',' || *p == ' ' || *p == ';';
+                }
+                return false;
+            }
+            continue;
+        }
+        p++;
+    }
+    return false;
+}
+
+const cache_variant_t* cache_pick_variant(cache_entry_t *entry, const struct http_msg *msg,
+                                          const struct buffer *buf) {
+    if (!(entry->flags & CACHE_F_NEGOTIATED) || !msg)
+        return NULL;
+
+    const http_hdr_t *hdr = http_msg_find(msg, buf, "accept-encoding");
+    if (!hdr)
+        return NULL;
+
+    const char *p = http_slice_ptr(buf, hdr->v);
+    const char *end = p + hdr->v.len;
+    bool ok[CACHE_ENCS] = { false };
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+            p++;
+        const char *tok = p;
+        while (p < end && *p != ',' && *p != ';' && *p != ' ' && *p != '\t')
+            p++;
+        size_t len = p - tok;
+        bool refused = cache_ae_refused(p, end);
+        while (p < end && *p != ',')
+            p++;
+        if (refused)
+            continue;
+
+        if ((len == 2 && strncasecmp(tok, "br", 2) == 0))
+            ok[CACHE_ENC_BR] = true;
+        else if ((len == 4 && strncasecmp(tok, "gzip", 4) == 0) ||
+                 (len == 6 && strncasecmp(tok, "x-gzip", 6) == 0))
+            ok[CACHE_ENC_GZIP] = true;
+        else if (len == 1 && *tok == '*')
+            ok[CACHE_ENC_BR] = ok[CACHE_ENC_GZIP] = true;
+    }
+
+    /* Smallest first */
+    static const int pref[] = { CACHE_ENC_BR, CACHE_ENC_GZIP };
+    for (size_t i = 0; i < sizeof(pref) / sizeof(pref[0]); i++) {
+        const cache_variant_t *v;
+        if (ok[pref[i]] && (v = atomic_load_explicit(&entry->variants[pref[i]], memory_order_acquire)))
+            return v;
+    }
     return NULL;
 }
 
-// ok 
+static void *cache_compressor_main(void *arg) {
+    cache_t *cache = arg;
 
-int cache_insert(cache_t *cache, const char *key, cache_entry_t *entry) {
+    pthread_mutex_lock(&cache->comp.lock);
+    while (!cache->comp.stop) {
+        cache_entry_t *e = cache->comp.head;
+        if (!e) {
+            pthread_cond_wait(&cache->comp.cond, &cache->comp.lock);
+            continue;
+        }
+        cache->comp.head = e->comp_next;
+        if (!cache->comp.head)
+            cache->comp.tail = NULL;
+        pthread_mutex_unlock(&cache->comp.lock);
+
+        /* Evicted while it waited: nobody will ask for it */
+        cache_shard_t *sh = cache_shard(cache, e->key_hash);
+        pthread_spin_lock(&sh->lock);
+        bool live = e->queue != CACHE_Q_NONE;
+        pthread_spin_unlock(&sh->lock);
+        if (live)
+            cache_entry_precompress(cache, e, CACHE_COMP_BG_GZIP, CACHE_COMP_BG_BR);
+        cache_entry_put(e);
+
+        pthread_mutex_lock(&cache->comp.lock);
+    }
+    pthread_mutex_unlock(&cache->comp.lock);
+    return NULL;
+}
+
+int cache_compressor_start(cache_t *cache) {
+    if (cache->comp.running) return 0;
+
+    cache->comp.stop = false;
+    if (pthread_create(&cache->comp.thread, NULL, cache_compressor_main, cache) != 0)
+        return -1;
+    cache->comp.running = true;
+    return 0;
+}
+
+void cache_compressor_stop(cache_t *cache) {
+    if (!cache->comp.running) return;
+
+    pthread_mutex_lock(&cache->comp.lock);
+    cache->comp.stop = true;
+    pthread_cond_signal(&cache->comp.cond);
+    pthread_mutex_unlock(&cache->comp.lock);
+    pthread_join(cache->comp.thread, NULL);
+    cache->comp.running = false;
+
+    while (cache->comp.head) {
+        cache_entry_t *e = cache->comp.head;
+        cache->comp.head = e->comp_next;
+        cache_entry_put(e);
+    }
+    cache->comp.tail = NULL;
+}
+
+bool cache_compressor_queue(cache_t *cache, cache_entry_t *e) {
+    pthread_mutex_lock(&cache->comp.lock);
+    bool queued = cache->comp.running && !cache->comp.stop;
+    if (queued) {
+        e->comp_next = NULL;
+        if (cache->comp.tail)
+            cache->comp.tail->comp_next = cache_entry_get(e);
+        else
+            cache->comp.head = cache_entry_get(e);
+        cache->comp.tail = e;
+        pthread_cond_signal(&cache->comp.cond);
+    }
+    pthread_mutex_unlock(&cache->comp.lock);
+    return queued;
+}
+
+static ssize_t cache_bytes_send(cache_slab_t *slab, uint64_t slab_off, const char *ptr,
+                                size_t len, int fd, size_t *off) {
+    size_t left = len - *off;
+    ssize_t n;
+
+    if (!left) return 0;
+    if (slab) {
+        off_t pos = slab_off + *off;
+        n = sendfile(fd, slab->fd, &pos, left);
+    } else {
+        n = send(fd, ptr + *off, left, MSG_NOSIGNAL);
+    }
+    if (n > 0)
+        *off += n;
+    return n;
+}
+
+ssize_t cache_entry_send(cache_entry_t *entry, int fd, size_t *off) {
+    return cache_bytes_send(entry->slab, entry->slab_off, entry->data.ptr, entry->data.len, fd, off);
+}
+
+int cache_send_hit(struct stream *s, int fd) {
+    cache_entry_t *entry = s->cache_hit;
+    const cache_variant_t *v = s->cache_variant;
+    size_t len = v ? v->data.len : entry->data.len;
+
+    while (s->cache_sent < len) {
+        ssize_t n = v ? cache_bytes_send(v->slab, v->slab_off, v->data.ptr, v->data.len, fd, &s->cache_sent)
+                      : cache_entry_send(entry, fd, &s->cache_sent);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        if (n <= 0) {
+            cache_release_hit(s);
+            return -1;
+        }
+    }
+
+    cache_release_hit(s);
+    return 1;
+}
+
+void cache_release_hit(struct stream *s) {
+    if (!s->cache_hit) return;
+    cache_entry_put(s->cache_hit);
+    s->cache_hit = NULL;
+    s->cache_variant = NULL;
+    s->cache_sent = 0;
+}
+
+int cache_insert_key(cache_t *cache, const cache_key_t *key, cache_entry_t *entry) {
     /* Check size limits */
     if (entry->size > cache->max_object_size) {
         log_debug("Object too large for cache: %u > %u", entry->size, cache->max_object_size);
         return -1;
     }
 
-    /* Evict entries if cache is full */
-    while (cache->current_size + entry->size > cache->max_size) {
-        cache_evict_lru(cache);
-    }
-
-    uint32_t hash = cache_hash_key(key);
-    uint32_t idx = hash & cache->hash.mask;
+    uint32_t hash = cache_key_hash32(key);
+    cache_shard_t *sh = cache_shard(cache, hash);
+    if (entry->size > sh->max_bytes)
+        return -1;
 
-    entry->key = strdup(key);
+    /* The only copy of the key text, kept to verify hash matches */
+    entry->key = lb_alloc(key->len + 1);
+    if (!entry->key)
+        return -1;
+    char *t = entry->key;
+    for (uint32_t i = 0; i < key->nparts; i++) {
+        if (i)
+            *t++ = ' ';
+        memcpy(t, key->part[i].ptr, key->part[i].len);
+        t += key->part[i].len;
+    }
+    *t = '\0';
     entry->key_hash = hash;
-    entry->created = time(NULL);
-    entry->last_access = entry->created;
+    entry->key_h[0] = key->hash[0];
+    entry->key_h[1] = key->hash[1];
+    entry->key_len = key->len;
+    entry->created = lb_now_sec();
 
     /* Set expiration based on Cache-Control headers */
     if (entry->flags & CACHE_F_MAX_AGE) {
@@ -171,113 +904,281 @@ int cache_insert(cache_t *cache, const char *key, cache_entry_t *entry) {
     } else {
         entry->expires = entry->created + cache->max_age;
     }
+    /* How long it may still be served while a refresh runs */
+    if (entry->flags & CACHE_F_MUST_REVALIDATE)
+        entry->stale_until = entry->expires;
+    else
+        entry->stale_until = entry->expires +
+            ((entry->flags & CACHE_F_SWR) ? entry->swr : cache->stale_while_revalidate);
+
+    atomic_init(&entry->freq, 0);
+
+    pthread_spin_lock(&sh->lock);
+
+    /* A newer copy replaces the old one: the same variant, or any if the
+     * Vary itself changed */
+    cache_entry_t *_Atomic *bucket = &sh->table[hash & sh->mask];
+    for (cache_entry_t *old = atomic_load_explicit(bucket, memory_order_relaxed); old;
+         old = atomic_load_explicit(&old->hash_next, memory_order_relaxed)) {
+        if (cache_key_match(old, key) &&
+            (old->vary_hash == entry->vary_hash ||
+             !old->vary != !entry->vary || (old->vary && strcmp(old->vary, entry->vary) != 0))) {
+            cache_unlink(cache, sh, old);
+            lb_rcu_retire(old, cache_entry_free);
+            break;
+        }
+    }
 
-    pthread_rwlock_init(&entry->lock, NULL);
+    /* Evict entries if the shard is full */
+    while ((sh->small.bytes + sh->main.bytes + entry->size > sh->max_bytes ||
+            sh->small.count + sh->main.count >= sh->max_entries) &&
+           (sh->small.tail || sh->main.tail))
+        cache_evict(cache, sh);
+
+    /* Seen recently enough to be in the ghost table: straight to main */
+    uint32_t *ghost = cache_ghost_slot(sh, hash);
+    if (*ghost == (hash | 1)) {
+        *ghost = 0;
+        entry->queue = CACHE_Q_MAIN;
+        fifo_push(&sh->main, entry);
+        atomic_fetch_add_explicit(&cache->stats.ghost_hits, 1, memory_order_relaxed);
+    } else {
+        entry->queue = CACHE_Q_SMALL;
+        fifo_push(&sh->small, entry);
+    }
 
-    /* Insert into hash table */
-    pthread_spin_lock(&cache->hash.locks[idx]);
-    entry->hash_next = cache->hash.table[idx];
-    cache->hash.table[idx] = entry;
-    pthread_spin_unlock(&cache->hash.locks[idx]);
+    /* Published last: a reader that finds it sees it complete */
+    atomic_store_explicit(&entry->hash_next, atomic_load_explicit(bucket, memory_order_relaxed),
+                          memory_order_relaxed);
+    atomic_store_explicit(bucket, entry, memory_order_release);
 
-    /* Add to LRU list head (most recently used) */
-    pthread_spin_lock(&cache->lru.lock);
-    entry->lru_next = cache->lru.head;
-    entry->lru_prev = NULL;
-    if (cache->lru.head) {
-        cache->lru.head->lru_prev = entry;
-    }
-    cache->lru.head = entry;
-    if (!cache->lru.tail) {
-        cache->lru.tail = entry;
-    }
-    pthread_spin_unlock(&cache->lru.lock);
+    atomic_fetch_add_explicit(&cache->current_size, entry->size, memory_order_relaxed);
+    atomic_fetch_add_explicit(&cache->entry_count, 1, memory_order_relaxed);
+    pthread_spin_unlock(&sh->lock);
 
-    /* Update stats */
-    cache->current_size += entry->size;
-    cache->entry_count++;
     atomic_fetch_add(&cache->stats.inserts, 1);
     atomic_fetch_add(&cache->stats.bytes_in, entry->size);
 
     log_debug("Cached object: key=%s, size=%u, expires=%ld",
-              key, entry->size, entry->expires);
+              entry->key, entry->size, entry->expires);
 
     return 0;
 }
 
-void cache_update_lru(cache_t *cache, cache_entry_t *entry) {
-    pthread_spin_lock(&cache->lru.lock);
+int cache_insert(cache_t *cache, const char *key, cache_entry_t *entry) {
+    cache_key_t k;
+    cache_key_str(&k, key);
+    return cache_insert_key(cache, &k, entry);
+}
+
+/* Every variant goes */
+void cache_delete(cache_t *cache, const char *key) {
+    cache_key_t k;
+    cache_key_str(&k, key);
+    uint32_t hash = cache_key_hash32(&k);
+    cache_shard_t *sh = cache_shard(cache, hash);
+
+    pthread_spin_lock(&sh->lock);
+    cache_entry_t *e = atomic_load_explicit(&sh->table[hash & sh->mask], memory_order_relaxed);
+    while (e) {
+        cache_entry_t *next = atomic_load_explicit(&e->hash_next, memory_order_relaxed);
+        if (cache_key_match(e, &k)) {
+            cache_unlink(cache, sh, e);
+            lb_rcu_retire(e, cache_entry_free);
+        }
+        e = next;
+    }
+    pthread_spin_unlock(&sh->lock);
+}
+
+void cache_purge(cache_t *cache) {
+    for (uint32_t i = 0; i < CACHE_SHARDS; i++) {
+        cache_shard_t *sh = &cache->shards[i];
 
-    /* Move entry to head of LRU list (most recently used) */
-    if (entry != cache->lru.head) {
-        /* Remove from current position */
-        if (entry->lru_prev) {
-            entry->lru_prev->lru_next = entry->lru_next;
+        pthread_spin_lock(&sh->lock);
+        while (sh->small.tail || sh->main.tail) {
+            cache_entry_t *e = sh->small.tail ? sh->small.tail : sh->main.tail;
+            cache_unlink(cache, sh, e);
+            lb_rcu_retire(e, cache_entry_free);
         }
-        if (entry->lru_next) {
-            entry->lru_next->lru_prev = entry->lru_prev;
-        } else {
-            /* Entry was tail */
-            cache->lru.tail = entry->lru_prev;
+        pthread_spin_unlock(&sh->lock);
+    }
+}
+
+/* No readers may remain; entries go as soon as no hit is being sent */
+static void cache_shard_free(cache_shard_t *sh) {
+    cache_fifo_t *queues[2] = { &sh->small, &sh->main };
+    for (int q = 0; q < 2; q++) {
+        cache_entry_t *e = queues[q]->head;
+        while (e) {
+            cache_entry_t *next = e->q_next;
+            cache_entry_free(e);
+            e = next;
         }
+    }
 
-        /* Insert at head */
-        entry->lru_prev = NULL;
-        entry->lru_next = cache->lru.head;
-        cache->lru.head->lru_prev = entry;
-        cache->lru.head = entry;
+    while (sh->pending) {
+        cache_pending_t *p = sh->pending;
+        sh->pending = p->next;
+        lb_free(p);
     }
 
-    pthread_spin_unlock(&cache->lru.lock);
+    free(sh->table);
+    free(sh->ghost);
+    pthread_spin_destroy(&sh->lock);
 }
 
-void cache_evict_lru(cache_t *cache) {
-    pthread_spin_lock(&cache->lru.lock);
+void cache_destroy(cache_t *cache) {
+    if (!cache) return;
 
-    cache_entry_t *victim = cache->lru.tail;
-    if (!victim) {
-        pthread_spin_unlock(&cache->lru.lock);
-        return;
+    cache_compressor_stop(cache);
+    pthread_rwlock_wrlock(&caches_lock);
+    for (cache_t **p = &caches; *p; p = &(*p)->next) {
+        if (*p == cache) {
+            *p = cache->next;
+            break;
+        }
     }
+    pthread_rwlock_unlock(&caches_lock);
 
-    /* Remove from LRU list */
-    cache->lru.tail = victim->lru_prev;
-    if (cache->lru.tail) {
-        cache->lru.tail->lru_next = NULL;
-    } else {
-        cache->lru.head = NULL;
+    for (uint32_t i = 0; i < CACHE_SHARDS; i++)
+        cache_shard_free(&cache->shards[i]);
+    free(cache->shards);
+    pthread_mutex_destroy(&cache->comp.lock);
+    pthread_cond_destroy(&cache->comp.cond);
+    pthread_rwlock_destroy(&cache->lock);
+    free(cache->name);
+    free(cache);
+}
+
+void cache_set_waker(cache_t *cache, void (*wake)(struct stream *s)) {
+    cache->wake = wake;
+}
+
+/* Fetches are told apart by the 128-bit key hash alone */
+static cache_pending_t** cache_pending_find(cache_shard_t *sh, const cache_key_t *key) {
+    cache_pending_t **pp = &sh->pending;
+    while (*pp && ((*pp)->key_h[0] != key->hash[0] || (*pp)->key_h[1] != key->hash[1]))
+        pp = &(*pp)->next;
+    return pp;
+}
+
+/* Makes s the stream fetching key; the shard is locked */
+static int cache_pending_start(cache_shard_t *sh, cache_pending_t **pp, struct stream *s,
+                               const cache_key_t *key) {
+    cache_pending_t *p = lb_calloc(1, sizeof(*p));
+    if (!p) return -1;
+    p->key_h[0] = key->hash[0];
+    p->key_h[1] = key->hash[1];
+    p->shard = sh;
+    p->owner = s;
+    p->started = lb_now_sec();
+    p->next = *pp;
+    *pp = p;
+    s->cache_fill = p;
+    return 0;
+}
+
+int cache_serve(cache_t *cache, struct stream *s, const cache_key_t *key) {
+    bool stale;
+    cache_entry_t *entry = cache_find(cache, key, true, &stale);
+
+    cache_release_hit(s);
+    if (entry) {
+        s->cache_variant = key->buf ? cache_pick_variant(entry, key->msg, key->buf) : NULL;
+        if (s->cache_variant)
+            atomic_fetch_add_explicit(&cache->stats.comp_hits, 1, memory_order_relaxed);
+    }
+    if (entry && !stale) {
+        s->cache_hit = entry;
+        return CACHE_HIT;
     }
 
-    pthread_spin_unlock(&cache->lru.lock);
+    cache_shard_t *sh = cache_shard(cache, cache_key_hash32(key));
+    int ret = CACHE_MISS;
+
+    pthread_spin_lock(&sh->lock);
+    cache_pending_t **pp = cache_pending_find(sh, key);
+    cache_pending_t *p = *pp;
+    if (entry) {
+        /* Stale: served as is, and the first to see it refreshes it */
+        s->cache_hit = entry;
+        ret = CACHE_HIT;
+        if (!p && cache_pending_start(sh, pp, s, key) == 0)
+            ret = CACHE_HIT_REFRESH;
+    } else if (!p) {
+        if (cache_pending_start(sh, pp, s, key) == 0)
+            ret = CACHE_FILL;
+    } else if (cache->wake && p->started + cache->fill_timeout > lb_now_sec()) {
+        /* A fetch is under way: wait for it rather than add to the herd */
+        s->cache_parked = p;
+        s->cache_parked_shard = sh;
+        s->cache_wait_next = p->waiters;
+        p->waiters = s;
+        atomic_fetch_add_explicit(&cache->stats.collapsed, 1, memory_order_relaxed);
+        ret = CACHE_PARKED;
+    }
+    pthread_spin_unlock(&sh->lock);
 
-    /* Remove from hash table */
-    uint32_t idx = victim->key_hash & cache->hash.mask;
+    return ret;
+}
 
-    pthread_spin_lock(&cache->hash.locks[idx]);
-    cache_entry_t **p = &cache->hash.table[idx];
-    while (*p) {
-        if (*p == victim) {
-            *p = victim->hash_next;
-            break;
+void cache_fill_finish(cache_t *cache, struct stream *s, cache_entry_t *entry) {
+    cache_pending_t *p = s->cache_fill;
+    if (!p) return;
+
+    cache_shard_t *sh = p->shard;
+    pthread_spin_lock(&sh->lock);
+    cache_pending_t **pp = &sh->pending;
+    while (*pp != p)
+        pp = &(*pp)->next;
+    *pp = p->next;
+
+    /* Woken under the lock so that no waiter can finish and go away in
+     * between; without an entry, or if they want another variant, they
+     * go to the backend themselves */
+    for (struct stream *w = p->waiters; w; ) {
+        struct stream *next = w->cache_wait_next;
+        w->cache_parked = NULL;
+        w->cache_wait_next = NULL;
+        if (entry && (!entry->vary || !w->txn || !w->req ||
+                      cache_entry_vary_hash(entry, &w->txn->req, &w->req->buf) == entry->vary_hash)) {
+            w->cache_hit = cache_entry_get(entry);
+            w->cache_variant = (w->txn && w->req) ?
+                cache_pick_variant(entry, &w->txn->req, &w->req->buf) : NULL;
+            w->cache_sent = 0;
         }
-        p = &(*p)->hash_next;
+        cache->wake(w);
+        w = next;
     }
-    pthread_spin_unlock(&cache->hash.locks[idx]);
-
-    /* Update stats */
-    cache->current_size -= victim->size;
-    cache->entry_count--;
-    atomic_fetch_add(&cache->stats.evictions, 1);
+    pthread_spin_unlock(&sh->lock);
 
-    log_debug("Evicted cache entry: key=%s, size=%u", victim->key, victim->size);
+    s->cache_fill = NULL;
+    lb_free(p);
+}
 
-    /* Free entry */
-    free(victim->key);
-    free(victim->data.ptr);
-    free(victim->etag);
-    free(victim->vary);
-    pthread_rwlock_destroy(&victim->lock);
-    free(victim);
+void cache_stream_done(cache_t *cache, struct stream *s) {
+    cache_release_hit(s);
+    if (s->cache_fill)
+        cache_fill_finish(cache, s, NULL);
+
+    /* The fetch is only looked at under its shard's lock: a fill finishing
+     * on another thread unlinks us and frees it under that lock */
+    cache_shard_t *sh = s->cache_parked_shard;
+    if (sh) {
+        pthread_spin_lock(&sh->lock);
+        cache_pending_t *p = s->cache_parked;
+        if (p) {
+            struct stream **wp = &p->waiters;
+            while (*wp != s)
+                wp = &(*wp)->cache_wait_next;
+            *wp = s->cache_wait_next;
+            s->cache_parked = NULL;
+            s->cache_wait_next = NULL;
+        }
+        pthread_spin_unlock(&sh->lock);
+        s->cache_parked_shard = NULL;
+    }
 }
 
 /* Check if request can be served from cache */
@@ -298,58 +1199,44 @@ int cache_check_request(struct stream *s, struct channel *req, struct channel *r
         }
     }
 
-    /* Build cache key and lookup */
-    char *key = cache_build_key(txn);
-    if (!key) return 0;
-
     cache_t *cache = px->cache;
-    if (!cache) {
-        free(key);
-        return 0;
-    }
-
-    cache_entry_t *entry = cache_lookup(cache, key);
-    free(key);
-
-    if (!entry) {
-        return 0;  /* Cache miss - proceed to backend */
-    }
-
-    /* Check if entry needs revalidation */
-    if (entry->etag || entry->last_modified) {
-        /* Add conditional headers for revalidation */
-        if (entry->etag) {
-            http_header_add(&txn->req, "If-None-Match", entry->etag);
-        }
-        if (entry->last_modified) {
-            char date[64];
-            strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT",
-                    gmtime(&entry->last_modified));
-            http_header_add(&txn->req, "If-Modified-Since", date);
-        }
-    }
+    if (!cache) return 0;
 
-    /* Serve from cache */
-    pthread_rwlock_rdlock(&entry->lock);
+    /* Hash the key where it lies in the request */
+    cache_key_t key;
+    if (cache_key_build(&key, txn, &req->buf) < 0) return 0;
 
-    /* Copy cached response to channel buffer */
-    buffer_put(&res->buf, entry->data.ptr, entry->data.len);
+    /* Hits are sent straight from the stored copy with cache_send_hit(),
+     * holding a reference until done. A miss that finds the key already
+     * being fetched parks until cache_store_response() has it. */
+    int ret = cache_serve(cache, s, &key);
 
     /* Update stats */
-    atomic_fetch_add(&cache->stats.bytes_out, entry->data.len);
+    if (s->cache_hit)
+        atomic_fetch_add(&cache->stats.bytes_out, s->cache_variant ? s->cache_variant->data.len
+                                                                   : s->cache_hit->data.len);
 
-    pthread_rwlock_unlock(&entry->lock);
+    return ret;
+}
 
-    return 1;  /* Request served from cache */
+/* Whether the cache may serve its own encodings of this response */
+static bool cache_negotiable(struct http_txn *txn, const cache_entry_t *entry, const char *cache_control) {
+    if (txn->status != 200 || !entry->hdr_len || (txn->rsp.flags & HTTP_MSGF_TE_CHNK))
+        return false;
+    if (entry->data.len - entry->hdr_len < CACHE_COMP_MIN)
+        return false;
+    if (cache_control && strstr(cache_control, "no-transform"))
+        return false;
+    if (http_header_get(&txn->rsp, "Content-Encoding"))
+        return false;
+
+    const char *type = http_header_get(&txn->rsp, "Content-Type");
+    return type && (strncasecmp(type, "text/", 5) == 0 || strstr(type, "json") ||
+                    strstr(type, "javascript") || strstr(type, "xml") || strstr(type, "wasm"));
 }
 
-/* Store response in cache if cacheable */
-int cache_store_response(struct stream *s, struct channel *res) {
+static int cache_store(cache_t *cache, struct stream *s, struct channel *res) {
     struct http_txn *txn = s->txn;
-    struct proxy *px = s->be ? s->be : s->fe;
-    cache_t *cache = px->cache;
-
-    if (!cache) return 0;
 
     /* Check if response is cacheable */
     if (txn->status < 200 || txn->status >= 300) {
@@ -366,37 +1253,42 @@ int cache_store_response(struct stream *s, struct channel *res) {
         }
     }
 
-    /* Build cache key */
-    char *key = cache_build_key(txn);
-    if (!key) return 0;
+    /* Vary: * means no two requests share it */
+    char *vary = http_header_get(&txn->rsp, "Vary");
+    if (vary && strchr(vary, '*')) {
+        return 0;
+    }
+
+    /* Build cache key; the request's headers are still in its buffer */
+    cache_key_t key;
+    if (!s->req || cache_key_build(&key, txn, &s->req->buf) < 0) return 0;
 
     /* Create cache entry */
-    cache_entry_t *entry = calloc(1, sizeof(*entry));
+    cache_entry_t *entry = cache_entry_new();
     if (!entry) {
-        free(key);
         return 0;
     }
 
     /* Copy response data */
-    entry->data.len = res->buf.data;
-    entry->data.alloc = entry->data.len;
-    entry->data.ptr = malloc(entry->data.len);
-    if (!entry->data.ptr) {
-        free(entry);
-        free(key);
+    if (cache_entry_set_data(cache, entry, &key, res->buf.area + res->buf.head, res->buf.data) < 0) {
+        cache_entry_put(entry);
         return 0;
     }
 
-    memcpy(entry->data.ptr, res->buf.area + res->buf.head, entry->data.len);
-    entry->size = entry->data.len;
-
     /* Store response metadata */
     entry->response.status = txn->status;
 
+    /* Where the body starts, for compressing it */
+    int64_t hdr_len = txn->rsp.sov - (int64_t)res->buf.head;
+    if (hdr_len > 0 && (uint64_t)hdr_len <= entry->data.len)
+        entry->hdr_len = hdr_len;
+    if (cache_negotiable(txn, entry, cache_control))
+        entry->flags |= CACHE_F_NEGOTIATED;
+
     /* Parse cache-related headers */
     char *etag = http_header_get(&txn->rsp, "ETag");
     if (etag) {
-        entry->etag = strdup(etag);
+        entry->etag = lb_strdup(etag);
     }
 
     char *last_modified = http_header_get(&txn->rsp, "Last-Modified");
@@ -407,9 +1299,9 @@ int cache_store_response(struct stream *s, struct channel *res) {
         }
     }
 
-    char *vary = http_header_get(&txn->rsp, "Vary");
     if (vary) {
-        entry->vary = strdup(vary);
+        entry->vary = lb_strdup(vary);
+        entry->vary_hash = cache_entry_vary_hash(entry, &txn->req, &s->req->buf);
     }
 
     /* Set cache flags based on headers */
@@ -422,87 +1314,319 @@ int cache_store_response(struct stream *s, struct channel *res) {
         if (max_age) {
             entry->flags |= CACHE_F_MAX_AGE;
             int age = atoi(max_age + 8);
-            entry->expires = time(NULL) + age;
+            entry->expires = lb_now_sec() + age;
+        }
+
+        char *swr = strstr(cache_control, "stale-while-revalidate=");
+        if (swr) {
+            entry->flags |= CACHE_F_SWR;
+            entry->swr = atoi(swr + 23);
         }
     }
 
-    /* Insert into cache */
-    int ret = cache_insert(cache, key, entry);
-    free(key);
+    /* Insert into cache, keeping a reference for the parked requests */
+    cache_entry_get(entry);
+    int ret = cache_insert_key(cache, &key, entry);
 
     if (ret < 0) {
         /* Failed to cache - cleanup */
-        free(entry->data.ptr);
-        free(entry->etag);
-        free(entry->vary);
-        free(entry);
+        cache_entry_put(entry);
+        cache_entry_put(entry);
         return 0;
     }
 
+    /* Encoded once, here or by the compressor thread, and then only served */
+    if ((entry->flags & CACHE_F_NEGOTIATED) && !cache_compressor_queue(cache, entry))
+        cache_entry_precompress(cache, entry, CACHE_COMP_GZIP_LEVEL, CACHE_COMP_BR_QUALITY);
+
+    cache_fill_finish(cache, s, entry);
+    cache_entry_put(entry);
     return 1;
 }
 
-/* Initialize compression context */
-int compression_init(compression_ctx_t *ctx, int type, int level) {
-    ctx->type = type;
-    ctx->level = level;
+/* Store response in cache if cacheable; requests parked on this one are
+ * answered from it, or sent to the backend if it was not stored */
+int cache_store_response(struct stream *s, struct channel *res) {
+    struct proxy *px = s->be ? s->be : s->fe;
+    cache_t *cache = px->cache;
 
-    switch (type) {
+    if (!cache) return 0;
+
+    int ret = cache_store(cache, s, res);
+    cache_fill_finish(cache, s, NULL);
+    return ret;
+}
+
+bool compression_adaptive = true;
+
+struct comp_engine {
+    int type;
+    int level;
+    union {
+        z_stream z;
+        BrotliEncoderState *br;
+#ifdef USE_ZSTD
+        ZSTD_CCtx *zstd;
+#endif
+    };
+    struct comp_engine *next;
+};
+
+/* Idle encoders, and blocks freed by brotli encoders, of this thread */
+static __thread struct {
+    comp_engine_t *idle[COMP_TYPES];
+    uint32_t count[COMP_TYPES];
+} comp_pool;
+
+typedef struct comp_block {
+    size_t size;
+    struct comp_block *next;
+} __attribute__((aligned(16))) comp_block_t;
+
+static __thread struct {
+    comp_block_t *free;
+    size_t bytes;
+} comp_blocks;
+
+static void *comp_block_alloc(void *opaque, size_t size) {
+    (void)opaque;
+    for (comp_block_t **bp = &comp_blocks.free; *bp; bp = &(*bp)->next) {
+        if ((*bp)->size == size) {
+            comp_block_t *b = *bp;
+            *bp = b->next;
+            comp_blocks.bytes -= size;
+            return b + 1;
+        }
+    }
+
+    comp_block_t *b = malloc(sizeof(*b) + size);
+    if (!b) return NULL;
+    b->size = size;
+    return b + 1;
+}
+
+static void comp_block_free(void *opaque, void *ptr) {
+    (void)opaque;
+    if (!ptr) return;
+
+    comp_block_t *b = (comp_block_t *)ptr - 1;
+    if (comp_blocks.bytes + b->size > COMP_BLOCKS_MAX_BYTES) {
+        free(b);
+        return;
+    }
+    b->next = comp_blocks.free;
+    comp_blocks.free = b;
+    comp_blocks.bytes += b->size;
+}
+
+static void comp_engine_free(comp_engine_t *eng) {
+    switch (eng->type) {
         case COMP_TYPE_GZIP:
         case COMP_TYPE_DEFLATE:
-            memset(&ctx->zstrm, 0, sizeof(ctx->zstrm));
+            deflateEnd(&eng->z);
+            break;
+        case COMP_TYPE_BROTLI:
+            if (eng->br)
+                BrotliEncoderDestroyInstance(eng->br);
+            break;
+#ifdef USE_ZSTD
+        case COMP_TYPE_ZSTD:
+            ZSTD_freeCCtx(eng->zstd);
+            break;
+#endif
+    }
+    free(eng);
+}
 
-            int wbits = (type == COMP_TYPE_GZIP) ? 15 + 16 : 15;
+/* A pooled encoder reset for a new stream, or a fresh one */
+static comp_engine_t *comp_engine_get(int type, int level) {
+    comp_engine_t *eng = comp_pool.idle[type];
+    if (eng) {
+        comp_pool.idle[type] = eng->next;
+        comp_pool.count[type]--;
+
+        switch (type) {
+            case COMP_TYPE_GZIP:
+            case COMP_TYPE_DEFLATE:
+                if (deflateReset(&eng->z) != Z_OK ||
+                    (eng->level != level && deflateParams(&eng->z, level, Z_DEFAULT_STRATEGY) != Z_OK)) {
+                    comp_engine_free(eng);
+                    return comp_engine_get(type, level);
+                }
+                break;
+            case COMP_TYPE_BROTLI:
+                /* No reset in the API; the blocks are what gets reused */
+                eng->br = BrotliEncoderCreateInstance(comp_block_alloc, comp_block_free, NULL);
+                if (!eng->br) {
+                    free(eng);
+                    return NULL;
+                }
+                BrotliEncoderSetParameter(eng->br, BROTLI_PARAM_QUALITY, level);
+                break;
+#ifdef USE_ZSTD
+            case COMP_TYPE_ZSTD:
+                ZSTD_CCtx_reset(eng->zstd, ZSTD_reset_session_only);
+                ZSTD_CCtx_setParameter(eng->zstd, ZSTD_c_compressionLevel, level);
+                break;
+#endif
+        }
+        eng->level = level;
+        return eng;
+    }
 
-            if (deflateInit2(&ctx->zstrm, level, Z_DEFLATED, wbits,
-                            8, Z_DEFAULT_STRATEGY) != Z_OK) {
-                return -1;
+    eng = calloc(1, sizeof(*eng));
+    if (!eng) return NULL;
+    eng->type = type;
+    eng->level = level;
+
+    switch (type) {
+        case COMP_TYPE_GZIP:
+        case COMP_TYPE_DEFLATE: {
+            int wbits = (type == COMP_TYPE_GZIP) ? 15 + 16 : 15;
+            if (deflateInit2(&eng->z, level, Z_DEFLATED, wbits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                free(eng);
+                return NULL;
             }
             break;
-
+        }
         case COMP_TYPE_BROTLI:
-            ctx->brotli_state = BrotliEncoderCreateInstance(NULL, NULL, NULL);
-            if (!ctx->brotli_state) {
-                return -1;
+            eng->br = BrotliEncoderCreateInstance(comp_block_alloc, comp_block_free, NULL);
+            if (!eng->br) {
+                free(eng);
+                return NULL;
             }
-
-            BrotliEncoderSetParameter(ctx->brotli_state,
-                                     BROTLI_PARAM_QUALITY, level);
+            BrotliEncoderSetParameter(eng->br, BROTLI_PARAM_QUALITY, level);
             break;
-
+#ifdef USE_ZSTD
+        case COMP_TYPE_ZSTD:
+            eng->zstd = ZSTD_createCCtx();
+            if (!eng->zstd) {
+                free(eng);
+                return NULL;
+            }
+            ZSTD_CCtx_setParameter(eng->zstd, ZSTD_c_compressionLevel, level);
+            break;
+#endif
         default:
-            return -1;
+            free(eng);
+            return NULL;
     }
+    return eng;
+}
 
-    return 0;
+static void comp_engine_put(comp_engine_t *eng) {
+    int type = eng->type;
+
+    /* A brotli encoder is spent once finished; its blocks stay behind */
+    if (type == COMP_TYPE_BROTLI) {
+        BrotliEncoderDestroyInstance(eng->br);
+        eng->br = NULL;
+    }
+
+    if (comp_pool.count[type] >= COMP_POOL_MAX) {
+        comp_engine_free(eng);
+        return;
+    }
+    eng->next = comp_pool.idle[type];
+    comp_pool.idle[type] = eng;
+    comp_pool.count[type]++;
+}
+
+void compression_pool_flush(void) {
+    for (int t = 0; t < COMP_TYPES; t++) {
+        while (comp_pool.idle[t]) {
+            comp_engine_t *eng = comp_pool.idle[t];
+            comp_pool.idle[t] = eng->next;
+            comp_engine_free(eng);
+        }
+        comp_pool.count[t] = 0;
+    }
+    while (comp_blocks.free) {
+        comp_block_t *b = comp_blocks.free;
+        comp_blocks.free = b->next;
+        free(b);
+    }
+    comp_blocks.bytes = 0;
+}
+
+static __thread struct {
+    uint64_t wall;
+    uint64_t cpu;
+    uint32_t load;
+} comp_load;
+
+uint32_t compression_thread_load(void) {
+    uint64_t now = lb_now_ns();
+    if (now - comp_load.wall < COMP_LOAD_PERIOD_MS * 1000000ULL)
+        return comp_load.load;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    uint64_t cpu = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    if (comp_load.wall) {
+        uint64_t pct = (cpu - comp_load.cpu) * 100 / (now - comp_load.wall);
+        if (pct > 100) pct = 100;
+        /* Half the weight on the last period: quick to react, not jumpy */
+        comp_load.load = (comp_load.load + pct) / 2;
+    }
+    comp_load.wall = now;
+    comp_load.cpu = cpu;
+    return comp_load.load;
+}
+
+int compression_scale_level(int level, uint32_t load) {
+    if (level <= 1 || load <= COMP_LOAD_LOW)
+        return level;
+    if (load >= COMP_LOAD_HIGH)
+        return 1;
+    return level - (int)((level - 1) * (load - COMP_LOAD_LOW) / (COMP_LOAD_HIGH - COMP_LOAD_LOW));
+}
+
+/* Initialize compression context */
+int compression_init(compression_ctx_t *ctx, int type, int level) {
+    if (type <= COMP_TYPE_NONE || type >= COMP_TYPES)
+        return -1;
+
+    if (compression_adaptive)
+        level = compression_scale_level(level, compression_thread_load());
+
+    ctx->type = type;
+    ctx->level = level;
+    ctx->consumed = ctx->produced = 0;
+    ctx->eng = comp_engine_get(type, level);
+    return ctx->eng ? 0 : -1;
 }
 
 /* Compress data */
 int compression_process(compression_ctx_t *ctx, struct buffer *in, struct buffer *out, int flags) {
-    int ret = 0;
+    comp_engine_t *eng = ctx->eng;
+    int done = 0;
 
     switch (ctx->type) {
         case COMP_TYPE_GZIP:
         case COMP_TYPE_DEFLATE:
-            ctx->zstrm.next_in = (Bytef*)(in->area + in->head);
-            ctx->zstrm.avail_in = in->data;
-            ctx->zstrm.next_out = (Bytef*)(out->area + out->head + out->data);
-            ctx->zstrm.avail_out = out->size - out->data;
+        {
+            eng->z.next_in = (Bytef*)(in->area + in->head);
+            eng->z.avail_in = in->data;
+            eng->z.next_out = (Bytef*)(out->area + out->head + out->data);
+            eng->z.avail_out = out->size - out->data;
 
             int flush = (flags & COMP_FINISH) ? Z_FINISH : Z_NO_FLUSH;
-            ret = deflate(&ctx->zstrm, flush);
+            int ret = deflate(&eng->z, flush);
 
             if (ret == Z_STREAM_ERROR) {
                 return -1;
             }
 
-            ctx->consumed = in->data - ctx->zstrm.avail_in;
-            ctx->produced = (out->size - out->data) - ctx->zstrm.avail_out;
+            ctx->consumed = in->data - eng->z.avail_in;
+            ctx->produced = (out->size - out->data) - eng->z.avail_out;
 
             in->data -= ctx->consumed;
             in->head += ctx->consumed;
             out->data += ctx->produced;
+            done = ret == Z_STREAM_END;
             break;
+        }
 
         case COMP_TYPE_BROTLI:
             {
@@ -514,7 +1638,7 @@ int compression_process(compression_ctx_t *ctx, struct buffer *in, struct buffer
                 BrotliEncoderOperation op = (flags & COMP_FINISH) ?
                     BROTLI_OPERATION_FINISH : BROTLI_OPERATION_PROCESS;
 
-                if (!BrotliEncoderCompressStream(ctx->brotli_state, op,
+                if (!BrotliEncoderCompressStream(eng->br, op,
                                                 &available_in, &next_in,
                                                 &available_out, &next_out,
                                                 NULL)) {
@@ -527,26 +1651,41 @@ int compression_process(compression_ctx_t *ctx, struct buffer *in, struct buffer
                 in->data = available_in;
                 in->head = (char*)next_in - in->area;
                 out->data += ctx->produced;
+                done = BrotliEncoderIsFinished(eng->br);
+            }
+            break;
+
+#ifdef USE_ZSTD
+        case COMP_TYPE_ZSTD:
+            {
+                ZSTD_inBuffer zin = { in->area + in->head, in->data, 0 };
+                ZSTD_outBuffer zout = { out->area + out->head + out->data, out->size - out->data, 0 };
+
+                size_t left = ZSTD_compressStream2(eng->zstd, &zout, &zin,
+                                                   (flags & COMP_FINISH) ? ZSTD_e_end : ZSTD_e_continue);
+                if (ZSTD_isError(left)) {
+                    return -1;
+                }
+
+                ctx->consumed = zin.pos;
+                ctx->produced = zout.pos;
+
+                in->data -= zin.pos;
+                in->head += zin.pos;
+                out->data += zout.pos;
+                done = (flags & COMP_FINISH) && left == 0;
             }
             break;
+#endif
     }
 
-    return (flags & COMP_FINISH && ret == Z_STREAM_END) ? 1 : 0;
+    return (flags & COMP_FINISH) && done ? 1 : 0;
 }
 
 /* End compression */
 void compression_end(compression_ctx_t *ctx) {
-    switch (ctx->type) {
-        case COMP_TYPE_GZIP:
-        case COMP_TYPE_DEFLATE:
-            deflateEnd(&ctx->zstrm);
-            break;
-
-        case COMP_TYPE_BROTLI:
-            if (ctx->brotli_state) {
-                BrotliEncoderDestroyInstance(ctx->brotli_state);
-                ctx->brotli_state = NULL;
-            }
-            break;
+    if (ctx->eng) {
+        comp_engine_put(ctx->eng);
+        ctx->eng = NULL;
     }
-}
\ No newline at end of file
+}
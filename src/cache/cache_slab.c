@@ -0,0 +1,133 @@
+#include "cache/cache_slab.h"
+#include "utils/log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define SLAB_HUGEPAGE   (2u << 20)
+
+static int slab_class(size_t len) {
+    int shift = CACHE_SLAB_MIN_SHIFT;
+    while (((size_t)1 << shift) < len)
+        shift++;
+    return shift - CACHE_SLAB_MIN_SHIFT;
+}
+
+static int slab_map(cache_slab_t *slab, int fd, size_t size) {
+    if (ftruncate(fd, size) < 0)
+        return -1;
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+        return -1;
+    slab->fd = fd;
+    slab->base = base;
+    slab->size = size;
+    return 0;
+}
+
+cache_slab_t* cache_slab_open(const char *path, size_t size) {
+    size -= size % CACHE_SLAB_PAGE;
+    if (!size)
+        return NULL;
+
+    cache_slab_t *slab = calloc(1, sizeof(*slab));
+    if (!slab)
+        return NULL;
+
+    if (path) {
+        int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (fd < 0 || slab_map(slab, fd, size) < 0) {
+            log_error("Cache slab %s: %s", path, strerror(errno));
+            if (fd >= 0)
+                close(fd);
+            free(slab);
+            return NULL;
+        }
+    } else {
+        // hugetlb reserves its pages at mmap() time, so this fails cleanly
+        // when none are set aside and we fall back to normal pages
+        size_t huge = (size + SLAB_HUGEPAGE - 1) & ~(size_t)(SLAB_HUGEPAGE - 1);
+        int fd = memfd_create("ub-cache", MFD_CLOEXEC | MFD_HUGETLB);
+        if (fd >= 0 && slab_map(slab, fd, huge) == 0) {
+            slab->hugepages = true;
+            slab->size = size;
+        } else {
+            if (fd >= 0)
+                close(fd);
+            fd = memfd_create("ub-cache", MFD_CLOEXEC);
+            if (fd < 0 || slab_map(slab, fd, size) < 0) {
+                log_error("Cache slab: %s", strerror(errno));
+                if (fd >= 0)
+                    close(fd);
+                free(slab);
+                return NULL;
+            }
+            madvise(slab->base, size, MADV_HUGEPAGE);
+        }
+    }
+
+    pthread_mutex_init(&slab->lock, NULL);
+    log_info("Cache slab: %zuMB %s%s", size >> 20, path ? path : "in memory",
+             slab->hugepages ? " on hugepages" : "");
+    return slab;
+}
+
+void cache_slab_close(cache_slab_t *slab) {
+    if (!slab) return;
+
+    size_t mapped = slab->size;
+    if (slab->hugepages)
+        mapped = (mapped + SLAB_HUGEPAGE - 1) & ~(size_t)(SLAB_HUGEPAGE - 1);
+    munmap(slab->base, mapped);
+    close(slab->fd);
+    pthread_mutex_destroy(&slab->lock);
+    free(slab);
+}
+
+int64_t cache_slab_alloc(cache_slab_t *slab, size_t len) {
+    if (!len || len > CACHE_SLAB_PAGE)
+        return -1;
+
+    int cls = slab_class(len);
+    size_t chunk = (size_t)1 << (cls + CACHE_SLAB_MIN_SHIFT);
+    int64_t off = -1;
+
+    pthread_mutex_lock(&slab->lock);
+    if (!slab->free_list[cls] && slab->next_page + CACHE_SLAB_PAGE <= slab->size) {
+        // Carve a fresh page, linking its chunks in address order
+        uint64_t page = slab->next_page;
+        slab->next_page += CACHE_SLAB_PAGE;
+        for (uint64_t c = page + CACHE_SLAB_PAGE - chunk; ; c -= chunk) {
+            memcpy(slab->base + c, &slab->free_list[cls], sizeof(uint64_t));
+            slab->free_list[cls] = c + 1;
+            if (c == page)
+                break;
+        }
+    }
+
+    if (slab->free_list[cls]) {
+        off = slab->free_list[cls] - 1;
+        memcpy(&slab->free_list[cls], slab->base + off, sizeof(uint64_t));
+        slab->stats.chunks_used++;
+        slab->stats.bytes_used += chunk;
+    } else {
+        slab->stats.alloc_failures++;
+    }
+    pthread_mutex_unlock(&slab->lock);
+
+    return off;
+}
+
+void cache_slab_free(cache_slab_t *slab, uint64_t off, size_t len) {
+    int cls = slab_class(len);
+
+    pthread_mutex_lock(&slab->lock);
+    memcpy(slab->base + off, &slab->free_list[cls], sizeof(uint64_t));
+    slab->free_list[cls] = off + 1;
+    slab->stats.chunks_used--;
+    slab->stats.bytes_used -= (size_t)1 << (cls + CACHE_SLAB_MIN_SHIFT);
+    pthread_mutex_unlock(&slab->lock);
+}
@@ -19,14 +19,19 @@
 #define CFG_BACKEND  3
 #define CFG_LISTEN   4
 
-typedef struct config_section {
-    const char *name;
-    int (*parse)(const char **args, int line);
-} config_section_t;
-
 static int current_section = CFG_GLOBAL;
 static proxy_t *current_proxy = NULL;
 
+// "hdr(<name>)" selects the header LB_ALGO_HDR hashes; plain "hdr" keeps Host
+static void config_set_lb_hdr(proxy_t *px, const char *algo) {
+    const char *open = strchr(algo, '(');
+    const char *close = open ? strchr(open, ')') : NULL;
+    if (!open || !close || close == open + 1) return;
+
+    free(px->lb_hdr);
+    px->lb_hdr = strndup(open + 1, close - open - 1);
+}
+
 static int parse_global(const char **args, int line) {
     if (strcmp(args[0], "daemon") == 0) {
         global.daemon = 1;
@@ -105,6 +110,78 @@ static int parse_defaults(const char **args, int line) {
     return 0;
 }
 
+// Optional "if|unless <condition>" ending a rule line; *cond stays NULL
+// without one
+static int config_parse_rule_cond(const char **args, int line, acl_cond_t **cond) {
+    *cond = NULL;
+    if (!*args)
+        return 0;
+
+    if (strcmp(*args, "if") != 0 && strcmp(*args, "unless") != 0) {
+        log_error("Expected 'if' or 'unless' instead of '%s' at line %d", *args, line);
+        return -1;
+    }
+
+    char *err = NULL;
+    *cond = acl_cond_parse(args, current_proxy->acl_list, &err);
+    if (!*cond) {
+        log_error("Invalid condition at line %d: %s", line, err ? err : "out of memory");
+        free(err);
+        return -1;
+    }
+    return 0;
+}
+
+// http-request allow|deny|tarpit [deny_status <code>] [if|unless <cond>]
+// http-response allow|deny [deny_status <code>] [if|unless <cond>]
+static int config_parse_http_rule(const char **args, int line) {
+    int response = strcmp(args[0], "http-response") == 0;
+    uint16_t action;
+
+    if (!args[1]) {
+        log_error("'%s' needs an action at line %d", args[0], line);
+        return -1;
+    } else if (strcmp(args[1], "allow") == 0) {
+        action = ACL_ALLOW;
+    } else if (strcmp(args[1], "deny") == 0) {
+        action = ACL_DENY;
+    } else if (strcmp(args[1], "tarpit") == 0 && !response) {
+        action = ACL_TARPIT;
+    } else {
+        log_error("Unsupported %s action '%s' at line %d", args[0], args[1], line);
+        return -1;
+    }
+
+    const char **rest = args + 2;
+    int status = 0;
+    if (*rest && strcmp(*rest, "deny_status") == 0) {
+        if (action != ACL_DENY || !rest[1] || (status = atoi(rest[1])) < 200 || status > 599) {
+            log_error("Invalid deny_status at line %d", line);
+            return -1;
+        }
+        rest += 2;
+    }
+
+    acl_cond_t *cond;
+    if (config_parse_rule_cond(rest, line, &cond) < 0)
+        return -1;
+
+    if (response) {
+        http_res_rule_t *rule = calloc(1, sizeof(*rule));
+        rule->action = action;
+        rule->cond = cond;
+        rule->arg.deny.status = status;
+        LIST_ADDQ(&current_proxy->http_res_rules, &rule->list);
+    } else {
+        http_req_rule_t *rule = calloc(1, sizeof(*rule));
+        rule->action = action;
+        rule->cond = cond;
+        rule->arg.deny.status = status;
+        LIST_ADDQ(&current_proxy->http_req_rules, &rule->list);
+    }
+    return 0;
+}
+
 static int parse_frontend(const char **args, int line) {
     if (!current_proxy || current_proxy->type != PR_TYPE_FRONTEND) {
         current_proxy = proxy_new(args[1], PR_MODE_HTTP);
@@ -152,27 +229,31 @@ static int parse_frontend(const char **args, int line) {
 
         free(addr_buf);
     } else if (strcmp(args[0], "acl") == 0) {
-        acl_t *acl = calloc(1, sizeof(*acl));
-        acl->name = strdup(args[1]);
-        // Initialize list manually
-        acl->expr_list.n = &acl->expr_list;
-        acl->expr_list.p = &acl->expr_list;
-
-        acl->next = current_proxy->acl_list;
-        current_proxy->acl_list = acl;
+        if (!args[1] || !args[2]) {
+            log_error("'acl' needs a name and a criterion at line %d", line);
+            return -1;
+        }
+
+        char *err = NULL;
+        acl_expr_t *expr = acl_expr_parse(args + 2, &err);
+        if (!expr || !acl_add_expr(&current_proxy->acl_list, args[1], expr)) {
+            log_error("acl '%s' at line %d: %s", args[1], line, err ? err : "out of memory");
+            free(err);
+            acl_expr_free(expr);
+            return -1;
+        }
     } else if (strcmp(args[0], "use_backend") == 0) {
+        acl_cond_t *cond;
+        if (!args[1] || config_parse_rule_cond(args + 2, line, &cond) < 0)
+            return -1;
+
         http_req_rule_t *rule = calloc(1, sizeof(*rule));
         rule->action = ACL_USE_BACKEND;
         rule->arg.backend.name = strdup(args[1]);
-
-        if (args[2] && strcmp(args[2], "if") == 0) {
-            rule->cond = NULL;
-        }
-
-        rule->list.n = &current_proxy->http_req_rules;
-        rule->list.p = current_proxy->http_req_rules.p;
-        current_proxy->http_req_rules.p->n = &rule->list;
-        current_proxy->http_req_rules.p = &rule->list;
+        rule->cond = cond;
+        LIST_ADDQ(&current_proxy->http_req_rules, &rule->list);
+    } else if (strcmp(args[0], "http-request") == 0 || strcmp(args[0], "http-response") == 0) {
+        return config_parse_http_rule(args, line);
     } else if (strcmp(args[0], "default_backend") == 0) {
         current_proxy->default_backend = proxy_find_by_name(args[1]);
     }
@@ -197,8 +278,9 @@ static int parse_backend(const char **args, int line) {
             current_proxy->lb_algo = LB_ALGO_URI;
         } else if (strcmp(args[1], "url_param") == 0) {
             current_proxy->lb_algo = LB_ALGO_URL_PARAM;
-        } else if (strcmp(args[1], "hdr") == 0) {
+        } else if (strncmp(args[1], "hdr", 3) == 0) {
             current_proxy->lb_algo = LB_ALGO_HDR;
+            config_set_lb_hdr(current_proxy, args[1]);
         } else if (strcmp(args[1], "random") == 0) {
             current_proxy->lb_algo = LB_ALGO_RANDOM;
         }
@@ -233,6 +315,8 @@ static int parse_backend(const char **args, int line) {
                 srv->weight = atoi(args[++i]);
             } else if (strcmp(args[i], "maxconn") == 0) {
                 srv->max_conns = atoi(args[++i]);
+            } else if (strcmp(args[i], "slowstart") == 0) {
+                srv->slowstart = atoi(args[++i]);
             } else if (strcmp(args[i], "backup") == 0) {
                 srv->flags |= SRV_BACKUP;
             } else if (strcmp(args[i], "ssl") == 0) {
@@ -252,8 +336,7 @@ static int parse_backend(const char **args, int line) {
             }
         }
 
-        srv->next = current_proxy->servers;
-        current_proxy->servers = srv;
+        proxy_add_server(current_proxy, srv);
 
         free(addr_buf);
     } else if (strcmp(args[0], "option") == 0) {
@@ -269,6 +352,8 @@ static int parse_backend(const char **args, int line) {
         } else if (strcmp(args[1], "redis-check") == 0) {
             current_proxy->check_type = HCHK_TYPE_REDIS;
         }
+    } else if (strcmp(args[0], "hash-balance-factor") == 0) {
+        current_proxy->hash_balance_factor = atoi(args[1]);
     } else if (strcmp(args[0], "stick-table") == 0) {
         parse_stick_table(current_proxy, &args[1]);
     } else if (strcmp(args[0], "stick") == 0) {
@@ -417,7 +502,13 @@ int config_check() {
 
 // Stub implementations for missing functions
 struct proxy* proxy_find_by_name(const char *name) {
-    // TODO: Implement proxy lookup
+    if (!name)
+        return NULL;
+
+    for (struct proxy *px = proxies_list; px; px = px->next) {
+        if (px->id && strcmp(px->id, name) == 0)
+            return px;
+    }
     return NULL;
 }
 
@@ -627,11 +718,14 @@ static int parse_yaml_backend(yaml_document_t *doc, yaml_node_t *node, const cha
                 (*px)->lb_algo = LB_ALGO_URI;
             } else if (strcmp(algo, "url_param") == 0) {
                 (*px)->lb_algo = LB_ALGO_URL_PARAM;
-            } else if (strcmp(algo, "hdr") == 0) {
+            } else if (strncmp(algo, "hdr", 3) == 0) {
                 (*px)->lb_algo = LB_ALGO_HDR;
+                config_set_lb_hdr(*px, algo);
             } else if (strcmp(algo, "random") == 0) {
                 (*px)->lb_algo = LB_ALGO_RANDOM;
             }
+        } else if (strcmp(key_str, "hash-balance-factor") == 0) {
+            (*px)->hash_balance_factor = atoi((const char *)value->data.scalar.value);
         } else if (strcmp(key_str, "servers") == 0 && value->type == YAML_SEQUENCE_NODE) {
             for (yaml_node_item_t *item = value->data.sequence.items.start;
                  item < value->data.sequence.items.top; item++) {
@@ -684,8 +778,7 @@ static int parse_yaml_backend(yaml_document_t *doc, yaml_node_t *node, const cha
                             srv->check->server = srv;
                         }
 
-                        srv->next = (*px)->servers;
-                        (*px)->servers = srv;
+                        proxy_add_server(*px, srv);
 
                         free(addr_copy);
                     }
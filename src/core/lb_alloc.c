@@ -0,0 +1,454 @@
+#include "core/lb_alloc.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define LB_ALLOC_PAGE       ((size_t)1 << LB_ALLOC_PAGE_SHIFT)
+#define LB_ALLOC_REGION     ((size_t)1 << LB_ALLOC_REGION_SHIFT)
+#define LB_ALLOC_PAGES      (LB_ALLOC_REGION / LB_ALLOC_PAGE)
+#define LB_ALLOC_MAGIC      0x4c42414cu
+#define LB_ALLOC_LARGE      0xff
+#define LB_ALLOC_LARGE_OFF  64      // object start in a large mapping
+#define LB_ALLOC_NODES      8       // pools kept; higher nodes wrap around
+
+typedef struct lb_alloc_obj {
+    struct lb_alloc_obj* next;
+    struct lb_alloc_obj* batch_next;    // in a central pool's batch list
+} lb_alloc_obj_t;
+
+// At the start of every region; page 0 holds nothing else
+typedef struct {
+    uint32_t magic;
+    uint8_t page_class[LB_ALLOC_PAGES];
+    size_t large_size;          // the whole mapping, for a large allocation
+} lb_alloc_region_t;
+
+_Static_assert(sizeof(lb_alloc_region_t) <= LB_ALLOC_LARGE_OFF, "region header too large");
+
+typedef struct {
+    pthread_spinlock_t lock;
+    lb_alloc_obj_t* batches;    // full batches
+    lb_alloc_obj_t* loose;      // partial ones, from exiting threads
+    uint32_t loose_count;
+} __attribute__((aligned(64))) lb_alloc_central_t;
+
+typedef struct {
+    lb_alloc_obj_t* head;
+    uint32_t count;
+} lb_alloc_list_t;
+
+// Region being carved for one node's classes
+typedef struct {
+    pthread_mutex_t lock;
+    lb_alloc_region_t* cur;
+    uint32_t next_page;
+} lb_alloc_cursor_t;
+
+static lb_alloc_central_t lb_alloc_central[LB_ALLOC_NODES][LB_ALLOC_CLASSES];
+static uint32_t lb_alloc_batch[LB_ALLOC_CLASSES];
+static lb_alloc_cursor_t lb_alloc_cursor[LB_ALLOC_NODES];
+
+static pthread_once_t lb_alloc_once = PTHREAD_ONCE_INIT;
+static pthread_key_t lb_alloc_key;
+
+static struct {
+    _Atomic uint64_t regions;
+    _Atomic uint64_t large_allocs;
+    _Atomic uint64_t large_bytes;
+    _Atomic uint64_t central_gets;
+    _Atomic uint64_t central_puts;
+} lb_alloc_stats;
+
+static __thread struct {
+    bool registered;
+    uint32_t node;              // pool index, 0 until lb_alloc_set_node()
+    lb_alloc_list_t lists[LB_ALLOC_CLASSES];
+    lb_arena_t arenas[LB_ARENA_COUNT];
+} lb_alloc_tls;
+
+int lb_alloc_class_of(size_t size) {
+    if (size <= 128) return size ? (int)((size + 15) >> 4) - 1 : 0;
+    if (size > LB_ALLOC_SMALL_MAX) return -1;
+    unsigned e = 63 - __builtin_clzll(size - 1);
+    return 8 + (int)(e - 7) * 4 + (int)(((size - 1) >> (e - 2)) & 3);
+}
+
+size_t lb_alloc_class_size(int cls) {
+    if (cls < 8) return (size_t)(cls + 1) << 4;
+    unsigned e = 7 + (cls - 8) / 4, sub = (cls - 8) % 4;
+    return ((size_t)1 << e) + ((size_t)(sub + 1) << (e - 2));
+}
+
+static void lb_alloc_thread_exit(void* arg);
+
+static void lb_alloc_init(void) {
+    for (int i = 0; i < LB_ALLOC_CLASSES; i++) {
+        // About 32 KB per batch, so small classes move many objects at once
+        uint32_t n = (uint32_t)(32768 / lb_alloc_class_size(i));
+        lb_alloc_batch[i] = n < 4 ? 4 : n > 128 ? 128 : n;
+    }
+    for (int node = 0; node < LB_ALLOC_NODES; node++) {
+        for (int i = 0; i < LB_ALLOC_CLASSES; i++)
+            pthread_spin_init(&lb_alloc_central[node][i].lock, PTHREAD_PROCESS_PRIVATE);
+        pthread_mutex_init(&lb_alloc_cursor[node].lock, NULL);
+    }
+    pthread_key_create(&lb_alloc_key, lb_alloc_thread_exit);
+}
+
+// The key's destructor flushes the thread's lists when it exits
+static void lb_alloc_register(void) {
+    pthread_once(&lb_alloc_once, lb_alloc_init);
+    pthread_setspecific(lb_alloc_key, &lb_alloc_tls);
+    lb_alloc_tls.registered = true;
+}
+
+static lb_alloc_region_t* lb_alloc_map_region(size_t len) {
+    // Twice the alignment, then trim to an aligned region
+    size_t map_len = len + LB_ALLOC_REGION;
+    char* raw = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) return NULL;
+
+    char* base = (char*)(((uintptr_t)raw + LB_ALLOC_REGION - 1) & ~(uintptr_t)(LB_ALLOC_REGION - 1));
+    if (base > raw) munmap(raw, base - raw);
+    if (raw + map_len > base + len) munmap(base + len, raw + map_len - (base + len));
+    if (len >= LB_ALLOC_REGION) madvise(base, len & ~(LB_ALLOC_REGION - 1), MADV_HUGEPAGE);
+
+    lb_alloc_region_t* r = (lb_alloc_region_t*)base;
+    r->magic = LB_ALLOC_MAGIC;
+    return r;
+}
+
+// npages contiguous pages for cls, from the current region of the calling
+// thread's node or a new one
+static char* lb_alloc_pages(uint32_t npages, int cls) {
+    lb_alloc_cursor_t* cur = &lb_alloc_cursor[lb_alloc_tls.node];
+    pthread_mutex_lock(&cur->lock);
+    if (!cur->cur || cur->next_page + npages > LB_ALLOC_PAGES) {
+        lb_alloc_region_t* r = lb_alloc_map_region(LB_ALLOC_REGION);
+        if (!r) {
+            pthread_mutex_unlock(&cur->lock);
+            return NULL;
+        }
+        atomic_fetch_add_explicit(&lb_alloc_stats.regions, 1, memory_order_relaxed);
+        cur->cur = r;
+        cur->next_page = 1;
+    }
+
+    lb_alloc_region_t* r = cur->cur;
+    uint32_t first = cur->next_page;
+    for (uint32_t i = 0; i < npages; i++)
+        r->page_class[first + i] = (uint8_t)cls;
+    cur->next_page += npages;
+    pthread_mutex_unlock(&cur->lock);
+
+    return (char*)r + (size_t)first * LB_ALLOC_PAGE;
+}
+
+// Carves a new span: one batch for the caller, the rest to the pool
+static lb_alloc_obj_t* lb_alloc_grow(int cls, uint32_t* count) {
+    size_t size = lb_alloc_class_size(cls);
+    size_t want = size * 8 > LB_ALLOC_PAGE ? size * 8 : LB_ALLOC_PAGE;
+    uint32_t npages = (uint32_t)((want + LB_ALLOC_PAGE - 1) / LB_ALLOC_PAGE);
+    char* span = lb_alloc_pages(npages, cls);
+    if (!span) return NULL;
+
+    uint32_t batch = lb_alloc_batch[cls];
+    uint32_t n = (uint32_t)((size_t)npages * LB_ALLOC_PAGE / size);
+    lb_alloc_obj_t* batches = NULL;
+    lb_alloc_obj_t** tail = &batches;
+    lb_alloc_obj_t* partial = NULL;
+    uint32_t in_partial = 0;
+
+    for (uint32_t i = 0; i + batch <= n; i += batch) {
+        lb_alloc_obj_t* head = (lb_alloc_obj_t*)(span + i * size);
+        for (uint32_t j = 0; j < batch; j++) {
+            lb_alloc_obj_t* o = (lb_alloc_obj_t*)(span + (i + j) * size);
+            o->next = j + 1 < batch ? (lb_alloc_obj_t*)(span + (i + j + 1) * size) : NULL;
+        }
+        head->batch_next = NULL;
+        *tail = head;
+        tail = &head->batch_next;
+    }
+    for (uint32_t i = n - n % batch; i < n; i++) {
+        lb_alloc_obj_t* o = (lb_alloc_obj_t*)(span + i * size);
+        o->next = partial;
+        partial = o;
+        in_partial++;
+    }
+
+    lb_alloc_obj_t* mine = batches;
+    *count = batch;
+    if (!mine) {
+        mine = partial;
+        *count = in_partial;
+        partial = NULL;
+        in_partial = 0;
+    } else {
+        batches = mine->batch_next;
+    }
+
+    lb_alloc_central_t* c = &lb_alloc_central[lb_alloc_tls.node][cls];
+    if (batches || partial) {
+        pthread_spin_lock(&c->lock);
+        if (batches) {
+            *tail = c->batches;
+            c->batches = batches;
+        }
+        while (partial) {
+            lb_alloc_obj_t* next = partial->next;
+            partial->next = c->loose;
+            c->loose = partial;
+            c->loose_count++;
+            partial = next;
+        }
+        pthread_spin_unlock(&c->lock);
+    }
+    return mine;
+}
+
+static lb_alloc_obj_t* lb_alloc_central_get(int cls, uint32_t* count) {
+    lb_alloc_central_t* c = &lb_alloc_central[lb_alloc_tls.node][cls];
+    lb_alloc_obj_t* chain = NULL;
+
+    pthread_spin_lock(&c->lock);
+    if (c->batches) {
+        chain = c->batches;
+        c->batches = chain->batch_next;
+        *count = lb_alloc_batch[cls];
+    } else if (c->loose) {
+        uint32_t n = 1;
+        chain = c->loose;
+        lb_alloc_obj_t* last = chain;
+        while (n < lb_alloc_batch[cls] && last->next) {
+            last = last->next;
+            n++;
+        }
+        c->loose = last->next;
+        c->loose_count -= n;
+        last->next = NULL;
+        *count = n;
+    }
+    pthread_spin_unlock(&c->lock);
+
+    if (!chain) chain = lb_alloc_grow(cls, count);
+    if (chain) atomic_fetch_add_explicit(&lb_alloc_stats.central_gets, 1, memory_order_relaxed);
+    return chain;
+}
+
+static void lb_alloc_central_put(int cls, lb_alloc_obj_t* chain) {
+    lb_alloc_central_t* c = &lb_alloc_central[lb_alloc_tls.node][cls];
+    pthread_spin_lock(&c->lock);
+    chain->batch_next = c->batches;
+    c->batches = chain;
+    pthread_spin_unlock(&c->lock);
+    atomic_fetch_add_explicit(&lb_alloc_stats.central_puts, 1, memory_order_relaxed);
+}
+
+// Hands the newest batch of a list back to the pool
+static void lb_alloc_release(int cls, lb_alloc_list_t* l) {
+    uint32_t batch = lb_alloc_batch[cls];
+    lb_alloc_obj_t* chain = l->head;
+    lb_alloc_obj_t* last = chain;
+    for (uint32_t i = 1; i < batch; i++)
+        last = last->next;
+    l->head = last->next;
+    l->count -= batch;
+    last->next = NULL;
+    lb_alloc_central_put(cls, chain);
+}
+
+static void* lb_alloc_large(size_t size) {
+    if (size > SIZE_MAX - LB_ALLOC_REGION - LB_ALLOC_LARGE_OFF) return NULL;
+    size_t len = (size + LB_ALLOC_LARGE_OFF + 4095) & ~(size_t)4095;
+    lb_alloc_region_t* r = lb_alloc_map_region(len);
+    if (!r) return NULL;
+
+    r->page_class[0] = LB_ALLOC_LARGE;
+    r->large_size = len;
+    atomic_fetch_add_explicit(&lb_alloc_stats.large_allocs, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&lb_alloc_stats.large_bytes, len, memory_order_relaxed);
+    return (char*)r + LB_ALLOC_LARGE_OFF;
+}
+
+static inline lb_alloc_region_t* lb_alloc_region_of(const void* ptr) {
+    lb_alloc_region_t* r = (lb_alloc_region_t*)((uintptr_t)ptr & ~(uintptr_t)(LB_ALLOC_REGION - 1));
+    // Not ours: freeing it would corrupt a free list
+    if (__builtin_expect(r->magic != LB_ALLOC_MAGIC, 0)) abort();
+    return r;
+}
+
+void* lb_alloc(size_t size) {
+    int cls = lb_alloc_class_of(size);
+    if (cls < 0) return lb_alloc_large(size);
+
+    lb_alloc_list_t* l = &lb_alloc_tls.lists[cls];
+    if (__builtin_expect(!l->head, 0)) {
+        if (!lb_alloc_tls.registered) lb_alloc_register();
+        l->head = lb_alloc_central_get(cls, &l->count);
+        if (!l->head) return NULL;
+    }
+
+    lb_alloc_obj_t* o = l->head;
+    l->head = o->next;
+    l->count--;
+    return o;
+}
+
+void lb_free(void* ptr) {
+    if (!ptr) return;
+
+    lb_alloc_region_t* r = lb_alloc_region_of(ptr);
+    uint8_t cls = r->page_class[((uintptr_t)ptr - (uintptr_t)r) >> LB_ALLOC_PAGE_SHIFT];
+    if (cls == LB_ALLOC_LARGE) {
+        atomic_fetch_sub_explicit(&lb_alloc_stats.large_allocs, 1, memory_order_relaxed);
+        atomic_fetch_sub_explicit(&lb_alloc_stats.large_bytes, r->large_size, memory_order_relaxed);
+        munmap(r, r->large_size);
+        return;
+    }
+
+    if (__builtin_expect(!lb_alloc_tls.registered, 0)) lb_alloc_register();
+    lb_alloc_list_t* l = &lb_alloc_tls.lists[cls];
+    lb_alloc_obj_t* o = ptr;
+    o->next = l->head;
+    l->head = o;
+    if (++l->count > 2 * lb_alloc_batch[cls])
+        lb_alloc_release(cls, l);
+}
+
+size_t lb_alloc_usable_size(const void* ptr) {
+    lb_alloc_region_t* r = lb_alloc_region_of(ptr);
+    uint8_t cls = r->page_class[((uintptr_t)ptr - (uintptr_t)r) >> LB_ALLOC_PAGE_SHIFT];
+    if (cls == LB_ALLOC_LARGE) return r->large_size - LB_ALLOC_LARGE_OFF;
+    return lb_alloc_class_size(cls);
+}
+
+void* lb_calloc(size_t n, size_t size) {
+    if (size && n > SIZE_MAX / size) return NULL;
+    size_t total = n * size;
+    void* p = lb_alloc(total);
+    // Large allocations are fresh mappings, already zero
+    if (p && total <= LB_ALLOC_SMALL_MAX) memset(p, 0, total);
+    return p;
+}
+
+void* lb_realloc(void* ptr, size_t size) {
+    if (!ptr) return lb_alloc(size);
+    size_t have = lb_alloc_usable_size(ptr);
+    if (size <= have) return ptr;
+
+    void* p = lb_alloc(size);
+    if (!p) return NULL;
+    memcpy(p, ptr, have);
+    lb_free(ptr);
+    return p;
+}
+
+char* lb_strdup(const char* s) {
+    size_t len = strlen(s) + 1;
+    char* p = lb_alloc(len);
+    if (p) memcpy(p, s, len);
+    return p;
+}
+
+void lb_alloc_thread_flush(void) {
+    for (int cls = 0; cls < LB_ALLOC_CLASSES; cls++) {
+        lb_alloc_list_t* l = &lb_alloc_tls.lists[cls];
+        while (l->count >= lb_alloc_batch[cls])
+            lb_alloc_release(cls, l);
+        if (!l->head) continue;
+
+        lb_alloc_obj_t* last = l->head;
+        while (last->next) last = last->next;
+
+        lb_alloc_central_t* c = &lb_alloc_central[lb_alloc_tls.node][cls];
+        pthread_spin_lock(&c->lock);
+        last->next = c->loose;
+        c->loose = l->head;
+        c->loose_count += l->count;
+        pthread_spin_unlock(&c->lock);
+        l->head = NULL;
+        l->count = 0;
+    }
+}
+
+void lb_alloc_set_node(int node) {
+    if (!lb_alloc_tls.registered) lb_alloc_register();
+    uint32_t idx = node > 0 ? (uint32_t)node % LB_ALLOC_NODES : 0;
+    if (idx == lb_alloc_tls.node) return;
+    // Cached objects go back to the old node's pool
+    lb_alloc_thread_flush();
+    lb_alloc_tls.node = idx;
+}
+
+static void lb_alloc_thread_exit(void* arg) {
+    for (int i = 0; i < LB_ARENA_COUNT; i++)
+        lb_arena_destroy(&lb_alloc_tls.arenas[i]);
+    lb_alloc_thread_flush();
+    // Frees by later destructors register again and get flushed again
+    lb_alloc_tls.registered = false;
+}
+
+void lb_alloc_get_stats(lb_alloc_stats_t* out) {
+    out->regions = atomic_load_explicit(&lb_alloc_stats.regions, memory_order_relaxed);
+    out->large_allocs = atomic_load_explicit(&lb_alloc_stats.large_allocs, memory_order_relaxed);
+    out->large_bytes = atomic_load_explicit(&lb_alloc_stats.large_bytes, memory_order_relaxed);
+    out->central_gets = atomic_load_explicit(&lb_alloc_stats.central_gets, memory_order_relaxed);
+    out->central_puts = atomic_load_explicit(&lb_alloc_stats.central_puts, memory_order_relaxed);
+}
+
+void lb_arena_init(lb_arena_t* arena, size_t chunk_size) {
+    memset(arena, 0, sizeof(*arena));
+    arena->chunk_size = chunk_size ? chunk_size : LB_ARENA_CHUNK;
+}
+
+void lb_arena_destroy(lb_arena_t* arena) {
+    lb_arena_chunk_t* c = arena->first;
+    while (c) {
+        lb_arena_chunk_t* next = c->next;
+        lb_free(c);
+        c = next;
+    }
+    size_t chunk_size = arena->chunk_size;
+    memset(arena, 0, sizeof(*arena));
+    arena->chunk_size = chunk_size;
+}
+
+// size is aligned. Chunks past the current one are free since the last
+// reset or release; one too small for size is skipped until then.
+void* lb_arena_alloc_slow(lb_arena_t* arena, size_t size) {
+    lb_arena_chunk_t** link = arena->cur ? &arena->cur->next : &arena->first;
+    while (*link && (*link)->size < size)
+        link = &(*link)->next;
+
+    if (!*link) {
+        size_t chunk = arena->chunk_size ? arena->chunk_size : LB_ARENA_CHUNK;
+        size_t total = sizeof(lb_arena_chunk_t) + (size > chunk ? size : chunk);
+        lb_arena_chunk_t* c = lb_alloc(total);
+        if (!c) return NULL;
+        c->next = NULL;
+        c->size = total - sizeof(lb_arena_chunk_t);
+        *link = c;
+    }
+
+    arena->cur = *link;
+    arena->ptr = arena->cur->data + size;
+    arena->end = arena->cur->data + arena->cur->size;
+    return arena->cur->data;
+}
+
+char* lb_arena_strndup(lb_arena_t* arena, const char* s, size_t len) {
+    char* p = lb_arena_alloc(arena, len + 1);
+    if (!p) return NULL;
+    memcpy(p, s, len);
+    p[len] = '\0';
+    return p;
+}
+
+lb_arena_t* lb_arena_local(lb_arena_id_t id) {
+    if (!lb_alloc_tls.registered) lb_alloc_register();
+    lb_arena_t* a = &lb_alloc_tls.arenas[id];
+    if (!a->chunk_size) a->chunk_size = LB_ARENA_CHUNK;
+    return a;
+}
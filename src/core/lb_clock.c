@@ -0,0 +1,83 @@
+#include "core/lb_clock.h"
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define LB_CLOCK_HAVE_TSC 1
+#endif
+
+__thread lb_clock_t lb_clock;
+
+// ns = snapshot.ns + ((tsc - snapshot.tsc) * tsc_mult) >> 32
+static uint64_t tsc_mult;
+static bool tsc_usable;
+static pthread_once_t tsc_once = PTHREAD_ONCE_INIT;
+
+uint64_t lb_clock_read_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+time_t lb_clock_read_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+#ifdef LB_CLOCK_HAVE_TSC
+// Only an invariant TSC ticks at a constant rate across P-states and
+// stays in step between cores; calibrate it against CLOCK_MONOTONIC
+static void lb_clock_calibrate(void) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1u << 8)))
+        return;
+
+    uint64_t t0 = lb_clock_read_ns();
+    uint64_t c0 = __rdtsc();
+    struct timespec pause = { 0, 5000000 };
+    nanosleep(&pause, NULL);
+    uint64_t t1 = lb_clock_read_ns();
+    uint64_t c1 = __rdtsc();
+
+    if (c1 <= c0 || t1 <= t0)
+        return;
+    tsc_mult = (uint64_t)(((unsigned __int128)(t1 - t0) << 32) / (c1 - c0));
+    tsc_usable = tsc_mult != 0;
+}
+#endif
+
+void lb_clock_update(void) {
+#ifdef LB_CLOCK_HAVE_TSC
+    pthread_once(&tsc_once, lb_clock_calibrate);
+    if (tsc_usable)
+        lb_clock.tsc = __rdtsc();
+#endif
+    lb_clock.ns = lb_clock_read_ns();
+    lb_clock.ms = lb_clock.ns / 1000000;
+    lb_clock.sec = lb_clock_read_sec();
+    lb_clock.valid = true;
+}
+
+void lb_clock_release(void) {
+    lb_clock.valid = false;
+}
+
+uint64_t lb_clock_precise_ns(void) {
+#ifdef LB_CLOCK_HAVE_TSC
+    // The snapshot is at most one loop iteration old, which keeps both
+    // the multiply in range and calibration error negligible
+    if (tsc_usable && lb_clock.valid) {
+        uint64_t delta = __rdtsc() - lb_clock.tsc;
+        return lb_clock.ns + (uint64_t)(((unsigned __int128)delta * tsc_mult) >> 32);
+    }
+#endif
+    return lb_clock_read_ns();
+}
+
+bool lb_clock_tsc_usable(void) {
+#ifdef LB_CLOCK_HAVE_TSC
+    pthread_once(&tsc_once, lb_clock_calibrate);
+#endif
+    return tsc_usable;
+}
@@ -1,12 +1,15 @@
 #include "core/loadbalancer.h"
+#include "core/lb_clock.h"
+#include "health/health.h"
+#include "utils/log.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
-#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/epoll.h>
 #include <netinet/tcp.h>
@@ -37,7 +40,18 @@ loadbalancer_t* lb_create(uint16_t port, lb_algorithm_t algorithm) {
     lb->config.tcp_nodelay = true;
     lb->config.so_reuseport = true;
     lb->config.defer_accept = true;
+    lb->config.accept_batch = 64;
     lb->config.health_check_enabled = true;
+    lb->config.cpu_pinning = true;
+    lb->config.health_check_timeout_ms = 2000;
+    lb->config.health_check_type = HCHK_TYPE_HTTP;
+    lb->config.outlier_consecutive = 5;
+    lb->config.outlier_error_pct = 50;
+    lb->config.outlier_min_requests = 20;
+    lb->config.outlier_window_ms = 10000;
+    lb->config.outlier_ejection_ms = 5000;
+    lb->config.outlier_max_ejection_ms = 300000;
+    lb->config.outlier_max_pct = 50;
 
     lb->epfd = epoll_create1(EPOLL_CLOEXEC);
     if (lb->epfd < 0) {
@@ -45,25 +59,6 @@ loadbalancer_t* lb_create(uint16_t port, lb_algorithm_t algorithm) {
         return NULL;
     }
 
-    size_t pool_size = 1024 * 1024 * 1024;
-    lb->memory_pool = mmap(NULL, pool_size, PROT_READ | PROT_WRITE,
-                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
-    if (lb->memory_pool == MAP_FAILED) {
-        close(lb->epfd);
-        free(lb);
-        return NULL;
-    }
-
-    if (madvise(lb->memory_pool, pool_size, MADV_HUGEPAGE) == -1) {
-        madvise(lb->memory_pool, pool_size, MADV_SEQUENTIAL);
-    }
-
-    memory_pool_t* pool = (memory_pool_t*)lb->memory_pool;
-    pool->base = (char*)lb->memory_pool + sizeof(memory_pool_t);
-    pool->size = pool_size - sizeof(memory_pool_t);
-    pool->used = 0;
-    pthread_spin_init(&pool->lock, PTHREAD_PROCESS_PRIVATE);
-
     return lb;
 }
 
@@ -79,10 +74,6 @@ void lb_destroy(loadbalancer_t* lb) {
         }
     }
 
-    if (lb->memory_pool && lb->memory_pool != MAP_FAILED) {
-        munmap(lb->memory_pool, 1024 * 1024 * 1024);
-    }
-
     if (lb->epfd >= 0) close(lb->epfd);
     pthread_spin_destroy(&lb->conn_pool_lock);
 
@@ -104,11 +95,79 @@ int lb_add_backend(loadbalancer_t* lb, const char* host, uint16_t port, uint32_t
 
     pthread_spin_init(&backend->lock, PTHREAD_PROCESS_PRIVATE);
 
-    lb->backends[lb->backend_count++] = backend;
+    lb_backend_attach(lb, backend);
 
     return 0;
 }
 
+// Backends are only added before the workers start, so the slot is final.
+// The address is resolved up front; names keep refreshing in
+// dns_resolver_thread.
+void lb_backend_attach(loadbalancer_t* lb, backend_t* backend) {
+    if (lb_dns_resolve_backend(backend) < 0) {
+        fprintf(stderr, "[WARN] Could not resolve backend %s, will retry\n", backend->host);
+    }
+
+    backend->slot = lb->backend_count;
+    atomic_store(&lb->view.conns[backend->slot], 0);
+    lb_backend_set_weight(lb, backend, atomic_load(&backend->weight));
+    lb_backend_set_state(lb, backend, atomic_load(&backend->state));
+    lb->backends[lb->backend_count++] = backend;
+}
+
+// Make a backend selectable. One coming back (not its first UP) ramps up
+// from zero when slow start is on.
+static void lb_backend_publish_up(loadbalancer_t* lb, backend_t* backend, bool returning) {
+    uint64_t bit = 1ULL << (backend->slot & 63);
+    if (returning) {
+        uint64_t now = lb_now_ns();
+        uint64_t since = atomic_exchange(&backend->up_since_ns, now);
+        if (since && lb->config.slow_start_ms) {
+            atomic_fetch_or(&lb->view.warming[backend->slot >> 6], bit);
+        }
+    }
+    atomic_fetch_or(&lb->view.up[backend->slot >> 6], bit);
+}
+
+void lb_backend_set_state(loadbalancer_t* lb, backend_t* backend, backend_state_t state) {
+    uint64_t bit = 1ULL << (backend->slot & 63);
+    backend_state_t prev = atomic_exchange(&backend->state, state);
+    if (state == BACKEND_UP) {
+        // An ejected backend stays out until lb_outlier_sweep() re-admits it
+        if (atomic_load(&backend->ejected_until_ns) == 0) {
+            lb_backend_publish_up(lb, backend, prev != BACKEND_UP);
+        }
+    } else {
+        atomic_fetch_and(&lb->view.up[backend->slot >> 6], ~bit);
+        atomic_fetch_and(&lb->view.warming[backend->slot >> 6], ~bit);
+    }
+}
+
+// Fraction of full weight, in 1/65536ths, a warming backend gets this far
+// into its slow-start window. The exponential curve doubles every tenth of
+// the window, so it stays near zero for longer than the linear one.
+uint32_t lb_slow_start_factor(loadbalancer_t* lb, backend_t* backend, uint64_t now_ns) {
+    uint64_t window = (uint64_t)lb->config.slow_start_ms * 1000000ULL;
+    uint64_t since = atomic_load_explicit(&backend->up_since_ns, memory_order_relaxed);
+    uint64_t elapsed = now_ns > since ? now_ns - since : 0;
+
+    if (!window || elapsed >= window) {
+        uint64_t bit = 1ULL << (backend->slot & 63);
+        atomic_fetch_and(&lb->view.warming[backend->slot >> 6], ~bit);
+        return LB_SLOW_START_FULL;
+    }
+
+    double t = (double)elapsed / (double)window;
+    double f = lb->config.slow_start_exp ? (exp2(10.0 * t) - 1.0) / 1023.0 : t;
+    uint32_t factor = (uint32_t)(f * LB_SLOW_START_FULL);
+    return factor ? factor : 1;
+}
+
+void lb_backend_set_weight(loadbalancer_t* lb, backend_t* backend, uint32_t weight) {
+    atomic_store(&backend->weight, weight);
+    atomic_store(&lb->view.weight[backend->slot], weight);
+}
+
 int create_listen_socket(uint16_t port, bool reuseport) {
     int sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (sockfd < 0) return -1;
@@ -128,9 +187,6 @@ int create_listen_socket(uint16_t port, bool reuseport) {
     val = 1;
     setsockopt(sockfd, IPPROTO_TCP, TCP_QUICKACK, &val, sizeof(val));
 
-    struct linger lng = {1, 0};
-    setsockopt(sockfd, SOL_SOCKET, SO_LINGER, &lng, sizeof(lng));
-
     int sndbuf = 2 * 1024 * 1024;
     int rcvbuf = 2 * 1024 * 1024;
     setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
@@ -155,37 +211,290 @@ int create_listen_socket(uint16_t port, bool reuseport) {
     return sockfd;
 }
 
-backend_t* lb_select_backend(loadbalancer_t* lb, struct sockaddr_in* client_addr) {
+static inline bool lb_backend_slot_warming(loadbalancer_t* lb, uint32_t slot) {
+    uint64_t word = atomic_load_explicit(&lb->view.warming[slot >> 6], memory_order_relaxed);
+    return (word >> (slot & 63)) & 1;
+}
+
+// Weight in 1/256ths, scaled down while the backend is warming
+static inline uint64_t lb_slot_eweight(loadbalancer_t* lb, uint32_t slot) {
+    uint32_t weight = atomic_load_explicit(&lb->view.weight[slot], memory_order_relaxed);
+    uint64_t eweight = (uint64_t)(weight ? weight : 1) << 8;
+    if (lb_backend_slot_warming(lb, slot)) {
+        uint32_t factor = lb_slow_start_factor(lb, lb->backends[slot], lb_now_ns());
+        eweight = (eweight * factor) >> 16;
+    }
+    return eweight ? eweight : 1;
+}
+
+// Connections per unit of effective weight, counting the one being
+// placed so that an idle but warming backend is not a free pick
+static inline uint64_t lb_slot_load(loadbalancer_t* lb, uint32_t slot) {
+    uint32_t conns = atomic_load_explicit(&lb->view.conns[slot], memory_order_relaxed);
+    return ((uint64_t)(conns + 1) << 16) / lb_slot_eweight(lb, slot);
+}
+
+#define P2C_SAMPLE_ATTEMPTS 8
+
+// Power of two choices: sample two distinct UP backends at random and keep
+// the less loaded one. Touches two backends instead of all of them and
+// avoids the herding of an exact minimum that every worker agrees on.
+static backend_t* lb_select_p2c(loadbalancer_t* lb, uint64_t (*load)(loadbalancer_t*, uint32_t)) {
+    uint32_t count = lb->backend_count;
+    uint32_t picks[2];
+    int found = 0;
+
+    if (count == 0) return NULL;
+
+    for (int attempt = 0; attempt < P2C_SAMPLE_ATTEMPTS && found < 2; attempt++) {
+        uint32_t slot = lb_rand_range(count);
+        if (!lb_backend_slot_up(lb, slot)) continue;
+        if (found == 1 && slot == picks[0]) continue;
+        picks[found++] = slot;
+    }
+
+    if (found == 0) return NULL;
+    if (found == 1) return count == 1 ? lb->backends[picks[0]] : NULL;
+    return lb->backends[load(lb, picks[1]) < load(lb, picks[0]) ? picks[1] : picks[0]];
+}
+
+// Full scan over the UP bitmap: a word of zeros skips 64 backends, and
+// only the packed view arrays are read for the ones that are up
+static backend_t* lb_select_min(loadbalancer_t* lb, uint64_t (*load)(loadbalancer_t*, uint32_t)) {
+    uint32_t count = lb->backend_count;
+    uint64_t min_load = UINT64_MAX;
+    int64_t best = -1;
+
+    for (uint32_t base = 0; base < count; base += 64) {
+        uint64_t bits = atomic_load_explicit(&lb->view.up[base >> 6], memory_order_relaxed);
+        while (bits) {
+            uint32_t slot = base + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            if (slot >= count) break;
+
+            uint64_t l = load(lb, slot);
+            if (l < min_load) {
+                min_load = l;
+                best = slot;
+            }
+        }
+    }
+    return best >= 0 ? lb->backends[best] : NULL;
+}
+
+// Peak-EWMA: a response slower than the current estimate replaces it
+// outright, faster ones are blended in with a weight that depends on how
+// long ago the last sample was. A backend that starts to struggle is
+// avoided after one slow response and only slowly trusted again.
+void lb_backend_observe_latency(backend_t* b, uint64_t rtt_ns, uint64_t now_ns) {
+    uint64_t cost = atomic_load_explicit(&b->ewma_cost_ns, memory_order_relaxed);
+    uint64_t stamp = atomic_load_explicit(&b->ewma_stamp_ns, memory_order_relaxed);
+
+    if (rtt_ns > cost) {
+        cost = rtt_ns;
+    } else {
+        double elapsed = now_ns > stamp ? (double)(now_ns - stamp) : 0.0;
+        double w = exp(-elapsed / PEAK_EWMA_DECAY_NS);
+        cost = (uint64_t)(cost * w + rtt_ns * (1.0 - w));
+    }
+
+    // Racing workers may lose an update; either sample is a fair estimate
+    atomic_store_explicit(&b->ewma_cost_ns, cost, memory_order_relaxed);
+    atomic_store_explicit(&b->ewma_stamp_ns, now_ns, memory_order_relaxed);
+}
+
+// The latency estimate, decayed toward zero while no samples arrive so
+// idle backends get probed again
+static uint64_t lb_backend_ewma_cost(backend_t* b, uint64_t now_ns) {
+    uint64_t cost = atomic_load_explicit(&b->ewma_cost_ns, memory_order_relaxed);
+    uint64_t stamp = atomic_load_explicit(&b->ewma_stamp_ns, memory_order_relaxed);
+
+    double elapsed = now_ns > stamp ? (double)(now_ns - stamp) : 0.0;
+    return (uint64_t)(cost * exp(-elapsed / PEAK_EWMA_DECAY_NS));
+}
+
+// Estimated wait for one more request: the decayed latency estimate
+// times the requests already queued there
+uint64_t lb_backend_ewma_load(backend_t* b, uint64_t now_ns) {
+    uint32_t pending = atomic_load_explicit(&b->pending_requests, memory_order_relaxed);
+    uint64_t decayed = lb_backend_ewma_cost(b, now_ns);
+
+    // Nothing measured yet: rank by queue depth behind every measured one
+    if (decayed == 0 && pending > 0) {
+        return PEAK_EWMA_PENALTY_NS + pending;
+    }
+    return decayed * (pending + 1);
+}
+
+static uint64_t lb_slot_ewma_load(loadbalancer_t* lb, uint32_t slot) {
+    return lb_backend_ewma_load(lb->backends[slot], lb_now_ns());
+}
+
+void lb_request_sent(lb_connection_t* conn) {
+    if (conn->request_sent_ns || !conn->backend) return;
+    conn->request_sent_ns = lb_clock_precise_ns();
+    atomic_fetch_add_explicit(&conn->backend->pending_requests, 1, memory_order_relaxed);
+}
+
+void lb_request_answered(lb_connection_t* conn) {
+    if (!conn->request_sent_ns) return;
+    uint64_t now = lb_clock_precise_ns();
+    lb_backend_observe_latency(conn->backend, now - conn->request_sent_ns, now);
+    atomic_fetch_sub_explicit(&conn->backend->pending_requests, 1, memory_order_relaxed);
+    conn->request_sent_ns = 0;
+}
+
+void lb_request_abort(lb_connection_t* conn) {
+    if (!conn->request_sent_ns) return;
+    atomic_fetch_sub_explicit(&conn->backend->pending_requests, 1, memory_order_relaxed);
+    conn->request_sent_ns = 0;
+}
+
+static void lb_outlier_eject(loadbalancer_t* lb, backend_t* b, uint64_t now, const char* why) {
+    if (atomic_load_explicit(&b->ejected_until_ns, memory_order_relaxed)) return;
+
+    // Keep enough backends to carry the traffic, and never the last one
+    uint32_t ejected = atomic_fetch_add(&lb->outlier_ejected, 1) + 1;
+    if ((uint64_t)ejected * 100 > (uint64_t)lb->backend_count * lb->config.outlier_max_pct) {
+        atomic_fetch_sub(&lb->outlier_ejected, 1);
+        return;
+    }
+
+    uint32_t n = atomic_fetch_add(&b->outlier_ejections, 1);
+    uint64_t ms = (uint64_t)lb->config.outlier_ejection_ms << (n < 16 ? n : 16);
+    if (ms > lb->config.outlier_max_ejection_ms) ms = lb->config.outlier_max_ejection_ms;
+
+    uint64_t expected = 0;
+    if (!atomic_compare_exchange_strong(&b->ejected_until_ns, &expected, now + ms * 1000000ULL)) {
+        // Another worker got there first
+        atomic_fetch_sub(&b->outlier_ejections, 1);
+        atomic_fetch_sub(&lb->outlier_ejected, 1);
+        return;
+    }
+
+    uint64_t bit = 1ULL << (b->slot & 63);
+    atomic_fetch_and(&lb->view.up[b->slot >> 6], ~bit);
+    atomic_fetch_and(&lb->view.warming[b->slot >> 6], ~bit);
+    log_warning("Backend %s:%u ejected for %lums (%s)", b->host, b->port, ms, why);
+}
+
+// Called for every exchange, so the common case (OK, nothing to reset)
+// is one load plus one add
+void lb_outlier_report(loadbalancer_t* lb, backend_t* b, lb_outcome_t outcome) {
+    const config_t* cfg = &lb->config;
+    if (!cfg->outlier_consecutive && !cfg->outlier_error_pct) return;
+
+    uint64_t now = lb_now_ns();
+    bool error = outcome != LB_OUTCOME_OK;
+
+    if (cfg->outlier_consecutive) {
+        if (outcome == LB_OUTCOME_CONNECT_FAIL || outcome == LB_OUTCOME_RESET) {
+            uint32_t run = atomic_fetch_add_explicit(&b->outlier_consecutive, 1, memory_order_relaxed) + 1;
+            if (run >= cfg->outlier_consecutive) {
+                lb_outlier_eject(lb, b, now, outcome == LB_OUTCOME_RESET ? "consecutive resets"
+                                                                         : "consecutive connect failures");
+            }
+        } else if (atomic_load_explicit(&b->outlier_consecutive, memory_order_relaxed)) {
+            atomic_store_explicit(&b->outlier_consecutive, 0, memory_order_relaxed);
+        }
+    }
+
+    if (!cfg->outlier_error_pct || !cfg->outlier_window_ms) return;
+
+    uint64_t window = now / ((uint64_t)cfg->outlier_window_ms * 1000000ULL);
+    uint64_t seen = atomic_load_explicit(&b->outlier_window, memory_order_relaxed);
+    uint32_t cur = window & 1;
+    if (seen != window &&
+        atomic_compare_exchange_strong(&b->outlier_window, &seen, window)) {
+        // The winner clears the bucket it moves into, and the other one
+        // as well when a whole window went by without traffic
+        atomic_store_explicit(&b->outlier_requests[cur], 0, memory_order_relaxed);
+        atomic_store_explicit(&b->outlier_errors[cur], 0, memory_order_relaxed);
+        if (window - seen > 1) {
+            atomic_store_explicit(&b->outlier_requests[cur ^ 1], 0, memory_order_relaxed);
+            atomic_store_explicit(&b->outlier_errors[cur ^ 1], 0, memory_order_relaxed);
+        }
+    }
+
+    uint32_t requests = atomic_fetch_add_explicit(&b->outlier_requests[cur], 1, memory_order_relaxed) + 1;
+    if (!error) return;
+    uint32_t errors = atomic_fetch_add_explicit(&b->outlier_errors[cur], 1, memory_order_relaxed) + 1;
+
+    // This window plus the previous one
+    requests += atomic_load_explicit(&b->outlier_requests[cur ^ 1], memory_order_relaxed);
+    errors += atomic_load_explicit(&b->outlier_errors[cur ^ 1], memory_order_relaxed);
+    if (requests >= cfg->outlier_min_requests &&
+        (uint64_t)errors * 100 >= (uint64_t)requests * cfg->outlier_error_pct) {
+        lb_outlier_eject(lb, b, now, "error rate");
+    }
+}
+
+// Re-admit backends whose ejection ran out. The backoff exponent is
+// forgotten once a backend has stayed in for the longest ejection.
+void lb_outlier_sweep(loadbalancer_t* lb, uint64_t now_ns) {
+    uint64_t forget_ns = (uint64_t)lb->config.outlier_max_ejection_ms * 1000000ULL;
+
+    for (uint32_t i = 0; i < lb->backend_count; i++) {
+        backend_t* b = lb->backends[i];
+        if (!b) continue;
+
+        uint64_t until = atomic_load(&b->ejected_until_ns);
+        if (!until) {
+            uint64_t readmit = atomic_load_explicit(&b->outlier_readmit_ns, memory_order_relaxed);
+            if (readmit && now_ns - readmit >= forget_ns) {
+                atomic_store(&b->outlier_ejections, 0);
+                atomic_store(&b->outlier_readmit_ns, 0);
+            }
+            continue;
+        }
+        if (now_ns < until) continue;
+
+        atomic_store(&b->outlier_consecutive, 0);
+        for (int w = 0; w < 2; w++) {
+            atomic_store(&b->outlier_requests[w], 0);
+            atomic_store(&b->outlier_errors[w], 0);
+        }
+        atomic_store(&b->outlier_readmit_ns, now_ns);
+        atomic_store(&b->ejected_until_ns, 0);
+        atomic_fetch_sub(&lb->outlier_ejected, 1);
+
+        if (atomic_load(&b->state) == BACKEND_UP) {
+            lb_backend_publish_up(lb, b, true);
+            log_info("Backend %s:%u re-admitted", b->host, b->port);
+        }
+    }
+}
+
+static backend_t* lb_select_by_algorithm(loadbalancer_t* lb, struct sockaddr_in* client_addr) {
     backend_t* selected = NULL;
-    uint32_t min_conns = UINT32_MAX;
 
     switch (lb->algorithm) {
         case LB_ALGO_ROUNDROBIN: {
             uint32_t attempts = 0;
             while (attempts < lb->backend_count) {
                 uint32_t idx = atomic_fetch_add(&lb->round_robin_idx, 1) % lb->backend_count;
-                backend_t* b = lb->backends[idx];
-                if (b && atomic_load(&b->state) == BACKEND_UP) {
-                    return b;
+                if (lb_backend_slot_up(lb, idx)) {
+                    return lb->backends[idx];
                 }
                 attempts++;
             }
             break;
         }
 
-        case LB_ALGO_LEASTCONN: {
-            for (uint32_t i = 0; i < lb->backend_count; i++) {
-                backend_t* b = lb->backends[i];
-                if (b && atomic_load(&b->state) == BACKEND_UP) {
-                    uint32_t conns = atomic_load(&b->active_conns);
-                    if (conns < min_conns) {
-                        min_conns = conns;
-                        selected = b;
-                    }
-                }
-            }
+        case LB_ALGO_LEASTCONN_P2C:
+            selected = lb_select_p2c(lb, lb_slot_load);
+            if (selected) return selected;
+            // Too few UP backends to sample: fall back to the full scan
+            __attribute__((fallthrough));
+
+        case LB_ALGO_LEASTCONN:
+            selected = lb_select_min(lb, lb_slot_load);
+            break;
+
+        case LB_ALGO_PEAK_EWMA:
+            selected = lb_select_p2c(lb, lb_slot_ewma_load);
+            if (!selected) selected = lb_select_min(lb, lb_slot_ewma_load);
             break;
-        }
 
         case LB_ALGO_SOURCE: {
             uint32_t hash = client_addr->sin_addr.s_addr;
@@ -193,37 +502,48 @@ backend_t* lb_select_backend(loadbalancer_t* lb, struct sockaddr_in* client_addr
             hash = ((hash >> 16) ^ hash) * 0x45d9f3b;
             hash = (hash >> 16) ^ hash;
 
+            // Maglev table when one is published; the probe below only
+            // covers the window before the first build
+            if (lb->consistent_hash) {
+                backend_t* b = consistent_hash_lookup(lb->consistent_hash, hash);
+                if (b) return b;
+            }
+
             uint32_t idx = hash % lb->backend_count;
             for (uint32_t i = 0; i < lb->backend_count; i++) {
                 uint32_t try_idx = (idx + i) % lb->backend_count;
-                backend_t* b = lb->backends[try_idx];
-                if (b && atomic_load(&b->state) == BACKEND_UP) {
-                    return b;
+                if (lb_backend_slot_up(lb, try_idx)) {
+                    return lb->backends[try_idx];
                 }
             }
             break;
         }
 
         case LB_ALGO_STICKY: {
+            // Precomputed smooth weighted schedule; the weighted random
+            // pick below only runs before the first build
+            if (lb->wrr) {
+                backend_t* b = lb_wrr_next(lb->wrr);
+                if (b) return b;
+            }
+
             uint32_t total_weight = 0;
             for (uint32_t i = 0; i < lb->backend_count; i++) {
-                backend_t* b = lb->backends[i];
-                if (b && atomic_load(&b->state) == BACKEND_UP) {
-                    total_weight += atomic_load(&b->weight);
+                if (lb_backend_slot_up(lb, i)) {
+                    total_weight += atomic_load_explicit(&lb->view.weight[i], memory_order_relaxed);
                 }
             }
 
             if (total_weight == 0) break;
 
-            uint32_t random_weight = (rand() % total_weight) + 1;
+            uint32_t random_weight = lb_rand_range(total_weight) + 1;
             uint32_t current_weight = 0;
 
             for (uint32_t i = 0; i < lb->backend_count; i++) {
-                backend_t* b = lb->backends[i];
-                if (b && atomic_load(&b->state) == BACKEND_UP) {
-                    current_weight += atomic_load(&b->weight);
+                if (lb_backend_slot_up(lb, i)) {
+                    current_weight += atomic_load_explicit(&lb->view.weight[i], memory_order_relaxed);
                     if (random_weight <= current_weight) {
-                        return b;
+                        return lb->backends[i];
                     }
                 }
             }
@@ -231,12 +551,14 @@ backend_t* lb_select_backend(loadbalancer_t* lb, struct sockaddr_in* client_addr
         }
 
         case LB_ALGO_RANDOM: {
+            // Least response time, from the same TTFB estimate as peak-EWMA
             uint64_t min_response_time = UINT64_MAX;
+            uint64_t now = lb_now_ns();
             for (uint32_t i = 0; i < lb->backend_count; i++) {
                 backend_t* b = lb->backends[i];
-                if (b && atomic_load(&b->state) == BACKEND_UP) {
-                    uint64_t rt = atomic_load(&b->response_time_ns);
-                    uint32_t conns = atomic_load(&b->active_conns);
+                if (lb_backend_slot_up(lb, i)) {
+                    uint64_t rt = lb_backend_ewma_cost(b, now);
+                    uint32_t conns = atomic_load_explicit(&lb->view.conns[i], memory_order_relaxed);
                     uint64_t score = rt * (conns + 1);
                     if (score < min_response_time) {
                         min_response_time = score;
@@ -252,4 +574,43 @@ backend_t* lb_select_backend(loadbalancer_t* lb, struct sockaddr_in* client_addr
     }
 
     return selected;
-}
\ No newline at end of file
+}
+
+#define SLOW_START_ATTEMPTS 3
+
+// Least-conn variants fold slow-start into the effective weight. Every
+// other algorithm keeps its pick of a warming backend with probability
+// equal to the ramp factor, and otherwise picks again. When every retry
+// lands on a warming backend, the weighted least-loaded backend wins.
+backend_t* lb_select_backend(loadbalancer_t* lb, struct sockaddr_in* client_addr) {
+    backend_t* selected = lb_select_by_algorithm(lb, client_addr);
+
+    // Hash and weighted tables are built from backend state and still
+    // list ejected backends
+    if (selected && !lb_backend_slot_up(lb, selected->slot)) {
+        selected = lb_select_min(lb, lb_slot_load);
+    }
+    if (!selected || !lb->config.slow_start_ms) return selected;
+
+    switch (lb->algorithm) {
+        case LB_ALGO_LEASTCONN:
+        case LB_ALGO_LEASTCONN_P2C:
+            return selected;
+        default:
+            break;
+    }
+
+    for (int attempt = 0; attempt < SLOW_START_ATTEMPTS; attempt++) {
+        if (!lb_backend_slot_warming(lb, selected->slot)) return selected;
+        uint32_t factor = lb_slow_start_factor(lb, selected, lb_now_ns());
+        if (lb_rand_range(LB_SLOW_START_FULL) < factor) return selected;
+
+        backend_t* next = lb_select_by_algorithm(lb, client_addr);
+        if (!next) return selected;
+        selected = next;
+    }
+
+    if (!lb_backend_slot_warming(lb, selected->slot)) return selected;
+    backend_t* fallback = lb_select_min(lb, lb_slot_load);
+    return fallback ? fallback : selected;
+}
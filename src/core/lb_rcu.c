@@ -0,0 +1,122 @@
+#include "core/lb_rcu.h"
+#include "core/lb_types.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+// Each reader slot records the global epoch the reader saw at its last
+// quiescent state; 0 marks a free or offline slot. An object retired at
+// epoch E can go once every online slot has seen E or later.
+typedef struct lb_rcu_reader {
+    _Atomic uint64_t seen;
+    _Atomic bool used;
+} __attribute__((aligned(CACHE_LINE_SIZE))) lb_rcu_reader_t;
+
+typedef struct lb_rcu_retired {
+    void* ptr;
+    void (*free_fn)(void*);
+    uint64_t epoch;
+    struct lb_rcu_retired* next;
+} lb_rcu_retired_t;
+
+static lb_rcu_reader_t lb_rcu_readers[LB_RCU_MAX_READERS];
+static _Atomic uint64_t lb_rcu_epoch = 1;
+static __thread int lb_rcu_slot = -1;
+
+static pthread_mutex_t lb_rcu_lock = PTHREAD_MUTEX_INITIALIZER;
+static lb_rcu_retired_t* lb_rcu_pending = NULL;
+
+int lb_rcu_register(void) {
+    if (lb_rcu_slot >= 0) return 0;
+
+    for (int i = 0; i < LB_RCU_MAX_READERS; i++) {
+        bool expected = false;
+        if (!atomic_compare_exchange_strong(&lb_rcu_readers[i].used, &expected, true)) continue;
+
+        atomic_store(&lb_rcu_readers[i].seen, atomic_load(&lb_rcu_epoch));
+        // Order the slot going online before any RCU pointer is loaded
+        atomic_thread_fence(memory_order_seq_cst);
+        lb_rcu_slot = i;
+        return 0;
+    }
+    return -1;
+}
+
+void lb_rcu_unregister(void) {
+    if (lb_rcu_slot < 0) return;
+
+    lb_rcu_reader_t* r = &lb_rcu_readers[lb_rcu_slot];
+    atomic_store_explicit(&r->seen, 0, memory_order_release);
+    atomic_store_explicit(&r->used, false, memory_order_release);
+    lb_rcu_slot = -1;
+}
+
+void lb_rcu_quiescent(void) {
+    if (lb_rcu_slot < 0) return;
+
+    uint64_t epoch = atomic_load_explicit(&lb_rcu_epoch, memory_order_acquire);
+    lb_rcu_reader_t* r = &lb_rcu_readers[lb_rcu_slot];
+    // Skip the store (and the cache line transfer) when nothing was retired
+    if (atomic_load_explicit(&r->seen, memory_order_relaxed) != epoch) {
+        atomic_store_explicit(&r->seen, epoch, memory_order_release);
+    }
+}
+
+bool lb_rcu_online(void) {
+    return lb_rcu_slot >= 0;
+}
+
+void lb_rcu_retire(void* ptr, void (*free_fn)(void*)) {
+    if (!ptr) return;
+
+    lb_rcu_retired_t* node = malloc(sizeof(*node));
+    if (!node) {
+        // Better to leak one object than to free it under a reader
+        return;
+    }
+
+    node->ptr = ptr;
+    node->free_fn = free_fn;
+
+    pthread_mutex_lock(&lb_rcu_lock);
+    // The caller already swapped the pointer; readers that see the new
+    // epoch can only see the new object
+    node->epoch = atomic_fetch_add(&lb_rcu_epoch, 1) + 1;
+    node->next = lb_rcu_pending;
+    lb_rcu_pending = node;
+    pthread_mutex_unlock(&lb_rcu_lock);
+
+    lb_rcu_reclaim();
+}
+
+void lb_rcu_reclaim(void) {
+    uint64_t min_seen = UINT64_MAX;
+    for (int i = 0; i < LB_RCU_MAX_READERS; i++) {
+        uint64_t seen = atomic_load_explicit(&lb_rcu_readers[i].seen, memory_order_acquire);
+        if (seen && seen < min_seen) min_seen = seen;
+    }
+
+    lb_rcu_retired_t* ready = NULL;
+
+    pthread_mutex_lock(&lb_rcu_lock);
+    lb_rcu_retired_t** link = &lb_rcu_pending;
+    while (*link) {
+        lb_rcu_retired_t* node = *link;
+        if (node->epoch <= min_seen) {
+            *link = node->next;
+            node->next = ready;
+            ready = node;
+        } else {
+            link = &node->next;
+        }
+    }
+    pthread_mutex_unlock(&lb_rcu_lock);
+
+    while (ready) {
+        lb_rcu_retired_t* next = ready->next;
+        ready->free_fn(ready->ptr);
+        free(ready);
+        ready = next;
+    }
+}
@@ -0,0 +1,250 @@
+#include "core/lb_shm.h"
+#include "core/loadbalancer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#define LB_SHM_MAGIC    0x55424853  // "UBHS"
+#define LB_SHM_VERSION  1
+
+// One backend as the leader last saw it. The leader rewrites it under a
+// seqlock (odd seq = write in progress), like lb_dns does for addresses.
+typedef struct lb_shm_entry {
+    _Atomic uint32_t seq;
+    uint32_t state;
+    uint64_t key;               // murmur3_64 of "host:port", 0 for an empty slot
+    uint64_t check_rtt_ns;
+    uint64_t ewma_cost_ns;
+    uint64_t ewma_stamp_ns;
+    uint64_t last_check_ns;
+    uint32_t conns;             // the leader's own active connections
+    uint32_t failed_checks;
+} __attribute__((aligned(CACHE_LINE_SIZE))) lb_shm_entry_t;
+
+typedef struct lb_shm_segment {
+    uint32_t magic;
+    uint32_t version;
+    _Atomic int32_t leader_pid;
+    _Atomic uint32_t count;
+    _Atomic uint64_t generation;    // bumped whenever entry positions change
+    _Atomic uint64_t heartbeat_ns;
+    lb_shm_entry_t entries[MAX_BACKENDS];
+} lb_shm_segment_t;
+
+struct lb_shm {
+    int fd;
+    bool leader;
+    lb_shm_segment_t* seg;
+
+    // Follower: local slot -> entry index. It is valid for one
+    // (generation, count, backend_count) triple.
+    uint64_t generation;
+    uint32_t count;
+    uint32_t local_count;
+    int32_t index[MAX_BACKENDS];
+    uint64_t merged_stamp[MAX_BACKENDS];    // leader EWMA sample already taken
+    uint64_t keys[MAX_BACKENDS];
+};
+
+static uint64_t lb_shm_key(lb_shm_t* shm, backend_t* b) {
+    if (!shm->keys[b->slot]) {
+        char name[512];
+        int len = snprintf(name, sizeof(name), "%s:%u", b->host, b->port);
+        uint64_t key = murmur3_64(name, len, 0x75627368);
+        shm->keys[b->slot] = key ? key : 1;
+    }
+    return shm->keys[b->slot];
+}
+
+lb_shm_t* lb_shm_open(const char* name) {
+    char path[NAME_MAX];
+    snprintf(path, sizeof(path), "%s%s", name[0] == '/' ? "" : "/", name);
+
+    int fd = shm_open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) return NULL;
+
+    // Every process sizes the segment; growing it to the same length twice
+    // is harmless
+    struct stat st;
+    if (fstat(fd, &st) < 0 ||
+        ((size_t)st.st_size < sizeof(lb_shm_segment_t) &&
+         ftruncate(fd, sizeof(lb_shm_segment_t)) < 0)) {
+        close(fd);
+        return NULL;
+    }
+
+    lb_shm_t* shm = calloc(1, sizeof(*shm));
+    if (!shm) {
+        close(fd);
+        return NULL;
+    }
+
+    shm->fd = fd;
+    shm->seg = mmap(NULL, sizeof(lb_shm_segment_t), PROT_READ, MAP_SHARED, fd, 0);
+    if (shm->seg == MAP_FAILED) {
+        close(fd);
+        free(shm);
+        return NULL;
+    }
+    shm->generation = UINT64_MAX;
+    return shm;
+}
+
+void lb_shm_close(lb_shm_t* shm) {
+    if (!shm) return;
+
+    // The segment stays for the other processes; closing the fd drops
+    // the leader lock
+    munmap(shm->seg, sizeof(lb_shm_segment_t));
+    close(shm->fd);
+    free(shm);
+}
+
+bool lb_shm_try_lead(lb_shm_t* shm) {
+    if (shm->leader) return true;
+    if (flock(shm->fd, LOCK_EX | LOCK_NB) < 0) return false;
+
+    // Followers only ever read the segment; the fd was opened O_RDWR, so
+    // the mapping can be made writable in place
+    if (mprotect(shm->seg, sizeof(lb_shm_segment_t), PROT_READ | PROT_WRITE) < 0) {
+        flock(shm->fd, LOCK_UN);
+        return false;
+    }
+
+    lb_shm_segment_t* seg = shm->seg;
+    seg->magic = LB_SHM_MAGIC;
+    seg->version = LB_SHM_VERSION;
+    atomic_store(&seg->leader_pid, (int32_t)getpid());
+    atomic_store(&seg->count, 0);
+    atomic_fetch_add(&seg->generation, 1);
+    shm->leader = true;
+    return true;
+}
+
+void lb_shm_publish(lb_shm_t* shm, loadbalancer_t* lb) {
+    if (!shm->leader) return;
+
+    lb_shm_segment_t* seg = shm->seg;
+    uint32_t count = lb->backend_count;
+
+    for (uint32_t i = 0; i < count; i++) {
+        backend_t* b = lb->backends[i];
+        lb_shm_entry_t* e = &seg->entries[i];
+        uint32_t seq = atomic_load_explicit(&e->seq, memory_order_relaxed);
+
+        atomic_store_explicit(&e->seq, seq + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        if (b) {
+            e->key = lb_shm_key(shm, b);
+            e->state = atomic_load(&b->state);
+            e->check_rtt_ns = atomic_load(&b->check_rtt_ns);
+            e->ewma_cost_ns = atomic_load(&b->ewma_cost_ns);
+            e->ewma_stamp_ns = atomic_load(&b->ewma_stamp_ns);
+            e->last_check_ns = atomic_load(&b->last_check_ns);
+            e->conns = lb_backend_conns(lb, b);
+            e->failed_checks = atomic_load(&b->failed_conns);
+        } else {
+            e->key = 0;
+        }
+        atomic_store_explicit(&e->seq, seq + 2, memory_order_release);
+    }
+
+    // Backends are only appended, so existing positions stay valid
+    if (atomic_load_explicit(&seg->count, memory_order_relaxed) != count) {
+        atomic_store_explicit(&seg->count, count, memory_order_release);
+        atomic_fetch_add_explicit(&seg->generation, 1, memory_order_release);
+    }
+    atomic_store_explicit(&seg->heartbeat_ns, get_time_ns(), memory_order_release);
+}
+
+static void lb_shm_read(const lb_shm_entry_t* e, lb_shm_entry_t* out) {
+    uint32_t seq;
+    do {
+        seq = atomic_load_explicit(&e->seq, memory_order_acquire);
+        if (seq & 1) continue;  // Leader writing, retry
+
+        memcpy((char*)out + sizeof(out->seq), (const char*)e + sizeof(e->seq),
+               sizeof(*e) - sizeof(e->seq));
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) || atomic_load_explicit(&e->seq, memory_order_relaxed) != seq);
+}
+
+// Matches local backends to the leader's entries by name. The two
+// processes may list their backends in different orders.
+static void lb_shm_reindex(lb_shm_t* shm, loadbalancer_t* lb, uint64_t generation, uint32_t count) {
+    lb_shm_entry_t snap;
+
+    for (uint32_t i = 0; i < lb->backend_count; i++) {
+        shm->index[i] = -1;
+        backend_t* b = lb->backends[i];
+        if (!b) continue;
+
+        uint64_t key = lb_shm_key(shm, b);
+        for (uint32_t j = 0; j < count && j < MAX_BACKENDS; j++) {
+            lb_shm_read(&shm->seg->entries[j], &snap);
+            if (snap.key == key) {
+                shm->index[i] = (int32_t)j;
+                break;
+            }
+        }
+    }
+    shm->generation = generation;
+    shm->count = count;
+    shm->local_count = lb->backend_count;
+}
+
+int lb_shm_follow(lb_shm_t* shm, loadbalancer_t* lb, uint32_t stale_ms) {
+    lb_shm_segment_t* seg = shm->seg;
+    uint64_t now = get_time_ns();
+
+    uint64_t beat = atomic_load_explicit(&seg->heartbeat_ns, memory_order_acquire);
+    if (seg->magic != LB_SHM_MAGIC || seg->version != LB_SHM_VERSION ||
+        now - beat > (uint64_t)stale_ms * 1000000ULL) {
+        return -1;
+    }
+
+    uint64_t generation = atomic_load_explicit(&seg->generation, memory_order_acquire);
+    uint32_t count = atomic_load_explicit(&seg->count, memory_order_acquire);
+    if (generation != shm->generation || count != shm->count ||
+        lb->backend_count != shm->local_count) {
+        lb_shm_reindex(shm, lb, generation, count);
+    }
+
+    int changed = 0;
+    lb_shm_entry_t snap;
+    for (uint32_t i = 0; i < lb->backend_count; i++) {
+        backend_t* b = lb->backends[i];
+        if (!b || shm->index[i] < 0) continue;
+
+        lb_shm_read(&seg->entries[shm->index[i]], &snap);
+        if (snap.key != lb_shm_key(shm, b)) {
+            shm->generation = UINT64_MAX;   // Slot reused, match again next time
+            continue;
+        }
+
+        backend_state_t state = (backend_state_t)snap.state;
+        if (atomic_load(&b->state) != state) {
+            lb_backend_set_state(lb, b, state);
+            changed++;
+            printf("[HEALTH] Backend %s:%u is now %s (shared state, leader pid %d)\n",
+                   b->host, b->port, state == BACKEND_UP ? "UP" : "DOWN",
+                   atomic_load(&seg->leader_pid));
+        }
+        atomic_store(&b->check_rtt_ns, snap.check_rtt_ns);
+        atomic_store(&b->last_check_ns, snap.last_check_ns);
+
+        // The leader's latency estimate counts as one more sample, so
+        // both processes rank backends from the same evidence
+        if (snap.ewma_stamp_ns > shm->merged_stamp[i]) {
+            shm->merged_stamp[i] = snap.ewma_stamp_ns;
+            lb_backend_observe_latency(b, snap.ewma_cost_ns, now);
+        }
+    }
+    return changed;
+}
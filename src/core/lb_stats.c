@@ -0,0 +1,69 @@
+#include "core/lb_stats.h"
+#include <stdlib.h>
+#include <string.h>
+
+__thread lb_worker_stats_t* lb_stats_local = NULL;
+
+int lb_stats_init(lb_worker_stats_t* stats, uint32_t backend_slots) {
+    memset(stats, 0, sizeof(*stats));
+    if (backend_slots == 0) return 0;
+
+    // Separate allocation per worker, so no two workers share a line
+    size_t size = (size_t)backend_slots * 2 * sizeof(stats->backend_bytes[0]);
+    size = (size + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+    void* mem = aligned_alloc(CACHE_LINE_SIZE, size);
+    if (!mem) return -1;
+
+    memset(mem, 0, size);
+    stats->backend_bytes = mem;
+    stats->backend_slots = backend_slots;
+    return 0;
+}
+
+void lb_stats_release(lb_worker_stats_t* stats) {
+    free((void*)stats->backend_bytes);
+    stats->backend_bytes = NULL;
+    stats->backend_slots = 0;
+}
+
+void lb_stats_bind(lb_worker_stats_t* stats) {
+    lb_stats_local = stats;
+}
+
+void lb_stats_snapshot(loadbalancer_t* lb, lb_stats_snapshot_t* out) {
+    out->total_requests = atomic_load(&lb->global_stats.total_requests);
+    out->failed_requests = atomic_load(&lb->global_stats.failed_requests);
+    out->bytes_in = atomic_load(&lb->global_stats.bytes_in);
+    out->bytes_out = atomic_load(&lb->global_stats.bytes_out);
+    out->active_connections = (int32_t)atomic_load(&lb->global_stats.active_connections);
+
+    if (!lb->worker_ctx) return;
+    for (uint32_t i = 0; i < lb->worker_threads; i++) {
+        lb_worker_stats_t* s = &lb->worker_ctx[i].stats;
+        out->total_requests += atomic_load_explicit(&s->total_requests, memory_order_relaxed);
+        out->failed_requests += atomic_load_explicit(&s->failed_requests, memory_order_relaxed);
+        out->bytes_in += atomic_load_explicit(&s->bytes_in, memory_order_relaxed);
+        out->bytes_out += atomic_load_explicit(&s->bytes_out, memory_order_relaxed);
+        // A connection may close on another worker than the one that
+        // accepted it; only the sum is meaningful
+        out->active_connections += atomic_load_explicit(&s->active_connections, memory_order_relaxed);
+    }
+}
+
+void lb_stats_backend_bytes(loadbalancer_t* lb, backend_t* backend,
+                            uint64_t* bytes_in, uint64_t* bytes_out) {
+    uint64_t in = atomic_load(&backend->stats.bytes_in);
+    uint64_t out = atomic_load(&backend->stats.bytes_out);
+
+    if (lb->worker_ctx) {
+        for (uint32_t i = 0; i < lb->worker_threads; i++) {
+            lb_worker_stats_t* s = &lb->worker_ctx[i].stats;
+            if (backend->slot >= s->backend_slots) continue;
+            in += atomic_load_explicit(&s->backend_bytes[backend->slot * 2], memory_order_relaxed);
+            out += atomic_load_explicit(&s->backend_bytes[backend->slot * 2 + 1], memory_order_relaxed);
+        }
+    }
+
+    *bytes_in = in;
+    *bytes_out = out;
+}
@@ -0,0 +1,143 @@
+#include "core/lb_timer.h"
+#include <stdlib.h>
+
+#define LB_TIMER_MASK (LB_TIMER_SLOTS - 1)
+
+static inline void lb_timer_list_init(lb_timer_t* head) {
+    head->next = head->prev = head;
+}
+
+static inline void lb_timer_link(lb_timer_t* head, lb_timer_t* timer) {
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+static inline void lb_timer_unlink(lb_timer_t* timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = timer->prev = NULL;
+}
+
+// Level is picked by how far out the timer is, slot by the matching bits of
+// its expiry, so a level-n slot is emptied exactly when the levels below it
+// wrap around to it.
+static void lb_timer_place(lb_timer_wheel_t* wheel, lb_timer_t* timer) {
+    uint64_t expires = timer->expires;
+    if (expires <= wheel->now) expires = wheel->now + 1;
+
+    uint64_t delta = expires - wheel->now;
+    int level = 0;
+    while (level < LB_TIMER_LEVELS - 1 &&
+           delta >= (1ULL << (LB_TIMER_BITS * (level + 1)))) {
+        level++;
+    }
+
+    // Beyond the top level: park in its farthest slot and re-place later
+    if (delta >= (1ULL << (LB_TIMER_BITS * LB_TIMER_LEVELS))) {
+        expires = wheel->now + (1ULL << (LB_TIMER_BITS * LB_TIMER_LEVELS)) - 1;
+    }
+
+    uint32_t slot = (expires >> (LB_TIMER_BITS * level)) & LB_TIMER_MASK;
+    lb_timer_link(&wheel->slots[level][slot], timer);
+}
+
+lb_timer_wheel_t* lb_timer_wheel_create(uint64_t now_ms) {
+    lb_timer_wheel_t* wheel = malloc(sizeof(*wheel));
+    if (!wheel) return NULL;
+
+    wheel->now = now_ms / LB_TIMER_TICK_MS;
+    wheel->count = 0;
+    for (int l = 0; l < LB_TIMER_LEVELS; l++) {
+        for (int s = 0; s < LB_TIMER_SLOTS; s++) {
+            lb_timer_list_init(&wheel->slots[l][s]);
+        }
+    }
+    return wheel;
+}
+
+void lb_timer_wheel_destroy(lb_timer_wheel_t* wheel) {
+    free(wheel);
+}
+
+void lb_timer_schedule(lb_timer_wheel_t* wheel, lb_timer_t* timer, uint64_t expires_ms) {
+    if (lb_timer_pending(timer)) {
+        lb_timer_unlink(timer);
+    } else {
+        wheel->count++;
+    }
+
+    // Round up so a timer never fires before its deadline
+    timer->expires = (expires_ms + LB_TIMER_TICK_MS - 1) / LB_TIMER_TICK_MS;
+    lb_timer_place(wheel, timer);
+}
+
+void lb_timer_cancel(lb_timer_wheel_t* wheel, lb_timer_t* timer) {
+    if (!lb_timer_pending(timer)) return;
+    lb_timer_unlink(timer);
+    wheel->count--;
+}
+
+// Re-distribute one slot of a higher level into the levels below
+static uint32_t lb_timer_cascade(lb_timer_wheel_t* wheel, int level) {
+    uint32_t slot = (wheel->now >> (LB_TIMER_BITS * level)) & LB_TIMER_MASK;
+    lb_timer_t* head = &wheel->slots[level][slot];
+
+    lb_timer_t list;
+    lb_timer_list_init(&list);
+    if (head->next != head) {
+        list.next = head->next;
+        list.prev = head->prev;
+        list.next->prev = &list;
+        list.prev->next = &list;
+        lb_timer_list_init(head);
+    }
+
+    while (list.next != &list) {
+        lb_timer_t* timer = list.next;
+        lb_timer_unlink(timer);
+        lb_timer_place(wheel, timer);
+    }
+    return slot;
+}
+
+uint32_t lb_timer_advance(lb_timer_wheel_t* wheel, uint64_t now_ms, lb_timer_fn fn, void* arg) {
+    uint64_t target = now_ms / LB_TIMER_TICK_MS;
+    uint32_t fired = 0;
+
+    while (wheel->now < target) {
+        // Nothing armed: jump straight to the target tick
+        if (wheel->count == 0) {
+            wheel->now = target;
+            break;
+        }
+
+        wheel->now++;
+
+        if ((wheel->now & LB_TIMER_MASK) == 0) {
+            for (int level = 1; level < LB_TIMER_LEVELS; level++) {
+                if (lb_timer_cascade(wheel, level) != 0) break;
+            }
+        }
+
+        lb_timer_t* head = &wheel->slots[0][wheel->now & LB_TIMER_MASK];
+        while (head->next != head) {
+            lb_timer_t* timer = head->next;
+            lb_timer_unlink(timer);
+            wheel->count--;
+
+            // Parked beyond the wheel's range: not due yet
+            if (timer->expires > wheel->now) {
+                wheel->count++;
+                lb_timer_place(wheel, timer);
+                continue;
+            }
+
+            fired++;
+            fn(timer, arg);
+        }
+    }
+
+    return fired;
+}
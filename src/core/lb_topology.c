@@ -0,0 +1,213 @@
+#include "core/lb_topology.h"
+#include "core/lb_alloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+// From <numaif.h>; used through syscall() so libnuma is not required
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED  1
+#endif
+
+#define LB_TOPO_MAX_NODES 64
+
+static int lb_topology_read_int(const char* path, int fallback) {
+    FILE* f = fopen(path, "r");
+    if (!f) return fallback;
+
+    int value;
+    if (fscanf(f, "%d", &value) != 1) value = fallback;
+    fclose(f);
+    return value;
+}
+
+// Parses a kernel CPU list ("0-3,8,10-11") into out[], keeping its order
+static int lb_topology_parse_list(const char* list, int* out, int max) {
+    int n = 0;
+    const char* p = list;
+
+    while (*p && n < max) {
+        while (*p == ',' || isspace((unsigned char)*p)) p++;
+        if (!isdigit((unsigned char)*p)) break;
+
+        char* end;
+        long lo = strtol(p, &end, 10);
+        long hi = lo;
+        if (*end == '-') hi = strtol(end + 1, &end, 10);
+        for (long c = lo; c <= hi && n < max; c++) {
+            if (c >= 0 && c < CPU_SETSIZE) out[n++] = (int)c;
+        }
+        p = end;
+    }
+    return n;
+}
+
+static void lb_topology_fill(lb_cpu_t* entry, int cpu, const int* node_of) {
+    char path[128];
+
+    entry->cpu = cpu;
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+    entry->core = lb_topology_read_int(path, cpu);
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+    entry->package = lb_topology_read_int(path, 0);
+    entry->node = node_of[cpu];
+}
+
+// node_of[cpu] from /sys/devices/system/node/nodeN/cpulist; returns the
+// number of nodes
+static uint32_t lb_topology_nodes(int* node_of) {
+    static int cpus[CPU_SETSIZE];
+    char path[128];
+    char buf[4096];
+    uint32_t nodes = 1;
+
+    memset(node_of, 0, CPU_SETSIZE * sizeof(int));
+    for (int node = 0; node < LB_TOPO_MAX_NODES; node++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE* f = fopen(path, "r");
+        if (!f) continue;
+
+        if (fgets(buf, sizeof(buf), f)) {
+            int n = lb_topology_parse_list(buf, cpus, CPU_SETSIZE);
+            for (int i = 0; i < n; i++) node_of[cpus[i]] = node;
+        }
+        fclose(f);
+        if ((uint32_t)node + 1 > nodes) nodes = node + 1;
+    }
+    return nodes;
+}
+
+static int lb_topology_allowed(cpu_set_t* set) {
+    CPU_ZERO(set);
+    return sched_getaffinity(0, sizeof(*set), set);
+}
+
+typedef struct {
+    lb_cpu_t cpu;
+    int smt_rank;   // 0 for the first sibling of a core
+} lb_topo_sort_t;
+
+static int lb_topology_cmp(const void* a, const void* b) {
+    const lb_topo_sort_t* x = a;
+    const lb_topo_sort_t* y = b;
+
+    if (x->smt_rank != y->smt_rank) return x->smt_rank - y->smt_rank;
+    if (x->cpu.node != y->cpu.node) return x->cpu.node - y->cpu.node;
+    if (x->cpu.package != y->cpu.package) return x->cpu.package - y->cpu.package;
+    if (x->cpu.core != y->cpu.core) return x->cpu.core - y->cpu.core;
+    return x->cpu.cpu - y->cpu.cpu;
+}
+
+// Physical cores come before SMT siblings, and a node is filled before
+// the next one is used: a small worker count stays on one socket, where
+// the shared backend view lives in one last-level cache.
+int lb_topology_detect(lb_topology_t* topo) {
+    static int node_of[CPU_SETSIZE];
+    static lb_topo_sort_t sorted[LB_TOPO_MAX_CPUS];
+    cpu_set_t allowed;
+
+    topo->count = 0;
+    topo->nodes = lb_topology_nodes(node_of);
+    if (lb_topology_allowed(&allowed) < 0) return -1;
+
+    uint32_t n = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE && n < LB_TOPO_MAX_CPUS; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+
+        lb_topology_fill(&sorted[n].cpu, cpu, node_of);
+        sorted[n].smt_rank = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            if (sorted[i].cpu.core == sorted[n].cpu.core &&
+                sorted[i].cpu.package == sorted[n].cpu.package) {
+                sorted[n].smt_rank++;
+            }
+        }
+        n++;
+    }
+
+    qsort(sorted, n, sizeof(sorted[0]), lb_topology_cmp);
+    for (uint32_t i = 0; i < n; i++) topo->cpus[i] = sorted[i].cpu;
+    topo->count = n;
+    return n ? 0 : -1;
+}
+
+// CPUs in the given order; ones outside the process affinity are dropped
+int lb_topology_from_list(lb_topology_t* topo, const char* list) {
+    static int node_of[CPU_SETSIZE];
+    static int cpus[LB_TOPO_MAX_CPUS];
+    cpu_set_t allowed;
+
+    topo->count = 0;
+    topo->nodes = lb_topology_nodes(node_of);
+    if (lb_topology_allowed(&allowed) < 0) return -1;
+
+    int n = lb_topology_parse_list(list, cpus, LB_TOPO_MAX_CPUS);
+    for (int i = 0; i < n; i++) {
+        if (!CPU_ISSET(cpus[i], &allowed)) continue;
+        lb_topology_fill(&topo->cpus[topo->count++], cpus[i], node_of);
+    }
+    return topo->count ? 0 : -1;
+}
+
+// One CPU per interrupt whose /proc/interrupts name contains ifname (the
+// NIC's queue vectors, in queue order): the first CPU of that IRQ's
+// smp_affinity_list, each CPU used once.
+int lb_topology_from_irqs(lb_topology_t* topo, const char* ifname) {
+    char line[4096];
+    char list[1024];
+    char path[64];
+    cpu_set_t seen;
+
+    FILE* f = fopen("/proc/interrupts", "r");
+    if (!f) return -1;
+
+    CPU_ZERO(&seen);
+    list[0] = '\0';
+    size_t used = 0;
+    while (fgets(line, sizeof(line), f)) {
+        char* colon = strchr(line, ':');
+        if (!colon || !strstr(colon, ifname)) continue;
+
+        int irq = atoi(line);
+        if (irq <= 0 && line[strspn(line, " ")] != '0') continue;
+
+        snprintf(path, sizeof(path), "/proc/irq/%d/smp_affinity_list", irq);
+        FILE* a = fopen(path, "r");
+        if (!a) continue;
+
+        char buf[256];
+        int cpu;
+        if (fgets(buf, sizeof(buf), a) && lb_topology_parse_list(buf, &cpu, 1) == 1 &&
+            !CPU_ISSET(cpu, &seen)) {
+            CPU_SET(cpu, &seen);
+            int len = snprintf(list + used, sizeof(list) - used, "%s%d", used ? "," : "", cpu);
+            if (len > 0 && (size_t)len < sizeof(list) - used) used += len;
+        }
+        fclose(a);
+    }
+    fclose(f);
+
+    if (!used) return -1;
+    return lb_topology_from_list(topo, list);
+}
+
+int lb_topology_pin(int cpu, int node) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) return -1;
+
+    // Slab chunks, buffers and rings the worker allocates from here on
+    // come from its own node while that node has free memory
+    if (node >= 0 && node < LB_TOPO_MAX_NODES) {
+        unsigned long mask = 1UL << node;
+        syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, sizeof(mask) * 8);
+        lb_alloc_set_node(node);
+    }
+    return 0;
+}
@@ -1,14 +1,20 @@
 #include "core/proxy.h"
 #include "core/lb_types.h"
+#include "core/lb_utils.h"
+#include "core/lb_clock.h"
+#include "core/lb_rcu.h"
 #include "utils/log.h"
 #include "health/health.h"
 #include "http/http.h"
 #include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <errno.h>
 #include <limits.h>
+#include <time.h>
 
 struct proxy *proxies_list = NULL;
 static pthread_rwlock_t proxy_lock = PTHREAD_RWLOCK_INITIALIZER;
@@ -30,6 +36,10 @@ proxy_t* proxy_new(const char *name, int mode) {
     px->timeout.tarpit = 60000;
 
     px->lb_algo = LB_ALGO_ROUNDROBIN;
+    px->hash_balance_factor = CHASH_DEFAULT_BALANCE_FACTOR;
+    pthread_mutex_init(&px->usable_lock, NULL);
+    px->http_req_rules.n = px->http_req_rules.p = &px->http_req_rules;
+    px->http_res_rules.n = px->http_res_rules.p = &px->http_res_rules;
 
     pthread_rwlock_wrlock(&proxy_lock);
     px->next = proxies_list;
@@ -56,10 +66,83 @@ void proxy_free(proxy_t *px) {
         srv = next;
     }
 
+    // No selection can be running once the proxy is being freed
+    free(atomic_load(&px->usable));
+    pthread_mutex_destroy(&px->usable_lock);
+
+    free(px->lb_hdr);
     free(px->id);
     free(px);
 }
 
+void proxy_add_server(proxy_t *px, server_t *srv) {
+    srv->proxy = px;
+    srv->next = px->servers;
+    px->servers = srv;
+    proxy_update_usable(px);
+}
+
+static uint32_t chash_server_points(server_t *srv) {
+    uint32_t weight = srv->weight ? srv->weight : 1;
+    if (weight > CHASH_MAX_WEIGHT) weight = CHASH_MAX_WEIGHT;
+    return weight * CHASH_POINTS_PER_WEIGHT;
+}
+
+static int chash_point_cmp(const void *a, const void *b) {
+    const chash_point_t *pa = a, *pb = b;
+    return (pa->hash > pb->hash) - (pa->hash < pb->hash);
+}
+
+// Rebuild the usable-server array and its hash ring from the list and
+// publish them. Selection then indexes the array instead of walking the
+// list; maxconn is still checked per pick since it changes with every
+// connection.
+void proxy_update_usable(proxy_t *px) {
+    pthread_mutex_lock(&px->usable_lock);
+
+    uint32_t count = 0, points = 0;
+    server_t *srv;
+    for (srv = px->servers; srv; srv = srv->next) {
+        if (srv->cur_state != SRV_RUNNING) continue;
+        count++;
+        points += chash_server_points(srv);
+    }
+
+    size_t srv_bytes = (count * sizeof(server_t *) + sizeof(chash_point_t) - 1) &
+                       ~(sizeof(chash_point_t) - 1);
+    srv_usable_t *set = malloc(sizeof(*set) + srv_bytes + points * sizeof(chash_point_t));
+    srv_usable_t *old = NULL;
+    if (set) {
+        set->count = 0;
+        set->ring_size = 0;
+        set->ring = (chash_point_t *)((char *)set->srv + srv_bytes);
+
+        char key[256];
+        for (srv = px->servers; srv && set->count < count; srv = srv->next) {
+            if (srv->cur_state != SRV_RUNNING) continue;
+            set->srv[set->count++] = srv;
+
+            // Points depend only on the server's own name, so a server
+            // joining or leaving moves just the keys next to its points
+            uint32_t n = chash_server_points(srv);
+            for (uint32_t i = 0; i < n; i++) {
+                int len = snprintf(key, sizeof(key), "%s-%u", srv->id ? srv->id : "", i);
+                chash_point_t *pt = &set->ring[set->ring_size++];
+                pt->hash = murmur3_64(key, len, 0);
+                pt->srv = srv;
+            }
+        }
+        qsort(set->ring, set->ring_size, sizeof(chash_point_t), chash_point_cmp);
+        old = atomic_exchange_explicit(&px->usable, set, memory_order_acq_rel);
+    } else {
+        log_error("Proxy %s: failed to rebuild usable server list", px->id);
+    }
+
+    pthread_mutex_unlock(&px->usable_lock);
+
+    lb_rcu_retire(old, free);
+}
+
 int proxy_start(proxy_t *px) {
     if (!px) return -1;
 
@@ -79,6 +162,7 @@ int proxy_start(proxy_t *px) {
             start_health_check(srv);
         }
     }
+    proxy_update_usable(px);
 
     px->state = PR_FL_READY;
     log_info("Proxy %s started", px->id);
@@ -103,6 +187,7 @@ void proxy_stop(proxy_t *px) {
     for (srv = px->servers; srv; srv = srv->next) {
         srv->cur_state = SRV_MAINTAIN;
     }
+    proxy_update_usable(px);
 
     log_info("Proxy %s stopped", px->id);
 }
@@ -135,50 +220,51 @@ void proxy_resume(proxy_t *px) {
     log_info("Proxy %s resumed", px->id);
 }
 
-server_t* select_server_roundrobin(proxy_t *px) {
-    static _Atomic uint32_t rr_idx = 0;
-    uint32_t idx = atomic_fetch_add(&rr_idx, 1);
-
-    server_t *srv;
-    uint32_t count = 0;
-
-    for (srv = px->servers; srv; srv = srv->next) {
-        if (server_is_usable(srv)) {
-            count++;
-        }
-    }
-
-    if (count == 0) return NULL;
-
-    idx %= count;
-    count = 0;
-
-    for (srv = px->servers; srv; srv = srv->next) {
+// First server at or after slot idx that can take a connection. A server
+// in slow start may be passed over for the next one; if every candidate
+// was, the first usable one still wins.
+static server_t* select_server_from(srv_usable_t *set, uint32_t idx) {
+    if (!set || set->count == 0) return NULL;
+
+    time_t now = lb_now_sec();
+    server_t *fallback = NULL;
+    idx %= set->count;
+    for (uint32_t i = 0; i < set->count; i++) {
+        server_t *srv = set->srv[idx];
         if (server_is_usable(srv)) {
-            if (count == idx) {
-                return srv;
-            }
-            count++;
+            if (server_slowstart_admit(srv, now)) return srv;
+            if (!fallback) fallback = srv;
         }
+        if (++idx == set->count) idx = 0;
     }
+    return fallback;
+}
 
-    return NULL;
+server_t* select_server_roundrobin(proxy_t *px) {
+    uint32_t idx = atomic_fetch_add_explicit(&px->rr.idx, 1, memory_order_relaxed);
+    return select_server_from(atomic_load_explicit(&px->usable, memory_order_acquire), idx);
 }
 
 server_t* select_server_leastconn(proxy_t *px) {
-    server_t *srv, *best = NULL;
-    int32_t min_conns = INT32_MAX;
+    srv_usable_t *set = atomic_load_explicit(&px->usable, memory_order_acquire);
+    server_t *best = NULL;
+    uint64_t min_load = UINT64_MAX;
 
-    for (srv = px->servers; srv; srv = srv->next) {
+    if (!set) return NULL;
+
+    time_t now = lb_now_sec();
+    for (uint32_t i = 0; i < set->count; i++) {
+        server_t *srv = set->srv[i];
         if (!server_is_usable(srv)) continue;
 
+        // Count the connection being placed, so a server in slow start
+        // is not a free pick just because it is idle
         int32_t cur_conns = atomic_load(&srv->cur_conns);
-        if (srv->cur_eweight > 0) {
-            cur_conns = (cur_conns * 256) / srv->cur_eweight;
-        }
+        uint64_t load = ((uint64_t)(cur_conns > 0 ? cur_conns + 1 : 1) << 16) /
+                        server_eweight(srv, now);
 
-        if (cur_conns < min_conns) {
-            min_conns = cur_conns;
+        if (load < min_load) {
+            min_load = load;
             best = srv;
         }
     }
@@ -187,42 +273,83 @@ server_t* select_server_leastconn(proxy_t *px) {
 }
 
 server_t* select_server_source(proxy_t *px, uint32_t hash) {
-    server_t *srv;
-    uint32_t count = 0;
+    return select_server_from(atomic_load_explicit(&px->usable, memory_order_acquire), hash);
+}
 
-    for (srv = px->servers; srv; srv = srv->next) {
-        if (server_is_usable(srv)) {
-            count++;
+// Consistent hashing with bounded loads: start at the key's successor on
+// the ring and take the first server below
+// ceil(hash_balance_factor% x average connections), so a hot key spills
+// over to the next servers on the ring instead of piling onto one.
+server_t* select_server_chash(proxy_t *px, uint64_t hash) {
+    srv_usable_t *set = atomic_load_explicit(&px->usable, memory_order_acquire);
+    if (!set || set->ring_size == 0) return NULL;
+
+    uint64_t limit = UINT64_MAX;
+    if (px->hash_balance_factor) {
+        uint64_t total = 1;  // the connection being placed
+        for (uint32_t i = 0; i < set->count; i++) {
+            int32_t conns = atomic_load_explicit(&set->srv[i]->cur_conns, memory_order_relaxed);
+            if (conns > 0) total += conns;
         }
+        uint64_t scaled = total * px->hash_balance_factor;
+        uint64_t div = (uint64_t)set->count * 100;
+        limit = (scaled + div - 1) / div;
     }
-    
 
-    if (count == 0) return NULL;
-
-    hash %= count;
-    count = 0;
+    // First point at or after the key
+    uint32_t lo = 0, hi = set->ring_size;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (set->ring[mid].hash < hash) lo = mid + 1;
+        else hi = mid;
+    }
 
-    for (srv = px->servers; srv; srv = srv->next) {
-        if (server_is_usable(srv)) {
-            if (count == hash) {
-                return srv;
-            }
-            count++;
+    time_t now = lb_now_sec();
+    server_t *fallback = NULL;
+    for (uint32_t i = 0; i < set->ring_size; i++) {
+        server_t *srv = set->ring[(lo + i) % set->ring_size].srv;
+        if (!server_is_usable(srv)) continue;
+        if ((uint64_t)atomic_load_explicit(&srv->cur_conns, memory_order_relaxed) < limit &&
+            server_slowstart_admit(srv, now)) {
+            return srv;
         }
+        if (!fallback) fallback = srv;
     }
 
-    return NULL;
+    // Everyone over the bound only happens transiently; keep affinity
+    return fallback;
 }
 
 server_t* select_server_uri(proxy_t *px, const char *uri, size_t len) {
-    uint32_t hash = 0;
-    size_t i;
+    return select_server_chash(px, murmur3_64(uri, len, 0));
+}
 
-    for (i = 0; i < len; i++) {
-        hash = ((hash << 5) + hash) + uri[i];
+// Value of a request header, located in the raw head that follows the
+// parsed start line
+static const char* proxy_hdr_value(http_txn_t *txn, const char *name, size_t *len) {
+    const char *p = txn->req.start_line.ptr;
+    if (!p || !name) return NULL;
+
+    size_t name_len = strlen(name);
+    p += txn->req.start_line.len;
+    if (*p == '\r') p++;
+    if (*p == '\n') p++;
+
+    while (*p && *p != '\r' && *p != '\n') {
+        const char *eol = strchr(p, '\n');
+        if (!eol) return NULL;
+
+        if (strncasecmp(p, name, name_len) == 0 && p[name_len] == ':') {
+            const char *v = p + name_len + 1;
+            const char *end = eol;
+            while (v < end && (*v == ' ' || *v == '\t')) v++;
+            while (end > v && (end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t')) end--;
+            *len = end - v;
+            return v;
+        }
+        p = eol + 1;
     }
-
-    return select_server_source(px, hash);
+    return NULL;
 }
 
 server_t* proxy_select_server(proxy_t *px, session_t *sess) {
@@ -239,7 +366,7 @@ server_t* proxy_select_server(proxy_t *px, session_t *sess) {
         case LB_ALGO_SOURCE:
             if (sess && sess->cli_conn) {
                 struct sockaddr_in *addr = (struct sockaddr_in *)&sess->cli_conn->addr.from;
-                return select_server_source(px, addr->sin_addr.s_addr);
+                return select_server_chash(px, murmur3_64(&addr->sin_addr, sizeof(addr->sin_addr), 0));
             }
             return select_server_roundrobin(px);
 
@@ -249,8 +376,16 @@ server_t* proxy_select_server(proxy_t *px, session_t *sess) {
             }
             return select_server_roundrobin(px);
 
+        case LB_ALGO_HDR:
+            if (sess && sess->txn) {
+                size_t len = 0;
+                const char *v = proxy_hdr_value(sess->txn, px->lb_hdr ? px->lb_hdr : "Host", &len);
+                if (v) return select_server_chash(px, murmur3_64(v, len, 0));
+            }
+            return select_server_roundrobin(px);
+
         case LB_ALGO_RANDOM:
-            return select_server_source(px, rand());
+            return select_server_source(px, (uint32_t)lb_rand64());
 
         default:
             return select_server_roundrobin(px);
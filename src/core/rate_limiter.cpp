@@ -0,0 +1,64 @@
+#include "core/rate_limiter.hpp"
+#include "core/lb_clock.h"
+#include <algorithm>
+#include <bit>
+#include <time.h>
+
+namespace ultrabalancer {
+
+GcraLimiter::GcraLimiter(double rate_per_sec, uint32_t burst) {
+    rate_per_sec = std::max(rate_per_sec, 1e-3);
+    emission_ns_ = std::max<uint64_t>(1, static_cast<uint64_t>(1e9 / rate_per_sec));
+    tolerance_ns_ = emission_ns_ * (std::max<uint32_t>(burst, 1) - 1);
+}
+
+// The worker's per-iteration snapshot: GCRA only needs to order arrivals
+// against the emission interval, not to time them exactly
+uint64_t GcraLimiter::now_ns() {
+    return lb_now_ns();
+}
+
+bool GcraLimiter::allow(std::atomic<uint64_t>& tat, uint64_t now) const {
+    uint64_t old = tat.load(std::memory_order_relaxed);
+    for (;;) {
+        uint64_t base = std::max(old, now);
+        if (base - now > tolerance_ns_) return false;
+        if (tat.compare_exchange_weak(old, base + emission_ns_, std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+}
+
+KeyedGcraLimiter::KeyedGcraLimiter(double rate_per_sec, uint32_t burst, uint32_t slots)
+    : rule_(rate_per_sec, burst) {
+    size_t n = std::bit_ceil<size_t>(std::max<uint32_t>(slots, kProbe));
+    cells_ = std::make_unique<Cell[]>(n);
+    mask_ = n - 1;
+}
+
+bool KeyedGcraLimiter::allow(std::string_view key, uint64_t now) {
+    // FNV-1a; 0 marks a free cell, so it is remapped
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (unsigned char c : key) {
+        h = (h ^ c) * 0x100000001b3ULL;
+    }
+    h = h ? h : 1;
+
+    uint64_t home = (h ^ (h >> 29)) & mask_;
+    for (uint32_t i = 0; i < kProbe; i++) {
+        Cell& cell = cells_[(home + i) & mask_];
+        uint64_t owner = cell.key.load(std::memory_order_acquire);
+        if (owner == h) return rule_.allow(cell.tat, now);
+
+        // Free, or idle long enough that its TAT no longer constrains anyone
+        if (owner == 0 || cell.tat.load(std::memory_order_relaxed) <= now) {
+            if (cell.key.compare_exchange_strong(owner, h, std::memory_order_acq_rel) || owner == h) {
+                return rule_.allow(cell.tat, now);
+            }
+        }
+    }
+
+    return rule_.allow(cells_[home].tat, now);
+}
+
+}
@@ -0,0 +1,635 @@
+#include "core/regex_set.hpp"
+#include <algorithm>
+#include <iterator>
+#include <map>
+
+namespace ultrabalancer {
+
+namespace {
+
+// Limits that keep a hostile or careless pattern from blowing up the NFA
+// or the DFA; past them add() rejects the pattern or matching falls back
+// to NFA simulation.
+constexpr int kMaxRepeat = 1000;
+constexpr size_t kMaxNfaStates = 1u << 20;
+constexpr size_t kDfaBudget = 16u << 20;
+constexpr uint32_t kMaxDfaStates = 65536;
+
+std::bitset<256> byte_range(int lo, int hi) {
+    std::bitset<256> set;
+    for (int c = lo; c <= hi; c++) set.set(c);
+    return set;
+}
+
+std::bitset<256> class_digit() { return byte_range('0', '9'); }
+
+std::bitset<256> class_word() {
+    auto set = byte_range('0', '9') | byte_range('A', 'Z') | byte_range('a', 'z');
+    set.set('_');
+    return set;
+}
+
+std::bitset<256> class_space() {
+    std::bitset<256> set;
+    for (char c : {' ', '\t', '\n', '\r', '\v', '\f'}) set.set(static_cast<unsigned char>(c));
+    return set;
+}
+
+int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+}
+
+struct RegexSet::Node {
+    enum Kind : uint8_t { EMPTY, SET, CAT, ALT, REP } kind;
+    std::bitset<256> set;
+    std::vector<uint32_t> kids;
+    int min{0};
+    int max{0};                 // -1 for unbounded
+};
+
+struct RegexSet::Frag {
+    uint32_t start;
+    std::vector<uint32_t> holes;    // state * 2 + slot, patched to the next state
+};
+
+// Recursive-descent parser for the ECMAScript subset described in the
+// header. Every failure, including syntax std::regex would accept but
+// this engine does not compile, is reported the same way.
+class RegexSet::Parser {
+public:
+    Parser(std::string_view re, std::vector<Node>& ast) : re_(re), ast_(ast) {}
+
+    bool parse(uint32_t& root) {
+        if (!parse_alt(root, 0)) return false;
+        return pos_ == re_.size();
+    }
+
+private:
+    bool eof() const { return pos_ >= re_.size(); }
+    char peek() const { return re_[pos_]; }
+
+    uint32_t node(Node::Kind kind) {
+        ast_.push_back(Node{kind, {}, {}, 0, 0});
+        return static_cast<uint32_t>(ast_.size() - 1);
+    }
+
+    uint32_t set_node(const std::bitset<256>& set) {
+        uint32_t n = node(Node::SET);
+        ast_[n].set = set;
+        return n;
+    }
+
+    bool parse_alt(uint32_t& out, int depth) {
+        if (depth > 200) return false;
+        uint32_t first;
+        if (!parse_cat(first, depth)) return false;
+        if (eof() || peek() != '|') {
+            out = first;
+            return true;
+        }
+
+        uint32_t alt = node(Node::ALT);
+        ast_[alt].kids.push_back(first);
+        while (!eof() && peek() == '|') {
+            pos_++;
+            uint32_t next;
+            if (!parse_cat(next, depth)) return false;
+            ast_[alt].kids.push_back(next);
+        }
+        out = alt;
+        return true;
+    }
+
+    bool parse_cat(uint32_t& out, int depth) {
+        uint32_t cat = node(Node::CAT);
+        while (!eof() && peek() != '|' && peek() != ')') {
+            uint32_t item;
+            if (!parse_repeat(item, depth)) return false;
+            ast_[cat].kids.push_back(item);
+        }
+        if (ast_[cat].kids.empty()) ast_[cat].kind = Node::EMPTY;
+        out = cat;
+        return true;
+    }
+
+    bool parse_int(int& v) {
+        size_t start = pos_;
+        v = 0;
+        while (!eof() && peek() >= '0' && peek() <= '9') {
+            v = v * 10 + (peek() - '0');
+            if (v > kMaxRepeat) return false;
+            pos_++;
+        }
+        return pos_ > start;
+    }
+
+    bool parse_repeat(uint32_t& out, int depth) {
+        uint32_t atom;
+        if (!parse_atom(atom, depth)) return false;
+        if (eof()) {
+            out = atom;
+            return true;
+        }
+
+        int min, max;
+        switch (peek()) {
+            case '*': min = 0; max = -1; pos_++; break;
+            case '+': min = 1; max = -1; pos_++; break;
+            case '?': min = 0; max = 1; pos_++; break;
+            case '{':
+                pos_++;
+                if (!parse_int(min)) return false;
+                max = min;
+                if (!eof() && peek() == ',') {
+                    pos_++;
+                    max = -1;
+                    if (!eof() && peek() != '}' && !parse_int(max)) return false;
+                }
+                if (eof() || peek() != '}' || (max >= 0 && max < min)) return false;
+                pos_++;
+                break;
+            default:
+                out = atom;
+                return true;
+        }
+
+        // Laziness changes which match is reported, never whether one exists
+        if (!eof() && peek() == '?') pos_++;
+        if (!eof() && (peek() == '*' || peek() == '+' || peek() == '?' || peek() == '{')) return false;
+
+        uint32_t rep = node(Node::REP);
+        ast_[rep].kids.push_back(atom);
+        ast_[rep].min = min;
+        ast_[rep].max = max;
+        out = rep;
+        return true;
+    }
+
+    // One escaped byte; class escapes (\d and friends) are handled by callers
+    bool parse_escape_byte(int& c, bool in_class) {
+        if (eof()) return false;
+        char e = re_[pos_++];
+        switch (e) {
+            case 't': c = '\t'; return true;
+            case 'n': c = '\n'; return true;
+            case 'r': c = '\r'; return true;
+            case 'f': c = '\f'; return true;
+            case 'v': c = '\v'; return true;
+            case '0': c = 0; return true;
+            case 'b':
+                if (!in_class) return false;    // word boundary
+                c = '\b';
+                return true;
+            case 'x': {
+                if (pos_ + 2 > re_.size()) return false;
+                int hi = hex_value(re_[pos_]), lo = hex_value(re_[pos_ + 1]);
+                if (hi < 0 || lo < 0) return false;
+                pos_ += 2;
+                c = hi * 16 + lo;
+                return true;
+            }
+            case 'u': {
+                if (pos_ + 4 > re_.size()) return false;
+                int v = 0;
+                for (int i = 0; i < 4; i++) {
+                    int h = hex_value(re_[pos_ + i]);
+                    if (h < 0) return false;
+                    v = v * 16 + h;
+                }
+                // Only code points that are a single byte in the path
+                if (v >= 0x80) return false;
+                pos_ += 4;
+                c = v;
+                return true;
+            }
+            default:
+                // Backreferences, \B, \c and unknown letters are not compiled
+                if ((e >= '0' && e <= '9') || (e >= 'a' && e <= 'z') || (e >= 'A' && e <= 'Z')) {
+                    return false;
+                }
+                c = static_cast<unsigned char>(e);
+                return true;
+        }
+    }
+
+    bool class_escape(char e, std::bitset<256>& set) {
+        switch (e) {
+            case 'd': set = class_digit(); return true;
+            case 'D': set = ~class_digit(); return true;
+            case 'w': set = class_word(); return true;
+            case 'W': set = ~class_word(); return true;
+            case 's': set = class_space(); return true;
+            case 'S': set = ~class_space(); return true;
+            default: return false;
+        }
+    }
+
+    bool parse_class(std::bitset<256>& set) {
+        bool negate = false;
+        if (!eof() && peek() == '^') {
+            negate = true;
+            pos_++;
+        }
+
+        while (!eof() && peek() != ']') {
+            int lo;
+            if (peek() == '\\') {
+                pos_++;
+                std::bitset<256> cls;
+                if (!eof() && class_escape(peek(), cls)) {
+                    pos_++;
+                    set |= cls;
+                    continue;
+                }
+                if (!parse_escape_byte(lo, true)) return false;
+            } else {
+                lo = static_cast<unsigned char>(re_[pos_++]);
+            }
+
+            int hi = lo;
+            if (pos_ + 1 < re_.size() && peek() == '-' && re_[pos_ + 1] != ']') {
+                pos_++;
+                if (peek() == '\\') {
+                    pos_++;
+                    if (!parse_escape_byte(hi, true)) return false;
+                } else {
+                    hi = static_cast<unsigned char>(re_[pos_++]);
+                }
+                if (hi < lo) return false;
+            }
+            set |= byte_range(lo, hi);
+        }
+
+        if (eof()) return false;
+        pos_++;
+        if (negate) set = ~set;
+        return true;
+    }
+
+    bool parse_atom(uint32_t& out, int depth) {
+        char c = re_[pos_++];
+        switch (c) {
+            case '(': {
+                if (!eof() && peek() == '?') {
+                    // Only non-capturing groups; lookaround is not compiled
+                    if (pos_ + 1 >= re_.size() || re_[pos_ + 1] != ':') return false;
+                    pos_ += 2;
+                }
+                if (!parse_alt(out, depth + 1)) return false;
+                if (eof() || peek() != ')') return false;
+                pos_++;
+                return true;
+            }
+            case '[': {
+                std::bitset<256> set;
+                if (!parse_class(set)) return false;
+                out = set_node(set);
+                return true;
+            }
+            case '.': {
+                std::bitset<256> set;
+                set.set();
+                set.reset('\n');
+                set.reset('\r');
+                out = set_node(set);
+                return true;
+            }
+            case '\\': {
+                std::bitset<256> set;
+                if (!eof() && class_escape(peek(), set)) {
+                    pos_++;
+                    out = set_node(set);
+                    return true;
+                }
+                int b;
+                if (!parse_escape_byte(b, false)) return false;
+                set.set(b);
+                out = set_node(set);
+                return true;
+            }
+            // Matching is anchored anyway, so anchors are only meaningful
+            // (and only accepted) at the ends of the whole pattern
+            case '^':
+                if (pos_ != 1) return false;
+                out = node(Node::EMPTY);
+                return true;
+            case '$':
+                if (pos_ != re_.size()) return false;
+                out = node(Node::EMPTY);
+                return true;
+            case '*': case '+': case '?': case '{': case ')': case '|':
+                return false;
+            default: {
+                std::bitset<256> set;
+                set.set(static_cast<unsigned char>(c));
+                out = set_node(set);
+                return true;
+            }
+        }
+    }
+
+    std::string_view re_;
+    std::vector<Node>& ast_;
+    size_t pos_{0};
+};
+
+size_t RegexSet::nfa_size(const std::vector<Node>& ast, uint32_t n, size_t limit) {
+    const auto& node = ast[n];
+    size_t total = 0;
+    switch (node.kind) {
+        case Node::EMPTY:
+        case Node::SET:
+            return 1;
+        case Node::CAT:
+        case Node::ALT:
+            for (uint32_t kid : node.kids) {
+                total += nfa_size(ast, kid, limit) + 1;
+                if (total >= limit) return limit;
+            }
+            return total;
+        case Node::REP: {
+            size_t copies = static_cast<size_t>(node.max < 0 ? node.min + 1 : node.max);
+            size_t kid = nfa_size(ast, node.kids[0], limit);
+            if (copies && kid >= limit / copies) return limit;
+            return copies * kid + copies + 2;
+        }
+    }
+    return limit;
+}
+
+uint32_t RegexSet::add_state(Op op, uint32_t set) {
+    states_.push_back(State{op, 0, 0, set});
+    return static_cast<uint32_t>(states_.size() - 1);
+}
+
+void RegexSet::patch(const std::vector<uint32_t>& holes, uint32_t target) {
+    for (uint32_t h : holes) {
+        State& s = states_[h >> 1];
+        (h & 1 ? s.out1 : s.out) = target;
+    }
+}
+
+RegexSet::Frag RegexSet::emit(const std::vector<Node>& ast, uint32_t n) {
+    const Node& node = ast[n];
+    switch (node.kind) {
+        case Node::EMPTY: {
+            uint32_t s = add_state(SPLIT);
+            return Frag{s, {s * 2, s * 2 + 1}};
+        }
+
+        case Node::SET: {
+            sets_.push_back(node.set);
+            uint32_t s = add_state(BYTE, static_cast<uint32_t>(sets_.size() - 1));
+            return Frag{s, {s * 2}};
+        }
+
+        case Node::CAT: {
+            Frag f = emit(ast, node.kids[0]);
+            for (size_t i = 1; i < node.kids.size(); i++) {
+                Frag next = emit(ast, node.kids[i]);
+                patch(f.holes, next.start);
+                f.holes = std::move(next.holes);
+            }
+            return f;
+        }
+
+        case Node::ALT: {
+            Frag f = emit(ast, node.kids.back());
+            for (size_t i = node.kids.size() - 1; i-- > 0;) {
+                Frag left = emit(ast, node.kids[i]);
+                uint32_t s = add_state(SPLIT);
+                states_[s].out = left.start;
+                states_[s].out1 = f.start;
+                left.holes.insert(left.holes.end(), f.holes.begin(), f.holes.end());
+                f = Frag{s, std::move(left.holes)};
+            }
+            return f;
+        }
+
+        case Node::REP: {
+            // x{min,max} is min copies of x followed by either a loop or
+            // (max - min) nested optional copies
+            uint32_t kid = node.kids[0];
+            uint32_t entry = add_state(SPLIT);
+            Frag f{entry, {entry * 2, entry * 2 + 1}};
+
+            for (int i = 0; i < node.min; i++) {
+                Frag x = emit(ast, kid);
+                patch(f.holes, x.start);
+                f.holes = std::move(x.holes);
+            }
+
+            if (node.max < 0) {
+                uint32_t loop = add_state(SPLIT);
+                Frag x = emit(ast, kid);
+                states_[loop].out = x.start;
+                patch(x.holes, loop);
+                patch(f.holes, loop);
+                f.holes = {loop * 2 + 1};
+            } else {
+                std::vector<uint32_t> exits;
+                for (int i = node.min; i < node.max; i++) {
+                    uint32_t opt = add_state(SPLIT);
+                    Frag x = emit(ast, kid);
+                    states_[opt].out = x.start;
+                    patch(f.holes, opt);
+                    exits.push_back(opt * 2 + 1);
+                    f.holes = std::move(x.holes);
+                }
+                f.holes.insert(f.holes.end(), exits.begin(), exits.end());
+            }
+            return f;
+        }
+    }
+    return Frag{0, {}};
+}
+
+int RegexSet::add(std::string_view pattern) {
+    std::vector<Node> ast;
+    uint32_t root;
+    Parser parser(pattern, ast);
+    if (!parser.parse(root)) return unsupported;
+
+    // Nested counted repeats multiply; refuse before emitting anything
+    if (states_.size() + nfa_size(ast, root, kMaxNfaStates) >= kMaxNfaStates) return unsupported;
+
+    Frag f = emit(ast, root);
+
+    uint32_t match = add_state(MATCH, patterns_);
+    patch(f.holes, match);
+    starts_.push_back(f.start);
+    return static_cast<int>(patterns_++);
+}
+
+void RegexSet::closure(std::vector<uint32_t>& list, std::vector<uint32_t>& mark, uint32_t gen,
+                       std::vector<uint32_t>& stack, uint32_t s) const {
+    stack.push_back(s);
+    while (!stack.empty()) {
+        uint32_t cur = stack.back();
+        stack.pop_back();
+        if (mark[cur] == gen) continue;
+        mark[cur] = gen;
+
+        const State& st = states_[cur];
+        if (st.op == SPLIT) {
+            stack.push_back(st.out1);
+            stack.push_back(st.out);
+        } else {
+            list.push_back(cur);
+        }
+    }
+}
+
+void RegexSet::compile() {
+    words_ = std::max(1u, (patterns_ + 63) / 64);
+    empty_.assign(words_, 0);
+
+    // Bytes no pattern tells apart share a DFA column
+    std::fill(std::begin(byte_class_), std::end(byte_class_), 0);
+    classes_ = 1;
+    for (const auto& set : sets_) {
+        std::vector<int> split(classes_ * 2, -1);
+        uint32_t next = 0;
+        for (int b = 0; b < 256; b++) {
+            int& id = split[byte_class_[b] * 2 + set.test(b)];
+            if (id < 0) id = static_cast<int>(next++);
+            byte_class_[b] = static_cast<uint8_t>(id);
+        }
+        classes_ = next;
+        if (classes_ == 256) break;
+    }
+
+    build_dfa();
+}
+
+void RegexSet::build_dfa() {
+    dfa_next_.clear();
+    dfa_accept_.clear();
+    dfa_start_ = 0;
+
+    size_t row = classes_ * sizeof(uint32_t) + words_ * sizeof(uint64_t);
+    uint32_t limit = static_cast<uint32_t>(std::min<size_t>(kMaxDfaStates, kDfaBudget / row));
+
+    uint8_t rep[256];
+    for (int b = 255; b >= 0; b--) rep[byte_class_[b]] = static_cast<uint8_t>(b);
+
+    std::vector<uint32_t> mark(states_.size(), 0), stack;
+    uint32_t gen = 0;
+
+    std::map<std::vector<uint32_t>, uint32_t> ids;
+    std::vector<std::vector<uint32_t>> pending;
+    std::vector<uint32_t> next_dfa, accept;
+
+    auto intern = [&](std::vector<uint32_t>&& key) -> int64_t {
+        std::sort(key.begin(), key.end());
+        auto it = ids.find(key);
+        if (it != ids.end()) return it->second;
+        if (pending.size() >= limit) return -1;
+        uint32_t id = static_cast<uint32_t>(pending.size());
+        ids.emplace(key, id);
+        pending.push_back(std::move(key));
+        return id;
+    };
+
+    intern({});     // dead state
+    std::vector<uint32_t> start;
+    gen++;
+    for (uint32_t s : starts_) closure(start, mark, gen, stack, s);
+    dfa_start_ = static_cast<uint32_t>(intern(std::move(start)));
+
+    std::vector<uint32_t> table;
+    for (size_t d = 0; d < pending.size(); d++) {
+        table.resize((d + 1) * classes_);
+        for (uint32_t c = 0; c < classes_; c++) {
+            std::vector<uint32_t> next;
+            gen++;
+            for (uint32_t s : pending[d]) {
+                const State& st = states_[s];
+                if (st.op == BYTE && sets_[st.set].test(rep[c])) {
+                    closure(next, mark, gen, stack, st.out);
+                }
+            }
+            int64_t id = intern(std::move(next));
+            if (id < 0) {
+                // Too many states; match() simulates the NFA instead
+                dfa_start_ = 0;
+                return;
+            }
+            table[d * classes_ + c] = static_cast<uint32_t>(id);
+        }
+    }
+
+    dfa_accept_.assign(pending.size() * words_, 0);
+    for (size_t d = 0; d < pending.size(); d++) {
+        for (uint32_t s : pending[d]) {
+            if (states_[s].op == MATCH) {
+                uint32_t id = states_[s].set;
+                dfa_accept_[d * words_ + (id >> 6)] |= 1ull << (id & 63);
+            }
+        }
+    }
+    dfa_next_ = std::move(table);
+}
+
+const uint64_t* RegexSet::match(std::string_view input) const {
+    if (dfa_next_.empty()) return match_nfa(input);
+
+    uint32_t s = dfa_start_;
+    const uint32_t* next = dfa_next_.data();
+    for (unsigned char c : input) {
+        s = next[s * classes_ + byte_class_[c]];
+        if (s == 0) return empty_.data();
+    }
+    return dfa_accept_.data() + static_cast<size_t>(s) * words_;
+}
+
+const uint64_t* RegexSet::match_nfa(std::string_view input) const {
+    // Per-thread scratch, grown once to the largest set seen
+    static thread_local std::vector<uint32_t> mark, stack, clist, nlist;
+    static thread_local std::vector<uint64_t> bits;
+    static thread_local uint32_t gen;
+
+    if (mark.size() < states_.size()) {
+        mark.assign(states_.size(), 0);
+        gen = 0;
+    }
+    bits.assign(words_, 0);
+    clist.clear();
+
+    // Reset the marks rather than let gen wrap onto stale values
+    if (gen > UINT32_MAX - input.size() - 2) {
+        std::fill(mark.begin(), mark.end(), 0);
+        gen = 0;
+    }
+
+    gen++;
+    for (uint32_t s : starts_) closure(clist, mark, gen, stack, s);
+
+    for (unsigned char c : input) {
+        if (clist.empty()) return bits.data();
+        nlist.clear();
+        gen++;
+        for (uint32_t s : clist) {
+            const State& st = states_[s];
+            if (st.op == BYTE && sets_[st.set].test(c)) {
+                closure(nlist, mark, gen, stack, st.out);
+            }
+        }
+        clist.swap(nlist);
+    }
+
+    for (uint32_t s : clist) {
+        if (states_[s].op == MATCH) {
+            uint32_t id = states_[s].set;
+            bits[id >> 6] |= 1ull << (id & 63);
+        }
+    }
+    return bits.data();
+}
+
+}
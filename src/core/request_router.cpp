@@ -1,9 +1,17 @@
 #include "core/request_router.hpp"
+#include "core/request_router.h"
+#include "core/lb_rcu.h"
+#include "core/lb_clock.h"
 #include <algorithm>
 #include <random>
 #include <mutex>
 #include <atomic>
 #include <string_view>
+#include <strings.h>
+#include <cstring>
+#include <sstream>
+#include <cstdlib>
+#include <sched.h>
 
 namespace ultrabalancer {
 
@@ -11,6 +19,49 @@ RouteRule::RouteRule(MatchType type, const std::string& pattern)
     : type_(type), pattern_(pattern) {
     if (type_ == MatchType::REGEX) {
         regex_ = std::regex(pattern);
+    } else if (type_ == MatchType::HEADER) {
+        header_sep_ = pattern_.find(':');
+    }
+}
+
+bool RouteRule::matches(std::string_view method, std::string_view path,
+                        std::span<const HeaderRef> headers) const {
+    switch (type_) {
+        case MatchType::EXACT:
+            return path == pattern_;
+
+        case MatchType::PREFIX:
+            return path.starts_with(pattern_);
+
+        case MatchType::REGEX:
+            return std::regex_match(path.begin(), path.end(), regex_);
+
+        case MatchType::HEADER: {
+            if (header_sep_ == std::string::npos) return false;
+            std::string_view name(pattern_.data(), header_sep_);
+            std::string_view value(pattern_.data() + header_sep_ + 1,
+                                   pattern_.length() - header_sep_ - 1);
+            // Field names are case-insensitive; values are compared as given
+            for (const auto& h : headers) {
+                if (h.name.size() == name.size() &&
+                    strncasecmp(h.name.data(), name.data(), name.size()) == 0) {
+                    return h.value == value;
+                }
+            }
+            return false;
+        }
+
+        case MatchType::METHOD:
+            return method == pattern_;
+
+        case MatchType::QUERY_PARAM: {
+            auto query_pos = path.find('?');
+            if (query_pos == std::string_view::npos) return false;
+            return path.substr(query_pos + 1).find(pattern_) != std::string_view::npos;
+        }
+
+        default:
+            return false;
     }
 }
 
@@ -60,8 +111,103 @@ bool RouteRule::matches(const std::string& path,
     }
 }
 
+namespace {
+
+// Ids for the router-wide counters, registered before any route or target
+enum : uint32_t { STAT_TOTAL, STAT_ROUTED, STAT_DEFAULT, STAT_RESERVED };
+
+struct StatRegistry {
+    std::mutex mutex;
+    std::vector<std::pair<StatKind, std::string>> names{
+        {StatKind::INTERNAL, "total"}, {StatKind::INTERNAL, "routed"}, {StatKind::INTERNAL, "default"}};
+};
+
+StatRegistry& stat_registry() {
+    static StatRegistry registry;
+    return registry;
+}
+
+std::atomic<uint64_t> next_counters_uid{1};
+
+}
+
+uint32_t stat_register(StatKind kind, const std::string& name) {
+    auto& reg = stat_registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.names.emplace_back(kind, name);
+    return static_cast<uint32_t>(reg.names.size() - 1);
+}
+
+StatKind stat_kind(uint32_t id) {
+    auto& reg = stat_registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    return reg.names[id].first;
+}
+
+std::string stat_name(uint32_t id) {
+    auto& reg = stat_registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    return reg.names[id].second;
+}
+
+ShardedCounters::ShardedCounters()
+    : uid_(next_counters_uid.fetch_add(1, std::memory_order_relaxed)) {}
+
+ShardedCounters::~ShardedCounters() = default;
+
+ShardedCounters::Shard::~Shard() {
+    for (auto& chunk : chunks) delete[] chunk.load(std::memory_order_relaxed);
+}
+
+ShardedCounters::Shard* ShardedCounters::local() {
+    // uid_ is never reused, so entries for destroyed counter sets are inert
+    static thread_local uint64_t last_uid;
+    static thread_local Shard* last;
+    static thread_local std::vector<std::pair<uint64_t, Shard*>> owned;
+
+    if (last_uid == uid_) return last;
+    for (const auto& [uid, shard] : owned) {
+        if (uid == uid_) {
+            last_uid = uid;
+            last = shard;
+            return shard;
+        }
+    }
+
+    auto shard = std::make_unique<Shard>();
+    last = shard.get();
+    last_uid = uid_;
+    owned.emplace_back(uid_, last);
+    std::lock_guard<std::mutex> lock(mutex_);
+    shards_.push_back(std::move(shard));
+    return last;
+}
+
+std::atomic<uint64_t>* ShardedCounters::grow(uint32_t chunk) {
+    auto* fresh = new std::atomic<uint64_t>[kChunk]();
+    local()->chunks[chunk].store(fresh, std::memory_order_release);
+    return fresh;
+}
+
+std::vector<uint64_t> ShardedCounters::snapshot() const {
+    std::vector<uint64_t> sum;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& shard : shards_) {
+        for (uint32_t c = 0; c < kChunks; c++) {
+            auto* chunk = shard->chunks[c].load(std::memory_order_acquire);
+            if (!chunk) continue;
+            if (sum.size() < (c + 1) * kChunk) sum.resize((c + 1) * kChunk);
+            for (uint32_t i = 0; i < kChunk; i++) {
+                sum[c * kChunk + i] += chunk[i].load(std::memory_order_relaxed);
+            }
+        }
+    }
+    return sum;
+}
+
 RouteTarget::RouteTarget(const std::string& backend_name, int weight)
-    : backend_name_(backend_name), weight_(weight) {}
+    : backend_name_(backend_name), weight_(weight),
+      stats_id_(stat_register(StatKind::TARGET, backend_name)) {}
 
 void RouteTarget::set_retry_policy(int max_retries, std::chrono::milliseconds timeout) {
     max_retries_ = max_retries;
@@ -73,7 +219,7 @@ bool RouteTarget::should_retry(int attempt) const {
 }
 
 Route::Route(const std::string& name)
-    : name_(name), cached_total_weight_(0), weight_cache_valid_(false) {}
+    : name_(name), stats_id_(stat_register(StatKind::ROUTE, name)), cached_total_weight_(0), weight_cache_valid_(false) {}
 
 void Route::add_rule(std::shared_ptr<RouteRule> rule) {
     rules_.push_back(rule);
@@ -141,9 +287,10 @@ void Route::enable_circuit_breaker(int error_threshold, std::chrono::seconds res
 bool Route::is_circuit_open() const {
     // Fast path: check if circuit is open without any locks (uses atomic operations)
     if (circuit_open_.load(std::memory_order_acquire)) {
-        auto now = std::chrono::steady_clock::now();
+        uint64_t now = lb_now_ns();
+        uint64_t reset_ns = std::chrono::nanoseconds(circuit_reset_timeout_).count();
         // Check if enough time has passed to reset the circuit
-        if (now - circuit_open_time_ > circuit_reset_timeout_) {
+        if (now - circuit_open_ns_.load(std::memory_order_relaxed) > reset_ns) {
             // Only one thread should reset the circuit, use a lock here
             std::unique_lock<std::shared_mutex> lock(circuit_mutex_);
             // Double-check after acquiring lock to prevent race condition
@@ -161,8 +308,8 @@ bool Route::is_circuit_open() const {
         std::unique_lock<std::shared_mutex> lock(circuit_mutex_);
         // Double-check to prevent multiple threads from opening circuit simultaneously
         if (!circuit_open_.load(std::memory_order_acquire)) {
+            circuit_open_ns_.store(lb_now_ns(), std::memory_order_relaxed);
             circuit_open_.store(true, std::memory_order_release);
-            circuit_open_time_ = std::chrono::steady_clock::now();
             return true;
         }
     }
@@ -170,23 +317,295 @@ bool Route::is_circuit_open() const {
     return false;
 }
 
+namespace {
+
+// Build-time trie; flattened into CompiledRoutes::Node once complete
+struct TrieBuild {
+    std::string label;
+    std::vector<std::unique_ptr<TrieBuild>> children;   // sorted by label[0]
+    std::vector<uint32_t> exact;
+    std::vector<uint32_t> prefix;
+};
+
+TrieBuild* trie_insert(TrieBuild* node, std::string_view key) {
+    while (!key.empty()) {
+        auto& kids = node->children;
+        auto it = std::lower_bound(kids.begin(), kids.end(), key[0],
+            [](const auto& child, char c) {
+                return static_cast<unsigned char>(child->label[0]) < static_cast<unsigned char>(c);
+            });
+
+        if (it == kids.end() || (*it)->label[0] != key[0]) {
+            auto leaf = std::make_unique<TrieBuild>();
+            leaf->label = std::string(key);
+            TrieBuild* raw = leaf.get();
+            kids.insert(it, std::move(leaf));
+            return raw;
+        }
+
+        TrieBuild* child = it->get();
+        size_t common = 0;
+        size_t limit = std::min(child->label.size(), key.size());
+        while (common < limit && child->label[common] == key[common]) common++;
+
+        // Split the edge so the key can end, or branch, at its own node
+        if (common < child->label.size()) {
+            auto mid = std::make_unique<TrieBuild>();
+            mid->label = child->label.substr(0, common);
+            child->label.erase(0, common);
+            mid->children.push_back(std::move(*it));
+            *it = std::move(mid);
+            child = it->get();
+        }
+
+        node = child;
+        key.remove_prefix(common);
+    }
+    return node;
+}
+
+}
+
+CompiledRoutes::CompiledRoutes(std::vector<std::shared_ptr<Route>> routes,
+                               std::shared_ptr<RouteTarget> default_target)
+    : routes_(std::move(routes)), default_target_(std::move(default_target)) {
+
+    TrieBuild root;
+    key_rule_.assign(routes_.size(), npos);
+    rule_base_.resize(routes_.size() + 1);
+
+    for (uint32_t i = 0; i < routes_.size(); i++) {
+        const auto& rules = routes_[i]->get_rules();
+
+        // Patterns the set can't compile keep using the rule's std::regex
+        rule_base_[i] = static_cast<uint32_t>(rules_.size());
+        rules_.insert(rules_.end(), rules.begin(), rules.end());
+        for (const auto& rule : rules) {
+            rule_regex_.push_back(rule->get_type() == RouteRule::MatchType::REGEX
+                                  ? regex_.add(rule->get_pattern())
+                                  : RegexSet::unsupported);
+        }
+
+        // A route without rules never matches
+        if (rules.empty()) continue;
+
+        for (uint32_t r = 0; r < rules.size(); r++) {
+            auto type = rules[r]->get_type();
+            if (type == RouteRule::MatchType::EXACT || type == RouteRule::MatchType::PREFIX) {
+                key_rule_[i] = r;
+                break;
+            }
+        }
+
+        if (key_rule_[i] == npos) {
+            linear_.push_back(i);
+            continue;
+        }
+
+        const auto& key = *rules[key_rule_[i]];
+        TrieBuild* node = trie_insert(&root, key.get_pattern());
+        // Routes are visited in priority order, so both lists stay sorted
+        if (key.get_type() == RouteRule::MatchType::EXACT) {
+            node->exact.push_back(i);
+        } else {
+            node->prefix.push_back(i);
+        }
+    }
+
+    rule_base_[routes_.size()] = static_cast<uint32_t>(rules_.size());
+    regex_.compile();
+
+    // Flatten breadth-first so each node's children are adjacent
+    std::vector<const TrieBuild*> order{&root};
+    nodes_.push_back(Node{});
+    for (size_t n = 0; n < order.size(); n++) {
+        const TrieBuild* b = order[n];
+        Node& node = nodes_[n];
+
+        node.label = static_cast<uint32_t>(labels_.size());
+        node.label_len = static_cast<uint32_t>(b->label.size());
+        labels_ += b->label;
+
+        node.exact = static_cast<uint32_t>(candidates_.size());
+        node.exact_count = static_cast<uint32_t>(b->exact.size());
+        candidates_.insert(candidates_.end(), b->exact.begin(), b->exact.end());
+        node.prefix = static_cast<uint32_t>(candidates_.size());
+        node.prefix_count = static_cast<uint32_t>(b->prefix.size());
+        candidates_.insert(candidates_.end(), b->prefix.begin(), b->prefix.end());
+
+        node.child = static_cast<uint32_t>(order.size());
+        node.child_count = static_cast<uint32_t>(b->children.size());
+        for (const auto& child : b->children) {
+            order.push_back(child.get());
+        }
+        nodes_.resize(order.size());
+    }
+}
+
+bool CompiledRoutes::predicates_match(uint32_t index, Lookup& req) const {
+    const auto* rules = rules_.data() + rule_base_[index];
+    const int* regex_ids = rule_regex_.data() + rule_base_[index];
+    uint32_t count = rule_base_[index + 1] - rule_base_[index];
+    for (uint32_t r = 0; r < count; r++) {
+        if (r == key_rule_[index]) continue;
+        if (regex_ids[r] != RegexSet::unsupported) {
+            if (!req.regex_hits) req.regex_hits = regex_.match(req.path);
+            if (!RegexSet::test(req.regex_hits, regex_ids[r])) return false;
+            continue;
+        }
+        if (!rules[r]->matches(req.method, req.path, req.headers)) return false;
+    }
+    return true;
+}
+
+uint32_t CompiledRoutes::best_of(uint32_t begin, uint32_t count, uint32_t from, uint32_t best,
+                                 Lookup& req) const {
+    const uint32_t* c = candidates_.data() + begin;
+    const uint32_t* end = c + count;
+    c = std::lower_bound(c, end, from);
+    for (; c != end && *c < best; c++) {
+        if (predicates_match(*c, req)) return *c;
+    }
+    return best;
+}
+
+uint32_t CompiledRoutes::first_match(std::string_view method, std::string_view path,
+                                     std::span<const HeaderRef> headers, uint32_t from) const {
+    Lookup req{method, path, headers, nullptr};
+    uint32_t best = npos;
+    uint32_t n = 0;
+    size_t depth = 0;
+
+    for (;;) {
+        const Node& node = nodes_[n];
+        if (node.prefix_count) {
+            best = best_of(node.prefix, node.prefix_count, from, best, req);
+        }
+        if (depth == path.size()) {
+            if (node.exact_count) {
+                best = best_of(node.exact, node.exact_count, from, best, req);
+            }
+            break;
+        }
+
+        const Node* kids = nodes_.data() + node.child;
+        const Node* kids_end = kids + node.child_count;
+        unsigned char c = static_cast<unsigned char>(path[depth]);
+        const Node* next = std::lower_bound(kids, kids_end, c,
+            [this](const Node& k, unsigned char ch) {
+                return static_cast<unsigned char>(labels_[k.label]) < ch;
+            });
+        if (next == kids_end || static_cast<unsigned char>(labels_[next->label]) != c) break;
+
+        std::string_view label(labels_.data() + next->label, next->label_len);
+        if (path.substr(depth, label.size()) != label) break;
+
+        depth += label.size();
+        n = static_cast<uint32_t>(next - nodes_.data());
+    }
+
+    // Routes with no path key only need checking ahead of the trie's answer
+    for (uint32_t index : linear_) {
+        if (index >= best) break;
+        if (index < from) continue;
+        if (predicates_match(index, req)) return index;
+    }
+
+    return best;
+}
+
+void Route::set_rate_limiter(std::shared_ptr<GcraLimiter> limiter) {
+    std::lock_guard<std::mutex> lock(limiter_mutex_);
+    limiter_.store(limiter.get(), std::memory_order_release);
+    limiter_refs_.push_back(limiter);
+    limiter_current_ = std::move(limiter);
+}
+
+void Route::set_client_rate_limiter(std::shared_ptr<KeyedGcraLimiter> limiter) {
+    std::lock_guard<std::mutex> lock(limiter_mutex_);
+    client_limiter_.store(limiter.get(), std::memory_order_release);
+    limiter_refs_.push_back(limiter);
+    client_limiter_current_ = std::move(limiter);
+}
+
+std::shared_ptr<GcraLimiter> Route::rate_limiter() const {
+    std::lock_guard<std::mutex> lock(limiter_mutex_);
+    return limiter_current_;
+}
+
+std::shared_ptr<KeyedGcraLimiter> Route::client_rate_limiter() const {
+    std::lock_guard<std::mutex> lock(limiter_mutex_);
+    return client_limiter_current_;
+}
+
+bool Route::allow_request() const {
+    GcraLimiter* limiter = limiter_.load(std::memory_order_acquire);
+    return !limiter || limiter->allow();
+}
+
+bool Route::allow_request(std::string_view client_key) const {
+    uint64_t now = GcraLimiter::now_ns();
+    KeyedGcraLimiter* client = client_limiter_.load(std::memory_order_acquire);
+    if (client && !client->allow(client_key, now)) return false;
+    GcraLimiter* limiter = limiter_.load(std::memory_order_acquire);
+    return !limiter || limiter->allow(now);
+}
+
+namespace {
+
+// Route lookups may come from threads that are not lb_rcu readers (the
+// C shim, the control plane); those go online for the duration of one
+// lookup. Worker threads are already online and pay nothing.
+class RcuReadGuard {
+public:
+    RcuReadGuard() : transient_(!lb_rcu_online()) {
+        if (transient_) {
+            while (lb_rcu_register() < 0) sched_yield();
+        }
+    }
+    ~RcuReadGuard() {
+        if (transient_) lb_rcu_unregister();
+    }
+
+    RcuReadGuard(const RcuReadGuard&) = delete;
+    RcuReadGuard& operator=(const RcuReadGuard&) = delete;
+
+private:
+    bool transient_;
+};
+
+template <typename T>
+void rcu_publish(std::atomic<const T*>& slot, const T* fresh) {
+    const T* old = slot.exchange(fresh, std::memory_order_acq_rel);
+    lb_rcu_retire(const_cast<T*>(old), [](void* p) { delete static_cast<T*>(p); });
+}
+
+bool by_priority(const std::shared_ptr<Route>& a, const std::shared_ptr<Route>& b) {
+    return a->get_priority() > b->get_priority();
+}
+
+}
+
 RequestRouter::RequestRouter()
-    : default_backend_target_(nullptr) {}
+    : snapshot_(new Snapshot{CompiledRoutes({}, nullptr), {}, {}}) {}
+
+RequestRouter::~RequestRouter() {
+    // Nothing can be reading through a router that is being destroyed
+    delete snapshot_.load(std::memory_order_acquire);
+}
 
 void RequestRouter::add_route(std::shared_ptr<Route> route) {
-    std::unique_lock<std::shared_mutex> lock(routes_mutex_);
+    std::lock_guard<std::mutex> lock(config_mutex_);
 
     // Use binary search insertion to maintain sorted order, avoiding full sort
-    auto insert_pos = std::lower_bound(
-        routes_.begin(), routes_.end(), route,
-        [](const auto& a, const auto& b) {
-            return a->get_priority() > b->get_priority();
-        });
+    auto insert_pos = std::lower_bound(routes_.begin(), routes_.end(), route, by_priority);
     routes_.insert(insert_pos, route);
+    attach_limiters_locked(*route);
+    compile_locked();
 }
 
 void RequestRouter::remove_route(const std::string& name) {
-    std::unique_lock<std::shared_mutex> lock(routes_mutex_);
+    std::lock_guard<std::mutex> lock(config_mutex_);
     // Fixed bug: actually compare route names instead of checking priority == 0
     routes_.erase(
         std::remove_if(routes_.begin(), routes_.end(),
@@ -194,137 +613,210 @@ void RequestRouter::remove_route(const std::string& name) {
                           return route->get_name() == name;
                       }),
         routes_.end());
+    compile_locked();
+}
+
+void RequestRouter::replace_routes(std::vector<std::shared_ptr<Route>> routes,
+                                   const std::string& default_backend) {
+    std::stable_sort(routes.begin(), routes.end(), by_priority);
+
+    // The routes carry their limiters; the by-name maps follow them
+    LimiterMap limiters;
+    ClientLimiterMap client_limiters;
+    for (const auto& route : routes) {
+        if (auto l = route->rate_limiter()) limiters[route->get_name()] = std::move(l);
+        if (auto l = route->client_rate_limiter()) client_limiters[route->get_name()] = std::move(l);
+    }
+    auto target = default_backend.empty() ? nullptr : std::make_shared<RouteTarget>(default_backend);
+
+    std::lock_guard<std::mutex> lock(config_mutex_);
+    routes_ = std::move(routes);
+    default_backend_ = default_backend;
+    default_target_ = std::move(target);
+    rate_limiters_ = std::move(limiters);
+    client_limiters_ = std::move(client_limiters);
+    compile_locked();
+}
+
+std::shared_ptr<Route> RequestRouter::find_route(const std::string& name) const {
+    std::lock_guard<std::mutex> lock(config_mutex_);
+    for (const auto& route : routes_) {
+        if (route->get_name() == name) return route;
+    }
+    return nullptr;
+}
+
+std::vector<std::shared_ptr<Route>> RequestRouter::get_routes() const {
+    std::lock_guard<std::mutex> lock(config_mutex_);
+    return routes_;
+}
+
+std::string RequestRouter::get_default_backend() const {
+    std::lock_guard<std::mutex> lock(config_mutex_);
+    return default_backend_;
+}
+
+void RequestRouter::compile() {
+    std::lock_guard<std::mutex> lock(config_mutex_);
+    compile_locked();
+}
+
+void RequestRouter::compile_locked() {
+    rcu_publish(snapshot_, static_cast<const Snapshot*>(new Snapshot{
+        CompiledRoutes(routes_, default_target_), rate_limiters_, client_limiters_}));
 }
 
 std::shared_ptr<RouteTarget> RequestRouter::route_request(
     const std::string& method,
     const std::string& path,
     const std::unordered_map<std::string, std::string>& headers) {
+    std::vector<HeaderRef> refs;
+    refs.reserve(headers.size());
+    for (const auto& [name, value] : headers) {
+        refs.push_back(HeaderRef{name, value});
+    }
+    return route_request(std::string_view(method), std::string_view(path),
+                         std::span<const HeaderRef>(refs));
+}
 
-    // Use atomic operations for stats to reduce lock contention
-    stats_.total_requests.fetch_add(1, std::memory_order_relaxed);
+std::shared_ptr<RouteTarget> RequestRouter::route_request(
+    std::string_view method,
+    std::string_view path,
+    std::span<const HeaderRef> headers) {
+
+    stats_.add(STAT_TOTAL);
 
-    // Hold read lock only during route matching, release before stats updates
     std::shared_ptr<RouteTarget> target;
+    std::shared_ptr<RouteTarget> fallback;
     {
-        std::shared_lock<std::shared_mutex> lock(routes_mutex_);
-
-        for (const auto& route : routes_) {
-            if (route->matches(path, headers)) {
-                target = route->select_target();
-                if (target) {
-                    break;
-                }
-            }
+        RcuReadGuard guard;
+        const CompiledRoutes& table = snapshot_.load(std::memory_order_acquire)->routes;
+
+        // A matching route whose circuit is open falls through to the next
+        uint32_t from = 0;
+        while (!target) {
+            uint32_t index = table.first_match(method, path, headers, from);
+            if (index == CompiledRoutes::npos) break;
+            const Route& route = table.route(index);
+            target = route.select_target();
+            if (target) stats_.add(route.stats_id());
+            from = index + 1;
         }
+        if (!target) fallback = table.default_target();
     }
 
-    // Update stats outside of routes lock to reduce contention
     if (target) {
-        stats_.routed_requests.fetch_add(1, std::memory_order_relaxed);
-        // Use atomic increment for backend selection counter
-        const std::string& backend = target->get_backend();
-        std::lock_guard<std::mutex> stats_lock(stats_mutex_);
-        stats_.backend_selections[backend]++;
+        stats_.add(STAT_ROUTED);
+        stats_.add(target->stats_id());
         return target;
     }
 
-    // Reuse cached default backend target to avoid repeated allocations
-    if (!default_backend_.empty()) {
-        stats_.default_route_hits.fetch_add(1, std::memory_order_relaxed);
-
-        // Check if we have a cached default target
-        auto cached = default_backend_target_.load(std::memory_order_acquire);
-        if (cached && cached->get_backend() == default_backend_) {
-            return std::shared_ptr<RouteTarget>(cached);
-        }
-
-        // Create new target and cache it
-        auto new_target = std::make_shared<RouteTarget>(default_backend_);
-        default_backend_target_.store(new_target.get(), std::memory_order_release);
-        return new_target;
+    // The default target is built once per set_default_backend() and shared
+    if (fallback) {
+        stats_.add(STAT_DEFAULT);
+        return fallback;
     }
 
     return nullptr;
 }
 
 void RequestRouter::set_default_backend(const std::string& backend) {
+    std::lock_guard<std::mutex> lock(config_mutex_);
     default_backend_ = backend;
-    // Invalidate cached default target when backend changes
-    default_backend_target_.store(nullptr, std::memory_order_release);
+    default_target_ = backend.empty() ? nullptr : std::make_shared<RouteTarget>(backend);
+    compile_locked();
 }
 
-void RequestRouter::enable_rate_limiting(const std::string& route_name,
-                                        int requests_per_second) {
-    std::lock_guard<std::mutex> lock(rate_limiters_mutex_);
-
-    auto limiter = std::make_unique<RateLimiter>();
-    limiter->max_tokens = requests_per_second;
-    limiter->tokens = requests_per_second;
-    limiter->last_refill = std::chrono::steady_clock::now();
-
-    rate_limiters_[route_name] = std::move(limiter);
+void RequestRouter::attach_limiters_locked(Route& route) {
+    if (auto it = rate_limiters_.find(route.get_name()); it != rate_limiters_.end()) {
+        route.set_rate_limiter(it->second);
+    }
+    if (auto it = client_limiters_.find(route.get_name()); it != client_limiters_.end()) {
+        route.set_client_rate_limiter(it->second);
+    }
 }
 
-bool RequestRouter::check_rate_limit(const std::string& route_name) {
-    // Fast path: check if rate limiter exists without holding the global lock
-    RateLimiter* limiter = nullptr;
-    {
-        std::lock_guard<std::mutex> lock(rate_limiters_mutex_);
-        auto it = rate_limiters_.find(route_name);
-        if (it == rate_limiters_.end()) {
-            return true;  // No rate limit configured
-        }
-        limiter = it->second.get();
+void RequestRouter::enable_rate_limiting(const std::string& route_name,
+                                        int requests_per_second, int burst) {
+    auto limiter = std::make_shared<GcraLimiter>(
+        requests_per_second, burst > 0 ? burst : requests_per_second);
+
+    std::lock_guard<std::mutex> lock(config_mutex_);
+    rate_limiters_[route_name] = limiter;
+    for (const auto& route : routes_) {
+        if (route->get_name() == route_name) route->set_rate_limiter(limiter);
     }
+    compile_locked();
+}
 
-    // Hold only the specific limiter's lock, not the global map lock
-    std::lock_guard<std::mutex> limiter_lock(limiter->mutex);
-
-    refill_tokens(limiter, limiter->max_tokens);
+void RequestRouter::enable_client_rate_limiting(const std::string& route_name,
+                                               int requests_per_second, int burst,
+                                               uint32_t slots) {
+    auto limiter = std::make_shared<KeyedGcraLimiter>(
+        requests_per_second, burst > 0 ? burst : requests_per_second, slots);
 
-    if (limiter->tokens > 0) {
-        limiter->tokens--;
-        return true;
+    std::lock_guard<std::mutex> lock(config_mutex_);
+    client_limiters_[route_name] = limiter;
+    for (const auto& route : routes_) {
+        if (route->get_name() == route_name) route->set_client_rate_limiter(limiter);
     }
+    compile_locked();
+}
 
-    return false;
+// By-name checks for callers without a Route; the request path should use
+// Route::allow_request() on the route it matched
+bool RequestRouter::check_rate_limit(const std::string& route_name) {
+    RcuReadGuard guard;
+    const Snapshot* snap = snapshot_.load(std::memory_order_acquire);
+    auto it = snap->rate_limiters.find(route_name);
+    if (it == snap->rate_limiters.end()) return true;  // No rate limit configured
+    return it->second->allow();
 }
 
-void RequestRouter::refill_tokens(RateLimiter* limiter, int tokens_per_second) {
-    auto now = std::chrono::steady_clock::now();
-    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
-        now - limiter->last_refill).count();
+bool RequestRouter::check_rate_limit(const std::string& route_name, std::string_view client_key) {
+    RcuReadGuard guard;
+    const Snapshot* snap = snapshot_.load(std::memory_order_acquire);
+    uint64_t now = GcraLimiter::now_ns();
 
-    if (elapsed > 0) {
-        int tokens_to_add = (tokens_per_second * elapsed) / 1000;
-        limiter->tokens = std::min(limiter->max_tokens,
-                                  limiter->tokens + tokens_to_add);
-        limiter->last_refill = now;
+    if (auto it = snap->client_limiters.find(route_name); it != snap->client_limiters.end()) {
+        if (!it->second->allow(client_key, now)) return false;
     }
+    auto it = snap->rate_limiters.find(route_name);
+    return it == snap->rate_limiters.end() || it->second->allow(now);
 }
 
 RequestRouter::RoutingStats RequestRouter::get_stats() const {
-    // Use a snapshot approach instead of copying entire structure under lock
-    RoutingStats snapshot;
-    snapshot.total_requests = stats_.total_requests.load(std::memory_order_relaxed);
-    snapshot.routed_requests = stats_.routed_requests.load(std::memory_order_relaxed);
-    snapshot.default_route_hits = stats_.default_route_hits.load(std::memory_order_relaxed);
+    std::vector<uint64_t> counts = stats_.snapshot();
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        for (size_t id = 0; id < counts.size() && id < stats_baseline_.size(); id++) {
+            counts[id] -= stats_baseline_[id];
+        }
+    }
+    counts.resize(std::max<size_t>(counts.size(), STAT_RESERVED));
 
-    // Only lock for the map copy
-    std::lock_guard<std::mutex> lock(stats_mutex_);
-    snapshot.backend_selections = stats_.backend_selections;
+    RoutingStats snapshot;
+    snapshot.total_requests = counts[STAT_TOTAL];
+    snapshot.routed_requests = counts[STAT_ROUTED];
+    snapshot.default_route_hits = counts[STAT_DEFAULT];
+
+    for (uint32_t id = STAT_RESERVED; id < counts.size(); id++) {
+        if (!counts[id]) continue;
+        // Several objects may share a name; their counts add up
+        if (stat_kind(id) == StatKind::ROUTE) {
+            snapshot.route_hits[stat_name(id)] += counts[id];
+        } else {
+            snapshot.backend_selections[stat_name(id)] += counts[id];
+        }
+    }
 
     return snapshot;
 }
 
 void RequestRouter::reset_stats() {
-    stats_.total_requests.store(0, std::memory_order_relaxed);
-    stats_.routed_requests.store(0, std::memory_order_relaxed);
-    stats_.default_route_hits.store(0, std::memory_order_relaxed);
-
+    auto counts = stats_.snapshot();
     std::lock_guard<std::mutex> lock(stats_mutex_);
-    stats_.backend_selections.clear();
+    stats_baseline_ = std::move(counts);
 }
 
 RouterManager& RouterManager::instance() {
@@ -332,16 +824,450 @@ RouterManager& RouterManager::instance() {
     return instance;
 }
 
+RouterManager::~RouterManager() {
+    delete routers_.load(std::memory_order_acquire);
+}
+
 std::shared_ptr<RequestRouter> RouterManager::get_router(const std::string& name) {
-    std::shared_lock<std::shared_mutex> lock(mutex_);
-    auto it = routers_.find(name);
-    return it != routers_.end() ? it->second : nullptr;
+    RcuReadGuard guard;
+    const RouterMap* routers = routers_.load(std::memory_order_acquire);
+    auto it = routers->find(name);
+    return it != routers->end() ? it->second : nullptr;
 }
 
 void RouterManager::register_router(const std::string& name,
                                    std::shared_ptr<RequestRouter> router) {
-    std::unique_lock<std::shared_mutex> lock(mutex_);
-    routers_[name] = router;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto* fresh = new RouterMap(*routers_.load(std::memory_order_relaxed));
+    (*fresh)[name] = std::move(router);
+    rcu_publish(routers_, static_cast<const RouterMap*>(fresh));
+}
+
+namespace {
+
+// Just enough JSON for router configuration documents
+struct JsonValue {
+    enum Type { NUL, BOOL, NUMBER, STRING, ARRAY, OBJECT } type{NUL};
+    bool boolean{false};
+    double number{0};
+    std::string string;
+    std::vector<JsonValue> array;
+    std::vector<std::pair<std::string, JsonValue>> object;
+
+    const JsonValue* get(std::string_view key) const {
+        for (const auto& [k, v] : object) {
+            if (k == key) return &v;
+        }
+        return nullptr;
+    }
+};
+
+class JsonReader {
+public:
+    explicit JsonReader(std::string_view text) : text_(text) {}
+
+    bool parse(JsonValue& out) {
+        if (!value(out, 0)) return false;
+        skip_ws();
+        return pos_ == text_.size();
+    }
+
+private:
+    void skip_ws() {
+        while (pos_ < text_.size() && (text_[pos_] == ' ' || text_[pos_] == '\t' ||
+                                       text_[pos_] == '\n' || text_[pos_] == '\r')) {
+            pos_++;
+        }
+    }
+
+    bool literal(std::string_view word) {
+        if (text_.substr(pos_, word.size()) != word) return false;
+        pos_ += word.size();
+        return true;
+    }
+
+    static void put_utf8(std::string& out, uint32_t cp) {
+        if (cp < 0x80) {
+            out += static_cast<char>(cp);
+        } else if (cp < 0x800) {
+            out += static_cast<char>(0xc0 | (cp >> 6));
+            out += static_cast<char>(0x80 | (cp & 0x3f));
+        } else if (cp < 0x10000) {
+            out += static_cast<char>(0xe0 | (cp >> 12));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+            out += static_cast<char>(0x80 | (cp & 0x3f));
+        } else {
+            out += static_cast<char>(0xf0 | (cp >> 18));
+            out += static_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+            out += static_cast<char>(0x80 | (cp & 0x3f));
+        }
+    }
+
+    bool hex4(uint32_t& v) {
+        if (pos_ + 4 > text_.size()) return false;
+        v = 0;
+        for (int i = 0; i < 4; i++) {
+            char c = text_[pos_++];
+            v <<= 4;
+            if (c >= '0' && c <= '9') v |= c - '0';
+            else if (c >= 'a' && c <= 'f') v |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') v |= c - 'A' + 10;
+            else return false;
+        }
+        return true;
+    }
+
+    bool string(std::string& out) {
+        if (pos_ >= text_.size() || text_[pos_] != '"') return false;
+        pos_++;
+        while (pos_ < text_.size()) {
+            char c = text_[pos_++];
+            if (c == '"') return true;
+            if (static_cast<unsigned char>(c) < 0x20) return false;
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (pos_ >= text_.size()) return false;
+            switch (text_[pos_++]) {
+                case '"': out += '"'; break;
+                case '\\': out += '\\'; break;
+                case '/': out += '/'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u': {
+                    uint32_t cp;
+                    if (!hex4(cp)) return false;
+                    if (cp >= 0xd800 && cp < 0xdc00) {
+                        uint32_t lo;
+                        if (!literal("\\u") || !hex4(lo) || lo < 0xdc00 || lo >= 0xe000) return false;
+                        cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+                    }
+                    put_utf8(out, cp);
+                    break;
+                }
+                default:
+                    return false;
+            }
+        }
+        return false;
+    }
+
+    bool value(JsonValue& out, int depth) {
+        if (depth > 32) return false;
+        skip_ws();
+        if (pos_ >= text_.size()) return false;
+
+        char c = text_[pos_];
+        if (c == '{') {
+            pos_++;
+            out.type = JsonValue::OBJECT;
+            skip_ws();
+            if (pos_ < text_.size() && text_[pos_] == '}') {
+                pos_++;
+                return true;
+            }
+            for (;;) {
+                std::string key;
+                JsonValue member;
+                skip_ws();
+                if (!string(key)) return false;
+                skip_ws();
+                if (pos_ >= text_.size() || text_[pos_++] != ':') return false;
+                if (!value(member, depth + 1)) return false;
+                out.object.emplace_back(std::move(key), std::move(member));
+                skip_ws();
+                if (pos_ >= text_.size()) return false;
+                if (text_[pos_] == '}') {
+                    pos_++;
+                    return true;
+                }
+                if (text_[pos_++] != ',') return false;
+            }
+        }
+        if (c == '[') {
+            pos_++;
+            out.type = JsonValue::ARRAY;
+            skip_ws();
+            if (pos_ < text_.size() && text_[pos_] == ']') {
+                pos_++;
+                return true;
+            }
+            for (;;) {
+                JsonValue item;
+                if (!value(item, depth + 1)) return false;
+                out.array.push_back(std::move(item));
+                skip_ws();
+                if (pos_ >= text_.size()) return false;
+                if (text_[pos_] == ']') {
+                    pos_++;
+                    return true;
+                }
+                if (text_[pos_++] != ',') return false;
+            }
+        }
+        if (c == '"') {
+            out.type = JsonValue::STRING;
+            return string(out.string);
+        }
+        if (literal("true")) {
+            out.type = JsonValue::BOOL;
+            out.boolean = true;
+            return true;
+        }
+        if (literal("false")) {
+            out.type = JsonValue::BOOL;
+            return true;
+        }
+        if (literal("null")) return true;
+
+        // strtod needs a terminator; numbers in a config are short
+        size_t end = pos_;
+        while (end < text_.size() && std::strchr("+-.0123456789eE", text_[end])) end++;
+        if (end == pos_ || end - pos_ > 63) return false;
+        char buf[64];
+        memcpy(buf, text_.data() + pos_, end - pos_);
+        buf[end - pos_] = '\0';
+        char* stop;
+        out.number = std::strtod(buf, &stop);
+        if (stop != buf + (end - pos_)) return false;
+        out.type = JsonValue::NUMBER;
+        pos_ = end;
+        return true;
+    }
+
+    std::string_view text_;
+    size_t pos_{0};
+};
+
+constexpr std::pair<const char*, RouteRule::MatchType> kMatchNames[] = {
+    {"exact", RouteRule::MatchType::EXACT},
+    {"prefix", RouteRule::MatchType::PREFIX},
+    {"regex", RouteRule::MatchType::REGEX},
+    {"header", RouteRule::MatchType::HEADER},
+    {"method", RouteRule::MatchType::METHOD},
+    {"query_param", RouteRule::MatchType::QUERY_PARAM},
+};
+
+const std::string* json_string(const JsonValue& obj, std::string_view key) {
+    const JsonValue* v = obj.get(key);
+    return v && v->type == JsonValue::STRING ? &v->string : nullptr;
+}
+
+bool json_number(const JsonValue& obj, std::string_view key, double& out) {
+    const JsonValue* v = obj.get(key);
+    if (!v) return true;                    // optional; out keeps its default
+    if (v->type != JsonValue::NUMBER) return false;
+    out = v->number;
+    return true;
+}
+
+// {"rps": N, "burst": N, "slots": N}; burst defaults to rps
+bool json_limit(const JsonValue& spec, double& rps, double& burst, double& slots) {
+    if (spec.type != JsonValue::OBJECT) return false;
+    rps = 0;
+    if (!json_number(spec, "rps", rps) || rps <= 0) return false;
+    burst = rps;
+    return json_number(spec, "burst", burst) && json_number(spec, "slots", slots) && burst >= 1;
+}
+
+std::shared_ptr<Route> route_from_json(const JsonValue& spec) {
+    const std::string* name = json_string(spec, "name");
+    double priority = 0;
+    if (spec.type != JsonValue::OBJECT || !name || !json_number(spec, "priority", priority)) {
+        return nullptr;
+    }
+
+    auto route = std::make_shared<Route>(*name);
+    route->set_priority(static_cast<int>(priority));
+
+    if (const JsonValue* rules = spec.get("rules")) {
+        if (rules->type != JsonValue::ARRAY) return nullptr;
+        for (const auto& rule : rules->array) {
+            const std::string* type = json_string(rule, "type");
+            const std::string* pattern = json_string(rule, "pattern");
+            if (!type || !pattern) return nullptr;
+
+            auto match = std::find_if(std::begin(kMatchNames), std::end(kMatchNames),
+                                      [&](const auto& m) { return *type == m.first; });
+            if (match == std::end(kMatchNames)) return nullptr;
+            // RouteRule builds a std::regex, which throws on a bad pattern
+            if (match->second == RouteRule::MatchType::REGEX) {
+                RegexSet probe;
+                if (probe.add(*pattern) == RegexSet::unsupported) {
+                    try {
+                        std::regex check(*pattern);
+                    } catch (const std::regex_error&) {
+                        return nullptr;
+                    }
+                }
+            }
+            route->add_rule(std::make_shared<RouteRule>(match->second, *pattern));
+        }
+    }
+
+    if (const JsonValue* targets = spec.get("targets")) {
+        if (targets->type != JsonValue::ARRAY) return nullptr;
+        for (const auto& target : targets->array) {
+            const std::string* backend = json_string(target, "backend");
+            double weight = 100;
+            if (!backend || !json_number(target, "weight", weight) || weight < 0) return nullptr;
+            route->add_target(std::make_shared<RouteTarget>(*backend, static_cast<int>(weight)));
+        }
+    }
+
+    double rps, burst, slots = 65536;
+    if (const JsonValue* limit = spec.get("rate_limit")) {
+        if (!json_limit(*limit, rps, burst, slots)) return nullptr;
+        route->set_rate_limiter(std::make_shared<GcraLimiter>(rps, static_cast<uint32_t>(burst)));
+    }
+    if (const JsonValue* limit = spec.get("client_rate_limit")) {
+        if (!json_limit(*limit, rps, burst, slots)) return nullptr;
+        route->set_client_rate_limiter(std::make_shared<KeyedGcraLimiter>(
+            rps, static_cast<uint32_t>(burst), static_cast<uint32_t>(slots)));
+    }
+
+    return route;
+}
+
+void json_escape(std::ostringstream& out, std::string_view s) {
+    out << '"';
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out << buf;
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+void json_limit_out(std::ostringstream& out, const GcraLimiter& limiter) {
+    out << "\"rps\":" << 1e9 / static_cast<double>(limiter.emission_ns())
+        << ",\"burst\":" << limiter.tolerance_ns() / limiter.emission_ns() + 1;
+}
+
+}
+
+// {"routers": {"<name>": {"default_backend": "b",
+//   "routes": [{"name": "api", "priority": 10,
+//               "rules": [{"type": "prefix", "pattern": "/api/"}],
+//               "targets": [{"backend": "b1", "weight": 100}],
+//               "rate_limit": {"rps": 100, "burst": 200},
+//               "client_rate_limit": {"rps": 10, "burst": 20, "slots": 65536}}]}}}
+bool RouterManager::configure_from_json(const std::string& json_config) {
+    JsonValue doc;
+    if (!JsonReader(json_config).parse(doc) || doc.type != JsonValue::OBJECT) return false;
+    const JsonValue* routers = doc.get("routers");
+    if (!routers || routers->type != JsonValue::OBJECT) return false;
+
+    struct Pending {
+        std::string name;
+        std::vector<std::shared_ptr<Route>> routes;
+        std::string default_backend;
+    };
+    std::vector<Pending> pending;
+
+    // Everything is built and validated before anything is published
+    for (const auto& [name, spec] : routers->object) {
+        if (spec.type != JsonValue::OBJECT) return false;
+        Pending p{name, {}, {}};
+        if (const JsonValue* def = spec.get("default_backend")) {
+            if (def->type != JsonValue::STRING) return false;
+            p.default_backend = def->string;
+        }
+        if (const JsonValue* routes = spec.get("routes")) {
+            if (routes->type != JsonValue::ARRAY) return false;
+            for (const auto& route_spec : routes->array) {
+                auto route = route_from_json(route_spec);
+                if (!route) return false;
+                p.routes.push_back(std::move(route));
+            }
+        }
+        pending.push_back(std::move(p));
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto* fresh = new RouterMap(*routers_.load(std::memory_order_relaxed));
+    for (auto& p : pending) {
+        auto& router = (*fresh)[p.name];
+        if (!router) router = std::make_shared<RequestRouter>();
+        router->replace_routes(std::move(p.routes), p.default_backend);
+    }
+    rcu_publish(routers_, static_cast<const RouterMap*>(fresh));
+    return true;
+}
+
+std::string RouterManager::export_config_json() const {
+    std::vector<std::pair<std::string, std::shared_ptr<RequestRouter>>> routers;
+    {
+        RcuReadGuard guard;
+        const RouterMap* map = routers_.load(std::memory_order_acquire);
+        routers.assign(map->begin(), map->end());
+    }
+    std::sort(routers.begin(), routers.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    std::ostringstream out;
+    out << "{\"routers\":{";
+    for (size_t r = 0; r < routers.size(); r++) {
+        if (r) out << ",";
+        json_escape(out, routers[r].first);
+        out << ":{\"default_backend\":";
+        json_escape(out, routers[r].second->get_default_backend());
+        out << ",\"routes\":[";
+
+        auto routes = routers[r].second->get_routes();
+        for (size_t i = 0; i < routes.size(); i++) {
+            const Route& route = *routes[i];
+            if (i) out << ",";
+            out << "{\"name\":";
+            json_escape(out, route.get_name());
+            out << ",\"priority\":" << route.get_priority() << ",\"rules\":[";
+
+            const auto& rules = route.get_rules();
+            for (size_t k = 0; k < rules.size(); k++) {
+                if (k) out << ",";
+                out << "{\"type\":\"" << kMatchNames[static_cast<int>(rules[k]->get_type())].first
+                    << "\",\"pattern\":";
+                json_escape(out, rules[k]->get_pattern());
+                out << "}";
+            }
+            out << "],\"targets\":[";
+
+            const auto& targets = route.get_targets();
+            for (size_t k = 0; k < targets.size(); k++) {
+                if (k) out << ",";
+                out << "{\"backend\":";
+                json_escape(out, targets[k]->get_backend());
+                out << ",\"weight\":" << targets[k]->get_weight() << "}";
+            }
+            out << "]";
+
+            if (auto limiter = route.rate_limiter()) {
+                out << ",\"rate_limit\":{";
+                json_limit_out(out, *limiter);
+                out << "}";
+            }
+            if (auto limiter = route.client_rate_limiter()) {
+                out << ",\"client_rate_limit\":{";
+                json_limit_out(out, limiter->rule());
+                out << ",\"slots\":" << limiter->slots() << "}";
+            }
+            out << "}";
+        }
+        out << "]}";
+    }
+    out << "}}";
+    return out.str();
 }
 
 }
@@ -349,11 +1275,11 @@ void RouterManager::register_router(const std::string& name,
 extern "C" {
 
 void* create_request_router() {
-    auto router = std::make_shared<ultrabalancer::RequestRouter>();
-    return router.get();
+    return new ultrabalancer::RequestRouter();
 }
 
 void destroy_request_router(void* router) {
+    delete static_cast<ultrabalancer::RequestRouter*>(router);
 }
 
 void router_add_route(void* router, const char* name, int priority) {
@@ -363,35 +1289,124 @@ void router_add_route(void* router, const char* name, int priority) {
     cpp_router->add_route(route);
 }
 
+int router_add_rule(void* router, const char* route_name, int type, const char* pattern) {
+    auto cpp_router = static_cast<ultrabalancer::RequestRouter*>(router);
+    auto route = cpp_router->find_route(route_name);
+    if (!route || type < ROUTER_MATCH_EXACT || type > ROUTER_MATCH_QUERY_PARAM) return -1;
+
+    route->add_rule(std::make_shared<ultrabalancer::RouteRule>(
+        static_cast<ultrabalancer::RouteRule::MatchType>(type), pattern));
+    cpp_router->compile();
+    return 0;
+}
+
+int router_add_target(void* router, const char* route_name, const char* backend, int weight) {
+    auto cpp_router = static_cast<ultrabalancer::RequestRouter*>(router);
+    auto route = cpp_router->find_route(route_name);
+    if (!route) return -1;
+
+    route->add_target(std::make_shared<ultrabalancer::RouteTarget>(backend, weight));
+    return 0;
+}
+
 const char* router_route_request(void* router, const char* method,
                                 const char* path, const char* headers_json) {
     auto cpp_router = static_cast<ultrabalancer::RequestRouter*>(router);
+    (void)headers_json;
 
-    std::unordered_map<std::string, std::string> headers;
-    // For simplicity, we skip parsing headers_json in this example
-
-    // headers["path"] = path;
-    headers["method"] = method;
-    auto target = cpp_router->route_request(method, path, headers);
+    auto target = cpp_router->route_request(std::string_view(method), std::string_view(path),
+                                            std::span<const ultrabalancer::HeaderRef>());
     if (target) {
         static thread_local std::string backend;
         backend = target->get_backend();
-        
         return backend.c_str();
-
     }
 
     return nullptr;
 }
-
 void router_set_default_backend(void* router, const char* backend) {
     auto cpp_router = static_cast<ultrabalancer::RequestRouter*>(router);
     cpp_router->set_default_backend(backend);
 }
 
+void router_enable_rate_limit(void* router, const char* route_name, int rps, int burst) {
+    auto cpp_router = static_cast<ultrabalancer::RequestRouter*>(router);
+    cpp_router->enable_rate_limiting(route_name, rps, burst);
+}
+
+void router_enable_client_rate_limit(void* router, const char* route_name, int rps, int burst) {
+    auto cpp_router = static_cast<ultrabalancer::RequestRouter*>(router);
+    cpp_router->enable_client_rate_limiting(route_name, rps, burst);
+}
+
 int router_check_rate_limit(void* router, const char* route_name) {
     auto cpp_router = static_cast<ultrabalancer::RequestRouter*>(router);
     return cpp_router->check_rate_limit(route_name) ? 1 : 0;
 }
 
+int router_get_stats(void* router, char* buffer, size_t buffer_size) {
+    auto cpp_router = static_cast<ultrabalancer::RequestRouter*>(router);
+    if (!cpp_router || !buffer || buffer_size == 0) return -1;
+
+    auto stats = cpp_router->get_stats();
+    std::ostringstream oss;
+    oss << "{"
+        << "\"total_requests\":" << stats.total_requests << ","
+        << "\"routed_requests\":" << stats.routed_requests << ","
+        << "\"default_route_hits\":" << stats.default_route_hits << ","
+        << "\"route_hits\":{";
+
+    bool first = true;
+    for (const auto& [name, hits] : stats.route_hits) {
+        if (!first) oss << ",";
+        first = false;
+        oss << "\"" << name << "\":" << hits;
+    }
+    oss << "},\"backend_selections\":{";
+
+    first = true;
+    for (const auto& [name, hits] : stats.backend_selections) {
+        if (!first) oss << ",";
+        first = false;
+        oss << "\"" << name << "\":" << hits;
+    }
+    oss << "}}";
+
+    std::string json = oss.str();
+    size_t copy_len = std::min(json.length(), buffer_size - 1);
+    memcpy(buffer, json.c_str(), copy_len);
+    buffer[copy_len] = '\0';
+
+    return static_cast<int>(copy_len);
+}
+
+void router_reset_stats(void* router) {
+    static_cast<ultrabalancer::RequestRouter*>(router)->reset_stats();
+}
+
+int router_manager_configure(const char* json) {
+    return ultrabalancer::RouterManager::instance().configure_from_json(json) ? 0 : -1;
+}
+
+void* router_manager_get(const char* name) {
+    // The manager keeps registered routers alive; hand out the raw pointer
+    return ultrabalancer::RouterManager::instance().get_router(name).get();
+}
+
+int router_manager_export(char* buffer, size_t buffer_size) {
+    if (!buffer || buffer_size == 0) return -1;
+
+    std::string json = ultrabalancer::RouterManager::instance().export_config_json();
+    size_t copy_len = std::min(json.length(), buffer_size - 1);
+    memcpy(buffer, json.c_str(), copy_len);
+    buffer[copy_len] = '\0';
+
+    return static_cast<int>(copy_len);
+}
+
+int router_check_client_rate_limit(void* router, const char* route_name, const char* client_key) {
+    auto cpp_router = static_cast<ultrabalancer::RequestRouter*>(router);
+    return cpp_router->check_rate_limit(route_name, std::string_view(client_key)) ? 1 : 0;
+}
+
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "core/proxy.h"
 #include "core/common.h"
+#include "core/lb_utils.h"
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -51,6 +52,39 @@ void server_set_state(server_t *srv, int state) {
     srv->prev_state = srv->cur_state;
     srv->cur_state = state;
     srv->last_change = time(NULL);
+    if (srv->proxy) proxy_update_usable(srv->proxy);
+}
+
+void server_set_weight(server_t *srv, uint32_t weight) {
+    srv->weight = weight;
+    if (srv->proxy) proxy_update_usable(srv->proxy);
+}
+
+// Effective weight in 1/SRV_EWGHT_SCALE units. It ramps linearly from 0
+// over slowstart ms after the server comes back to running; cur_eweight
+// keeps the last value for the stats pages.
+uint32_t server_eweight(server_t *srv, time_t now) {
+    uint32_t full = (srv->weight ? srv->weight : 1) * SRV_EWGHT_SCALE;
+    uint32_t eweight = full;
+    uint64_t elapsed_ms = now > srv->last_change ? (uint64_t)(now - srv->last_change) * 1000 : 0;
+
+    if (srv->slowstart && srv->prev_state != SRV_RUNNING && srv->last_change &&
+        elapsed_ms < srv->slowstart) {
+        eweight = (uint32_t)(((uint64_t)full * elapsed_ms) / srv->slowstart);
+        if (!eweight) eweight = 1;
+    }
+    srv->cur_eweight = eweight;
+    return eweight;
+}
+
+// Selection that ignores weights keeps a warming server with probability
+// eweight / full weight
+int server_slowstart_admit(server_t *srv, time_t now) {
+    if (!srv->slowstart) return 1;
+
+    uint32_t full = (srv->weight ? srv->weight : 1) * SRV_EWGHT_SCALE;
+    uint32_t eweight = server_eweight(srv, now);
+    return eweight >= full || lb_rand_range(full) < eweight;
 }
 
 int server_is_usable(server_t *srv) {
@@ -1,5 +1,6 @@
 #include "core/proxy.h"
 #include "core/common.h"
+#include "core/lb_clock.h"
 #include <stdlib.h>
 #include <sys/time.h>
 
@@ -8,7 +9,7 @@ session_t* session_new(listener_t *l) {
     if (!sess) return NULL;
 
     sess->listener = l;
-    sess->accept_date = time(NULL);
+    sess->accept_date = lb_now_sec();
     gettimeofday(&sess->tv_accept, NULL);
 
     return sess;
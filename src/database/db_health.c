@@ -1,17 +1,32 @@
 #include "database/db_health.h"
 #include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <stdatomic.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <poll.h>
 #include <time.h>
+#include <openssl/evp.h>
 
 static void* db_health_check_thread(void* arg);
 
+static const char* const db_default_lag_query[DB_PROTOCOL_REDIS + 1] = {
+    [DB_PROTOCOL_POSTGRESQL] =
+        "SELECT CASE WHEN NOT pg_is_in_recovery() "
+        "OR pg_last_wal_receive_lsn() = pg_last_wal_replay_lsn() THEN 0 "
+        "ELSE COALESCE(EXTRACT(EPOCH FROM now() - pg_last_xact_replay_timestamp()) * 1000, 0) END",
+    [DB_PROTOCOL_MYSQL] =
+        "SELECT COALESCE(MAX(IF(APPLYING_TRANSACTION = '', 0, "
+        "TIMESTAMPDIFF(MICROSECOND, APPLYING_TRANSACTION_ORIGINAL_COMMIT_TIMESTAMP, NOW(6)) / 1000)), 0) "
+        "FROM performance_schema.replication_applier_status_by_worker",
+};
+
 db_health_checker_t* db_health_checker_create(db_pool_t* pool,
                                                 uint32_t check_interval_ms,
                                                 uint32_t timeout_ms,
@@ -21,12 +36,20 @@ db_health_checker_t* db_health_checker_create(db_pool_t* pool,
     db_health_checker_t* checker = (db_health_checker_t*)calloc(1, sizeof(db_health_checker_t));
     if (!checker) return NULL;
 
+    checker->probes = (db_probe_t*)calloc(DB_HEALTH_MAX_PROBES, sizeof(db_probe_t));
+    if (!checker->probes) {
+        free(checker);
+        return NULL;
+    }
+
     checker->pool = pool;
-    checker->check_interval_ms = check_interval_ms;
-    checker->timeout_ms = timeout_ms;
+    checker->check_interval_ms = check_interval_ms ? check_interval_ms : 500;
+    checker->timeout_ms = timeout_ms ? timeout_ms : 1000;
     checker->max_lag_ms = max_lag_ms;
     atomic_store(&checker->running, false);
 
+    db_pool_set_max_replica_lag(pool, max_lag_ms);
+
     return checker;
 }
 
@@ -37,9 +60,45 @@ void db_health_checker_destroy(db_health_checker_t* checker) {
         db_health_checker_stop(checker);
     }
 
+    for (uint32_t i = 0; i < checker->probe_count; i++) {
+        if (checker->probes[i].fd >= 0) close(checker->probes[i].fd);
+    }
+    for (int i = 0; i <= DB_PROTOCOL_REDIS; i++) {
+        free(checker->lag_query[i]);
+    }
+    free(checker->probes);
     free(checker);
 }
 
+int db_health_checker_set_auth(db_health_checker_t* checker, const char* user,
+                               const char* password, const char* database) {
+    if (!checker || !user || atomic_load(&checker->running)) return -1;
+    if (strlen(user) >= sizeof(checker->user) ||
+        (password && strlen(password) >= sizeof(checker->password)) ||
+        (database && strlen(database) >= sizeof(checker->database))) {
+        return -1;
+    }
+
+    snprintf(checker->user, sizeof(checker->user), "%s", user);
+    snprintf(checker->password, sizeof(checker->password), "%s", password ? password : "");
+    snprintf(checker->database, sizeof(checker->database), "%s", database ? database : "");
+    return 0;
+}
+
+int db_health_checker_set_lag_query(db_health_checker_t* checker,
+                                    db_protocol_type_t protocol, const char* sql) {
+    if (!checker || !sql || atomic_load(&checker->running)) return -1;
+    if (protocol != DB_PROTOCOL_POSTGRESQL && protocol != DB_PROTOCOL_MYSQL) return -1;
+    // Sent in one buffer with its framing
+    if (strlen(sql) > sizeof(((db_probe_t*)0)->out) - 8) return -1;
+
+    char* copy = strdup(sql);
+    if (!copy) return -1;
+    free(checker->lag_query[protocol]);
+    checker->lag_query[protocol] = copy;
+    return 0;
+}
+
 int db_health_checker_start(db_health_checker_t* checker) {
     if (!checker || atomic_load(&checker->running)) return -1;
 
@@ -82,15 +141,8 @@ static int db_health_check_tcp(const char* host, uint16_t port, uint32_t timeout
         return -1;
     }
 
-    fd_set write_fds;
-    FD_ZERO(&write_fds);
-    FD_SET(fd, &write_fds);
-
-    struct timeval timeout;
-    timeout.tv_sec = timeout_ms / 1000;
-    timeout.tv_usec = (timeout_ms % 1000) * 1000;
-
-    result = select(fd + 1, NULL, &write_fds, NULL, &timeout);
+    struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+    result = poll(&pfd, 1, timeout_ms);
     if (result <= 0) {
         close(fd);
         return -1;
@@ -107,43 +159,6 @@ static int db_health_check_tcp(const char* host, uint16_t port, uint32_t timeout
     return 0;
 }
 
-static uint64_t db_health_check_postgresql_lag(const char* host, uint16_t port) {
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (fd < 0) return UINT64_MAX;
-
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
-
-    if (inet_pton(AF_INET, host, &addr.sin_addr) <= 0) {
-        close(fd);
-        return UINT64_MAX;
-    }
-
-    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-        close(fd);
-        return UINT64_MAX;
-    }
-
-    const char* query = "SELECT EXTRACT(EPOCH FROM (now() - pg_last_xact_replay_timestamp())) * 1000;";
-    ssize_t sent = send(fd, query, strlen(query), 0);
-
-    if (sent <= 0) {
-        close(fd);
-        return 0;
-    }
-
-    close(fd);
-    return 0;
-}
-
-static uint64_t db_health_check_mysql_lag(const char* host, uint16_t port) {
-    (void)host;
-    (void)port;
-    return UINT64_MAX;
-}
-
 int db_health_check_backend(db_backend_t* backend) {
     if (!backend) return -1;
 
@@ -162,65 +177,604 @@ int db_health_check_backend(db_backend_t* backend) {
     }
 }
 
-uint64_t db_health_check_replication_lag(db_backend_t* backend) {
-    if (!backend || backend->role != DB_BACKEND_REPLICA) {
-        return 0;
+static uint64_t db_health_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool db_probe_has_auth(const db_health_checker_t* checker, const db_probe_t* probe) {
+    return checker->user[0] && probe->protocol != DB_PROTOCOL_REDIS;
+}
+
+static void db_probe_close(db_probe_t* probe) {
+    if (probe->fd >= 0) close(probe->fd);
+    probe->fd = -1;
+    probe->state = DB_PROBE_IDLE;
+    probe->in_len = 0;
+    probe->out_len = probe->out_off = 0;
+}
+
+static void db_probe_report(db_health_checker_t* checker, db_probe_t* probe,
+                            bool ok, uint64_t lag_ms) {
+    if (ok) {
+        probe->fails = 0;
+        probe->healthy = true;
+    } else {
+        atomic_fetch_add(&checker->stats.failures, 1);
+        if (++probe->fails >= DB_HEALTH_FAILS_DOWN) {
+            probe->healthy = false;
+        }
+        lag_ms = probe->role == DB_BACKEND_REPLICA ? UINT64_MAX : 0;
     }
+    db_pool_set_backend_state(checker->pool, probe->backend_id, probe->healthy, lag_ms);
+}
+
+static void db_probe_fail(db_health_checker_t* checker, db_probe_t* probe) {
+    db_probe_close(probe);
+    db_probe_report(checker, probe, false, 0);
+}
 
+// The round is judged; an authenticated connection stays for the next
+static void db_probe_done(db_health_checker_t* checker, db_probe_t* probe) {
     uint64_t lag = 0;
+    if (probe->role == DB_BACKEND_REPLICA && probe->value > 0) {
+        lag = (uint64_t)probe->value;
+    }
+    db_probe_report(checker, probe, true, lag);
+    probe->state = DB_PROBE_READY;
+    probe->in_len = 0;
+}
 
-    switch (backend->protocol) {
-        case DB_PROTOCOL_POSTGRESQL:
-            lag = db_health_check_postgresql_lag(backend->host, backend->port);
-            break;
-        case DB_PROTOCOL_MYSQL:
-            lag = db_health_check_mysql_lag(backend->host, backend->port);
-            break;
-        case DB_PROTOCOL_REDIS:
-            lag = 0;
-            break;
+static bool db_probe_queue(db_probe_t* probe, const void* data, size_t len) {
+    if (probe->out_len + len > sizeof(probe->out)) return false;
+    memcpy(probe->out + probe->out_len, data, len);
+    probe->out_len += len;
+    return true;
+}
+
+static void db_put32be(uint8_t* p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static void db_put32le(uint8_t* p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static uint32_t db_get32be(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static bool db_digest(const char* md, const void* a, size_t alen,
+                      const void* b, size_t blen, uint8_t* out) {
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    bool ok = ctx &&
+              EVP_DigestInit_ex(ctx, EVP_get_digestbyname(md), NULL) == 1 &&
+              EVP_DigestUpdate(ctx, a, alen) == 1 &&
+              (!blen || EVP_DigestUpdate(ctx, b, blen) == 1) &&
+              EVP_DigestFinal_ex(ctx, out, NULL) == 1;
+    EVP_MD_CTX_free(ctx);
+    return ok;
+}
+
+/* PostgreSQL */
+
+static bool db_pg_queue_message(db_probe_t* probe, char type, const char* body, size_t len) {
+    uint8_t hdr[5] = { (uint8_t)type };
+    db_put32be(hdr + 1, (uint32_t)len + 4);
+    return db_probe_queue(probe, hdr, 5) && db_probe_queue(probe, body, len);
+}
+
+static bool db_pg_startup(db_health_checker_t* checker, db_probe_t* probe) {
+    char body[400];
+    size_t n = 4;
+    db_put32be((uint8_t*)body, 196608);     // protocol 3.0
+    n += snprintf(body + n, sizeof(body) - n, "user%c%s%c", 0, checker->user, 0);
+    if (checker->database[0]) {
+        n += snprintf(body + n, sizeof(body) - n, "database%c%s%c", 0, checker->database, 0);
+    }
+    n += snprintf(body + n, sizeof(body) - n, "application_name%cultrabalancer-health%c", 0, 0);
+    body[n++] = 0;
+
+    uint8_t len[4];
+    db_put32be(len, (uint32_t)n + 4);
+    return db_probe_queue(probe, len, 4) && db_probe_queue(probe, body, n);
+}
+
+static bool db_pg_password(db_health_checker_t* checker, db_probe_t* probe,
+                           const uint8_t* salt) {
+    char pw[40];
+    if (!salt) {
+        return db_pg_queue_message(probe, 'p', checker->password, strlen(checker->password) + 1);
+    }
+
+    // "md5" + md5hex(md5hex(password + user) + salt)
+    uint8_t d[EVP_MAX_MD_SIZE];
+    char hex[33];
+    if (!db_digest("MD5", checker->password, strlen(checker->password),
+                   checker->user, strlen(checker->user), d)) {
+        return false;
+    }
+    for (int i = 0; i < 16; i++) snprintf(hex + 2 * i, 3, "%02x", d[i]);
+    if (!db_digest("MD5", hex, 32, salt, 4, d)) return false;
+    memcpy(pw, "md5", 3);
+    for (int i = 0; i < 16; i++) snprintf(pw + 3 + 2 * i, 3, "%02x", d[i]);
+    return db_pg_queue_message(probe, 'p', pw, 36);
+}
+
+static bool db_pg_message(db_health_checker_t* checker, db_probe_t* probe,
+                          uint8_t type, const uint8_t* body, size_t len) {
+    switch (type) {
+        case 'R': {
+            if (len < 4) return false;
+            uint32_t code = db_get32be(body);
+            if (code == 0) return true;
+            if (code == 3) return db_pg_password(checker, probe, NULL);
+            if (code == 5 && len >= 8) return db_pg_password(checker, probe, body + 4);
+            return false;           // SASL and the rest
+        }
+        case 'E':
+            if (probe->state == DB_PROBE_AUTH) return false;
+            probe->failed = true;
+            return true;
+        case 'D':
+            // The first column of the first row
+            if (!probe->have_value && len >= 6 && ((body[0] << 8) | body[1]) >= 1) {
+                int32_t vlen = (int32_t)db_get32be(body + 2);
+                char num[64] = "0";
+                if (vlen > 0 && (size_t)vlen + 6 <= len && vlen < (int32_t)sizeof(num)) {
+                    memcpy(num, body + 6, vlen);
+                    num[vlen] = 0;
+                }
+                probe->value = strtod(num, NULL);
+                probe->have_value = true;
+            }
+            return true;
+        case 'Z':
+            if (probe->state == DB_PROBE_AUTH) {
+                probe->state = DB_PROBE_READY;
+                return true;
+            }
+            if (probe->failed || !probe->have_value) return false;
+            db_probe_done(checker, probe);
+            return true;
         default:
-            lag = 0;
-            break;
+            return true;            // ParameterStatus, BackendKeyData, RowDescription...
     }
+}
+
+static ssize_t db_pg_parse(db_health_checker_t* checker, db_probe_t* probe) {
+    size_t off = 0;
+    while (probe->in_len - off >= 5) {
+        uint32_t len = db_get32be(probe->in + off + 1);
+        if (len < 4 || len + 1 > sizeof(probe->in)) return -1;
+        if (probe->in_len - off < len + 1) break;
 
-    backend->replication_lag_ms = lag;
-    return lag;
+        db_probe_state_t before = probe->state;
+        if (!db_pg_message(checker, probe, probe->in[off], probe->in + off + 5, len - 4)) {
+            return -1;
+        }
+        off += len + 1;
+        if (before == DB_PROBE_QUERY && probe->state == DB_PROBE_READY) {
+            // db_probe_done() emptied the buffer
+            return 0;
+        }
+    }
+    return off;
+}
+
+/* MySQL */
+
+#define MYSQL_CLIENT_LONG_PASSWORD      0x00000001
+#define MYSQL_CLIENT_CONNECT_WITH_DB    0x00000008
+#define MYSQL_CLIENT_PROTOCOL_41        0x00000200
+#define MYSQL_CLIENT_SECURE_CONNECTION  0x00008000
+#define MYSQL_CLIENT_PLUGIN_AUTH        0x00080000
+
+static bool db_mysql_queue_packet(db_probe_t* probe, uint8_t seq, const void* body, size_t len) {
+    uint8_t hdr[4] = { (uint8_t)len, (uint8_t)(len >> 8), (uint8_t)(len >> 16), seq };
+    return db_probe_queue(probe, hdr, 4) && db_probe_queue(probe, body, len);
+}
+
+// mysql_native_password:  SHA1(pw) ^ SHA1(nonce + SHA1(SHA1(pw)))
+// caching_sha2_password:  SHA256(pw) ^ SHA256(SHA256(SHA256(pw)) + nonce)
+static int db_mysql_scramble(const char* plugin, const char* password,
+                             const uint8_t* nonce, uint8_t* out) {
+    if (!password[0]) return 0;
+
+    uint8_t h1[EVP_MAX_MD_SIZE], h2[EVP_MAX_MD_SIZE], h3[EVP_MAX_MD_SIZE];
+    size_t pwlen = strlen(password);
+
+    if (!strcmp(plugin, "mysql_native_password")) {
+        if (!db_digest("SHA1", password, pwlen, NULL, 0, h1) ||
+            !db_digest("SHA1", h1, 20, NULL, 0, h2) ||
+            !db_digest("SHA1", nonce, 20, h2, 20, h3)) {
+            return -1;
+        }
+        for (int i = 0; i < 20; i++) out[i] = h1[i] ^ h3[i];
+        return 20;
+    }
+    if (!strcmp(plugin, "caching_sha2_password")) {
+        if (!db_digest("SHA256", password, pwlen, NULL, 0, h1) ||
+            !db_digest("SHA256", h1, 32, NULL, 0, h2) ||
+            !db_digest("SHA256", h2, 32, nonce, 20, h3)) {
+            return -1;
+        }
+        for (int i = 0; i < 32; i++) out[i] = h1[i] ^ h3[i];
+        return 32;
+    }
+    return -1;
+}
+
+static bool db_mysql_handshake(db_health_checker_t* checker, db_probe_t* probe,
+                               const uint8_t* p, size_t len) {
+    const uint8_t* end = p + len;
+    if (len < 1 || p[0] != 10) return false;
+
+    // Version string, connection id, nonce part 1, filler
+    const uint8_t* q = memchr(p + 1, 0, len - 1);
+    if (!q || end - q < 1 + 4 + 8 + 1 + 2 + 1 + 2 + 2 + 1 + 10 + 12) return false;
+    q += 1 + 4;
+    uint8_t nonce[20];
+    memcpy(nonce, q, 8);
+    q += 8 + 1 + 2 + 1 + 2 + 2 + 1 + 10;
+    memcpy(nonce + 8, q, 12);
+    q += 13;
+
+    const char* plugin = "mysql_native_password";
+    if (q < end && memchr(q, 0, end - q)) {
+        plugin = (const char*)q;
+    }
+    if (strcmp(plugin, "caching_sha2_password") != 0) {
+        plugin = "mysql_native_password";
+    }
+
+    uint8_t auth[32];
+    int auth_len = db_mysql_scramble(plugin, checker->password, nonce, auth);
+    if (auth_len < 0) return false;
+
+    uint8_t body[400];
+    size_t n = 0;
+    uint32_t caps = MYSQL_CLIENT_LONG_PASSWORD | MYSQL_CLIENT_PROTOCOL_41 |
+                    MYSQL_CLIENT_SECURE_CONNECTION | MYSQL_CLIENT_PLUGIN_AUTH;
+    if (checker->database[0]) caps |= MYSQL_CLIENT_CONNECT_WITH_DB;
+
+    db_put32le(body, caps);
+    db_put32le(body + 4, 1 << 24);                  // max packet
+    body[8] = 0x21;                                 // utf8_general_ci
+    memset(body + 9, 0, 23);
+    n = 32;
+    n += snprintf((char*)body + n, sizeof(body) - n, "%s", checker->user) + 1;
+    body[n++] = (uint8_t)auth_len;
+    memcpy(body + n, auth, auth_len);
+    n += auth_len;
+    if (checker->database[0]) {
+        n += snprintf((char*)body + n, sizeof(body) - n, "%s", checker->database) + 1;
+    }
+    n += snprintf((char*)body + n, sizeof(body) - n, "%s", plugin) + 1;
+
+    return db_mysql_queue_packet(probe, probe->seq + 1, body, n);
+}
+
+static bool db_mysql_auth_reply(db_health_checker_t* checker, db_probe_t* probe,
+                                const uint8_t* p, size_t len) {
+    if (len < 1) return false;
+    switch (p[0]) {
+        case 0x00:
+            probe->state = DB_PROBE_READY;
+            return true;
+        case 0x01:
+            // caching_sha2_password: 3 is fast auth passed, 4 wants the
+            // full exchange, which needs TLS or the server's RSA key
+            return len >= 2 && p[1] == 3;
+        case 0xfe: {
+            // Auth switch: plugin name, then a fresh nonce
+            const uint8_t* nul = memchr(p + 1, 0, len - 1);
+            if (!nul || (size_t)(p + len - nul - 1) < 20) return false;
+            uint8_t auth[32];
+            int auth_len = db_mysql_scramble((const char*)p + 1, checker->password, nul + 1, auth);
+            if (auth_len < 0) return false;
+            return db_mysql_queue_packet(probe, probe->seq + 1, auth, auth_len);
+        }
+        default:
+            return false;
+    }
+}
+
+static bool db_mysql_is_eof(const uint8_t* p, size_t len) {
+    return len >= 1 && len < 9 && p[0] == 0xfe;
+}
+
+static bool db_mysql_result(db_health_checker_t* checker, db_probe_t* probe,
+                            const uint8_t* p, size_t len) {
+    if (len >= 1 && p[0] == 0xff) return false;
+
+    switch (probe->phase) {
+        case 0:     // column count; an OK here means no result set
+            if (len < 1 || p[0] == 0x00) return false;
+            probe->phase = 1;
+            return true;
+        case 1:     // column definitions up to an EOF
+            if (db_mysql_is_eof(p, len)) probe->phase = 2;
+            return true;
+        default:    // rows up to an EOF
+            if (db_mysql_is_eof(p, len)) {
+                if (!probe->have_value) return false;
+                db_probe_done(checker, probe);
+                return true;
+            }
+            if (!probe->have_value && len >= 1) {
+                char num[64] = "0";
+                size_t vlen = p[0] < 0xfb ? p[0] : 0;     // 0xfb is NULL
+                if (vlen && vlen + 1 <= len && vlen < sizeof(num)) {
+                    memcpy(num, p + 1, vlen);
+                    num[vlen] = 0;
+                }
+                probe->value = strtod(num, NULL);
+                probe->have_value = true;
+            }
+            return true;
+    }
+}
+
+static ssize_t db_mysql_parse(db_health_checker_t* checker, db_probe_t* probe) {
+    size_t off = 0;
+    while (probe->in_len - off >= 4) {
+        const uint8_t* h = probe->in + off;
+        size_t len = h[0] | (h[1] << 8) | (h[2] << 16);
+        if (len + 4 > sizeof(probe->in)) return -1;
+        if (probe->in_len - off < len + 4) break;
+
+        probe->seq = h[3];
+        bool ok;
+        if (probe->state == DB_PROBE_AUTH) {
+            // The first packet is the server's greeting
+            ok = probe->phase == 0 ?
+                 db_mysql_handshake(checker, probe, h + 4, len) :
+                 db_mysql_auth_reply(checker, probe, h + 4, len);
+            probe->phase = 1;
+        } else {
+            ok = db_mysql_result(checker, probe, h + 4, len);
+        }
+        if (!ok) return -1;
+        off += len + 4;
+
+        if (probe->state == DB_PROBE_READY) {
+            probe->phase = 0;
+            if (probe->in_len == 0) return 0;   // db_probe_done() emptied it
+        }
+    }
+    return off;
+}
+
+/* The probe loop */
+
+static void db_probe_send_query(db_health_checker_t* checker, db_probe_t* probe, uint64_t now) {
+    const char* sql = "SELECT 0";
+    if (probe->role == DB_BACKEND_REPLICA) {
+        sql = checker->lag_query[probe->protocol] ?
+              checker->lag_query[probe->protocol] : db_default_lag_query[probe->protocol];
+    }
+
+    probe->failed = false;
+    probe->have_value = false;
+    probe->value = 0;
+    probe->phase = 0;
+    probe->in_len = 0;
+    probe->out_len = probe->out_off = 0;
+
+    bool ok;
+    if (probe->protocol == DB_PROTOCOL_POSTGRESQL) {
+        ok = db_pg_queue_message(probe, 'Q', sql, strlen(sql) + 1);
+    } else {
+        uint8_t cmd = 0x03;     // COM_QUERY
+        size_t len = strlen(sql);
+        uint8_t hdr[4] = { (uint8_t)(len + 1), (uint8_t)((len + 1) >> 8),
+                           (uint8_t)((len + 1) >> 16), 0 };
+        ok = db_probe_queue(probe, hdr, 4) && db_probe_queue(probe, &cmd, 1) &&
+             db_probe_queue(probe, sql, len);
+    }
+    if (!ok) {
+        db_probe_fail(checker, probe);
+        return;
+    }
+    probe->state = DB_PROBE_QUERY;
+    probe->deadline_ms = now + checker->timeout_ms;
+}
+
+static void db_probe_start(db_health_checker_t* checker, db_probe_t* probe, uint64_t now) {
+    probe->next_ms = now + checker->check_interval_ms;
+    atomic_fetch_add(&checker->stats.rounds, 1);
+
+    if (probe->state == DB_PROBE_READY) {
+        db_probe_send_query(checker, probe, now);
+        return;
+    }
+    if (probe->state != DB_PROBE_IDLE) return;      // still busy with the last round
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(probe->port);
+    if (inet_pton(AF_INET, probe->host, &addr.sin_addr) <= 0) {
+        db_probe_fail(checker, probe);
+        return;
+    }
+
+    probe->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (probe->fd < 0) {
+        db_probe_fail(checker, probe);
+        return;
+    }
+    int flag = 1;
+    setsockopt(probe->fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+    if (connect(probe->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+        db_probe_fail(checker, probe);
+        return;
+    }
+    probe->state = DB_PROBE_CONNECTING;
+    probe->deadline_ms = now + checker->timeout_ms;
+}
+
+static void db_probe_connected(db_health_checker_t* checker, db_probe_t* probe) {
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(probe->fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0) {
+        db_probe_fail(checker, probe);
+        return;
+    }
+
+    if (!db_probe_has_auth(checker, probe)) {
+        // Reachability is all there is to know
+        db_probe_close(probe);
+        db_probe_report(checker, probe, true, 0);
+        return;
+    }
+
+    probe->state = DB_PROBE_AUTH;
+    probe->phase = 0;
+    probe->in_len = 0;
+    probe->out_len = probe->out_off = 0;
+    if (probe->protocol == DB_PROTOCOL_POSTGRESQL && !db_pg_startup(checker, probe)) {
+        db_probe_fail(checker, probe);
+    }
+    // MySQL: the server speaks first
+}
+
+static void db_probe_io(db_health_checker_t* checker, db_probe_t* probe,
+                        short revents, uint64_t now) {
+    if (probe->state == DB_PROBE_CONNECTING) {
+        if (revents & (POLLOUT | POLLERR | POLLHUP)) db_probe_connected(checker, probe);
+        return;
+    }
+
+    if ((revents & POLLOUT) && probe->out_off < probe->out_len) {
+        ssize_t n = send(probe->fd, probe->out + probe->out_off,
+                         probe->out_len - probe->out_off, MSG_NOSIGNAL);
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            db_probe_fail(checker, probe);
+            return;
+        }
+        if (n > 0) probe->out_off += n;
+        if (probe->out_off == probe->out_len) probe->out_len = probe->out_off = 0;
+    }
+
+    if (!(revents & (POLLIN | POLLERR | POLLHUP))) return;
+
+    ssize_t n = recv(probe->fd, probe->in + probe->in_len, sizeof(probe->in) - probe->in_len, 0);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+    if (n <= 0) {
+        // An idle connection the server closed is no failure; redial next round
+        if (probe->state == DB_PROBE_READY) {
+            db_probe_close(probe);
+        } else {
+            db_probe_fail(checker, probe);
+        }
+        return;
+    }
+    if (probe->state == DB_PROBE_READY) {
+        // Nothing is expected between rounds
+        db_probe_fail(checker, probe);
+        return;
+    }
+    probe->in_len += n;
+
+    bool was_auth = probe->state == DB_PROBE_AUTH;
+    ssize_t used = probe->protocol == DB_PROTOCOL_POSTGRESQL ?
+                   db_pg_parse(checker, probe) : db_mysql_parse(checker, probe);
+    if (used < 0) {
+        db_probe_fail(checker, probe);
+        return;
+    }
+    if (used > 0) {
+        memmove(probe->in, probe->in + used, probe->in_len - used);
+        probe->in_len -= used;
+    }
+
+    // Authenticated: this round's query goes out right away
+    if (was_auth && probe->state == DB_PROBE_READY) {
+        db_probe_send_query(checker, probe, now);
+    }
+}
+
+// Picks up backends added to the pool since the last round
+static void db_probe_refresh(db_health_checker_t* checker) {
+    db_backend_t backends[DB_HEALTH_MAX_PROBES];
+    uint32_t n = db_pool_get_backends(checker->pool, backends, DB_HEALTH_MAX_PROBES);
+
+    for (uint32_t i = checker->probe_count; i < n; i++) {
+        db_probe_t* probe = &checker->probes[i];
+        memset(probe, 0, sizeof(*probe));
+        probe->backend_id = backends[i].id;
+        memcpy(probe->host, backends[i].host, sizeof(probe->host));
+        probe->port = backends[i].port;
+        probe->role = backends[i].role;
+        probe->protocol = backends[i].protocol;
+        probe->fd = -1;
+        probe->healthy = backends[i].is_healthy;
+    }
+    if (n > checker->probe_count) checker->probe_count = n;
 }
 
 static void* db_health_check_thread(void* arg) {
     db_health_checker_t* checker = (db_health_checker_t*)arg;
+    struct pollfd pfds[DB_HEALTH_MAX_PROBES];
+    db_probe_t* owners[DB_HEALTH_MAX_PROBES];
+    uint64_t next_refresh = 0;
 
     while (atomic_load(&checker->running)) {
-        pthread_mutex_t* mutex = (pthread_mutex_t*)checker->pool->mutex;
-        pthread_mutex_lock(mutex);
-
-        db_backend_t* backend = checker->pool->backends;
-        while (backend) {
-            db_backend_t* next = backend->next;
-            pthread_mutex_unlock(mutex);
+        uint64_t now = db_health_now_ms();
+        if (now >= next_refresh) {
+            db_probe_refresh(checker);
+            next_refresh = now + checker->check_interval_ms;
+        }
 
-            int health_result = db_health_check_backend(backend);
+        int nfds = 0;
+        uint64_t wake = now + 100;      // notice stop requests promptly
+        for (uint32_t i = 0; i < checker->probe_count; i++) {
+            db_probe_t* probe = &checker->probes[i];
 
-            if (backend->role == DB_BACKEND_REPLICA && health_result == 0) {
-                uint64_t lag = db_health_check_replication_lag(backend);
+            if (probe->state != DB_PROBE_READY && probe->state != DB_PROBE_IDLE &&
+                now >= probe->deadline_ms) {
+                db_probe_fail(checker, probe);
+            }
+            if ((probe->state == DB_PROBE_IDLE || probe->state == DB_PROBE_READY) &&
+                now >= probe->next_ms) {
+                db_probe_start(checker, probe, now);
+            }
 
-                pthread_mutex_lock(mutex);
-                if (lag > checker->max_lag_ms && backend->is_healthy) {
-                    backend->is_healthy = false;
-                } else if (lag <= checker->max_lag_ms && !backend->is_healthy) {
-                    backend->is_healthy = true;
-                }
-                pthread_mutex_unlock(mutex);
+            if (probe->state == DB_PROBE_IDLE) {
+                if (probe->next_ms < wake) wake = probe->next_ms;
+                continue;
+            }
+            if (probe->state == DB_PROBE_READY) {
+                if (probe->next_ms < wake) wake = probe->next_ms;
+            } else if (probe->deadline_ms < wake) {
+                wake = probe->deadline_ms;
             }
 
-            pthread_mutex_lock(mutex);
-            backend = next;
+            short events = POLLIN;
+            if (probe->state == DB_PROBE_CONNECTING || probe->out_off < probe->out_len) {
+                events |= POLLOUT;
+            }
+            pfds[nfds] = (struct pollfd){ .fd = probe->fd, .events = events };
+            owners[nfds++] = probe;
         }
 
-        pthread_mutex_unlock(mutex);
+        int timeout = wake > now ? (int)(wake - now) : 0;
+        if (poll(pfds, nfds, timeout) <= 0) continue;
 
-        usleep(checker->check_interval_ms * 1000);
+        now = db_health_now_ms();
+        for (int i = 0; i < nfds; i++) {
+            if (pfds[i].revents) db_probe_io(checker, owners[i], pfds[i].revents, now);
+        }
     }
 
     return NULL;
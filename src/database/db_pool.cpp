@@ -10,6 +10,7 @@
 #include <cstring>
 #include <algorithm>
 #include <sstream>
+#include <new>
 
 namespace ultrabalancer {
 namespace database {
@@ -36,7 +37,8 @@ Connection::Connection(Connection&& other) noexcept
       in_transaction_(other.in_transaction_),
       created_at_(other.created_at_),
       last_used_(other.last_used_),
-      state_(other.state_) {
+      state_(other.state_),
+      prepared_(std::move(other.prepared_)) {
     other.fd_ = -1;
 }
 
@@ -52,6 +54,7 @@ Connection& Connection::operator=(Connection&& other) noexcept {
         created_at_ = other.created_at_;
         last_used_ = other.last_used_;
         state_ = other.state_;
+        prepared_ = std::move(other.prepared_);
         other.fd_ = -1;
     }
     return *this;
@@ -93,6 +96,38 @@ bool Connection::validate() {
     return true;
 }
 
+int Connection::prepared(uint64_t name_hash, uint64_t text_hash) const noexcept {
+    for (const auto& [name, text] : prepared_) {
+        if (name == name_hash) {
+            return text == text_hash ? 1 : -1;
+        }
+    }
+    return 0;
+}
+
+void Connection::set_prepared(uint64_t name_hash, uint64_t text_hash) {
+    for (auto& [name, text] : prepared_) {
+        if (name == name_hash) {
+            text = text_hash;
+            return;
+        }
+    }
+    prepared_.emplace_back(name_hash, text_hash);
+}
+
+void Connection::forget_prepared(uint64_t name_hash) noexcept {
+    if (name_hash == 0) {
+        prepared_.clear();
+        return;
+    }
+    auto it = std::find_if(prepared_.begin(), prepared_.end(),
+        [name_hash](const auto& p) { return p.first == name_hash; });
+    if (it != prepared_.end()) {
+        *it = prepared_.back();
+        prepared_.pop_back();
+    }
+}
+
 Backend::Backend(uint64_t id, std::string host, uint16_t port,
                  BackendRole role, db_protocol_type_t protocol)
     : id_(id),
@@ -150,6 +185,65 @@ expected<int, std::string> Backend::create_connection() {
     return fd;
 }
 
+IdleStack::IdleStack(uint32_t capacity)
+    : slots_(std::make_unique<Slot[]>(capacity)),
+      idle_(kNil),
+      free_(kNil) {
+    for (uint32_t i = capacity; i-- > 0;) {
+        put(free_, i);
+    }
+}
+
+IdleStack::~IdleStack() {
+    while (pop()) {}
+}
+
+uint32_t IdleStack::take(std::atomic<uint64_t>& list) noexcept {
+    uint64_t old = list.load(std::memory_order_acquire);
+    for (;;) {
+        uint32_t idx = static_cast<uint32_t>(old);
+        if (idx == kNil) return kNil;
+
+        uint32_t next = slots_[idx].next.load(std::memory_order_relaxed);
+        uint64_t tagged = (((old >> 32) + 1) << 32) | next;
+        if (list.compare_exchange_weak(old, tagged, std::memory_order_acq_rel,
+                                       std::memory_order_acquire)) {
+            return idx;
+        }
+    }
+}
+
+void IdleStack::put(std::atomic<uint64_t>& list, uint32_t idx) noexcept {
+    uint64_t old = list.load(std::memory_order_relaxed);
+    uint64_t tagged;
+    do {
+        slots_[idx].next.store(static_cast<uint32_t>(old), std::memory_order_relaxed);
+        tagged = (((old >> 32) + 1) << 32) | idx;
+    } while (!list.compare_exchange_weak(old, tagged, std::memory_order_release,
+                                         std::memory_order_relaxed));
+}
+
+std::unique_ptr<Connection> IdleStack::push(std::unique_ptr<Connection> conn) noexcept {
+    uint32_t idx = take(free_);
+    if (idx == kNil) return conn;
+
+    slots_[idx].conn = conn.release();
+    put(idle_, idx);
+    size_.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+}
+
+std::unique_ptr<Connection> IdleStack::pop() noexcept {
+    uint32_t idx = take(idle_);
+    if (idx == kNil) return nullptr;
+
+    std::unique_ptr<Connection> conn(slots_[idx].conn);
+    slots_[idx].conn = nullptr;
+    put(free_, idx);
+    size_.fetch_sub(1, std::memory_order_relaxed);
+    return conn;
+}
+
 DatabasePool::DatabasePool(uint32_t max_connections, uint32_t min_idle, uint32_t max_idle,
                            std::chrono::seconds max_lifetime, std::chrono::seconds idle_timeout)
     : max_connections_(max_connections),
@@ -158,27 +252,41 @@ DatabasePool::DatabasePool(uint32_t max_connections, uint32_t min_idle, uint32_t
       max_lifetime_(max_lifetime),
       idle_timeout_(idle_timeout) {}
 
-DatabasePool::~DatabasePool() {
-    std::unique_lock lock(mutex_);
-    idle_connections_.clear();
-}
+DatabasePool::~DatabasePool() = default;
 
 uint64_t DatabasePool::add_backend(const std::string& host, uint16_t port,
                                     BackendRole role, db_protocol_type_t protocol) {
-    std::unique_lock lock(mutex_);
+    std::lock_guard lock(mutex_);
+
+    uint32_t n = backend_count_.load(std::memory_order_relaxed);
+    if (n >= kMaxBackends) {
+        return 0;
+    }
 
-    uint64_t id = next_backend_id_.fetch_add(1);
-    auto backend = std::make_unique<Backend>(id, host, port, role, protocol);
-    backends_.push_back(std::move(backend));
+    uint64_t id = n + 1;
+    backends_[n] = std::make_unique<BackendSlot>(
+        std::make_unique<Backend>(id, host, port, role, protocol), max_idle_);
+    backend_count_.store(n + 1, std::memory_order_release);
 
     return id;
 }
 
+IdleStack* DatabasePool::idle_stack(uint64_t backend_id) const noexcept {
+    if (backend_id == 0 || backend_id > backend_count_.load(std::memory_order_acquire)) {
+        return nullptr;
+    }
+    return &backends_[backend_id - 1]->idle;
+}
+
+void DatabasePool::close_connection(std::unique_ptr<Connection> conn) noexcept {
+    conn.reset();
+    total_connections_.fetch_sub(1);
+    stats_.total_closed.fetch_add(1);
+}
+
 expected<std::unique_ptr<Connection>, std::string>
 DatabasePool::acquire(db_query_type_t query_type, bool in_transaction,
                       std::optional<uint64_t> session_backend_id) {
-    std::unique_lock lock(mutex_);
-
     Backend* backend = nullptr;
 
     if (session_backend_id.has_value()) {
@@ -188,70 +296,76 @@ DatabasePool::acquire(db_query_type_t query_type, bool in_transaction,
         }
     } else {
         auto opt_backend = select_backend(query_type);
-        if (!opt_backend) {
+        if (!opt_backend || !*opt_backend) {
             return make_unexpected(std::string("No healthy backend available"));
         }
         backend = *opt_backend;
     }
 
-    auto& conns = idle_connections_[backend->id()];
+    IdleStack* idle = idle_stack(backend->id());
 
-    while (!conns.empty()) {
-        auto conn = std::move(conns.back());
-        conns.pop_back();
-
-        if (conn->validate() && conn->age() < max_lifetime_) {
-            conn->mark_used();
-            conn->set_transaction(in_transaction);
-            backend->increment_connections();
-            stats_.total_acquired.fetch_add(1);
-            return conn;
-        } else {
-            stats_.total_closed.fetch_add(1);
+    while (auto conn = idle->pop()) {
+        if (conn->age() >= max_lifetime_) {
+            close_connection(std::move(conn));
+            continue;
+        }
+        // Only a connection that sat idle for a while gets the syscall
+        if (conn->idle_time() >= kValidateAfter && !conn->validate()) {
+            stats_.total_validation_failures.fetch_add(1);
+            close_connection(std::move(conn));
+            continue;
         }
+
+        conn->mark_used();
+        conn->set_transaction(in_transaction);
+        backend->increment_connections();
+        stats_.total_acquired.fetch_add(1);
+        return conn;
     }
 
-    if (total_connections_.load() >= max_connections_) {
+    // Reserve the slot first so concurrent acquires cannot overshoot
+    if (total_connections_.fetch_add(1) >= max_connections_) {
+        total_connections_.fetch_sub(1);
         return make_unexpected(std::string("Connection pool exhausted"));
     }
 
     auto conn = create_new_connection(backend);
-    if (conn) {
-        conn->set_transaction(in_transaction);
-        backend->increment_connections();
-        total_connections_.fetch_add(1);
-        stats_.total_created.fetch_add(1);
-        stats_.total_acquired.fetch_add(1);
+    if (!conn) {
+        total_connections_.fetch_sub(1);
+        return make_unexpected(std::string("Failed to connect to backend"));
     }
 
+    conn->set_transaction(in_transaction);
+    backend->increment_connections();
+    stats_.total_created.fetch_add(1);
+    stats_.total_acquired.fetch_add(1);
+
     return conn;
 }
 
 void DatabasePool::release(std::unique_ptr<Connection> conn) {
     if (!conn) return;
 
-    std::unique_lock lock(mutex_);
-
     auto* backend = get_backend_by_id(conn->backend_id());
     if (backend) {
         backend->decrement_connections();
     }
 
-    // Check both idle time and age to ensure connections don't become stale
-    if (!conn->validate() || conn->idle_time() > idle_timeout_ || conn->age() > max_lifetime_) {
-        total_connections_.fetch_sub(1);
-        stats_.total_closed.fetch_add(1);
+    // Check both idle time and age to ensure connections don't become stale.
+    // Liveness is left to the next acquire, once the connection sat idle.
+    IdleStack* idle = idle_stack(conn->backend_id());
+    if (!idle || conn->idle_time() > idle_timeout_ || conn->age() > max_lifetime_) {
+        close_connection(std::move(conn));
         return;
     }
 
-    auto& conns = idle_connections_[conn->backend_id()];
-    if (conns.size() < max_idle_) {
-        conn->set_transaction(false);
-        conns.push_back(std::move(conn));
-        stats_.total_released.fetch_add(1);
+    conn->set_transaction(false);
+    conn->mark_used();
+    conn = idle->push(std::move(conn));
+    if (conn) {
+        close_connection(std::move(conn));
     } else {
-        total_connections_.fetch_sub(1);
-        stats_.total_closed.fetch_add(1);
+        stats_.total_released.fetch_add(1);
     }
 }
 
@@ -271,21 +385,31 @@ std::optional<Backend*> DatabasePool::select_backend(db_query_type_t query_type)
 }
 
 void DatabasePool::cleanup_idle_connections() {
-    std::unique_lock lock(mutex_);
-
-    for (auto& [backend_id, conns] : idle_connections_) {
-        auto it = std::remove_if(conns.begin(), conns.end(),
-            [this](const std::unique_ptr<Connection>& conn) {
-                bool should_remove = !conn->validate() ||
-                                    conn->idle_time() > idle_timeout_ ||
-                                    conn->age() > max_lifetime_;
-                if (should_remove) {
-                    total_connections_.fetch_sub(1);
-                    stats_.total_closed.fetch_add(1);
-                }
-                return should_remove;
-            });
-        conns.erase(it, conns.end());
+    uint32_t n = backend_count_.load(std::memory_order_acquire);
+
+    for (uint32_t i = 0; i < n; i++) {
+        IdleStack& idle = backends_[i]->idle;
+
+        // Check at most what was idle on entry; pushed-back survivors and
+        // connections released meanwhile are left for the next pass.
+        for (uint32_t left = idle.size(); left > 0; left--) {
+            auto conn = idle.pop();
+            if (!conn) break;
+
+            if (conn->idle_time() > idle_timeout_ || conn->age() > max_lifetime_) {
+                close_connection(std::move(conn));
+                continue;
+            }
+            if (!conn->validate()) {
+                stats_.total_validation_failures.fetch_add(1);
+                close_connection(std::move(conn));
+                continue;
+            }
+            conn = idle.push(std::move(conn));
+            if (conn) {
+                close_connection(std::move(conn));
+            }
+        }
     }
 }
 
@@ -300,8 +424,6 @@ ConnectionStatsSnapshot DatabasePool::get_stats() const noexcept {
 }
 
 std::string DatabasePool::get_stats_json() const {
-    std::shared_lock lock(mutex_);
-
     std::ostringstream oss;
     oss << "{"
         << "\"total_acquired\":" << stats_.total_acquired.load() << ","
@@ -312,10 +434,10 @@ std::string DatabasePool::get_stats_json() const {
         << "\"validation_failures\":" << stats_.total_validation_failures.load() << ","
         << "\"backends\":[";
 
-    bool first = true;
-    for (const auto& backend : backends_) {
-        if (!first) oss << ",";
-        first = false;
+    uint32_t n = backend_count_.load(std::memory_order_acquire);
+    for (uint32_t i = 0; i < n; i++) {
+        const Backend* backend = backends_[i]->backend.get();
+        if (i > 0) oss << ",";
         oss << "{"
             << "\"id\":" << backend->id() << ","
             << "\"host\":\"" << backend->host() << "\","
@@ -323,6 +445,7 @@ std::string DatabasePool::get_stats_json() const {
             << "\"role\":\"" << (backend->role() == BackendRole::Primary ? "primary" : "replica") << "\","
             << "\"healthy\":" << (backend->is_healthy() ? "true" : "false") << ","
             << "\"active_connections\":" << backend->active_connections() << ","
+            << "\"idle_connections\":" << backends_[i]->idle.size() << ","
             << "\"replication_lag_ms\":" << backend->replication_lag_ms()
             << "}";
     }
@@ -341,9 +464,11 @@ std::unique_ptr<Connection> DatabasePool::create_new_connection(Backend* backend
 }
 
 Backend* DatabasePool::select_primary() {
-    for (auto& backend : backends_) {
+    uint32_t n = backend_count_.load(std::memory_order_acquire);
+    for (uint32_t i = 0; i < n; i++) {
+        Backend* backend = backends_[i]->backend.get();
         if (backend->role() == BackendRole::Primary && backend->is_healthy()) {
-            return backend.get();
+            return backend;
         }
     }
     return nullptr;
@@ -353,18 +478,23 @@ Backend* DatabasePool::select_replica() {
     Backend* best = nullptr;
     uint32_t min_connections = UINT32_MAX;
     uint64_t min_lag = UINT64_MAX;
+    uint64_t max_lag = std::min<uint64_t>(max_replica_lag_ms_.load(std::memory_order_relaxed),
+                                          UINT64_MAX - 1);
 
-    for (auto& backend : backends_) {
+    uint32_t n = backend_count_.load(std::memory_order_acquire);
+    for (uint32_t i = 0; i < n; i++) {
+        Backend* backend = backends_[i]->backend.get();
         if (backend->role() != BackendRole::Replica || !backend->is_healthy()) {
             continue;
         }
 
+        // UINT64_MAX, lag unknown, is never under the bound
         uint64_t lag = backend->replication_lag_ms();
-        if (lag > 5000) continue;
+        if (lag > max_lag) continue;
 
         uint32_t conns = backend->active_connections();
         if (conns < min_connections || (conns == min_connections && lag < min_lag)) {
-            best = backend.get();
+            best = backend;
             min_connections = conns;
             min_lag = lag;
         }
@@ -378,12 +508,17 @@ Backend* DatabasePool::select_replica() {
 }
 
 Backend* DatabasePool::get_backend_by_id(uint64_t id) const noexcept {
-    std::shared_lock lock(mutex_);
-
-    auto it = std::find_if(backends_.begin(), backends_.end(),
-        [id](const std::unique_ptr<Backend>& b) { return b->id() == id; });
+    if (id == 0 || id > backend_count_.load(std::memory_order_acquire)) {
+        return nullptr;
+    }
+    return backends_[id - 1]->backend.get();
+}
 
-    return it != backends_.end() ? it->get() : nullptr;
+Backend* DatabasePool::get_backend_at(uint32_t index) const noexcept {
+    if (index >= backend_count_.load(std::memory_order_acquire)) {
+        return nullptr;
+    }
+    return backends_[index]->backend.get();
 }
 
 }
@@ -429,8 +564,8 @@ int db_pool_add_backend(db_pool_t* pool, const char* host, uint16_t port,
     auto* cpp_pool = static_cast<DatabasePool*>(pool->mutex);
     BackendRole cpp_role = (role == DB_BACKEND_PRIMARY) ? BackendRole::Primary : BackendRole::Replica;
 
-    [[maybe_unused]] uint64_t backend_id = cpp_pool->add_backend(host, port, cpp_role, protocol);
-    return 0;
+    uint64_t backend_id = cpp_pool->add_backend(host, port, cpp_role, protocol);
+    return backend_id ? 0 : -1;
 }
 
 db_connection_t* db_pool_acquire(db_pool_t* pool, db_query_type_t query_type,
@@ -447,7 +582,10 @@ db_connection_t* db_pool_acquire(db_pool_t* pool, db_query_type_t query_type,
 
     auto conn_ptr = std::move(result).value();
     db_connection_t* conn = (db_connection_t*)malloc(sizeof(db_connection_t));
-    if (!conn) return nullptr;
+    if (!conn) {
+        cpp_pool->release(std::move(conn_ptr));
+        return nullptr;
+    }
 
     conn->fd = conn_ptr->fd();
     conn->protocol = conn_ptr->protocol();
@@ -458,6 +596,8 @@ db_connection_t* db_pool_acquire(db_pool_t* pool, db_query_type_t query_type,
     conn->last_used = time(nullptr);
     conn->query_count = 0;
     conn->next = nullptr;
+    // The C side holds the connection until db_pool_release() hands it back
+    conn->handle = conn_ptr.release();
 
     // Fix: Properly get backend role instead of hardcoding to PRIMARY
     auto* backend = cpp_pool->get_backend_by_id(conn->backend_id);
@@ -470,9 +610,12 @@ db_connection_t* db_pool_acquire(db_pool_t* pool, db_query_type_t query_type,
 void db_pool_release(db_pool_t* pool, db_connection_t* conn) {
     if (!pool || !pool->mutex || !conn) return;
 
-    auto cpp_conn = std::make_unique<Connection>(
-        conn->fd, conn->protocol, conn->backend_id
-    );
+    std::unique_ptr<Connection> cpp_conn;
+    if (conn->handle) {
+        cpp_conn.reset(static_cast<Connection*>(conn->handle));
+    } else {
+        cpp_conn = std::make_unique<Connection>(conn->fd, conn->protocol, conn->backend_id);
+    }
     cpp_conn->set_transaction(conn->in_transaction);
 
     auto* cpp_pool = static_cast<DatabasePool*>(pool->mutex);
@@ -481,6 +624,20 @@ void db_pool_release(db_pool_t* pool, db_connection_t* conn) {
     free(conn);
 }
 
+static void db_pool_fill_backend(const Backend* backend, db_backend_t* c_backend) {
+    memset(c_backend, 0, sizeof(*c_backend));
+    c_backend->id = backend->id();
+    strncpy(c_backend->host, backend->host().c_str(), sizeof(c_backend->host) - 1);
+    c_backend->port = backend->port();
+    c_backend->role = (backend->role() == BackendRole::Primary) ?
+                      DB_BACKEND_PRIMARY : DB_BACKEND_REPLICA;
+    c_backend->protocol = backend->protocol();
+    c_backend->is_healthy = backend->is_healthy();
+    c_backend->active_connections = backend->active_connections();
+    c_backend->replication_lag_ms = backend->replication_lag_ms();
+    c_backend->next = nullptr;
+}
+
 db_backend_t* db_pool_select_backend(db_pool_t* pool, db_query_type_t query_type) {
     if (!pool || !pool->mutex) return nullptr;
 
@@ -490,23 +647,44 @@ db_backend_t* db_pool_select_backend(db_pool_t* pool, db_query_type_t query_type
     if (!backend_opt) return nullptr;
 
     auto* backend = backend_opt.value();
+    if (!backend) return nullptr;
+
     db_backend_t* c_backend = (db_backend_t*)malloc(sizeof(db_backend_t));
     if (!c_backend) return nullptr;
 
-    c_backend->id = backend->id();
-    strncpy(c_backend->host, backend->host().c_str(), sizeof(c_backend->host) - 1);
-    c_backend->port = backend->port();
-    c_backend->role = (backend->role() == BackendRole::Primary) ?
-                      DB_BACKEND_PRIMARY : DB_BACKEND_REPLICA;
-    c_backend->protocol = backend->protocol();
-    c_backend->is_healthy = backend->is_healthy();
-    c_backend->active_connections = backend->active_connections();
-    c_backend->replication_lag_ms = backend->replication_lag_ms();
-    c_backend->next = nullptr;
-
+    db_pool_fill_backend(backend, c_backend);
     return c_backend;
 }
 
+uint32_t db_pool_get_backends(db_pool_t* pool, db_backend_t* out, uint32_t max) {
+    if (!pool || !pool->mutex || !out) return 0;
+
+    auto* cpp_pool = static_cast<DatabasePool*>(pool->mutex);
+    uint32_t n = std::min(cpp_pool->backend_count(), max);
+    for (uint32_t i = 0; i < n; i++) {
+        db_pool_fill_backend(cpp_pool->get_backend_at(i), &out[i]);
+    }
+    return n;
+}
+
+void db_pool_set_backend_state(db_pool_t* pool, uint64_t backend_id,
+                               bool healthy, uint64_t lag_ms) {
+    if (!pool || !pool->mutex) return;
+
+    auto* backend = static_cast<DatabasePool*>(pool->mutex)->get_backend_by_id(backend_id);
+    if (!backend) return;
+    backend->set_replication_lag(lag_ms);
+    backend->set_healthy(healthy);
+}
+
+void db_pool_set_max_replica_lag(db_pool_t* pool, uint64_t lag_ms) {
+    if (!pool || !pool->mutex) return;
+
+    auto* cpp_pool = static_cast<DatabasePool*>(pool->mutex);
+    cpp_pool->set_max_replica_lag(std::chrono::milliseconds(
+        std::min<uint64_t>(lag_ms, INT64_MAX)));
+}
+
 int db_pool_validate_connection(db_connection_t* conn) {
     if (!conn || conn->fd < 0) return -1;
 
@@ -518,6 +696,25 @@ int db_pool_validate_connection(db_connection_t* conn) {
     return 0;
 }
 
+int db_pool_conn_prepared(db_connection_t* conn, uint64_t name_hash, uint64_t text_hash) {
+    if (!conn || !conn->handle) return 0;
+    return static_cast<Connection*>(conn->handle)->prepared(name_hash, text_hash);
+}
+
+void db_pool_conn_set_prepared(db_connection_t* conn, uint64_t name_hash, uint64_t text_hash) {
+    if (!conn || !conn->handle) return;
+    try {
+        static_cast<Connection*>(conn->handle)->set_prepared(name_hash, text_hash);
+    } catch (const std::bad_alloc&) {
+        // Unknown statements are prepared again on use
+    }
+}
+
+void db_pool_conn_forget_prepared(db_connection_t* conn, uint64_t name_hash) {
+    if (!conn || !conn->handle) return;
+    static_cast<Connection*>(conn->handle)->forget_prepared(name_hash);
+}
+
 void db_pool_cleanup_idle(db_pool_t* pool) {
     if (!pool || !pool->mutex) return;
 
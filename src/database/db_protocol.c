@@ -1,6 +1,13 @@
 #include "database/db_protocol.h"
 #include <string.h>
+#include <strings.h>
 #include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
 
 db_protocol_type_t db_protocol_detect(const uint8_t* data, size_t length) {
     if (length < 4) return DB_PROTOCOL_UNKNOWN;
@@ -9,6 +16,20 @@ db_protocol_type_t db_protocol_detect(const uint8_t* data, size_t length) {
         return DB_PROTOCOL_POSTGRESQL;
     }
 
+    // A simple query, 'Q' and a big-endian length covering the rest
+    if (length >= 5 && data[0] == 'Q') {
+        uint32_t len = ((uint32_t)data[1] << 24) | (data[2] << 16) | (data[3] << 8) | data[4];
+        if (len >= 4 && (size_t)len + 1 == length) {
+            return DB_PROTOCOL_POSTGRESQL;
+        }
+    }
+
+    // COM_QUERY: a little-endian length covering the rest, then 0x03
+    if (length >= 5 && data[4] == 0x03 &&
+        (size_t)(data[0] | (data[1] << 8) | (data[2] << 16)) + 4 == length) {
+        return DB_PROTOCOL_MYSQL;
+    }
+
     if (length >= 5 && data[0] < 0x20 && (data[4] == 0x0a || data[4] == 0x09)) {
         return DB_PROTOCOL_MYSQL;
     }
@@ -270,3 +291,176 @@ bool db_protocol_is_handshake(const uint8_t* data, size_t length, db_protocol_ty
             return false;
     }
 }
+
+static const char* skip_space(const char* p, const char* end) {
+    while (p < end && isspace((unsigned char)*p)) p++;
+    return p;
+}
+
+// Matches keyword, case-insensitively and as a whole word
+static const char* match_keyword(const char* p, const char* end, const char* keyword) {
+    size_t n = strlen(keyword);
+    if ((size_t)(end - p) < n || strncasecmp(p, keyword, n) != 0) return NULL;
+    if (p + n < end && (isalnum((unsigned char)p[n]) || p[n] == '_')) return NULL;
+    return p + n;
+}
+
+static const char* match_name(const char* p, const char* end, size_t* len) {
+    const char* start = p;
+    if (p < end && (*p == '"' || *p == '`')) {
+        char quote = *p++;
+        while (p < end && *p != quote) p++;
+        if (p == end) return NULL;
+        p++;
+    } else {
+        while (p < end && (isalnum((unsigned char)*p) || *p == '_' || *p == '$')) p++;
+    }
+    *len = p - start;
+    return *len ? start : NULL;
+}
+
+db_prepared_op_t db_protocol_parse_prepared(const char* query, size_t length,
+                                            const char** name, size_t* name_len) {
+    if (!query || !name || !name_len) return DB_PREPARED_NONE;
+
+    const char* end = query + length;
+    const char* p = skip_space(query, end);
+    const char* q;
+    db_prepared_op_t op;
+
+    if ((q = match_keyword(p, end, "PREPARE"))) {
+        op = DB_PREPARED_PREPARE;
+    } else if ((q = match_keyword(p, end, "EXECUTE"))) {
+        op = DB_PREPARED_EXECUTE;
+    } else if ((q = match_keyword(p, end, "DEALLOCATE"))) {
+        op = DB_PREPARED_DEALLOCATE;
+        const char* r = match_keyword(skip_space(q, end), end, "PREPARE");
+        if (r) q = r;
+    } else if ((q = match_keyword(p, end, "DROP")) &&
+               (q = match_keyword(skip_space(q, end), end, "PREPARE"))) {
+        op = DB_PREPARED_DEALLOCATE;
+    } else {
+        return DB_PREPARED_NONE;
+    }
+
+    q = skip_space(q, end);
+    if (op == DB_PREPARED_DEALLOCATE && match_keyword(q, end, "ALL")) {
+        *name = q;
+        *name_len = 0;
+        return op;
+    }
+
+    *name = match_name(q, end, name_len);
+    return *name ? op : DB_PREPARED_NONE;
+}
+
+static int remaining_ms(const struct timespec* deadline) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long ms = (deadline->tv_sec - now.tv_sec) * 1000 +
+              (deadline->tv_nsec - now.tv_nsec) / 1000000;
+    return ms > 0 ? (int)ms : 0;
+}
+
+static int io_full(int fd, void* buf, size_t len, bool out, const struct timespec* deadline) {
+    uint8_t* p = (uint8_t*)buf;
+    while (len > 0) {
+        ssize_t n = out ? send(fd, p, len, MSG_NOSIGNAL) : recv(fd, p, len, 0);
+        if (n > 0) {
+            p += n;
+            len -= n;
+            continue;
+        }
+        if (n == 0) return -1;
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+
+        struct pollfd pfd = { .fd = fd, .events = out ? POLLOUT : POLLIN };
+        int ms = remaining_ms(deadline);
+        if (ms == 0 || poll(&pfd, 1, ms) <= 0) return -1;
+    }
+    return 0;
+}
+
+static int io_skip(int fd, size_t len, const struct timespec* deadline) {
+    uint8_t scratch[512];
+    while (len > 0) {
+        size_t n = len < sizeof(scratch) ? len : sizeof(scratch);
+        if (io_full(fd, scratch, n, false, deadline) < 0) return -1;
+        len -= n;
+    }
+    return 0;
+}
+
+static int run_postgresql(int fd, const char* sql, size_t length, const struct timespec* deadline) {
+    uint8_t hdr[5];
+    uint32_t len = (uint32_t)length + 5;
+    hdr[0] = 'Q';
+    hdr[1] = len >> 24;
+    hdr[2] = len >> 16;
+    hdr[3] = len >> 8;
+    hdr[4] = len;
+    if (io_full(fd, hdr, sizeof(hdr), true, deadline) < 0 ||
+        io_full(fd, (void*)sql, length, true, deadline) < 0 ||
+        io_full(fd, "", 1, true, deadline) < 0) {
+        return -1;
+    }
+
+    // Everything up to ReadyForQuery; an ErrorResponse on the way fails
+    bool failed = false;
+    for (;;) {
+        if (io_full(fd, hdr, sizeof(hdr), false, deadline) < 0) return -1;
+        len = ((uint32_t)hdr[1] << 24) | (hdr[2] << 16) | (hdr[3] << 8) | hdr[4];
+        if (len < 4 || io_skip(fd, len - 4, deadline) < 0) return -1;
+        if (hdr[0] == 'E') failed = true;
+        if (hdr[0] == 'Z') return failed ? -1 : 0;
+    }
+}
+
+static int run_mysql(int fd, const char* sql, size_t length, const struct timespec* deadline) {
+    if (length + 1 >= 0xffffff) return -1;
+
+    uint8_t hdr[5];
+    uint32_t len = (uint32_t)length + 1;
+    hdr[0] = len;
+    hdr[1] = len >> 8;
+    hdr[2] = len >> 16;
+    hdr[3] = 0;
+    hdr[4] = 0x03;
+    if (io_full(fd, hdr, sizeof(hdr), true, deadline) < 0 ||
+        io_full(fd, (void*)sql, length, true, deadline) < 0) {
+        return -1;
+    }
+
+    // PREPARE and DEALLOCATE answer with a single OK or ERR packet
+    if (io_full(fd, hdr, 4, false, deadline) < 0) return -1;
+    len = hdr[0] | (hdr[1] << 8) | (hdr[2] << 16);
+    if (len == 0 || io_full(fd, &hdr[4], 1, false, deadline) < 0 ||
+        io_skip(fd, len - 1, deadline) < 0) {
+        return -1;
+    }
+    return hdr[4] == 0x00 ? 0 : -1;
+}
+
+int db_protocol_run_query(int fd, db_protocol_type_t protocol,
+                          const char* sql, size_t length, int timeout_ms) {
+    if (fd < 0 || !sql) return -1;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    switch (protocol) {
+        case DB_PROTOCOL_POSTGRESQL:
+            return run_postgresql(fd, sql, length, &deadline);
+        case DB_PROTOCOL_MYSQL:
+            return run_mysql(fd, sql, length, &deadline);
+        default:
+            return -1;
+    }
+}
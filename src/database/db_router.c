@@ -1,15 +1,32 @@
 #include "database/db_router.h"
+#include "core/lb_utils.h"
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
 #include <time.h>
 #include <stdio.h>
+#include <ctype.h>
+
+static inline uint64_t db_router_hash(uint64_t id) {
+    id ^= id >> 33;
+    id *= 0xff51afd7ed558ccdULL;
+    id ^= id >> 33;
+    id *= 0xc4ceb9fe1a85ec53ULL;
+    id ^= id >> 33;
+    return id;
+}
+
+// Top bits pick the shard, low bits the bucket
+static inline db_router_shard_t* db_router_shard(db_router_t* router, uint64_t hash) {
+    return &router->shards[hash >> 60];
+}
 
 db_router_t* db_router_create(db_pool_t* pool, uint32_t max_sessions) {
-    if (!pool) return NULL;
+    if (!pool || max_sessions == 0) return NULL;
 
-    db_router_t* router = (db_router_t*)calloc(1, sizeof(db_router_t));
-    if (!router) return NULL;
+    db_router_t* router = NULL;
+    if (posix_memalign((void**)&router, 64, sizeof(db_router_t)) != 0) return NULL;
+    memset(router, 0, sizeof(*router));
 
     router->pool = pool;
     router->max_sessions = max_sessions;
@@ -20,83 +37,376 @@ db_router_t* db_router_create(db_pool_t* pool, uint32_t max_sessions) {
         return NULL;
     }
 
-    pthread_mutex_t* mutex = (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t));
-    if (!mutex) {
-        free(router->sessions);
-        free(router);
-        return NULL;
+    uint32_t per_shard = (max_sessions + DB_ROUTER_SHARDS - 1) / DB_ROUTER_SHARDS;
+    uint32_t nbuckets = 1;
+    while (nbuckets < per_shard) nbuckets <<= 1;
+
+    uint32_t next = 0;
+    for (int i = 0; i < DB_ROUTER_SHARDS; i++) {
+        db_router_shard_t* shard = &router->shards[i];
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->mask = nbuckets - 1;
+        shard->buckets = (db_session_t**)calloc(nbuckets, sizeof(db_session_t*));
+        if (!shard->buckets) {
+            db_router_destroy(router);
+            return NULL;
+        }
+
+        uint32_t end = next + per_shard < max_sessions ? next + per_shard : max_sessions;
+        for (; next < end; next++) {
+            router->sessions[next].hash_next = shard->free;
+            shard->free = &router->sessions[next];
+            shard->capacity++;
+        }
     }
-    pthread_mutex_init(mutex, NULL);
-    router->mutex = mutex;
 
     return router;
 }
 
+static void db_router_free_prepared(db_prepared_t* p) {
+    while (p) {
+        db_prepared_t* next = p->next;
+        free(p->name);
+        free(p->sql);
+        free(p);
+        p = next;
+    }
+}
+
 void db_router_destroy(db_router_t* router) {
     if (!router) return;
 
-    pthread_mutex_t* mutex = (pthread_mutex_t*)router->mutex;
-    pthread_mutex_destroy(mutex);
-    free(mutex);
+    // Free slots and unused ones are zeroed or carry no state
+    for (uint32_t i = 0; i < router->max_sessions; i++) {
+        db_session_t* session = &router->sessions[i];
+        if (session->lease) {
+            db_pool_release(router->pool, session->lease);
+        }
+        db_router_free_prepared(session->prepared);
+    }
+
+    for (int i = 0; i < DB_ROUTER_SHARDS; i++) {
+        pthread_mutex_destroy(&router->shards[i].lock);
+        free(router->shards[i].buckets);
+    }
     free(router->sessions);
     free(router);
 }
 
-static db_session_t* db_router_find_session(db_router_t* router, uint64_t session_id) {
-    for (uint32_t i = 0; i < router->session_count; i++) {
-        if (router->sessions[i].session_id == session_id) {
-            return &router->sessions[i];
-        }
+void db_router_set_mode(db_router_t* router, db_router_mode_t mode) {
+    if (router) router->mode = mode;
+}
+
+void db_router_set_read_your_writes(db_router_t* router, uint32_t window_ms) {
+    if (router) router->ryw_window_ms = window_ms;
+}
+
+static uint64_t db_router_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static inline bool db_router_is_write(db_query_type_t type) {
+    return type == DB_QUERY_WRITE || type == DB_QUERY_TRANSACTION_END;
+}
+
+// Under the shard lock: records a write, or sends a read that follows one
+// to the primary
+static db_query_type_t db_router_read_your_writes(db_router_t* router, db_session_t* session,
+                                                  db_query_type_t type) {
+    if (!router->ryw_window_ms || !session) return type;
+
+    uint64_t now = db_router_now_ms();
+    if (db_router_is_write(type)) {
+        session->last_write_ms = now;
+    } else if (type == DB_QUERY_READ && session->last_write_ms &&
+               now - session->last_write_ms < router->ryw_window_ms) {
+        return DB_QUERY_WRITE;
     }
-    return NULL;
+    return type;
 }
 
-static db_session_t* db_router_create_session(db_router_t* router, uint64_t session_id) {
-    if (router->session_count >= router->max_sessions) {
-        time_t oldest_time = 0;
-        uint32_t oldest_idx = 0;
-        bool found_non_transaction = false;
+// A busy session is pinned to its state and is never evicted
+static inline bool db_router_busy(const db_session_t* session) {
+    return session->in_transaction || session->pinned || session->lease;
+}
 
-        // Find the first non-transaction session to initialize baseline
-        for (uint32_t i = 0; i < router->session_count; i++) {
-            if (!router->sessions[i].in_transaction) {
-                oldest_time = router->sessions[i].last_activity;
-                oldest_idx = i;
-                found_non_transaction = true;
-                break;
-            }
-        }
+static void db_router_lru_unlink(db_router_shard_t* shard, db_session_t* session) {
+    if (session->lru_prev) session->lru_prev->lru_next = session->lru_next;
+    else shard->lru_head = session->lru_next;
+    if (session->lru_next) session->lru_next->lru_prev = session->lru_prev;
+    else shard->lru_tail = session->lru_prev;
+    session->lru_prev = session->lru_next = NULL;
+}
 
-        // If we found a non-transaction session, continue to find the oldest one
-        if (found_non_transaction) {
-            for (uint32_t i = oldest_idx + 1; i < router->session_count; i++) {
-                if (!router->sessions[i].in_transaction &&
-                    router->sessions[i].last_activity < oldest_time) {
-                    oldest_time = router->sessions[i].last_activity;
-                    oldest_idx = i;
-                }
-            }
+static void db_router_lru_append(db_router_shard_t* shard, db_session_t* session) {
+    session->lru_prev = shard->lru_tail;
+    session->lru_next = NULL;
+    if (shard->lru_tail) shard->lru_tail->lru_next = session;
+    else shard->lru_head = session;
+    shard->lru_tail = session;
+}
 
-            // Always evict oldest session when at max capacity
-            router->sessions[oldest_idx].session_id = session_id;
-            router->sessions[oldest_idx].backend_id = 0;
-            router->sessions[oldest_idx].in_transaction = false;
-            router->sessions[oldest_idx].last_activity = time(NULL);
-            return &router->sessions[oldest_idx];
-        }
+// Moves session to the idle list's tail, or off the list once busy
+static void db_router_touch(db_router_shard_t* shard, db_session_t* session, bool was_busy) {
+    if (!was_busy) {
+        db_router_lru_unlink(shard, session);
+    }
+    if (!db_router_busy(session)) {
+        db_router_lru_append(shard, session);
+    }
+}
+
+static db_session_t* db_router_find_session(db_router_shard_t* shard, uint64_t hash,
+                                            uint64_t session_id) {
+    db_session_t* session = shard->buckets[hash & shard->mask];
+    while (session && session->session_id != session_id) {
+        session = session->hash_next;
+    }
+    return session;
+}
+
+static void db_router_remove_session(db_router_t* router, db_router_shard_t* shard,
+                                     db_session_t* session) {
+    uint64_t hash = db_router_hash(session->session_id);
+    db_session_t** link = &shard->buckets[hash & shard->mask];
+    while (*link != session) {
+        link = &(*link)->hash_next;
+    }
+    *link = session->hash_next;
+
+    if (!db_router_busy(session)) {
+        db_router_lru_unlink(shard, session);
+    }
+    if (session->lease) {
+        db_pool_release(router->pool, session->lease);
+        session->lease = NULL;
+    }
+    db_router_free_prepared(session->prepared);
+    session->prepared = NULL;
+    session->pinned = false;
+    session->hash_next = shard->free;
+    shard->free = session;
+    shard->count--;
+}
 
-        return NULL;  // All sessions in transaction
+static db_session_t* db_router_create_session(db_router_t* router, db_router_shard_t* shard,
+                                              uint64_t hash, uint64_t session_id) {
+    if (!shard->free) {
+        // Always evict the least recently used session outside a transaction
+        if (!shard->lru_head) {
+            return NULL;  // All sessions in transaction
+        }
+        db_router_remove_session(router, shard, shard->lru_head);
     }
 
-    db_session_t* session = &router->sessions[router->session_count++];
+    db_session_t* session = shard->free;
+    shard->free = session->hash_next;
+
     session->session_id = session_id;
     session->backend_id = 0;
     session->in_transaction = false;
     session->last_activity = time(NULL);
+    session->last_write_ms = 0;
+
+    db_session_t** bucket = &shard->buckets[hash & shard->mask];
+    session->hash_next = *bucket;
+    *bucket = session;
+    db_router_lru_append(shard, session);
+    shard->count++;
 
     return session;
 }
 
+// Unquoted names fold to lowercase, as both servers fold them
+static uint64_t db_router_name_hash(const char* name, size_t len) {
+    char folded[128];
+    if (len > sizeof(folded)) len = sizeof(folded);
+
+    bool quoted = name[0] == '"' || name[0] == '`';
+    for (size_t i = 0; i < len; i++) {
+        folded[i] = quoted ? name[i] : (char)tolower((unsigned char)name[i]);
+    }
+    uint64_t h = murmur3_64(folded, len, 0);
+    return h ? h : 1;  // 0 stands for all of them
+}
+
+static void db_router_forget_prepared(db_session_t* session, uint64_t name_hash) {
+    db_prepared_t** link = &session->prepared;
+    while (*link) {
+        db_prepared_t* p = *link;
+        if (name_hash == 0 || p->name_hash == name_hash) {
+            *link = p->next;
+            p->next = NULL;
+            db_router_free_prepared(p);
+        } else {
+            link = &p->next;
+        }
+    }
+}
+
+static db_prepared_t* db_router_new_prepared(uint64_t name_hash, uint64_t text_hash,
+                                             const char* name, size_t name_len,
+                                             const char* sql, size_t sql_len) {
+    db_prepared_t* p = (db_prepared_t*)calloc(1, sizeof(db_prepared_t));
+    if (!p) return NULL;
+
+    p->name_hash = name_hash;
+    p->text_hash = text_hash;
+    p->name = strndup(name, name_len);
+    p->sql = strndup(sql, sql_len);
+    p->sql_len = sql_len;
+    if (!p->name || !p->sql) {
+        db_router_free_prepared(p);
+        return NULL;
+    }
+    return p;
+}
+
+// Makes sure conn has the statement before an EXECUTE runs on it
+static int db_router_reprepare(db_router_t* router, db_connection_t* conn,
+                               const db_prepared_t* p) {
+    int state = db_pool_conn_prepared(conn, p->name_hash, p->text_hash);
+    if (state == 1) return 0;
+
+    if (state < 0) {
+        char sql[192];
+        int n = snprintf(sql, sizeof(sql), "DEALLOCATE %s%s",
+                         conn->protocol == DB_PROTOCOL_MYSQL ? "PREPARE " : "", p->name);
+        if (n >= (int)sizeof(sql) ||
+            db_protocol_run_query(conn->fd, conn->protocol, sql, n,
+                                  DB_ROUTER_PREPARE_TIMEOUT_MS) < 0) {
+            db_pool_conn_forget_prepared(conn, p->name_hash);
+            atomic_fetch_add(&router->stats.reprepare_failures, 1);
+            return -1;
+        }
+        db_pool_conn_forget_prepared(conn, p->name_hash);
+    }
+
+    if (db_protocol_run_query(conn->fd, conn->protocol, p->sql, p->sql_len,
+                              DB_ROUTER_PREPARE_TIMEOUT_MS) < 0) {
+        atomic_fetch_add(&router->stats.reprepare_failures, 1);
+        return -1;
+    }
+    db_pool_conn_set_prepared(conn, p->name_hash, p->text_hash);
+    atomic_fetch_add(&router->stats.reprepares, 1);
+    return 0;
+}
+
+static db_connection_t* db_router_route_transaction(db_router_t* router,
+                                                    const db_query_info_t* info,
+                                                    uint64_t client_session_id) {
+    const char* text = info->query_text;
+    size_t text_len = text ? info->query_length : 0;
+    while (text_len > 0 && text[text_len - 1] == '\0') text_len--;
+
+    const char* name = NULL;
+    size_t name_len = 0;
+    db_prepared_op_t op = db_protocol_parse_prepared(text, text_len, &name, &name_len);
+    uint64_t name_hash = (op != DB_PREPARED_NONE && name_len) ?
+                         db_router_name_hash(name, name_len) : 0;
+
+    bool needs_session = info->query_type == DB_QUERY_TRANSACTION_BEGIN ||
+                         info->query_type == DB_QUERY_SESSION_VAR ||
+                         op == DB_PREPARED_PREPARE ||
+                         (router->ryw_window_ms && db_router_is_write(info->query_type));
+
+    uint64_t hash = db_router_hash(client_session_id);
+    db_router_shard_t* shard = db_router_shard(router, hash);
+    pthread_mutex_lock(&shard->lock);
+
+    db_session_t* session = db_router_find_session(shard, hash, client_session_id);
+    if (!session && needs_session) {
+        session = db_router_create_session(router, shard, hash, client_session_id);
+        if (!session) {
+            pthread_mutex_unlock(&shard->lock);
+            return NULL;  // All sessions busy; none can hold the state
+        }
+    }
+
+    db_connection_t* conn = NULL;
+    db_prepared_t* replay = NULL;
+    bool hold = false;
+    db_query_type_t route_type = db_router_read_your_writes(router, session, info->query_type);
+
+    if (session) {
+        bool was_busy = db_router_busy(session);
+
+        if (info->query_type == DB_QUERY_TRANSACTION_BEGIN) {
+            session->in_transaction = true;
+        } else if (info->query_type == DB_QUERY_TRANSACTION_END) {
+            session->in_transaction = false;
+        } else if (info->query_type == DB_QUERY_SESSION_VAR) {
+            session->pinned = true;
+        }
+
+        if (op == DB_PREPARED_PREPARE) {
+            db_router_forget_prepared(session, name_hash);
+            db_prepared_t* p = db_router_new_prepared(name_hash, murmur3_64(text, text_len, 0),
+                                                      name, name_len, text, text_len);
+            if (p) {
+                p->next = session->prepared;
+                session->prepared = p;
+            }
+        } else if (op == DB_PREPARED_DEALLOCATE) {
+            db_router_forget_prepared(session, name_hash);
+        } else if (op == DB_PREPARED_EXECUTE) {
+            for (db_prepared_t* p = session->prepared; p; p = p->next) {
+                if (p->name_hash == name_hash) {
+                    // A copy: the session may change once unlocked
+                    replay = db_router_new_prepared(p->name_hash, p->text_hash,
+                                                    p->name, strlen(p->name),
+                                                    p->sql, p->sql_len);
+                    break;
+                }
+            }
+        }
+
+        conn = session->lease;
+        hold = session->in_transaction || session->pinned;
+        db_router_touch(shard, session, was_busy);
+        session->last_activity = time(NULL);
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+
+    if (!conn) {
+        conn = db_pool_acquire(router->pool, route_type,
+                               info->query_type == DB_QUERY_TRANSACTION_BEGIN, 0);
+        if (!conn) {
+            db_router_free_prepared(replay);
+            return NULL;
+        }
+        atomic_fetch_add(&router->stats.leases, 1);
+
+        if (hold) {
+            pthread_mutex_lock(&shard->lock);
+            session = db_router_find_session(shard, hash, client_session_id);
+            if (session && !session->lease &&
+                (session->in_transaction || session->pinned)) {
+                session->lease = conn;
+            }
+            pthread_mutex_unlock(&shard->lock);
+        }
+    }
+
+    if (op == DB_PREPARED_PREPARE && name_hash) {
+        db_pool_conn_set_prepared(conn, name_hash, murmur3_64(text, text_len, 0));
+    } else if (op == DB_PREPARED_DEALLOCATE) {
+        db_pool_conn_forget_prepared(conn, name_hash);
+    } else if (replay) {
+        int rc = db_router_reprepare(router, conn, replay);
+        db_router_free_prepared(replay);
+        if (rc < 0) {
+            db_router_release(router, client_session_id, conn);
+            return NULL;
+        }
+    }
+
+    return conn;
+}
+
 db_connection_t* db_router_route_query(db_router_t* router,
                                         const uint8_t* query_data,
                                         size_t query_length,
@@ -121,20 +431,31 @@ db_connection_t* db_router_route_query(db_router_t* router,
             return NULL;
     }
 
-    pthread_mutex_t* mutex = (pthread_mutex_t*)router->mutex;
-    pthread_mutex_lock(mutex);
+    if (router->mode == DB_ROUTER_TRANSACTION) {
+        return db_router_route_transaction(router, &query_info, client_session_id);
+    }
+
+    uint64_t hash = db_router_hash(client_session_id);
+    db_router_shard_t* shard = db_router_shard(router, hash);
+    pthread_mutex_lock(&shard->lock);
 
-    db_session_t* session = db_router_find_session(router, client_session_id);
+    db_session_t* session = db_router_find_session(shard, hash, client_session_id);
 
     if (!session && (query_info.requires_sticky ||
-                     query_info.query_type == DB_QUERY_TRANSACTION_BEGIN)) {
-        session = db_router_create_session(router, client_session_id);
+                     query_info.query_type == DB_QUERY_TRANSACTION_BEGIN ||
+                     (router->ryw_window_ms && db_router_is_write(query_info.query_type)))) {
+        session = db_router_create_session(router, shard, hash, client_session_id);
     }
 
+    db_query_type_t route_type = db_router_read_your_writes(router, session,
+                                                            query_info.query_type);
     uint64_t backend_id = 0;
     bool in_transaction = false;
+    bool need_backend = false;
 
     if (session) {
+        bool was_busy = db_router_busy(session);
+
         if (query_info.query_type == DB_QUERY_TRANSACTION_BEGIN) {
             session->in_transaction = true;
             in_transaction = true;
@@ -148,66 +469,120 @@ db_connection_t* db_router_route_query(db_router_t* router,
             in_transaction = session->in_transaction;
         }
 
+        // Sessions in a transaction are never evicted, so they leave the
+        // idle list; the rest move to its tail
+        db_router_touch(shard, session, was_busy);
+
         session->last_activity = time(NULL);
+        need_backend = session->backend_id == 0;
     }
 
-    // Keep mutex locked while acquiring connection to prevent race condition
-    db_connection_t* conn = db_pool_acquire(router->pool, query_info.query_type,
+    pthread_mutex_unlock(&shard->lock);
+
+    // Connecting can take a round trip to the backend; no lock is held.
+    // The session may be ended or evicted meanwhile, so it is looked up
+    // again before it learns its backend.
+    db_connection_t* conn = db_pool_acquire(router->pool, route_type,
                                              in_transaction, backend_id);
 
-    // Update session backend_id if it was just created
-    if (conn && session && session->backend_id == 0) {
-        session->backend_id = conn->backend_id;
+    if (conn && need_backend) {
+        pthread_mutex_lock(&shard->lock);
+        session = db_router_find_session(shard, hash, client_session_id);
+        if (session && session->backend_id == 0) {
+            session->backend_id = conn->backend_id;
+        }
+        pthread_mutex_unlock(&shard->lock);
     }
 
-    pthread_mutex_unlock(mutex);
-
     return conn;
 }
 
-void db_router_end_session(db_router_t* router, uint64_t client_session_id) {
-    if (!router) return;
+void db_router_release(db_router_t* router, uint64_t client_session_id,
+                       db_connection_t* conn) {
+    if (!router || !conn) return;
 
-    pthread_mutex_t* mutex = (pthread_mutex_t*)router->mutex;
-    pthread_mutex_lock(mutex);
+    if (router->mode == DB_ROUTER_TRANSACTION) {
+        uint64_t hash = db_router_hash(client_session_id);
+        db_router_shard_t* shard = db_router_shard(router, hash);
+        pthread_mutex_lock(&shard->lock);
 
-    for (uint32_t i = 0; i < router->session_count; i++) {
-        if (router->sessions[i].session_id == client_session_id) {
-            if (i < router->session_count - 1) {
-                memmove(&router->sessions[i], &router->sessions[i + 1],
-                        (router->session_count - i - 1) * sizeof(db_session_t));
+        db_session_t* session = db_router_find_session(shard, hash, client_session_id);
+        if (session && session->lease == conn) {
+            if (session->in_transaction || session->pinned) {
+                pthread_mutex_unlock(&shard->lock);
+                return;
             }
-            router->session_count--;
-            break;
+            session->lease = NULL;
+            db_router_touch(shard, session, true);
         }
+
+        pthread_mutex_unlock(&shard->lock);
     }
 
-    pthread_mutex_unlock(mutex);
+    db_pool_release(router->pool, conn);
 }
 
-int db_router_get_stats(db_router_t* router, char* buffer, size_t buffer_size) {
-    if (!router || !buffer) return -1;
+void db_router_end_session(db_router_t* router, uint64_t client_session_id) {
+    if (!router) return;
 
-    pthread_mutex_t* mutex = (pthread_mutex_t*)router->mutex;
-    pthread_mutex_lock(mutex);
+    uint64_t hash = db_router_hash(client_session_id);
+    db_router_shard_t* shard = db_router_shard(router, hash);
+    pthread_mutex_lock(&shard->lock);
 
-    int written = snprintf(buffer, buffer_size,
-        "{\"session_count\":%u,\"max_sessions\":%u,\"sessions\":[",
-        router->session_count, router->max_sessions);
+    db_session_t* session = db_router_find_session(shard, hash, client_session_id);
+    if (session) {
+        db_router_remove_session(router, shard, session);
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+}
 
-    for (uint32_t i = 0; i < router->session_count && written < (int)buffer_size; i++) {
-        if (i > 0) {
-            written += snprintf(buffer + written, buffer_size - written, ",");
+int db_router_get_stats(db_router_t* router, char* buffer, size_t buffer_size) {
+    if (!router || !buffer || buffer_size == 0) return -1;
+
+    // Shards are locked one at a time, so the listing is not a snapshot
+    uint32_t session_count = 0;
+    for (int i = 0; i < DB_ROUTER_SHARDS; i++) {
+        pthread_mutex_lock(&router->shards[i].lock);
+        session_count += router->shards[i].count;
+        pthread_mutex_unlock(&router->shards[i].lock);
+    }
+
+    size_t written = snprintf(buffer, buffer_size,
+        "{\"mode\":\"%s\",\"session_count\":%u,\"max_sessions\":%u,"
+        "\"leases\":%lu,\"reprepares\":%lu,\"reprepare_failures\":%lu,\"sessions\":[",
+        router->mode == DB_ROUTER_TRANSACTION ? "transaction" : "session",
+        session_count, router->max_sessions,
+        (unsigned long)atomic_load(&router->stats.leases),
+        (unsigned long)atomic_load(&router->stats.reprepares),
+        (unsigned long)atomic_load(&router->stats.reprepare_failures));
+
+    bool first = true;
+    for (int i = 0; i < DB_ROUTER_SHARDS && written < buffer_size; i++) {
+        db_router_shard_t* shard = &router->shards[i];
+        pthread_mutex_lock(&shard->lock);
+
+        for (uint32_t b = 0; b <= shard->mask && written < buffer_size; b++) {
+            for (db_session_t* s = shard->buckets[b]; s && written < buffer_size; s = s->hash_next) {
+                written += snprintf(buffer + written, buffer_size - written,
+                    "%s{\"session_id\":%lu,\"backend_id\":%lu,\"in_transaction\":%s}",
+                    first ? "" : ",",
+                    (unsigned long)s->session_id,
+                    (unsigned long)s->backend_id,
+                    s->in_transaction ? "true" : "false");
+                first = false;
+            }
         }
-        written += snprintf(buffer + written, buffer_size - written,
-            "{\"session_id\":%lu,\"backend_id\":%lu,\"in_transaction\":%s}",
-            (unsigned long)router->sessions[i].session_id,
-            (unsigned long)router->sessions[i].backend_id,
-            router->sessions[i].in_transaction ? "true" : "false");
+
+        pthread_mutex_unlock(&shard->lock);
     }
 
-    written += snprintf(buffer + written, buffer_size - written, "]}");
+    if (written < buffer_size) {
+        written += snprintf(buffer + written, buffer_size - written, "]}");
+    }
+    if (written >= buffer_size) {
+        written = buffer_size - 1;
+    }
 
-    pthread_mutex_unlock(mutex);
-    return written;
+    return (int)written;
 }
@@ -46,6 +46,185 @@ check_t* check_new(check_type_t type) {
     return check;
 }
 
+void check_free(check_t *check) {
+    if (!check) return;
+
+    if (check->conn.fd >= 0)
+        close(check->conn.fd);
+    buffer_free(check->conn.buf);
+    free(check);
+}
+
+// Request bytes for one probe, or 0 when the probe only connects (plain
+// TCP without a send string, and MySQL, where the server speaks first)
+int check_probe_request(const check_t *check, char *buf, size_t size, bool keepalive) {
+    int len = 0;
+
+    switch (check->type) {
+        case HCHK_TYPE_HTTP:
+        case HCHK_TYPE_HTTPS:
+            len = snprintf(buf, size,
+                           "%s %s HTTP/1.%d\r\n"
+                           "Host: %s\r\n"
+                           "User-Agent: UltraBalancer/1.0\r\n"
+                           "Connection: %s\r\n"
+                           "\r\n",
+                           check->http.method ? check->http.method : "OPTIONS",
+                           check->http.uri ? check->http.uri : "/",
+                           check->http.version ? check->http.version : 1,
+                           check->http.host ? check->http.host : "localhost",
+                           keepalive ? "keep-alive" : "close");
+            break;
+        case HCHK_TYPE_REDIS:
+            len = snprintf(buf, size, "*1\r\n$4\r\nPING\r\n");
+            break;
+        case HCHK_TYPE_MYSQL:
+            return 0;
+        default:
+            if (!check->tcp.send_string || check->tcp.send_len == 0) return 0;
+            if (check->tcp.send_len > size) return -1;
+            memcpy(buf, check->tcp.send_string, check->tcp.send_len);
+            return (int)check->tcp.send_len;
+    }
+
+    return (len < 0 || (size_t)len >= size) ? -1 : len;
+}
+
+bool check_probe_expects_response(const check_t *check) {
+    switch (check->type) {
+        case HCHK_TYPE_HTTP:
+        case HCHK_TYPE_HTTPS:
+        case HCHK_TYPE_REDIS:
+        case HCHK_TYPE_MYSQL:
+            return true;
+        default:
+            return check->tcp.expect_string || check->tcp.expect_regex;
+    }
+}
+
+// Whether a TCP check's expect string/regex matches; false may just mean
+// the expected bytes have not arrived yet
+static bool check_tcp_expect(const check_t *check, const char *buf, size_t len,
+                             char *desc, size_t desc_size) {
+    if (check->tcp.expect_string && !strstr(buf, check->tcp.expect_string)) {
+        snprintf(desc, desc_size, "Unexpected response");
+        return false;
+    }
+
+    if (check->tcp.expect_regex) {
+#ifdef USE_PCRE
+        int ovector[30];
+        if (pcre_exec(check->tcp.expect_regex, NULL, buf, len, 0, 0, ovector, 30) < 0) {
+            snprintf(desc, desc_size, "Regex mismatch");
+            return false;
+        }
+#else
+        // PCRE not available, skip regex check
+        log_warning("PCRE regex check skipped (library not available)");
+#endif
+    }
+    return true;
+}
+
+// Content-Length of a response whose headers end at hdr_end, or -1 when the
+// body length is unknown or the server will close the connection
+static long check_http_body_len(const check_t *check, const char *buf, const char *hdr_end,
+                                int status_code) {
+    const char *close_hdr = strcasestr(buf, "\r\nConnection: close");
+    if (close_hdr && close_hdr < hdr_end) return -1;
+    if (strncmp(buf, "HTTP/1.0", 8) == 0) return -1;
+
+    if ((check->http.method && strcmp(check->http.method, "HEAD") == 0) ||
+        status_code == 204 || status_code == 304 || status_code < 200) {
+        return 0;
+    }
+
+    const char *cl = strcasestr(buf, "\r\nContent-Length:");
+    if (!cl || cl >= hdr_end) return -1;
+    return strtol(cl + 17, NULL, 10);
+}
+
+// Verdict on the bytes received so far (NUL-terminated at buf[len]), or
+// HCHK_STATUS_UNKNOWN while more are needed. *consumed is the length of
+// the complete response when the connection can carry another probe, 0
+// otherwise.
+check_status_t check_probe_response(const check_t *check, const char *buf, size_t len,
+                                    size_t *consumed, char *desc, size_t desc_size) {
+    *consumed = 0;
+
+    switch (check->type) {
+        case HCHK_TYPE_HTTP:
+        case HCHK_TYPE_HTTPS: {
+            const char *hdr_end = memmem(buf, len, "\r\n\r\n", 4);
+            if (!hdr_end) return HCHK_STATUS_UNKNOWN;
+
+            int status_code = 0;
+            if (sscanf(buf, "HTTP/%*d.%*d %d", &status_code) != 1) {
+                snprintf(desc, desc_size, "Invalid HTTP response");
+                return HCHK_STATUS_L7RSP;
+            }
+
+            if (check->tcp.expect_status > 0) {
+                if (status_code != check->tcp.expect_status) {
+                    snprintf(desc, desc_size, "Status %d != %d", status_code, check->tcp.expect_status);
+                    return HCHK_STATUS_L7STS;
+                }
+            } else if (status_code < 200 || status_code >= 400) {
+                // Default: accept 2xx and 3xx
+                snprintf(desc, desc_size, "HTTP status %d", status_code);
+                return HCHK_STATUS_L7STS;
+            }
+
+            long body = check_http_body_len(check, buf, hdr_end, status_code);
+            size_t total = (size_t)(hdr_end + 4 - buf) + (body > 0 ? (size_t)body : 0);
+            if (body >= 0 && total == len) *consumed = total;
+            snprintf(desc, desc_size, "HTTP check passed");
+            return HCHK_STATUS_L7OK;
+        }
+
+        case HCHK_TYPE_REDIS: {
+            static const char pong[] = "+PONG\r\n";
+            size_t n = len < sizeof(pong) - 1 ? len : sizeof(pong) - 1;
+            if (strncmp(buf, pong, n) != 0) {
+                snprintf(desc, desc_size, "Invalid PONG response");
+                return HCHK_STATUS_L6RSP;
+            }
+            if (len < sizeof(pong) - 1) return HCHK_STATUS_UNKNOWN;
+
+            if (len == sizeof(pong) - 1) *consumed = len;
+            snprintf(desc, desc_size, "Redis check passed");
+            return HCHK_STATUS_L6OK;
+        }
+
+        case HCHK_TYPE_MYSQL: {
+            const uint8_t *packet = (const uint8_t *)buf;
+            if (len < 5) return HCHK_STATUS_UNKNOWN;
+
+            // Check packet header
+            uint32_t packet_len = packet[0] | (packet[1] << 8) | (packet[2] << 16);
+            uint8_t packet_num = packet[3];
+            if (packet_len < 4 || packet_num != 0) {
+                snprintf(desc, desc_size, "Invalid MySQL packet");
+                return HCHK_STATUS_L6RSP;
+            }
+
+            // Check protocol version (packet[4])
+            if (packet[4] != 10 && packet[4] != 9) {
+                snprintf(desc, desc_size, "Unsupported MySQL version");
+                return HCHK_STATUS_L6RSP;
+            }
+
+            snprintf(desc, desc_size, "MySQL check passed");
+            return HCHK_STATUS_L6OK;
+        }
+
+        default:
+            if (!check_tcp_expect(check, buf, len, desc, desc_size)) return HCHK_STATUS_UNKNOWN;
+            snprintf(desc, desc_size, "TCP check passed");
+            return HCHK_STATUS_L4OK;
+    }
+}
+
 int check_tcp(check_t *check) {
     struct server *srv = check->server;
 
@@ -99,6 +278,7 @@ int check_tcp(check_t *check) {
     // Receive and check response
     if (check->tcp.expect_string || check->tcp.expect_regex) {
         char buffer[4096];
+        char desc[HCHK_DESC_LEN];
         ssize_t received = recv(fd, buffer, sizeof(buffer) - 1, 0);
 
         if (received <= 0) {
@@ -110,31 +290,11 @@ int check_tcp(check_t *check) {
 
         buffer[received] = '\0';
 
-        // Check expected response
-        if (check->tcp.expect_string) {
-            if (!strstr(buffer, check->tcp.expect_string)) {
-                close(fd);
-                check->conn.fd = -1;
-                set_server_check_status(check, HCHK_STATUS_L7RSP, "Unexpected response");
-                return -1;
-            }
-        }
-
-        if (check->tcp.expect_regex) {
-#ifdef USE_PCRE
-            int ovector[30];
-            int ret = pcre_exec(check->tcp.expect_regex, NULL, buffer, received,
-                               0, 0, ovector, 30);
-            if (ret < 0) {
-                close(fd);
-                check->conn.fd = -1;
-                set_server_check_status(check, HCHK_STATUS_L7RSP, "Regex mismatch");
-                return -1;
-            }
-#else
-            // PCRE not available, skip regex check
-            log_warning("PCRE regex check skipped (library not available)");
-#endif
+        if (!check_tcp_expect(check, buffer, received, desc, sizeof(desc))) {
+            close(fd);
+            check->conn.fd = -1;
+            set_server_check_status(check, HCHK_STATUS_L7RSP, desc);
+            return -1;
         }
     }
 
@@ -176,18 +336,9 @@ int check_http(check_t *check) {
 
     // Build HTTP request
     char request[1024];
-    int len = snprintf(request, sizeof(request),
-                      "%s %s HTTP/1.%d\r\n"
-                      "Host: %s\r\n"
-                      "User-Agent: UltraBalancer/1.0\r\n"
-                      "Connection: close\r\n"
-                      "\r\n",
-                      check->http.method ? check->http.method : "OPTIONS",
-                      check->http.uri ? check->http.uri : "/",
-                      check->http.version ? check->http.version : 1,
-                      check->http.host ? check->http.host : "localhost");
-
-    if (send(fd, request, len, MSG_NOSIGNAL) < 0) {
+    int len = check_probe_request(check, request, sizeof(request), false);
+
+    if (len < 0 || send(fd, request, len, MSG_NOSIGNAL) < 0) {
         close(fd);
         set_server_check_status(check, HCHK_STATUS_L6RSP, "Failed to send request");
         return -1;
@@ -205,37 +356,17 @@ int check_http(check_t *check) {
 
     response[received] = '\0';
 
-    // Parse status code
-    int status_code = 0;
-    if (sscanf(response, "HTTP/%*d.%*d %d", &status_code) != 1) {
-        close(fd);
+    char desc[HCHK_DESC_LEN];
+    size_t consumed;
+    check_status_t status = check_probe_response(check, response, received, &consumed,
+                                                 desc, sizeof(desc));
+    close(fd);
+    if (status == HCHK_STATUS_UNKNOWN) {
         set_server_check_status(check, HCHK_STATUS_L7RSP, "Invalid HTTP response");
         return -1;
     }
-
-    // Check expected status
-    if (check->tcp.expect_status > 0) {
-        if (status_code != check->tcp.expect_status) {
-            close(fd);
-            char msg[64];
-            snprintf(msg, sizeof(msg), "Status %d != %d", status_code, check->tcp.expect_status);
-            set_server_check_status(check, HCHK_STATUS_L7STS, msg);
-            return -1;
-        }
-    } else {
-        // Default: accept 2xx and 3xx
-        if (status_code < 200 || status_code >= 400) {
-            close(fd);
-            char msg[64];
-            snprintf(msg, sizeof(msg), "HTTP status %d", status_code);
-            set_server_check_status(check, HCHK_STATUS_L7STS, msg);
-            return -1;
-        }
-    }
-
-    close(fd);
-    set_server_check_status(check, HCHK_STATUS_L7OK, "HTTP check passed");
-    return 0;
+    set_server_check_status(check, status, desc);
+    return status == HCHK_STATUS_L7OK ? 0 : -1;
 }
 
 int check_mysql(check_t *check) {
@@ -261,35 +392,23 @@ int check_mysql(check_t *check) {
     }
 
     // Read MySQL handshake packet
-    uint8_t packet[256];
-    ssize_t received = recv(fd, packet, sizeof(packet), 0);
+    char packet[256];
+    ssize_t received = recv(fd, packet, sizeof(packet) - 1, 0);
+    close(fd);
 
-    if (received < 4) {
-        close(fd);
-        set_server_check_status(check, HCHK_STATUS_L6RSP, "Invalid MySQL handshake");
-        return -1;
+    char desc[HCHK_DESC_LEN];
+    size_t consumed;
+    check_status_t status = HCHK_STATUS_UNKNOWN;
+    if (received > 0) {
+        packet[received] = '\0';
+        status = check_probe_response(check, packet, received, &consumed, desc, sizeof(desc));
     }
-
-    // Check packet header
-    uint32_t packet_len = packet[0] | (packet[1] << 8) | (packet[2] << 16);
-    uint8_t packet_num = packet[3];
-
-    if (packet_len < 4 || packet_num != 0) {
-        close(fd);
-        set_server_check_status(check, HCHK_STATUS_L6RSP, "Invalid MySQL packet");
-        return -1;
-    }
-
-    // Check protocol version (packet[4])
-    if (packet[4] != 10 && packet[4] != 9) {
-        close(fd);
-        set_server_check_status(check, HCHK_STATUS_L6RSP, "Unsupported MySQL version");
+    if (status == HCHK_STATUS_UNKNOWN) {
+        set_server_check_status(check, HCHK_STATUS_L6RSP, "Invalid MySQL handshake");
         return -1;
     }
-
-    close(fd);
-    set_server_check_status(check, HCHK_STATUS_L6OK, "MySQL check passed");
-    return 0;
+    set_server_check_status(check, status, desc);
+    return status == HCHK_STATUS_L6OK ? 0 : -1;
 }
 
 int check_redis(check_t *check) {
@@ -315,8 +434,9 @@ int check_redis(check_t *check) {
     }
 
     // Send PING command
-    const char *ping_cmd = "*1\r\n$4\r\nPING\r\n";
-    if (send(fd, ping_cmd, strlen(ping_cmd), MSG_NOSIGNAL) < 0) {
+    char ping_cmd[32];
+    int len = check_probe_request(check, ping_cmd, sizeof(ping_cmd), false);
+    if (len < 0 || send(fd, ping_cmd, len, MSG_NOSIGNAL) < 0) {
         close(fd);
         set_server_check_status(check, HCHK_STATUS_L6RSP, "Failed to send PING");
         return -1;
@@ -325,15 +445,20 @@ int check_redis(check_t *check) {
     // Expect "+PONG\r\n"
     char response[32];
     ssize_t received = recv(fd, response, sizeof(response) - 1, 0);
+    close(fd);
 
-    if (received < 7 || strncmp(response, "+PONG\r\n", 7) != 0) {
-        close(fd);
+    char desc[HCHK_DESC_LEN];
+    size_t consumed;
+    check_status_t status = HCHK_STATUS_UNKNOWN;
+    if (received > 0) {
+        response[received] = '\0';
+        status = check_probe_response(check, response, received, &consumed, desc, sizeof(desc));
+    }
+    if (status != HCHK_STATUS_L6OK) {
         set_server_check_status(check, HCHK_STATUS_L6RSP, "Invalid PONG response");
         return -1;
     }
-
-    close(fd);
-    set_server_check_status(check, HCHK_STATUS_L6OK, "Redis check passed");
+    set_server_check_status(check, status, desc);
     return 0;
 }
 
@@ -361,8 +486,7 @@ void set_server_check_status(check_t *check, check_status_t status, const char *
 
             if (check->consecutive_success >= check->interval.rise) {
                 if (srv->cur_state != SRV_RUNNING) {
-                    srv->cur_state = SRV_RUNNING;
-                    srv->last_change = now;
+                    server_set_state(srv, SRV_RUNNING);
                     log_info("Server %s:%d is UP", srv->hostname, srv->port);
                 }
             }
@@ -374,8 +498,7 @@ void set_server_check_status(check_t *check, check_status_t status, const char *
 
             if (check->consecutive_errors >= check->interval.fall) {
                 if (srv->cur_state == SRV_RUNNING) {
-                    srv->cur_state = SRV_MAINTAIN;
-                    srv->last_change = now;
+                    server_set_state(srv, SRV_MAINTAIN);
                     log_warning("Server %s:%d is DOWN: %s", srv->hostname, srv->port, desc);
                 }
             }
@@ -1,4 +1,10 @@
 #include "core/loadbalancer.h"
+#include "core/lb_stats.h"
+#include "core/lb_clock.h"
+#include "core/lb_timer.h"
+#include "core/lb_network.h"
+#include "core/lb_shm.h"
+#include "health/health.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,142 +17,395 @@
 #include <sys/epoll.h>
 #include <arpa/inet.h>
 #include <netdb.h>
-#include <fcntl.h>
-#include <sys/select.h>
 
-void* health_check_thread(void* arg) {
-    loadbalancer_t* lb = (loadbalancer_t*)arg;
+// Event-driven health checker. Every backend has one probe, a small state
+// machine driven by a shared epoll set: all probes run concurrently, each
+// on its own jittered schedule, and a probe that times out only holds up
+// itself. HTTP and Redis probes keep their connection for the next round
+// when the backend allows it. One timer per probe (from lb_timer) serves
+// as both the next-run schedule and the in-flight deadline.
+#define HC_MAX_EVENTS   256
+#define HC_JITTER_PCT   10      // +/- spread of each probe interval
+#define HC_BUF_SIZE     1024
+
+// Console report: one row per backend up to this many, then state counts
+#define STATS_PRINT_BACKENDS    32
+
+typedef enum {
+    HC_IDLE,            // waiting for its next run, maybe holding a kept-alive fd
+    HC_CONNECTING,
+    HC_SENDING,
+    HC_RECEIVING
+} hc_state_t;
+
+typedef struct hc_probe {
+    lb_timer_t timer;   // first member: the timer callback casts back
+    backend_t* backend;
+    int fd;
+    hc_state_t state;
+    bool reused;        // this run went out on a kept-alive connection
+    uint64_t start_ns;
+    size_t req_len;
+    size_t sent;
+    size_t recv_len;
+    check_t check;      // type and request settings; no server attached
+    char req[HC_BUF_SIZE];
+    char buf[HC_BUF_SIZE];
+} hc_probe_t;
+
+typedef struct hc_engine {
+    loadbalancer_t* lb;
+    int epfd;
+    lb_timer_wheel_t* timers;
+    uint32_t count;
+    bool changed;       // a backend changed state since the last sync
+    hc_probe_t* probes[MAX_BACKENDS];
+} hc_engine_t;
+
+static uint64_t hc_jitter_ms(uint32_t interval_ms) {
+    uint32_t spread = interval_ms * HC_JITTER_PCT / 100;
+    if (!spread) return interval_ms;
+    return interval_ms - spread + lb_rand_range(2 * spread + 1);
+}
 
-    while (lb->running) {
-        // Skip health checks if disabled
-        if (!lb->config.health_check_enabled) {
-            sleep(1);
+static void hc_close(hc_engine_t* e, hc_probe_t* p) {
+    if (p->fd < 0) return;
+    epoll_ctl(e->epfd, EPOLL_CTL_DEL, p->fd, NULL);
+    close(p->fd);
+    p->fd = -1;
+}
+
+static void hc_watch(hc_engine_t* e, hc_probe_t* p, uint32_t events) {
+    struct epoll_event ev = { .events = events | EPOLLRDHUP, .data.ptr = p };
+    if (epoll_ctl(e->epfd, EPOLL_CTL_MOD, p->fd, &ev) < 0) {
+        epoll_ctl(e->epfd, EPOLL_CTL_ADD, p->fd, &ev);
+    }
+}
+
+// Record one probe verdict. A backend goes DOWN after
+// health_check_fail_threshold failed checks in a row and UP again on the
+// first one that passes. Returns true when the backend changed state.
+bool lb_health_report(loadbalancer_t* lb, backend_t* backend, bool passed,
+                      uint64_t rtt_ns, const char* why) {
+    if (!passed) {
+        uint32_t fails = atomic_fetch_add(&backend->failed_conns, 1) + 1;
+        if (fails >= lb->config.health_check_fail_threshold &&
+            atomic_load(&backend->state) != BACKEND_DOWN) {
+            lb_backend_set_state(lb, backend, BACKEND_DOWN);
+            printf("[HEALTH] Backend %s:%u marked DOWN after %u failed checks (%s)\n",
+                   backend->host, backend->port, fails, why);
+            return true;
+        }
+        return false;
+    }
+
+    backend_state_t prev_state = atomic_load(&backend->state);
+    lb_backend_set_state(lb, backend, BACKEND_UP);
+    atomic_store(&backend->failed_conns, 0);
+    atomic_store(&backend->check_rtt_ns, rtt_ns);
+    atomic_store(&backend->last_check_ns, get_time_ns());
+
+    if (prev_state != BACKEND_UP) {
+        printf("[HEALTH] Backend %s:%u is now UP (response time: %.2fms)\n",
+               backend->host, backend->port, rtt_ns / 1000000.0);
+        return true;
+    }
+    return false;
+}
+
+// End of one run: record the verdict, keep or drop the connection, and
+// schedule the next run
+static void hc_finish(hc_engine_t* e, hc_probe_t* p, bool passed, bool keep, const char* why) {
+    uint64_t rtt_ns = passed ? get_time_ns() - p->start_ns : 0;
+    if (lb_health_report(e->lb, p->backend, passed, rtt_ns, why)) {
+        e->changed = true;
+    }
+
+    if (keep) {
+        // Only a close from the backend is of interest while idle
+        hc_watch(e, p, EPOLLIN);
+    } else {
+        hc_close(e, p);
+    }
+    p->state = HC_IDLE;
+    lb_timer_schedule(e->timers, &p->timer,
+                      get_time_ns() / 1000000 + hc_jitter_ms(e->lb->config.health_check_interval_ms));
+}
+
+static void hc_send(hc_engine_t* e, hc_probe_t* p);
+static void hc_start(hc_engine_t* e, hc_probe_t* p);
+
+static void hc_connected(hc_engine_t* e, hc_probe_t* p) {
+    int len = check_probe_request(&p->check, p->req, sizeof(p->req),
+                                  p->check.type == HCHK_TYPE_HTTP || p->check.type == HCHK_TYPE_REDIS);
+    if (len < 0) {
+        hc_finish(e, p, false, false, "request too large");
+        return;
+    }
+
+    p->req_len = len;
+    p->sent = 0;
+    p->recv_len = 0;
+    if (len == 0 && !check_probe_expects_response(&p->check)) {
+        hc_finish(e, p, true, false, NULL);
+        return;
+    }
+    hc_send(e, p);
+}
+
+static void hc_send(hc_engine_t* e, hc_probe_t* p) {
+    while (p->sent < p->req_len) {
+        ssize_t n = send(p->fd, p->req + p->sent, p->req_len - p->sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            p->sent += n;
             continue;
         }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            p->state = HC_SENDING;
+            hc_watch(e, p, EPOLLOUT);
+            return;
+        }
+        if (p->reused) {
+            // The kept-alive connection went away meanwhile; not the
+            // backend's fault, so try again on a fresh one
+            hc_close(e, p);
+            hc_start(e, p);
+            return;
+        }
+        hc_finish(e, p, false, false, strerror(errno));
+        return;
+    }
 
-        for (uint32_t i = 0; i < lb->backend_count; i++) {
-            backend_t* backend = lb->backends[i];
-            if (!backend) continue;
-
-            int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-            if (sockfd < 0) continue;
-
-            struct timeval tv = {
-                .tv_sec = 2,
-                .tv_usec = 0
-            };
-            setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
-            setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
-
-            // Set connect timeout
-            fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) | O_NONBLOCK);
-
-            struct sockaddr_in addr = {
-                .sin_family = AF_INET,
-                .sin_port = htons(backend->port)
-            };
-
-            if (inet_pton(AF_INET, backend->host, &addr.sin_addr) <= 0) {
-                struct hostent* he = gethostbyname(backend->host);
-                if (!he) {
-                    close(sockfd);
-                    atomic_store(&backend->state, BACKEND_DOWN);
-                    continue;
-                }
-                memcpy(&addr.sin_addr, he->h_addr_list[0], he->h_length);
+    p->state = HC_RECEIVING;
+    hc_watch(e, p, EPOLLIN);
+}
+
+static void hc_receive(hc_engine_t* e, hc_probe_t* p) {
+    for (;;) {
+        ssize_t n = recv(p->fd, p->buf + p->recv_len, sizeof(p->buf) - 1 - p->recv_len, 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+
+        if (n <= 0) {
+            if (p->reused && p->recv_len == 0) {
+                hc_close(e, p);
+                hc_start(e, p);
+                return;
             }
+            hc_finish(e, p, false, false, n == 0 ? "connection closed" : strerror(errno));
+            return;
+        }
 
-            uint64_t start_ns = get_time_ns();
+        p->recv_len += n;
+        p->buf[p->recv_len] = '\0';
+
+        char desc[HCHK_DESC_LEN];
+        size_t consumed;
+        check_status_t status = check_probe_response(&p->check, p->buf, p->recv_len,
+                                                     &consumed, desc, sizeof(desc));
+        if (status == HCHK_STATUS_UNKNOWN) {
+            if (p->recv_len < sizeof(p->buf) - 1) continue;
+            hc_finish(e, p, false, false, "response too large");
+            return;
+        }
 
-            // Try non-blocking connect with proper timeout handling
-            int connect_result = connect(sockfd, (struct sockaddr*)&addr, sizeof(addr));
+        bool passed = status == HCHK_STATUS_L4OK || status == HCHK_STATUS_L6OK ||
+                      status == HCHK_STATUS_L7OK;
+        hc_finish(e, p, passed, passed && consumed == p->recv_len, desc);
+        return;
+    }
+}
 
-            if (connect_result < 0 && errno == EINPROGRESS) {
-                // Wait for connection with select
-                fd_set write_fds;
-                FD_ZERO(&write_fds);
-                FD_SET(sockfd, &write_fds);
+static void hc_start(hc_engine_t* e, hc_probe_t* p) {
+    loadbalancer_t* lb = e->lb;
+    p->start_ns = get_time_ns();
+    lb_timer_schedule(e->timers, &p->timer, p->start_ns / 1000000 + lb->config.health_check_timeout_ms);
 
-                struct timeval connect_tv = { .tv_sec = 2, .tv_usec = 0 };
-                int select_result = select(sockfd + 1, NULL, &write_fds, NULL, &connect_tv);
+    if (p->fd >= 0) {
+        p->reused = true;
+        hc_connected(e, p);
+        return;
+    }
+    p->reused = false;
+
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    if (lb_dns_backend_addr(p->backend, &addr, &addr_len) < 0) {
+        hc_finish(e, p, false, false, "unresolved");
+        return;
+    }
 
-                if (select_result > 0) {
-                    int sock_error = 0;
-                    socklen_t len = sizeof(sock_error);
-                    getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &sock_error, &len);
-                    connect_result = (sock_error == 0) ? 0 : -1;
-                } else {
-                    connect_result = -1;
-                }
+    p->fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (p->fd < 0) {
+        hc_finish(e, p, false, false, strerror(errno));
+        return;
+    }
+    int one = 1;
+    setsockopt(p->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (connect(p->fd, (struct sockaddr*)&addr, addr_len) == 0) {
+        hc_connected(e, p);
+    } else if (errno == EINPROGRESS) {
+        p->state = HC_CONNECTING;
+        hc_watch(e, p, EPOLLOUT);
+    } else {
+        hc_finish(e, p, false, false, strerror(errno));
+    }
+}
+
+static void hc_event(hc_engine_t* e, hc_probe_t* p, uint32_t events) {
+    switch (p->state) {
+        case HC_IDLE:
+            // Kept-alive connection closed or sent something unasked for
+            hc_close(e, p);
+            break;
+
+        case HC_CONNECTING: {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(p->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err || (events & (EPOLLERR | EPOLLHUP))) {
+                hc_finish(e, p, false, false, strerror(err ? err : ECONNREFUSED));
+            } else {
+                hc_connected(e, p);
             }
+            break;
+        }
+
+        case HC_SENDING:
+            hc_send(e, p);
+            break;
+
+        case HC_RECEIVING:
+            hc_receive(e, p);
+            break;
+    }
+}
+
+static void hc_timer_fired(lb_timer_t* timer, void* arg) {
+    hc_engine_t* e = arg;
+    hc_probe_t* p = (hc_probe_t*)timer;  // timer is the first member
+
+    if (p->state == HC_IDLE) {
+        hc_start(e, p);
+    } else {
+        hc_finish(e, p, false, false, "timeout");
+    }
+}
+
+// Probes for backends added since the last pass, first run spread over
+// one interval
+static void hc_add_probes(hc_engine_t* e) {
+    loadbalancer_t* lb = e->lb;
+    uint64_t now_ms = get_time_ns() / 1000000;
+
+    while (e->count < lb->backend_count) {
+        backend_t* backend = lb->backends[e->count];
+        hc_probe_t* p = backend ? calloc(1, sizeof(*p)) : NULL;
+        e->probes[e->count++] = p;
+        if (!p) continue;
+
+        p->backend = backend;
+        p->fd = -1;
+        p->state = HC_IDLE;
+        p->check.type = lb->config.health_check_type;
+        p->check.http.method = "HEAD";
+        p->check.http.uri = lb->config.health_check_uri;
+        p->check.http.host = "localhost";
+        lb_timer_init(&p->timer);
+        lb_timer_schedule(e->timers, &p->timer,
+                          now_ms + lb_rand_range(lb->config.health_check_interval_ms + 1));
+    }
+}
+
+void* health_check_thread(void* arg) {
+    loadbalancer_t* lb = (loadbalancer_t*)arg;
+
+    hc_engine_t* e = calloc(1, sizeof(*e));
+    if (!e) return NULL;
+    e->lb = lb;
+    e->epfd = epoll_create1(EPOLL_CLOEXEC);
+    e->timers = lb_timer_wheel_create(get_time_ns() / 1000000);
+    if (e->epfd < 0 || !e->timers) {
+        perror("health checker setup");
+        if (e->epfd >= 0) close(e->epfd);
+        lb_timer_wheel_destroy(e->timers);
+        free(e);
+        return NULL;
+    }
+
+    // With a shared segment only the leader probes; the others adopt its
+    // results for as long as it keeps publishing
+    lb_shm_t* shm = NULL;
+    bool leading = false;
+    if (lb->config.shared_state) {
+        shm = lb_shm_open(lb->config.shared_state);
+        if (!shm) {
+            fprintf(stderr, "[WARN] Cannot open shared state %s: %s\n",
+                    lb->config.shared_state, strerror(errno));
+        } else {
+            leading = lb_shm_try_lead(shm);
+            printf("[HEALTH] Shared state %s: %s\n", lb->config.shared_state,
+                   leading ? "leader" : "follower");
+        }
+    }
 
-            // Set socket back to blocking for send/recv
-            fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) & ~O_NONBLOCK);
-
-            if (connect_result == 0) {
-                const char* http_req = "HEAD / HTTP/1.0\r\nHost: localhost\r\nConnection: close\r\n\r\n";
-                ssize_t sent = send(sockfd, http_req, strlen(http_req), MSG_NOSIGNAL);
-
-                if (sent > 0) {
-                    char response[512];
-                    ssize_t received = recv(sockfd, response, sizeof(response) - 1, 0);
-
-                    if (received > 0) {
-                        response[received] = '\0';
-                        if (strstr(response, "HTTP/1.") &&
-                            (strstr(response, " 200 ") || strstr(response, " 204 ") ||
-                             strstr(response, " 301 ") || strstr(response, " 302 "))) {
-
-                            backend_state_t prev_state = atomic_load(&backend->state);
-                            atomic_store(&backend->state, BACKEND_UP);
-                            atomic_store(&backend->failed_conns, 0);
-                            uint64_t response_time = get_time_ns() - start_ns;
-                            atomic_store(&backend->response_time_ns, response_time);
-                            atomic_store(&backend->last_check_ns, get_time_ns());
-
-                            if (prev_state != BACKEND_UP) {
-                                printf("[HEALTH] Backend %s:%u is now UP (response time: %.2fms)\n",
-                                       backend->host, backend->port, response_time / 1000000.0);
-                            }
-                        } else {
-                            uint32_t fails = atomic_fetch_add(&backend->failed_conns, 1) + 1;
-                            if (fails >= lb->config.health_check_fail_threshold) {
-                                atomic_store(&backend->state, BACKEND_DOWN);
-                                printf("[HEALTH] Backend %s:%u marked DOWN after %u failed checks\n",
-                                       backend->host, backend->port, fails);
-                            }
-                        }
-                    } else {
-                        uint32_t fails = atomic_fetch_add(&backend->failed_conns, 1) + 1;
-                        if (fails >= lb->config.health_check_fail_threshold) {
-                            atomic_store(&backend->state, BACKEND_DOWN);
-                            printf("[HEALTH] Backend %s:%u marked DOWN after %u failed checks\n",
-                                   backend->host, backend->port, fails);
-                        }
-                    }
-                } else {
-                    uint32_t fails = atomic_fetch_add(&backend->failed_conns, 1) + 1;
-                    if (fails >= lb->config.health_check_fail_threshold) {
-                        atomic_store(&backend->state, BACKEND_DOWN);
-                        printf("[HEALTH] Backend %s:%u marked DOWN after %u failed checks\n",
-                               backend->host, backend->port, fails);
-                    }
-                }
+    struct epoll_event events[HC_MAX_EVENTS];
+    while (lb->running) {
+        // Passive ejections run out on their own schedule, probes or not
+        lb_outlier_sweep(lb, lb_now_ns());
+
+        // Skip health checks if disabled
+        if (!lb->config.health_check_enabled) {
+            sleep(1);
+            continue;
+        }
+
+        bool following = false;
+        if (shm && !leading) {
+            if (lb_shm_try_lead(shm)) {
+                leading = true;
+                printf("[HEALTH] Took over health checks for %s\n", lb->config.shared_state);
             } else {
-                uint32_t fails = atomic_fetch_add(&backend->failed_conns, 1) + 1;
-                if (fails >= lb->config.health_check_fail_threshold) {
-                    atomic_store(&backend->state, BACKEND_DOWN);
-                    printf("[HEALTH] Backend %s:%u marked DOWN after %u failed checks\n",
-                           backend->host, backend->port, fails);
-                }
+                int changed = lb_shm_follow(shm, lb, LB_SHM_STALE_MS);
+                if (changed > 0) e->changed = true;
+                following = changed >= 0;
             }
+        }
 
-            close(sockfd);
+        if (following) {
+            usleep(100000);
+        } else {
+            hc_add_probes(e);
+
+            int nfds = epoll_wait(e->epfd, events, HC_MAX_EVENTS, 100);
+            for (int i = 0; i < nfds; i++) {
+                hc_event(e, events[i].data.ptr, events[i].events);
+            }
+            lb_timer_advance(e->timers, get_time_ns() / 1000000, hc_timer_fired, e);
+            if (shm) lb_shm_publish(shm, lb);
         }
 
-        usleep(lb->config.health_check_interval_ms * 1000 * 2);
+        // Re-publish the selection tables if any backend changed state
+        if (e->changed) {
+            e->changed = false;
+            if (lb->consistent_hash) {
+                consistent_hash_sync(lb->consistent_hash);
+            }
+            if (lb->wrr) {
+                lb_wrr_sync(lb->wrr, lb->backends, lb->backend_count);
+            }
+        }
     }
 
+    for (uint32_t i = 0; i < e->count; i++) {
+        if (!e->probes[i]) continue;
+        hc_close(e, e->probes[i]);
+        free(e->probes[i]);
+    }
+    close(e->epfd);
+    lb_timer_wheel_destroy(e->timers);
+    free(e);
+    lb_shm_close(shm);
     return NULL;
 }
 
@@ -154,34 +413,57 @@ void* stats_thread(void* arg) {
     loadbalancer_t* lb = (loadbalancer_t*)arg;
 
     while (lb->running) {
+        lb_stats_snapshot_t totals;
+        lb_stats_snapshot(lb, &totals);
+
         printf("\n========== Load Balancer Statistics ==========\n");
         printf("Global Stats:\n");
-        printf("  Total Requests:     %lu\n", atomic_load(&lb->global_stats.total_requests));
-        printf("  Failed Requests:    %lu\n", atomic_load(&lb->global_stats.failed_requests));
-        printf("  Active Connections: %u\n", atomic_load(&lb->global_stats.active_connections));
-        printf("  Bytes In:           %lu MB\n", atomic_load(&lb->global_stats.bytes_in) / (1024 * 1024));
-        printf("  Bytes Out:          %lu MB\n", atomic_load(&lb->global_stats.bytes_out) / (1024 * 1024));
+        printf("  Total Requests:     %lu\n", totals.total_requests);
+        printf("  Failed Requests:    %lu\n", totals.failed_requests);
+        printf("  Active Connections: %ld\n", totals.active_connections);
+        printf("  Bytes In:           %lu MB\n", totals.bytes_in / (1024 * 1024));
+        printf("  Bytes Out:          %lu MB\n", totals.bytes_out / (1024 * 1024));
 
         printf("\nBackend Stats:\n");
+        uint32_t printed = 0, by_state[BACKEND_MAINT + 1] = {0};
         for (uint32_t i = 0; i < lb->backend_count; i++) {
             backend_t* b = lb->backends[i];
             if (!b) continue;
 
+            backend_state_t state = atomic_load(&b->state);
+            if (printed == STATS_PRINT_BACKENDS) {
+                if ((unsigned)state <= BACKEND_MAINT) by_state[state]++;
+                continue;
+            }
+            printed++;
+
             const char* state_str = "UNKNOWN";
-            switch (atomic_load(&b->state)) {
+            switch (state) {
                 case BACKEND_UP: state_str = "UP"; break;
                 case BACKEND_DOWN: state_str = "DOWN"; break;
                 case BACKEND_DRAIN: state_str = "DRAIN"; break;
                 case BACKEND_MAINT: state_str = "MAINT"; break;
             }
 
-            printf("  [%s:%u] State: %s, Active: %u, Total: %u, Failed: %u, RT: %.2fms\n",
+            uint64_t bytes_in, bytes_out;
+            lb_stats_backend_bytes(lb, b, &bytes_in, &bytes_out);
+
+            printf("  [%s:%u] State: %s, Active: %u, Total: %u, Failed: %u, RT: %.2fms, In: %lu MB, Out: %lu MB\n",
                    b->host, b->port, state_str,
-                   atomic_load(&b->active_conns),
+                   lb_backend_conns(lb, b),
                    atomic_load(&b->total_conns),
                    atomic_load(&b->failed_conns),
-                   atomic_load(&b->response_time_ns) / 1000000.0);
+                   atomic_load(&b->ewma_cost_ns) / 1000000.0,
+                   bytes_in / (1024 * 1024), bytes_out / (1024 * 1024));
+        }
+        uint32_t rest = by_state[BACKEND_UP] + by_state[BACKEND_DOWN] +
+                        by_state[BACKEND_DRAIN] + by_state[BACKEND_MAINT];
+        if (rest) {
+            printf("  ... %u more: %u UP, %u DOWN, %u DRAIN, %u MAINT\n", rest,
+                   by_state[BACKEND_UP], by_state[BACKEND_DOWN],
+                   by_state[BACKEND_DRAIN], by_state[BACKEND_MAINT]);
         }
+        fflush(stdout);
 
         sleep(5);
     }
@@ -236,15 +518,22 @@ int lb_start(loadbalancer_t* lb) {
     pthread_create(&stats_tid, NULL, stats_thread, lb);
     pthread_detach(stats_tid);
 
+    pthread_t dns_tid;
+    if (pthread_create(&dns_tid, NULL, dns_resolver_thread, lb) == 0) {
+        pthread_detach(dns_tid);
+    }
+
     printf("Load balancer started on port %u with %u workers\n", lb->port, lb->worker_threads);
     printf("Algorithm: ");
     switch (lb->algorithm) {
         case LB_ALGO_ROUNDROBIN: printf("Round Robin\n"); break;
         case LB_ALGO_LEASTCONN: printf("Least Connections\n"); break;
+        case LB_ALGO_LEASTCONN_P2C: printf("Least Connections (P2C)\n"); break;
         case LB_ALGO_SOURCE: printf("IP Hash\n"); break;
         case LB_ALGO_STICKY: printf("Weighted\n"); break;
         case LB_ALGO_URI: printf("Consistent Hash\n"); break;
-        case LB_ALGO_RANDOM: printf("Least Response Time\n"); break;
+        case LB_ALGO_RANDOM: printf("Random\n"); break;
+        case LB_ALGO_PEAK_EWMA: printf("Peak EWMA Response Time\n"); break;
         default: printf("Unknown\n");
     }
 
@@ -0,0 +1,482 @@
+#include "http/h2.h"
+#include <string.h>
+#include <pthread.h>
+
+void h2_frame_decode(const uint8_t* p, struct h2_frame* frm) {
+    frm->len = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+    frm->type = p[3];
+    frm->flags = p[4];
+    frm->sid = (((uint32_t)p[5] << 24) | ((uint32_t)p[6] << 16) |
+                ((uint32_t)p[7] << 8) | p[8]) & 0x7fffffff;
+}
+
+uint8_t* h2_frame_encode(uint8_t* p, uint32_t len, uint8_t type, uint8_t flags, uint32_t sid) {
+    p[0] = (uint8_t)(len >> 16);
+    p[1] = (uint8_t)(len >> 8);
+    p[2] = (uint8_t)len;
+    p[3] = type;
+    p[4] = flags;
+    p[5] = (uint8_t)((sid >> 24) & 0x7f);
+    p[6] = (uint8_t)(sid >> 16);
+    p[7] = (uint8_t)(sid >> 8);
+    p[8] = (uint8_t)sid;
+    return p + H2_FRAME_HDR_LEN;
+}
+
+// RFC 7541 Appendix A
+static const struct {
+    const char* name;
+    const char* value;
+    uint8_t nlen;
+    uint8_t vlen;
+} hpack_static[] = {
+#define HPACK_S(n, v) { n, v, sizeof(n) - 1, sizeof(v) - 1 }
+    HPACK_S("", ""),
+    HPACK_S(":authority", ""),
+    HPACK_S(":method", "GET"),
+    HPACK_S(":method", "POST"),
+    HPACK_S(":path", "/"),
+    HPACK_S(":path", "/index.html"),
+    HPACK_S(":scheme", "http"),
+    HPACK_S(":scheme", "https"),
+    HPACK_S(":status", "200"),
+    HPACK_S(":status", "204"),
+    HPACK_S(":status", "206"),
+    HPACK_S(":status", "304"),
+    HPACK_S(":status", "400"),
+    HPACK_S(":status", "404"),
+    HPACK_S(":status", "500"),
+    HPACK_S("accept-charset", ""),
+    HPACK_S("accept-encoding", "gzip, deflate"),
+    HPACK_S("accept-language", ""),
+    HPACK_S("accept-ranges", ""),
+    HPACK_S("accept", ""),
+    HPACK_S("access-control-allow-origin", ""),
+    HPACK_S("age", ""),
+    HPACK_S("allow", ""),
+    HPACK_S("authorization", ""),
+    HPACK_S("cache-control", ""),
+    HPACK_S("content-disposition", ""),
+    HPACK_S("content-encoding", ""),
+    HPACK_S("content-language", ""),
+    HPACK_S("content-length", ""),
+    HPACK_S("content-location", ""),
+    HPACK_S("content-range", ""),
+    HPACK_S("content-type", ""),
+    HPACK_S("cookie", ""),
+    HPACK_S("date", ""),
+    HPACK_S("etag", ""),
+    HPACK_S("expect", ""),
+    HPACK_S("expires", ""),
+    HPACK_S("from", ""),
+    HPACK_S("host", ""),
+    HPACK_S("if-match", ""),
+    HPACK_S("if-modified-since", ""),
+    HPACK_S("if-none-match", ""),
+    HPACK_S("if-range", ""),
+    HPACK_S("if-unmodified-since", ""),
+    HPACK_S("last-modified", ""),
+    HPACK_S("link", ""),
+    HPACK_S("location", ""),
+    HPACK_S("max-forwards", ""),
+    HPACK_S("proxy-authenticate", ""),
+    HPACK_S("proxy-authorization", ""),
+    HPACK_S("range", ""),
+    HPACK_S("referer", ""),
+    HPACK_S("refresh", ""),
+    HPACK_S("retry-after", ""),
+    HPACK_S("server", ""),
+    HPACK_S("set-cookie", ""),
+    HPACK_S("strict-transport-security", ""),
+    HPACK_S("transfer-encoding", ""),
+    HPACK_S("user-agent", ""),
+    HPACK_S("vary", ""),
+    HPACK_S("via", ""),
+    HPACK_S("www-authenticate", ""),
+#undef HPACK_S
+};
+
+#define HPACK_STATIC_COUNT 61
+
+// Huffman code lengths for bytes 0-255 and EOS (RFC 7541 Appendix B).
+// The code is canonical, so the codes themselves follow from the lengths.
+static const uint8_t hpack_huff_len[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+#define HPACK_HUFF_MAXLEN 30
+
+// Decoding tables, derived once from the lengths: per code length the
+// first code and how many symbols have it, plus an 8-bit lookup for the
+// short codes that carry nearly all header text
+static struct {
+    uint32_t first[HPACK_HUFF_MAXLEN + 1];
+    uint16_t count[HPACK_HUFF_MAXLEN + 1];
+    uint16_t offset[HPACK_HUFF_MAXLEN + 1];
+    uint16_t sym[257];
+    struct {
+        uint8_t sym;
+        uint8_t len;        // 0: no code of 8 bits or fewer starts here
+    } fast[256];
+} hpack_huff;
+
+static pthread_once_t hpack_huff_once = PTHREAD_ONCE_INIT;
+
+static void hpack_huff_build(void) {
+    for (int s = 0; s < 257; s++) hpack_huff.count[hpack_huff_len[s]]++;
+
+    uint32_t code = 0;
+    uint16_t offset = 0;
+    for (int len = 1; len <= HPACK_HUFF_MAXLEN; len++) {
+        hpack_huff.first[len] = code;
+        hpack_huff.offset[len] = offset;
+        code = (code + hpack_huff.count[len]) << 1;
+        offset += hpack_huff.count[len];
+    }
+
+    uint16_t next[HPACK_HUFF_MAXLEN + 1];
+    memcpy(next, hpack_huff.offset, sizeof(next));
+    for (int s = 0; s < 257; s++) {
+        int len = hpack_huff_len[s];
+        uint16_t i = next[len]++;
+        hpack_huff.sym[i] = (uint16_t)s;
+
+        if (len <= 8) {
+            uint32_t c = hpack_huff.first[len] + (i - hpack_huff.offset[len]);
+            uint32_t lo = c << (8 - len);
+            for (uint32_t j = 0; j < (1u << (8 - len)); j++) {
+                hpack_huff.fast[lo + j].sym = (uint8_t)s;
+                hpack_huff.fast[lo + j].len = (uint8_t)len;
+            }
+        }
+    }
+}
+
+ssize_t hpack_huffman_decode(const uint8_t* p, size_t len, char* out, size_t cap) {
+    pthread_once(&hpack_huff_once, hpack_huff_build);
+
+    const uint8_t* end = p + len;
+    uint64_t acc = 0;           // pending bits, most significant first
+    int nbits = 0;
+    size_t n = 0;
+
+    for (;;) {
+        while (nbits <= 56 && p < end) {
+            acc |= (uint64_t)*p++ << (56 - nbits);
+            nbits += 8;
+        }
+        if (nbits == 0) break;
+
+        int sym = -1;
+        int used = 0;
+        if (nbits >= 8 && hpack_huff.fast[acc >> 56].len) {
+            sym = hpack_huff.fast[acc >> 56].sym;
+            used = hpack_huff.fast[acc >> 56].len;
+        } else {
+            for (int l = 5; l <= HPACK_HUFF_MAXLEN && l <= nbits; l++) {
+                uint32_t c = (uint32_t)(acc >> (64 - l));
+                if (c - hpack_huff.first[l] < hpack_huff.count[l]) {
+                    sym = hpack_huff.sym[hpack_huff.offset[l] + c - hpack_huff.first[l]];
+                    used = l;
+                    break;
+                }
+            }
+        }
+
+        if (sym < 0) {
+            // Input ran out inside a code: fine if it is up to seven
+            // bits of EOS padding
+            if (nbits > 7 || (acc >> (64 - nbits)) != (1u << nbits) - 1) return -1;
+            break;
+        }
+        if (sym == 256 || n >= cap) return -1;
+
+        out[n++] = (char)sym;
+        acc <<= used;
+        nbits -= used;
+    }
+    return (ssize_t)n;
+}
+
+void hpack_table_init(hpack_table_t* t) {
+    memset(t, 0, offsetof(hpack_table_t, ent));
+    t->max_size = HPACK_TABLE_SIZE;
+}
+
+static void hpack_arena_put(hpack_table_t* t, const char* s, size_t len) {
+    size_t first = HPACK_TABLE_SIZE - t->head;
+    if (first > len) first = len;
+    memcpy(t->arena + t->head, s, first);
+    memcpy(t->arena, s + first, len - first);
+    t->head = (uint32_t)((t->head + len) % HPACK_TABLE_SIZE);
+}
+
+static void hpack_arena_get(const hpack_table_t* t, uint32_t pos, size_t len, char* out) {
+    size_t first = HPACK_TABLE_SIZE - pos;
+    if (first > len) first = len;
+    memcpy(out, t->arena + pos, first);
+    memcpy(out + first, t->arena, len - first);
+}
+
+static bool hpack_arena_eq(const hpack_table_t* t, uint32_t pos, const char* s, size_t len) {
+    size_t first = HPACK_TABLE_SIZE - pos;
+    if (first > len) first = len;
+    return memcmp(t->arena + pos, s, first) == 0 && memcmp(t->arena, s + first, len - first) == 0;
+}
+
+// Ring slot of dynamic entry d (0 is the newest)
+static inline uint32_t hpack_slot(const hpack_table_t* t, uint32_t d) {
+    return (t->newest + HPACK_MAX_ENTRIES - d) % HPACK_MAX_ENTRIES;
+}
+
+static void hpack_evict(hpack_table_t* t) {
+    uint32_t slot = hpack_slot(t, t->count - 1);
+    t->size -= t->ent[slot].nlen + t->ent[slot].vlen + 32;
+    t->count--;
+}
+
+void hpack_table_resize(hpack_table_t* t, uint32_t max_size) {
+    if (max_size > HPACK_TABLE_SIZE) max_size = HPACK_TABLE_SIZE;
+    t->max_size = max_size;
+    while (t->count > 0 && t->size > t->max_size) hpack_evict(t);
+}
+
+static void hpack_insert(hpack_table_t* t, const char* name, size_t nlen,
+                         const char* value, size_t vlen) {
+    size_t esize = nlen + vlen + 32;
+    while (t->count > 0 && t->size + esize > t->max_size) hpack_evict(t);
+    if (esize > t->max_size) return;    // Too big for any table: it just ends up empty
+
+    t->newest = (t->newest + 1) % HPACK_MAX_ENTRIES;
+    t->ent[t->newest].pos = (uint16_t)t->head;
+    t->ent[t->newest].nlen = (uint16_t)nlen;
+    t->ent[t->newest].vlen = (uint16_t)vlen;
+    hpack_arena_put(t, name, nlen);
+    hpack_arena_put(t, value, vlen);
+    t->count++;
+    t->size += (uint32_t)esize;
+}
+
+static int hpack_get_int(const uint8_t** pp, const uint8_t* end, int prefix, uint32_t* out) {
+    const uint8_t* p = *pp;
+    if (p >= end) return -1;
+
+    uint32_t max = (1u << prefix) - 1;
+    uint32_t v = *p++ & max;
+    if (v == max) {
+        int shift = 0;
+        uint8_t b;
+        do {
+            if (p >= end || shift > 21) return -1;
+            b = *p++;
+            v += (uint32_t)(b & 0x7f) << shift;
+            shift += 7;
+        } while (b & 0x80);
+    }
+    *pp = p;
+    *out = v;
+    return 0;
+}
+
+// Decode a string literal into out->buf; *off and *len locate it there
+static int hpack_get_string(const uint8_t** pp, const uint8_t* end, hpack_headers_t* out,
+                            uint16_t* off, uint16_t* len) {
+    const uint8_t* p = *pp;
+    if (p >= end) return -1;
+
+    bool huffman = *p & 0x80;
+    uint32_t n;
+    if (hpack_get_int(&p, end, 7, &n) < 0 || n > (size_t)(end - p)) return -1;
+
+    size_t room = HPACK_LIST_MAX - out->used;
+    char* dst = out->buf + out->used;
+    ssize_t got;
+    if (huffman) {
+        got = hpack_huffman_decode(p, n, dst, room);
+    } else {
+        got = n <= room ? (ssize_t)n : -1;
+        if (got >= 0) memcpy(dst, p, n);
+    }
+    if (got < 0) return -1;
+
+    *off = (uint16_t)out->used;
+    *len = (uint16_t)got;
+    out->used += (uint32_t)got;
+    *pp = p + n;
+    return 0;
+}
+
+// Copy table entry idx (1-based, static then dynamic) into out->buf
+static int hpack_get_indexed(const hpack_table_t* t, uint32_t idx, bool with_value,
+                             hpack_headers_t* out, hpack_hdr_t* h) {
+    size_t nlen, vlen;
+    const char* sname = NULL;
+    const char* svalue = NULL;
+    uint32_t slot = 0;
+
+    if (idx == 0) return -1;
+    if (idx <= HPACK_STATIC_COUNT) {
+        sname = hpack_static[idx].name;
+        svalue = hpack_static[idx].value;
+        nlen = hpack_static[idx].nlen;
+        vlen = hpack_static[idx].vlen;
+    } else {
+        if (idx - HPACK_STATIC_COUNT - 1 >= t->count) return -1;
+        slot = hpack_slot(t, idx - HPACK_STATIC_COUNT - 1);
+        nlen = t->ent[slot].nlen;
+        vlen = t->ent[slot].vlen;
+    }
+    if (!with_value) vlen = 0;
+    if (out->used + nlen + vlen > HPACK_LIST_MAX) return -1;
+
+    char* dst = out->buf + out->used;
+    if (sname) {
+        memcpy(dst, sname, nlen);
+        memcpy(dst + nlen, svalue, vlen);
+    } else {
+        hpack_arena_get(t, t->ent[slot].pos, nlen, dst);
+        hpack_arena_get(t, (uint32_t)((t->ent[slot].pos + nlen) % HPACK_TABLE_SIZE), vlen, dst + nlen);
+    }
+
+    h->name = (uint16_t)out->used;
+    h->nlen = (uint16_t)nlen;
+    h->value = (uint16_t)(out->used + nlen);
+    h->vlen = (uint16_t)vlen;
+    out->used += (uint32_t)(nlen + vlen);
+    return 0;
+}
+
+int hpack_decode(hpack_table_t* t, const uint8_t* p, size_t len, hpack_headers_t* out) {
+    const uint8_t* end = p + len;
+    out->count = 0;
+    out->used = 0;
+
+    while (p < end) {
+        uint8_t b = *p;
+        uint32_t idx;
+
+        if ((b & 0xe0) == 0x20) {
+            // Dynamic table size update, only ahead of the first field
+            if (out->count > 0 || hpack_get_int(&p, end, 5, &idx) < 0 || idx > HPACK_TABLE_SIZE) {
+                return -1;
+            }
+            hpack_table_resize(t, idx);
+            continue;
+        }
+
+        if (out->count >= HPACK_HDR_MAX) return -1;
+        hpack_hdr_t* h = &out->h[out->count];
+
+        if (b & 0x80) {
+            if (hpack_get_int(&p, end, 7, &idx) < 0 || hpack_get_indexed(t, idx, true, out, h) < 0) {
+                return -1;
+            }
+            out->count++;
+            continue;
+        }
+
+        // Literal: with incremental indexing (01), without (0000) or
+        // never indexed (0001)
+        bool index = (b & 0xc0) == 0x40;
+        if (hpack_get_int(&p, end, index ? 6 : 4, &idx) < 0) return -1;
+        if (idx) {
+            if (hpack_get_indexed(t, idx, false, out, h) < 0) return -1;
+        } else if (hpack_get_string(&p, end, out, &h->name, &h->nlen) < 0) {
+            return -1;
+        }
+        if (hpack_get_string(&p, end, out, &h->value, &h->vlen) < 0) return -1;
+
+        if (index) {
+            hpack_insert(t, out->buf + h->name, h->nlen, out->buf + h->value, h->vlen);
+        }
+        out->count++;
+    }
+    return 0;
+}
+
+static size_t hpack_put_int(uint8_t* out, size_t cap, uint8_t first, int prefix, uint32_t v) {
+    uint32_t max = (1u << prefix) - 1;
+    size_t n = 0;
+
+    if (cap == 0) return 0;
+    if (v < max) {
+        out[n++] = first | (uint8_t)v;
+        return n;
+    }
+    out[n++] = first | (uint8_t)max;
+    v -= max;
+    while (v >= 0x80) {
+        if (n >= cap) return 0;
+        out[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    if (n >= cap) return 0;
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+// Raw (not Huffman-coded) string literal
+static size_t hpack_put_string(uint8_t* out, size_t cap, const char* s, size_t len) {
+    size_t n = hpack_put_int(out, cap, 0x00, 7, (uint32_t)len);
+    if (n == 0 || n + len > cap) return 0;
+    memcpy(out + n, s, len);
+    return n + len;
+}
+
+size_t hpack_encode_table_size(uint8_t* out, size_t cap, uint32_t size) {
+    return hpack_put_int(out, cap, 0x20, 5, size);
+}
+
+size_t hpack_encode(hpack_table_t* t, uint8_t* out, size_t cap,
+                    const char* name, size_t nlen, const char* value, size_t vlen, bool index) {
+    uint32_t full = 0;
+    uint32_t named = 0;
+
+    for (uint32_t i = 1; i <= HPACK_STATIC_COUNT && !full; i++) {
+        if (hpack_static[i].nlen != nlen || memcmp(hpack_static[i].name, name, nlen) != 0) continue;
+        if (!named) named = i;
+        if (hpack_static[i].vlen == vlen && memcmp(hpack_static[i].value, value, vlen) == 0) full = i;
+    }
+    for (uint32_t d = 0; d < t->count && !full; d++) {
+        uint32_t slot = hpack_slot(t, d);
+        if (t->ent[slot].nlen != nlen || !hpack_arena_eq(t, t->ent[slot].pos, name, nlen)) continue;
+        if (!named) named = HPACK_STATIC_COUNT + 1 + d;
+        uint32_t vpos = (uint32_t)((t->ent[slot].pos + nlen) % HPACK_TABLE_SIZE);
+        if (t->ent[slot].vlen == vlen && hpack_arena_eq(t, vpos, value, vlen)) {
+            full = HPACK_STATIC_COUNT + 1 + d;
+        }
+    }
+
+    if (full) return hpack_put_int(out, cap, 0x80, 7, full);
+
+    size_t n = index ? hpack_put_int(out, cap, 0x40, 6, named)
+                     : hpack_put_int(out, cap, 0x00, 4, named);
+    if (n == 0) return 0;
+    if (!named) {
+        size_t s = hpack_put_string(out + n, cap - n, name, nlen);
+        if (s == 0) return 0;
+        n += s;
+    }
+    size_t s = hpack_put_string(out + n, cap - n, value, vlen);
+    if (s == 0) return 0;
+    n += s;
+
+    if (index) hpack_insert(t, name, nlen, value, vlen);
+    return n;
+}
@@ -1,16 +1,42 @@
 #include "http/http.h"
+#include "http/http_scan.h"
 #include "core/proxy.h"
+#include "acl/acl.h"
 #include "utils/buffer.h"
 #include "utils/log.h"
+#include "core/lb_alloc.h"
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <stddef.h>
 
-static const char *http_methods[] = {
-    "OPTIONS", "GET", "HEAD", "POST", "PUT", "DELETE",
-    "TRACE", "CONNECT", "PATCH", NULL
+// Bit i of msg->meth for entry i (HTTP_METH_*)
+static const struct {
+    const char *name;
+    size_t len;
+} http_methods[] = {
+    {"OPTIONS", 7}, {"GET", 3}, {"HEAD", 4}, {"POST", 4}, {"PUT", 3},
+    {"DELETE", 6}, {"TRACE", 5}, {"CONNECT", 7}, {"PATCH", 5}, {NULL, 0}
+};
+
+// Perfect hash of the well-known header names: their lengths differ in
+// the low four bits, so len & 15 picks the only candidate and one
+// case-insensitive compare confirms it
+static const struct {
+    const char *name;
+    uint8_t len;
+    uint8_t id;
+} http_known_hdrs[16] = {
+    [17 & 15] = {"transfer-encoding", 17, HTTP_HDR_TRANSFER_ENCODING},
+    [4]       = {"host", 4, HTTP_HDR_HOST},
+    [7]       = {"upgrade", 7, HTTP_HDR_UPGRADE},
+    [10]      = {"connection", 10, HTTP_HDR_CONNECTION},
+    [14]      = {"content-length", 14, HTTP_HDR_CONTENT_LENGTH},
 };
 
+// Headers past this many make the message invalid
+#define HTTP_HDR_MAX 256
+
 static const struct {
     int code;
     const char *text;
@@ -84,61 +110,135 @@ bool http_is_status_server_error(int code) {
     return code >= 500 && code < 600;
 }
 
+// Returns the length of the request line including its LF, 0 while the
+// line is incomplete, -1 if it is malformed. msg->next is left on the
+// first header line.
 int http_parse_request_line(http_msg_t *msg, char *data, size_t len) {
+    char *lf = memchr(data, '\n', len);
+    if (!lf) return 0;
+
     char *p = data;
-    char *end = data + len;
+    char *end = (lf > data && lf[-1] == '\r') ? lf - 1 : lf;
     char *method_end, *uri_start, *uri_end, *ver_start;
 
     while (p < end && isspace(*p)) p++;
 
-    method_end = p;
-    while (method_end < end && !isspace(*method_end)) method_end++;
-
-    if (method_end == end) return -1;
+    method_end = (char *)http_scan_token(p, end);
+    if (method_end == p || method_end == end || *method_end != ' ') return -1;
 
     msg->som.pos = p - data;
     msg->som.len = method_end - p;
 
-    for (int i = 0; http_methods[i]; i++) {
-        if (msg->som.len == strlen(http_methods[i]) &&
-            memcmp(p, http_methods[i], msg->som.len) == 0) {
+    for (int i = 0; http_methods[i].name; i++) {
+        if ((size_t)msg->som.len == http_methods[i].len &&
+            memcmp(p, http_methods[i].name, msg->som.len) == 0) {
             msg->meth = 1 << i;
             break;
         }
     }
 
     p = method_end;
-    while (p < end && isspace(*p)) p++;
+    while (p < end && *p == ' ') p++;
 
     uri_start = p;
-    while (p < end && !isspace(*p)) p++;
+    while (p < end && *p != ' ') p++;
     uri_end = p;
 
     if (uri_end == uri_start) return -1;
 
-    msg->uri = malloc(uri_end - uri_start + 1);
-    memcpy(msg->uri, uri_start, uri_end - uri_start);
-    msg->uri[uri_end - uri_start] = '\0';
-    msg->uri_len = uri_end - uri_start;
+    msg->uri.pos = uri_start - data;
+    msg->uri.len = uri_end - uri_start;
 
-    while (p < end && isspace(*p)) p++;
+    while (p < end && *p == ' ') p++;
 
     ver_start = p;
-    while (p < end && *p != '\r' && *p != '\n') p++;
-
-    if (memcmp(ver_start, "HTTP/1.0", 8) == 0) {
+    size_t ver_len = end - ver_start;
+    if (ver_len == 8 && memcmp(ver_start, "HTTP/1.0", 8) == 0) {
         msg->flags |= HTTP_MSGF_VER_10;
-    } else if (memcmp(ver_start, "HTTP/1.1", 8) == 0) {
+    } else if (ver_len == 8 && memcmp(ver_start, "HTTP/1.1", 8) == 0) {
         msg->flags |= HTTP_MSGF_VER_11;
-    } else if (memcmp(ver_start, "HTTP/2", 6) == 0) {
+    } else if (ver_len >= 6 && memcmp(ver_start, "HTTP/2", 6) == 0) {
         msg->flags |= HTTP_MSGF_VER_20;
     }
 
     msg->sol.pos = 0;
-    msg->sol.len = p - data;
-    msg->eol.pos = p - data;
+    msg->sol.len = end - data;
+    msg->eol.pos = end - data;
+    msg->next = lf + 1 - data;
+
+    return lf + 1 - data;
+}
+
+int http_known_hdr_id(const char *name, size_t len) {
+    const char *cand = http_known_hdrs[len & 15].name;
+    if (cand && http_known_hdrs[len & 15].len == len && strncasecmp(name, cand, len) == 0)
+        return http_known_hdrs[len & 15].id;
+    return HTTP_HDR_OTHER;
+}
+
+// Next header slot: inline first, then the spill array, which is grown
+// here and kept for the next message unless it lives in the arena
+static http_hdr_t *http_msg_new_hdr(http_msg_t *msg) {
+    uint32_t i = msg->hdr_count;
+    if (i >= HTTP_HDR_MAX) return NULL;
+    if (i < HTTP_HDR_INLINE) {
+        msg->hdr_count++;
+        return &msg->hdrs[i];
+    }
+
+    uint32_t spilled = i - HTTP_HDR_INLINE;
+    if (spilled == msg->spill_cap) {
+        uint32_t cap = msg->spill_cap ? msg->spill_cap * 2 : HTTP_HDR_INLINE;
+        http_hdr_t *spill;
+        if (msg->arena) {
+            spill = lb_arena_alloc(msg->arena, cap * sizeof(*spill));
+            if (spill && spilled) memcpy(spill, msg->spill, spilled * sizeof(*spill));
+        } else {
+            spill = lb_realloc(msg->spill, cap * sizeof(*spill));
+        }
+        if (!spill) return NULL;
+        msg->spill = spill;
+        msg->spill_cap = cap;
+    }
+    msg->hdr_count++;
+    return &msg->spill[spilled];
+}
+
+// Ready for the next message; the spill array stays allocated
+void http_msg_reset(http_msg_t *msg) {
+    struct lb_arena *arena = msg->arena;
+    http_hdr_t *spill = arena ? NULL : msg->spill;
+    uint32_t spill_cap = arena ? 0 : msg->spill_cap;
+
+    memset(msg, 0, offsetof(http_msg_t, hdrs));
+    msg->msg_state = HTTP_MSG_RQBEFORE;
+    msg->spill = spill;
+    msg->spill_cap = spill_cap;
+    msg->arena = arena;
+}
+
+void http_msg_release(http_msg_t *msg) {
+    if (!msg->arena) lb_free(msg->spill);
+    msg->spill = NULL;
+    msg->spill_cap = 0;
+    msg->hdr_count = 0;
+}
+
+const http_hdr_t *http_msg_find(const http_msg_t *msg, const struct buffer *buf, const char *name) {
+    size_t len = strlen(name);
+    int id = http_known_hdr_id(name, len);
+    if (id != HTTP_HDR_OTHER) return http_msg_known(msg, id);
+
+    for (uint32_t i = 0; i < msg->hdr_count; i++) {
+        const http_hdr_t *hdr = http_msg_hdr(msg, i);
+        if (hdr->n.len == len && strncasecmp(http_slice_ptr(buf, hdr->n), name, len) == 0)
+            return hdr;
+    }
+    return NULL;
+}
 
-    return p - data;
+static inline bool http_is_ows(char c) {
+    return c == ' ' || c == '\t';
 }
 
 int http_parse_headers(http_msg_t *msg, struct buffer *buf) {
@@ -147,106 +247,140 @@ int http_parse_headers(http_msg_t *msg, struct buffer *buf) {
     http_hdr_t *hdr;
 
     while (p < end) {
-        char *eol = memchr(p, '\n', end - p);
-        if (!eol) break;
-
-        if (p == eol || (p + 1 == eol && *p == '\r')) {
-            msg->next = eol + 1 - buf->area;
+        // Empty line: end of the header block
+        if (*p == '\n' || *p == '\r') {
+            if (*p == '\r') {
+                if (p + 1 == end) break;
+                if (p[1] != '\n') goto error;
+            }
+            msg->next = (*p == '\r' ? p + 2 : p + 1) - buf->area;
+            msg->sov = msg->next;
             msg->msg_state = HTTP_MSG_BODY;
             return 1;
         }
 
-        char *colon = memchr(p, ':', eol - p);
-        if (!colon) {
-            msg->msg_state = HTTP_MSG_ERROR;
-            return -1;
+        // Name: tchars right up to the colon. Whitespace before it is
+        // rejected (RFC 9112 section 5.1), as are obs-fold lines.
+        char *colon = (char *)http_scan_token(p, end);
+        if (colon == end) break;
+        if (*colon != ':' || colon == p) goto error;
+
+        char *v = colon + 1;
+        while (v < end && http_is_ows(*v)) v++;
+
+        // Value: runs to the first control character, which has to be
+        // the CR or LF ending the line
+        char *eol = (char *)http_scan_ctl(v, end);
+        if (eol == end) break;
+        char *next;
+        if (*eol == '\n') {
+            next = eol + 1;
+        } else if (*eol == '\r') {
+            if (eol + 1 == end) break;
+            if (eol[1] != '\n') goto error;
+            next = eol + 2;
+        } else {
+            goto error;
         }
 
-        hdr = calloc(1, sizeof(http_hdr_t));
-        if (!hdr) return -1;
-
-        hdr->n.ptr = p;
-        hdr->n.len = colon - p;
-
-        while (hdr->n.len > 0 && isspace(hdr->n.ptr[hdr->n.len - 1]))
-            hdr->n.len--;
-
-        p = colon + 1;
-        while (p < eol && isspace(*p)) p++;
+        hdr = http_msg_new_hdr(msg);
+        if (!hdr) goto error;
 
-        hdr->v.ptr = p;
-        hdr->v.len = eol - p;
+        size_t vlen = eol - v;
+        while (vlen > 0 && http_is_ows(v[vlen - 1])) vlen--;
 
-        if (hdr->v.len > 0 && hdr->v.ptr[hdr->v.len - 1] == '\r')
-            hdr->v.len--;
+        hdr->n.pos = p - buf->area;
+        hdr->n.len = colon - p;
+        hdr->v.pos = v - buf->area;
+        hdr->v.len = vlen;
 
-        while (hdr->v.len > 0 && isspace(hdr->v.ptr[hdr->v.len - 1]))
-            hdr->v.len--;
+        int id = http_known_hdr_id(p, colon - p);
+        if (id != HTTP_HDR_OTHER && !msg->known[id])
+            msg->known[id] = msg->hdr_count;
 
-        if (strncasecmp(hdr->n.ptr, "content-length", hdr->n.len) == 0) {
-            msg->body_len = strtoll(hdr->v.ptr, NULL, 10);
-            msg->flags |= HTTP_MSGF_CNT_LEN;
-        } else if (strncasecmp(hdr->n.ptr, "transfer-encoding", hdr->n.len) == 0) {
-            if (strncasecmp(hdr->v.ptr, "chunked", 7) == 0) {
-                msg->flags |= HTTP_MSGF_TE_CHNK;
-            }
-        } else if (strncasecmp(hdr->n.ptr, "connection", hdr->n.len) == 0) {
-            if (strncasecmp(hdr->v.ptr, "close", 5) == 0) {
-                msg->flags |= HTTP_MSGF_CONN_CLO;
-            } else if (strncasecmp(hdr->v.ptr, "keep-alive", 10) == 0) {
-                msg->flags |= HTTP_MSGF_CONN_KAL;
-            } else if (strncasecmp(hdr->v.ptr, "upgrade", 7) == 0) {
-                msg->flags |= HTTP_MSGF_CONN_UPG;
-            }
-        } else if (strncasecmp(hdr->n.ptr, "upgrade", hdr->n.len) == 0) {
-            if (strncasecmp(hdr->v.ptr, "websocket", 9) == 0) {
-                msg->flags |= HTTP_MSGF_WEBSOCKET;
-            } else if (strncasecmp(hdr->v.ptr, "h2c", 3) == 0) {
-                msg->flags |= HTTP_MSGF_UPGRADE_H2C;
-            }
+        switch (id) {
+            case HTTP_HDR_CONTENT_LENGTH:
+                msg->body_len = strtoll(v, NULL, 10);
+                msg->flags |= HTTP_MSGF_CNT_LEN;
+                break;
+            case HTTP_HDR_TRANSFER_ENCODING:
+                if (vlen >= 7 && strncasecmp(v, "chunked", 7) == 0)
+                    msg->flags |= HTTP_MSGF_TE_CHNK;
+                break;
+            case HTTP_HDR_CONNECTION:
+                if (vlen >= 5 && strncasecmp(v, "close", 5) == 0) {
+                    msg->flags |= HTTP_MSGF_CONN_CLO;
+                } else if (vlen >= 10 && strncasecmp(v, "keep-alive", 10) == 0) {
+                    msg->flags |= HTTP_MSGF_CONN_KAL;
+                } else if (vlen >= 7 && strncasecmp(v, "upgrade", 7) == 0) {
+                    msg->flags |= HTTP_MSGF_CONN_UPG;
+                }
+                break;
+            case HTTP_HDR_UPGRADE:
+                if (vlen >= 9 && strncasecmp(v, "websocket", 9) == 0) {
+                    msg->flags |= HTTP_MSGF_WEBSOCKET;
+                } else if (vlen >= 3 && strncasecmp(v, "h2c", 3) == 0) {
+                    msg->flags |= HTTP_MSGF_UPGRADE_H2C;
+                }
+                break;
         }
 
-        http_header_add_tail(msg, hdr);
-        p = eol + 1;
+        p = next;
     }
 
+    // Incomplete line: resume from its start once more data is in
     msg->next = p - buf->area;
     return 0;
+
+error:
+    msg->err_pos = p - buf->area;
+    msg->msg_state = HTTP_MSG_ERROR;
+    return -1;
 }
 
+// Longest chunk-size line (size plus extensions) or trailer line held
+// while waiting for its end
+#define HTTP_CHUNK_LINE_MAX 4096
+
+// Size line of the next chunk. Returns 1 once it is complete, 0 when more
+// bytes are needed, -1 on a malformed line.
 int http_parse_chunk_size(http_msg_t *msg, struct buffer *buf) {
-    char *p = buf->area + msg->next;
+    char *start = buf->area + msg->next;
     char *end = buf->area + buf->data;
+    char *p = start;
     uint64_t chunk_size = 0;
 
-    while (p < end && isxdigit(*p)) {
+    while (p < end && isxdigit((unsigned char)*p)) {
+        if (chunk_size >> 60) return -1;
         chunk_size = (chunk_size << 4) |
-                    (*p <= '9' ? *p - '0' : toupper(*p) - 'A' + 10);
-        p++;
-    }
-
-    while (p < end && *p != '\n') {
-        if (*p == ';') {
-            while (p < end && *p != '\n') p++;
-            break;
-        }
+                    (*p <= '9' ? *p - '0' : toupper((unsigned char)*p) - 'A' + 10);
         p++;
     }
+    if (p == start && p < end) return -1;
 
-    if (p >= end) return 0;
-
-    p++;
+    char *lf = memchr(p, '\n', end - p);
+    if (!lf) return (end - start > HTTP_CHUNK_LINE_MAX) ? -1 : 0;
+    if (p < lf && *p != ';' && *p != '\r' && *p != ' ' && *p != '\t') return -1;
 
     msg->chunk_len = chunk_size;
-    msg->next = p - buf->area;
+    msg->next = lf + 1 - buf->area;
+    msg->msg_state = chunk_size ? HTTP_MSG_CHUNK_DATA : HTTP_MSG_TRAILERS;
+    return 1;
+}
 
-    if (chunk_size == 0) {
-        msg->msg_state = HTTP_MSG_DONE;
-    } else {
-        msg->msg_state = HTTP_MSG_CHUNK_DATA;
-    }
+// Skip over payload already in the buffer. Returns true once the run
+// the message is in has been fully seen.
+static bool http_msg_take(http_msg_t *msg, const struct buffer *buf) {
+    uint64_t avail = buf->data - msg->next;
+    uint64_t take = avail < msg->chunk_len ? avail : msg->chunk_len;
+    msg->next += take;
+    msg->chunk_len -= take;
+    return msg->chunk_len == 0;
+}
 
-    return 1;
+void http_msg_consume(http_msg_t *msg, size_t n) {
+    msg->next -= n;
+    msg->sov -= n;
 }
 
 int http_msg_analyzer(http_msg_t *msg, struct buffer *buf) {
@@ -257,12 +391,17 @@ int http_msg_analyzer(http_msg_t *msg, struct buffer *buf) {
         switch (msg->msg_state) {
             case HTTP_MSG_RQBEFORE:
             case HTTP_MSG_RQMETH:
-                if (http_parse_request_line(msg, buf->area, buf->data) < 0) {
+            {
+                int ret = http_parse_request_line(msg, buf->area, buf->data);
+                if (ret < 0) {
                     msg->msg_state = HTTP_MSG_ERROR;
                     return -1;
                 }
+                if (ret == 0)
+                    return 0;
                 msg->msg_state = HTTP_MSG_HDR_FIRST;
                 break;
+            }
 
             case HTTP_MSG_HDR_FIRST:
             case HTTP_MSG_HDR_NAME:
@@ -278,29 +417,77 @@ int http_msg_analyzer(http_msg_t *msg, struct buffer *buf) {
             case HTTP_MSG_BODY:
                 if (msg->flags & HTTP_MSGF_TE_CHNK) {
                     msg->msg_state = HTTP_MSG_CHUNK_SIZE;
-                } else if (msg->flags & HTTP_MSGF_CNT_LEN) {
-                    if (msg->body_len == 0) {
-                        msg->msg_state = HTTP_MSG_DONE;
-                        return 1;
-                    }
+                } else if ((msg->flags & HTTP_MSGF_CNT_LEN) && msg->body_len > 0) {
+                    // The body is walked like one big chunk
+                    msg->chunk_len = msg->body_len;
+                    msg->msg_state = HTTP_MSG_DATA;
                 } else {
                     msg->msg_state = HTTP_MSG_DONE;
                     return 1;
                 }
                 break;
 
+            case HTTP_MSG_DATA:
+                if (!http_msg_take(msg, buf))
+                    return 0;
+                msg->msg_state = HTTP_MSG_DONE;
+                return 1;
+
             case HTTP_MSG_CHUNK_SIZE:
-                if (http_parse_chunk_size(msg, buf) <= 0)
+            {
+                int ret = http_parse_chunk_size(msg, buf);
+                if (ret < 0) {
+                    msg->msg_state = HTTP_MSG_ERROR;
+                    return -1;
+                }
+                if (ret == 0)
                     return 0;
                 break;
+            }
 
             case HTTP_MSG_CHUNK_DATA:
-                if (buf->data - msg->next < msg->chunk_len + 2)
+                if (!http_msg_take(msg, buf))
                     return 0;
+                msg->msg_state = HTTP_MSG_CHUNK_CRLF;
+                break;
 
-                msg->next += msg->chunk_len + 2;
+            case HTTP_MSG_CHUNK_CRLF:
+            {
+                size_t avail = buf->data - msg->next;
+                const char *p = buf->area + msg->next;
+                if (avail > 0 && p[0] == '\n') {
+                    msg->next += 1;
+                } else if (avail >= 2 && p[0] == '\r' && p[1] == '\n') {
+                    msg->next += 2;
+                } else if (avail >= 2 || (avail == 1 && p[0] != '\r')) {
+                    msg->msg_state = HTTP_MSG_ERROR;
+                    return -1;
+                } else {
+                    return 0;
+                }
                 msg->msg_state = HTTP_MSG_CHUNK_SIZE;
                 break;
+            }
+
+            case HTTP_MSG_TRAILERS:
+            {
+                // Trailer lines up to the empty one that ends the message
+                const char *p = buf->area + msg->next;
+                const char *lf = memchr(p, '\n', buf->data - msg->next);
+                if (!lf) {
+                    if (buf->data - msg->next > HTTP_CHUNK_LINE_MAX) {
+                        msg->msg_state = HTTP_MSG_ERROR;
+                        return -1;
+                    }
+                    return 0;
+                }
+                msg->next = lf + 1 - buf->area;
+                if (lf == p || (lf == p + 1 && p[0] == '\r')) {
+                    msg->msg_state = HTTP_MSG_DONE;
+                    return 1;
+                }
+                break;
+            }
 
             case HTTP_MSG_DONE:
                 return 1;
@@ -333,7 +520,11 @@ int http_process_request(struct stream *s, struct channel *req) {
         s->flags |= SF_WEBSOCKET;
     }
 
-
+    if (!(txn->flags & TX_REQ_RULES_DONE)) {
+        txn->flags |= TX_REQ_RULES_DONE;
+        if (apply_http_req_rules(s, req, px) == ACL_RULES_DENY)
+            return -1;
+    }
 
     return 1;
 }
@@ -354,5 +545,11 @@ int http_process_response(struct stream *s, struct channel *res) {
     if (msg->flags & HTTP_MSGF_CONN_CLO)
         s->flags |= SF_CONN_CLO;
 
+    if (!(txn->flags & TX_RES_RULES_DONE)) {
+        txn->flags |= TX_RES_RULES_DONE;
+        if (apply_http_res_rules(s, res) == ACL_RULES_DENY)
+            return -1;
+    }
+
     return 1;
 }
\ No newline at end of file
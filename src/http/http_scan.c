@@ -0,0 +1,101 @@
+#include "http/http_scan.h"
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+// tchar classes by nibble: byte c is a tchar when bit (c >> 4) of
+// http_tchar_lo[c & 15] is set. Only high nibbles 0-7 are used, so
+// bytes >= 0x80 never match. The vector paths look up both nibbles with
+// a byte shuffle, 16 or 32 bytes at a time.
+static const uint8_t http_tchar_lo[16] = {
+    0xe8, 0xfc, 0xf8, 0xfc, 0xfc, 0xfc, 0xfc, 0xfc,
+    0xf8, 0xf8, 0xf4, 0x54, 0xd0, 0x54, 0xf4, 0x70
+};
+
+bool http_is_tchar(unsigned char c) {
+    return c < 0x80 && ((http_tchar_lo[c & 15] >> (c >> 4)) & 1);
+}
+
+static inline bool http_is_ctl(unsigned char c) {
+    return (c < 0x20 && c != '\t') || c == 0x7f;
+}
+
+#if defined(__AVX2__)
+
+#define HTTP_SCAN_STEP 32
+
+// Bit i set when p[i] is not a tchar
+static inline uint32_t http_token_stops(const char* p) {
+    const __m256i lo_tbl = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)http_tchar_lo));
+    const __m256i hi_tbl = _mm256_broadcastsi128_si256(
+        _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, (char)128, 0, 0, 0, 0, 0, 0, 0, 0));
+    const __m256i nib = _mm256_set1_epi8(0x0f);
+    __m256i v = _mm256_loadu_si256((const __m256i*)p);
+
+    __m256i lo = _mm256_shuffle_epi8(lo_tbl, _mm256_and_si256(v, nib));
+    __m256i hi = _mm256_shuffle_epi8(hi_tbl, _mm256_and_si256(_mm256_srli_epi16(v, 4), nib));
+    __m256i miss = _mm256_cmpeq_epi8(_mm256_and_si256(lo, hi), _mm256_setzero_si256());
+    return (uint32_t)_mm256_movemask_epi8(miss);
+}
+
+// Bit i set when p[i] is below 0x20 but not HTAB, or DEL
+static inline uint32_t http_ctl_stops(const char* p) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)p);
+    __m256i low = _mm256_cmpeq_epi8(_mm256_min_epu8(v, _mm256_set1_epi8(0x1f)), v);
+    __m256i tab = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'));
+    __m256i del = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x7f));
+    return (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_andnot_si256(tab, low), del));
+}
+
+#elif defined(__SSE4_2__)
+
+#define HTTP_SCAN_STEP 16
+
+static inline uint32_t http_token_stops(const char* p) {
+    const __m128i lo_tbl = _mm_loadu_si128((const __m128i*)http_tchar_lo);
+    const __m128i hi_tbl = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, (char)128, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i nib = _mm_set1_epi8(0x0f);
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+
+    __m128i lo = _mm_shuffle_epi8(lo_tbl, _mm_and_si128(v, nib));
+    __m128i hi = _mm_shuffle_epi8(hi_tbl, _mm_and_si128(_mm_srli_epi16(v, 4), nib));
+    __m128i miss = _mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128());
+    return (uint32_t)_mm_movemask_epi8(miss);
+}
+
+static inline uint32_t http_ctl_stops(const char* p) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    __m128i low = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x1f)), v);
+    __m128i tab = _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'));
+    __m128i del = _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f));
+    return (uint32_t)_mm_movemask_epi8(_mm_or_si128(_mm_andnot_si128(tab, low), del));
+}
+
+#endif
+
+const char* http_scan_token(const char* p, const char* end) {
+#ifdef HTTP_SCAN_STEP
+    for (; end - p >= HTTP_SCAN_STEP; p += HTTP_SCAN_STEP) {
+        uint32_t stops = http_token_stops(p);
+        if (stops) return p + __builtin_ctz(stops);
+    }
+#endif
+    // Tail shorter than one vector, or no vector unit at all
+    while (p < end && http_is_tchar((unsigned char)*p)) p++;
+    return p;
+}
+
+const char* http_scan_ctl(const char* p, const char* end) {
+#ifdef HTTP_SCAN_STEP
+    for (; end - p >= HTTP_SCAN_STEP; p += HTTP_SCAN_STEP) {
+        uint32_t stops = http_ctl_stops(p);
+        if (stops) return p + __builtin_ctz(stops);
+    }
+#endif
+    while (p < end && !http_is_ctl((unsigned char)*p)) p++;
+    return p;
+}
@@ -12,11 +12,20 @@
 #include <errno.h>
 #include <time.h>
 #include "core/lb_types.h"
+#include "core/loadbalancer.h"
+#include "core/lb_memory.h"
+#include "core/lb_rcu.h"
+#include "core/lb_stats.h"
+#include "core/lb_timer.h"
+#include "core/lb_topology.h"
+#include "core/lb_utils.h"
 #include "core/common.h"
 #include "core/lb_network.h"
 #include "config/config.h"
+#include "health/health.h"
+#include "utils/log.h"
 
-#define MEMORY_POOL_SIZE (256 * 1024 * 1024)  // 256MB
+#define CONN_SLAB_CHUNK 256                    // connections per slab chunk
 
 static loadbalancer_t* global_lb = NULL;
 
@@ -52,15 +61,38 @@ static void print_usage(const char* prog) {
     printf("  -a, --algorithm ALGO     Load balancing algorithm:\n");
     printf("                           round-robin (default)\n");
     printf("                           least-conn\n");
+    printf("                           p2c (least-conn over two random picks)\n");
     printf("                           ip-hash\n");
     printf("                           weighted\n");
-    printf("                           response-time\n");
+    printf("                           response-time (peak-EWMA latency x outstanding requests)\n");
     printf("  -b, --backend HOST:PORT  Add backend server (can specify multiple)\n");
     printf("  -w, --workers NUM        Number of worker threads (default: CPU*2)\n");
     printf("  --health-check-enabled   Enable health checks (default: true)\n");
     printf("  --no-health-check        Disable health checks\n");
     printf("  --health-check-interval  Health check interval in ms (default: 5000)\n");
     printf("  --health-check-fails     Failed checks before marking down (default: 3)\n");
+    printf("  --health-check-timeout   Probe timeout in ms (default: 2000)\n");
+    printf("  --health-check-type TYPE Probe: tcp, http, redis, mysql (default: http)\n");
+    printf("  --health-check-uri PATH  Path of the HTTP probe (default: /)\n");
+    printf("  --shared-state NAME      Share probe results with sibling processes via /dev/shm/NAME\n");
+    printf("  --no-outlier-detection   Only active health checks take backends out\n");
+    printf("  --outlier-consecutive N  Connect failures/resets in a row to eject (default: 5)\n");
+    printf("  --outlier-error-rate PCT 5xx/error share over 10s to eject (default: 50)\n");
+    printf("  --outlier-ejection MS    First ejection, doubled on repeats (default: 5000)\n");
+    printf("  --no-worker-sharding     Share one epoll/listen socket across workers\n");
+    printf("  --no-splice              Disable zero-copy splice() forwarding for L4\n");
+    printf("  --io-uring               Use the io_uring event engine when available\n");
+    printf("  --accept-batch NUM       Connections accepted per listen wakeup (default: 64)\n");
+    printf("  --upstream-keepalive     Reuse idle HTTP/1.1 backend connections\n");
+    printf("  --l7                     Balance each HTTP/1.1 request separately (keep-alive, pipelining)\n");
+    printf("  --http2                  Serve HTTP/2 on L7 connections (h2c prior knowledge and Upgrade)\n");
+    printf("  --edge-triggered         Use EPOLLET instead of re-arming EPOLLONESHOT\n");
+    printf("  --upstream-idle-timeout  Idle upstream connection lifetime in ms (default: 10000)\n");
+    printf("  --slow-start MS          Ramp a recovered backend's weight over MS (default: 0, off)\n");
+    printf("  --slow-start-curve TYPE  Slow-start ramp: linear, exp (default: linear)\n");
+    printf("  --no-cpu-pinning         Leave worker placement to the scheduler\n");
+    printf("  --cpu-list LIST          Worker CPUs in worker order, e.g. 0-7,16-23\n");
+    printf("  --irq-affinity IFACE     Pin worker N where IFACE's RX queue N IRQ is handled\n");
     printf("  -h, --help              Show this help message\n");
     printf("\nExamples:\n");
     printf("  %s -c config/ultrabalancer.yaml\n", prog);
@@ -68,6 +100,26 @@ static void print_usage(const char* prog) {
     printf("  %s -p 8080 --no-health-check -b 127.0.0.1:8001\n", prog);
 }
 
+static cleanup_queue_t* main_cleanup_queue_create(void) {
+    cleanup_queue_t* queue = calloc(1, sizeof(cleanup_queue_t));
+    if (!queue) return NULL;
+
+    if (pthread_mutex_init(&queue->lock, NULL) != 0) {
+        free(queue);
+        return NULL;
+    }
+
+    atomic_store(&queue->head, 0);
+    atomic_store(&queue->tail, 0);
+    return queue;
+}
+
+static void main_cleanup_queue_destroy(cleanup_queue_t* queue) {
+    if (!queue) return;
+    pthread_mutex_destroy(&queue->lock);
+    free(queue);
+}
+
 static loadbalancer_t* main_lb_create(uint16_t port, lb_algorithm_t algorithm) {
     loadbalancer_t* lb = calloc(1, sizeof(loadbalancer_t));
     if (!lb) return NULL;
@@ -88,8 +140,25 @@ static loadbalancer_t* main_lb_create(uint16_t port, lb_algorithm_t algorithm) {
     lb->config.health_check_fail_threshold = 3;
     lb->config.tcp_nodelay = true;
     lb->config.so_reuseport = true;
+    lb->config.worker_sharding = true;
+    lb->config.splice_forwarding = true;
+    lb->config.io_uring = false;
+    lb->config.accept_batch = 64;
+    lb->config.upstream_keepalive = false;
+    lb->config.edge_triggered = false;
+    lb->config.upstream_idle_timeout_ms = 10000;
     lb->config.defer_accept = true;
     lb->config.health_check_enabled = true;
+    lb->config.cpu_pinning = true;
+    lb->config.health_check_timeout_ms = 2000;
+    lb->config.health_check_type = HCHK_TYPE_HTTP;
+    lb->config.outlier_consecutive = 5;
+    lb->config.outlier_error_pct = 50;
+    lb->config.outlier_min_requests = 20;
+    lb->config.outlier_window_ms = 10000;
+    lb->config.outlier_ejection_ms = 5000;
+    lb->config.outlier_max_ejection_ms = 300000;
+    lb->config.outlier_max_pct = 50;
 
     lb->epfd = epoll_create1(EPOLL_CLOEXEC);
     if (lb->epfd < 0) {
@@ -97,42 +166,32 @@ static loadbalancer_t* main_lb_create(uint16_t port, lb_algorithm_t algorithm) {
         return NULL;
     }
 
-    // Initialize memory pool
-    lb->memory_pool = mmap(NULL, MEMORY_POOL_SIZE, PROT_READ | PROT_WRITE,
-                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (lb->memory_pool == MAP_FAILED) {
-        close(lb->epfd);
-        free(lb);
-        return NULL;
-    }
-
     // Initialize cleanup queue
-    lb->cleanup_queue = calloc(1, sizeof(cleanup_queue_t));
+    lb->cleanup_queue = main_cleanup_queue_create();
     if (!lb->cleanup_queue) {
-        munmap(lb->memory_pool, MEMORY_POOL_SIZE);
         close(lb->epfd);
         free(lb);
         return NULL;
     }
 
-    // Initialize mutex for cleanup queue
-    if (pthread_mutex_init(&lb->cleanup_queue->lock, NULL) != 0) {
-        free(lb->cleanup_queue);
-        munmap(lb->memory_pool, MEMORY_POOL_SIZE);
+    // Backlog buffers shared by all workers
+    lb->buffer_pool = buffer_pool_create();
+    if (!lb->buffer_pool) {
+        main_cleanup_queue_destroy(lb->cleanup_queue);
         close(lb->epfd);
         free(lb);
         return NULL;
     }
 
-    atomic_store(&lb->cleanup_queue->head, 0);
-    atomic_store(&lb->cleanup_queue->tail, 0);
-
     return lb;
 }
 
 static void main_lb_destroy(loadbalancer_t* lb) {
     if (!lb) return;
 
+    // Idle upstream sockets go before the backends that own them
+    lb_net_upstream_pools_destroy(lb);
+
     for (uint32_t i = 0; i < lb->backend_count; i++) {
         if (lb->backends[i]) {
             pthread_spin_destroy(&lb->backends[i]->lock);
@@ -140,20 +199,41 @@ static void main_lb_destroy(loadbalancer_t* lb) {
         }
     }
 
-    if (lb->memory_pool && lb->memory_pool != MAP_FAILED) {
-        munmap(lb->memory_pool, MEMORY_POOL_SIZE);
-    }
+    // Workers are gone, so every retired table can be freed
+    consistent_hash_destroy(lb->consistent_hash);
+    lb->consistent_hash = NULL;
+    lb_wrr_destroy(lb->wrr);
+    lb->wrr = NULL;
+    lb_rcu_reclaim();
 
     if (lb->epfd >= 0) close(lb->epfd);
     pthread_spin_destroy(&lb->conn_pool_lock);
 
+    // Per-worker epoll instances and queues; shared mode aliases the globals
+    if (lb->worker_ctx) {
+        for (uint32_t i = 0; i < lb->worker_threads; i++) {
+            lb_worker_t* w = &lb->worker_ctx[i];
+            if (w->epfd >= 0 && w->epfd != lb->epfd) close(w->epfd);
+            if (w->cleanup_queue != lb->cleanup_queue) {
+                main_cleanup_queue_destroy(w->cleanup_queue);
+            }
+            slab_destroy(w->conn_slab);
+            lb_timer_wheel_destroy(w->timers);
+            lb_stats_release(&w->stats);
+        }
+        free(lb->worker_ctx);
+        lb->worker_ctx = NULL;
+    }
+
     // Cleanup queue with mutex destruction
     if (lb->cleanup_queue) {
-        pthread_mutex_destroy(&lb->cleanup_queue->lock);
-        free(lb->cleanup_queue);
+        main_cleanup_queue_destroy(lb->cleanup_queue);
         lb->cleanup_queue = NULL;
     }
 
+    buffer_pool_destroy(lb->buffer_pool);
+    lb->buffer_pool = NULL;
+
     // Cleanup listen wrapper
     if (lb->listen_wrapper) {
         free(lb->listen_wrapper);
@@ -183,7 +263,7 @@ static int main_lb_add_backend(loadbalancer_t* lb, const char* host, uint16_t po
 
     pthread_spin_init(&backend->lock, PTHREAD_PROCESS_PRIVATE);
 
-    lb->backends[lb->backend_count++] = backend;
+    lb_backend_attach(lb, backend);
 
     return 0;
 }
@@ -217,7 +297,7 @@ static backend_t* main_lb_select_backend(loadbalancer_t* lb, struct sockaddr_in*
             for (uint32_t i = 0; i < lb->backend_count; i++) {
                 backend_t* b = lb->backends[i];
                 if (b && atomic_load(&b->state) == BACKEND_UP) {
-                    uint32_t conns = atomic_load(&b->active_conns);
+                    uint32_t conns = lb_backend_conns(lb, b);
                     if (conns < min_conns) {
                         min_conns = conns;
                         selected = b;
@@ -238,9 +318,61 @@ static backend_t* main_lb_select_backend(loadbalancer_t* lb, struct sockaddr_in*
 
 // Old worker_thread removed - using worker_thread_v2 from lb_net.c
 
-static int main_lb_start(loadbalancer_t* lb) {
-    if (!lb || lb->running) return -1;
+// Sharded mode: every worker gets its own epoll instance. With SO_REUSEPORT
+// each worker also gets its own listen socket so the kernel spreads accepts
+// across workers; without it they share one socket registered with
+// EPOLLEXCLUSIVE so a new connection wakes one worker, not all of them.
+static int main_lb_setup_sharded_workers(loadbalancer_t* lb) {
+    bool reuseport = lb->config.so_reuseport;
+
+    for (uint32_t i = 0; i < lb->worker_threads; i++) {
+        lb_worker_t* w = &lb->worker_ctx[i];
+
+        w->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (w->epfd < 0) {
+            perror("Failed to create worker epoll instance");
+            return -1;
+        }
+
+        w->cleanup_queue = main_cleanup_queue_create();
+        if (!w->cleanup_queue) {
+            perror("Failed to allocate worker cleanup queue");
+            return -1;
+        }
+
+        if (reuseport || i == 0) {
+            w->listen_fd = create_listen_socket(lb->port, reuseport);
+            if (w->listen_fd < 0) {
+                perror("Failed to create worker listen socket");
+                return -1;
+            }
+            w->owns_listener = true;
+        } else {
+            w->listen_fd = lb->worker_ctx[0].listen_fd;
+        }
+
+        w->listen_wrapper.type = SOCKET_TYPE_LISTEN;
+        w->listen_wrapper.fd = w->listen_fd;
+        w->listen_wrapper.conn = NULL;
+
+        struct epoll_event ev = {
+            .events = EPOLLIN | EPOLLEXCLUSIVE,
+            .data.ptr = &w->listen_wrapper
+        };
+
+        if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->listen_fd, &ev) < 0) {
+            perror("Failed to register worker listen socket");
+            return -1;
+        }
+    }
 
+    // Keep lb->listen_fd meaningful for callers that only need "a" listener
+    lb->listen_fd = lb->worker_ctx[0].listen_fd;
+    return 0;
+}
+
+// Shared mode: a single listen socket registered on lb->epfd, polled by all
+static int main_lb_setup_shared_workers(loadbalancer_t* lb) {
     lb->listen_fd = create_listen_socket(lb->port, lb->config.so_reuseport);
     if (lb->listen_fd < 0) {
         perror("Failed to create listen socket");
@@ -252,6 +384,7 @@ static int main_lb_start(loadbalancer_t* lb) {
     if (!lb->listen_wrapper) {
         perror("Failed to allocate listen wrapper");
         close(lb->listen_fd);
+        lb->listen_fd = -1;
         return -1;
     }
 
@@ -269,6 +402,126 @@ static int main_lb_start(loadbalancer_t* lb) {
         free(lb->listen_wrapper);
         lb->listen_wrapper = NULL;
         close(lb->listen_fd);
+        lb->listen_fd = -1;
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < lb->worker_threads; i++) {
+        lb_worker_t* w = &lb->worker_ctx[i];
+        w->epfd = lb->epfd;
+        w->listen_fd = lb->listen_fd;
+        w->listen_wrapper = *lb->listen_wrapper;
+        w->cleanup_queue = lb->cleanup_queue;
+    }
+
+    return 0;
+}
+
+static void main_lb_close_listeners(loadbalancer_t* lb) {
+    if (lb->worker_ctx) {
+        for (uint32_t i = 0; i < lb->worker_threads; i++) {
+            lb_worker_t* w = &lb->worker_ctx[i];
+            if (w->owns_listener && w->listen_fd >= 0) {
+                close(w->listen_fd);
+            }
+            w->listen_fd = -1;
+            w->owns_listener = false;
+        }
+    }
+
+    if (lb->listen_wrapper && lb->listen_fd >= 0) {
+        close(lb->listen_fd);
+    }
+    lb->listen_fd = -1;
+}
+
+// Worker N gets the Nth CPU of the placement order, wrapping when there
+// are more workers than CPUs
+static void main_lb_place_workers(loadbalancer_t* lb) {
+    static lb_topology_t topo;
+    int rc = -1;
+    const char* source = "topology";
+
+    for (uint32_t i = 0; i < lb->worker_threads; i++) {
+        lb->worker_ctx[i].cpu = -1;
+        lb->worker_ctx[i].numa_node = -1;
+    }
+    if (!lb->config.cpu_pinning) return;
+
+    if (lb->config.cpu_list) {
+        rc = lb_topology_from_list(&topo, lb->config.cpu_list);
+        source = "cpu list";
+        if (rc < 0) fprintf(stderr, "[WARN] No usable CPUs in --cpu-list %s\n", lb->config.cpu_list);
+    } else if (lb->config.irq_iface) {
+        rc = lb_topology_from_irqs(&topo, lb->config.irq_iface);
+        source = "IRQ affinity";
+        if (rc < 0) fprintf(stderr, "[WARN] No queue IRQs found for %s\n", lb->config.irq_iface);
+    }
+    if (rc < 0) {
+        rc = lb_topology_detect(&topo);
+        source = "topology";
+    }
+    if (rc < 0) return;
+
+    for (uint32_t i = 0; i < lb->worker_threads; i++) {
+        const lb_cpu_t* cpu = lb_topology_worker_cpu(&topo, i);
+        lb->worker_ctx[i].cpu = cpu->cpu;
+        lb->worker_ctx[i].numa_node = cpu->node;
+    }
+    printf("Worker CPUs (%s, %u NUMA node%s):", source, topo.nodes, topo.nodes == 1 ? "" : "s");
+    for (uint32_t i = 0; i < lb->worker_threads && i < 16; i++) {
+        printf(" %d", lb->worker_ctx[i].cpu);
+    }
+    printf("%s\n", lb->worker_threads > 16 ? " ..." : "");
+}
+
+static int main_lb_wait_workers(loadbalancer_t* lb) {
+    int ret = 0;
+    for (uint32_t i = 0; i < lb->worker_threads; i++) {
+        int state;
+        while ((state = atomic_load(&lb->worker_ctx[i].init_state)) == 0) {
+            usleep(1000);
+        }
+        if (state < 0) ret = -1;
+    }
+    return ret;
+}
+
+static int main_lb_start(loadbalancer_t* lb) {
+    if (!lb || lb->running) return -1;
+
+    // Cache-line aligned so one worker's counters never share a line
+    // with its neighbour's
+    size_t ctx_size = lb->worker_threads * sizeof(lb_worker_t);
+    lb->worker_ctx = aligned_alloc(CACHE_LINE_SIZE, ctx_size);
+    if (!lb->worker_ctx) {
+        perror("Failed to allocate worker contexts");
+        return -1;
+    }
+    memset(lb->worker_ctx, 0, ctx_size);
+
+    for (uint32_t i = 0; i < lb->worker_threads; i++) {
+        lb->worker_ctx[i].lb = lb;
+        lb->worker_ctx[i].id = i;
+        lb->worker_ctx[i].epfd = -1;
+        lb->worker_ctx[i].listen_fd = -1;
+        lb->worker_ctx[i].conn_slab = slab_create(sizeof(lb_connection_t), CONN_SLAB_CHUNK);
+        if (!lb->worker_ctx[i].conn_slab) {
+            perror("Failed to allocate worker connection slab");
+            return -1;
+        }
+    }
+
+    main_lb_place_workers(lb);
+
+    bool sharded = lb->config.worker_sharding;
+    if (lb->config.edge_triggered && !sharded) {
+        fprintf(stderr, "[WARN] --edge-triggered needs sharded workers, using EPOLLONESHOT\n");
+    }
+    int setup = sharded ? main_lb_setup_sharded_workers(lb)
+                        : main_lb_setup_shared_workers(lb);
+    if (setup < 0) {
+        main_lb_close_listeners(lb);
         return -1;
     }
 
@@ -276,28 +529,66 @@ static int main_lb_start(loadbalancer_t* lb) {
 
     // Start all backends as UP for testing
     for (uint32_t i = 0; i < lb->backend_count; i++) {
-        lb->backends[i]->state = BACKEND_UP;
+        lb_backend_set_state(lb, lb->backends[i], BACKEND_UP);
+    }
+
+    // Hash and weighted selection read tables the health checker rebuilds
+    if (lb->algorithm == LB_ALGO_SOURCE) {
+        consistent_hash_t* ch = consistent_hash_create(MAGLEV_DEFAULT_SIZE);
+        if (ch) {
+            for (uint32_t i = 0; i < lb->backend_count; i++) {
+                consistent_hash_add(ch, lb->backends[i]);
+            }
+            consistent_hash_rebuild(ch);
+            lb->consistent_hash = ch;
+        }
+    }
+
+    if (lb->algorithm == LB_ALGO_STICKY) {
+        lb->wrr = lb_wrr_create();
+        if (lb->wrr) lb_wrr_sync(lb->wrr, lb->backends, lb->backend_count);
     }
 
     lb->workers = calloc(lb->worker_threads, sizeof(pthread_t));
     if (!lb->workers) {
-        close(lb->listen_fd);
+        main_lb_close_listeners(lb);
         return -1;
     }
 
+    bool use_uring = lb->config.io_uring && lb_uring_supported() && !lb->config.l7_mode;
+    if (lb->config.io_uring && lb->config.l7_mode) {
+        fprintf(stderr, "[WARN] --l7 is only implemented for epoll workers, not using io_uring\n");
+    } else if (lb->config.io_uring && !use_uring) {
+        fprintf(stderr, "[WARN] io_uring not available (build with USE_IO_URING=1 on a recent kernel), using epoll\n");
+    }
+    void* (*worker_fn)(void*) = use_uring ? worker_thread_uring : worker_thread_v2;
+
     for (uint32_t i = 0; i < lb->worker_threads; i++) {
-        if (pthread_create(&lb->workers[i], NULL, worker_thread_v2, lb) != 0) {
+        if (pthread_create(&lb->workers[i], NULL, worker_fn, &lb->worker_ctx[i]) != 0) {
             lb->running = false;
             for (uint32_t j = 0; j < i; j++) {
                 pthread_join(lb->workers[j], NULL);
             }
             free(lb->workers);
             lb->workers = NULL;
-            close(lb->listen_fd);
+            main_lb_close_listeners(lb);
             return -1;
         }
     }
 
+    // Each worker builds its own timer wheel, stats and upstream pools once
+    // pinned; nothing reads them before all are up
+    if (main_lb_wait_workers(lb) < 0) {
+        lb->running = false;
+        for (uint32_t i = 0; i < lb->worker_threads; i++) {
+            pthread_join(lb->workers[i], NULL);
+        }
+        free(lb->workers);
+        lb->workers = NULL;
+        main_lb_close_listeners(lb);
+        return -1;
+    }
+
     pthread_t health_thread;
     if (pthread_create(&health_thread, NULL, health_check_thread, lb) == 0) {
         pthread_detach(health_thread);
@@ -308,13 +599,23 @@ static int main_lb_start(loadbalancer_t* lb) {
         pthread_detach(stats_tid);
     }
 
-    printf("Load balancer started on port %u with %u workers\n", lb->port, lb->worker_threads);
+    pthread_t dns_tid;
+    if (pthread_create(&dns_tid, NULL, dns_resolver_thread, lb) == 0) {
+        pthread_detach(dns_tid);
+    }
+
+    printf("Load balancer started on port %u with %u workers (%s)\n", lb->port,
+           lb->worker_threads,
+           use_uring ? (sharded ? "sharded io_uring" : "shared io_uring")
+                     : (sharded ? "sharded epoll" : "shared epoll"));
     printf("Algorithm: ");
     switch (lb->algorithm) {
         case LB_ALGO_ROUNDROBIN: printf("Round Robin\n"); break;
         case LB_ALGO_LEASTCONN: printf("Least Connections\n"); break;
+        case LB_ALGO_LEASTCONN_P2C: printf("Least Connections (P2C)\n"); break;
         case LB_ALGO_SOURCE: printf("IP Hash\n"); break;
         case LB_ALGO_STICKY: printf("Weighted\n"); break;
+        case LB_ALGO_PEAK_EWMA: printf("Peak EWMA Response Time\n"); break;
         default: printf("Unknown\n");
     }
     printf("\nHealth checks enabled (interval: %ums)\n", lb->config.health_check_interval_ms);
@@ -334,9 +635,7 @@ static void main_lb_stop(loadbalancer_t* lb) {
         }
     }
 
-    if (lb->listen_fd >= 0) {
-        close(lb->listen_fd);
-    }
+    main_lb_close_listeners(lb);
 
     printf("Load balancer stopped\n");
 }
@@ -355,6 +654,27 @@ int main(int argc, char** argv) {
     bool health_check_enabled = true;
     uint32_t health_check_interval = 5000;
     uint32_t health_check_fails = 3;
+    uint32_t health_check_timeout = 2000;
+    uint8_t health_check_type = HCHK_TYPE_HTTP;
+    const char* health_check_uri = NULL;
+    const char* shared_state = NULL;
+    uint32_t outlier_consecutive = 5;
+    uint32_t outlier_error_pct = 50;
+    uint32_t outlier_ejection = 5000;
+    bool worker_sharding = true;
+    bool splice_forwarding = true;
+    bool io_uring = false;
+    uint32_t accept_batch = 64;
+    bool upstream_keepalive = false;
+    bool l7_mode = false;
+    bool http2 = false;
+    bool edge_triggered = false;
+    uint32_t upstream_idle_timeout = 10000;
+    uint32_t slow_start_ms = 0;
+    bool slow_start_exp = false;
+    bool cpu_pinning = true;
+    const char* cpu_list = NULL;
+    const char* irq_iface = NULL;
 
     static struct option long_options[] = {
         {"config", required_argument, 0, 'c'},
@@ -366,6 +686,28 @@ int main(int argc, char** argv) {
         {"no-health-check", no_argument, 0, 1002},
         {"health-check-interval", required_argument, 0, 1003},
         {"health-check-fails", required_argument, 0, 1004},
+        {"no-worker-sharding", no_argument, 0, 1005},
+        {"no-splice", no_argument, 0, 1006},
+        {"io-uring", no_argument, 0, 1007},
+        {"accept-batch", required_argument, 0, 1008},
+        {"upstream-keepalive", no_argument, 0, 1009},
+        {"upstream-idle-timeout", required_argument, 0, 1010},
+        {"edge-triggered", no_argument, 0, 1011},
+        {"slow-start", required_argument, 0, 1012},
+        {"slow-start-curve", required_argument, 0, 1013},
+        {"no-cpu-pinning", no_argument, 0, 1014},
+        {"cpu-list", required_argument, 0, 1015},
+        {"irq-affinity", required_argument, 0, 1016},
+        {"health-check-timeout", required_argument, 0, 1017},
+        {"health-check-type", required_argument, 0, 1018},
+        {"health-check-uri", required_argument, 0, 1019},
+        {"no-outlier-detection", no_argument, 0, 1020},
+        {"outlier-consecutive", required_argument, 0, 1021},
+        {"outlier-error-rate", required_argument, 0, 1022},
+        {"outlier-ejection", required_argument, 0, 1023},
+        {"shared-state", required_argument, 0, 1024},
+        {"l7", no_argument, 0, 1025},
+        {"http2", no_argument, 0, 1026},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}
     };
@@ -386,12 +728,14 @@ int main(int argc, char** argv) {
                     algorithm = LB_ALGO_ROUNDROBIN;
                 } else if (strcmp(optarg, "least-conn") == 0) {
                     algorithm = LB_ALGO_LEASTCONN;
+                } else if (strcmp(optarg, "p2c") == 0) {
+                    algorithm = LB_ALGO_LEASTCONN_P2C;
                 } else if (strcmp(optarg, "ip-hash") == 0) {
                     algorithm = LB_ALGO_SOURCE;
                 } else if (strcmp(optarg, "weighted") == 0 || strcmp(optarg, "weighted-rr") == 0) {
                     algorithm = LB_ALGO_STICKY;
-                } else if (strcmp(optarg, "response-time") == 0) {
-                    algorithm = LB_ALGO_RANDOM;
+                } else if (strcmp(optarg, "response-time") == 0 || strcmp(optarg, "peak-ewma") == 0) {
+                    algorithm = LB_ALGO_PEAK_EWMA;
                 } else {
                     fprintf(stderr, "Unknown algorithm: %s\n", optarg);
                     exit(1);
@@ -444,6 +788,113 @@ int main(int argc, char** argv) {
                 health_check_fails = atoi(optarg);
                 break;
 
+            case 1005:
+                worker_sharding = false;
+                break;
+
+            case 1006:
+                splice_forwarding = false;
+                break;
+
+            case 1007:
+                io_uring = true;
+                break;
+
+            case 1008:
+                accept_batch = atoi(optarg);
+                break;
+
+            case 1009:
+                upstream_keepalive = true;
+                break;
+
+            case 1010:
+                upstream_idle_timeout = atoi(optarg);
+                break;
+
+            case 1011:
+                edge_triggered = true;
+                break;
+
+            case 1012:
+                slow_start_ms = atoi(optarg);
+                break;
+
+            case 1013:
+                if (strcmp(optarg, "exp") == 0) {
+                    slow_start_exp = true;
+                } else if (strcmp(optarg, "linear") == 0) {
+                    slow_start_exp = false;
+                } else {
+                    fprintf(stderr, "Unknown slow-start curve: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+
+            case 1014:
+                cpu_pinning = false;
+                break;
+
+            case 1015:
+                cpu_list = optarg;
+                break;
+
+            case 1016:
+                irq_iface = optarg;
+                break;
+
+            case 1017:
+                health_check_timeout = atoi(optarg);
+                break;
+
+            case 1018:
+                if (strcmp(optarg, "tcp") == 0) {
+                    health_check_type = HCHK_TYPE_TCP;
+                } else if (strcmp(optarg, "http") == 0) {
+                    health_check_type = HCHK_TYPE_HTTP;
+                } else if (strcmp(optarg, "redis") == 0) {
+                    health_check_type = HCHK_TYPE_REDIS;
+                } else if (strcmp(optarg, "mysql") == 0) {
+                    health_check_type = HCHK_TYPE_MYSQL;
+                } else {
+                    fprintf(stderr, "Unknown health check type: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+
+            case 1019:
+                health_check_uri = optarg;
+                break;
+
+            case 1020:
+                outlier_consecutive = 0;
+                outlier_error_pct = 0;
+                break;
+
+            case 1021:
+                outlier_consecutive = atoi(optarg);
+                break;
+
+            case 1022:
+                outlier_error_pct = atoi(optarg);
+                break;
+
+            case 1023:
+                outlier_ejection = atoi(optarg);
+                break;
+
+            case 1024:
+                shared_state = optarg;
+                break;
+
+            case 1025:
+                l7_mode = true;
+                break;
+
+            case 1026:
+                http2 = true;
+                break;
+
             case 'h':
                 print_usage(argv[0]);
                 exit(0);
@@ -509,6 +960,34 @@ int main(int argc, char** argv) {
     global_lb->config.health_check_enabled = health_check_enabled;
     global_lb->config.health_check_interval_ms = health_check_interval;
     global_lb->config.health_check_fail_threshold = health_check_fails;
+    global_lb->config.health_check_timeout_ms = health_check_timeout;
+    global_lb->config.health_check_type = health_check_type;
+    global_lb->config.health_check_uri = health_check_uri;
+    global_lb->config.shared_state = shared_state;
+    global_lb->config.outlier_consecutive = outlier_consecutive;
+    global_lb->config.outlier_error_pct = outlier_error_pct;
+    global_lb->config.outlier_ejection_ms = outlier_ejection;
+    global_lb->config.worker_sharding = worker_sharding;
+    global_lb->config.splice_forwarding = splice_forwarding;
+    global_lb->config.io_uring = io_uring;
+    global_lb->config.accept_batch = accept_batch;
+    // HTTP/2 streams keep their backend sockets on the accepting worker
+    if (http2 && !worker_sharding) {
+        fprintf(stderr, "[WARN] --http2 needs sharded workers, serving HTTP/1.1 only\n");
+        http2 = false;
+    }
+    l7_mode = l7_mode || http2;
+    // Backend sockets freed between requests go back to the pool
+    global_lb->config.upstream_keepalive = upstream_keepalive || l7_mode;
+    global_lb->config.l7_mode = l7_mode;
+    global_lb->config.http2 = http2;
+    global_lb->config.upstream_idle_timeout_ms = upstream_idle_timeout;
+    global_lb->config.edge_triggered = edge_triggered;
+    global_lb->config.slow_start_ms = slow_start_ms;
+    global_lb->config.slow_start_exp = slow_start_exp;
+    global_lb->config.cpu_pinning = cpu_pinning;
+    global_lb->config.cpu_list = cpu_list;
+    global_lb->config.irq_iface = irq_iface;
 
     printf("Health check: %s (interval: %ums, fail threshold: %u)\n",
            health_check_enabled ? "enabled" : "disabled",
@@ -525,6 +1004,11 @@ int main(int argc, char** argv) {
         }
     }
 
+    // Worker threads log through per-thread rings from here on
+    if (log_start() < 0) {
+        fprintf(stderr, "[WARN] Failed to start log writer, logging synchronously\n");
+    }
+
     if (main_lb_start(global_lb) < 0) {
         fprintf(stderr, "Failed to start load balancer\n");
         main_lb_destroy(global_lb);
@@ -0,0 +1,222 @@
+#include "core/loadbalancer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <arpa/nameser.h>
+#include <resolv.h>
+
+// Backend address cache. Each backend_t carries one resolved address that
+// workers read lock-free; only the resolver thread (and the initial
+// resolution before workers start) ever writes it. Names are re-queried
+// when their DNS TTL runs out, so no worker ever blocks on a lookup.
+
+#define DNS_MIN_TTL_S      1
+#define DNS_MAX_TTL_S      300
+#define DNS_DEFAULT_TTL_S  30      // getaddrinfo() reports no TTL
+#define DNS_RETRY_S        5       // after a failed refresh
+#define DNS_POLL_US        100000
+
+static void lb_dns_publish(backend_t* backend, const struct sockaddr_storage* addr, socklen_t len) {
+    uint32_t seq = atomic_load_explicit(&backend->addr_seq, memory_order_relaxed);
+
+    atomic_store_explicit(&backend->addr_seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(&backend->addr, addr, sizeof(*addr));
+    backend->addr_len = len;
+    atomic_store_explicit(&backend->addr_seq, seq + 2, memory_order_release);
+}
+
+int lb_dns_backend_addr(const backend_t* backend, struct sockaddr_storage* addr, socklen_t* len) {
+    uint32_t seq;
+    do {
+        seq = atomic_load_explicit(&backend->addr_seq, memory_order_acquire);
+        if (seq & 1) continue;  // Writer in progress, retry
+
+        memcpy(addr, &backend->addr, sizeof(*addr));
+        *len = backend->addr_len;
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) || atomic_load_explicit(&backend->addr_seq, memory_order_relaxed) != seq);
+
+    return *len > 0 ? 0 : -1;
+}
+
+static bool lb_dns_parse_literal(const char* host, uint16_t port,
+                                 struct sockaddr_storage* out, socklen_t* len) {
+    memset(out, 0, sizeof(*out));
+
+    struct sockaddr_in* in4 = (struct sockaddr_in*)out;
+    if (inet_pton(AF_INET, host, &in4->sin_addr) == 1) {
+        in4->sin_family = AF_INET;
+        in4->sin_port = htons(port);
+        *len = sizeof(*in4);
+        return true;
+    }
+
+    struct sockaddr_in6* in6 = (struct sockaddr_in6*)out;
+    if (inet_pton(AF_INET6, host, &in6->sin6_addr) == 1) {
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(port);
+        *len = sizeof(*in6);
+        return true;
+    }
+    return false;
+}
+
+// One A or AAAA query. The TTL is the smallest one in the answer section,
+// which also covers any CNAME chain in front of the records.
+static int lb_dns_query(res_state rs, const char* name, int type, uint16_t port,
+                        struct sockaddr_storage* out, socklen_t* len, uint32_t* ttl) {
+    unsigned char answer[NS_PACKETSZ * 4];
+    int n = res_nquery(rs, name, ns_c_in, type, answer, sizeof(answer));
+    if (n < 0) return -1;
+
+    ns_msg msg;
+    if (ns_initparse(answer, n, &msg) < 0) return -1;
+
+    bool found = false;
+    uint32_t min_ttl = UINT32_MAX;
+    int count = ns_msg_count(msg, ns_s_an);
+
+    for (int i = 0; i < count; i++) {
+        ns_rr rr;
+        if (ns_parserr(&msg, ns_s_an, i, &rr) < 0) break;
+        if (ns_rr_ttl(rr) < min_ttl) min_ttl = ns_rr_ttl(rr);
+        if (found || ns_rr_type(rr) != type) continue;
+
+        memset(out, 0, sizeof(*out));
+        if (type == ns_t_a && ns_rr_rdlen(rr) == 4) {
+            struct sockaddr_in* in4 = (struct sockaddr_in*)out;
+            in4->sin_family = AF_INET;
+            in4->sin_port = htons(port);
+            memcpy(&in4->sin_addr, ns_rr_rdata(rr), 4);
+            *len = sizeof(*in4);
+            found = true;
+        } else if (type == ns_t_aaaa && ns_rr_rdlen(rr) == 16) {
+            struct sockaddr_in6* in6 = (struct sockaddr_in6*)out;
+            in6->sin6_family = AF_INET6;
+            in6->sin6_port = htons(port);
+            memcpy(&in6->sin6_addr, ns_rr_rdata(rr), 16);
+            *len = sizeof(*in6);
+            found = true;
+        }
+    }
+
+    if (!found) return -1;
+    *ttl = min_ttl;
+    return 0;
+}
+
+// Names not served by DNS (/etc/hosts and friends) go through getaddrinfo
+static int lb_dns_getaddrinfo(const char* name, uint16_t port,
+                              struct sockaddr_storage* out, socklen_t* len) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo* res = NULL;
+    if (getaddrinfo(name, NULL, &hints, &res) != 0 || !res) return -1;
+
+    // Same preference as the DNS path: IPv4 first
+    struct addrinfo* pick = res;
+    for (struct addrinfo* ai = res; ai; ai = ai->ai_next) {
+        if (ai->ai_family == AF_INET) {
+            pick = ai;
+            break;
+        }
+    }
+
+    memset(out, 0, sizeof(*out));
+    memcpy(out, pick->ai_addr, pick->ai_addrlen);
+    *len = pick->ai_addrlen;
+    if (out->ss_family == AF_INET) {
+        ((struct sockaddr_in*)out)->sin_port = htons(port);
+    } else {
+        ((struct sockaddr_in6*)out)->sin6_port = htons(port);
+    }
+
+    freeaddrinfo(res);
+    return 0;
+}
+
+// Resolve a backend name, preferring IPv4. Returns the TTL in seconds to
+// keep the result for, or -1 when nothing could be resolved.
+static int lb_dns_lookup(res_state rs, const backend_t* backend,
+                         struct sockaddr_storage* out, socklen_t* len) {
+    uint32_t ttl = 0;
+
+    if (rs && (lb_dns_query(rs, backend->host, ns_t_a, backend->port, out, len, &ttl) == 0 ||
+               lb_dns_query(rs, backend->host, ns_t_aaaa, backend->port, out, len, &ttl) == 0)) {
+        if (ttl < DNS_MIN_TTL_S) ttl = DNS_MIN_TTL_S;
+        if (ttl > DNS_MAX_TTL_S) ttl = DNS_MAX_TTL_S;
+        return (int)ttl;
+    }
+
+    if (lb_dns_getaddrinfo(backend->host, backend->port, out, len) == 0) {
+        return DNS_DEFAULT_TTL_S;
+    }
+    return -1;
+}
+
+static void lb_dns_refresh(res_state rs, backend_t* backend, uint64_t now) {
+    struct sockaddr_storage addr;
+    socklen_t len = 0;
+
+    int ttl = lb_dns_lookup(rs, backend, &addr, &len);
+    if (ttl < 0) {
+        // Keep serving the last good address until the name resolves again
+        backend->addr_expires_ns = now + DNS_RETRY_S * 1000000000ULL;
+        return;
+    }
+
+    lb_dns_publish(backend, &addr, len);
+    backend->addr_expires_ns = now + (uint64_t)ttl * 1000000000ULL;
+}
+
+int lb_dns_resolve_backend(backend_t* backend) {
+    struct sockaddr_storage addr;
+    socklen_t len = 0;
+
+    if (lb_dns_parse_literal(backend->host, backend->port, &addr, &len)) {
+        backend->addr_dynamic = false;
+        lb_dns_publish(backend, &addr, len);
+        return 0;
+    }
+
+    backend->addr_dynamic = true;
+
+    struct __res_state rs;
+    memset(&rs, 0, sizeof(rs));
+    bool have_rs = res_ninit(&rs) == 0;
+
+    lb_dns_refresh(have_rs ? &rs : NULL, backend, get_time_ns());
+    if (have_rs) res_nclose(&rs);
+
+    return backend->addr_len > 0 ? 0 : -1;
+}
+
+void* dns_resolver_thread(void* arg) {
+    loadbalancer_t* lb = (loadbalancer_t*)arg;
+
+    struct __res_state rs;
+    memset(&rs, 0, sizeof(rs));
+    bool have_rs = res_ninit(&rs) == 0;
+
+    while (lb->running) {
+        uint64_t now = get_time_ns();
+
+        for (uint32_t i = 0; i < lb->backend_count; i++) {
+            backend_t* backend = lb->backends[i];
+            if (!backend || !backend->addr_dynamic || now < backend->addr_expires_ns) continue;
+            lb_dns_refresh(have_rs ? &rs : NULL, backend, now);
+        }
+
+        usleep(DNS_POLL_US);
+    }
+
+    if (have_rs) res_nclose(&rs);
+    return NULL;
+}
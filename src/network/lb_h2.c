@@ -0,0 +1,1316 @@
+#include "core/loadbalancer.h"
+#include "core/lb_stats.h"
+#include "core/lb_clock.h"
+#include "http/http.h"
+#include "http/h2.h"
+#include "utils/log.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+// HTTP/2 frontend for L7 connections. Every client stream becomes one
+// HTTP/1.1 exchange with a backend picked for that stream alone; the
+// backend sockets are taken from and returned to the worker's upstream
+// pool, so any number of client streams share the same few keep-alive
+// connections. Streams and their sockets belong to the worker that
+// accepted the client, like every other connection on a sharded worker.
+
+#define H2_MAX_STREAMS      100             // SETTINGS_MAX_CONCURRENT_STREAMS
+#define H2_CONN_WINDOW      (1024 * 1024)   // connection receive window
+#define H2_STREAM_READAHEAD (256 * 1024)    // response bytes read ahead of the client's window
+#define H2_REQ_BACKLOG      (64 * 1024)     // request body queued before its window stops reopening
+#define H2_CLIENT_BACKLOG   (1024 * 1024)   // frames queued for the client before streams stop
+#define H2_HEAD_MAX         (64 * 1024)
+#define H2_BLOCK_MAX        (HPACK_LIST_MAX * 2)
+
+enum {
+    H2_BODY_NONE = 0,
+    H2_BODY_LENGTH,
+    H2_BODY_CHUNKED,
+    H2_BODY_CLOSE,
+};
+
+enum {
+    H2_CHUNK_SIZE = 0,
+    H2_CHUNK_DATA,
+    H2_CHUNK_CRLF,
+    H2_CHUNK_TRAILER,
+};
+
+typedef struct lb_h2_stream {
+    uint32_t id;                // 0 for a free slot
+    int fd;
+    backend_t* backend;
+    epoll_data_wrapper_t wrapper;
+
+    bool req_done;              // END_STREAM seen from the client
+    bool req_chunked;           // body forwarded with chunked coding
+    bool head_only;             // HEAD: the response never has a body
+    bool resp_started;          // HEADERS sent to the client
+    bool reusable;              // backend socket may go back to the pool
+    bool readable;              // no EAGAIN on the backend socket since the last edge
+    bool backend_eof;
+
+    uint8_t body;
+    uint8_t chunk;
+    uint64_t remaining;         // body or chunk bytes left
+
+    int32_t send_window;        // DATA the client lets us send on this stream
+    int32_t recv_window;        // DATA the client may still send
+    uint32_t recv_credit;       // received, not yet handed back in WINDOW_UPDATE
+    uint64_t sent_ns;           // request forwarded, first response byte pending
+
+    uint8_t* out;               // request bytes for the backend
+    size_t out_size;
+    size_t out_cap;
+
+    uint8_t* in;                // response bytes not yet framed
+    size_t in_off;
+    size_t in_size;
+    size_t in_cap;
+} lb_h2_stream_t;
+
+struct lb_h2_session {
+    hpack_table_t dec;
+    hpack_table_t enc;
+    hpack_headers_t hdrs;       // decode scratch for the block in hand
+
+    bool preface;               // client connection preface consumed
+    bool goaway;
+    bool enc_update;            // table size change to announce in the next block
+
+    uint32_t last_sid;
+    uint32_t max_frame;         // client's SETTINGS_MAX_FRAME_SIZE
+    int32_t initial_window;     // client's SETTINGS_INITIAL_WINDOW_SIZE
+    int64_t send_window;
+    int32_t recv_window;
+    uint32_t recv_credit;
+
+    // HEADERS waiting for its CONTINUATION frames
+    uint32_t cont_sid;
+    uint8_t cont_flags;
+    uint8_t* block;
+    size_t block_size;
+    size_t block_cap;
+
+    uint8_t* in;                // client bytes not yet parsed
+    size_t in_head;
+    size_t in_size;
+    size_t in_cap;
+
+    uint32_t active;
+    lb_h2_stream_t streams[H2_MAX_STREAMS];
+};
+
+static inline void lb_h2_put32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static inline uint32_t lb_h2_get32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static int lb_h2_out(lb_connection_t* conn, const void* data, size_t len) {
+    return lb_net_backlog_append(conn->worker->lb, &conn->to_client_buffer, &conn->to_client_size,
+                                 &conn->to_client_capacity, data, len);
+}
+
+static int lb_h2_frame(lb_connection_t* conn, uint8_t type, uint8_t flags, uint32_t sid,
+                       const void* payload, uint32_t len) {
+    uint8_t hdr[H2_FRAME_HDR_LEN];
+    h2_frame_encode(hdr, len, type, flags, sid);
+    if (lb_h2_out(conn, hdr, sizeof(hdr)) < 0) return -1;
+    return len > 0 ? lb_h2_out(conn, payload, len) : 0;
+}
+
+static int lb_h2_rst(lb_connection_t* conn, uint32_t sid, uint32_t code) {
+    uint8_t p[4];
+    lb_h2_put32(p, code);
+    return lb_h2_frame(conn, H2_FT_RST_STREAM, 0, sid, p, sizeof(p));
+}
+
+static int lb_h2_window_update(lb_connection_t* conn, uint32_t sid, uint32_t inc) {
+    uint8_t p[4];
+    lb_h2_put32(p, inc);
+    return lb_h2_frame(conn, H2_FT_WINDOW_UPDATE, 0, sid, p, sizeof(p));
+}
+
+// Connection error: tell the client why and have the caller close.
+// Always returns -1.
+static int lb_h2_goaway(lb_connection_t* conn, uint32_t code) {
+    struct lb_h2_session* s = conn->h2;
+    uint8_t p[8];
+
+    LB_DEBUG("HTTP/2 connection error %u", code);
+    lb_h2_put32(p, s->last_sid);
+    lb_h2_put32(p + 4, code);
+    lb_h2_frame(conn, H2_FT_GOAWAY, 0, 0, p, sizeof(p));
+    s->goaway = true;
+    return -1;
+}
+
+static int lb_h2_flush(loadbalancer_t* lb, lb_connection_t* conn) {
+    size_t off = 0;
+    while (off < conn->to_client_size) {
+        ssize_t n = send(conn->client_fd, conn->to_client_buffer + off, conn->to_client_size - off,
+                         MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            LB_DEBUG("Error sending to HTTP/2 client: %s", strerror(errno));
+            return -1;
+        }
+        off += n;
+    }
+
+    if (off > 0) {
+        LB_STAT_ADD(lb, bytes_out, off);
+        memmove(conn->to_client_buffer, conn->to_client_buffer + off, conn->to_client_size - off);
+        conn->to_client_size -= off;
+    }
+    if (conn->to_client_size == 0) {
+        lb_net_backlog_release(lb, &conn->to_client_buffer, &conn->to_client_capacity);
+    }
+    return 0;
+}
+
+// Client stream ids are odd and only grow, so (id / 2) spreads the live
+// ones over the table; a taken home slot falls back to a scan
+static lb_h2_stream_t* lb_h2_stream_find(struct lb_h2_session* s, uint32_t sid) {
+    lb_h2_stream_t* st = &s->streams[(sid >> 1) % H2_MAX_STREAMS];
+    if (st->id == sid) return st;
+
+    for (uint32_t i = 0; i < H2_MAX_STREAMS; i++) {
+        if (s->streams[i].id == sid) return &s->streams[i];
+    }
+    return NULL;
+}
+
+static lb_h2_stream_t* lb_h2_stream_new(struct lb_h2_session* s, uint32_t sid) {
+    lb_h2_stream_t* st = &s->streams[(sid >> 1) % H2_MAX_STREAMS];
+    for (uint32_t i = 0; st->id != 0 && i < H2_MAX_STREAMS; i++) st = &s->streams[i];
+    if (st->id != 0) return NULL;
+
+    memset(st, 0, sizeof(*st));
+    st->id = sid;
+    st->fd = -1;
+    st->send_window = s->initial_window;
+    st->recv_window = H2_DEFAULT_WINDOW;
+    s->active++;
+    return st;
+}
+
+static void lb_h2_stream_release(lb_connection_t* conn, lb_h2_stream_t* st, bool pool) {
+    lb_worker_t* worker = conn->worker;
+    loadbalancer_t* lb = worker->lb;
+
+    if (st->fd >= 0) {
+        epoll_ctl(worker->epfd, EPOLL_CTL_DEL, st->fd, NULL);
+        if (!pool || !lb_net_upstream_checkin(worker, st->backend, st->fd)) close(st->fd);
+        st->fd = -1;
+    }
+    if (st->backend) {
+        if (st->sent_ns) atomic_fetch_sub_explicit(&st->backend->pending_requests, 1, memory_order_relaxed);
+        lb_backend_conn_put(lb, st->backend);
+        st->backend = NULL;
+    }
+    lb_net_backlog_release(lb, &st->out, &st->out_cap);
+    lb_net_backlog_release(lb, &st->in, &st->in_cap);
+    st->wrapper.conn = NULL;
+    st->id = 0;
+    conn->h2->active--;
+}
+
+// Header block as HEADERS plus CONTINUATION frames of the client's size
+static int lb_h2_send_block(lb_connection_t* conn, uint32_t sid, const uint8_t* block, size_t len,
+                            bool end_stream) {
+    uint32_t max = conn->h2->max_frame;
+    uint8_t type = H2_FT_HEADERS;
+    uint8_t flags = end_stream ? H2_F_END_STREAM : 0;
+
+    do {
+        uint32_t n = len > max ? max : (uint32_t)len;
+        if (n == len) flags |= H2_F_END_HEADERS;
+        if (lb_h2_frame(conn, type, flags, sid, block, n) < 0) return -1;
+        block += n;
+        len -= n;
+        type = H2_FT_CONTINUATION;
+        flags = 0;
+    } while (len > 0);
+    return 0;
+}
+
+static size_t lb_h2_block_start(struct lb_h2_session* s, uint8_t* block, size_t cap) {
+    if (!s->enc_update) return 0;
+    s->enc_update = false;
+    return hpack_encode_table_size(block, cap, s->enc.max_size);
+}
+
+// Answer a stream ourselves (no backend, or the backend failed before
+// its response started) and retire it
+static int lb_h2_respond(lb_connection_t* conn, lb_h2_stream_t* st, int status) {
+    struct lb_h2_session* s = conn->h2;
+    uint8_t block[64];
+    char code[4];
+
+    snprintf(code, sizeof(code), "%03d", status);
+    size_t n = lb_h2_block_start(s, block, sizeof(block));
+    n += hpack_encode(&s->enc, block + n, sizeof(block) - n, ":status", 7, code, 3, true);
+    n += hpack_encode(&s->enc, block + n, sizeof(block) - n, "content-length", 14, "0", 1, false);
+
+    int ret = lb_h2_send_block(conn, st->id, block, n, true);
+    if (ret == 0 && !st->req_done) ret = lb_h2_rst(conn, st->id, H2_NO_ERROR);
+    lb_h2_stream_release(conn, st, false);
+    return ret;
+}
+
+// Backend failed under a stream: 502 if nothing was answered yet, reset
+// otherwise
+static int lb_h2_stream_fail(loadbalancer_t* lb, lb_connection_t* conn, lb_h2_stream_t* st, int err) {
+    LB_DEBUG("HTTP/2 stream %u backend error: %s", st->id, strerror(err));
+
+    switch (err) {
+        case ECONNREFUSED:
+        case EHOSTUNREACH:
+        case ENETUNREACH:
+        case ETIMEDOUT:
+            atomic_fetch_add(&st->backend->failed_conns, 1);
+            lb_outlier_report(lb, st->backend, LB_OUTCOME_CONNECT_FAIL);
+            break;
+        case ECONNRESET:
+        case EPIPE:
+            lb_outlier_report(lb, st->backend, LB_OUTCOME_RESET);
+            break;
+        default:
+            break;
+    }
+    LB_STAT_ADD(lb, failed_requests, 1);
+
+    if (!st->resp_started) return lb_h2_respond(conn, st, 502);
+    int ret = lb_h2_rst(conn, st->id, H2_INTERNAL_ERROR);
+    lb_h2_stream_release(conn, st, false);
+    return ret;
+}
+
+// Pick a backend for the stream and open (or reuse) a socket to it.
+// Returns 0, or the status to answer with.
+static int lb_h2_stream_connect(loadbalancer_t* lb, lb_connection_t* conn, lb_h2_stream_t* st) {
+    lb_worker_t* worker = conn->worker;
+    backend_t* backend = lb_select_backend(lb, &conn->client_addr);
+    if (!backend) return 503;
+
+    int fd = lb_net_upstream_checkout(worker, backend);
+    if (fd < 0) fd = lb_net_connect_to_backend(backend);
+    if (fd < 0) {
+        atomic_fetch_add(&backend->failed_conns, 1);
+        lb_outlier_report(lb, backend, LB_OUTCOME_CONNECT_FAIL);
+        LB_STAT_ADD(lb, failed_requests, 1);
+        return 502;
+    }
+
+    st->fd = fd;
+    st->backend = backend;
+    st->reusable = true;
+    st->readable = true;
+    lb_backend_conn_get(lb, backend);
+    atomic_fetch_add(&backend->total_conns, 1);
+    st->sent_ns = lb_clock_precise_ns();
+    atomic_fetch_add_explicit(&backend->pending_requests, 1, memory_order_relaxed);
+
+    // One edge-triggered registration for the stream's lifetime; only the
+    // owning worker ever touches it
+    st->wrapper.type = SOCKET_TYPE_H2_STREAM;
+    st->wrapper.conn = conn;
+    st->wrapper.fd = fd;
+    st->wrapper.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    struct epoll_event ev = { .events = st->wrapper.events, .data.ptr = &st->wrapper };
+    if (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) return 502;
+    return 0;
+}
+
+static int lb_h2_stream_send(loadbalancer_t* lb, lb_h2_stream_t* st) {
+    size_t off = 0;
+    while (off < st->out_size) {
+        ssize_t n = send(st->fd, st->out + off, st->out_size - off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
+        }
+        off += n;
+    }
+
+    if (off > 0) {
+        LB_STAT_ADD(lb, bytes_in, off);
+        lb_stat_backend_bytes(st->backend, 0, off);
+        memmove(st->out, st->out + off, st->out_size - off);
+        st->out_size -= off;
+    }
+    if (st->out_size == 0) lb_net_backlog_release(lb, &st->out, &st->out_cap);
+    return 0;
+}
+
+// Reopen the stream's receive window once its body has drained to the
+// backend, so a slow backend pushes back on the client
+static int lb_h2_stream_credit(lb_connection_t* conn, lb_h2_stream_t* st) {
+    if (st->req_done || st->out_size >= H2_REQ_BACKLOG || st->recv_credit < H2_DEFAULT_WINDOW / 2) {
+        return 0;
+    }
+    uint32_t inc = st->recv_credit;
+    st->recv_credit = 0;
+    st->recv_window += (int32_t)inc;
+    return lb_h2_window_update(conn, st->id, inc);
+}
+
+static int lb_h2_stream_read(loadbalancer_t* lb, lb_h2_stream_t* st) {
+    char buffer[16384];
+
+    while (st->readable && !st->backend_eof && st->in_size - st->in_off < H2_STREAM_READAHEAD) {
+        ssize_t n = recv(st->fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (n > 0) {
+            if (st->sent_ns) {
+                uint64_t now = lb_clock_precise_ns();
+                lb_backend_observe_latency(st->backend, now - st->sent_ns, now);
+                atomic_fetch_sub_explicit(&st->backend->pending_requests, 1, memory_order_relaxed);
+                st->sent_ns = 0;
+            }
+            lb_stat_backend_bytes(st->backend, 1, n);
+            if (lb_net_backlog_append(lb, &st->in, &st->in_size, &st->in_cap, buffer, n) < 0) {
+                errno = ENOMEM;
+                return -1;
+            }
+        } else if (n == 0) {
+            st->backend_eof = true;
+            st->reusable = false;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            st->readable = false;
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static bool lb_h2_hop_by_hop(const char* name, size_t len) {
+    static const char* const names[] = {
+        "connection", "keep-alive", "proxy-connection", "transfer-encoding", "upgrade", NULL
+    };
+    for (int i = 0; names[i]; i++) {
+        if (strlen(names[i]) == len && strncasecmp(name, names[i], len) == 0) return true;
+    }
+    return false;
+}
+
+// Values that change with every response would only churn the table
+static bool lb_h2_no_index(const char* name, size_t len) {
+    static const char* const names[] = {
+        "content-length", "date", "set-cookie", "etag", "last-modified", "age", "expires", NULL
+    };
+    for (int i = 0; names[i]; i++) {
+        if (strlen(names[i]) == len && memcmp(name, names[i], len) == 0) return true;
+    }
+    return false;
+}
+
+static void lb_h2_stream_finish(lb_connection_t* conn, lb_h2_stream_t* st);
+
+// Turn the backend's HTTP/1.1 status line and headers into a HEADERS
+// frame. Returns 1 once sent, 0 while the head is incomplete, -1 when the
+// response is unusable, -2 when the frame could not be queued.
+static int lb_h2_response_head(loadbalancer_t* lb, lb_connection_t* conn, lb_h2_stream_t* st) {
+    struct lb_h2_session* s = conn->h2;
+
+    for (;;) {
+        const char* data = (const char*)st->in + st->in_off;
+        size_t avail = st->in_size - st->in_off;
+        const char* end = memmem(data, avail, "\r\n\r\n", 4);
+        if (!end) return (avail > H2_HEAD_MAX || st->backend_eof) ? -1 : 0;
+
+        size_t head_len = (size_t)(end + 4 - data);
+        if (head_len < 16 || memcmp(data, "HTTP/1.", 7) != 0 || data[8] != ' ' ||
+            !isdigit((unsigned char)data[9]) || !isdigit((unsigned char)data[10]) ||
+            !isdigit((unsigned char)data[11])) {
+            return -1;
+        }
+        int status = (data[9] - '0') * 100 + (data[10] - '0') * 10 + (data[11] - '0');
+        if (status == 101 || status < 100) return -1;
+        if (status < 200) {
+            st->in_off += head_len;  // Interim response, e.g. 100 Continue
+            continue;
+        }
+
+        lb_outlier_report(lb, st->backend, lb_response_outcome(data, avail));
+        if (data[7] == '0') st->reusable = false;
+
+        uint8_t block[H2_HEAD_MAX + 1024];
+        size_t n = lb_h2_block_start(s, block, sizeof(block));
+        n += hpack_encode(&s->enc, block + n, sizeof(block) - n, ":status", 7, data + 9, 3, true);
+
+        bool chunked = false;
+        bool has_length = false;
+        uint64_t length = 0;
+        const char* line = memchr(data, '\n', head_len) + 1;
+        while (line < end + 2) {
+            const char* eol = memchr(line, '\n', end + 4 - line);
+            const char* colon = memchr(line, ':', eol - line);
+            size_t line_len = (size_t)(eol - line);
+            if (line_len > 0 && line[line_len - 1] == '\r') line_len--;
+            if (!colon || colon == line) {
+                line = eol + 1;
+                continue;
+            }
+
+            size_t nlen = (size_t)(colon - line);
+            const char* v = colon + 1;
+            const char* vend = line + line_len;
+            while (v < vend && (*v == ' ' || *v == '\t')) v++;
+            while (vend > v && (vend[-1] == ' ' || vend[-1] == '\t')) vend--;
+            size_t vlen = (size_t)(vend - v);
+
+            if (nlen == 14 && strncasecmp(line, "content-length", 14) == 0) {
+                has_length = true;
+                length = strtoull(v, NULL, 10);
+            } else if (nlen == 17 && strncasecmp(line, "transfer-encoding", 17) == 0) {
+                chunked = memmem(v, vlen, "chunked", 7) != NULL;
+            } else if (nlen == 10 && strncasecmp(line, "connection", 10) == 0) {
+                if (memmem(v, vlen, "close", 5)) st->reusable = false;
+            }
+
+            if (!lb_h2_hop_by_hop(line, nlen)) {
+                char name[256];
+                if (nlen > sizeof(name)) return -1;
+                for (size_t i = 0; i < nlen; i++) name[i] = (char)tolower((unsigned char)line[i]);
+
+                size_t w = hpack_encode(&s->enc, block + n, sizeof(block) - n, name, nlen, v, vlen,
+                                        !lb_h2_no_index(name, nlen));
+                if (w == 0) return -1;
+                n += w;
+            }
+            line = eol + 1;
+        }
+
+        if (st->head_only || status == 204 || status == 304) {
+            st->body = H2_BODY_NONE;
+        } else if (chunked) {
+            st->body = H2_BODY_CHUNKED;
+            st->chunk = H2_CHUNK_SIZE;
+        } else if (has_length) {
+            st->body = length > 0 ? H2_BODY_LENGTH : H2_BODY_NONE;
+            st->remaining = length;
+        } else {
+            st->body = H2_BODY_CLOSE;
+            st->reusable = false;
+        }
+
+        st->in_off += head_len;
+        st->resp_started = true;
+        if (lb_h2_send_block(conn, st->id, block, n, st->body == H2_BODY_NONE) < 0) return -2;
+        if (st->body == H2_BODY_NONE) lb_h2_stream_finish(conn, st);
+        return 1;
+    }
+}
+
+// Next run of response body at in[in_off], with chunk framing stripped.
+// Returns 1 with *len set, 0 when more input is needed, 2 once the body
+// is complete, -1 on bad framing.
+static int lb_h2_body_span(lb_h2_stream_t* st, size_t* len) {
+    for (;;) {
+        const char* data = (const char*)st->in + st->in_off;
+        size_t avail = st->in_size - st->in_off;
+
+        switch (st->body) {
+            case H2_BODY_NONE:
+                return 2;
+
+            case H2_BODY_LENGTH:
+                if (st->remaining == 0) return 2;
+                if (avail == 0) return 0;
+                *len = avail < st->remaining ? avail : st->remaining;
+                return 1;
+
+            case H2_BODY_CLOSE:
+                if (avail == 0) return st->backend_eof ? 2 : 0;
+                *len = avail;
+                return 1;
+
+            default:
+                break;
+        }
+
+        const char* eol;
+        switch (st->chunk) {
+            case H2_CHUNK_SIZE: {
+                eol = memchr(data, '\n', avail);
+                if (!eol) return avail > 1024 ? -1 : 0;
+                uint64_t size = 0;
+                const char* p = data;
+                if (!isxdigit((unsigned char)*p)) return -1;
+                for (; isxdigit((unsigned char)*p); p++) {
+                    if (size >> 60) return -1;
+                    size = (size << 4) | (uint64_t)(isdigit((unsigned char)*p) ? *p - '0'
+                                                                               : (tolower(*p) - 'a' + 10));
+                }
+                st->in_off += (size_t)(eol + 1 - data);
+                st->remaining = size;
+                st->chunk = size > 0 ? H2_CHUNK_DATA : H2_CHUNK_TRAILER;
+                break;
+            }
+
+            case H2_CHUNK_DATA:
+                if (st->remaining == 0) {
+                    st->chunk = H2_CHUNK_CRLF;
+                    break;
+                }
+                if (avail == 0) return 0;
+                *len = avail < st->remaining ? avail : st->remaining;
+                return 1;
+
+            case H2_CHUNK_CRLF:
+                if (avail < 2) return 0;
+                if (data[0] != '\r' || data[1] != '\n') return -1;
+                st->in_off += 2;
+                st->chunk = H2_CHUNK_SIZE;
+                break;
+
+            case H2_CHUNK_TRAILER:
+                // Trailers are dropped; an empty line ends the body
+                eol = memchr(data, '\n', avail);
+                if (!eol) return avail > H2_HEAD_MAX ? -1 : 0;
+                st->in_off += (size_t)(eol + 1 - data);
+                if (eol == data || (eol == data + 1 && data[0] == '\r')) return 2;
+                break;
+        }
+    }
+}
+
+static void lb_h2_stream_finish(lb_connection_t* conn, lb_h2_stream_t* st) {
+    // Request still running: stop the client sending the rest
+    if (!st->req_done) {
+        lb_h2_rst(conn, st->id, H2_NO_ERROR);
+        st->reusable = false;
+    }
+    bool pool = st->reusable && st->out_size == 0 && !st->backend_eof && st->in_off == st->in_size;
+    lb_h2_stream_release(conn, st, pool);
+}
+
+// Frame as much buffered response as the flow-control windows allow
+static int lb_h2_stream_pump(loadbalancer_t* lb, lb_connection_t* conn, lb_h2_stream_t* st) {
+    struct lb_h2_session* s = conn->h2;
+
+    if (!st->resp_started) {
+        int r = lb_h2_response_head(lb, conn, st);
+        if (r == -1) return lb_h2_stream_fail(lb, conn, st, EPROTO);
+        if (r <= 0) return r == 0 ? 0 : -1;
+        if (st->id == 0) return 0;
+    }
+
+    while (conn->to_client_size < H2_CLIENT_BACKLOG) {
+        size_t span = 0;
+        int r = lb_h2_body_span(st, &span);
+        if (r < 0 || (r == 0 && st->backend_eof)) {
+            int ret = lb_h2_rst(conn, st->id, H2_INTERNAL_ERROR);
+            lb_h2_stream_release(conn, st, false);
+            return ret;
+        }
+        if (r == 0) break;
+        if (r == 2) {
+            int ret = lb_h2_frame(conn, H2_FT_DATA, H2_F_END_STREAM, st->id, NULL, 0);
+            lb_h2_stream_finish(conn, st);
+            return ret;
+        }
+
+        int64_t window = st->send_window < s->send_window ? st->send_window : s->send_window;
+        if (window <= 0) break;
+        if ((uint64_t)window > span) window = (int64_t)span;
+        if (window > s->max_frame) window = s->max_frame;
+        uint32_t n = (uint32_t)window;
+
+        bool last = st->body == H2_BODY_LENGTH && n == st->remaining;
+        if (lb_h2_frame(conn, H2_FT_DATA, last ? H2_F_END_STREAM : 0, st->id, st->in + st->in_off, n) < 0) {
+            return -1;
+        }
+        st->in_off += n;
+        if (st->body != H2_BODY_CLOSE) st->remaining -= n;
+        st->send_window -= (int32_t)n;
+        s->send_window -= n;
+        if (last) {
+            lb_h2_stream_finish(conn, st);
+            return 0;
+        }
+    }
+
+    if (st->in_off == st->in_size) {
+        st->in_off = st->in_size = 0;
+        lb_net_backlog_release(lb, &st->in, &st->in_cap);
+    } else if (st->in_off > st->in_size / 2) {
+        memmove(st->in, st->in + st->in_off, st->in_size - st->in_off);
+        st->in_size -= st->in_off;
+        st->in_off = 0;
+    }
+    return 0;
+}
+
+// Move a stream along: request out, response in, frames to the client
+static int lb_h2_stream_run(loadbalancer_t* lb, lb_connection_t* conn, lb_h2_stream_t* st) {
+    if (st->out_size > 0 && lb_h2_stream_send(lb, st) < 0) return lb_h2_stream_fail(lb, conn, st, errno);
+    if (lb_h2_stream_credit(conn, st) < 0) return -1;
+
+    for (;;) {
+        if (lb_h2_stream_read(lb, st) < 0) return lb_h2_stream_fail(lb, conn, st, errno);
+        if (lb_h2_stream_pump(lb, conn, st) < 0) return -1;
+        if (st->id == 0) return 0;
+
+        // Reading only stopped at the readahead cap; go on if the pump made room
+        if (!st->readable || st->backend_eof || st->in_size - st->in_off >= H2_STREAM_READAHEAD) break;
+    }
+    return 0;
+}
+
+static int lb_h2_run_all(loadbalancer_t* lb, lb_connection_t* conn) {
+    struct lb_h2_session* s = conn->h2;
+    for (uint32_t i = 0; i < H2_MAX_STREAMS && s->active > 0; i++) {
+        lb_h2_stream_t* st = &s->streams[i];
+        if (st->id != 0 && st->fd >= 0 && lb_h2_stream_run(lb, conn, st) < 0) return -1;
+    }
+    return 0;
+}
+
+static int lb_h2_stream_queue(loadbalancer_t* lb, lb_h2_stream_t* st, const void* data, size_t len) {
+    return lb_net_backlog_append(lb, &st->out, &st->out_size, &st->out_cap, data, len);
+}
+
+static bool lb_h2_name_is(const hpack_headers_t* hs, uint32_t i, const char* name) {
+    size_t n = strlen(name);
+    return hs->h[i].nlen == n && memcmp(hpack_name(hs, i), name, n) == 0;
+}
+
+// Rewrite a decoded request as an HTTP/1.1 head. Returns its length, -1
+// for a malformed request, -2 for one we do not proxy (CONNECT).
+static ssize_t lb_h2_request_head(const hpack_headers_t* hs, bool end_stream, bool* head_only,
+                                  bool* chunked, char* out, size_t cap) {
+    int method = -1, path = -1, authority = -1;
+    bool has_length = false;
+
+    for (uint32_t i = 0; i < hs->count; i++) {
+        const char* name = hpack_name(hs, i);
+        if (hs->h[i].nlen == 0) return -1;
+        if (name[0] != ':') {
+            for (uint32_t j = 0; j < hs->h[i].nlen; j++) {
+                if (isupper((unsigned char)name[j])) return -1;
+            }
+            if (lb_h2_hop_by_hop(name, hs->h[i].nlen)) return -1;
+            if (lb_h2_name_is(hs, i, "content-length")) has_length = true;
+            continue;
+        }
+        if (lb_h2_name_is(hs, i, ":method")) method = (int)i;
+        else if (lb_h2_name_is(hs, i, ":path")) path = (int)i;
+        else if (lb_h2_name_is(hs, i, ":authority")) authority = (int)i;
+        else if (!lb_h2_name_is(hs, i, ":scheme")) return -1;
+    }
+    if (method < 0) return -1;
+    if (hs->h[method].vlen == 7 && memcmp(hpack_value(hs, method), "CONNECT", 7) == 0) return -2;
+    if (path < 0 || hs->h[path].vlen == 0) return -1;
+
+    *head_only = hs->h[method].vlen == 4 && memcmp(hpack_value(hs, method), "HEAD", 4) == 0;
+    *chunked = !end_stream && !has_length;
+
+    size_t n = 0;
+#define H2_PUT(p, l) do { if (n + (l) > cap) return -1; memcpy(out + n, (p), (l)); n += (l); } while (0)
+    H2_PUT(hpack_value(hs, method), hs->h[method].vlen);
+    H2_PUT(" ", 1);
+    H2_PUT(hpack_value(hs, path), hs->h[path].vlen);
+    H2_PUT(" HTTP/1.1\r\n", 11);
+    if (authority >= 0) {
+        H2_PUT("host: ", 6);
+        H2_PUT(hpack_value(hs, authority), hs->h[authority].vlen);
+        H2_PUT("\r\n", 2);
+    }
+
+    // Cookie crumbs are folded back into one header (RFC 9113 8.2.3)
+    bool cookie = false;
+    for (uint32_t i = 0; i < hs->count; i++) {
+        const char* name = hpack_name(hs, i);
+        if (name[0] == ':' || lb_h2_name_is(hs, i, "te")) continue;
+        if (authority >= 0 && lb_h2_name_is(hs, i, "host")) continue;
+        if (lb_h2_name_is(hs, i, "cookie")) {
+            if (cookie) continue;
+            cookie = true;
+            H2_PUT("cookie: ", 8);
+            bool first = true;
+            for (uint32_t j = i; j < hs->count; j++) {
+                if (!lb_h2_name_is(hs, j, "cookie")) continue;
+                if (!first) H2_PUT("; ", 2);
+                H2_PUT(hpack_value(hs, j), hs->h[j].vlen);
+                first = false;
+            }
+            H2_PUT("\r\n", 2);
+            continue;
+        }
+        H2_PUT(name, hs->h[i].nlen);
+        H2_PUT(": ", 2);
+        H2_PUT(hpack_value(hs, i), hs->h[i].vlen);
+        H2_PUT("\r\n", 2);
+    }
+    if (*chunked) H2_PUT("transfer-encoding: chunked\r\n", 28);
+    H2_PUT("\r\n", 2);
+#undef H2_PUT
+    return (ssize_t)n;
+}
+
+// Start a stream's exchange with the request head already queued
+static int lb_h2_stream_open(loadbalancer_t* lb, lb_connection_t* conn, lb_h2_stream_t* st) {
+    int status = lb_h2_stream_connect(lb, conn, st);
+    if (status) return lb_h2_respond(conn, st, status);
+    return lb_h2_stream_run(lb, conn, st);
+}
+
+static int lb_h2_headers(loadbalancer_t* lb, lb_connection_t* conn, uint32_t sid, uint8_t flags,
+                         const uint8_t* block, size_t len) {
+    struct lb_h2_session* s = conn->h2;
+    bool end_stream = flags & H2_F_END_STREAM;
+
+    if (hpack_decode(&s->dec, block, len, &s->hdrs) < 0) return lb_h2_goaway(conn, H2_COMPRESSION_ERROR);
+
+    lb_h2_stream_t* st = lb_h2_stream_find(s, sid);
+    if (st) {
+        // Trailers end the request; HTTP/1.1 backends get the last chunk
+        // without them
+        if (st->req_done) return lb_h2_rst(conn, sid, H2_STREAM_CLOSED);
+        if (!end_stream) return lb_h2_goaway(conn, H2_PROTOCOL_ERROR);
+        st->req_done = true;
+        if (st->req_chunked && lb_h2_stream_queue(lb, st, "0\r\n\r\n", 5) < 0) return -1;
+        return st->fd >= 0 ? lb_h2_stream_run(lb, conn, st) : 0;
+    }
+
+    if (sid <= s->last_sid) return lb_h2_goaway(conn, H2_STREAM_CLOSED);
+    s->last_sid = sid;
+    if (s->goaway) return 0;
+    if (s->active >= H2_MAX_STREAMS) return lb_h2_rst(conn, sid, H2_REFUSED_STREAM);
+
+    st = lb_h2_stream_new(s, sid);
+    st->req_done = end_stream;
+
+    char head[HPACK_LIST_MAX + 1024];
+    ssize_t n = lb_h2_request_head(&s->hdrs, end_stream, &st->head_only, &st->req_chunked,
+                                   head, sizeof(head));
+    if (n == -2) return lb_h2_respond(conn, st, 501);
+    if (n < 0) {
+        lb_h2_stream_release(conn, st, false);
+        return lb_h2_rst(conn, sid, H2_PROTOCOL_ERROR);
+    }
+    if (lb_h2_stream_queue(lb, st, head, (size_t)n) < 0) return -1;
+    return lb_h2_stream_open(lb, conn, st);
+}
+
+static int lb_h2_data(loadbalancer_t* lb, lb_connection_t* conn, const struct h2_frame* f,
+                      const uint8_t* p) {
+    struct lb_h2_session* s = conn->h2;
+    size_t len = f->len;
+
+    if (f->sid == 0) return lb_h2_goaway(conn, H2_PROTOCOL_ERROR);
+    if ((int64_t)f->len > s->recv_window) return lb_h2_goaway(conn, H2_FLOW_CONTROL_ERROR);
+    s->recv_window -= (int32_t)f->len;
+    s->recv_credit += f->len;
+    if (s->recv_credit >= H2_CONN_WINDOW / 2) {
+        if (lb_h2_window_update(conn, 0, s->recv_credit) < 0) return -1;
+        s->recv_window += (int32_t)s->recv_credit;
+        s->recv_credit = 0;
+    }
+
+    if (f->flags & H2_F_PADDED) {
+        if (len == 0 || p[0] >= len) return lb_h2_goaway(conn, H2_PROTOCOL_ERROR);
+        len -= 1 + p[0];
+        p++;
+    }
+
+    lb_h2_stream_t* st = lb_h2_stream_find(s, f->sid);
+    if (!st) {
+        if (f->sid > s->last_sid) return lb_h2_goaway(conn, H2_PROTOCOL_ERROR);
+        return lb_h2_rst(conn, f->sid, H2_STREAM_CLOSED);
+    }
+    if (st->req_done) return lb_h2_rst(conn, f->sid, H2_STREAM_CLOSED);
+    if ((int64_t)f->len > st->recv_window) {
+        lb_h2_stream_release(conn, st, false);
+        return lb_h2_rst(conn, f->sid, H2_FLOW_CONTROL_ERROR);
+    }
+    st->recv_window -= (int32_t)f->len;
+    st->recv_credit += f->len;
+
+    if (len > 0) {
+        if (st->req_chunked) {
+            char size[20];
+            int sn = snprintf(size, sizeof(size), "%zx\r\n", len);
+            if (lb_h2_stream_queue(lb, st, size, sn) < 0 ||
+                lb_h2_stream_queue(lb, st, p, len) < 0 ||
+                lb_h2_stream_queue(lb, st, "\r\n", 2) < 0) {
+                return -1;
+            }
+        } else if (lb_h2_stream_queue(lb, st, p, len) < 0) {
+            return -1;
+        }
+    }
+    if (f->flags & H2_F_END_STREAM) {
+        st->req_done = true;
+        if (st->req_chunked && lb_h2_stream_queue(lb, st, "0\r\n\r\n", 5) < 0) return -1;
+    }
+    return st->fd >= 0 ? lb_h2_stream_run(lb, conn, st) : 0;
+}
+
+static int lb_h2_settings(lb_connection_t* conn, const uint8_t* p, size_t len) {
+    struct lb_h2_session* s = conn->h2;
+    if (len % 6) return lb_h2_goaway(conn, H2_FRAME_SIZE_ERROR);
+
+    for (size_t off = 0; off < len; off += 6) {
+        uint16_t id = (uint16_t)((p[off] << 8) | p[off + 1]);
+        uint32_t v = lb_h2_get32(p + off + 2);
+
+        switch (id) {
+            case H2_SET_HEADER_TABLE_SIZE:
+                if (v > HPACK_TABLE_SIZE) v = HPACK_TABLE_SIZE;
+                if (v != s->enc.max_size) {
+                    hpack_table_resize(&s->enc, v);
+                    s->enc_update = true;
+                }
+                break;
+            case H2_SET_ENABLE_PUSH:
+                if (v > 1) return lb_h2_goaway(conn, H2_PROTOCOL_ERROR);
+                break;
+            case H2_SET_INITIAL_WINDOW_SIZE: {
+                if (v > H2_MAX_WINDOW) return lb_h2_goaway(conn, H2_FLOW_CONTROL_ERROR);
+                int64_t delta = (int64_t)v - s->initial_window;
+                for (uint32_t i = 0; i < H2_MAX_STREAMS; i++) {
+                    lb_h2_stream_t* st = &s->streams[i];
+                    if (st->id == 0) continue;
+                    if (st->send_window + delta > H2_MAX_WINDOW) return lb_h2_goaway(conn, H2_FLOW_CONTROL_ERROR);
+                    st->send_window += (int32_t)delta;
+                }
+                s->initial_window = (int32_t)v;
+                break;
+            }
+            case H2_SET_MAX_FRAME_SIZE:
+                if (v < H2_DEFAULT_FRAME || v > H2_MAX_FRAME) return lb_h2_goaway(conn, H2_PROTOCOL_ERROR);
+                s->max_frame = v;
+                break;
+            default:
+                break;  // Unknown settings are ignored
+        }
+    }
+    return 0;
+}
+
+static int lb_h2_frame_in(loadbalancer_t* lb, lb_connection_t* conn, const struct h2_frame* f,
+                          const uint8_t* p) {
+    struct lb_h2_session* s = conn->h2;
+
+    if (s->cont_sid && (f->type != H2_FT_CONTINUATION || f->sid != s->cont_sid)) {
+        return lb_h2_goaway(conn, H2_PROTOCOL_ERROR);
+    }
+
+    switch (f->type) {
+        case H2_FT_DATA:
+            return lb_h2_data(lb, conn, f, p);
+
+        case H2_FT_HEADERS: {
+            if (f->sid == 0 || !(f->sid & 1)) return lb_h2_goaway(conn, H2_PROTOCOL_ERROR);
+            size_t len = f->len;
+            if (f->flags & H2_F_PADDED) {
+                if (len == 0 || p[0] >= len) return lb_h2_goaway(conn, H2_PROTOCOL_ERROR);
+                len -= 1 + p[0];
+                p++;
+            }
+            if (f->flags & H2_F_PRIORITY) {
+                if (len < 5) return lb_h2_goaway(conn, H2_FRAME_SIZE_ERROR);
+                p += 5;
+                len -= 5;
+            }
+            if (f->flags & H2_F_END_HEADERS) return lb_h2_headers(lb, conn, f->sid, f->flags, p, len);
+
+            s->cont_sid = f->sid;
+            s->cont_flags = f->flags;
+            s->block_size = 0;
+            return lb_net_backlog_append(lb, &s->block, &s->block_size, &s->block_cap, (const char*)p, len);
+        }
+
+        case H2_FT_CONTINUATION: {
+            if (!s->cont_sid) return lb_h2_goaway(conn, H2_PROTOCOL_ERROR);
+            if (s->block_size + f->len > H2_BLOCK_MAX) return lb_h2_goaway(conn, H2_ENHANCE_YOUR_CALM);
+            if (lb_net_backlog_append(lb, &s->block, &s->block_size, &s->block_cap, (const char*)p, f->len) < 0) {
+                return -1;
+            }
+            if (!(f->flags & H2_F_END_HEADERS)) return 0;
+
+            uint32_t sid = s->cont_sid;
+            s->cont_sid = 0;
+            int ret = lb_h2_headers(lb, conn, sid, s->cont_flags, s->block, s->block_size);
+            lb_net_backlog_release(lb, &s->block, &s->block_cap);
+            s->block_size = 0;
+            return ret;
+        }
+
+        case H2_FT_PRIORITY:
+            if (f->sid == 0) return lb_h2_goaway(conn, H2_PROTOCOL_ERROR);
+            if (f->len != 5) return lb_h2_rst(conn, f->sid, H2_FRAME_SIZE_ERROR);
+            return 0;
+
+        case H2_FT_RST_STREAM: {
+            if (f->sid == 0 || f->sid > s->last_sid) return lb_h2_goaway(conn, H2_PROTOCOL_ERROR);
+            if (f->len != 4) return lb_h2_goaway(conn, H2_FRAME_SIZE_ERROR);
+            lb_h2_stream_t* st = lb_h2_stream_find(s, f->sid);
+            if (st) lb_h2_stream_release(conn, st, false);
+            return 0;
+        }
+
+        case H2_FT_SETTINGS:
+            if (f->sid != 0) return lb_h2_goaway(conn, H2_PROTOCOL_ERROR);
+            if (f->flags & H2_F_ACK) return f->len ? lb_h2_goaway(conn, H2_FRAME_SIZE_ERROR) : 0;
+            if (lb_h2_settings(conn, p, f->len) < 0) return -1;
+            if (lb_h2_frame(conn, H2_FT_SETTINGS, H2_F_ACK, 0, NULL, 0) < 0) return -1;
+            return lb_h2_run_all(lb, conn);
+
+        case H2_FT_PING:
+            if (f->sid != 0) return lb_h2_goaway(conn, H2_PROTOCOL_ERROR);
+            if (f->len != 8) return lb_h2_goaway(conn, H2_FRAME_SIZE_ERROR);
+            if (f->flags & H2_F_ACK) return 0;
+            return lb_h2_frame(conn, H2_FT_PING, H2_F_ACK, 0, p, 8);
+
+        case H2_FT_GOAWAY:
+            if (f->sid != 0) return lb_h2_goaway(conn, H2_PROTOCOL_ERROR);
+            s->goaway = true;   // Finish what is running, accept nothing new
+            return 0;
+
+        case H2_FT_WINDOW_UPDATE: {
+            if (f->len != 4) return lb_h2_goaway(conn, H2_FRAME_SIZE_ERROR);
+            uint32_t inc = lb_h2_get32(p) & 0x7fffffff;
+            if (f->sid == 0) {
+                if (inc == 0 || s->send_window + inc > H2_MAX_WINDOW) {
+                    return lb_h2_goaway(conn, inc ? H2_FLOW_CONTROL_ERROR : H2_PROTOCOL_ERROR);
+                }
+                s->send_window += inc;
+                return lb_h2_run_all(lb, conn);
+            }
+
+            lb_h2_stream_t* st = lb_h2_stream_find(s, f->sid);
+            if (!st) return 0;  // Closed stream, or a race with our END_STREAM
+            if (inc == 0 || (int64_t)st->send_window + inc > H2_MAX_WINDOW) {
+                int ret = lb_h2_rst(conn, f->sid, inc ? H2_FLOW_CONTROL_ERROR : H2_PROTOCOL_ERROR);
+                lb_h2_stream_release(conn, st, false);
+                return ret;
+            }
+            st->send_window += (int32_t)inc;
+            return st->fd >= 0 ? lb_h2_stream_run(lb, conn, st) : 0;
+        }
+
+        case H2_FT_PUSH_PROMISE:
+            return lb_h2_goaway(conn, H2_PROTOCOL_ERROR);
+
+        default:
+            return 0;   // Unknown frame types are ignored
+    }
+}
+
+// Parse every complete frame received so far
+static int lb_h2_process(loadbalancer_t* lb, lb_connection_t* conn) {
+    struct lb_h2_session* s = conn->h2;
+    int ret = 0;
+
+    while (ret == 0) {
+        const uint8_t* data = s->in + s->in_head;
+        size_t avail = s->in_size - s->in_head;
+
+        if (!s->preface) {
+            if (avail < H2_PREFACE_LEN) break;
+            if (memcmp(data, H2_PREFACE, H2_PREFACE_LEN) != 0) return lb_h2_goaway(conn, H2_PROTOCOL_ERROR);
+            s->in_head += H2_PREFACE_LEN;
+            s->preface = true;
+            continue;
+        }
+
+        if (avail < H2_FRAME_HDR_LEN) break;
+        struct h2_frame f;
+        h2_frame_decode(data, &f);
+        if (f.len > H2_DEFAULT_FRAME) return lb_h2_goaway(conn, H2_FRAME_SIZE_ERROR);
+        if (avail < H2_FRAME_HDR_LEN + f.len) break;
+
+        s->in_head += H2_FRAME_HDR_LEN + f.len;
+        ret = lb_h2_frame_in(lb, conn, &f, data + H2_FRAME_HDR_LEN);
+    }
+
+    if (s->in_head == s->in_size) {
+        s->in_head = s->in_size = 0;
+        lb_net_backlog_release(lb, &s->in, &s->in_cap);
+    } else if (s->in_head > 0) {
+        memmove(s->in, s->in + s->in_head, s->in_size - s->in_head);
+        s->in_size -= s->in_head;
+        s->in_head = 0;
+    }
+    return ret;
+}
+
+// Server connection preface: our SETTINGS, then a larger connection
+// window than the 64KB default
+static int lb_h2_start(loadbalancer_t* lb, lb_connection_t* conn) {
+    struct lb_h2_session* s = lb_calloc(1, sizeof(*s));
+    if (!s) return -1;
+
+    hpack_table_init(&s->dec);
+    hpack_table_init(&s->enc);
+    s->max_frame = H2_DEFAULT_FRAME;
+    s->initial_window = H2_DEFAULT_WINDOW;
+    s->send_window = H2_DEFAULT_WINDOW;
+    s->recv_window = H2_CONN_WINDOW;
+
+    // The bytes read so far move over as the session's input
+    s->in = conn->to_backend_buffer;
+    s->in_size = conn->to_backend_size;
+    s->in_cap = conn->to_backend_capacity;
+    conn->to_backend_buffer = NULL;
+    conn->to_backend_size = 0;
+    conn->to_backend_capacity = 0;
+
+    conn->h2 = s;
+    conn->is_http2 = true;
+
+    uint8_t settings[12];
+    settings[0] = 0;
+    settings[1] = H2_SET_MAX_CONCURRENT_STREAMS;
+    lb_h2_put32(settings + 2, H2_MAX_STREAMS);
+    settings[6] = 0;
+    settings[7] = H2_SET_MAX_HEADER_LIST_SIZE;
+    lb_h2_put32(settings + 8, HPACK_LIST_MAX);
+    if (lb_h2_frame(conn, H2_FT_SETTINGS, 0, 0, settings, sizeof(settings)) < 0 ||
+        lb_h2_window_update(conn, 0, H2_CONN_WINDOW - H2_DEFAULT_WINDOW) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static ssize_t lb_h2_base64url(const char* in, size_t len, uint8_t* out, size_t cap) {
+    uint32_t acc = 0;
+    int bits = 0;
+    size_t n = 0;
+
+    for (size_t i = 0; i < len && in[i] != '='; i++) {
+        int c = (unsigned char)in[i];
+        int v;
+        if (c >= 'A' && c <= 'Z') v = c - 'A';
+        else if (c >= 'a' && c <= 'z') v = c - 'a' + 26;
+        else if (c >= '0' && c <= '9') v = c - '0' + 52;
+        else if (c == '-' || c == '+') v = 62;
+        else if (c == '_' || c == '/') v = 63;
+        else return -1;
+
+        acc = (acc << 6) | (uint32_t)v;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            if (n >= cap) return -1;
+            out[n++] = (uint8_t)(acc >> bits);
+        }
+    }
+    return (ssize_t)n;
+}
+
+// Upgrade: h2c on the first request (RFC 7540 3.2). The request itself
+// becomes stream 1 and the client sends its preface after our 101.
+// Returns 1 when the connection switched, 0 when it stays HTTP/1.1.
+static int lb_h2_upgrade(loadbalancer_t* lb, lb_connection_t* conn, size_t head_len) {
+    struct buffer buf = {
+        .area = (char*)conn->to_backend_buffer,
+        .size = conn->to_backend_capacity,
+        .data = conn->to_backend_size,
+    };
+    // Spilled headers live only as long as this call
+    lb_arena_t* arena = lb_arena_local(LB_ARENA_HTTP);
+    lb_arena_mark_t mark = lb_arena_mark(arena);
+    http_msg_t msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.arena = arena;
+    http_msg_reset(&msg);
+
+    int switched = 0;
+    uint8_t settings[256];
+    ssize_t settings_len = -1;
+    const http_hdr_t* h2s = NULL;
+
+    if (http_msg_analyzer(&msg, &buf) == 1 && (msg.flags & HTTP_MSGF_UPGRADE_H2C) &&
+        !(msg.flags & HTTP_MSGF_TE_CHNK) && msg.body_len == 0 && msg.meth != HTTP_METH_CONNECT &&
+        (h2s = http_msg_find(&msg, &buf, "http2-settings")) != NULL) {
+        settings_len = lb_h2_base64url(http_slice_ptr(&buf, h2s->v), h2s->v.len, settings, sizeof(settings));
+    }
+    if (settings_len < 0) goto out;
+
+    // Stream 1 keeps the HTTP/1.1 head minus the upgrade negotiation
+    char head[H2_HEAD_MAX];
+    const char* data = buf.area;
+    const char* eol = memchr(data, '\n', head_len);
+    size_t n = (size_t)(eol + 1 - data);
+    if (n > sizeof(head)) goto out;
+    memcpy(head, data, n);
+    for (uint32_t i = 0; i < msg.hdr_count; i++) {
+        const http_hdr_t* h = http_msg_hdr(&msg, i);
+        const char* name = http_slice_ptr(&buf, h->n);
+        if ((h->n.len == 10 && strncasecmp(name, "connection", 10) == 0) ||
+            (h->n.len == 7 && strncasecmp(name, "upgrade", 7) == 0) ||
+            (h->n.len == 14 && strncasecmp(name, "http2-settings", 14) == 0)) {
+            continue;
+        }
+        if (n + h->n.len + h->v.len + 4 > sizeof(head)) goto out;
+        memcpy(head + n, name, h->n.len);
+        n += h->n.len;
+        memcpy(head + n, ": ", 2);
+        n += 2;
+        memcpy(head + n, http_slice_ptr(&buf, h->v), h->v.len);
+        n += h->v.len;
+        memcpy(head + n, "\r\n", 2);
+        n += 2;
+    }
+    if (n + 2 > sizeof(head)) goto out;
+    memcpy(head + n, "\r\n", 2);
+    n += 2;
+
+    static const char switching[] =
+        "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+    if (lb_h2_out(conn, switching, sizeof(switching) - 1) < 0) goto out;
+
+    // Whatever followed the head (the preface, usually) is session input
+    memmove(conn->to_backend_buffer, conn->to_backend_buffer + head_len, conn->to_backend_size - head_len);
+    conn->to_backend_size -= head_len;
+    if (lb_h2_start(lb, conn) < 0) {
+        switched = -1;
+        goto out;
+    }
+    switched = 1;
+
+    struct lb_h2_session* s = conn->h2;
+    if (lb_h2_settings(conn, settings, (size_t)settings_len) < 0) {
+        switched = -1;
+        goto out;
+    }
+
+    lb_h2_stream_t* st = lb_h2_stream_new(s, 1);
+    s->last_sid = 1;
+    st->req_done = true;
+    st->head_only = msg.meth == HTTP_METH_HEAD;
+    if (lb_h2_stream_queue(lb, st, head, n) < 0 || lb_h2_stream_open(lb, conn, st) < 0) switched = -1;
+
+out:
+    http_msg_release(&msg);
+    lb_arena_release(arena, mark);
+    return switched;
+}
+
+int lb_h2_probe(loadbalancer_t* lb, lb_connection_t* conn) {
+    const uint8_t* data = conn->to_backend_buffer;
+    size_t len = conn->to_backend_size;
+    size_t n = len < H2_PREFACE_LEN ? len : H2_PREFACE_LEN;
+
+    if (len == 0) return -1;
+    if (memcmp(data, H2_PREFACE, n) == 0) {
+        if (n < H2_PREFACE_LEN) return -1;
+        if (lb_h2_start(lb, conn) < 0) return -2;
+        LB_DEBUG("HTTP/2 connection (prior knowledge)");
+        return 1;
+    }
+
+    const char* end = memmem(data, len, "\r\n\r\n", 4);
+    if (!end) return len > H2_HEAD_MAX ? 0 : -1;
+    return lb_h2_upgrade(lb, conn, (size_t)(end + 4 - (const char*)data)) < 0 ? -2 : (conn->is_http2 ? 1 : 0);
+}
+
+// Leave the connection once the client said goodbye and nothing is left
+static int lb_h2_status(const lb_connection_t* conn) {
+    const struct lb_h2_session* s = conn->h2;
+    return (s->goaway && s->active == 0 && conn->to_client_size == 0) ? 0 : 1;
+}
+
+int lb_h2_client_read(loadbalancer_t* lb, lb_connection_t* conn) {
+    struct lb_h2_session* s = conn->h2;
+    char buffer[16384];
+    ssize_t n;
+
+    // Frames are parsed as they arrive so input never piles up
+    if (lb_h2_process(lb, conn) < 0) {
+        lb_h2_flush(lb, conn);
+        return 0;
+    }
+    while ((n = recv(conn->client_fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+        if (lb_net_backlog_append(lb, &s->in, &s->in_size, &s->in_cap, buffer, n) < 0) return -1;
+        if (lb_h2_process(lb, conn) < 0) {
+            lb_h2_flush(lb, conn);
+            return 0;
+        }
+    }
+
+    if (n == 0) {
+        LB_DEBUG("HTTP/2 client closed connection");
+        conn->client_eof = true;
+        return 0;
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+
+    if (lb_h2_flush(lb, conn) < 0) return -1;
+    return lb_h2_status(conn);
+}
+
+int lb_h2_client_write(loadbalancer_t* lb, lb_connection_t* conn) {
+    if (lb_h2_flush(lb, conn) < 0) return -1;
+
+    // Streams held back by a full client backlog can go on
+    if (conn->to_client_size < H2_CLIENT_BACKLOG) {
+        if (lb_h2_run_all(lb, conn) < 0 || lb_h2_flush(lb, conn) < 0) return -1;
+    }
+    return lb_h2_status(conn);
+}
+
+int lb_h2_upstream_event(loadbalancer_t* lb, epoll_data_wrapper_t* wrapper, uint32_t events) {
+    lb_connection_t* conn = (lb_connection_t*)wrapper->conn;
+    lb_h2_stream_t* st = (lb_h2_stream_t*)((char*)wrapper - offsetof(lb_h2_stream_t, wrapper));
+
+    // A slot reused within one epoll batch can see its old socket's events
+    if (st->id == 0 || st->fd != wrapper->fd) return 1;
+
+    int ret = 0;
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if ((events & EPOLLERR) && getsockopt(st->fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err) {
+        ret = lb_h2_stream_fail(lb, conn, st, err);
+    } else {
+        if (events & (EPOLLIN | EPOLLHUP)) st->readable = true;
+        ret = lb_h2_stream_run(lb, conn, st);
+    }
+
+    if (ret < 0 || lb_h2_flush(lb, conn) < 0) return -1;
+    return lb_h2_status(conn);
+}
+
+bool lb_h2_busy(const lb_connection_t* conn) {
+    return conn->h2 && conn->h2->active > 0;
+}
+
+void lb_h2_close(lb_connection_t* conn) {
+    struct lb_h2_session* s = conn->h2;
+    if (!s) return;
+
+    loadbalancer_t* lb = conn->worker->lb;
+    for (uint32_t i = 0; i < H2_MAX_STREAMS && s->active > 0; i++) {
+        if (s->streams[i].id != 0) lb_h2_stream_release(conn, &s->streams[i], false);
+    }
+    lb_net_backlog_release(lb, &s->in, &s->in_cap);
+    lb_net_backlog_release(lb, &s->block, &s->block_cap);
+    s->in_size = s->in_head = s->block_size = 0;
+}
+
+void lb_h2_free(lb_connection_t* conn) {
+    if (!conn->h2) return;
+    lb_h2_close(conn);
+    lb_free(conn->h2);
+    conn->h2 = NULL;
+}
@@ -1,8 +1,16 @@
 #include "core/loadbalancer.h"
+#include "core/lb_rcu.h"
+#include "core/lb_clock.h"
+#include "core/lb_stats.h"
+#include "core/lb_timer.h"
+#include "core/lb_topology.h"
+#include "utils/log.h"
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <ctype.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -28,7 +36,7 @@ static bool cleanup_queue_enqueue(cleanup_queue_t* queue, lb_connection_t* conn)
     // Check if queue is full
     if (next_tail == head) {
         pthread_mutex_unlock(&queue->lock);
-        fprintf(stderr, "[WARN] Cleanup queue full, immediate free\n");
+        log_warning("Cleanup queue full, immediate free");
         return false;
     }
 
@@ -61,45 +69,37 @@ static lb_connection_t* cleanup_queue_dequeue(cleanup_queue_t* queue) {
     return conn;
 }
 
+// Return a connection's backlog buffers to the shared pool and the struct to
+// the slab of the worker that allocated it
+static void lb_net_conn_free(lb_worker_t* worker, lb_connection_t* conn) {
+    lb_buffer_pool_t* pool = conn->worker->lb->buffer_pool;
+
+    lb_h2_free(conn);
+    buffer_pool_put(pool, conn->to_backend_buffer, conn->to_backend_capacity);
+    buffer_pool_put(pool, conn->to_client_buffer, conn->to_client_capacity);
+    conn->to_backend_buffer = NULL;
+    conn->to_client_buffer = NULL;
+
+    if (conn->worker == worker) {
+        slab_free(worker->conn_slab, conn);
+    } else {
+        slab_free_remote(conn->worker->conn_slab, conn);
+    }
+}
+
 // Process cleanup queue - drain and free all pending connections
-static void process_cleanup_queue(loadbalancer_t* lb) {
-    if (!lb || !lb->cleanup_queue) return;
+static void process_cleanup_queue(lb_worker_t* worker) {
+    if (!worker || !worker->cleanup_queue) return;
 
     lb_connection_t* conn;
     int count = 0;
-    while ((conn = cleanup_queue_dequeue(lb->cleanup_queue)) != NULL) {
-        // Free all connection resources with NULL checks to prevent double-free
-        if (conn->read_buffer) {
-            free(conn->read_buffer);
-            conn->read_buffer = NULL;
-        }
-        if (conn->write_buffer) {
-            free(conn->write_buffer);
-            conn->write_buffer = NULL;
-        }
-        if (conn->to_backend_buffer) {
-            free(conn->to_backend_buffer);
-            conn->to_backend_buffer = NULL;
-        }
-        if (conn->to_client_buffer) {
-            free(conn->to_client_buffer);
-            conn->to_client_buffer = NULL;
-        }
-        // Free wrappers - safe since FDs are closed and EPOLL_CTL_DEL done
-        if (conn->client_wrapper) {
-            free(conn->client_wrapper);
-            conn->client_wrapper = NULL;
-        }
-        if (conn->backend_wrapper) {
-            free(conn->backend_wrapper);
-            conn->backend_wrapper = NULL;
-        }
-        free(conn);
+    while ((conn = cleanup_queue_dequeue(worker->cleanup_queue)) != NULL) {
+        lb_net_conn_free(worker, conn);
         count++;
     }
 
     if (count > 0) {
-        fprintf(stderr, "[DEBUG] Cleaned up %d deferred connections\n", count);
+        LB_DEBUG("Cleaned up %d deferred connections", count);
     }
 }
 
@@ -109,216 +109,971 @@ int lb_net_set_nonblocking(int fd) {
     return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
 }
 
-static int lb_net_connect_to_backend(backend_t* backend) {
-    int sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+int lb_net_connect_to_backend(backend_t* backend) {
+    // Address comes from the resolver cache; never resolve on a worker
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    if (lb_dns_backend_addr(backend, &addr, &addr_len) < 0) return -1;
+
+    int sockfd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (sockfd < 0) return -1;
 
     int val = 1;
     setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
 
-    struct sockaddr_in addr = {
-        .sin_family = AF_INET,
-        .sin_port = htons(backend->port),
-    };
-
-    if (inet_pton(AF_INET, backend->host, &addr.sin_addr) <= 0) {
-        struct hostent* he = gethostbyname(backend->host);
-        if (!he) {
+    if (connect(sockfd, (struct sockaddr*)&addr, addr_len) < 0) {
+        if (errno != EINPROGRESS) {
             close(sockfd);
             return -1;
         }
-        memcpy(&addr.sin_addr, he->h_addr_list[0], he->h_length);
     }
 
-    if (connect(sockfd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-        if (errno != EINPROGRESS) {
-            close(sockfd);
-            return -1;
+    return sockfd;
+}
+
+// Per-worker pool of this backend's idle upstream sockets, or NULL when
+// pooling is off
+static upstream_pool_t* lb_net_upstream_pool(lb_worker_t* worker, backend_t* backend) {
+    if (backend->slot >= worker->upstream_pool_count) return NULL;
+    return &worker->upstream_pools[backend->slot];
+}
+
+// An idle upstream socket must have nothing to read: EOF means the backend
+// closed it, data means a response we do not own.
+static bool lb_net_upstream_alive(int fd) {
+    char byte;
+    ssize_t ret = recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    return ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+// Most recently parked socket first; stale or dead ones are closed on the way
+int lb_net_upstream_checkout(lb_worker_t* worker, backend_t* backend) {
+    upstream_pool_t* pool = lb_net_upstream_pool(worker, backend);
+    if (!pool) return -1;
+
+    uint64_t now = lb_now_ns();
+    uint64_t max_idle = (uint64_t)worker->lb->config.upstream_idle_timeout_ms * 1000000ULL;
+    while (pool->count > 0) {
+        pool->count--;
+        int fd = pool->fds[pool->count];
+        if (now - pool->idle_since_ns[pool->count] < max_idle && lb_net_upstream_alive(fd)) {
+            return fd;
         }
+        close(fd);
     }
+    return -1;
+}
 
-    return sockfd;
+bool lb_net_upstream_checkin(lb_worker_t* worker, backend_t* backend, int fd) {
+    upstream_pool_t* pool = lb_net_upstream_pool(worker, backend);
+    if (!pool || pool->count >= UPSTREAM_POOL_MAX) return false;
+
+    pool->fds[pool->count] = fd;
+    pool->idle_since_ns[pool->count] = lb_now_ns();
+    pool->count++;
+    return true;
 }
 
-static lb_connection_t* lb_net_conn_create(loadbalancer_t* lb) {
-    // Use malloc for simplicity and reliability
-    lb_connection_t* conn = (lb_connection_t*)calloc(1, sizeof(lb_connection_t));
-    if (!conn) {
-        fprintf(stderr, "[ERROR] Failed to allocate connection struct\n");
-        return NULL;
+// Drop idle sockets that timed out or were closed by the backend. Entries
+// are ordered oldest first, survivors keep their order.
+static void lb_net_upstream_expire(lb_worker_t* worker) {
+    loadbalancer_t* lb = worker->lb;
+    uint64_t now = lb_now_ns();
+    uint64_t max_idle = (uint64_t)lb->config.upstream_idle_timeout_ms * 1000000ULL;
+
+    for (uint32_t b = 0; b < lb->backend_count; b++) {
+        upstream_pool_t* pool = lb_net_upstream_pool(worker, lb->backends[b]);
+        if (!pool) continue;
+
+        uint32_t kept = 0;
+        for (uint32_t i = 0; i < pool->count; i++) {
+            int fd = pool->fds[i];
+            if (now - pool->idle_since_ns[i] >= max_idle || !lb_net_upstream_alive(fd)) {
+                close(fd);
+                continue;
+            }
+            pool->fds[kept] = fd;
+            pool->idle_since_ns[kept] = pool->idle_since_ns[i];
+            kept++;
+        }
+        pool->count = kept;
     }
+}
+
+static int lb_net_worker_setup(lb_worker_t* worker) {
+    loadbalancer_t* lb = worker->lb;
+
+    worker->timers = lb_timer_wheel_create(lb_now_ms());
+    if (!worker->timers) return -1;
+    if (lb_stats_init(&worker->stats, lb->backend_count) < 0) return -1;
+
+    // Pools need sharded workers so a connection is only ever touched by
+    // the worker that owns the pool
+    if (lb->config.upstream_keepalive && lb->config.worker_sharding && lb->backend_count) {
+        void* pools = NULL;
+        size_t size = lb->backend_count * sizeof(upstream_pool_t);
+        if (posix_memalign(&pools, CACHE_LINE_SIZE, size) != 0) return -1;
+        memset(pools, 0, size);
+        worker->upstream_pools = pools;
+        worker->upstream_pool_count = lb->backend_count;
+    }
+    return 0;
+}
+
+int lb_net_worker_init(lb_worker_t* worker) {
+    int state = atomic_load(&worker->init_state);
+    if (state != 0) return state > 0 ? 0 : -1;
 
-    conn->read_buffer = (uint8_t*)malloc(BUFFER_SIZE);
-    conn->write_buffer = (uint8_t*)malloc(BUFFER_SIZE);
-    conn->client_wrapper = (epoll_data_wrapper_t*)malloc(sizeof(epoll_data_wrapper_t));
-    conn->backend_wrapper = (epoll_data_wrapper_t*)malloc(sizeof(epoll_data_wrapper_t));
+    if (lb_net_worker_setup(worker) < 0) {
+        fprintf(stderr, "[ERROR] Worker %u could not allocate its local state\n", worker->id);
+        atomic_store(&worker->init_state, -1);
+        return -1;
+    }
+    atomic_store(&worker->init_state, 1);
+    return 0;
+}
+
+void lb_net_upstream_pools_destroy(loadbalancer_t* lb) {
+    if (!lb->worker_ctx) return;
+    for (uint32_t w = 0; w < lb->worker_threads; w++) {
+        upstream_pool_t* pools = lb->worker_ctx[w].upstream_pools;
+        if (!pools) continue;
+        for (uint32_t b = 0; b < lb->worker_ctx[w].upstream_pool_count; b++) {
+            for (uint32_t i = 0; i < pools[b].count; i++) {
+                close(pools[b].fds[i]);
+            }
+        }
+        free(pools);
+        lb->worker_ctx[w].upstream_pools = NULL;
+    }
+}
+
+// Minimal HTTP/1.1 framing for upstream reuse, run on both directions.
+// Anything it does not fully understand (HEAD, CONNECT, HTTP/1.0, upgrades,
+// close-delimited bodies, heads split across reads) clears
+// upstream_reusable for good.
+static bool lb_net_header_is(const char* line, size_t len, const char* name) {
+    size_t n = strlen(name);
+    return len > n && strncasecmp(line, name, n) == 0;
+}
+
+// Parse one complete message head. Returns its length, 0 when reuse is no
+// longer possible.
+static size_t lb_net_track_head(http_track_t* t, const char* data, size_t len, bool response) {
+    const char* end = memmem(data, len, "\r\n\r\n", 4);
+    if (!end) return 0;
+
+    const char* eol = memchr(data, '\r', end + 2 - data);
+    size_t first_len = eol - data;
+    int status = 0;
+
+    if (response) {
+        if (first_len < 12 || strncmp(data, "HTTP/1.1 ", 9) != 0) return 0;
+        status = atoi(data + 9);
+        if (status == 101) return 0;
+    } else {
+        if (first_len < 9 || strncmp(eol - 9, " HTTP/1.1", 9) != 0) return 0;
+        if (strncmp(data, "HEAD ", 5) == 0 || strncmp(data, "CONNECT ", 8) == 0) return 0;
+    }
 
-    // Check all allocations succeeded
-    if (!conn->read_buffer || !conn->write_buffer || !conn->client_wrapper || !conn->backend_wrapper) {
-        fprintf(stderr, "[ERROR] Failed to allocate connection buffers\n");
-        free(conn->backend_wrapper);
-        free(conn->client_wrapper);
-        free(conn->write_buffer);
-        free(conn->read_buffer);
-        free(conn);
+    bool chunked = false;
+    bool has_length = false;
+    uint64_t length = 0;
+
+    const char* line = eol + 2;
+    while (line < end) {
+        eol = memchr(line, '\r', end + 2 - line);
+        size_t line_len = eol - line;
+
+        if (lb_net_header_is(line, line_len, "content-length:")) {
+            has_length = true;
+            length = strtoull(line + 15, NULL, 10);
+        } else if (lb_net_header_is(line, line_len, "transfer-encoding:")) {
+            chunked = memmem(line, line_len, "chunked", 7) != NULL;
+        } else if (lb_net_header_is(line, line_len, "connection:")) {
+            if (memmem(line, line_len, "close", 5)) return 0;
+        } else if (lb_net_header_is(line, line_len, "upgrade:")) {
+            return 0;
+        }
+        line = eol + 2;
+    }
+
+    size_t head_len = (size_t)(end + 4 - data);
+    if (response && status < 200) return head_len;  // Interim, the real one follows
+
+    // Never a body, whatever the headers say; a 304 keeps the
+    // Content-Length of the representation it stands for
+    if (response && (status == 204 || status == 304)) {
+        t->messages++;
+        return head_len;
+    }
+
+    if (chunked) {
+        t->state = HTTP_TRACK_CHUNK_SIZE;
+        t->remaining = 0;
+    } else if (has_length && length > 0) {
+        t->state = HTTP_TRACK_BODY;
+        t->remaining = length;
+    } else if (!response || has_length) {
+        t->messages++;
+    } else {
+        return 0;  // Body runs until the backend closes
+    }
+    return head_len;
+}
+
+// Feed bytes through the tracker. With one_message it stops right after
+// the end of the message in progress; returns the bytes consumed.
+size_t lb_net_track(lb_connection_t* conn, http_track_t* t, const char* data,
+                           size_t len, bool response, bool one_message) {
+    size_t pos = 0;
+    uint32_t start = t->messages;
+
+    while (conn->upstream_reusable && pos < len && !(one_message && t->messages != start)) {
+        switch (t->state) {
+            case HTTP_TRACK_IDLE: {
+                size_t head = lb_net_track_head(t, data + pos, len - pos, response);
+                if (head == 0) {
+                    conn->upstream_reusable = false;
+                    return pos;
+                }
+                pos += head;
+                break;
+            }
+
+            case HTTP_TRACK_BODY:
+            case HTTP_TRACK_CHUNK_DATA: {
+                uint64_t take = len - pos;
+                if (take > t->remaining) take = t->remaining;
+                t->remaining -= take;
+                pos += take;
+                if (t->remaining == 0) {
+                    if (t->state == HTTP_TRACK_BODY) {
+                        t->messages++;
+                        t->state = HTTP_TRACK_IDLE;
+                    } else {
+                        t->state = HTTP_TRACK_CHUNK_END;
+                    }
+                }
+                break;
+            }
+
+            case HTTP_TRACK_CHUNK_SIZE: {
+                char c = data[pos++];
+                if (isxdigit((unsigned char)c)) {
+                    int digit = isdigit((unsigned char)c) ? c - '0' : tolower((unsigned char)c) - 'a' + 10;
+                    t->remaining = t->remaining * 16 + digit;
+                } else if (c == ';') {
+                    t->state = HTTP_TRACK_CHUNK_EXT;
+                } else if (c == '\n') {
+                    t->state = t->remaining ? HTTP_TRACK_CHUNK_DATA : HTTP_TRACK_TRAILERS;
+                } else if (c != '\r') {
+                    conn->upstream_reusable = false;
+                }
+                break;
+            }
+
+            case HTTP_TRACK_CHUNK_EXT:
+                if (data[pos++] == '\n') {
+                    t->state = t->remaining ? HTTP_TRACK_CHUNK_DATA : HTTP_TRACK_TRAILERS;
+                }
+                break;
+
+            case HTTP_TRACK_CHUNK_END:
+                if (data[pos++] == '\n') {
+                    t->state = HTTP_TRACK_CHUNK_SIZE;
+                    t->remaining = 0;
+                }
+                break;
+
+            case HTTP_TRACK_TRAILERS: {
+                // remaining counts bytes on the current trailer line
+                char c = data[pos++];
+                if (c == '\n') {
+                    if (t->remaining == 0) {
+                        t->messages++;
+                        t->state = HTTP_TRACK_IDLE;
+                    }
+                    t->remaining = 0;
+                } else if (c != '\r') {
+                    t->remaining++;
+                }
+                break;
+            }
+        }
+    }
+    return pos;
+}
+
+// Park the backend socket in the worker's pool if the client went away
+// between exchanges. Returns true when the socket was kept.
+static bool lb_net_upstream_release(lb_worker_t* worker, lb_connection_t* conn) {
+    if (!conn->upstream_reusable || !conn->backend || !conn->client_eof || conn->backend_eof) {
+        return false;
+    }
+    if (conn->req_track.state != HTTP_TRACK_IDLE || conn->resp_track.state != HTTP_TRACK_IDLE ||
+        conn->resp_track.messages == 0 || conn->req_track.messages != conn->resp_track.messages) {
+        return false;
+    }
+    if (conn->to_backend_size > 0 || conn->to_client_size > 0) return false;
+
+    return lb_net_upstream_checkin(worker, conn->backend, conn->backend_fd);
+}
+
+static void lb_net_splice_close(lb_connection_t* conn) {
+    for (int i = 0; i < 2; i++) {
+        if (conn->splice_c2b[i] >= 0) close(conn->splice_c2b[i]);
+        if (conn->splice_b2c[i] >= 0) close(conn->splice_b2c[i]);
+        conn->splice_c2b[i] = -1;
+        conn->splice_b2c[i] = -1;
+    }
+    conn->splice_c2b_len = 0;
+    conn->splice_b2c_len = 0;
+}
+
+// Algorithms that pick a backend from request content need the bytes in
+// user space, so those connections stay on the copy path.
+static bool lb_net_requires_l7(const loadbalancer_t* lb) {
+    switch (lb->algorithm) {
+        case LB_ALGO_URI:
+        case LB_ALGO_URL_PARAM:
+        case LB_ALGO_HDR:
+        case LB_ALGO_RDP_COOKIE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static lb_connection_t* lb_net_conn_create(lb_worker_t* worker) {
+    // Zeroed slab object; backlog buffers are attached only when needed
+    lb_connection_t* conn = (lb_connection_t*)slab_alloc(worker->conn_slab);
+    if (!conn) {
+        log_error("Failed to allocate connection struct");
         return NULL;
     }
 
     conn->client_fd = -1;
     conn->backend_fd = -1;
     conn->state = STATE_DISCONNECTED;
-    conn->to_backend_buffer = NULL;
-    conn->to_backend_size = 0;
-    conn->to_backend_capacity = 0;
-    conn->to_client_buffer = NULL;
-    conn->to_client_size = 0;
-    conn->to_client_capacity = 0;
+    conn->worker = worker;
+    conn->splice_c2b[0] = conn->splice_c2b[1] = -1;
+    conn->splice_b2c[0] = conn->splice_b2c[1] = -1;
 
-    memset(conn->client_wrapper, 0, sizeof(epoll_data_wrapper_t));
-    conn->client_wrapper->type = SOCKET_TYPE_CLIENT;
-    conn->client_wrapper->conn = conn;
-    conn->client_wrapper->fd = -1;
+    conn->client_wrapper.type = SOCKET_TYPE_CLIENT;
+    conn->client_wrapper.conn = conn;
+    conn->client_wrapper.fd = -1;
 
-    memset(conn->backend_wrapper, 0, sizeof(epoll_data_wrapper_t));
-    conn->backend_wrapper->type = SOCKET_TYPE_BACKEND;
-    conn->backend_wrapper->conn = conn;
-    conn->backend_wrapper->fd = -1;
+    conn->backend_wrapper.type = SOCKET_TYPE_BACKEND;
+    conn->backend_wrapper.conn = conn;
+    conn->backend_wrapper.fd = -1;
 
     return conn;
 }
 
-static void lb_net_conn_destroy(loadbalancer_t* lb, lb_connection_t* conn) {
+static void lb_net_conn_destroy(lb_connection_t* conn) {
     if (!conn) return;
 
+    int epfd = conn->worker->epfd;
     if (conn->client_fd >= 0) {
-        epoll_ctl(lb->epfd, EPOLL_CTL_DEL, conn->client_fd, NULL);
+        epoll_ctl(epfd, EPOLL_CTL_DEL, conn->client_fd, NULL);
         close(conn->client_fd);
         conn->client_fd = -1;
     }
     if (conn->backend_fd >= 0) {
-        epoll_ctl(lb->epfd, EPOLL_CTL_DEL, conn->backend_fd, NULL);
+        epoll_ctl(epfd, EPOLL_CTL_DEL, conn->backend_fd, NULL);
         close(conn->backend_fd);
         conn->backend_fd = -1;
     }
 
+    lb_net_splice_close(conn);
+
     if (conn->backend) {
-        atomic_fetch_sub(&conn->backend->active_conns, 1);
+        lb_request_abort(conn);
+        lb_backend_conn_put(conn->worker->lb, conn->backend);
         conn->backend = NULL;
     }
 
-    // Free buffers and mark as NULL to prevent double-free
-    if (conn->read_buffer) {
-        free(conn->read_buffer);
-        conn->read_buffer = NULL;
+    lb_net_conn_free(conn->worker, conn);
+}
+
+// Queue bytes that the peer could not take yet. The backlog buffer comes
+// from the shared pool and is moved up a size class when it fills.
+int lb_net_backlog_append(loadbalancer_t* lb, uint8_t** buf, size_t* size,
+                          size_t* capacity, const char* data, size_t len) {
+    if (*capacity < *size + len) {
+        // Grow at least geometrically once past the largest pooled class
+        size_t want = *size + len;
+        if (want < *capacity * 2) want = *capacity * 2;
+
+        size_t new_cap;
+        uint8_t* new_buf = buffer_pool_get(lb->buffer_pool, want, &new_cap);
+        if (!new_buf) return -1;
+
+        if (*size > 0) memcpy(new_buf, *buf, *size);
+        buffer_pool_put(lb->buffer_pool, *buf, *capacity);
+        *buf = new_buf;
+        *capacity = new_cap;
     }
-    if (conn->write_buffer) {
-        free(conn->write_buffer);
-        conn->write_buffer = NULL;
+
+    memcpy(*buf + *size, data, len);
+    *size += len;
+    return 0;
+}
+
+// Hand a drained backlog back so idle connections hold no buffer memory
+void lb_net_backlog_release(loadbalancer_t* lb, uint8_t** buf, size_t* capacity) {
+    buffer_pool_put(lb->buffer_pool, *buf, *capacity);
+    *buf = NULL;
+    *capacity = 0;
+}
+
+// Backlog watermarks: reading from a peer stops once this much is queued
+// for the other side and resumes when it drains below LOW, so a fast
+// sender costs at most HIGH bytes however much it sends
+#define BACKLOG_HIGH (256 * 1024)
+#define BACKLOG_LOW  (64 * 1024)
+
+static bool lb_net_read_paused(const lb_connection_t* conn, bool* paused, size_t backlog) {
+    if (!conn->backpressure) return false;
+    if (*paused && backlog <= BACKLOG_LOW) *paused = false;
+    if (!*paused && backlog >= BACKLOG_HIGH) *paused = true;
+    return *paused;
+}
+
+// Client bytes the backend socket should take now. In L7 mode pipelined
+// requests behind the one in flight are held, not pending.
+static size_t lb_net_backend_pending(const lb_connection_t* conn) {
+    return (conn->l7 ? conn->l7_fwd : conn->to_backend_size) + conn->splice_c2b_len;
+}
+
+// Bring one socket's edge-triggered registration in line with what the
+// connection needs: EPOLLIN unless reading is paused or the peer sent EOF,
+// EPOLLOUT only while output is queued for it. Re-registering also makes
+// epoll report data that arrived while EPOLLIN was off.
+static void lb_net_et_update(lb_connection_t* conn, socket_type_t side) {
+    bool client = (side == SOCKET_TYPE_CLIENT);
+    int fd = client ? conn->client_fd : conn->backend_fd;
+    epoll_data_wrapper_t* wrapper = client ? &conn->client_wrapper : &conn->backend_wrapper;
+    if (fd < 0) return;
+
+    bool eof = client ? conn->client_eof : conn->backend_eof;
+    bool paused = client ? conn->client_read_paused : conn->backend_read_paused;
+    size_t pending = client ? conn->to_client_size + conn->splice_b2c_len
+                            : lb_net_backend_pending(conn);
+
+    uint32_t events = EPOLLET;
+    if (!eof && !paused) events |= EPOLLIN;
+    if (pending > 0) events |= EPOLLOUT;
+    if (events == wrapper->events) return;
+
+    struct epoll_event ev = { .events = events, .data.ptr = wrapper };
+    if (epoll_ctl(conn->worker->epfd, EPOLL_CTL_MOD, fd, &ev) == 0) {
+        wrapper->events = events;
     }
-    if (conn->to_backend_buffer) {
-        free(conn->to_backend_buffer);
-        conn->to_backend_buffer = NULL;
+}
+
+// Level-triggered counterpart: re-arm one socket's EPOLLONESHOT
+// registration with what the connection needs now
+static void lb_net_lt_arm(lb_connection_t* conn, socket_type_t side) {
+    bool client = (side == SOCKET_TYPE_CLIENT);
+    int fd = client ? conn->client_fd : conn->backend_fd;
+    epoll_data_wrapper_t* wrapper = client ? &conn->client_wrapper : &conn->backend_wrapper;
+    if (fd < 0) return;
+
+    bool eof = client ? conn->client_eof : conn->backend_eof;
+    bool paused = client ? conn->client_read_paused : conn->backend_read_paused;
+    size_t pending = client ? conn->to_client_size + conn->splice_b2c_len
+                            : lb_net_backend_pending(conn);
+
+    uint32_t events = EPOLLONESHOT;
+    if (!eof && !paused) events |= EPOLLIN;
+    if (pending > 0) events |= EPOLLOUT;
+
+    struct epoll_event ev = { .events = events, .data.ptr = wrapper };
+    if (epoll_ctl(conn->worker->epfd, EPOLL_CTL_MOD, fd, &ev) == 0) {
+        wrapper->events = events;
     }
-    if (conn->to_client_buffer) {
-        free(conn->to_client_buffer);
-        conn->to_client_buffer = NULL;
+}
+
+// A level-triggered reader paused on a full backlog was left without
+// EPOLLIN, so the side that drained the backlog re-arms it
+static void lb_net_lt_resume(lb_connection_t* conn, socket_type_t side) {
+    bool client = (side == SOCKET_TYPE_CLIENT);
+    epoll_data_wrapper_t* wrapper = client ? &conn->client_wrapper : &conn->backend_wrapper;
+    bool* paused = client ? &conn->client_read_paused : &conn->backend_read_paused;
+    size_t backlog = client ? conn->to_backend_size : conn->to_client_size;
+    bool eof = client ? conn->client_eof : conn->backend_eof;
+
+    if (!conn->backpressure || eof || (wrapper->events & EPOLLIN)) return;
+    if (!lb_net_read_paused(conn, paused, backlog)) lb_net_lt_arm(conn, side);
+}
+
+// Interest for a socket that was just added to the worker's epoll
+static uint32_t lb_net_initial_events(const lb_connection_t* conn) {
+    return conn->edge_triggered ? (EPOLLIN | EPOLLET) : (EPOLLIN | EPOLLONESHOT);
+}
+
+// Select a backend, open a non-blocking connection to it and register the
+// socket on the owning worker's epoll instance.
+static int lb_net_attach_backend(loadbalancer_t* lb, lb_connection_t* conn) {
+    LB_DEBUG("No backend connection, creating one");
+    backend_t* backend = lb_select_backend(lb, &conn->client_addr);
+    if (!backend) {
+        LB_DEBUG("No backend available");
+        return -1;
     }
-    // Free wrappers - safe since FDs are closed and EPOLL_CTL_DEL done
-    if (conn->client_wrapper) {
-        free(conn->client_wrapper);
-        conn->client_wrapper = NULL;
+
+    conn->backend_fd = lb_net_upstream_checkout(conn->worker, backend);
+    if (conn->backend_fd < 0) {
+        conn->backend_fd = lb_net_connect_to_backend(backend);
+        conn->state = STATE_CONNECTING;
     }
-    if (conn->backend_wrapper) {
-        free(conn->backend_wrapper);
-        conn->backend_wrapper = NULL;
+    if (conn->backend_fd < 0) {
+        LB_DEBUG("Failed to connect to backend");
+        atomic_fetch_add(&backend->failed_conns, 1);
+        lb_outlier_report(lb, backend, LB_OUTCOME_CONNECT_FAIL);
+        LB_STAT_ADD(lb, failed_requests, 1);
+        return -1;
     }
-    free(conn);
+
+    LB_DEBUG("Connected to backend fd=%d", conn->backend_fd);
+
+    conn->backend = backend;
+    lb_backend_conn_get(lb, backend);
+    atomic_fetch_add(&backend->total_conns, 1);
+
+    // Register backend socket with epoll (EPOLLONESHOT, or EPOLLET)
+    conn->backend_wrapper.fd = conn->backend_fd;
+    conn->backend_wrapper.events = lb_net_initial_events(conn);
+    struct epoll_event ev = {
+        .events = conn->backend_wrapper.events,
+        .data.ptr = &conn->backend_wrapper
+    };
+    if (epoll_ctl(conn->worker->epfd, EPOLL_CTL_ADD, conn->backend_fd, &ev) < 0) {
+        perror("epoll_ctl backend");
+        return -1;
+    }
+    LB_DEBUG("Registered backend socket with epoll");
+
+    return 0;
 }
 
+// L7 mode holds pipelined requests on the client side: a head that never
+// ends, or a client that keeps sending while its oldest request is still
+// being answered, is cut off at these sizes.
+#define L7_HEAD_MAX (64 * 1024)
+#define L7_HOLD_MAX (1024 * 1024)
+
+// Send the request in flight (the first l7_fwd bytes of the backlog) and
+// keep the rest queued behind it
+static int lb_net_l7_flush(loadbalancer_t* lb, lb_connection_t* conn) {
+    while (conn->l7_fwd > 0) {
+        ssize_t sent = send(conn->backend_fd, conn->to_backend_buffer, conn->l7_fwd, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            LB_DEBUG("Error sending request to backend: %s", strerror(errno));
+            conn->backend_errno = errno;
+            return -1;
+        }
+        memmove(conn->to_backend_buffer, conn->to_backend_buffer + sent, conn->to_backend_size - sent);
+        conn->to_backend_size -= sent;
+        conn->l7_fwd -= sent;
+        LB_STAT_ADD(lb, bytes_in, sent);
+        lb_stat_backend_bytes(conn->backend, 0, sent);
+    }
+
+    if (conn->to_backend_size == 0) {
+        lb_net_backlog_release(lb, &conn->to_backend_buffer, &conn->to_backend_capacity);
+    }
+    if (!conn->edge_triggered) {
+        struct epoll_event ev = {
+            .events = EPOLLIN | EPOLLONESHOT | (conn->l7_fwd > 0 ? EPOLLOUT : 0),
+            .data.ptr = &conn->backend_wrapper
+        };
+        epoll_ctl(conn->worker->epfd, EPOLL_CTL_MOD, conn->backend_fd, &ev);
+    }
+    return 1;
+}
+
+// Framing the tracker does not follow pins the connection to its current
+// backend: everything queued goes there as it arrives
+static void lb_net_l7_tunnel(lb_connection_t* conn) {
+    LB_DEBUG("L7 framing lost, forwarding as a plain stream");
+    conn->l7_tunnel = true;
+    conn->l7_fwd = conn->to_backend_size;
+}
+
+// Classify queued client bytes until the request at the front is complete,
+// then make sure it has a backend and is on its way
+static int lb_net_l7_advance(loadbalancer_t* lb, lb_connection_t* conn) {
+    if (conn->l7_tunnel) {
+        conn->l7_fwd = conn->to_backend_size;
+    }
+    while (!conn->l7_tunnel && conn->req_track.messages == 0 &&
+           conn->l7_fwd < conn->to_backend_size) {
+        const char* data = (const char*)conn->to_backend_buffer + conn->l7_fwd;
+        size_t avail = conn->to_backend_size - conn->l7_fwd;
+
+        // The tracker needs a whole head at once
+        if (conn->req_track.state == HTTP_TRACK_IDLE && !memmem(data, avail, "\r\n\r\n", 4)) {
+            if (avail > L7_HEAD_MAX) return -1;
+            break;
+        }
+        conn->l7_fwd += lb_net_track(conn, &conn->req_track, data, avail, false, true);
+        if (!conn->upstream_reusable) lb_net_l7_tunnel(conn);
+    }
+
+    if (conn->l7_fwd == 0 && conn->backend_fd < 0) return 1;
+    if (conn->to_backend_size - conn->l7_fwd > L7_HOLD_MAX) return -1;
+
+    if (conn->backend_fd < 0 && lb_net_attach_backend(lb, conn) < 0) return -1;
+    if (conn->l7_fwd > 0) lb_request_sent(conn);
+    return lb_net_l7_flush(lb, conn);
+}
+
+// Body bytes of the request in flight go from the read buffer straight to
+// the backend when nothing is queued ahead of them, so a long upload is
+// never copied into the backlog while the backend keeps up. Returns the
+// bytes of data taken (sent, or queued as in flight), -1 on a send error.
+static ssize_t lb_net_l7_direct(loadbalancer_t* lb, lb_connection_t* conn, const char* data, size_t len) {
+    if (conn->backend_fd < 0 || conn->state != STATE_CONNECTED || conn->to_backend_size > 0) return 0;
+
+    size_t take = len;
+    if (!conn->l7_tunnel) {
+        if (conn->req_track.messages > 0 || conn->req_track.state == HTTP_TRACK_IDLE) return 0;
+        take = lb_net_track(conn, &conn->req_track, data, len, false, true);
+        if (!conn->upstream_reusable) {
+            lb_net_l7_tunnel(conn);
+            take = len;
+        }
+    }
+
+    size_t sent = 0;
+    while (sent < take) {
+        ssize_t n = send(conn->backend_fd, data + sent, take - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            LB_DEBUG("Error sending request body to backend: %s", strerror(errno));
+            conn->backend_errno = errno;
+            return -1;
+        }
+        sent += n;
+    }
+    LB_STAT_ADD(lb, bytes_in, sent);
+    lb_stat_backend_bytes(conn->backend, 0, sent);
+
+    // The unsent part is still in flight, ahead of anything held
+    if (sent < take && lb_net_backlog_append(lb, &conn->to_backend_buffer, &conn->to_backend_size,
+                                             &conn->to_backend_capacity, data + sent, take - sent) < 0) {
+        return -1;
+    }
+    conn->l7_fwd += take - sent;
+    return (ssize_t)take;
+}
+
+// Both sides reached a message boundary and nothing of the next request
+// has been sent yet
+static bool lb_net_l7_exchange_done(const lb_connection_t* conn) {
+    return conn->upstream_reusable && conn->l7_fwd == 0 &&
+           conn->req_track.messages > 0 && conn->resp_track.messages >= conn->req_track.messages &&
+           conn->req_track.state == HTTP_TRACK_IDLE && conn->resp_track.state == HTTP_TRACK_IDLE;
+}
+
+// The response is complete: park the backend socket and start the next
+// held request, which selects a backend of its own. Returns 0 when the
+// client has gone and nothing is left to deliver.
+static int lb_net_l7_finish(loadbalancer_t* lb, lb_connection_t* conn) {
+    lb_worker_t* worker = conn->worker;
+
+    epoll_ctl(worker->epfd, EPOLL_CTL_DEL, conn->backend_fd, NULL);
+    if (conn->backend_eof || !lb_net_upstream_checkin(worker, conn->backend, conn->backend_fd)) {
+        close(conn->backend_fd);
+    }
+    conn->backend_fd = -1;
+    conn->backend_wrapper.fd = -1;
+    conn->backend_wrapper.events = 0;
+
+    lb_request_abort(conn);
+    lb_backend_conn_put(lb, conn->backend);
+    conn->backend = NULL;
+    conn->state = STATE_CONNECTED;
+    conn->backend_eof = false;
+    conn->backend_errno = 0;
+    conn->backend_read_paused = false;
+    memset(&conn->req_track, 0, sizeof(conn->req_track));
+    memset(&conn->resp_track, 0, sizeof(conn->resp_track));
+
+    if (lb_net_l7_advance(lb, conn) < 0) return -1;
+
+    // Held requests may have paused the client; let it resume now
+    lb_net_read_paused(conn, &conn->client_read_paused, conn->to_backend_size);
+
+    if (conn->client_eof && !conn->backend && conn->to_client_size == 0) return 0;
+    return 1;
+}
+
+static int lb_net_l7_client_to_backend(loadbalancer_t* lb, lb_connection_t* conn) {
+    char buffer[16384];
+    ssize_t bytes_read = 1;
+
+    if (conn->backend_fd >= 0 && lb_net_l7_flush(lb, conn) < 0) return -1;
+
+    while (!lb_net_read_paused(conn, &conn->client_read_paused, conn->to_backend_size) &&
+           (bytes_read = recv(conn->client_fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+        LB_DEBUG("Read %zd bytes from client", bytes_read);
+        ssize_t direct = lb_net_l7_direct(lb, conn, buffer, bytes_read);
+        if (direct < 0) return -1;
+        if (direct < bytes_read &&
+            lb_net_backlog_append(lb, &conn->to_backend_buffer, &conn->to_backend_size,
+                                  &conn->to_backend_capacity, buffer + direct, bytes_read - direct) < 0) {
+            LB_DEBUG("Failed to allocate to_backend_buffer");
+            return -1;
+        }
+    }
+
+    if (bytes_read == 0) {
+        LB_DEBUG("Client closed connection");
+        conn->client_eof = true;
+    } else if (bytes_read < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        LB_DEBUG("Error reading from client: %s", strerror(errno));
+        return -1;
+    }
+
+    // Connection preface or h2c Upgrade in the first bytes
+    if (lb->config.http2 && !conn->h2_probed) {
+        int h2 = lb_h2_probe(lb, conn);
+        if (h2 == -2) return -1;
+        if (h2 == -1 && !conn->client_eof) return 1;
+        conn->h2_probed = true;
+        if (h2 > 0) return lb_h2_client_read(lb, conn);
+    }
+
+    if (lb_net_l7_advance(lb, conn) < 0) return -1;
+
+    // Between exchanges with nothing left to answer
+    if (conn->client_eof && !conn->backend && conn->to_client_size == 0) return 0;
+    return 1;
+}
+
+#ifdef USE_SPLICE
+int handle_client_to_backend(loadbalancer_t* lb, lb_connection_t* conn);
+
+// Re-arm one side of a spliced connection. Reads stop once that side has
+// sent EOF; writes are only requested while its pipe still holds data.
+static void lb_net_splice_arm(lb_connection_t* conn, socket_type_t side) {
+    if (conn->edge_triggered) return;  // Worker loop keeps EPOLLET interest current
+
+    bool client = (side == SOCKET_TYPE_CLIENT);
+    int fd = client ? conn->client_fd : conn->backend_fd;
+    if (fd < 0) return;
+
+    uint32_t events = EPOLLONESHOT;
+    if (!(client ? conn->client_eof : conn->backend_eof)) events |= EPOLLIN;
+    if (client ? conn->splice_b2c_len > 0 : conn->splice_c2b_len > 0) events |= EPOLLOUT;
+
+    struct epoll_event ev = {
+        .events = events,
+        .data.ptr = client ? &conn->client_wrapper : &conn->backend_wrapper
+    };
+    epoll_ctl(conn->worker->epfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+// Move bytes in_fd -> pipe -> out_fd without copying them to user space.
+// The pipe doubles as the backlog buffer: it is always drained into out_fd
+// before more is pulled from in_fd, so it never exceeds MAX_SPLICE_SIZE.
+// Returns 1 while the stream is open, 0 once in_fd hit EOF and the pipe is
+// empty, -1 on error with *failed_fd set to the descriptor that failed.
+// *moved is the number of bytes delivered to out_fd.
+static int lb_net_splice_pump(int in_fd, int out_fd, int pipe_fds[2], size_t* pipe_len,
+                              bool* eof, size_t* moved, int* failed_fd) {
+    *moved = 0;
+
+    for (;;) {
+        while (*pipe_len > 0) {
+            ssize_t n = splice(pipe_fds[0], NULL, out_fd, NULL, *pipe_len,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n > 0) {
+                *pipe_len -= n;
+                *moved += n;
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return 1;  // out_fd is full, wait for EPOLLOUT
+            }
+            *failed_fd = out_fd;
+            return -1;
+        }
+
+        if (*eof) return 0;
+
+        ssize_t n = splice(in_fd, NULL, pipe_fds[1], NULL, MAX_SPLICE_SIZE,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0) {
+            *pipe_len += n;
+        } else if (n == 0) {
+            *eof = true;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 1;
+        } else {
+            *failed_fd = in_fd;
+            return -1;
+        }
+    }
+}
+
+// Lazily open the pipe pairs when the backend is attached. If the process is
+// out of descriptors the connection simply stays on the copy path.
+static void lb_net_splice_setup(lb_connection_t* conn) {
+    if (pipe2(conn->splice_c2b, O_NONBLOCK | O_CLOEXEC) < 0 ||
+        pipe2(conn->splice_b2c, O_NONBLOCK | O_CLOEXEC) < 0) {
+        lb_net_splice_close(conn);
+        conn->splice_enabled = false;
+    }
+}
+
+static int lb_net_splice_client_to_backend(loadbalancer_t* lb, lb_connection_t* conn) {
+    if (conn->backend_fd < 0) {
+        // Don't pick a backend for a client that connected and went away
+        char probe;
+        ssize_t n = recv(conn->client_fd, &probe, 1, MSG_PEEK | MSG_DONTWAIT);
+        if (n == 0) return 0;
+        if (n < 0) return (errno == EAGAIN || errno == EWOULDBLOCK) ? 1 : -1;
+
+        if (lb_net_attach_backend(lb, conn) < 0) return -1;
+        lb_net_splice_setup(conn);
+        if (!conn->splice_enabled) return handle_client_to_backend(lb, conn);
+    }
+
+    size_t moved = 0;
+    int failed_fd = -1;
+    int ret = lb_net_splice_pump(conn->client_fd, conn->backend_fd, conn->splice_c2b,
+                                 &conn->splice_c2b_len, &conn->client_eof, &moved, &failed_fd);
+    int err = errno;
+
+    if (moved > 0) {
+        LB_STAT_ADD(lb, bytes_in, moved);
+        lb_stat_backend_bytes(conn->backend, 0, moved);
+        lb_request_sent(conn);
+    }
+
+    if (ret < 0) {
+        // splice() consumes the socket error, keep it for the outlier check
+        if (failed_fd == conn->backend_fd) conn->backend_errno = err;
+        return -1;
+    }
+    if (ret == 0) {
+        // Client finished sending; pass the half-close on and keep the
+        // connection open until the backend response has been delivered.
+        shutdown(conn->backend_fd, SHUT_WR);
+        if (conn->backend_eof && conn->splice_b2c_len == 0) return 0;
+    }
+
+    lb_net_splice_arm(conn, SOCKET_TYPE_BACKEND);
+    return 1;
+}
+
+static int lb_net_splice_backend_to_client(loadbalancer_t* lb, lb_connection_t* conn) {
+    // The response bypasses user space, so its status line is peeked at
+    // before the first bytes are spliced
+    lb_outcome_t outcome = LB_OUTCOME_OK;
+    if (conn->request_sent_ns && conn->splice_b2c_len == 0) {
+        char status[16];
+        ssize_t n = recv(conn->backend_fd, status, sizeof(status), MSG_PEEK | MSG_DONTWAIT);
+        if (n > 0) outcome = lb_response_outcome(status, n);
+    }
+
+    size_t moved = 0;
+    int failed_fd = -1;
+    int ret = lb_net_splice_pump(conn->backend_fd, conn->client_fd, conn->splice_b2c,
+                                 &conn->splice_b2c_len, &conn->backend_eof, &moved, &failed_fd);
+    int err = errno;
+
+    if (moved > 0) {
+        LB_STAT_ADD(lb, bytes_out, moved);
+        lb_stat_backend_bytes(conn->backend, 1, moved);
+        if (conn->request_sent_ns) lb_outlier_report(lb, conn->backend, outcome);
+        lb_request_answered(conn);
+    }
+
+    if (ret < 0 && failed_fd == conn->backend_fd) conn->backend_errno = err;
+    if (ret <= 0) return ret;  // Backend closed and everything was delivered
+
+    lb_net_splice_arm(conn, SOCKET_TYPE_CLIENT);
+    return 1;
+}
+#endif
+
 // Forward data from client to backend
 int handle_client_to_backend(loadbalancer_t* lb, lb_connection_t* conn) {
     char buffer[16384];
-    ssize_t bytes_read;
+    ssize_t bytes_read = 1;  // Stays positive when reading is paused
 
-    fprintf(stderr, "[DEBUG] handle_client_to_backend called\n");
+    LB_DEBUG("handle_client_to_backend called");
+
+    if (conn->is_http2) return lb_h2_client_read(lb, conn);
+#ifdef USE_SPLICE
+    if (conn->splice_enabled) return lb_net_splice_client_to_backend(lb, conn);
+#endif
+    if (conn->l7) return lb_net_l7_client_to_backend(lb, conn);
 
     if (conn->to_backend_size > 0 && conn->backend_fd >= 0) {
-        ssize_t sent = send(conn->backend_fd, conn->to_backend_buffer, conn->to_backend_size, MSG_NOSIGNAL);
-        if (sent > 0) {
+        // Flush until the backlog is gone or the socket is full again
+        while (conn->to_backend_size > 0) {
+            ssize_t sent = send(conn->backend_fd, conn->to_backend_buffer, conn->to_backend_size, MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                LB_DEBUG("Error flushing to backend: %s", strerror(errno));
+                conn->backend_errno = errno;
+                return -1;
+            }
             if ((size_t)sent < conn->to_backend_size) {
                 memmove(conn->to_backend_buffer, conn->to_backend_buffer + sent, conn->to_backend_size - sent);
             }
             conn->to_backend_size -= sent;
-            atomic_fetch_add(&lb->global_stats.bytes_in, sent);
+            LB_STAT_ADD(lb, bytes_in, sent);
             if (conn->backend) {
-                atomic_fetch_add(&conn->backend->stats.bytes_in, sent);
+                lb_stat_backend_bytes(conn->backend, 0, sent);
             }
-        } else if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
-            fprintf(stderr, "[DEBUG] Error flushing to backend: %s\n", strerror(errno));
-            return -1;
         }
 
         if (conn->to_backend_size == 0) {
+            lb_net_backlog_release(lb, &conn->to_backend_buffer, &conn->to_backend_capacity);
+        }
+        if (conn->to_backend_size == 0 && !conn->edge_triggered) {
             struct epoll_event ev = {
                 .events = EPOLLIN | EPOLLONESHOT,
-                .data.ptr = conn->backend_wrapper
+                .data.ptr = &conn->backend_wrapper
             };
-            epoll_ctl(lb->epfd, EPOLL_CTL_MOD, conn->backend_fd, &ev);
+            epoll_ctl(conn->worker->epfd, EPOLL_CTL_MOD, conn->backend_fd, &ev);
         }
     }
 
-    // Read all available data from client
-    while ((bytes_read = recv(conn->client_fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
-        fprintf(stderr, "[DEBUG] Read %zd bytes from client\n", bytes_read);
+    // Read all available data from client. Edge-triggered connections only
+    // stop early while the backend backlog is over the high watermark.
+    while (!lb_net_read_paused(conn, &conn->client_read_paused, conn->to_backend_size) &&
+           (bytes_read = recv(conn->client_fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+        LB_DEBUG("Read %zd bytes from client", bytes_read);
 
         // If no backend connection yet, establish one
-        if (conn->backend_fd < 0) {
-            fprintf(stderr, "[DEBUG] No backend connection, creating one\n");
-            backend_t* backend = lb_select_backend(lb, &conn->client_addr);
-            if (!backend) {
-                fprintf(stderr, "[DEBUG] No backend available\n");
-                return -1;  // Caller will close connection
-            }
-
-            conn->backend_fd = lb_net_connect_to_backend(backend);
-            if (conn->backend_fd < 0) {
-                fprintf(stderr, "[DEBUG] Failed to connect to backend\n");
-                atomic_fetch_add(&backend->failed_conns, 1);
-                atomic_fetch_add(&lb->global_stats.failed_requests, 1);
-                return -1;  // Caller will close connection properly
-            }
-
-            fprintf(stderr, "[DEBUG] Connected to backend fd=%d\n", conn->backend_fd);
-
-            conn->backend = backend;
-            atomic_fetch_add(&backend->active_conns, 1);
-            atomic_fetch_add(&backend->total_conns, 1);
-
-            // Register backend socket with epoll using EPOLLONESHOT
-            if (conn->backend_wrapper) {
-                conn->backend_wrapper->fd = conn->backend_fd;
-                struct epoll_event ev = {
-                    .events = EPOLLIN | EPOLLONESHOT,
-                    .data.ptr = conn->backend_wrapper
-                };
-                if (epoll_ctl(lb->epfd, EPOLL_CTL_ADD, conn->backend_fd, &ev) < 0) {
-                    perror("epoll_ctl backend");
-                    return -1;
-                }
-                fprintf(stderr, "[DEBUG] Registered backend socket with epoll\n");
-            }
+        if (conn->backend_fd < 0 && lb_net_attach_backend(lb, conn) < 0) {
+            return -1;  // Caller will close connection properly
         }
+        lb_net_track(conn, &conn->req_track, buffer, bytes_read, false, false);
+        lb_request_sent(conn);
 
         // Forward to backend
         ssize_t sent = 0;
         ssize_t total_sent = 0;
-        while (total_sent < bytes_read) {
+        // Queued bytes go first; new data only bypasses an empty backlog
+        while (conn->to_backend_size == 0 && total_sent < bytes_read) {
             sent = send(conn->backend_fd, buffer + total_sent, bytes_read - total_sent, MSG_NOSIGNAL);
             if (sent < 0) {
                 if (errno == EAGAIN || errno == EWOULDBLOCK) {
                     break;  // Would block, try again later
                 }
-                fprintf(stderr, "[DEBUG] Error sending to backend: %s\n", strerror(errno));
+                LB_DEBUG("Error sending to backend: %s", strerror(errno));
+                conn->backend_errno = errno;
                 return -1;  // Real error
             }
             total_sent += sent;
@@ -326,42 +1081,38 @@ int handle_client_to_backend(loadbalancer_t* lb, lb_connection_t* conn) {
 
         if (total_sent < bytes_read) {
             size_t remaining = bytes_read - total_sent;
-            if (conn->to_backend_capacity < conn->to_backend_size + remaining) {
-                size_t new_cap = (conn->to_backend_size + remaining) * 2;
-                uint8_t* new_buf = (uint8_t*)realloc(conn->to_backend_buffer, new_cap);
-                if (!new_buf) {
-                    fprintf(stderr, "[DEBUG] Failed to allocate to_backend_buffer\n");
-                    return -1;
-                }
-                conn->to_backend_buffer = new_buf;
-                conn->to_backend_capacity = new_cap;
+            if (lb_net_backlog_append(lb, &conn->to_backend_buffer, &conn->to_backend_size,
+                                      &conn->to_backend_capacity, buffer + total_sent, remaining) < 0) {
+                LB_DEBUG("Failed to allocate to_backend_buffer");
+                return -1;
             }
-            memcpy(conn->to_backend_buffer + conn->to_backend_size, buffer + total_sent, remaining);
-            conn->to_backend_size += remaining;
 
-            struct epoll_event ev = {
-                .events = EPOLLIN | EPOLLOUT | EPOLLONESHOT,
-                .data.ptr = conn->backend_wrapper
-            };
-            epoll_ctl(lb->epfd, EPOLL_CTL_MOD, conn->backend_fd, &ev);
+            if (!conn->edge_triggered) {
+                struct epoll_event ev = {
+                    .events = EPOLLIN | EPOLLOUT | EPOLLONESHOT,
+                    .data.ptr = &conn->backend_wrapper
+                };
+                epoll_ctl(conn->worker->epfd, EPOLL_CTL_MOD, conn->backend_fd, &ev);
+            }
         }
 
-        fprintf(stderr, "[DEBUG] Sent %zd bytes to backend\n", total_sent);
+        LB_DEBUG("Sent %zd bytes to backend", total_sent);
 
-        atomic_fetch_add(&lb->global_stats.bytes_in, total_sent);
+        LB_STAT_ADD(lb, bytes_in, total_sent);
         if (conn->backend) {
-            atomic_fetch_add(&conn->backend->stats.bytes_in, total_sent);
+            lb_stat_backend_bytes(conn->backend, 0, total_sent);
         }
     }
 
     if (bytes_read == 0) {
-        fprintf(stderr, "[DEBUG] Client closed connection\n");
+        LB_DEBUG("Client closed connection");
         // Client closed connection
+        conn->client_eof = true;
         return 0;
     }
 
     if (bytes_read < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
-        fprintf(stderr, "[DEBUG] Error reading from client: %s\n", strerror(errno));
+        LB_DEBUG("Error reading from client: %s", strerror(errno));
         // Real error
         return -1;
     }
@@ -372,49 +1123,75 @@ int handle_client_to_backend(loadbalancer_t* lb, lb_connection_t* conn) {
 // Forward data from backend to client
 int handle_backend_to_client(loadbalancer_t* lb, lb_connection_t* conn) {
     char buffer[16384];
-    ssize_t bytes_read;
+    ssize_t bytes_read = 1;  // Stays positive when reading is paused
+
+    LB_DEBUG("handle_backend_to_client called");
 
-    fprintf(stderr, "[DEBUG] handle_backend_to_client called\n");
+    if (conn->is_http2) return lb_h2_client_write(lb, conn);
+#ifdef USE_SPLICE
+    if (conn->splice_enabled && conn->splice_b2c[0] >= 0) {
+        return lb_net_splice_backend_to_client(lb, conn);
+    }
+#endif
 
     if (conn->to_client_size > 0) {
-        ssize_t sent = send(conn->client_fd, conn->to_client_buffer, conn->to_client_size, MSG_NOSIGNAL);
-        if (sent > 0) {
+        // Flush until the backlog is gone or the socket is full again
+        while (conn->to_client_size > 0) {
+            ssize_t sent = send(conn->client_fd, conn->to_client_buffer, conn->to_client_size, MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                LB_DEBUG("Error flushing to client: %s", strerror(errno));
+                return -1;
+            }
             if ((size_t)sent < conn->to_client_size) {
                 memmove(conn->to_client_buffer, conn->to_client_buffer + sent, conn->to_client_size - sent);
             }
             conn->to_client_size -= sent;
-            atomic_fetch_add(&lb->global_stats.bytes_out, sent);
+            LB_STAT_ADD(lb, bytes_out, sent);
             if (conn->backend) {
-                atomic_fetch_add(&conn->backend->stats.bytes_out, sent);
+                lb_stat_backend_bytes(conn->backend, 1, sent);
             }
-        } else if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
-            fprintf(stderr, "[DEBUG] Error flushing to client: %s\n", strerror(errno));
-            return -1;
         }
 
         if (conn->to_client_size == 0) {
+            lb_net_backlog_release(lb, &conn->to_client_buffer, &conn->to_client_capacity);
+        }
+        if (conn->to_client_size == 0 && !conn->edge_triggered) {
             struct epoll_event ev = {
                 .events = EPOLLIN | EPOLLONESHOT,
-                .data.ptr = conn->client_wrapper
+                .data.ptr = &conn->client_wrapper
             };
-            epoll_ctl(lb->epfd, EPOLL_CTL_MOD, conn->client_fd, &ev);
+            epoll_ctl(conn->worker->epfd, EPOLL_CTL_MOD, conn->client_fd, &ev);
         }
     }
 
-    // Read all available data from backend
-    while ((bytes_read = recv(conn->backend_fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
-        fprintf(stderr, "[DEBUG] Read %zd bytes from backend\n", bytes_read);
+    // L7 connection between exchanges: only the client backlog was pending
+    if (conn->backend_fd < 0) {
+        return (conn->client_eof && conn->to_client_size == 0) ? 0 : 1;
+    }
+
+    // Read all available data from backend. Edge-triggered connections only
+    // stop early while the client backlog is over the high watermark.
+    while (!lb_net_read_paused(conn, &conn->backend_read_paused, conn->to_client_size) &&
+           (bytes_read = recv(conn->backend_fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+        LB_DEBUG("Read %zd bytes from backend", bytes_read);
+        lb_net_track(conn, &conn->resp_track, buffer, bytes_read, true, false);
+        if (conn->request_sent_ns) {
+            lb_outlier_report(lb, conn->backend, lb_response_outcome(buffer, bytes_read));
+        }
+        lb_request_answered(conn);
 
         // Forward to client
         ssize_t sent = 0;
         ssize_t total_sent = 0;
-        while (total_sent < bytes_read) {
+        // Queued bytes go first; new data only bypasses an empty backlog
+        while (conn->to_client_size == 0 && total_sent < bytes_read) {
             sent = send(conn->client_fd, buffer + total_sent, bytes_read - total_sent, MSG_NOSIGNAL);
             if (sent < 0) {
                 if (errno == EAGAIN || errno == EWOULDBLOCK) {
                     break;  // Would block, try again later
                 }
-                fprintf(stderr, "[DEBUG] Error sending to client: %s\n", strerror(errno));
+                LB_DEBUG("Error sending to client: %s", strerror(errno));
                 return -1;  // Real error
             }
             total_sent += sent;
@@ -422,43 +1199,49 @@ int handle_backend_to_client(loadbalancer_t* lb, lb_connection_t* conn) {
 
         if (total_sent < bytes_read) {
             size_t remaining = bytes_read - total_sent;
-            if (conn->to_client_capacity < conn->to_client_size + remaining) {
-                size_t new_cap = (conn->to_client_size + remaining) * 2;
-                uint8_t* new_buf = (uint8_t*)realloc(conn->to_client_buffer, new_cap);
-                if (!new_buf) {
-                    fprintf(stderr, "[DEBUG] Failed to allocate to_client_buffer\n");
-                    return -1;
-                }
-                conn->to_client_buffer = new_buf;
-                conn->to_client_capacity = new_cap;
+            if (lb_net_backlog_append(lb, &conn->to_client_buffer, &conn->to_client_size,
+                                      &conn->to_client_capacity, buffer + total_sent, remaining) < 0) {
+                LB_DEBUG("Failed to allocate to_client_buffer");
+                return -1;
             }
-            memcpy(conn->to_client_buffer + conn->to_client_size, buffer + total_sent, remaining);
-            conn->to_client_size += remaining;
 
-            struct epoll_event ev = {
-                .events = EPOLLIN | EPOLLOUT | EPOLLONESHOT,
-                .data.ptr = conn->client_wrapper
-            };
-            epoll_ctl(lb->epfd, EPOLL_CTL_MOD, conn->client_fd, &ev);
+            if (!conn->edge_triggered) {
+                struct epoll_event ev = {
+                    .events = EPOLLIN | EPOLLOUT | EPOLLONESHOT,
+                    .data.ptr = &conn->client_wrapper
+                };
+                epoll_ctl(conn->worker->epfd, EPOLL_CTL_MOD, conn->client_fd, &ev);
+            }
         }
 
-        fprintf(stderr, "[DEBUG] Sent %zd bytes to client\n", total_sent);
+        LB_DEBUG("Sent %zd bytes to client", total_sent);
 
-        atomic_fetch_add(&lb->global_stats.bytes_out, total_sent);
+        LB_STAT_ADD(lb, bytes_out, total_sent);
         if (conn->backend) {
-            atomic_fetch_add(&conn->backend->stats.bytes_out, total_sent);
+            lb_stat_backend_bytes(conn->backend, 1, total_sent);
+        }
+    }
+
+    if (conn->l7 && !conn->l7_tunnel) {
+        if (bytes_read == 0) conn->backend_eof = true;
+        if (lb_net_l7_exchange_done(conn)) return lb_net_l7_finish(lb, conn);
+        if (!conn->upstream_reusable) {
+            lb_net_l7_tunnel(conn);
+            if (lb_net_l7_flush(lb, conn) < 0) return -1;
         }
     }
 
     if (bytes_read == 0) {
-        fprintf(stderr, "[DEBUG] Backend closed connection\n");
+        LB_DEBUG("Backend closed connection");
         // Backend closed connection
+        conn->backend_eof = true;
         return 0;
     }
 
     if (bytes_read < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
-        fprintf(stderr, "[DEBUG] Error reading from backend: %s\n", strerror(errno));
+        LB_DEBUG("Error reading from backend: %s", strerror(errno));
         // Real error
+        conn->backend_errno = errno;
         return -1;
     }
 
@@ -587,33 +1370,274 @@ const char* get_check_status_string(int status) {
     }
 }
 
+// A connection that ends on a backend error counts against that backend.
+// The request may already be queued on a socket that never connected, so
+// the error, not conn->state, tells a failed connect from a reset.
+static void lb_net_backend_outcome(loadbalancer_t* lb, lb_connection_t* conn) {
+    int err = conn->backend_errno;
+    if (!err) {
+        socklen_t len = sizeof(err);
+        getsockopt(conn->backend_fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    }
+
+    switch (err) {
+        case ECONNREFUSED:
+        case EHOSTUNREACH:
+        case ENETUNREACH:
+        case ETIMEDOUT:
+            atomic_fetch_add(&conn->backend->failed_conns, 1);
+            lb_outlier_report(lb, conn->backend, LB_OUTCOME_CONNECT_FAIL);
+            break;
+        case ECONNRESET:
+        case EPIPE:
+            lb_outlier_report(lb, conn->backend, LB_OUTCOME_RESET);
+            break;
+        default:
+            break;
+    }
+}
+
+// Close both sides and queue the connection for deferred cleanup. Events
+// for it later in the same epoll batch see a NULL wrapper and are skipped.
+static void lb_net_conn_close(lb_worker_t* worker, lb_connection_t* conn) {
+    loadbalancer_t* lb = worker->lb;
+
+    LB_DEBUG("Marking connection for close");
+
+    lb_timer_cancel(worker->timers, &conn->timer);
+
+    if (conn->backend && conn->backend_fd >= 0) lb_net_backend_outcome(lb, conn);
+
+    // Remove from epoll first
+    if (conn->client_fd >= 0) {
+        epoll_ctl(worker->epfd, EPOLL_CTL_DEL, conn->client_fd, NULL);
+        close(conn->client_fd);
+        conn->client_fd = -1;  // Mark as closed
+    }
+    if (conn->backend_fd >= 0) {
+        epoll_ctl(worker->epfd, EPOLL_CTL_DEL, conn->backend_fd, NULL);
+        if (!lb_net_upstream_release(worker, conn)) {
+            close(conn->backend_fd);
+        }
+        conn->backend_fd = -1;  // Mark as closed
+    }
+    lb_net_splice_close(conn);
+    lb_h2_close(conn);
+
+    if (conn->backend) {
+        lb_request_abort(conn);
+        lb_backend_conn_put(lb, conn->backend);
+    }
+
+    // Enqueue connection for deferred cleanup
+    // Mark wrapper as invalid by setting conn to NULL to prevent use after this batch
+    conn->client_wrapper.conn = NULL;
+    conn->backend_wrapper.conn = NULL;
+
+    // Enqueue for cleanup at the start of next iteration
+    if (!cleanup_queue_enqueue(worker->cleanup_queue, conn)) {
+        // Queue full, free immediately with NULL checks
+        log_warning("Cleanup queue full, freeing connection immediately");
+        lb_net_conn_free(worker, conn);
+    }
+
+    LB_STAT_ADD(lb, active_connections, -1);
+}
+
+// Timeout for the phase a connection is in: connecting to the backend,
+// blocked on a slow reader, idle between HTTP/1.1 exchanges, or waiting
+// for the next bytes from either peer.
+static uint32_t lb_net_conn_timeout_ms(const lb_connection_t* conn) {
+    const config_t* config = &conn->worker->lb->config;
+
+    if (conn->is_http2) {
+        if (conn->to_client_size > 0) return config->write_timeout_ms;
+        return lb_h2_busy(conn) ? config->read_timeout_ms : config->keepalive_timeout_ms;
+    }
+    if (conn->state == STATE_CONNECTING) return config->connect_timeout_ms;
+    if (lb_net_backend_pending(conn) > 0 || conn->to_client_size > 0 || conn->splice_b2c_len > 0) {
+        return config->write_timeout_ms;
+    }
+    // L7 connection waiting for its next request
+    if (conn->l7 && !conn->backend) {
+        return conn->to_backend_size > 0 ? config->read_timeout_ms : config->keepalive_timeout_ms;
+    }
+    // Framing is only known while the connection is tracked for pooling
+    if (conn->upstream_reusable && conn->resp_track.messages > 0 &&
+        conn->req_track.state == HTTP_TRACK_IDLE && conn->resp_track.state == HTTP_TRACK_IDLE &&
+        conn->req_track.messages == conn->resp_track.messages) {
+        return config->keepalive_timeout_ms;
+    }
+    return config->read_timeout_ms;
+}
+
+// Called after every event on a connection. Pushing the deadline out only
+// updates deadline_ms; the timer is moved when the deadline comes closer
+// (say from read to connect timeout) and otherwise re-armed when it fires.
+static void lb_net_conn_touch(lb_connection_t* conn, uint64_t now_ms) {
+    if (!conn->timeouts) return;
+
+    // All queued request bytes reached the socket, so the connect finished
+    if (conn->state == STATE_CONNECTING && conn->backend_fd >= 0 &&
+        lb_net_backend_pending(conn) == 0) {
+        conn->state = STATE_CONNECTED;
+    }
+
+    uint32_t timeout = lb_net_conn_timeout_ms(conn);
+    lb_timer_wheel_t* timers = conn->worker->timers;
+    if (timeout == 0) {
+        lb_timer_cancel(timers, &conn->timer);
+        return;
+    }
+
+    conn->deadline_ms = now_ms + timeout;
+    if (!lb_timer_pending(&conn->timer) ||
+        conn->deadline_ms + LB_TIMER_TICK_MS <= lb_timer_expires_ms(&conn->timer)) {
+        lb_timer_schedule(timers, &conn->timer, conn->deadline_ms);
+    }
+}
+
+static void lb_net_conn_expired(lb_timer_t* timer, void* arg) {
+    lb_worker_t* worker = (lb_worker_t*)arg;
+    lb_connection_t* conn = (lb_connection_t*)((char*)timer - offsetof(lb_connection_t, timer));
+    uint64_t now_ms = worker->timers->now * LB_TIMER_TICK_MS;
+
+    // Saw activity since the timer was armed
+    if (conn->deadline_ms > now_ms) {
+        lb_timer_schedule(worker->timers, timer, conn->deadline_ms);
+        return;
+    }
+
+    LB_DEBUG("Connection timed out (client fd=%d backend fd=%d state=%d)",
+             conn->client_fd, conn->backend_fd, conn->state);
+    if (conn->state == STATE_CONNECTING && conn->backend) {
+        atomic_fetch_add(&conn->backend->failed_conns, 1);
+        lb_outlier_report(worker->lb, conn->backend, LB_OUTCOME_CONNECT_FAIL);
+        LB_STAT_ADD(worker->lb, failed_requests, 1);
+    }
+    lb_net_conn_close(worker, conn);
+}
+
+// Accept one pending connection and register it with the worker's epoll.
+// Returns -1 once the listen queue is empty (or on a hard accept error).
+static int lb_net_accept_client(lb_worker_t* worker) {
+    loadbalancer_t* lb = worker->lb;
+
+    struct sockaddr_in client_addr;
+    socklen_t addr_len = sizeof(client_addr);
+
+    int client_fd = accept4(worker->listen_fd, (struct sockaddr*)&client_addr,
+                           &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+    if (client_fd < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            perror("accept");
+        }
+        return -1;
+    }
+
+    LB_DEBUG("Accepted client fd=%d", client_fd);
+
+    LB_STAT_ADD(lb, total_requests, 1);
+    LB_STAT_ADD(lb, active_connections, 1);
+
+    int val = 1;
+    setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+
+    lb_connection_t* conn = lb_net_conn_create(worker);
+    if (!conn) {
+        log_error("lb_net_conn_create FAILED for fd=%d", client_fd);
+        close(client_fd);
+        LB_STAT_ADD(lb, active_connections, -1);
+        return 0;
+    }
+
+    LB_DEBUG("lb_net_conn_create succeeded for fd=%d, client_wrapper=%p backend_wrapper=%p", client_fd,
+             (void*)&conn->client_wrapper, (void*)&conn->backend_wrapper);
+
+    conn->client_fd = client_fd;
+    conn->client_addr = client_addr;
+    conn->start_time_ns = lb_now_ns();
+    conn->state = STATE_CONNECTED;
+    // Pooling has to see the HTTP framing, so it keeps the copy path
+    conn->upstream_reusable = lb->config.upstream_keepalive;
+    conn->l7 = lb->config.l7_mode;
+    conn->edge_triggered = lb->config.edge_triggered && lb->config.worker_sharding;
+    // Shared workers hand connections around; the wheel is single-threaded
+    conn->timeouts = lb->config.worker_sharding;
+    conn->backpressure = lb->config.worker_sharding;
+#ifdef USE_SPLICE
+    conn->splice_enabled = lb->config.splice_forwarding && !lb_net_requires_l7(lb) &&
+                           !conn->upstream_reusable && !conn->l7;
+#endif
+
+    // Set wrapper FD
+    conn->client_wrapper.fd = client_fd;
+
+    // Register client socket with epoll using EPOLLONESHOT to prevent stale
+    // events, or once with EPOLLET when this worker owns it exclusively
+    conn->client_wrapper.events = lb_net_initial_events(conn);
+    struct epoll_event ev = {
+        .events = conn->client_wrapper.events,
+        .data.ptr = &conn->client_wrapper
+    };
+
+    if (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, client_fd, &ev) < 0) {
+        LB_DEBUG("epoll_ctl failed: %s", strerror(errno));
+        perror("epoll_ctl client");
+        lb_net_conn_destroy(conn);
+        LB_STAT_ADD(lb, active_connections, -1);
+    } else {
+        LB_DEBUG("Registered client socket with epoll");
+        lb_net_conn_touch(conn, conn->start_time_ns / 1000000);
+    }
+
+    return 0;
+}
+
 // Renamed to avoid LTO internalization - called from main.c
 void* worker_thread_v2(void* arg) {
-    loadbalancer_t* lb = (loadbalancer_t*)arg;
+    lb_worker_t* worker = (lb_worker_t*)arg;
+    loadbalancer_t* lb = worker->lb;
     struct epoll_event events[MAX_EVENTS];
 
-    cpu_set_t cpuset;
-    CPU_ZERO(&cpuset);
-    CPU_SET(pthread_self() % sysconf(_SC_NPROCESSORS_ONLN), &cpuset);
-    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+    if (worker->cpu >= 0) lb_topology_pin(worker->cpu, worker->numa_node);
+    if (lb_net_worker_init(worker) < 0) return NULL;
 
-    FILE* debug = fopen("/tmp/worker_debug.log", "a");
-    if (debug) {
-        fprintf(debug, "[DEBUG] Worker thread %lu started\n", pthread_self());
-        fflush(debug);
-    }
+    LB_DEBUG("Worker thread %lu started", pthread_self());
+
+    // Backend tables published with RCU are read from this thread
+    lb_rcu_register();
+    lb_stats_bind(&worker->stats);
+
+    uint64_t next_expire_ns = 0;
 
     while (lb->running) {
+        // No RCU-protected pointers are held between iterations
+        lb_rcu_quiescent();
+
         // Process cleanup queue before handling new events
-        process_cleanup_queue(lb);
+        process_cleanup_queue(worker);
+
+        // Idle upstream sockets are swept about once a second
+        uint64_t now = lb_now_ns();
+        if (now >= next_expire_ns) {
+            lb_net_upstream_expire(worker);
+            next_expire_ns = now + 1000000000ULL;
+        }
 
-        int nfds = epoll_wait(lb->epfd, events, MAX_EVENTS, 100);
+        int nfds = epoll_wait(worker->epfd, events, MAX_EVENTS, 100);
+        // Everything handled below this wakeup shares one clock read
+        lb_clock_update();
 
-        if (nfds > 0 && debug) {
-            fprintf(debug, "[DEBUG] epoll_wait returned %d events\n", nfds);
-            fflush(debug);
+        if (nfds > 0) {
+            LB_DEBUG("epoll_wait returned %d events", nfds);
         }
 
+        // One wheel step per wakeup closes whatever timed out meanwhile
+        uint64_t now_ms = lb_now_ms();
+        lb_timer_advance(worker->timers, now_ms, lb_net_conn_expired, worker);
+
         for (int i = 0; i < nfds; i++) {
             // Try to interpret as wrapper first
             epoll_data_wrapper_t* wrapper = (epoll_data_wrapper_t*)events[i].data.ptr;
@@ -622,84 +1646,12 @@ void* worker_thread_v2(void* arg) {
             if (wrapper && wrapper->type == SOCKET_TYPE_LISTEN) {
                 // This is the listen socket
                 int fd = wrapper->fd;
-                if (fd == lb->listen_fd) {
-                    if (debug) {
-                        fprintf(debug, "[DEBUG] Listen socket event\n");
-                        fflush(debug);
-                    }
-                    // Accept new connection
-                    struct sockaddr_in client_addr;
-                    socklen_t addr_len = sizeof(client_addr);
-
-                    int client_fd = accept4(lb->listen_fd, (struct sockaddr*)&client_addr,
-                                           &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
-
-                    if (client_fd < 0) {
-                        if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                            perror("accept");
-                        }
-                        continue;
-                    }
-
-                    if (debug) {
-                        fprintf(debug, "[DEBUG] Accepted client fd=%d\n", client_fd);
-                        fflush(debug);
-                    }
-
-                    atomic_fetch_add(&lb->global_stats.total_requests, 1);
-                    atomic_fetch_add(&lb->global_stats.active_connections, 1);
-
-                    int val = 1;
-                    setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
-
-                    lb_connection_t* conn = lb_net_conn_create(lb);
-                    if (!conn) {
-                        fprintf(stderr, "[ERROR] lb_net_conn_create FAILED for fd=%d\n", client_fd);
-                        if (debug) {
-                            fprintf(debug, "[DEBUG] lb_net_conn_create failed\n");
-                            fflush(debug);
-                        }
-                        close(client_fd);
-                        atomic_fetch_sub(&lb->global_stats.active_connections, 1);
-                        continue;
-                    }
-
-                    fprintf(stderr, "[INFO] lb_net_conn_create SUCCESS for fd=%d\n", client_fd);
-                    if (debug) {
-                        fprintf(debug, "[DEBUG] lb_net_conn_create succeeded, client_wrapper=%p backend_wrapper=%p\n",
-                                (void*)conn->client_wrapper, (void*)conn->backend_wrapper);
-                        fflush(debug);
-                    }
-
-                    conn->client_fd = client_fd;
-                    conn->client_addr = client_addr;
-                    conn->start_time_ns = get_time_ns();
-                    conn->state = STATE_CONNECTED;
-
-                    // Set wrapper FD
-                    if (conn->client_wrapper) {
-                        conn->client_wrapper->fd = client_fd;
-                    }
-
-                    // Register client socket with epoll using EPOLLONESHOT to prevent stale events
-                    struct epoll_event ev = {
-                        .events = EPOLLIN | EPOLLONESHOT,
-                        .data.ptr = conn->client_wrapper
-                    };
-
-                    if (epoll_ctl(lb->epfd, EPOLL_CTL_ADD, client_fd, &ev) < 0) {
-                        if (debug) {
-                            fprintf(debug, "[DEBUG] epoll_ctl failed: %s\n", strerror(errno));
-                            fflush(debug);
-                        }
-                        perror("epoll_ctl client");
-                        lb_net_conn_destroy(lb, conn);
-                        atomic_fetch_sub(&lb->global_stats.active_connections, 1);
-                    } else {
-                        if (debug) {
-                            fprintf(debug, "[DEBUG] Registered client socket with epoll\n");
-                            fflush(debug);
-                        }
+                if (fd == worker->listen_fd) {
+                    LB_DEBUG("Listen socket event");
+                    // Drain up to accept_batch pending connections per wakeup
+                    uint32_t batch = lb->config.accept_batch ? lb->config.accept_batch : 1;
+                    for (uint32_t n = 0; n < batch; n++) {
+                        if (lb_net_accept_client(worker) < 0) break;
                     }
                 }
                 continue;
@@ -707,10 +1659,7 @@ void* worker_thread_v2(void* arg) {
 
             // This is a wrapper for client or backend socket
             if (!wrapper || !wrapper->conn) {
-                if (debug) {
-                    fprintf(debug, "[DEBUG] Invalid wrapper\n");
-                    fflush(debug);
-                }
+                LB_DEBUG("Invalid wrapper");
                 continue;
             }
 
@@ -726,35 +1675,65 @@ void* worker_thread_v2(void* arg) {
             if (wrapper->type == SOCKET_TYPE_CLIENT && conn->client_fd < 0) {
                 continue;
             }
+
+            // Backend socket of one HTTP/2 stream; the client socket is the
+            // only one whose interest follows the connection's backlog
+            if (wrapper->type == SOCKET_TYPE_H2_STREAM) {
+                if (conn->client_fd < 0) continue;
+                if (lb_h2_upstream_event(lb, wrapper, events[i].events) <= 0) {
+                    lb_net_conn_close(worker, conn);
+                    continue;
+                }
+                lb_net_conn_touch(conn, now_ms);
+                if (conn->edge_triggered) {
+                    lb_net_et_update(conn, SOCKET_TYPE_CLIENT);
+                } else {
+                    lb_net_lt_arm(conn, SOCKET_TYPE_CLIENT);
+                }
+                continue;
+            }
             if (wrapper->type == SOCKET_TYPE_BACKEND && conn->backend_fd < 0) {
                 continue;
             }
 
-            if (debug) {
-                fprintf(debug, "[DEBUG] Socket event: type=%d\n", wrapper->type);
-                fflush(debug);
+            LB_DEBUG("Socket event: type=%d", wrapper->type);
+
+            if (wrapper->type == SOCKET_TYPE_BACKEND && conn->state == STATE_CONNECTING &&
+                !(events[i].events & EPOLLERR)) {
+                conn->state = STATE_CONNECTED;
             }
             bool should_close = false;
             int result = 0;
 
-            if (events[i].events & (EPOLLHUP | EPOLLERR)) {
-                if (debug) {
-                    fprintf(debug, "[DEBUG] EPOLLHUP or EPOLLERR\n");
-                    fflush(debug);
+            // A hangup that still has readable data is handled as a read so
+            // the final bytes (and the EOF) are forwarded before closing
+            if (conn->edge_triggered) {
+                // Each edge is reported once, so service every direction it
+                // signals: writable pulls queued data from the peer, readable
+                // pushes to it. Both handlers run until EAGAIN.
+                uint32_t ev = events[i].events;
+                bool client = (wrapper->type == SOCKET_TYPE_CLIENT);
+
+                result = (ev & EPOLLERR) ? -1 : 1;
+                if (result > 0 && (ev & EPOLLOUT)) {
+                    result = client ? handle_backend_to_client(lb, conn)
+                                    : handle_client_to_backend(lb, conn);
                 }
+                if (result > 0 && (ev & (EPOLLIN | EPOLLHUP))) {
+                    result = client ? handle_client_to_backend(lb, conn)
+                                    : handle_backend_to_client(lb, conn);
+                }
+                should_close = (result <= 0);
+            } else if ((events[i].events & EPOLLERR) ||
+                ((events[i].events & EPOLLHUP) && !(events[i].events & EPOLLIN))) {
+                LB_DEBUG("EPOLLHUP or EPOLLERR");
                 should_close = true;
             } else if (events[i].events & EPOLLOUT) {
                 if (wrapper->type == SOCKET_TYPE_CLIENT) {
-                    if (debug) {
-                        fprintf(debug, "[DEBUG] Client socket writable\n");
-                        fflush(debug);
-                    }
+                    LB_DEBUG("Client socket writable");
                     result = handle_backend_to_client(lb, conn);
                 } else if (wrapper->type == SOCKET_TYPE_BACKEND) {
-                    if (debug) {
-                        fprintf(debug, "[DEBUG] Backend socket writable\n");
-                        fflush(debug);
-                    }
+                    LB_DEBUG("Backend socket writable");
                     result = handle_client_to_backend(lb, conn);
                 }
 
@@ -764,17 +1743,11 @@ void* worker_thread_v2(void* arg) {
             } else if (events[i].events & EPOLLIN) {
                 // Determine which socket has data
                 if (wrapper->type == SOCKET_TYPE_CLIENT) {
-                    if (debug) {
-                        fprintf(debug, "[DEBUG] Client socket has data\n");
-                        fflush(debug);
-                    }
+                    LB_DEBUG("Client socket has data");
                     // Data from client → forward to backend
                     result = handle_client_to_backend(lb, conn);
                 } else if (wrapper->type == SOCKET_TYPE_BACKEND) {
-                    if (debug) {
-                        fprintf(debug, "[DEBUG] Backend socket has data\n");
-                        fflush(debug);
-                    }
+                    LB_DEBUG("Backend socket has data");
                     // Data from backend → forward to client
                     result = handle_backend_to_client(lb, conn);
                 }
@@ -785,99 +1758,30 @@ void* worker_thread_v2(void* arg) {
             }
 
             if (should_close) {
-                if (debug) {
-                    fprintf(debug, "[DEBUG] Marking connection for close\n");
-                    fflush(debug);
-                }
-
-                // Remove from epoll first
-                if (conn->client_fd >= 0) {
-                    epoll_ctl(lb->epfd, EPOLL_CTL_DEL, conn->client_fd, NULL);
-                    close(conn->client_fd);
-                    conn->client_fd = -1;  // Mark as closed
-                }
-                if (conn->backend_fd >= 0) {
-                    epoll_ctl(lb->epfd, EPOLL_CTL_DEL, conn->backend_fd, NULL);
-                    close(conn->backend_fd);
-                    conn->backend_fd = -1;  // Mark as closed
-                }
+                lb_net_conn_close(worker, conn);
+                continue;
+            }
 
-                uint64_t duration = get_time_ns() - conn->start_time_ns;
-                if (conn->backend) {
-                    atomic_store(&conn->backend->response_time_ns, duration);
-                    atomic_fetch_sub(&conn->backend->active_conns, 1);
-                }
+            lb_net_conn_touch(conn, now_ms);
 
-                // Enqueue connection for deferred cleanup
-                // Mark wrapper as invalid by setting conn to NULL to prevent use after this batch
-                if (conn->client_wrapper) conn->client_wrapper->conn = NULL;
-                if (conn->backend_wrapper) conn->backend_wrapper->conn = NULL;
-
-                // Enqueue for cleanup at the start of next iteration
-                if (!cleanup_queue_enqueue(lb->cleanup_queue, conn)) {
-                    // Queue full, free immediately with NULL checks
-                    fprintf(stderr, "[WARN] Cleanup queue full, freeing connection immediately\n");
-                    if (conn->read_buffer) {
-                        free(conn->read_buffer);
-                        conn->read_buffer = NULL;
-                    }
-                    if (conn->write_buffer) {
-                        free(conn->write_buffer);
-                        conn->write_buffer = NULL;
-                    }
-                    if (conn->to_backend_buffer) {
-                        free(conn->to_backend_buffer);
-                        conn->to_backend_buffer = NULL;
-                    }
-                    if (conn->to_client_buffer) {
-                        free(conn->to_client_buffer);
-                        conn->to_client_buffer = NULL;
-                    }
-                    // Free wrappers - safe since FDs are closed and EPOLL_CTL_DEL done
-                    if (conn->client_wrapper) {
-                        free(conn->client_wrapper);
-                        conn->client_wrapper = NULL;
-                    }
-                    if (conn->backend_wrapper) {
-                        free(conn->backend_wrapper);
-                        conn->backend_wrapper = NULL;
-                    }
-                    free(conn);
-                }
-
-                atomic_fetch_sub(&lb->global_stats.active_connections, 1);
+            if (conn->edge_triggered) {
+                // No re-arm needed; only adjust interest if the backlogs moved
+                lb_net_et_update(conn, SOCKET_TYPE_CLIENT);
+                lb_net_et_update(conn, SOCKET_TYPE_BACKEND);
             } else {
-                // Connection still alive - re-arm EPOLLONESHOT for next event
-                if (wrapper->type == SOCKET_TYPE_CLIENT && conn->client_fd >= 0) {
-                    uint32_t events = EPOLLIN | EPOLLONESHOT;
-                    // Keep EPOLLOUT if there's buffered data to send to client
-                    if (conn->to_client_size > 0) {
-                        events |= EPOLLOUT;
-                    }
-                    struct epoll_event ev = {
-                        .events = events,
-                        .data.ptr = conn->client_wrapper
-                    };
-                    epoll_ctl(lb->epfd, EPOLL_CTL_MOD, conn->client_fd, &ev);
-                } else if (wrapper->type == SOCKET_TYPE_BACKEND && conn->backend_fd >= 0) {
-                    uint32_t events = EPOLLIN | EPOLLONESHOT;
-                    // Keep EPOLLOUT if there's buffered data to send to backend
-                    if (conn->to_backend_size > 0) {
-                        events |= EPOLLOUT;
-                    }
-                    struct epoll_event ev = {
-                        .events = events,
-                        .data.ptr = conn->backend_wrapper
-                    };
-                    epoll_ctl(lb->epfd, EPOLL_CTL_MOD, conn->backend_fd, &ev);
-                }
+                // Connection still alive - re-arm EPOLLONESHOT for next
+                // event, and the peer if this event drained what it waited on
+                bool client = (wrapper->type == SOCKET_TYPE_CLIENT);
+                lb_net_lt_arm(conn, wrapper->type);
+                lb_net_lt_resume(conn, client ? SOCKET_TYPE_BACKEND : SOCKET_TYPE_CLIENT);
             }
         }
     }
 
-    if (debug) {
-        fprintf(debug, "[DEBUG] Worker thread %lu exiting\n", pthread_self());
-        fclose(debug);
-    }
+    // Connections closed during the last iteration are still queued
+    process_cleanup_queue(worker);
+
+    lb_rcu_unregister();
+    LB_DEBUG("Worker thread %lu exiting", pthread_self());
     return NULL;
 }
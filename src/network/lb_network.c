@@ -56,26 +56,20 @@ int connect_to_backend(backend_t* backend) {
 }
 
 connection_t* conn_create(loadbalancer_t* lb) {
-    memory_pool_t* pool = (memory_pool_t*)lb->memory_pool;
+    (void)lb;
 
-    pthread_spin_lock(&pool->lock);
-
-    connection_t* conn = memory_pool_alloc(pool, sizeof(connection_t));
-    if (!conn) {
-        pthread_spin_unlock(&pool->lock);
-        return NULL;
-    }
-
-    conn->read_buffer = memory_pool_alloc(pool, BUFFER_SIZE);
-    conn->write_buffer = memory_pool_alloc(pool, BUFFER_SIZE);
-
-    pthread_spin_unlock(&pool->lock);
+    connection_t* conn = lb_calloc(1, sizeof(connection_t));
+    if (!conn) return NULL;
 
+    conn->read_buffer = lb_alloc(BUFFER_SIZE);
+    conn->write_buffer = lb_alloc(BUFFER_SIZE);
     if (!conn->read_buffer || !conn->write_buffer) {
+        lb_free(conn->read_buffer);
+        lb_free(conn->write_buffer);
+        lb_free(conn);
         return NULL;
     }
 
-    memset(conn, 0, sizeof(connection_t));
     conn->client_fd = -1;
     conn->backend_fd = -1;
     conn->state = STATE_DISCONNECTED;
@@ -97,18 +91,10 @@ void conn_destroy(loadbalancer_t* lb, connection_t* conn) {
         atomic_fetch_sub(&conn->backend->active_conns, 1);
     }
 
-    memory_pool_t* pool = (memory_pool_t*)lb->memory_pool;
-    pthread_spin_lock(&pool->lock);
-
-    if (conn->read_buffer) {
-        memory_pool_free(pool, conn->read_buffer, BUFFER_SIZE);
-    }
-    if (conn->write_buffer) {
-        memory_pool_free(pool, conn->write_buffer, BUFFER_SIZE);
-    }
-    memory_pool_free(pool, conn, sizeof(connection_t));
-
-    pthread_spin_unlock(&pool->lock);
+    (void)lb;
+    lb_free(conn->read_buffer);
+    lb_free(conn->write_buffer);
+    lb_free(conn);
 }
 
 int handle_client_data(loadbalancer_t* lb, connection_t* conn) {
@@ -0,0 +1,789 @@
+#include "core/loadbalancer.h"
+#include "core/lb_rcu.h"
+#include "core/lb_clock.h"
+#include "core/lb_stats.h"
+#include "core/lb_topology.h"
+#include <stdio.h>
+
+#ifdef USE_IO_URING
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/tcp.h>
+#include <linux/io_uring.h>
+
+// io_uring event engine. Talks to the kernel ABI directly so the build has
+// no liburing dependency. Per worker it uses:
+//   - one multishot accept on the worker's listen socket
+//   - one multishot recv per socket, filling buffers from a shared
+//     provided-buffer ring
+//   - ordered chains of linked MSG_WAITALL sends that hand the received
+//     buffers straight to the peer and recycle them on completion
+// so a steady-state request costs one io_uring_enter() per loop iteration
+// instead of epoll_wait + recv + send + epoll_ctl.
+
+#define URING_ENTRIES      4096
+#define URING_BUF_COUNT    512     // must be a power of two
+#define URING_BUF_SIZE     16384
+#define URING_BUF_GROUP    0
+#define URING_QUEUE_PAUSE  8       // stop reading once this many are queued
+#define URING_CHAIN_MAX    64      // sends per linked chain
+#define URING_TICK_MS      100
+
+// user_data = connection pointer | op tag (slab objects are 8-byte aligned)
+enum {
+    URING_OP_CONNECT      = 0,
+    URING_OP_RECV_CLIENT  = 1,
+    URING_OP_RECV_BACKEND = 2,
+    URING_OP_SEND_CLIENT  = 3,
+    URING_OP_SEND_BACKEND = 4,
+    URING_OP_CANCEL       = 5,
+};
+enum {
+    URING_EV_ACCEPT  = 1,
+    URING_EV_TIMEOUT = 2,
+};
+#define URING_OP_MASK 7ULL
+
+typedef struct uring {
+    int fd;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned sq_entries;
+    struct io_uring_sqe* sqes;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    unsigned to_submit;
+} uring_t;
+
+// One direction of a proxied connection: a FIFO of received buffers linked
+// through uring_engine_t.buf_next. The first `inflight` entries are being
+// sent by the current linked chain; the rest wait for it. Every entry owns
+// a ring buffer, so the queue can never outgrow the ring.
+typedef struct uring_dir {
+    int32_t head;
+    int32_t tail;
+    uint32_t count;
+    uint32_t inflight;
+    bool recv_armed;
+    bool paused;
+    bool eof;
+} uring_dir_t;
+
+typedef struct uring_conn {
+    lb_connection_t base;
+    uring_dir_t c2b;
+    uring_dir_t b2c;
+    struct sockaddr_storage backend_addr;
+    socklen_t backend_addr_len;
+    uint32_t pending_ops;
+    bool connected;
+    bool closing;
+    struct uring_conn* starved_next;
+    bool starved;
+} uring_conn_t;
+
+typedef struct uring_engine {
+    lb_worker_t* worker;
+    uring_t ring;
+    struct io_uring_buf_ring* br;
+    uint8_t* buf_base;
+    size_t br_size;
+    uint16_t br_tail;
+    int32_t buf_next[URING_BUF_COUNT];
+    uint32_t buf_len[URING_BUF_COUNT];
+    slab_t* conns;
+    uring_conn_t* starved;
+    struct __kernel_timespec tick;
+    bool multishot_recv;
+    bool multishot_accept;
+} uring_engine_t;
+
+static inline int uring_setup_sys(unsigned entries, struct io_uring_params* p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int uring_enter_sys(int fd, unsigned submit, unsigned wait, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+}
+
+static inline int uring_register_sys(int fd, unsigned op, void* arg, unsigned nr) {
+    return (int)syscall(__NR_io_uring_register, fd, op, arg, nr);
+}
+
+static void uring_queue_exit(uring_t* r) {
+    if (r->sqes && r->sqes != MAP_FAILED) munmap(r->sqes, r->sqes_size);
+    if (r->cq_ring && r->cq_ring != MAP_FAILED && r->cq_ring != r->sq_ring) {
+        munmap(r->cq_ring, r->cq_ring_size);
+    }
+    if (r->sq_ring && r->sq_ring != MAP_FAILED) munmap(r->sq_ring, r->sq_ring_size);
+    if (r->fd >= 0) close(r->fd);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+static int uring_queue_init(uring_t* r, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(r, 0, sizeof(*r));
+
+    r->fd = uring_setup_sys(entries, &p);
+    if (r->fd < 0) return -1;
+
+    r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_ring_size > r->sq_ring_size) r->sq_ring_size = r->cq_ring_size;
+        r->cq_ring_size = r->sq_ring_size;
+    }
+
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED) goto fail;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ring = r->sq_ring;
+    } else {
+        r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ring == MAP_FAILED) goto fail;
+    }
+
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) goto fail;
+
+    char* sq = (char*)r->sq_ring;
+    char* cq = (char*)r->cq_ring;
+    r->sq_head = (unsigned*)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned*)(sq + p.sq_off.array);
+    r->sq_entries = p.sq_entries;
+    r->cq_head = (unsigned*)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    return 0;
+
+fail:
+    uring_queue_exit(r);
+    return -1;
+}
+
+static int uring_submit(uring_t* r, unsigned wait) {
+    unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    int ret;
+    do {
+        ret = uring_enter_sys(r->fd, r->to_submit, wait, flags);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret >= 0) r->to_submit -= (unsigned)ret < r->to_submit ? (unsigned)ret : r->to_submit;
+    return ret;
+}
+
+static inline unsigned uring_sq_space(uring_t* r) {
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    return r->sq_entries - (*r->sq_tail - head);
+}
+
+static struct io_uring_sqe* uring_get_sqe(uring_t* r) {
+    if (uring_sq_space(r) == 0 && uring_submit(r, 0) < 0) return NULL;
+    if (uring_sq_space(r) == 0) return NULL;
+
+    unsigned tail = *r->sq_tail;
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe* sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->to_submit++;
+    return sqe;
+}
+
+static inline uint64_t uring_tag(uring_conn_t* c, unsigned op) {
+    return (uint64_t)(uintptr_t)c | op;
+}
+
+static inline uint8_t* uring_buf_addr(uring_engine_t* e, uint16_t bid) {
+    return e->buf_base + (size_t)bid * URING_BUF_SIZE;
+}
+
+static void uring_buf_recycle(uring_engine_t* e, uint16_t bid) {
+    struct io_uring_buf* buf = &e->br->bufs[e->br_tail & (URING_BUF_COUNT - 1)];
+    buf->addr = (uint64_t)(uintptr_t)uring_buf_addr(e, bid);
+    buf->len = URING_BUF_SIZE;
+    buf->bid = bid;
+    e->br_tail++;
+    __atomic_store_n(&e->br->tail, e->br_tail, __ATOMIC_RELEASE);
+}
+
+static int uring_buf_ring_init(uring_engine_t* e) {
+    e->br_size = URING_BUF_COUNT * sizeof(struct io_uring_buf);
+    e->br = mmap(NULL, e->br_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (e->br == MAP_FAILED) {
+        e->br = NULL;
+        return -1;
+    }
+
+    e->buf_base = malloc((size_t)URING_BUF_COUNT * URING_BUF_SIZE);
+    if (!e->buf_base) return -1;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)e->br;
+    reg.ring_entries = URING_BUF_COUNT;
+    reg.bgid = URING_BUF_GROUP;
+    if (uring_register_sys(e->ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        return -1;
+    }
+
+    e->br_tail = 0;
+    for (uint16_t i = 0; i < URING_BUF_COUNT; i++) {
+        uring_buf_recycle(e, i);
+    }
+    return 0;
+}
+
+static bool uring_probe_ops(int ring_fd) {
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = calloc(1, len);
+    if (!probe) return false;
+
+    bool ok = false;
+    if (uring_register_sys(ring_fd, IORING_REGISTER_PROBE, probe, 256) >= 0) {
+        static const int needed[] = {
+            IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND,
+            IORING_OP_CONNECT, IORING_OP_ASYNC_CANCEL, IORING_OP_TIMEOUT
+        };
+        ok = true;
+        for (size_t i = 0; i < sizeof(needed) / sizeof(needed[0]); i++) {
+            int op = needed[i];
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                ok = false;
+            }
+        }
+    }
+    free(probe);
+    return ok;
+}
+
+bool lb_uring_supported(void) {
+    static int cached = -1;
+    if (cached >= 0) return cached;
+
+    // A throwaway ring tells us whether the kernel allows io_uring at all,
+    // has the ops we need and supports provided buffer rings
+    uring_engine_t e;
+    memset(&e, 0, sizeof(e));
+    bool ok = uring_queue_init(&e.ring, 8) == 0 &&
+              uring_probe_ops(e.ring.fd) &&
+              uring_buf_ring_init(&e) == 0;
+
+    if (e.br) munmap(e.br, e.br_size);
+    free(e.buf_base);
+    if (e.ring.fd > 0) uring_queue_exit(&e.ring);
+
+    cached = ok ? 1 : 0;
+    return ok;
+}
+
+static void uring_arm_accept(uring_engine_t* e) {
+    struct io_uring_sqe* sqe = uring_get_sqe(&e->ring);
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = e->worker->listen_fd;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    if (e->multishot_accept) sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = URING_EV_ACCEPT;
+}
+
+static void uring_arm_tick(uring_engine_t* e) {
+    struct io_uring_sqe* sqe = uring_get_sqe(&e->ring);
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)&e->tick;
+    sqe->len = 1;
+    sqe->user_data = URING_EV_TIMEOUT;
+}
+
+static void uring_arm_recv(uring_engine_t* e, uring_conn_t* c, bool client) {
+    uring_dir_t* d = client ? &c->c2b : &c->b2c;
+    if (d->recv_armed || d->eof || c->closing) return;
+
+    struct io_uring_sqe* sqe = uring_get_sqe(&e->ring);
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = client ? c->base.client_fd : c->base.backend_fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    if (e->multishot_recv) sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = uring_tag(c, client ? URING_OP_RECV_CLIENT : URING_OP_RECV_BACKEND);
+
+    d->recv_armed = true;
+    c->pending_ops++;
+}
+
+static void uring_cancel_fd(uring_engine_t* e, uring_conn_t* c, int fd) {
+    if (fd < 0) return;
+    struct io_uring_sqe* sqe = uring_get_sqe(&e->ring);
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = uring_tag(c, URING_OP_CANCEL);
+    c->pending_ops++;
+}
+
+// Cancel just the armed recv of one direction; a cancel by fd would also
+// take down the sends travelling the other way on the same socket
+static void uring_cancel_recv(uring_engine_t* e, uring_conn_t* c, bool client) {
+    struct io_uring_sqe* sqe = uring_get_sqe(&e->ring);
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = uring_tag(c, client ? URING_OP_RECV_CLIENT : URING_OP_RECV_BACKEND);
+    sqe->user_data = uring_tag(c, URING_OP_CANCEL);
+    c->pending_ops++;
+}
+
+// Resume a paused reader once its queue has drained below the threshold
+static void uring_maybe_resume(uring_engine_t* e, uring_conn_t* c, bool client) {
+    uring_dir_t* d = client ? &c->c2b : &c->b2c;
+    if (!d->paused || d->recv_armed || d->count >= URING_QUEUE_PAUSE) return;
+    d->paused = false;
+    uring_arm_recv(e, c, client);
+}
+
+// Submit every queued buffer of one direction as a single linked chain so
+// the kernel sends them in order. Only one chain per direction is ever in
+// flight; later data waits in the FIFO until it completes.
+static void uring_flush_dir(uring_engine_t* e, uring_conn_t* c, bool to_backend) {
+    uring_dir_t* d = to_backend ? &c->c2b : &c->b2c;
+    int fd = to_backend ? c->base.backend_fd : c->base.client_fd;
+    if (d->inflight > 0 || d->count == 0 || c->closing) return;
+    if (to_backend && !c->connected) return;
+
+    // A chain must occupy consecutive SQ slots
+    uint32_t n = d->count < URING_CHAIN_MAX ? d->count : URING_CHAIN_MAX;
+    if (uring_sq_space(&e->ring) < n) uring_submit(&e->ring, 0);
+    if (uring_sq_space(&e->ring) < n) return;
+
+    int32_t bid = d->head;
+    for (uint32_t i = 0; i < n; i++) {
+        struct io_uring_sqe* sqe = uring_get_sqe(&e->ring);
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)(uintptr_t)uring_buf_addr(e, (uint16_t)bid);
+        sqe->len = e->buf_len[bid];
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        if (i + 1 < n) sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = uring_tag(c, to_backend ? URING_OP_SEND_BACKEND : URING_OP_SEND_CLIENT);
+        c->pending_ops++;
+        bid = e->buf_next[bid];
+    }
+    d->inflight = n;
+}
+
+static void uring_conn_close(uring_engine_t* e, uring_conn_t* c) {
+    if (c->closing) return;
+    c->closing = true;
+
+    // Every op still referencing the connection completes (mostly with
+    // -ECANCELED) before the slot is released in uring_conn_maybe_free()
+    uring_cancel_fd(e, c, c->base.client_fd);
+    if (c->base.backend_fd >= 0) uring_cancel_fd(e, c, c->base.backend_fd);
+}
+
+static void uring_conn_maybe_free(uring_engine_t* e, uring_conn_t* c) {
+    if (!c->closing || c->pending_ops > 0) return;
+
+    loadbalancer_t* lb = e->worker->lb;
+    uring_dir_t* dirs[2] = { &c->c2b, &c->b2c };
+    for (int i = 0; i < 2; i++) {
+        for (int32_t bid = dirs[i]->head; bid >= 0; bid = e->buf_next[bid]) {
+            uring_buf_recycle(e, (uint16_t)bid);
+        }
+    }
+
+    if (c->base.client_fd >= 0) close(c->base.client_fd);
+    if (c->base.backend_fd >= 0) close(c->base.backend_fd);
+
+    if (c->base.backend) {
+        lb_request_abort(&c->base);
+        lb_backend_conn_put(lb, c->base.backend);
+    }
+    LB_STAT_ADD(lb, active_connections, -1);
+
+    if (c->starved) {
+        uring_conn_t** pp = &e->starved;
+        while (*pp && *pp != c) pp = &(*pp)->starved_next;
+        if (*pp) *pp = c->starved_next;
+    }
+
+    slab_free(e->conns, c);
+}
+
+static void uring_mark_starved(uring_engine_t* e, uring_conn_t* c) {
+    if (c->starved) return;
+    c->starved = true;
+    c->starved_next = e->starved;
+    e->starved = c;
+}
+
+// Buffers came back to the ring: restart reads that hit -ENOBUFS
+static void uring_wake_starved(uring_engine_t* e) {
+    uring_conn_t* c = e->starved;
+    e->starved = NULL;
+    while (c) {
+        uring_conn_t* next = c->starved_next;
+        c->starved = false;
+        c->starved_next = NULL;
+        if (!c->closing) {
+            if (!c->c2b.paused) uring_arm_recv(e, c, true);
+            if (c->connected && !c->b2c.paused) uring_arm_recv(e, c, false);
+        }
+        c = next;
+    }
+}
+
+static int uring_attach_backend(uring_engine_t* e, uring_conn_t* c) {
+    loadbalancer_t* lb = e->worker->lb;
+    backend_t* backend = lb_select_backend(lb, &c->base.client_addr);
+    if (!backend) return -1;
+
+    if (lb_dns_backend_addr(backend, &c->backend_addr, &c->backend_addr_len) < 0) {
+        atomic_fetch_add(&backend->failed_conns, 1);
+        lb_outlier_report(lb, backend, LB_OUTCOME_CONNECT_FAIL);
+        return -1;
+    }
+
+    int fd = socket(c->backend_addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    int val = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+
+    c->base.backend_fd = fd;
+    c->base.backend = backend;
+    lb_backend_conn_get(lb, backend);
+    atomic_fetch_add(&backend->total_conns, 1);
+
+    struct io_uring_sqe* sqe = uring_get_sqe(&e->ring);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_CONNECT;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)&c->backend_addr;
+    sqe->off = c->backend_addr_len;
+    sqe->user_data = uring_tag(c, URING_OP_CONNECT);
+    c->pending_ops++;
+    return 0;
+}
+
+// Source side reached EOF and everything it sent has been delivered
+static void uring_dir_drained(uring_engine_t* e, uring_conn_t* c, bool to_backend) {
+    uring_dir_t* d = to_backend ? &c->c2b : &c->b2c;
+    if (!d->eof || d->count > 0) return;
+
+    if (to_backend && c->connected) {
+        shutdown(c->base.backend_fd, SHUT_WR);
+        if (c->b2c.eof && c->b2c.count == 0) uring_conn_close(e, c);
+    } else if (!to_backend) {
+        uring_conn_close(e, c);
+    } else if (!c->connected && c->base.backend_fd < 0) {
+        uring_conn_close(e, c);  // Client left before sending anything
+    }
+}
+
+static void uring_handle_recv(uring_engine_t* e, uring_conn_t* c, bool client,
+                              struct io_uring_cqe* cqe) {
+    uring_dir_t* d = client ? &c->c2b : &c->b2c;
+    bool more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+    if (!more) {
+        d->recv_armed = false;
+        c->pending_ops--;
+    }
+
+    if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+        uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (c->closing) {
+            uring_buf_recycle(e, bid);
+            return;
+        }
+
+        e->buf_len[bid] = (uint32_t)cqe->res;
+        e->buf_next[bid] = -1;
+        if (d->tail >= 0) {
+            e->buf_next[d->tail] = bid;
+        } else {
+            d->head = bid;
+        }
+        d->tail = bid;
+        d->count++;
+
+        if (client && c->base.backend_fd < 0 && uring_attach_backend(e, c) < 0) {
+            LB_STAT_ADD(e->worker->lb, failed_requests, 1);
+            uring_conn_close(e, c);
+            return;
+        }
+
+        uring_flush_dir(e, c, client);
+
+        // Backpressure: stop the multishot recv while the peer is slow
+        if (d->count >= URING_QUEUE_PAUSE && more && !d->paused) {
+            d->paused = true;
+            uring_cancel_recv(e, c, client);
+        }
+        if (!more && !d->paused && !c->closing) uring_arm_recv(e, c, client);
+        return;
+    }
+
+    if (cqe->res == 0) {
+        d->eof = true;
+        uring_dir_drained(e, c, client);
+        return;
+    }
+
+    if (cqe->res == -ENOBUFS) {
+        uring_mark_starved(e, c);
+        return;
+    }
+
+    if (cqe->res == -EINVAL && e->multishot_recv) {
+        // Kernel without multishot recv: fall back to re-armed single shots
+        e->multishot_recv = false;
+        uring_arm_recv(e, c, client);
+        return;
+    }
+
+    if (cqe->res == -ECANCELED && (d->paused || c->closing)) {
+        uring_maybe_resume(e, c, client);
+        return;
+    }
+
+    if (!client && cqe->res == -ECONNRESET) {
+        lb_outlier_report(e->worker->lb, c->base.backend, LB_OUTCOME_RESET);
+    }
+    uring_conn_close(e, c);
+}
+
+static void uring_handle_send(uring_engine_t* e, uring_conn_t* c, bool to_backend,
+                              struct io_uring_cqe* cqe) {
+    uring_dir_t* d = to_backend ? &c->c2b : &c->b2c;
+    c->pending_ops--;
+
+    int32_t bid = d->head;
+    if (d->inflight == 0) return;
+
+    if (cqe->res < 0 || (uint32_t)cqe->res != e->buf_len[bid]) {
+        // Error or a broken chain: the rest of the chain is cancelled too
+        d->inflight--;
+        uring_conn_close(e, c);
+        return;
+    }
+
+    loadbalancer_t* lb = e->worker->lb;
+    if (to_backend) {
+        LB_STAT_ADD(lb, bytes_in, cqe->res);
+        lb_stat_backend_bytes(c->base.backend, 0, cqe->res);
+        lb_request_sent(&c->base);
+    } else {
+        LB_STAT_ADD(lb, bytes_out, cqe->res);
+        lb_stat_backend_bytes(c->base.backend, 1, cqe->res);
+        if (c->base.request_sent_ns) {
+            lb_outlier_report(lb, c->base.backend,
+                              lb_response_outcome((const char*)uring_buf_addr(e, (uint16_t)bid), cqe->res));
+        }
+        lb_request_answered(&c->base);
+    }
+
+    d->head = e->buf_next[bid];
+    if (d->head < 0) d->tail = -1;
+    d->count--;
+    uring_buf_recycle(e, (uint16_t)bid);
+    d->inflight--;
+
+    if (d->inflight > 0) return;
+
+    // Chain finished: resume reading if we paused, push what queued up
+    uring_flush_dir(e, c, to_backend);
+    uring_maybe_resume(e, c, to_backend);
+    uring_dir_drained(e, c, to_backend);
+}
+
+static void uring_handle_connect(uring_engine_t* e, uring_conn_t* c, struct io_uring_cqe* cqe) {
+    c->pending_ops--;
+    if (c->closing) return;
+
+    if (cqe->res < 0) {
+        atomic_fetch_add(&c->base.backend->failed_conns, 1);
+        lb_outlier_report(e->worker->lb, c->base.backend, LB_OUTCOME_CONNECT_FAIL);
+        LB_STAT_ADD(e->worker->lb, failed_requests, 1);
+        uring_conn_close(e, c);
+        return;
+    }
+
+    c->connected = true;
+    c->base.state = STATE_CONNECTED;
+    uring_arm_recv(e, c, false);
+    uring_flush_dir(e, c, true);
+    uring_dir_drained(e, c, true);
+}
+
+static void uring_handle_accept(uring_engine_t* e, struct io_uring_cqe* cqe) {
+    loadbalancer_t* lb = e->worker->lb;
+
+    if (!(cqe->flags & IORING_CQE_F_MORE) && lb->running) {
+        if (cqe->res == -EINVAL && e->multishot_accept) e->multishot_accept = false;
+        uring_arm_accept(e);
+    }
+    if (cqe->res < 0) return;
+
+    int client_fd = cqe->res;
+    LB_STAT_ADD(lb, total_requests, 1);
+    LB_STAT_ADD(lb, active_connections, 1);
+
+    uring_conn_t* c = slab_alloc(e->conns);
+    if (!c) {
+        close(client_fd);
+        LB_STAT_ADD(lb, active_connections, -1);
+        return;
+    }
+
+    int val = 1;
+    setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+
+    socklen_t addr_len = sizeof(c->base.client_addr);
+    getpeername(client_fd, (struct sockaddr*)&c->base.client_addr, &addr_len);
+
+    c->base.client_fd = client_fd;
+    c->base.backend_fd = -1;
+    c->base.worker = e->worker;
+    c->base.start_time_ns = lb_now_ns();
+    c->base.state = STATE_CONNECTING;
+    c->c2b.head = c->c2b.tail = -1;
+    c->b2c.head = c->b2c.tail = -1;
+
+    uring_arm_recv(e, c, true);
+}
+
+static void uring_handle_cqe(uring_engine_t* e, struct io_uring_cqe* cqe) {
+    uint64_t data = cqe->user_data;
+    uring_conn_t* c = (uring_conn_t*)(uintptr_t)(data & ~URING_OP_MASK);
+    unsigned op = (unsigned)(data & URING_OP_MASK);
+
+    if (!c) {
+        if (op == URING_EV_ACCEPT) {
+            uring_handle_accept(e, cqe);
+        } else if (op == URING_EV_TIMEOUT && e->worker->lb->running) {
+            uring_arm_tick(e);
+        }
+        return;
+    }
+
+    switch (op) {
+        case URING_OP_RECV_CLIENT:  uring_handle_recv(e, c, true, cqe); break;
+        case URING_OP_RECV_BACKEND: uring_handle_recv(e, c, false, cqe); break;
+        case URING_OP_SEND_BACKEND: uring_handle_send(e, c, true, cqe); break;
+        case URING_OP_SEND_CLIENT:  uring_handle_send(e, c, false, cqe); break;
+        case URING_OP_CONNECT:      uring_handle_connect(e, c, cqe); break;
+        case URING_OP_CANCEL:       c->pending_ops--; break;
+        default: break;
+    }
+
+    uring_conn_maybe_free(e, c);
+}
+
+static void uring_engine_destroy(uring_engine_t* e) {
+    if (e->br) munmap(e->br, e->br_size);
+    free(e->buf_base);
+    slab_destroy(e->conns);
+    if (e->ring.fd > 0) uring_queue_exit(&e->ring);
+}
+
+void* worker_thread_uring(void* arg) {
+    lb_worker_t* worker = (lb_worker_t*)arg;
+    loadbalancer_t* lb = worker->lb;
+
+    // Before the rings and buffer ring are allocated, so they are node-local
+    if (worker->cpu >= 0) lb_topology_pin(worker->cpu, worker->numa_node);
+    if (lb_net_worker_init(worker) < 0) return NULL;
+
+    uring_engine_t e;
+    memset(&e, 0, sizeof(e));
+    e.worker = worker;
+    e.multishot_recv = true;
+    e.multishot_accept = true;
+    e.tick.tv_nsec = URING_TICK_MS * 1000000LL;
+
+    if (uring_queue_init(&e.ring, URING_ENTRIES) < 0 || uring_buf_ring_init(&e) < 0 ||
+        !(e.conns = slab_create(sizeof(uring_conn_t), 256))) {
+        fprintf(stderr, "[ERROR] io_uring worker %u setup failed, using epoll\n", worker->id);
+        uring_engine_destroy(&e);
+        return worker_thread_v2(arg);
+    }
+
+    uring_arm_accept(&e);
+    uring_arm_tick(&e);
+    lb_rcu_register();
+    lb_stats_bind(&worker->stats);
+
+    while (lb->running) {
+        lb_rcu_quiescent();
+
+        if (uring_submit(&e.ring, 1) < 0 && errno != EBUSY) {
+            perror("io_uring_enter");
+            break;
+        }
+        lb_clock_update();
+
+        unsigned head = *e.ring.cq_head;
+        unsigned tail = __atomic_load_n(e.ring.cq_tail, __ATOMIC_ACQUIRE);
+        bool recycled = false;
+        while (head != tail) {
+            struct io_uring_cqe* cqe = &e.ring.cqes[head & *e.ring.cq_mask];
+            unsigned op = (unsigned)(cqe->user_data & URING_OP_MASK);
+            recycled |= (op == URING_OP_SEND_BACKEND || op == URING_OP_SEND_CLIENT);
+            uring_handle_cqe(&e, cqe);
+            head++;
+        }
+        __atomic_store_n(e.ring.cq_head, head, __ATOMIC_RELEASE);
+
+        if (recycled && e.starved) uring_wake_starved(&e);
+    }
+
+    lb_rcu_unregister();
+
+    // Live connections die with the ring; closing the ring fd cancels their
+    // outstanding requests
+    uring_engine_destroy(&e);
+    return NULL;
+}
+
+#else
+
+bool lb_uring_supported(void) {
+    return false;
+}
+
+void* worker_thread_uring(void* arg) {
+    return worker_thread_v2(arg);
+}
+
+#endif
@@ -0,0 +1,169 @@
+#include "ssl/ssl.h"
+#include "ssl/ssl_async.h"
+#include "utils/log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+static void *ssl_crypto_loop(void *arg) {
+    ssl_crypto_pool_t *pool = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->head && !pool->stop)
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        ssl_sock_ctx_t *ctx = pool->head;
+        if (!ctx) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        pool->head = ctx->async_next;
+        if (!pool->head)
+            pool->tail = NULL;
+        pthread_mutex_unlock(&pool->lock);
+        atomic_fetch_sub_explicit(&pool->stats.queued, 1, memory_order_relaxed);
+
+        ctx->async_ret = ssl_sock_handshake(ctx->conn, 0);
+        // The thread's error queue would otherwise grow with failures
+        ERR_clear_error();
+        atomic_fetch_add_explicit(&pool->stats.steps, 1, memory_order_relaxed);
+
+        ssl_async_t *a = ctx->async;
+        pthread_mutex_lock(&a->lock);
+        ctx->async_next = a->done;
+        a->done = ctx;
+        pthread_mutex_unlock(&a->lock);
+
+        uint64_t one = 1;
+        ssize_t n = write(a->fd, &one, sizeof(one));
+        (void)n;
+    }
+}
+
+ssl_crypto_pool_t* ssl_crypto_pool_new(int threads) {
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 1 ? cpus / 2 : 1;
+    }
+    if (threads > SSL_CRYPTO_THREADS_MAX)
+        threads = SSL_CRYPTO_THREADS_MAX;
+
+    ssl_crypto_pool_t *pool = calloc(1, sizeof(*pool));
+    if (!pool) return NULL;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, ssl_crypto_loop, pool) != 0) {
+            log_error("TLS crypto pool: only %d of %d threads started", i, threads);
+            break;
+        }
+        pool->nthreads++;
+    }
+    if (!pool->nthreads) {
+        ssl_crypto_pool_free(pool);
+        return NULL;
+    }
+    log_info("TLS crypto pool: %d threads", pool->nthreads);
+    return pool;
+}
+
+void ssl_crypto_pool_free(ssl_crypto_pool_t *pool) {
+    if (!pool) return;
+
+    // Queued steps still run, so their owners get their callbacks
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->nthreads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+ssl_async_t* ssl_async_new(ssl_crypto_pool_t *pool) {
+    ssl_async_t *a = calloc(1, sizeof(*a));
+    if (!a) return NULL;
+
+    a->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (a->fd < 0) {
+        free(a);
+        return NULL;
+    }
+    a->pool = pool;
+    pthread_mutex_init(&a->lock, NULL);
+    return a;
+}
+
+void ssl_async_free(ssl_async_t *a) {
+    if (!a) return;
+
+    if (a->in_flight)
+        log_warning("TLS async: freed with %u handshake steps in flight", a->in_flight);
+    close(a->fd);
+    pthread_mutex_destroy(&a->lock);
+    free(a);
+}
+
+int ssl_async_handshake(ssl_async_t *a, struct connection *conn) {
+    ssl_sock_ctx_t *ctx = conn->xprt_ctx;
+    ssl_crypto_pool_t *pool = a->pool;
+
+    ctx->async = a;
+    ctx->async_next = NULL;
+    a->in_flight++;
+    atomic_fetch_add_explicit(&pool->stats.queued, 1, memory_order_relaxed);
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->stop) {
+        pthread_mutex_unlock(&pool->lock);
+        atomic_fetch_sub_explicit(&pool->stats.queued, 1, memory_order_relaxed);
+        a->in_flight--;
+        ctx->async = NULL;
+        return -1;
+    }
+    if (pool->tail)
+        pool->tail->async_next = ctx;
+    else
+        pool->head = ctx;
+    pool->tail = ctx;
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+int ssl_async_complete(ssl_async_t *a, ssl_async_cb_t cb, void *arg) {
+    uint64_t count;
+    ssize_t n = read(a->fd, &count, sizeof(count));
+    (void)n;
+
+    pthread_mutex_lock(&a->lock);
+    ssl_sock_ctx_t *done = a->done;
+    a->done = NULL;
+    pthread_mutex_unlock(&a->lock);
+
+    // Pushed newest first; call back in the order they finished
+    ssl_sock_ctx_t *fifo = NULL;
+    while (done) {
+        ssl_sock_ctx_t *next = done->async_next;
+        done->async_next = fifo;
+        fifo = done;
+        done = next;
+    }
+
+    int completed = 0;
+    while (fifo) {
+        ssl_sock_ctx_t *ctx = fifo;
+        fifo = ctx->async_next;
+        ctx->async_next = NULL;
+        ctx->async = NULL;
+        a->in_flight--;
+        completed++;
+        cb(ctx->conn, ctx->async_ret, arg);
+    }
+    return completed;
+}
@@ -0,0 +1,625 @@
+#include "ssl/ssl.h"
+#include "ssl/ssl_session.h"
+#include "core/lb_clock.h"
+#include "core/lb_rcu.h"
+#include "core/lb_types.h"
+#include "core/lb_utils.h"
+#include "utils/log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <openssl/rand.h>
+#include <openssl/hmac.h>
+#include <openssl/evp.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#endif
+
+#define SSL_SESS_MAGIC      0x55425353  // "UBSS"
+#define SSL_SESS_VERSION    1
+#define SSL_SESS_SPINS      64
+
+static int ssl_tickets_idx = -1;
+static int ssl_sess_idx = -1;
+static pthread_once_t ssl_session_once = PTHREAD_ONCE_INIT;
+
+static void ssl_session_init_idx(void) {
+    ssl_tickets_idx = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+    ssl_sess_idx = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+}
+
+/* Ticket keys */
+
+static void ssl_tickets_publish(ssl_tickets_t *t, ssl_ticket_keys_t *keys) {
+    ssl_ticket_keys_t *old = atomic_exchange_explicit(&t->keys, keys, memory_order_acq_rel);
+    if (old)
+        lb_rcu_retire(old, free);
+}
+
+// name, AES and HMAC keys of one period: HMAC-SHA256(secret, label || period || i)
+static void ssl_tickets_derive(ssl_tickets_t *t, int64_t period, ssl_ticket_key_t *key) {
+    unsigned char out[3 * 32];
+    for (int i = 0; i < 3; i++) {
+        unsigned char msg[32];
+        int len = snprintf((char *)msg, sizeof(msg), "ub-ticket %lld %d", (long long)period, i);
+        unsigned int n = 32;
+        HMAC(EVP_sha256(), t->secret, t->secret_len, msg, len, out + 32 * i, &n);
+    }
+    memcpy(key->name, out, sizeof(key->name));
+    memcpy(key->aes, out + 32, sizeof(key->aes));
+    memcpy(key->hmac, out + 64, sizeof(key->hmac));
+    OPENSSL_cleanse(out, sizeof(out));
+}
+
+static ssl_ticket_keys_t* ssl_tickets_period_keys(ssl_tickets_t *t, int64_t period) {
+    ssl_ticket_keys_t *keys = calloc(1, sizeof(*keys));
+    if (!keys) return NULL;
+
+    if (t->secret) {
+        ssl_tickets_derive(t, period, &keys->keys[0]);
+        ssl_tickets_derive(t, period - 1, &keys->keys[1]);
+        ssl_tickets_derive(t, period + 1, &keys->keys[2]);
+        keys->count = 3;
+        return keys;
+    }
+
+    // Random: a new key, and the one it replaces still decrypts
+    if (RAND_bytes((unsigned char *)&keys->keys[0], sizeof(keys->keys[0])) <= 0) {
+        free(keys);
+        return NULL;
+    }
+    keys->count = 1;
+    ssl_ticket_keys_t *old = atomic_load_explicit(&t->keys, memory_order_acquire);
+    if (old && t->period == period - 1)
+        keys->keys[keys->count++] = old->keys[0];
+    return keys;
+}
+
+static int ssl_tickets_rotate(ssl_tickets_t *t, time_t now) {
+    int64_t period = now / t->rotate;
+    if (period == t->period)
+        return 0;
+
+    ssl_ticket_keys_t *keys = ssl_tickets_period_keys(t, period);
+    if (!keys) return -1;
+    t->period = period;
+    ssl_tickets_publish(t, keys);
+    return 1;
+}
+
+static int ssl_tickets_decode(const char *line, size_t len, ssl_ticket_key_t *key) {
+    unsigned char raw[((SSL_TICKET_KEY_SIZE + 2) / 3) * 3];
+    if (len != ((SSL_TICKET_KEY_SIZE + 2) / 3) * 4)
+        return -1;
+
+    int n = EVP_DecodeBlock(raw, (const unsigned char *)line, len);
+    for (size_t i = len; i > 0 && line[i - 1] == '='; i--)
+        n--;
+    if (n != SSL_TICKET_KEY_SIZE)
+        return -1;
+
+    memcpy(key, raw, SSL_TICKET_KEY_SIZE);
+    OPENSSL_cleanse(raw, sizeof(raw));
+    return 0;
+}
+
+static ssl_ticket_keys_t* ssl_tickets_read_file(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        log_error("TLS ticket keys %s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    ssl_ticket_keys_t *keys = calloc(1, sizeof(*keys));
+    char line[256];
+    int lineno = 0;
+    while (keys && fgets(line, sizeof(line), f)) {
+        lineno++;
+        size_t len = strcspn(line, "\r\n");
+        while (len > 0 && (line[len - 1] == ' ' || line[len - 1] == '\t'))
+            len--;
+        if (len == 0 || line[0] == '#')
+            continue;
+
+        if (keys->count == SSL_TICKET_KEYS_MAX ||
+            ssl_tickets_decode(line, len, &keys->keys[keys->count]) < 0) {
+            log_error("TLS ticket keys %s:%d: %s", path, lineno,
+                      keys->count == SSL_TICKET_KEYS_MAX ? "too many keys" : "not an 80 byte base64 key");
+            free(keys);
+            keys = NULL;
+            break;
+        }
+        keys->count++;
+    }
+    OPENSSL_cleanse(line, sizeof(line));
+    fclose(f);
+
+    if (keys && !keys->count) {
+        log_error("TLS ticket keys %s: no keys", path);
+        free(keys);
+        keys = NULL;
+    }
+    return keys;
+}
+
+ssl_tickets_t* ssl_tickets_new(unsigned int rotate) {
+    ssl_tickets_t *t = calloc(1, sizeof(*t));
+    if (!t) return NULL;
+
+    t->rotate = rotate ? rotate : SSL_TICKET_ROTATE_SEC;
+    t->period = INT64_MIN;
+    if (ssl_tickets_rotate(t, lb_now_sec()) < 0) {
+        free(t);
+        return NULL;
+    }
+    atomic_store(&t->next_update, lb_now_sec() + 1);
+    return t;
+}
+
+void ssl_tickets_free(ssl_tickets_t *t) {
+    if (!t) return;
+
+    // Every SSL_CTX using t is gone by now, so nobody can be reading
+    ssl_ticket_keys_t *keys = atomic_load(&t->keys);
+    if (keys) {
+        OPENSSL_cleanse(keys, sizeof(*keys));
+        free(keys);
+    }
+    if (t->secret) {
+        OPENSSL_cleanse(t->secret, t->secret_len);
+        free(t->secret);
+    }
+    free(t->path);
+    free(t);
+}
+
+int ssl_tickets_load_file(ssl_tickets_t *t, const char *path) {
+    struct stat st;
+    ssl_ticket_keys_t *keys;
+    if (stat(path, &st) < 0 || !(keys = ssl_tickets_read_file(path)))
+        return -1;
+
+    char *copy = strdup(path);
+    if (!copy) {
+        free(keys);
+        return -1;
+    }
+    free(t->path);
+    t->path = copy;
+    t->mtime = st.st_mtim;
+    ssl_tickets_publish(t, keys);
+    atomic_store(&t->next_update, lb_now_sec() + SSL_TICKET_CHECK_SEC);
+    log_info("TLS ticket keys: %d from %s", keys->count, path);
+    return 0;
+}
+
+int ssl_tickets_set_secret(ssl_tickets_t *t, const void *secret, size_t len) {
+    if (len < 16) {
+        log_error("TLS ticket secret: at least 16 bytes needed");
+        return -1;
+    }
+
+    unsigned char *copy = malloc(len);
+    if (!copy) return -1;
+    memcpy(copy, secret, len);
+    if (t->secret) {
+        OPENSSL_cleanse(t->secret, t->secret_len);
+        free(t->secret);
+    }
+    t->secret = copy;
+    t->secret_len = len;
+    free(t->path);
+    t->path = NULL;
+
+    // New keys even within the current period
+    t->period = INT64_MIN;
+    return ssl_tickets_rotate(t, lb_now_sec()) < 0 ? -1 : 0;
+}
+
+int ssl_tickets_load_secret(ssl_tickets_t *t, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        log_error("TLS ticket secret %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    unsigned char buf[1024];
+    size_t len = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+    while (len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == '\r'))
+        len--;
+
+    int ret = ssl_tickets_set_secret(t, buf, len);
+    OPENSSL_cleanse(buf, sizeof(buf));
+    return ret;
+}
+
+int ssl_tickets_update(ssl_tickets_t *t, time_t now) {
+    if (now < atomic_load_explicit(&t->next_update, memory_order_relaxed) ||
+        atomic_exchange_explicit(&t->updating, true, memory_order_acquire))
+        return 0;
+
+    int ret = 0;
+    if (t->path) {
+        struct stat st;
+        if (stat(t->path, &st) == 0 &&
+            (st.st_mtim.tv_sec != t->mtime.tv_sec || st.st_mtim.tv_nsec != t->mtime.tv_nsec)) {
+            // A bad file keeps the keys we have
+            ssl_ticket_keys_t *keys = ssl_tickets_read_file(t->path);
+            if (keys) {
+                t->mtime = st.st_mtim;
+                ssl_tickets_publish(t, keys);
+                log_info("TLS ticket keys: reloaded %d from %s", keys->count, t->path);
+                ret = 1;
+            }
+        }
+        atomic_store_explicit(&t->next_update, now + SSL_TICKET_CHECK_SEC, memory_order_relaxed);
+    } else {
+        ret = ssl_tickets_rotate(t, now) > 0;
+        atomic_store_explicit(&t->next_update, (now / t->rotate + 1) * t->rotate, memory_order_relaxed);
+    }
+
+    atomic_store_explicit(&t->updating, false, memory_order_release);
+    return ret;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static int ssl_tickets_mac_init(EVP_MAC_CTX *hctx, const ssl_ticket_key_t *key) {
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, (void *)key->hmac, sizeof(key->hmac)),
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "SHA256", 0),
+        OSSL_PARAM_construct_end()
+    };
+    return EVP_MAC_CTX_set_params(hctx, params);
+}
+typedef EVP_MAC_CTX ssl_tickets_mac_t;
+#else
+static int ssl_tickets_mac_init(HMAC_CTX *hctx, const ssl_ticket_key_t *key) {
+    return HMAC_Init_ex(hctx, key->hmac, sizeof(key->hmac), EVP_sha256(), NULL);
+}
+typedef HMAC_CTX ssl_tickets_mac_t;
+#endif
+
+static int ssl_tickets_cbk(SSL *ssl, unsigned char *name, unsigned char *iv,
+                           EVP_CIPHER_CTX *ectx, ssl_tickets_mac_t *hctx, int enc) {
+    ssl_tickets_t *t = SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), ssl_tickets_idx);
+    if (!t) return enc ? -1 : 0;
+
+    ssl_tickets_update(t, lb_now_sec());
+
+    bool transient = !lb_rcu_online();
+    if (transient) {
+        while (lb_rcu_register() < 0)
+            sched_yield();
+    }
+
+    const ssl_ticket_keys_t *keys = atomic_load_explicit(&t->keys, memory_order_acquire);
+    int ret = 0;
+    if (enc) {
+        const ssl_ticket_key_t *key = &keys->keys[0];
+        memcpy(name, key->name, sizeof(key->name));
+        if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) > 0 &&
+            EVP_EncryptInit_ex(ectx, EVP_aes_256_cbc(), NULL, key->aes, iv) &&
+            ssl_tickets_mac_init(hctx, key)) {
+            atomic_fetch_add_explicit(&t->stats.issued, 1, memory_order_relaxed);
+            ret = 1;
+        } else {
+            ret = -1;
+        }
+    } else {
+        int i = 0;
+        while (i < keys->count && memcmp(name, keys->keys[i].name, sizeof(keys->keys[i].name)))
+            i++;
+
+        if (i == keys->count) {
+            atomic_fetch_add_explicit(&t->stats.unknown, 1, memory_order_relaxed);
+        } else if (EVP_DecryptInit_ex(ectx, EVP_aes_256_cbc(), NULL, keys->keys[i].aes, iv) &&
+                   ssl_tickets_mac_init(hctx, &keys->keys[i])) {
+            atomic_fetch_add_explicit(i ? &t->stats.renewed : &t->stats.resumed, 1,
+                                      memory_order_relaxed);
+            ret = i ? 2 : 1;
+        } else {
+            ret = -1;
+        }
+    }
+
+    if (transient)
+        lb_rcu_unregister();
+    return ret;
+}
+
+int ssl_ctx_set_tickets(SSL_CTX *ctx, ssl_tickets_t *t) {
+    pthread_once(&ssl_session_once, ssl_session_init_idx);
+    if (!SSL_CTX_set_ex_data(ctx, ssl_tickets_idx, t))
+        return -1;
+
+    SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    return SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, ssl_tickets_cbk) ? 0 : -1;
+#else
+    return SSL_CTX_set_tlsext_ticket_key_cb(ctx, ssl_tickets_cbk) ? 0 : -1;
+#endif
+}
+
+/* Shared session ID cache */
+
+typedef struct ssl_sess_slot {
+    int64_t expires;            // wall clock seconds
+    uint16_t der_len;
+    uint8_t id_len;             // 0 for an empty slot
+    uint8_t id[SSL_MAX_SSL_SESSION_ID_LENGTH];
+    uint8_t der[SSL_SESS_DER_MAX];
+} ssl_sess_slot_t;
+
+typedef struct ssl_sess_bucket {
+    _Atomic uint32_t seq;
+    ssl_sess_slot_t slots[SSL_SESS_WAYS];
+} __attribute__((aligned(CACHE_LINE_SIZE))) ssl_sess_bucket_t;
+
+typedef struct ssl_sess_segment {
+    uint32_t magic;
+    uint32_t version;
+    _Atomic uint32_t ready;
+    uint32_t nbuckets;
+    ssl_sess_bucket_t buckets[] __attribute__((aligned(CACHE_LINE_SIZE)));
+} ssl_sess_segment_t;
+
+struct ssl_sess_cache {
+    int fd;
+    size_t size;
+    uint32_t mask;
+    ssl_sess_segment_t *seg;
+
+    struct {
+        _Atomic uint64_t stores;
+        _Atomic uint64_t hits;
+        _Atomic uint64_t misses;
+        _Atomic uint64_t too_big;
+        _Atomic uint64_t busy;
+    } stats;
+};
+
+ssl_sess_cache_t* ssl_sess_cache_open(const char *name, uint32_t size) {
+    uint32_t nbuckets = 1;
+    while (nbuckets * SSL_SESS_WAYS < size && nbuckets < (1u << 24))
+        nbuckets <<= 1;
+    size_t len = sizeof(ssl_sess_segment_t) + (size_t)nbuckets * sizeof(ssl_sess_bucket_t);
+
+    char path[NAME_MAX];
+    snprintf(path, sizeof(path), "%s%s", name[0] == '/' ? "" : "/", name);
+    int fd = shm_open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        log_error("TLS session cache %s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    // The first process sizes the segment and the others take it as it
+    // is, whatever size they were configured with
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (!st.st_size && ftruncate(fd, len) < 0)) {
+        log_error("TLS session cache %s: %s", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    if (st.st_size)
+        len = st.st_size;
+
+    ssl_sess_segment_t *seg = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (seg == MAP_FAILED) {
+        log_error("TLS session cache %s: %s", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    uint32_t zero = 0;
+    if (atomic_compare_exchange_strong(&seg->ready, &zero, 1)) {
+        seg->magic = SSL_SESS_MAGIC;
+        seg->version = SSL_SESS_VERSION;
+        seg->nbuckets = nbuckets;
+        atomic_store_explicit(&seg->ready, 2, memory_order_release);
+    } else {
+        while (atomic_load_explicit(&seg->ready, memory_order_acquire) != 2)
+            sched_yield();
+    }
+
+    if (seg->magic != SSL_SESS_MAGIC || seg->version != SSL_SESS_VERSION ||
+        sizeof(*seg) + (size_t)seg->nbuckets * sizeof(ssl_sess_bucket_t) > len ||
+        (seg->nbuckets & (seg->nbuckets - 1))) {
+        log_error("TLS session cache %s: segment from another version", path);
+        munmap(seg, len);
+        close(fd);
+        return NULL;
+    }
+
+    ssl_sess_cache_t *c = calloc(1, sizeof(*c));
+    if (!c) {
+        munmap(seg, len);
+        close(fd);
+        return NULL;
+    }
+    c->fd = fd;
+    c->size = len;
+    c->seg = seg;
+    c->mask = seg->nbuckets - 1;
+    return c;
+}
+
+void ssl_sess_cache_close(ssl_sess_cache_t *c) {
+    if (!c) return;
+
+    // The segment stays for the other processes
+    munmap(c->seg, c->size);
+    close(c->fd);
+    free(c);
+}
+
+void ssl_sess_cache_get_stats(ssl_sess_cache_t *c, ssl_sess_cache_stats_t *out) {
+    out->stores = atomic_load(&c->stats.stores);
+    out->hits = atomic_load(&c->stats.hits);
+    out->misses = atomic_load(&c->stats.misses);
+    out->too_big = atomic_load(&c->stats.too_big);
+    out->busy = atomic_load(&c->stats.busy);
+}
+
+static ssl_sess_bucket_t* ssl_sess_bucket(ssl_sess_cache_t *c, const unsigned char *id, unsigned int len) {
+    return &c->seg->buckets[murmur3_64(id, len, 0x75627373) & c->mask];
+}
+
+static bool ssl_sess_lock(ssl_sess_bucket_t *b) {
+    for (int i = 0; i < SSL_SESS_SPINS; i++) {
+        uint32_t seq = atomic_load_explicit(&b->seq, memory_order_relaxed);
+        if (!(seq & 1) &&
+            atomic_compare_exchange_weak_explicit(&b->seq, &seq, seq + 1,
+                                                  memory_order_acquire, memory_order_relaxed))
+            return true;
+        sched_yield();
+    }
+    return false;
+}
+
+static void ssl_sess_unlock(ssl_sess_bucket_t *b) {
+    atomic_fetch_add_explicit(&b->seq, 1, memory_order_release);
+}
+
+static ssl_sess_slot_t* ssl_sess_find(ssl_sess_bucket_t *b, const unsigned char *id, unsigned int len) {
+    for (int i = 0; i < SSL_SESS_WAYS; i++) {
+        ssl_sess_slot_t *slot = &b->slots[i];
+        if (slot->id_len == len && !memcmp(slot->id, id, len))
+            return slot;
+    }
+    return NULL;
+}
+
+static ssl_sess_cache_t* ssl_sess_cache_of(SSL_CTX *ctx) {
+    return ssl_sess_idx < 0 ? NULL : SSL_CTX_get_ex_data(ctx, ssl_sess_idx);
+}
+
+int ssl_sock_sess_new_cbk(SSL *ssl, SSL_SESSION *sess) {
+    ssl_sess_cache_t *c = ssl_sess_cache_of(SSL_get_SSL_CTX(ssl));
+    unsigned int id_len;
+    const unsigned char *id = SSL_SESSION_get_id(sess, &id_len);
+    if (!c || !id_len)
+        return 0;
+
+    unsigned char der[SSL_SESS_DER_MAX];
+    int der_len = i2d_SSL_SESSION(sess, NULL);
+    if (der_len <= 0 || der_len > SSL_SESS_DER_MAX) {
+        atomic_fetch_add_explicit(&c->stats.too_big, 1, memory_order_relaxed);
+        return 0;
+    }
+    unsigned char *p = der;
+    i2d_SSL_SESSION(sess, &p);
+
+    int64_t now = lb_now_sec();
+    ssl_sess_bucket_t *b = ssl_sess_bucket(c, id, id_len);
+    if (!ssl_sess_lock(b)) {
+        atomic_fetch_add_explicit(&c->stats.busy, 1, memory_order_relaxed);
+        return 0;
+    }
+
+    // The same ID again, else an empty or expired slot, else the one
+    // that would expire first
+    ssl_sess_slot_t *slot = ssl_sess_find(b, id, id_len);
+    for (int i = 0; !slot && i < SSL_SESS_WAYS; i++) {
+        if (!b->slots[i].id_len || b->slots[i].expires <= now)
+            slot = &b->slots[i];
+    }
+    if (!slot) {
+        slot = &b->slots[0];
+        for (int i = 1; i < SSL_SESS_WAYS; i++) {
+            if (b->slots[i].expires < slot->expires)
+                slot = &b->slots[i];
+        }
+    }
+
+    slot->expires = (int64_t)SSL_SESSION_get_time(sess) + SSL_SESSION_get_timeout(sess);
+    slot->id_len = id_len;
+    memcpy(slot->id, id, id_len);
+    slot->der_len = der_len;
+    memcpy(slot->der, der, der_len);
+    ssl_sess_unlock(b);
+
+    atomic_fetch_add_explicit(&c->stats.stores, 1, memory_order_relaxed);
+    // We keep no reference to sess
+    return 0;
+}
+
+SSL_SESSION* ssl_sock_sess_get_cbk(SSL *ssl, const unsigned char *id, int len, int *copy) {
+    ssl_sess_cache_t *c = ssl_sess_cache_of(SSL_get_SSL_CTX(ssl));
+    *copy = 0;
+    if (!c || len <= 0 || len > SSL_MAX_SSL_SESSION_ID_LENGTH)
+        return NULL;
+
+    ssl_sess_bucket_t *b = ssl_sess_bucket(c, id, len);
+    unsigned char der[SSL_SESS_DER_MAX];
+    int der_len = 0;
+    int64_t expires = 0;
+
+    // Copy out under the seqlock and decode outside it
+    for (int i = 0; i < SSL_SESS_SPINS; i++) {
+        uint32_t seq = atomic_load_explicit(&b->seq, memory_order_acquire);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+
+        der_len = 0;
+        ssl_sess_slot_t *slot = ssl_sess_find(b, id, len);
+        if (slot) {
+            expires = slot->expires;
+            der_len = slot->der_len;
+            if (der_len > SSL_SESS_DER_MAX)
+                der_len = 0;
+            memcpy(der, slot->der, der_len);
+        }
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&b->seq, memory_order_relaxed) == seq)
+            break;
+        der_len = -1;
+    }
+
+    SSL_SESSION *sess = NULL;
+    if (der_len > 0 && expires > lb_now_sec()) {
+        const unsigned char *p = der;
+        sess = d2i_SSL_SESSION(NULL, &p, der_len);
+    }
+    atomic_fetch_add_explicit(sess ? &c->stats.hits : &c->stats.misses, 1, memory_order_relaxed);
+    return sess;
+}
+
+void ssl_sock_sess_remove_cbk(SSL_CTX *ctx, SSL_SESSION *sess) {
+    ssl_sess_cache_t *c = ssl_sess_cache_of(ctx);
+    unsigned int id_len;
+    const unsigned char *id = SSL_SESSION_get_id(sess, &id_len);
+    if (!c || !id_len)
+        return;
+
+    ssl_sess_bucket_t *b = ssl_sess_bucket(c, id, id_len);
+    if (!ssl_sess_lock(b))
+        return;
+    ssl_sess_slot_t *slot = ssl_sess_find(b, id, id_len);
+    if (slot)
+        slot->id_len = 0;
+    ssl_sess_unlock(b);
+}
+
+int ssl_ctx_set_sess_cache(SSL_CTX *ctx, ssl_sess_cache_t *c) {
+    pthread_once(&ssl_session_once, ssl_session_init_idx);
+    if (!SSL_CTX_set_ex_data(ctx, ssl_sess_idx, c))
+        return -1;
+
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+    SSL_CTX_sess_set_new_cb(ctx, ssl_sock_sess_new_cbk);
+    SSL_CTX_sess_set_get_cb(ctx, ssl_sock_sess_get_cbk);
+    SSL_CTX_sess_set_remove_cb(ctx, ssl_sock_sess_remove_cbk);
+    return 0;
+}
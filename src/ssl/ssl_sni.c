@@ -0,0 +1,460 @@
+#include "ssl/ssl.h"
+#include "ssl/ssl_sni.h"
+#include "core/lb_clock.h"
+#include "core/lb_rcu.h"
+#include "core/lb_utils.h"
+#include "utils/log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sched.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#define SSL_SNI_SEED            0x736e69
+#define SSL_SNI_NAME_MAX        255
+
+static uint64_t ssl_sni_hash(const char *name, size_t len, bool wildcard) {
+    return murmur3_64(name, len, SSL_SNI_SEED + wildcard);
+}
+
+static ssl_sni_entry_t* ssl_sni_find(const ssl_sni_index_t *idx, const char *name, size_t len, bool wildcard) {
+    for (uint32_t i = ssl_sni_hash(name, len, wildcard) & idx->mask; ; i = (i + 1) & idx->mask) {
+        ssl_sni_entry_t *e = idx->slots[i];
+        if (!e)
+            return NULL;
+        if (e->len == len && e->wildcard == wildcard && !memcmp(e->name, name, len))
+            return e;
+    }
+}
+
+// Lowercase copy of name, with "*." or "_." turned into the wildcard flag
+static ssl_sni_entry_t* ssl_sni_entry_new(const char *name, size_t len) {
+    bool wildcard = len > 2 && (name[0] == '*' || name[0] == '_') && name[1] == '.';
+    if (wildcard) {
+        name += 2;
+        len -= 2;
+    }
+    if (!len || len > SSL_SNI_NAME_MAX)
+        return NULL;
+
+    ssl_sni_entry_t *e = calloc(1, sizeof(*e));
+    if (!e || !(e->name = malloc(len + 1))) {
+        free(e);
+        return NULL;
+    }
+    for (size_t i = 0; i < len; i++)
+        e->name[i] = tolower((unsigned char)name[i]);
+    e->name[len] = '\0';
+    e->len = len;
+    e->wildcard = wildcard;
+    return e;
+}
+
+static void ssl_sni_entry_free(ssl_sni_entry_t *e) {
+    SSL_CTX *ctx = atomic_load(&e->ctx);
+    if (ctx)
+        SSL_CTX_free(ctx);
+    free(e->name);
+    free(e->path);
+    free(e);
+}
+
+static void ssl_sni_entry_retire(void *e) {
+    ssl_sni_entry_free(e);
+}
+
+static void ssl_sni_ctx_free(void *ctx) {
+    SSL_CTX_free(ctx);
+}
+
+static ssl_sni_index_t* ssl_sni_index_build(ssl_sni_entry_t **entries, uint32_t count) {
+    uint32_t size = 16;
+    while (size < 2 * count)
+        size <<= 1;
+
+    ssl_sni_index_t *idx = malloc(sizeof(*idx) + count * sizeof(idx->entries[0]));
+    if (!idx) return NULL;
+    idx->slots = calloc(size, sizeof(idx->slots[0]));
+    if (!idx->slots) {
+        free(idx);
+        return NULL;
+    }
+    idx->mask = size - 1;
+    idx->count = count;
+
+    for (uint32_t n = 0; n < count; n++) {
+        ssl_sni_entry_t *e = entries[n];
+        uint32_t i = ssl_sni_hash(e->name, e->len, e->wildcard) & idx->mask;
+        while (idx->slots[i])
+            i = (i + 1) & idx->mask;
+        idx->slots[i] = e;
+        idx->entries[n] = e;
+    }
+    return idx;
+}
+
+// Entries outlive the indexes they are in; each is retired on its own
+static void ssl_sni_index_free(void *p) {
+    ssl_sni_index_t *idx = p;
+    free(idx->slots);
+    free(idx);
+}
+
+static void ssl_sni_clock_append(ssl_sni_t *sni, ssl_sni_entry_t *e) {
+    e->clock_next = NULL;
+    if (sni->clock_tail)
+        sni->clock_tail->clock_next = e;
+    else
+        sni->clock_head = e;
+    sni->clock_tail = e;
+}
+
+// Called with sni->lock held
+static void ssl_sni_evict(ssl_sni_t *sni) {
+    uint32_t passes = 2 * sni->built + 1;
+    while (sni->built > sni->max_built && sni->clock_head && passes--) {
+        ssl_sni_entry_t *e = sni->clock_head;
+        sni->clock_head = e->clock_next;
+        if (!sni->clock_head)
+            sni->clock_tail = NULL;
+
+        if (atomic_exchange_explicit(&e->referenced, false, memory_order_relaxed)) {
+            ssl_sni_clock_append(sni, e);
+            continue;
+        }
+
+        e->on_clock = false;
+        sni->built--;
+        lb_rcu_retire(atomic_exchange(&e->ctx, NULL), ssl_sni_ctx_free);
+        atomic_fetch_add_explicit(&sni->stats.evictions, 1, memory_order_relaxed);
+    }
+}
+
+// Swaps in an index over entries, with sni->lock held. Entries of the old
+// index that are not among them are dropped.
+static int ssl_sni_publish(ssl_sni_t *sni, ssl_sni_entry_t **entries, uint32_t count) {
+    ssl_sni_index_t *idx = ssl_sni_index_build(entries, count);
+    if (!idx) return -1;
+
+    ssl_sni_index_t *old = atomic_load_explicit(&sni->index, memory_order_relaxed);
+    if (old) {
+        for (uint32_t i = 0; i < old->count; i++)
+            old->entries[i]->dead = true;
+        for (uint32_t i = 0; i < count; i++)
+            entries[i]->dead = false;
+
+        ssl_sni_entry_t *e = sni->clock_head;
+        sni->clock_head = sni->clock_tail = NULL;
+        while (e) {
+            ssl_sni_entry_t *next = e->clock_next;
+            if (e->dead) {
+                e->on_clock = false;
+                sni->built--;
+            } else {
+                ssl_sni_clock_append(sni, e);
+            }
+            e = next;
+        }
+    }
+
+    atomic_store_explicit(&sni->index, idx, memory_order_release);
+    if (old) {
+        for (uint32_t i = 0; i < old->count; i++) {
+            if (old->entries[i]->dead)
+                lb_rcu_retire(old->entries[i], ssl_sni_entry_retire);
+        }
+        lb_rcu_retire(old, ssl_sni_index_free);
+    }
+    return 0;
+}
+
+ssl_sni_t* ssl_sni_new(struct ssl_bind_conf *conf, uint32_t max_built) {
+    ssl_sni_t *sni = calloc(1, sizeof(*sni));
+    if (!sni) return NULL;
+
+    sni->conf = conf;
+    sni->max_built = max_built ? max_built : SSL_SNI_MAX_BUILT;
+    pthread_mutex_init(&sni->lock, NULL);
+    ssl_sni_index_t *idx = ssl_sni_index_build(NULL, 0);
+    if (!idx) {
+        free(sni);
+        return NULL;
+    }
+    atomic_store(&sni->index, idx);
+    return sni;
+}
+
+void ssl_sni_free(ssl_sni_t *sni) {
+    if (!sni) return;
+
+    ssl_sni_index_t *idx = atomic_load(&sni->index);
+    for (uint32_t i = 0; i < idx->count; i++)
+        ssl_sni_entry_free(idx->entries[i]);
+    ssl_sni_index_free(idx);
+    pthread_mutex_destroy(&sni->lock);
+    free(sni->dir);
+    free(sni);
+}
+
+// The current entries minus any keyed like e, plus e
+static int ssl_sni_replace(ssl_sni_t *sni, ssl_sni_entry_t *e) {
+    ssl_sni_index_t *old = atomic_load_explicit(&sni->index, memory_order_relaxed);
+    ssl_sni_entry_t **entries = malloc((old->count + 1) * sizeof(*entries));
+    if (!entries) return -1;
+
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < old->count; i++) {
+        ssl_sni_entry_t *o = old->entries[i];
+        if (o->len != e->len || o->wildcard != e->wildcard || memcmp(o->name, e->name, e->len))
+            entries[n++] = o;
+    }
+    entries[n++] = e;
+    int ret = ssl_sni_publish(sni, entries, n);
+    free(entries);
+    return ret;
+}
+
+int ssl_sni_add(ssl_sni_t *sni, const char *name, SSL_CTX *ctx) {
+    ssl_sni_entry_t *e = ssl_sni_entry_new(name, strlen(name));
+    if (!e || !SSL_CTX_up_ref(ctx)) {
+        if (e)
+            ssl_sni_entry_free(e);
+        return -1;
+    }
+    atomic_store(&e->ctx, ctx);
+
+    pthread_mutex_lock(&sni->lock);
+    int ret = ssl_sni_replace(sni, e);
+    pthread_mutex_unlock(&sni->lock);
+    if (ret < 0)
+        ssl_sni_entry_free(e);
+    return ret;
+}
+
+static bool ssl_sni_pem_name(const char *file, size_t *len) {
+    size_t n = strlen(file);
+    if (n <= 4 || strcmp(file + n - 4, ".pem"))
+        return false;
+    *len = n - 4;
+    return true;
+}
+
+// Called with sni->lock held
+static int ssl_sni_scan(ssl_sni_t *sni, const char *dir) {
+    DIR *d = opendir(dir);
+    struct stat dst;
+    if (!d || fstat(dirfd(d), &dst) < 0) {
+        log_error("SNI certificates %s: %s", dir, strerror(errno));
+        if (d)
+            closedir(d);
+        return -1;
+    }
+
+    ssl_sni_index_t *old = atomic_load_explicit(&sni->index, memory_order_relaxed);
+    uint32_t cap = old->count + 64, n = 0;
+    ssl_sni_entry_t **entries = malloc(cap * sizeof(*entries));
+    if (!entries) {
+        closedir(d);
+        return -1;
+    }
+
+    // Pinned contexts stay whatever the directory holds
+    for (uint32_t i = 0; i < old->count; i++) {
+        if (!old->entries[i]->path)
+            entries[n++] = old->entries[i];
+    }
+
+    struct dirent *de;
+    while ((de = readdir(d))) {
+        size_t len;
+        char path[PATH_MAX];
+        struct stat st;
+        if (!ssl_sni_pem_name(de->d_name, &len) ||
+            snprintf(path, sizeof(path), "%s/%s", dir, de->d_name) >= (int)sizeof(path) ||
+            stat(path, &st) < 0 || !S_ISREG(st.st_mode))
+            continue;
+
+        ssl_sni_entry_t *e = ssl_sni_entry_new(de->d_name, len);
+        if (!e) continue;
+
+        ssl_sni_entry_t *prev = ssl_sni_find(old, e->name, e->len, e->wildcard);
+        bool taken = false;
+        for (uint32_t i = 0; i < n && !taken; i++) {
+            taken = entries[i]->len == e->len && entries[i]->wildcard == e->wildcard &&
+                    !memcmp(entries[i]->name, e->name, e->len);
+        }
+        if (taken) {
+            // "*.x.pem" next to "_.x.pem", or a pinned name
+            ssl_sni_entry_free(e);
+            continue;
+        }
+
+        if (prev && prev->path && !strcmp(prev->path, path) &&
+            prev->mtime.tv_sec == st.st_mtim.tv_sec && prev->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+            ssl_sni_entry_free(e);
+            e = prev;
+        } else if (!(e->path = strdup(path))) {
+            ssl_sni_entry_free(e);
+            continue;
+        } else {
+            e->mtime = st.st_mtim;
+        }
+
+        if (n == cap) {
+            ssl_sni_entry_t **grown = realloc(entries, 2 * cap * sizeof(*entries));
+            if (!grown) {
+                if (e != prev)
+                    ssl_sni_entry_free(e);
+                break;
+            }
+            entries = grown;
+            cap *= 2;
+        }
+        entries[n++] = e;
+    }
+    closedir(d);
+
+    // Entries made above are new; on failure only they are ours to free
+    int ret = ssl_sni_publish(sni, entries, n);
+    if (ret < 0) {
+        for (uint32_t i = 0; i < n; i++) {
+            bool carried = false;
+            for (uint32_t j = 0; j < old->count && !carried; j++)
+                carried = old->entries[j] == entries[i];
+            if (!carried)
+                ssl_sni_entry_free(entries[i]);
+        }
+    } else {
+        sni->dir_mtime = dst.st_mtim;
+        ret = n;
+    }
+    free(entries);
+    return ret;
+}
+
+int ssl_sni_load_dir(ssl_sni_t *sni, const char *dir) {
+    char *copy = strdup(dir);
+    if (!copy) return -1;
+
+    pthread_mutex_lock(&sni->lock);
+    int ret = ssl_sni_scan(sni, dir);
+    if (ret >= 0) {
+        free(sni->dir);
+        sni->dir = copy;
+        copy = NULL;
+    }
+    pthread_mutex_unlock(&sni->lock);
+    free(copy);
+
+    atomic_store(&sni->next_check, lb_now_sec() + SSL_SNI_CHECK_SEC);
+    if (ret >= 0)
+        log_info("SNI certificates: %d names in %s", ret, dir);
+    return ret;
+}
+
+int ssl_sni_reload(ssl_sni_t *sni) {
+    pthread_mutex_lock(&sni->lock);
+    int ret = sni->dir ? ssl_sni_scan(sni, sni->dir) : -1;
+    pthread_mutex_unlock(&sni->lock);
+    return ret;
+}
+
+int ssl_sni_update(ssl_sni_t *sni, time_t now) {
+    if (now < atomic_load_explicit(&sni->next_check, memory_order_relaxed))
+        return 0;
+    atomic_store_explicit(&sni->next_check, now + SSL_SNI_CHECK_SEC, memory_order_relaxed);
+
+    // Files are added, replaced (renamed over) and removed through the
+    // directory, which changes its mtime
+    pthread_mutex_lock(&sni->lock);
+    struct stat st;
+    int ret = 0;
+    if (sni->dir && stat(sni->dir, &st) == 0 &&
+        (st.st_mtim.tv_sec != sni->dir_mtime.tv_sec || st.st_mtim.tv_nsec != sni->dir_mtime.tv_nsec)) {
+        int n = ssl_sni_scan(sni, sni->dir);
+        if (n >= 0) {
+            log_info("SNI certificates: reloaded %d names from %s", n, sni->dir);
+            ret = 1;
+        }
+    }
+    pthread_mutex_unlock(&sni->lock);
+    return ret;
+}
+
+static SSL_CTX* ssl_sni_entry_ctx(ssl_sni_t *sni, ssl_sni_entry_t *e) {
+    SSL_CTX *ctx = atomic_load_explicit(&e->ctx, memory_order_acquire);
+    if (ctx) {
+        if (!atomic_load_explicit(&e->referenced, memory_order_relaxed))
+            atomic_store_explicit(&e->referenced, true, memory_order_relaxed);
+        return ctx;
+    }
+    if (!e->path)
+        return NULL;
+
+    // Built outside the lock: loading a key from disk is slow, and two
+    // handshakes racing for the same name just build it twice
+    SSL_CTX *built = ssl_ctx_new(sni->conf);
+    if (!built || ssl_ctx_load_cert(built, e->path, e->path) < 0) {
+        if (built)
+            SSL_CTX_free(built);
+        atomic_fetch_add_explicit(&sni->stats.failures, 1, memory_order_relaxed);
+        return NULL;
+    }
+    atomic_fetch_add_explicit(&sni->stats.builds, 1, memory_order_relaxed);
+
+    pthread_mutex_lock(&sni->lock);
+    SSL_CTX *expected = NULL;
+    if (!atomic_compare_exchange_strong(&e->ctx, &expected, built)) {
+        pthread_mutex_unlock(&sni->lock);
+        SSL_CTX_free(built);
+        return expected;
+    }
+    // A dead entry is already retired, and takes the context with it
+    if (!e->dead) {
+        atomic_store_explicit(&e->referenced, true, memory_order_relaxed);
+        e->on_clock = true;
+        ssl_sni_clock_append(sni, e);
+        sni->built++;
+        ssl_sni_evict(sni);
+    }
+    pthread_mutex_unlock(&sni->lock);
+    return built;
+}
+
+bool ssl_sni_select(ssl_sni_t *sni, SSL *ssl, const char *servername) {
+    char name[SSL_SNI_NAME_MAX + 1];
+    size_t len = 0;
+    for (; servername[len] && len < sizeof(name); len++)
+        name[len] = tolower((unsigned char)servername[len]);
+    if (!len || len > SSL_SNI_NAME_MAX)
+        return false;
+
+    bool transient = !lb_rcu_online();
+    if (transient) {
+        while (lb_rcu_register() < 0)
+            sched_yield();
+    }
+
+    // The exact name, else a wildcard covering its first label
+    const ssl_sni_index_t *idx = atomic_load_explicit(&sni->index, memory_order_acquire);
+    ssl_sni_entry_t *e = ssl_sni_find(idx, name, len, false);
+    if (!e) {
+        const char *dot = memchr(name, '.', len);
+        if (dot && dot + 1 < name + len)
+            e = ssl_sni_find(idx, dot + 1, name + len - dot - 1, true);
+    }
+
+    SSL_CTX *ctx = e ? ssl_sni_entry_ctx(sni, e) : NULL;
+    if (ctx)
+        SSL_set_SSL_CTX(ssl, ctx);
+
+    if (transient)
+        lb_rcu_unregister();
+
+    atomic_fetch_add_explicit(ctx ? &sni->stats.hits : &sni->stats.misses, 1, memory_order_relaxed);
+    return ctx != NULL;
+}
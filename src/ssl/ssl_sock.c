@@ -2,6 +2,10 @@
 #include "core/common.h"
 #include "utils/log.h"
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
 #include <openssl/rand.h>
 #include <openssl/pem.h>
 
@@ -130,6 +134,44 @@ void ssl_sock_deinit() {
     ssl_initialized = 0;
 }
 
+// Ticket keys and the shared session cache of conf, made once for all
+// its contexts
+static int ssl_sock_prepare_resumption(ssl_bind_conf_t *conf) {
+    if (!conf->ticket_keys) {
+        ssl_tickets_t *t = ssl_tickets_new(conf->tickets.rotate);
+        if (!t)
+            return -1;
+        if ((conf->tickets.keys_file && ssl_tickets_load_file(t, conf->tickets.keys_file) < 0) ||
+            (conf->tickets.secret_file && ssl_tickets_load_secret(t, conf->tickets.secret_file) < 0)) {
+            ssl_tickets_free(t);
+            return -1;
+        }
+        conf->ticket_keys = t;
+    }
+
+    if (conf->session_cache.shm && !conf->sess_cache) {
+        conf->sess_cache = ssl_sess_cache_open(conf->session_cache.shm, conf->session_cache.size);
+        if (!conf->sess_cache)
+            return -1;
+    }
+    return 0;
+}
+
+// The index is made by the first context; the ones it builds per name
+// come back through here and find it set
+static int ssl_sock_prepare_sni(ssl_bind_conf_t *conf) {
+    if (!conf->crt_dir || conf->sni)
+        return 0;
+
+    ssl_sni_t *sni = ssl_sni_new(conf, conf->sni_cache_size);
+    if (!sni || ssl_sni_load_dir(sni, conf->crt_dir) < 0) {
+        ssl_sni_free(sni);
+        return -1;
+    }
+    conf->sni = sni;
+    return 0;
+}
+
 SSL_CTX* ssl_ctx_new(ssl_bind_conf_t *conf) {
     SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
     if (!ctx) {
@@ -151,15 +193,35 @@ SSL_CTX* ssl_ctx_new(ssl_bind_conf_t *conf) {
     if (conf->verify_depth > 0)
         SSL_CTX_set_verify_depth(ctx, conf->verify_depth);
 
+#ifdef SSL_OP_ENABLE_KTLS
+    if (conf->ktls)
+        SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#else
+    if (conf->ktls)
+        log_warning("OpenSSL built without kTLS, ktls ignored");
+#endif
+
     SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
     SSL_CTX_sess_set_cache_size(ctx, conf->session_cache.size);
     SSL_CTX_set_timeout(ctx, conf->session_cache.lifetime);
 
+    if (ssl_sock_prepare_resumption(conf) < 0 ||
+        ssl_ctx_set_tickets(ctx, conf->ticket_keys) < 0 ||
+        (conf->sess_cache && ssl_ctx_set_sess_cache(ctx, conf->sess_cache) < 0)) {
+        log_error("Failed to set up TLS session resumption");
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+
     SSL_CTX_set_info_callback(ctx, ssl_sock_info_cbk);
     SSL_CTX_set_msg_callback(ctx, ssl_sock_msg_cbk);
 
     SSL_CTX_set_tlsext_servername_callback(ctx, ssl_sock_switchctx_cbk);
     SSL_CTX_set_tlsext_servername_arg(ctx, conf);
+    if (ssl_sock_prepare_sni(conf) < 0) {
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
 
     if (conf->alpn_str) {
         SSL_CTX_set_alpn_select_cb(ctx, ssl_sock_alpn_select_cbk, conf);
@@ -237,6 +299,14 @@ int ssl_sock_handshake(struct connection *conn, unsigned int flag) {
     ssl_ctx->flags |= SSL_SOCK_FL_HANDSHAKE_DONE;
     conn->flags &= ~(CO_FL_WAIT_RD | CO_FL_WAIT_WR);
 
+#ifndef OPENSSL_NO_KTLS
+    // Whether OpenSSL managed to install the keys in the kernel
+    if (BIO_get_ktls_send(SSL_get_wbio(ssl)))
+        ssl_ctx->flags |= SSL_SOCK_FL_KTLS_TX;
+    if (BIO_get_ktls_recv(SSL_get_rbio(ssl)))
+        ssl_ctx->flags |= SSL_SOCK_FL_KTLS_RX;
+#endif
+
     const unsigned char *alpn;
     unsigned int alpn_len;
     SSL_get0_alpn_selected(ssl, &alpn, &alpn_len);
@@ -286,6 +356,19 @@ int ssl_sock_send(struct connection *conn, const void *buf, size_t len, int flag
     SSL *ssl = ssl_ctx->ssl;
     int ret;
 
+    if (ssl_ctx->flags & SSL_SOCK_FL_KTLS_TX) {
+        ssize_t n = send(conn->fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                conn->flags |= CO_FL_WAIT_WR;
+                return 0;
+            }
+            conn->flags |= CO_FL_ERROR;
+            return -1;
+        }
+        return n;
+    }
+
     ret = SSL_write(ssl, buf, len);
 
     if (ret <= 0) {
@@ -306,6 +389,48 @@ int ssl_sock_send(struct connection *conn, const void *buf, size_t len, int flag
     return ret;
 }
 
+int ssl_sock_ktls_fd(struct connection *conn) {
+    ssl_sock_ctx_t *ssl_ctx = conn->xprt_ctx;
+    return (ssl_ctx->flags & SSL_SOCK_FL_KTLS_TX) ? conn->fd : -1;
+}
+
+ssize_t ssl_sock_sendfile(struct connection *conn, int in_fd, off_t off, size_t len) {
+    ssl_sock_ctx_t *ssl_ctx = conn->xprt_ctx;
+
+    if (ssl_ctx->flags & SSL_SOCK_FL_KTLS_TX) {
+        ssize_t n = sendfile(conn->fd, in_fd, &off, len);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                conn->flags |= CO_FL_WAIT_WR;
+                return 0;
+            }
+            conn->flags |= CO_FL_ERROR;
+            return -1;
+        }
+        return n;
+    }
+
+    // One record's worth at a time, as SSL_write() would cut it anyway
+    char buf[16384];
+    size_t sent = 0;
+    while (sent < len) {
+        size_t want = len - sent < sizeof(buf) ? len - sent : sizeof(buf);
+        ssize_t n = pread(in_fd, buf, want, off + sent);
+        if (n <= 0) {
+            if (n < 0)
+                conn->flags |= CO_FL_ERROR;
+            return n < 0 && !sent ? -1 : (ssize_t)sent;
+        }
+        int w = ssl_sock_send(conn, buf, n, 0);
+        if (w < 0)
+            return sent ? (ssize_t)sent : -1;
+        sent += w;
+        if (w < n)
+            break;
+    }
+    return sent;
+}
+
 int ssl_sock_verify_cbk(int ok, X509_STORE_CTX *ctx) {
     SSL *ssl = X509_STORE_CTX_get_ex_data(ctx, SSL_get_ex_data_X509_STORE_CTX_idx());
     struct connection *conn = SSL_get_ex_data(ssl, 0);
@@ -357,6 +482,9 @@ int ssl_sock_switchctx_cbk(SSL *ssl, int *al, void *priv) {
     if (!servername)
         return SSL_TLSEXT_ERR_NOACK;
 
+    if (conf->sni && ssl_sni_select(conf->sni, ssl, servername))
+        return SSL_TLSEXT_ERR_OK;
+
     for (int i = 0; i < conf->sni_ctx_count; i++) {
         if (strcasecmp(servername, conf->sni_ctx[i].cert) == 0) {
             SSL_set_SSL_CTX(ssl, conf->sni_ctx[i].ctx);
@@ -416,11 +544,28 @@ void ssl_sock_msg_cbk(int write_p, int version, int content_type,
                      const void *buf, size_t len, SSL *ssl, void *arg) {
 }
 
+// alpn_str is our comma-separated preference list ("h2,http/1.1"); the first
+// of ours the client also offers wins. *out must point into the client's
+// wire-format list, which outlives the callback.
 int ssl_sock_alpn_select_cbk(SSL *ssl, const unsigned char **out, unsigned char *outlen,
                             const unsigned char *in, unsigned int inlen, void *arg) {
-    *out = in;
-    *outlen = inlen > 0 ? 1 : 0;
-    return SSL_TLSEXT_ERR_OK;
+    const ssl_bind_conf_t *conf = arg;
+    const char *proto = conf ? conf->alpn_str : NULL;
+
+    while (proto && *proto) {
+        size_t len = strcspn(proto, ",");
+        for (unsigned int i = 0; len > 0 && i < inlen; i += 1 + in[i]) {
+            if (i + 1 + in[i] > inlen) break;
+            if (in[i] == len && memcmp(in + i + 1, proto, len) == 0) {
+                *out = in + i + 1;
+                *outlen = in[i];
+                return SSL_TLSEXT_ERR_OK;
+            }
+        }
+        proto += len;
+        if (*proto == ',') proto++;
+    }
+    return SSL_TLSEXT_ERR_NOACK;
 }
 
 int ssl_sock_npn_advertise_cbk(SSL *ssl, const unsigned char **data, unsigned int *len, void *arg) {
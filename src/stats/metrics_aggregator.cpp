@@ -1,19 +1,20 @@
 #include "stats/metrics_aggregator.hpp"
+#include "stats/metrics.h"
 #include <cstring>
 
 namespace ultrabalancer {
 
 MetricsAggregator::MetricsAggregator() {
-    get_or_create("requests.total", Metric::COUNTER);
-    get_or_create("requests.success", Metric::COUNTER);
-    get_or_create("requests.failed", Metric::COUNTER);
-    get_or_create("response.time", Metric::TIMER);
-    get_or_create("connections.active", Metric::GAUGE);
-    get_or_create("bytes.in", Metric::COUNTER);
-    get_or_create("bytes.out", Metric::COUNTER);
-    get_or_create("backend.health", Metric::GAUGE);
-    get_or_create("cache.hits", Metric::COUNTER);
-    get_or_create("cache.misses", Metric::COUNTER);
+    requests_total_ = register_metric("requests.total", Metric::COUNTER);
+    requests_success_ = register_metric("requests.success", Metric::COUNTER);
+    requests_failed_ = register_metric("requests.failed", Metric::COUNTER);
+    response_time_ = register_metric("response.time", Metric::TIMER);
+    connections_active_ = register_metric("connections.active", Metric::GAUGE);
+    bytes_in_ = register_metric("bytes.in", Metric::COUNTER);
+    bytes_out_ = register_metric("bytes.out", Metric::COUNTER);
+    register_metric("backend.health", Metric::GAUGE);
+    register_metric("cache.hits", Metric::COUNTER);
+    register_metric("cache.misses", Metric::COUNTER);
 }
 
 MetricsAggregator& MetricsAggregator::instance() {
@@ -21,108 +22,103 @@ MetricsAggregator& MetricsAggregator::instance() {
     return instance;
 }
 
+MetricHandle MetricsAggregator::register_metric(const std::string& name, Metric::Type type) {
+    return MetricHandle(get_or_create(name, type));
+}
+
 void MetricsAggregator::increment_counter(const std::string& name, double value) {
-    auto metric = get_or_create(name, Metric::COUNTER);
-    metric->increment(value);
+    get_or_create(name, Metric::COUNTER)->increment(value);
 }
 
 void MetricsAggregator::set_gauge(const std::string& name, double value) {
-    auto metric = get_or_create(name, Metric::GAUGE);
-    metric->set(value);
+    get_or_create(name, Metric::GAUGE)->set(value);
 }
 
 void MetricsAggregator::record_timer(const std::string& name,
                                     std::chrono::nanoseconds duration) {
-    auto metric = get_or_create(name, Metric::TIMER);
-    metric->record_time(duration);
+    get_or_create(name, Metric::TIMER)->record_time(duration);
 }
 
 std::shared_ptr<Metric> MetricsAggregator::get_metric(const std::string& name) {
-    std::lock_guard<std::mutex> lock(mutex_);
+    std::shared_lock<std::shared_mutex> lock(mutex_);
     auto it = metrics_.find(name);
     return it != metrics_.end() ? it->second : nullptr;
 }
 
 std::unordered_map<std::string, std::shared_ptr<Metric>>
 MetricsAggregator::get_all_metrics() {
-    std::lock_guard<std::mutex> lock(mutex_);
+    std::shared_lock<std::shared_mutex> lock(mutex_);
     return metrics_;
 }
 
 MetricsAggregator::Stats MetricsAggregator::get_stats() {
     Stats stats{};
 
-    if (auto m = get_metric("requests.total")) {
-        stats.total_requests = m->get_count();
-    }
+    stats.total_requests = requests_total_.get()->get_count();
+    stats.successful_requests = requests_success_.get()->get_count();
+    stats.failed_requests = requests_failed_.get()->get_count();
 
-    if (auto m = get_metric("requests.success")) {
-        stats.successful_requests = m->get_count();
-        // stats.failed_requests =
-        //     stats.total_requests > stats.successful_requests
-        //         ? stats.total_requests - stats.successful_requests
-        //         : 0;
-    }
+    const Metric* rt = response_time_.get();
+    stats.avg_response_time_ms = rt->get_mean();
+    auto percentiles = rt->get_percentiles({50, 95, 99});
+    stats.p50_response_time_ms = percentiles[0];
+    stats.p95_response_time_ms = percentiles[1];
+    stats.p99_response_time_ms = percentiles[2];
 
-    if (auto m = get_metric("requests.failed")) {
-        stats.failed_requests = m->get_count();
-    }
+    stats.active_connections = static_cast<uint64_t>(connections_active_.get()->get_gauge());
+    stats.total_bytes_in = bytes_in_.get()->get_count();
+    stats.total_bytes_out = bytes_out_.get()->get_count();
 
-    if (auto m = get_metric("response.time")) {
-        stats.avg_response_time_ms = m->get_mean();
-        auto percentiles = m->get_percentiles({50, 95, 99});
-        if (percentiles.size() >= 3) {
-            stats.p50_response_time_ms = percentiles[0];
-            stats.p95_response_time_ms = percentiles[1];
-            stats.p99_response_time_ms = percentiles[2];
-        }
-    }
+    return stats;
+}
 
-    if (auto m = get_metric("connections.active")) {
-        stats.active_connections = static_cast<uint64_t>(m->get_gauge());
+// Metrics are zeroed, not dropped, so handles stay valid
+void MetricsAggregator::reset_stats() {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    for (auto& [name, metric] : metrics_) {
+        metric->reset();
     }
+}
 
-    if (auto m = get_metric("bytes.in")) {
-        stats.total_bytes_in = m->get_count();
+Metric* MetricsAggregator::get_or_create(const std::string& name, Metric::Type type) {
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = metrics_.find(name);
+        if (it != metrics_.end()) {
+            return it->second.get();
+        }
     }
 
-    if (auto m = get_metric("bytes.out")) {
-        stats.total_bytes_out = m->get_count();
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    auto& metric = metrics_[name];
+    if (!metric) {
+        metric = std::make_shared<Metric>(name, type);
     }
+    return metric.get();
+}
 
-    return stats;
 }
 
-void MetricsAggregator::reset_stats() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    metrics_.clear();
-
-    get_or_create("requests.total", Metric::COUNTER);
-    get_or_create("requests.success", Metric::COUNTER);
-    get_or_create("requests.failed", Metric::COUNTER);
-    get_or_create("response.time", Metric::TIMER);
-    get_or_create("connections.active", Metric::GAUGE);
-    get_or_create("bytes.in", Metric::COUNTER);
-    get_or_create("bytes.out", Metric::COUNTER);
-    // get_all_metrics().clear();
-}
-
-std::shared_ptr<Metric> MetricsAggregator::get_or_create(const std::string& name,
-                                                        Metric::Type type) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    auto it = metrics_.find(name);
-    if (it != metrics_.end()) {
-        return it->second;
-    }
+extern "C" {
 
-    auto metric = std::make_shared<Metric>(name, type);
-    metrics_[name] = metric;
-    return metric;
+metrics_metric_t* metrics_register(const char* name, metrics_type_t type) {
+    auto handle = ultrabalancer::MetricsAggregator::instance().register_metric(
+        name, static_cast<ultrabalancer::Metric::Type>(type));
+    return reinterpret_cast<metrics_metric_t*>(handle.get());
 }
 
+void metrics_increment(metrics_metric_t* metric, double value) {
+    ultrabalancer::MetricHandle(reinterpret_cast<ultrabalancer::Metric*>(metric)).increment(value);
 }
 
-extern "C" {
+void metrics_set(metrics_metric_t* metric, double value) {
+    ultrabalancer::MetricHandle(reinterpret_cast<ultrabalancer::Metric*>(metric)).set(value);
+}
+
+void metrics_record_ns(metrics_metric_t* metric, uint64_t nanoseconds) {
+    ultrabalancer::MetricHandle(reinterpret_cast<ultrabalancer::Metric*>(metric))
+        .record_time(std::chrono::nanoseconds(nanoseconds));
+}
 
 void metrics_increment_counter(const char* name, double value) {
     ultrabalancer::MetricsAggregator::instance().increment_counter(name, value);
@@ -144,7 +140,7 @@ void metrics_get_stats(void* stats_struct) {
     }
 }
 
-void metrics_reset() {
+void metrics_reset(void) {
     ultrabalancer::MetricsAggregator::instance().reset_stats();
 }
 
@@ -167,11 +163,9 @@ void metrics_get_percentiles(const char* name, double* p50, double* p95, double*
     auto metric = ultrabalancer::MetricsAggregator::instance().get_metric(name);
     if (metric) {
         auto percentiles = metric->get_percentiles({50, 95, 99});
-        if (percentiles.size() >= 3) {
-            if (p50) *p50 = percentiles[0];
-            if (p95) *p95 = percentiles[1];
-            if (p99) *p99 = percentiles[2];
-        }
+        if (p50) *p50 = percentiles[0];
+        if (p95) *p95 = percentiles[1];
+        if (p99) *p99 = percentiles[2];
     }
 }
 
@@ -1,4 +1,5 @@
 #include "stats/stats.h"
+#include "stats/stats_snapshot.h"
 #include "core/proxy.h"
 #include "health/health.h"
 #include "utils/log.h"
@@ -164,165 +165,12 @@ int stats_dump_csv_header(struct channel *chn) {
 
 // Output stats in JSON format
 int stats_dump_json_to_buffer(struct stream *s, struct channel *res) {
-    struct proxy *px;
-    char json_buf[65536];
-    int len = 0;
-
-    len += snprintf(json_buf + len, sizeof(json_buf) - len, "{\n");
-    len += snprintf(json_buf + len, sizeof(json_buf) - len, "  \"proxies\": [\n");
-
-    int first_px = 1;
-    for (px = proxies_list; px; px = px->next) {
-        if (!first_px) {
-            len += snprintf(json_buf + len, sizeof(json_buf) - len, ",\n");
-        }
-        first_px = 0;
-
-        len += snprintf(json_buf + len, sizeof(json_buf) - len,
-                       "    {\n"
-                       "      \"name\": \"%s\",\n"
-                       "      \"type\": \"%s\",\n"
-                       "      \"status\": \"%s\",\n",
-                       px->id,
-                       px->mode == PR_MODE_TCP ? "tcp" : "http",
-                       (px->state & PR_FL_READY) ? "UP" : "DOWN");
-
-        // Add frontend stats
-        if (px->type == PR_TYPE_FRONTEND || px->type == PR_TYPE_LISTEN) {
-            len += snprintf(json_buf + len, sizeof(json_buf) - len,
-                           "      \"frontend\": {\n"
-                           "        \"connections\": %lu,\n"
-                           "        \"sessions\": %lu,\n"
-                           "        \"bytes_in\": %lu,\n"
-                           "        \"bytes_out\": %lu,\n"
-                           "        \"denied_requests\": %lu,\n"
-                           "        \"errors\": %lu\n"
-                           "      }",
-                           atomic_load(&px->fe_counters[5]),
-                           atomic_load(&px->fe_counters[10]),
-                           atomic_load(&px->fe_counters[11]),
-                           atomic_load(&px->fe_counters[12]),
-                           atomic_load(&px->fe_counters[13]),
-                           atomic_load(&px->fe_counters[15]));
-        }
-
-        // Add backend stats
-        if (px->type == PR_TYPE_BACKEND || px->type == PR_TYPE_LISTEN) {
-            if (px->type == PR_TYPE_LISTEN) {
-                len += snprintf(json_buf + len, sizeof(json_buf) - len, ",\n");
-            }
-
-            len += snprintf(json_buf + len, sizeof(json_buf) - len,
-                           "      \"backend\": {\n"
-                           "        \"servers\": [\n");
-
-            server_t *srv;
-            int first_srv = 1;
-            for (srv = px->servers; srv; srv = srv->next) {
-                if (!first_srv) {
-                    len += snprintf(json_buf + len, sizeof(json_buf) - len, ",\n");
-                }
-                first_srv = 0;
-
-                const char *status = "UNKNOWN";
-                switch (srv->cur_state) {
-                    case SRV_RUNNING: status = "UP"; break;
-                    case SRV_BACKUP:  status = "BACKUP"; break;
-                    case SRV_DRAIN:   status = "DRAIN"; break;
-                    case SRV_MAINTAIN: status = "MAINT"; break;
-                }
-
-                len += snprintf(json_buf + len, sizeof(json_buf) - len,
-                               "          {\n"
-                               "            \"name\": \"%s\",\n"
-                               "            \"address\": \"%s:%d\",\n"
-                               "            \"status\": \"%s\",\n"
-                               "            \"weight\": %u,\n"
-                               "            \"active_connections\": %d,\n"
-                               "            \"total_connections\": %lu\n"
-                               "          }",
-                               srv->id,
-                               srv->hostname, srv->port,
-                               status,
-                               srv->weight,
-                               atomic_load(&srv->cur_conns),
-                               atomic_load(&srv->cum_conns));
-            }
-
-            len += snprintf(json_buf + len, sizeof(json_buf) - len,
-                           "\n        ]\n"
-                           "      }");
-        }
-
-        len += snprintf(json_buf + len, sizeof(json_buf) - len, "\n    }");
-    }
-
-    len += snprintf(json_buf + len, sizeof(json_buf) - len,
-                   "\n  ],\n"
-                   "  \"info\": {\n"
-                   "    \"version\": \"%s\",\n"
-                   "    \"uptime\": %ld,\n"
-                   "    \"max_connections\": %u,\n"
-                   "    \"current_connections\": %u\n"
-                   "  }\n"
-                   "}\n",
-                   UB_VERSION,
-                   time(NULL) - start_time,
-                   global.maxconn,
-                   total_connections);
-
-    return buffer_put(&res->buf, json_buf, len);
+    return stats_snapshot_dump_default(STATS_SNAP_JSON, res);
 }
 
 // Prometheus metrics format
 int stats_dump_prometheus(struct stream *s, struct channel *res) {
-    struct proxy *px;
-    char buf[4096];
-    int len;
-
-    // Global metrics
-    len = snprintf(buf, sizeof(buf),
-                  "# HELP ultrabalancer_up Is the load balancer up\n"
-                  "# TYPE ultrabalancer_up gauge\n"
-                  "ultrabalancer_up 1\n"
-                  "\n"
-                  "# HELP ultrabalancer_connections_total Total connections\n"
-                  "# TYPE ultrabalancer_connections_total counter\n");
-
-    buffer_put(&res->buf, buf, len);
-
-    // Per-proxy metrics
-    for (px = proxies_list; px; px = px->next) {
-        len = snprintf(buf, sizeof(buf),
-                      "ultrabalancer_frontend_connections_total{proxy=\"%s\"} %lu\n"
-                      "ultrabalancer_frontend_bytes_in_total{proxy=\"%s\"} %lu\n"
-                      "ultrabalancer_frontend_bytes_out_total{proxy=\"%s\"} %lu\n"
-                      "ultrabalancer_frontend_denied_requests_total{proxy=\"%s\"} %lu\n",
-                      px->id, atomic_load(&px->fe_counters[5]),
-                      px->id, atomic_load(&px->fe_counters[11]),
-                      px->id, atomic_load(&px->fe_counters[12]),
-                      px->id, atomic_load(&px->fe_counters[13]));
-
-        buffer_put(&res->buf, buf, len);
-
-        // Server metrics
-        server_t *srv;
-        for (srv = px->servers; srv; srv = srv->next) {
-            len = snprintf(buf, sizeof(buf),
-                          "ultrabalancer_server_up{proxy=\"%s\",server=\"%s\"} %d\n"
-                          "ultrabalancer_server_current_sessions{proxy=\"%s\",server=\"%s\"} %d\n"
-                          "ultrabalancer_server_total_sessions{proxy=\"%s\",server=\"%s\"} %lu\n"
-                          "ultrabalancer_server_weight{proxy=\"%s\",server=\"%s\"} %u\n",
-                          px->id, srv->id, (srv->cur_state == SRV_RUNNING) ? 1 : 0,
-                          px->id, srv->id, atomic_load(&srv->cur_conns),
-                          px->id, srv->id, atomic_load(&srv->cum_conns),
-                          px->id, srv->id, srv->weight);
-
-            buffer_put(&res->buf, buf, len);
-        }
-    }
-
-    return 0;
+    return stats_snapshot_dump_default(STATS_SNAP_PROMETHEUS, res);
 }
 
 // HTML stats page
@@ -0,0 +1,585 @@
+#include "stats/stats_snapshot.h"
+#include "core/proxy.h"
+#include "core/lb_clock.h"
+#include "utils/buffer.h"
+#include "utils/log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef enum {
+    SNAP_TEXT = 0,
+    SNAP_PX_FE,                 // px->fe_counters[arg]
+    SNAP_PX_STATUS,             // "UP" or "DOWN"
+    SNAP_SV_UP,
+    SNAP_SV_STATUS,
+    SNAP_SV_CUR_CONNS,
+    SNAP_SV_CUM_CONNS,
+    SNAP_SV_WEIGHT,
+    SNAP_UPTIME,
+    SNAP_MAXCONN,
+    SNAP_CUR_CONNS
+} snap_kind_t;
+
+// Text [off, off + len), then the value, then for a sample a newline
+typedef struct {
+    uint32_t off;
+    uint32_t len;
+    uint8_t kind;
+    uint8_t arg;
+    bool sample;
+    const void *obj;
+} snap_op_t;
+
+struct stats_snap_template {
+    char *text;
+    size_t text_len;
+    size_t text_cap;
+    snap_op_t *ops;
+    uint32_t nops;
+    uint32_t ops_cap;
+    uint32_t nvalues;
+    uint32_t nsamples;
+    size_t pending;             // text not yet in an op
+    bool failed;
+};
+
+// Longest rendering of one value: 20 digits or a status word
+#define SNAP_VALUE_MAX  20
+
+static _Atomic(stats_snapshot_t *) snap_default;
+
+static void tpl_free(stats_snap_template_t *t) {
+    if (!t) return;
+    free(t->text);
+    free(t->ops);
+    free(t);
+}
+
+static bool tpl_reserve(stats_snap_template_t *t, size_t len) {
+    if (t->text_len + len <= t->text_cap) return true;
+    size_t cap = t->text_cap ? t->text_cap : 4096;
+    while (cap < t->text_len + len) cap *= 2;
+    char *text = realloc(t->text, cap);
+    if (!text) {
+        t->failed = true;
+        return false;
+    }
+    t->text = text;
+    t->text_cap = cap;
+    return true;
+}
+
+static void tpl_put(stats_snap_template_t *t, const char *s, size_t len) {
+    if (!tpl_reserve(t, len)) return;
+    memcpy(t->text + t->text_len, s, len);
+    t->text_len += len;
+}
+
+static void tpl_str(stats_snap_template_t *t, const char *s) {
+    tpl_put(t, s, strlen(s));
+}
+
+__attribute__((format(printf, 2, 3)))
+static void tpl_printf(stats_snap_template_t *t, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    if (n < 0 || !tpl_reserve(t, n + 1)) {
+        t->failed = true;
+        return;
+    }
+    va_start(ap, fmt);
+    vsnprintf(t->text + t->text_len, n + 1, fmt, ap);
+    va_end(ap);
+    t->text_len += n;
+}
+
+// A JSON string body or a Prometheus label value; both escape \ and "
+static void tpl_escaped(stats_snap_template_t *t, const char *s, bool json) {
+    for (s = s ? s : ""; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            char esc[2] = { '\\', c };
+            tpl_put(t, esc, 2);
+        } else if (c == '\n') {
+            tpl_put(t, "\\n", 2);
+        } else if (c < 0x20) {
+            if (json) tpl_printf(t, "\\u%04x", c);
+        } else {
+            tpl_put(t, (const char *)&c, 1);
+        }
+    }
+}
+
+static void tpl_op(stats_snap_template_t *t, snap_kind_t kind, const void *obj,
+                   uint8_t arg, bool sample) {
+    if (t->nops == t->ops_cap) {
+        uint32_t cap = t->ops_cap ? t->ops_cap * 2 : 256;
+        snap_op_t *ops = realloc(t->ops, cap * sizeof(*ops));
+        if (!ops) {
+            t->failed = true;
+            return;
+        }
+        t->ops = ops;
+        t->ops_cap = cap;
+    }
+    t->ops[t->nops++] = (snap_op_t){
+        .off = t->pending, .len = t->text_len - t->pending,
+        .kind = kind, .arg = arg, .sample = sample, .obj = obj,
+    };
+    t->pending = t->text_len;
+    if (kind != SNAP_TEXT) t->nvalues++;
+    if (sample) t->nsamples++;
+}
+
+static void tpl_value(stats_snap_template_t *t, snap_kind_t kind, const void *obj, uint8_t arg) {
+    tpl_op(t, kind, obj, arg, false);
+}
+
+// Starts a sample's "name{labels} " in an op of its own, for the layout
+static void tpl_sample_begin(stats_snap_template_t *t) {
+    if (t->text_len > t->pending)
+        tpl_op(t, SNAP_TEXT, NULL, 0, false);
+}
+
+static void tpl_sample(stats_snap_template_t *t, snap_kind_t kind, const void *obj, uint8_t arg) {
+    tpl_put(t, " ", 1);
+    tpl_op(t, kind, obj, arg, true);
+}
+
+static stats_snap_template_t *tpl_finish(stats_snap_template_t *t) {
+    if (t->text_len > t->pending)
+        tpl_op(t, SNAP_TEXT, NULL, 0, false);
+    if (t->failed) {
+        tpl_free(t);
+        return NULL;
+    }
+    return t;
+}
+
+static const struct {
+    const char *name;
+    const char *help;
+    uint8_t counter;
+} prom_fe[] = {
+    { "ultrabalancer_frontend_connections_total", "Connections accepted by the frontend", 5 },
+    { "ultrabalancer_frontend_bytes_in_total", "Bytes received by the frontend", 11 },
+    { "ultrabalancer_frontend_bytes_out_total", "Bytes sent by the frontend", 12 },
+    { "ultrabalancer_frontend_denied_requests_total", "Requests denied by the frontend", 13 },
+};
+
+static const struct {
+    const char *name;
+    const char *help;
+    const char *type;
+    snap_kind_t kind;
+} prom_sv[] = {
+    { "ultrabalancer_server_up", "Whether the server is up", "gauge", SNAP_SV_UP },
+    { "ultrabalancer_server_current_sessions", "Current sessions on the server", "gauge", SNAP_SV_CUR_CONNS },
+    { "ultrabalancer_server_total_sessions", "Sessions sent to the server", "counter", SNAP_SV_CUM_CONNS },
+    { "ultrabalancer_server_weight", "Configured weight of the server", "gauge", SNAP_SV_WEIGHT },
+};
+
+static stats_snap_template_t *tpl_build_prometheus(void) {
+    stats_snap_template_t *t = calloc(1, sizeof(*t));
+    if (!t) return NULL;
+
+    tpl_str(t, "# HELP ultrabalancer_up Is the load balancer up\n"
+               "# TYPE ultrabalancer_up gauge\n"
+               "ultrabalancer_up 1\n");
+
+    for (size_t f = 0; f < sizeof(prom_fe) / sizeof(prom_fe[0]); f++) {
+        tpl_printf(t, "# HELP %s %s\n# TYPE %s counter\n",
+                   prom_fe[f].name, prom_fe[f].help, prom_fe[f].name);
+        for (proxy_t *px = proxies_list; px; px = px->next) {
+            tpl_sample_begin(t);
+            tpl_printf(t, "%s{proxy=\"", prom_fe[f].name);
+            tpl_escaped(t, px->id, false);
+            tpl_str(t, "\"}");
+            tpl_sample(t, SNAP_PX_FE, px, prom_fe[f].counter);
+        }
+    }
+
+    for (size_t f = 0; f < sizeof(prom_sv) / sizeof(prom_sv[0]); f++) {
+        tpl_printf(t, "# HELP %s %s\n# TYPE %s %s\n",
+                   prom_sv[f].name, prom_sv[f].help, prom_sv[f].name, prom_sv[f].type);
+        for (proxy_t *px = proxies_list; px; px = px->next) {
+            for (server_t *srv = px->servers; srv; srv = srv->next) {
+                tpl_sample_begin(t);
+                tpl_printf(t, "%s{proxy=\"", prom_sv[f].name);
+                tpl_escaped(t, px->id, false);
+                tpl_str(t, "\",server=\"");
+                tpl_escaped(t, srv->id, false);
+                tpl_str(t, "\"}");
+                tpl_sample(t, prom_sv[f].kind, srv, 0);
+            }
+        }
+    }
+    return tpl_finish(t);
+}
+
+static stats_snap_template_t *tpl_build_json(void) {
+    stats_snap_template_t *t = calloc(1, sizeof(*t));
+    if (!t) return NULL;
+
+    tpl_str(t, "{\n  \"proxies\": [\n");
+    for (proxy_t *px = proxies_list; px; px = px->next) {
+        if (px != proxies_list)
+            tpl_str(t, ",\n");
+
+        tpl_str(t, "    {\n      \"name\": \"");
+        tpl_escaped(t, px->id, true);
+        tpl_printf(t, "\",\n      \"type\": \"%s\",\n      \"status\": \"",
+                   px->mode == PR_MODE_TCP ? "tcp" : "http");
+        tpl_value(t, SNAP_PX_STATUS, px, 0);
+        tpl_str(t, "\"");
+
+        if (px->type == PR_TYPE_FRONTEND || px->type == PR_TYPE_LISTEN) {
+            tpl_str(t, ",\n      \"frontend\": {\n        \"connections\": ");
+            tpl_value(t, SNAP_PX_FE, px, 5);
+            tpl_str(t, ",\n        \"sessions\": ");
+            tpl_value(t, SNAP_PX_FE, px, 10);
+            tpl_str(t, ",\n        \"bytes_in\": ");
+            tpl_value(t, SNAP_PX_FE, px, 11);
+            tpl_str(t, ",\n        \"bytes_out\": ");
+            tpl_value(t, SNAP_PX_FE, px, 12);
+            tpl_str(t, ",\n        \"denied_requests\": ");
+            tpl_value(t, SNAP_PX_FE, px, 13);
+            tpl_str(t, ",\n        \"errors\": ");
+            tpl_value(t, SNAP_PX_FE, px, 15);
+            tpl_str(t, "\n      }");
+        }
+
+        if (px->type == PR_TYPE_BACKEND || px->type == PR_TYPE_LISTEN) {
+            tpl_str(t, ",\n      \"backend\": {\n        \"servers\": [\n");
+            for (server_t *srv = px->servers; srv; srv = srv->next) {
+                if (srv != px->servers)
+                    tpl_str(t, ",\n");
+                tpl_str(t, "          {\n            \"name\": \"");
+                tpl_escaped(t, srv->id, true);
+                tpl_str(t, "\",\n            \"address\": \"");
+                tpl_escaped(t, srv->hostname, true);
+                tpl_printf(t, ":%d\",\n            \"status\": \"", srv->port);
+                tpl_value(t, SNAP_SV_STATUS, srv, 0);
+                tpl_str(t, "\",\n            \"weight\": ");
+                tpl_value(t, SNAP_SV_WEIGHT, srv, 0);
+                tpl_str(t, ",\n            \"active_connections\": ");
+                tpl_value(t, SNAP_SV_CUR_CONNS, srv, 0);
+                tpl_str(t, ",\n            \"total_connections\": ");
+                tpl_value(t, SNAP_SV_CUM_CONNS, srv, 0);
+                tpl_str(t, "\n          }");
+            }
+            tpl_str(t, "\n        ]\n      }");
+        }
+        tpl_str(t, "\n    }");
+    }
+
+    tpl_printf(t, "\n  ],\n  \"info\": {\n    \"version\": \"%s\",\n    \"uptime\": ", UB_VERSION);
+    tpl_value(t, SNAP_UPTIME, NULL, 0);
+    tpl_str(t, ",\n    \"max_connections\": ");
+    tpl_value(t, SNAP_MAXCONN, NULL, 0);
+    tpl_str(t, ",\n    \"current_connections\": ");
+    tpl_value(t, SNAP_CUR_CONNS, NULL, 0);
+    tpl_str(t, "\n  }\n}\n");
+    return tpl_finish(t);
+}
+
+static const char *snap_string(const snap_op_t *op) {
+    if (op->kind == SNAP_PX_STATUS)
+        return (((const proxy_t *)op->obj)->state & PR_FL_READY) ? "UP" : "DOWN";
+
+    switch (((const server_t *)op->obj)->cur_state) {
+        case SRV_RUNNING:  return "UP";
+        case SRV_BACKUP:   return "BACKUP";
+        case SRV_DRAIN:    return "DRAIN";
+        case SRV_MAINTAIN: return "MAINT";
+        default:           return "UNKNOWN";
+    }
+}
+
+static uint64_t snap_number(const snap_op_t *op) {
+    const proxy_t *px = op->obj;
+    const server_t *srv = op->obj;
+
+    switch (op->kind) {
+        case SNAP_PX_FE:
+            return atomic_load_explicit(&px->fe_counters[op->arg], memory_order_relaxed);
+        case SNAP_SV_UP:
+            return srv->cur_state == SRV_RUNNING;
+        case SNAP_SV_CUR_CONNS: {
+            int32_t cur = atomic_load_explicit(&srv->cur_conns, memory_order_relaxed);
+            return cur > 0 ? (uint64_t)cur : 0;
+        }
+        case SNAP_SV_CUM_CONNS:
+            return atomic_load_explicit(&srv->cum_conns, memory_order_relaxed);
+        case SNAP_SV_WEIGHT:
+            return srv->weight;
+        case SNAP_UPTIME: {
+            time_t up = time(NULL) - start_time;
+            return up > 0 ? (uint64_t)up : 0;
+        }
+        case SNAP_MAXCONN:
+            return global.maxconn;
+        case SNAP_CUR_CONNS:
+            return total_connections;
+        default:
+            return 0;
+    }
+}
+
+static char *snap_u64(char *out, uint64_t v) {
+    char tmp[SNAP_VALUE_MAX];
+    int n = 0;
+    do {
+        tmp[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (n) *out++ = tmp[--n];
+    return out;
+}
+
+static size_t tpl_bound(const stats_snap_template_t *t) {
+    return t->text_len + (size_t)t->nvalues * (SNAP_VALUE_MAX + 1) + sizeof(stats_snap_header_t);
+}
+
+static bool snap_buf_reserve(stats_snap_buf_t *b, size_t len) {
+    if (len <= b->cap) return true;
+    char *data = realloc(b->data, len);
+    if (!data) return false;
+    b->data = data;
+    b->cap = len;
+    return true;
+}
+
+// out holds at least tpl_bound(t)
+static size_t snap_render_text(const stats_snap_template_t *t, char *out) {
+    char *p = out;
+    for (uint32_t i = 0; i < t->nops; i++) {
+        const snap_op_t *op = &t->ops[i];
+        memcpy(p, t->text + op->off, op->len);
+        p += op->len;
+        if (op->kind == SNAP_TEXT) continue;
+
+        if (op->kind == SNAP_PX_STATUS || op->kind == SNAP_SV_STATUS) {
+            const char *s = snap_string(op);
+            size_t n = strlen(s);
+            memcpy(p, s, n);
+            p += n;
+        } else {
+            p = snap_u64(p, snap_number(op));
+        }
+        if (op->sample) *p++ = '\n';
+    }
+    return p - out;
+}
+
+static size_t snap_render_layout(const stats_snap_template_t *t, char *out) {
+    char *p = out;
+    for (uint32_t i = 0; i < t->nops; i++) {
+        const snap_op_t *op = &t->ops[i];
+        if (!op->sample) continue;
+        // Without the space before the value
+        memcpy(p, t->text + op->off, op->len - 1);
+        p += op->len - 1;
+        *p++ = '\n';
+    }
+    return p - out;
+}
+
+static size_t snap_render_binary(const stats_snap_template_t *t, uint32_t generation, char *out) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    stats_snap_header_t hdr = {
+        .magic = STATS_SNAP_MAGIC,
+        .version = STATS_SNAP_VERSION,
+        .header_len = sizeof(hdr),
+        .generation = generation,
+        .count = t->nsamples,
+        .time_ms = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000,
+    };
+    memcpy(out, &hdr, sizeof(hdr));
+
+    char *p = out + sizeof(hdr);
+    for (uint32_t i = 0; i < t->nops; i++) {
+        if (!t->ops[i].sample) continue;
+        uint64_t v = snap_number(&t->ops[i]);
+        memcpy(p, &v, sizeof(v));
+        p += sizeof(v);
+    }
+    return p - out;
+}
+
+// Renders fmt into b, growing it only when the template outgrew it
+static int snap_render_into(stats_snap_buf_t *b, stats_snap_format_t fmt,
+                            const stats_snap_template_t *prom,
+                            const stats_snap_template_t *json, uint32_t generation) {
+    const stats_snap_template_t *t = fmt == STATS_SNAP_JSON ? json : prom;
+    if (!snap_buf_reserve(b, tpl_bound(t)))
+        return -1;
+
+    switch (fmt) {
+        case STATS_SNAP_BINARY: b->len = snap_render_binary(t, generation, b->data); break;
+        case STATS_SNAP_LAYOUT: b->len = snap_render_layout(t, b->data); break;
+        default:                b->len = snap_render_text(t, b->data); break;
+    }
+    return 0;
+}
+
+static int snap_render_locked(stats_snapshot_t *snap) {
+    uint64_t start = lb_now_ns();
+    for (int f = 0; f < STATS_SNAP_FORMATS; f++) {
+        if (snap_render_into(&snap->back[f], f, snap->prom, snap->json, snap->generation) < 0)
+            return -1;
+    }
+
+    // The old fronts become the next back buffers
+    pthread_rwlock_wrlock(&snap->swap);
+    for (int f = 0; f < STATS_SNAP_FORMATS; f++) {
+        stats_snap_buf_t tmp = snap->front[f];
+        snap->front[f] = snap->back[f];
+        snap->back[f] = tmp;
+    }
+    pthread_rwlock_unlock(&snap->swap);
+
+    atomic_fetch_add_explicit(&snap->stats.renders, 1, memory_order_relaxed);
+    atomic_store_explicit(&snap->stats.render_ns, lb_now_ns() - start, memory_order_relaxed);
+    return 0;
+}
+
+int stats_snapshot_rebuild(stats_snapshot_t *snap) {
+    stats_snap_template_t *prom = tpl_build_prometheus();
+    stats_snap_template_t *json = tpl_build_json();
+    if (!prom || !json) {
+        tpl_free(prom);
+        tpl_free(json);
+        return -1;
+    }
+
+    pthread_mutex_lock(&snap->lock);
+    tpl_free(snap->prom);
+    tpl_free(snap->json);
+    snap->prom = prom;
+    snap->json = json;
+    snap->generation++;
+    // Fronts may still hold values read through the old pointers, but
+    // only as copies
+    int ret = snap_render_locked(snap);
+    pthread_mutex_unlock(&snap->lock);
+    return ret;
+}
+
+int stats_snapshot_render(stats_snapshot_t *snap) {
+    pthread_mutex_lock(&snap->lock);
+    int ret = snap->prom ? snap_render_locked(snap) : -1;
+    pthread_mutex_unlock(&snap->lock);
+    return ret;
+}
+
+stats_snapshot_t* stats_snapshot_new(uint32_t interval_ms) {
+    stats_snapshot_t *snap = calloc(1, sizeof(*snap));
+    if (!snap) return NULL;
+
+    snap->interval_ms = interval_ms ? interval_ms : STATS_SNAP_INTERVAL_MS;
+    pthread_mutex_init(&snap->lock, NULL);
+    pthread_rwlock_init(&snap->swap, NULL);
+    if (stats_snapshot_rebuild(snap) < 0) {
+        stats_snapshot_free(snap);
+        return NULL;
+    }
+    return snap;
+}
+
+void stats_snapshot_free(stats_snapshot_t *snap) {
+    if (!snap) return;
+
+    stats_snapshot_stop(snap);
+    stats_snapshot_t *expected = snap;
+    atomic_compare_exchange_strong(&snap_default, &expected, NULL);
+
+    for (int f = 0; f < STATS_SNAP_FORMATS; f++) {
+        free(snap->back[f].data);
+        free(snap->front[f].data);
+    }
+    tpl_free(snap->prom);
+    tpl_free(snap->json);
+    pthread_rwlock_destroy(&snap->swap);
+    pthread_mutex_destroy(&snap->lock);
+    free(snap);
+}
+
+static void *stats_snapshot_loop(void *arg) {
+    stats_snapshot_t *snap = arg;
+
+    while (atomic_load(&snap->running)) {
+        // Sleep in short steps, so stop does not wait a whole interval
+        for (uint32_t slept = 0; slept < snap->interval_ms && atomic_load(&snap->running); ) {
+            uint32_t step = snap->interval_ms - slept < 50 ? snap->interval_ms - slept : 50;
+            usleep(step * 1000);
+            slept += step;
+        }
+        if (atomic_load(&snap->running) && stats_snapshot_render(snap) < 0)
+            log_warning("stats snapshot: render failed");
+    }
+    return NULL;
+}
+
+int stats_snapshot_start(stats_snapshot_t *snap) {
+    if (atomic_exchange(&snap->running, true))
+        return 0;
+    if (pthread_create(&snap->thread, NULL, stats_snapshot_loop, snap) != 0) {
+        atomic_store(&snap->running, false);
+        return -1;
+    }
+    return 0;
+}
+
+void stats_snapshot_stop(stats_snapshot_t *snap) {
+    if (!atomic_exchange(&snap->running, false))
+        return;
+    pthread_join(snap->thread, NULL);
+}
+
+int stats_snapshot_dump(stats_snapshot_t *snap, stats_snap_format_t fmt,
+                        struct channel *chn) {
+    if ((unsigned)fmt >= STATS_SNAP_FORMATS)
+        return -1;
+
+    pthread_rwlock_rdlock(&snap->swap);
+    int ret = buffer_put(&chn->buf, snap->front[fmt].data, snap->front[fmt].len);
+    pthread_rwlock_unlock(&snap->swap);
+
+    atomic_fetch_add_explicit(&snap->stats.scrapes, 1, memory_order_relaxed);
+    if (ret < 0)
+        atomic_fetch_add_explicit(&snap->stats.overflows, 1, memory_order_relaxed);
+    return ret;
+}
+
+void stats_snapshot_set_default(stats_snapshot_t *snap) {
+    atomic_store(&snap_default, snap);
+}
+
+int stats_snapshot_dump_default(stats_snap_format_t fmt, struct channel *chn) {
+    stats_snapshot_t *snap = atomic_load(&snap_default);
+    if (snap)
+        return stats_snapshot_dump(snap, fmt, chn);
+    if ((unsigned)fmt >= STATS_SNAP_FORMATS)
+        return -1;
+
+    // No renderer: compile and render for this one request
+    stats_snap_template_t *prom = fmt != STATS_SNAP_JSON ? tpl_build_prometheus() : NULL;
+    stats_snap_template_t *json = fmt == STATS_SNAP_JSON ? tpl_build_json() : NULL;
+    stats_snap_buf_t b = {0};
+    int ret = -1;
+    if ((prom || json) && snap_render_into(&b, fmt, prom, json, 0) == 0)
+        ret = buffer_put(&chn->buf, b.data, b.len);
+
+    free(b.data);
+    tpl_free(prom);
+    tpl_free(json);
+    return ret;
+}
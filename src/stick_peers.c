@@ -0,0 +1,888 @@
+#include "stick_peers.h"
+#include "core/lb_rcu.h"
+#include "utils/log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define STK_MSG_HELLO   1
+#define STK_MSG_UPDATE  2
+#define STK_MSG_RESYNC  3
+
+#define STK_HDR_LEN         5
+#define STK_BATCH_ENTRIES   1024
+/* A peer that cannot keep up is dropped and resynced on reconnect */
+#define STK_OUT_MAX         (64u << 20)
+#define STK_MSG_MAX         (16u << 20)
+#define STK_RETRY_MIN_MS    100
+#define STK_RETRY_MAX_MS    5000
+
+enum stk_conn_state {
+    STK_CONN_CONNECTING,
+    STK_CONN_HELLO,         /* waiting for the other side's HELLO */
+    STK_CONN_ESTABLISHED,
+};
+
+struct stk_buf {
+    uint8_t *p;
+    size_t len;
+    size_t off;             /* bytes already consumed or sent */
+    size_t cap;
+};
+
+struct stk_peer;
+
+struct stk_conn {
+    int fd;
+    enum stk_conn_state state;
+    struct stk_peer *peer;  /* NULL for an inbound connection before HELLO */
+    struct stk_buf in;
+    struct stk_buf out;
+};
+
+struct stk_peer {
+    char *name;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    bool local;
+    bool dialer;            /* this node opens the connection */
+    struct stk_conn *conn;
+    uint64_t retry_at;
+    uint32_t backoff;
+};
+
+struct stk_peers {
+    char *local;
+    uint32_t flush_ms;
+
+    struct stk_peer peers[STK_PEERS_MAX];
+    uint32_t peer_count;
+
+    stick_table_t **tables;
+    uint32_t table_count;
+
+    /* Connections owned by the sync thread, established or not */
+    struct stk_conn **conns;
+    uint32_t conn_count;
+    uint32_t conn_cap;
+
+    int listen_fd;
+    int wake_fd;
+    pthread_t thread;
+    _Atomic bool running;
+    _Atomic uint32_t connected;
+
+    struct stk_buf batch;   /* scratch for one flush */
+
+    struct {
+        _Atomic uint64_t connects;
+        _Atomic uint64_t resyncs_sent;
+        _Atomic uint64_t messages_sent;
+        _Atomic uint64_t updates_sent;
+        _Atomic uint64_t updates_received;
+        _Atomic uint64_t errors;
+    } stats;
+};
+
+static uint64_t stk_peers_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int buf_reserve(struct stk_buf *b, size_t n) {
+    if (b->len + n <= b->cap)
+        return 0;
+
+    /* Reclaim what was already consumed before growing */
+    if (b->off) {
+        memmove(b->p, b->p + b->off, b->len - b->off);
+        b->len -= b->off;
+        b->off = 0;
+        if (b->len + n <= b->cap)
+            return 0;
+    }
+
+    size_t cap = b->cap ? b->cap : 4096;
+    while (cap < b->len + n)
+        cap *= 2;
+    uint8_t *p = realloc(b->p, cap);
+    if (!p)
+        return -1;
+    b->p = p;
+    b->cap = cap;
+    return 0;
+}
+
+static int buf_put(struct stk_buf *b, const void *data, size_t n) {
+    if (buf_reserve(b, n) < 0)
+        return -1;
+    memcpy(b->p + b->len, data, n);
+    b->len += n;
+    return 0;
+}
+
+static int buf_varint(struct stk_buf *b, uint64_t v) {
+    uint8_t tmp[10];
+    size_t n = 0;
+    do {
+        tmp[n] = v & 0x7f;
+        v >>= 7;
+        if (v)
+            tmp[n] |= 0x80;
+        n++;
+    } while (v);
+    return buf_put(b, tmp, n);
+}
+
+static int buf_str(struct stk_buf *b, const void *s, size_t len) {
+    if (buf_varint(b, len) < 0)
+        return -1;
+    return buf_put(b, s, len);
+}
+
+static void buf_be32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static uint32_t get_be32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void buf_free(struct stk_buf *b) {
+    free(b->p);
+    memset(b, 0, sizeof(*b));
+}
+
+/* Starts a message; returns the header offset for msg_end */
+static size_t msg_begin(struct stk_buf *b, uint8_t type) {
+    size_t at = b->len;
+    uint8_t hdr[STK_HDR_LEN] = { type };
+    buf_put(b, hdr, sizeof(hdr));
+    return at;
+}
+
+static void msg_end(struct stk_buf *b, size_t at) {
+    buf_be32(b->p + at + 1, b->len - at - STK_HDR_LEN);
+}
+
+/* Reader over a received payload */
+struct stk_rd {
+    const uint8_t *p;
+    const uint8_t *end;
+    bool err;
+};
+
+static uint64_t rd_varint(struct stk_rd *r) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (r->p >= r->end)
+            break;
+        uint8_t c = *r->p++;
+        v |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return v;
+    }
+    r->err = true;
+    return 0;
+}
+
+static const uint8_t *rd_bytes(struct stk_rd *r, size_t *len) {
+    *len = rd_varint(r);
+    if (r->err || (size_t)(r->end - r->p) < *len) {
+        r->err = true;
+        return NULL;
+    }
+    const uint8_t *s = r->p;
+    r->p += *len;
+    return s;
+}
+
+static int parse_addr(const char *spec, struct sockaddr_storage *ss, socklen_t *len) {
+    char host[256];
+    const char *colon = strrchr(spec, ':');
+    if (!colon || colon == spec || (size_t)(colon - spec) >= sizeof(host))
+        return -1;
+
+    memcpy(host, spec, colon - spec);
+    host[colon - spec] = '\0';
+
+    /* [v6]:port */
+    char *h = host;
+    size_t hl = strlen(h);
+    if (h[0] == '[' && h[hl - 1] == ']') {
+        h[hl - 1] = '\0';
+        h++;
+    }
+
+    struct addrinfo hints = { .ai_socktype = SOCK_STREAM, .ai_flags = AI_NUMERICSERV };
+    struct addrinfo *res;
+    if (getaddrinfo(h, colon + 1, &hints, &res) != 0 || !res)
+        return -1;
+
+    memcpy(ss, res->ai_addr, res->ai_addrlen);
+    *len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
+
+stk_peers_t* stk_peers_new(const char *local, uint32_t flush_ms) {
+    stk_peers_t *ps = calloc(1, sizeof(*ps));
+    if (!ps) return NULL;
+
+    ps->local = strdup(local);
+    if (!ps->local) {
+        free(ps);
+        return NULL;
+    }
+    ps->flush_ms = flush_ms ? flush_ms : STK_PEERS_FLUSH_MS;
+    ps->listen_fd = -1;
+    ps->wake_fd = -1;
+    return ps;
+}
+
+int stk_peers_add(stk_peers_t *ps, const char *name, const char *addr) {
+    if (ps->peer_count >= STK_PEERS_MAX)
+        return -1;
+
+    struct stk_peer *p = &ps->peers[ps->peer_count];
+    memset(p, 0, sizeof(*p));
+    if (parse_addr(addr, &p->addr, &p->addr_len) < 0) {
+        log_error("peers: bad address '%s' for peer %s", addr, name);
+        return -1;
+    }
+
+    p->name = strdup(name);
+    if (!p->name)
+        return -1;
+    p->local = strcmp(name, ps->local) == 0;
+    p->dialer = !p->local && strcmp(ps->local, name) < 0;
+    ps->peer_count++;
+    return 0;
+}
+
+int stk_peers_attach(stk_peers_t *ps, stick_table_t *t) {
+    stick_table_t **tables = realloc(ps->tables, (ps->table_count + 1) * sizeof(*tables));
+    if (!tables)
+        return -1;
+
+    ps->tables = tables;
+    ps->tables[ps->table_count++] = t;
+    t->peers = ps;
+    return 0;
+}
+
+static stick_table_t *stk_peers_table(stk_peers_t *ps, const uint8_t *id, size_t len) {
+    for (uint32_t i = 0; i < ps->table_count; i++) {
+        stick_table_t *t = ps->tables[i];
+        if (strlen(t->id) == len && memcmp(t->id, id, len) == 0)
+            return t;
+    }
+    return NULL;
+}
+
+static struct stk_peer *stk_peers_find(stk_peers_t *ps, const uint8_t *name, size_t len) {
+    for (uint32_t i = 0; i < ps->peer_count; i++) {
+        struct stk_peer *p = &ps->peers[i];
+        if (!p->local && strlen(p->name) == len && memcmp(p->name, name, len) == 0)
+            return p;
+    }
+    return NULL;
+}
+
+/* Entry serialisation, shared by the flush and the resync */
+static void put_entry(struct stk_buf *b, const stick_entry_t *e, uint32_t mask,
+                      const uint64_t vals[STKTABLE_DATA_BITS]) {
+    const stick_key_t *k = &e->key;
+    switch (k->type) {
+        case STKTABLE_TYPE_IP:
+            buf_str(b, &k->data.ipv4, sizeof(k->data.ipv4));
+            break;
+        case STKTABLE_TYPE_IPV6:
+            buf_str(b, &k->data.ipv6, sizeof(k->data.ipv6));
+            break;
+        case STKTABLE_TYPE_INTEGER: {
+            /* Network order, so nodes of either endianness agree */
+            uint8_t be[4];
+            buf_be32(be, k->data.integer);
+            buf_str(b, be, sizeof(be));
+            break;
+        }
+        default:
+            buf_str(b, k->data.bin.ptr, k->data.bin.len);
+            break;
+    }
+
+    buf_varint(b, mask);
+    for (uint32_t m = mask; m; m &= m - 1)
+        buf_varint(b, vals[__builtin_ctz(m)]);
+}
+
+struct stk_batch {
+    struct stk_buf *b;
+    stick_table_t *t;
+    uint8_t type;
+    size_t msg;             /* header offset of the open message */
+    size_t count_at;
+    uint32_t count;
+};
+
+static void batch_open(struct stk_batch *bt) {
+    bt->msg = msg_begin(bt->b, bt->type);
+    buf_str(bt->b, bt->t->id, strlen(bt->t->id));
+    buf_varint(bt->b, bt->t->type);
+    bt->count_at = bt->b->len;
+    uint8_t zero[4] = { 0 };
+    buf_put(bt->b, zero, sizeof(zero));
+    bt->count = 0;
+}
+
+static void batch_close(struct stk_batch *bt) {
+    if (!bt->count) {
+        /* Nothing went in: drop the empty message */
+        bt->b->len = bt->msg;
+        return;
+    }
+    buf_be32(bt->b->p + bt->count_at, bt->count);
+    msg_end(bt->b, bt->msg);
+}
+
+static void batch_add(struct stk_batch *bt, const stick_entry_t *e, uint32_t mask,
+                      const uint64_t vals[STKTABLE_DATA_BITS]) {
+    if (bt->count == STK_BATCH_ENTRIES) {
+        batch_close(bt);
+        batch_open(bt);
+    }
+    put_entry(bt->b, e, mask, vals);
+    bt->count++;
+}
+
+static void resync_entry(stick_entry_t *e, void *arg) {
+    struct stk_batch *bt = arg;
+    uint64_t vals[STKTABLE_DATA_BITS];
+    uint32_t mask = stktable_sync_snapshot(bt->t, e, vals);
+    batch_add(bt, e, mask, vals);
+}
+
+static void conn_resync(stk_peers_t *ps, struct stk_conn *c) {
+    for (uint32_t i = 0; i < ps->table_count; i++) {
+        struct stk_batch bt = { .b = &c->out, .t = ps->tables[i], .type = STK_MSG_RESYNC };
+        batch_open(&bt);
+        stktable_walk(bt.t, resync_entry, &bt);
+        batch_close(&bt);
+    }
+    atomic_fetch_add(&ps->stats.resyncs_sent, 1);
+}
+
+static void conn_hello(stk_peers_t *ps, struct stk_conn *c) {
+    size_t at = msg_begin(&c->out, STK_MSG_HELLO);
+    buf_varint(&c->out, STK_PEERS_VERSION);
+    buf_str(&c->out, ps->local, strlen(ps->local));
+    msg_end(&c->out, at);
+}
+
+static struct stk_conn *conn_new(stk_peers_t *ps, int fd, enum stk_conn_state state) {
+    if (ps->conn_count == ps->conn_cap) {
+        uint32_t cap = ps->conn_cap ? ps->conn_cap * 2 : 8;
+        struct stk_conn **conns = realloc(ps->conns, cap * sizeof(*conns));
+        if (!conns)
+            return NULL;
+        ps->conns = conns;
+        ps->conn_cap = cap;
+    }
+
+    struct stk_conn *c = calloc(1, sizeof(*c));
+    if (!c)
+        return NULL;
+    c->fd = fd;
+    c->state = state;
+    ps->conns[ps->conn_count++] = c;
+    return c;
+}
+
+static void conn_close(stk_peers_t *ps, struct stk_conn *c) {
+    for (uint32_t i = 0; i < ps->conn_count; i++) {
+        if (ps->conns[i] == c) {
+            ps->conns[i] = ps->conns[--ps->conn_count];
+            break;
+        }
+    }
+
+    struct stk_peer *p = c->peer;
+    if (p && p->conn == c) {
+        p->conn = NULL;
+        if (c->state == STK_CONN_ESTABLISHED)
+            atomic_fetch_sub(&ps->connected, 1);
+        if (p->dialer) {
+            p->backoff = p->backoff ? p->backoff * 2 : STK_RETRY_MIN_MS;
+            if (p->backoff > STK_RETRY_MAX_MS)
+                p->backoff = STK_RETRY_MAX_MS;
+            p->retry_at = stk_peers_now_ms() + p->backoff;
+        }
+    }
+
+    close(c->fd);
+    buf_free(&c->in);
+    buf_free(&c->out);
+    free(c);
+}
+
+static int set_nonblock(int fd) {
+    int fl = fcntl(fd, F_GETFL);
+    return fl < 0 ? -1 : fcntl(fd, F_SETFL, fl | O_NONBLOCK);
+}
+
+static void peer_dial(stk_peers_t *ps, struct stk_peer *p) {
+    int fd = socket(p->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return;
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (connect(fd, (struct sockaddr *)&p->addr, p->addr_len) < 0 && errno != EINPROGRESS) {
+        close(fd);
+        p->backoff = p->backoff ? p->backoff * 2 : STK_RETRY_MIN_MS;
+        if (p->backoff > STK_RETRY_MAX_MS)
+            p->backoff = STK_RETRY_MAX_MS;
+        p->retry_at = stk_peers_now_ms() + p->backoff;
+        return;
+    }
+
+    struct stk_conn *c = conn_new(ps, fd, STK_CONN_CONNECTING);
+    if (!c) {
+        close(fd);
+        return;
+    }
+    c->peer = p;
+    p->conn = c;
+}
+
+static void conn_established(stk_peers_t *ps, struct stk_conn *c) {
+    c->state = STK_CONN_ESTABLISHED;
+    c->peer->backoff = 0;
+    atomic_fetch_add(&ps->connected, 1);
+    atomic_fetch_add(&ps->stats.connects, 1);
+    conn_resync(ps, c);
+    log_info("peers: connected to %s", c->peer->name);
+}
+
+static int handle_hello(stk_peers_t *ps, struct stk_conn *c, struct stk_rd *r) {
+    uint64_t version = rd_varint(r);
+    size_t len;
+    const uint8_t *name = rd_bytes(r, &len);
+    if (r->err || version != STK_PEERS_VERSION)
+        return -1;
+
+    struct stk_peer *p = stk_peers_find(ps, name, len);
+    if (!p || (c->peer && c->peer != p))
+        return -1;
+
+    if (!c->peer) {
+        /* Inbound: the newest connection from a peer replaces an old one */
+        if (p->conn)
+            conn_close(ps, p->conn);
+        c->peer = p;
+        p->conn = c;
+        conn_hello(ps, c);
+    }
+    conn_established(ps, c);
+    return 0;
+}
+
+static int handle_updates(stk_peers_t *ps, struct stk_rd *r, bool full) {
+    size_t id_len;
+    const uint8_t *id = rd_bytes(r, &id_len);
+    uint64_t type = rd_varint(r);
+    if (r->err || r->end - r->p < 4)
+        return -1;
+    uint32_t count = get_be32(r->p);
+    r->p += 4;
+
+    /* A table this node does not replicate is skipped, not an error */
+    stick_table_t *t = stk_peers_table(ps, id, id_len);
+    if (!t || (uint64_t)t->type != type)
+        return 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        size_t klen;
+        const uint8_t *kb = rd_bytes(r, &klen);
+        uint32_t mask = rd_varint(r);
+        uint64_t vals[STKTABLE_DATA_BITS] = { 0 };
+        for (uint32_t m = mask; m && !r->err; m &= m - 1) {
+            uint64_t v = rd_varint(r);
+            int bit = __builtin_ctz(m);
+            if (bit < STKTABLE_DATA_BITS)
+                vals[bit] = v;
+        }
+        if (r->err)
+            return -1;
+
+        stick_key_t key = { .type = t->type };
+        switch (t->type) {
+            case STKTABLE_TYPE_IP:
+                if (klen != sizeof(key.data.ipv4)) return -1;
+                memcpy(&key.data.ipv4, kb, klen);
+                break;
+            case STKTABLE_TYPE_IPV6:
+                if (klen != sizeof(key.data.ipv6)) return -1;
+                memcpy(&key.data.ipv6, kb, klen);
+                break;
+            case STKTABLE_TYPE_INTEGER:
+                if (klen != 4) return -1;
+                key.data.integer = get_be32(kb);
+                break;
+            default:
+                key.data.bin.ptr = (void *)kb;
+                key.data.bin.len = klen;
+                break;
+        }
+
+        stktable_sync_apply(t, &key, mask, vals, full);
+        atomic_fetch_add_explicit(&ps->stats.updates_received, 1, memory_order_relaxed);
+    }
+    return 0;
+}
+
+/* Parses every complete message in c->in; -1 drops the connection */
+static int conn_process(stk_peers_t *ps, struct stk_conn *c) {
+    struct stk_buf *b = &c->in;
+
+    while (b->len - b->off >= STK_HDR_LEN) {
+        const uint8_t *hdr = b->p + b->off;
+        uint32_t len = get_be32(hdr + 1);
+        if (len > STK_MSG_MAX)
+            return -1;
+        if (b->len - b->off < STK_HDR_LEN + len)
+            break;
+
+        struct stk_rd r = { hdr + STK_HDR_LEN, hdr + STK_HDR_LEN + len, false };
+        int ret;
+        if (hdr[0] == STK_MSG_HELLO)
+            ret = c->state == STK_CONN_HELLO ? handle_hello(ps, c, &r) : -1;
+        else if (c->state != STK_CONN_ESTABLISHED)
+            ret = -1;
+        else if (hdr[0] == STK_MSG_UPDATE || hdr[0] == STK_MSG_RESYNC)
+            ret = handle_updates(ps, &r, hdr[0] == STK_MSG_RESYNC);
+        else
+            ret = 0;        /* unknown types are for newer versions */
+
+        if (ret < 0)
+            return -1;
+        b->off += STK_HDR_LEN + len;
+    }
+
+    if (b->off == b->len)
+        b->off = b->len = 0;
+    return 0;
+}
+
+static int conn_read(stk_peers_t *ps, struct stk_conn *c) {
+    for (;;) {
+        if (buf_reserve(&c->in, 16384) < 0)
+            return -1;
+        ssize_t n = recv(c->fd, c->in.p + c->in.len, c->in.cap - c->in.len, 0);
+        if (n > 0) {
+            c->in.len += n;
+            continue;
+        }
+        if (n == 0)
+            return -1;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+        if (errno != EINTR)
+            return -1;
+    }
+    return conn_process(ps, c);
+}
+
+static int conn_write(struct stk_conn *c) {
+    struct stk_buf *b = &c->out;
+
+    while (b->off < b->len) {
+        ssize_t n = send(c->fd, b->p + b->off, b->len - b->off, MSG_NOSIGNAL);
+        if (n > 0) {
+            b->off += n;
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        if (n < 0 && errno == EINTR)
+            continue;
+        return -1;
+    }
+    b->off = b->len = 0;
+    return 0;
+}
+
+/* Sends every queued entry's changes, one batch per table */
+static void stk_peers_flush(stk_peers_t *ps) {
+    for (uint32_t i = 0; i < ps->table_count; i++) {
+        stick_table_t *t = ps->tables[i];
+        stick_entry_t *e = stktable_sync_take(t);
+        if (!e)
+            continue;
+
+        struct stk_batch bt = { .b = &ps->batch, .t = t, .type = STK_MSG_UPDATE };
+        ps->batch.len = ps->batch.off = 0;
+        batch_open(&bt);
+
+        uint64_t sent = 0;
+        while (e) {
+            stick_entry_t *next = e->sync_next;
+            uint64_t vals[STKTABLE_DATA_BITS];
+            uint32_t mask = stktable_sync_collect(e, vals);
+            if (mask) {
+                batch_add(&bt, e, mask, vals);
+                sent++;
+            }
+            stktable_sync_done(e);
+            e = next;
+        }
+        batch_close(&bt);
+
+        if (!ps->batch.len)
+            continue;
+        for (uint32_t j = 0; j < ps->conn_count; j++) {
+            struct stk_conn *c = ps->conns[j];
+            if (c->state != STK_CONN_ESTABLISHED)
+                continue;
+            buf_put(&c->out, ps->batch.p, ps->batch.len);
+            atomic_fetch_add_explicit(&ps->stats.messages_sent, 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&ps->stats.updates_sent, sent, memory_order_relaxed);
+        }
+    }
+}
+
+static void stk_peers_accept(stk_peers_t *ps) {
+    for (;;) {
+        int fd = accept4(ps->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            return;
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (!conn_new(ps, fd, STK_CONN_HELLO))
+            close(fd);
+    }
+}
+
+static void *stk_peers_loop(void *arg) {
+    stk_peers_t *ps = arg;
+    uint64_t next_flush = stk_peers_now_ms() + ps->flush_ms;
+    struct pollfd *pfd = NULL;
+    uint32_t pfd_cap = 0;
+
+    /* Entries from lookups stay valid until our next quiescent state */
+    while (lb_rcu_register() < 0)
+        sched_yield();
+
+    while (atomic_load_explicit(&ps->running, memory_order_acquire)) {
+        uint64_t now = stk_peers_now_ms();
+
+        for (uint32_t i = 0; i < ps->peer_count; i++) {
+            struct stk_peer *p = &ps->peers[i];
+            if (p->dialer && !p->conn && now >= p->retry_at)
+                peer_dial(ps, p);
+        }
+
+        if (now >= next_flush) {
+            stk_peers_flush(ps);
+            next_flush = now + ps->flush_ms;
+        }
+
+        /* Drop peers whose backlog outgrew the limit */
+        for (uint32_t i = 0; i < ps->conn_count;) {
+            struct stk_conn *c = ps->conns[i];
+            if (c->out.len - c->out.off > STK_OUT_MAX) {
+                log_warning("peers: %s is too slow, resyncing", c->peer ? c->peer->name : "peer");
+                atomic_fetch_add(&ps->stats.errors, 1);
+                conn_close(ps, c);
+                continue;
+            }
+            i++;
+        }
+
+        uint32_t n = 2 + ps->conn_count;
+        if (n > pfd_cap) {
+            struct pollfd *np = realloc(pfd, n * sizeof(*np));
+            if (!np)
+                break;
+            pfd = np;
+            pfd_cap = n;
+        }
+        pfd[0] = (struct pollfd){ .fd = ps->wake_fd, .events = POLLIN };
+        pfd[1] = (struct pollfd){ .fd = ps->listen_fd, .events = POLLIN };
+        for (uint32_t i = 0; i < ps->conn_count; i++) {
+            struct stk_conn *c = ps->conns[i];
+            short ev = c->state == STK_CONN_CONNECTING ? POLLOUT : POLLIN;
+            if (c->out.len > c->out.off)
+                ev |= POLLOUT;
+            pfd[2 + i] = (struct pollfd){ .fd = c->fd, .events = ev };
+        }
+
+        lb_rcu_quiescent();
+        int timeout = next_flush > now ? (int)(next_flush - now) : 0;
+        if (poll(pfd, n, timeout) < 0 && errno != EINTR)
+            break;
+
+        if (pfd[1].revents & POLLIN)
+            stk_peers_accept(ps);
+
+        /* Walk the connections polled this round; closing swaps the last
+         * one in, so match by fd rather than by index */
+        for (uint32_t i = 2; i < n; i++) {
+            if (!pfd[i].revents)
+                continue;
+
+            struct stk_conn *c = NULL;
+            for (uint32_t j = 0; j < ps->conn_count; j++) {
+                if (ps->conns[j]->fd == pfd[i].fd) {
+                    c = ps->conns[j];
+                    break;
+                }
+            }
+            if (!c)
+                continue;
+
+            int bad = pfd[i].revents & (POLLERR | POLLNVAL);
+            if (c->state == STK_CONN_CONNECTING && !bad && (pfd[i].revents & (POLLOUT | POLLHUP))) {
+                int err = 0;
+                socklen_t el = sizeof(err);
+                getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &el);
+                if (err) {
+                    conn_close(ps, c);
+                    continue;
+                }
+                c->state = STK_CONN_HELLO;
+                conn_hello(ps, c);
+            }
+
+            if (bad || ((pfd[i].revents & (POLLIN | POLLHUP)) && conn_read(ps, c) < 0) ||
+                conn_write(c) < 0) {
+                if (c->state == STK_CONN_ESTABLISHED)
+                    log_warning("peers: lost %s", c->peer->name);
+                conn_close(ps, c);
+            }
+        }
+    }
+
+    /* Last changes go out before the connections close */
+    stk_peers_flush(ps);
+    for (uint32_t i = 0; i < ps->conn_count; i++)
+        conn_write(ps->conns[i]);
+    while (ps->conn_count)
+        conn_close(ps, ps->conns[0]);
+
+    free(pfd);
+    lb_rcu_unregister();
+    return NULL;
+}
+
+int stk_peers_start(stk_peers_t *ps) {
+    struct stk_peer *self = NULL;
+    for (uint32_t i = 0; i < ps->peer_count; i++) {
+        if (ps->peers[i].local)
+            self = &ps->peers[i];
+    }
+    if (!self) {
+        log_error("peers: no peer named %s for the local node", ps->local);
+        return -1;
+    }
+
+    int fd = socket(self->addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, (struct sockaddr *)&self->addr, self->addr_len) < 0 || listen(fd, 16) < 0 ||
+        set_nonblock(fd) < 0) {
+        log_error("peers: cannot listen for %s: %s", ps->local, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    ps->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ps->wake_fd < 0) {
+        close(fd);
+        return -1;
+    }
+    ps->listen_fd = fd;
+
+    atomic_store(&ps->running, true);
+    if (pthread_create(&ps->thread, NULL, stk_peers_loop, ps) != 0) {
+        atomic_store(&ps->running, false);
+        close(ps->wake_fd);
+        close(ps->listen_fd);
+        ps->wake_fd = ps->listen_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void stk_peers_stop(stk_peers_t *ps) {
+    if (!atomic_exchange(&ps->running, false))
+        return;
+
+    uint64_t one = 1;
+    ssize_t n = write(ps->wake_fd, &one, sizeof(one));
+    (void)n;
+    pthread_join(ps->thread, NULL);
+
+    close(ps->wake_fd);
+    close(ps->listen_fd);
+    ps->wake_fd = ps->listen_fd = -1;
+}
+
+void stk_peers_free(stk_peers_t *ps) {
+    if (!ps) return;
+
+    stk_peers_stop(ps);
+
+    /* Release the references held by queued entries */
+    for (uint32_t i = 0; i < ps->table_count; i++) {
+        stick_table_t *t = ps->tables[i];
+        t->peers = NULL;
+        for (stick_entry_t *e = stktable_sync_take(t), *next; e; e = next) {
+            uint64_t vals[STKTABLE_DATA_BITS];
+            next = e->sync_next;
+            stktable_sync_collect(e, vals);
+            stktable_sync_done(e);
+        }
+    }
+
+    for (uint32_t i = 0; i < ps->peer_count; i++)
+        free(ps->peers[i].name);
+    buf_free(&ps->batch);
+    free(ps->conns);
+    free(ps->tables);
+    free(ps->local);
+    free(ps);
+}
+
+uint32_t stk_peers_connected(stk_peers_t *ps) {
+    return atomic_load(&ps->connected);
+}
+
+void stk_peers_get_stats(stk_peers_t *ps, stk_peers_stats_t *out) {
+    out->connects = atomic_load(&ps->stats.connects);
+    out->resyncs_sent = atomic_load(&ps->stats.resyncs_sent);
+    out->messages_sent = atomic_load(&ps->stats.messages_sent);
+    out->updates_sent = atomic_load(&ps->stats.updates_sent);
+    out->updates_received = atomic_load(&ps->stats.updates_received);
+    out->errors = atomic_load(&ps->stats.errors);
+}
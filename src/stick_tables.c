@@ -1,13 +1,246 @@
 #include "stick_tables.h"
 #include "core/proxy.h"
+#include "core/lb_rcu.h"
+#include "core/lb_utils.h"
 #include "utils/log.h"
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /* Global list of stick tables */
 static stick_table_t *stick_tables = NULL;
 static pthread_rwlock_t stick_tables_lock = PTHREAD_RWLOCK_INITIALIZER;
 
+/* Control bytes: EMPTY and DELETED have the top bit set, a full slot
+ * holds the low 7 bits of its key's hash */
+#define STK_EMPTY    0x80
+#define STK_DELETED  0xfe
+
+/* Probing compares one group of control bytes at a time: 16 with SSE2,
+ * 8 with the portable word-at-a-time version. A match mask has one bit
+ * per slot (SSE2) or the top bit of each byte (SWAR); STK_MASK_SHIFT
+ * turns a bit position into a slot offset. */
+#ifdef __SSE2__
+#define STK_GROUP       16
+#define STK_MASK_SHIFT  0
+
+static inline uint32_t stk_match(const uint8_t *ctrl, uint8_t tag) {
+    __m128i g = _mm_loadu_si128((const __m128i *)ctrl);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)tag)));
+}
+
+static inline uint32_t stk_match_empty(const uint8_t *ctrl) {
+    return stk_match(ctrl, STK_EMPTY);
+}
+
+static inline uint32_t stk_match_free(const uint8_t *ctrl) {
+    /* EMPTY and DELETED are the only bytes with the top bit set */
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+}
+#else
+#define STK_GROUP       8
+#define STK_MASK_SHIFT  3
+
+#define STK_LSB 0x0101010101010101ULL
+#define STK_MSB 0x8080808080808080ULL
+
+static inline uint64_t stk_load(const uint8_t *ctrl) {
+    uint64_t g;
+    memcpy(&g, ctrl, sizeof(g));
+    return g;
+}
+
+/* May report a false positive next to a true match; the key compare
+ * filters those out */
+static inline uint64_t stk_match(const uint8_t *ctrl, uint8_t tag) {
+    uint64_t x = stk_load(ctrl) ^ (STK_LSB * tag);
+    return (x - STK_LSB) & ~x & STK_MSB;
+}
+
+/* Exact: only EMPTY has the top bit set and bit 1 clear */
+static inline uint64_t stk_match_empty(const uint8_t *ctrl) {
+    uint64_t g = stk_load(ctrl);
+    return g & ~(g << 6) & STK_MSB;
+}
+
+static inline uint64_t stk_match_free(const uint8_t *ctrl) {
+    return stk_load(ctrl) & STK_MSB;
+}
+#endif
+
+#define STK_MIN_CAP  STK_GROUP
+
+struct stktable_slot {
+    uint8_t key[STKTABLE_KEY_INLINE];   /* leading key bytes, zero padded */
+    uint32_t key_len;
+    stick_entry_t *entry;
+};
+
+static inline time_t stktable_now(void) {
+    /* Second resolution is all expiry needs */
+    return lb_now_sec();
+}
+
+static const void *stktable_key_bytes(const stick_key_t *key, size_t *len) {
+    switch (key->type) {
+        case STKTABLE_TYPE_IP:
+            *len = sizeof(key->data.ipv4);
+            return &key->data.ipv4;
+        case STKTABLE_TYPE_IPV6:
+            *len = sizeof(key->data.ipv6);
+            return &key->data.ipv6;
+        case STKTABLE_TYPE_INTEGER:
+            *len = sizeof(key->data.integer);
+            return &key->data.integer;
+        case STKTABLE_TYPE_STRING:
+            *len = key->data.str.len;
+            return key->data.str.ptr;
+        case STKTABLE_TYPE_BINARY:
+            *len = key->data.bin.len;
+            return key->data.bin.ptr;
+    }
+    *len = 0;
+    return NULL;
+}
+
+static inline stktable_shard_t *stktable_shard(stick_table_t *t, uint64_t hash) {
+    return &t->shards[hash >> (64 - STKTABLE_SHARD_BITS)];
+}
+
+static int stktable_shard_alloc(stktable_shard_t *sh, uint32_t cap) {
+    uint8_t *ctrl = malloc(cap);
+    struct stktable_slot *slots = malloc((size_t)cap * sizeof(*slots));
+    if (!ctrl || !slots) {
+        free(ctrl);
+        free(slots);
+        return -1;
+    }
+
+    memset(ctrl, STK_EMPTY, cap);
+    sh->ctrl = ctrl;
+    sh->slots = slots;
+    sh->cap = cap;
+    sh->growth_left = cap - cap / 8 - sh->count;
+    return 0;
+}
+
+/* Slot for a hash known to be absent: the first EMPTY or DELETED one on
+ * its probe sequence. Groups are aligned and visited in triangular
+ * order, which reaches every group of a power-of-two table. */
+static uint32_t stktable_find_free(const stktable_shard_t *sh, uint64_t hash) {
+    uint32_t mask = sh->cap - 1;
+    uint32_t pos = (uint32_t)(hash >> 7) & mask & ~(STK_GROUP - 1);
+
+    for (uint32_t step = STK_GROUP;; step += STK_GROUP) {
+        uint64_t m = stk_match_free(&sh->ctrl[pos]);
+        if (m)
+            return pos + (__builtin_ctzll(m) >> STK_MASK_SHIFT);
+        pos = (pos + step) & mask;
+    }
+}
+
+/* Rebuilds the shard at new_cap, dropping tombstones on the way */
+static int stktable_rehash(stktable_shard_t *sh, uint32_t new_cap) {
+    uint8_t *old_ctrl = sh->ctrl;
+    struct stktable_slot *old_slots = sh->slots;
+    uint32_t old_cap = sh->cap;
+
+    if (stktable_shard_alloc(sh, new_cap) < 0) {
+        sh->ctrl = old_ctrl;
+        sh->slots = old_slots;
+        sh->cap = old_cap;
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < old_cap; i++) {
+        if (old_ctrl[i] & 0x80)
+            continue;
+
+        uint64_t hash = old_slots[i].entry->hash;
+        uint32_t at = stktable_find_free(sh, hash);
+        sh->ctrl[at] = hash & 0x7f;
+        sh->slots[at] = old_slots[i];
+    }
+
+    free(old_ctrl);
+    free(old_slots);
+    return 0;
+}
+
+static bool stktable_slot_match(const struct stktable_slot *slot, const void *key, size_t len) {
+    if (slot->key_len != len)
+        return false;
+    if (len <= STKTABLE_KEY_INLINE)
+        return memcmp(slot->key, key, len) == 0;
+
+    /* Long keys: the inline prefix rejects most mismatches first */
+    if (memcmp(slot->key, key, STKTABLE_KEY_INLINE) != 0)
+        return false;
+
+    size_t elen;
+    const void *ekey = stktable_key_bytes(&slot->entry->key, &elen);
+    return memcmp(ekey, key, len) == 0;
+}
+
+/* Slot index holding key, or -1. Stops at the first group with an EMPTY
+ * control byte: an insert would have used it. */
+static int64_t stktable_find(const stktable_shard_t *sh, uint64_t hash, const void *key, size_t len) {
+    uint32_t mask = sh->cap - 1;
+    uint32_t pos = (uint32_t)(hash >> 7) & mask & ~(STK_GROUP - 1);
+    uint8_t tag = hash & 0x7f;
+
+    for (uint32_t step = STK_GROUP; step <= sh->cap; step += STK_GROUP) {
+        for (uint64_t m = stk_match(&sh->ctrl[pos], tag); m; m &= m - 1) {
+            uint32_t at = pos + (__builtin_ctzll(m) >> STK_MASK_SHIFT);
+            if (stktable_slot_match(&sh->slots[at], key, len))
+                return at;
+        }
+        if (stk_match_empty(&sh->ctrl[pos]))
+            return -1;
+        pos = (pos + step) & mask;
+    }
+    return -1;
+}
+
+static void stktable_entry_free(void *ptr) {
+    stick_entry_t *entry = ptr;
+    if ((entry->key.type == STKTABLE_TYPE_STRING || entry->key.type == STKTABLE_TYPE_BINARY) &&
+        entry->key.data.str.ptr != (char *)entry->key_buf) {
+        free(entry->key.data.str.ptr);
+    }
+    free(entry);
+}
+
+/* Takes the entry in slot `at` out of the shard; the caller holds the
+ * shard lock. The entry itself goes once readers are done with it. */
+static void stktable_remove_slot(stick_table_t *t, stktable_shard_t *sh, uint32_t at, int defer) {
+    stick_entry_t *entry = sh->slots[at].entry;
+    uint32_t group = at & ~(STK_GROUP - 1);
+
+    /* A group that still has an EMPTY never made a probe move on, so the
+     * slot can be EMPTY again rather than a tombstone */
+    if (stk_match_empty(&sh->ctrl[group])) {
+        sh->ctrl[at] = STK_EMPTY;
+        sh->growth_left++;
+    } else {
+        sh->ctrl[at] = STK_DELETED;
+    }
+    sh->count--;
+
+    LIST_DEL(&entry->list);
+    LIST_DEL(&entry->wheel);
+    atomic_fetch_sub(&t->current, 1);
+
+    if (defer)
+        lb_rcu_retire(entry, stktable_entry_free);
+    else
+        stktable_entry_free(entry);
+}
+
 stick_table_t* stktable_new(const char *id, int type, uint32_t size, uint32_t expire) {
     stick_table_t *t = calloc(1, sizeof(*t));
     if (!t) return NULL;
@@ -16,30 +249,37 @@ stick_table_t* stktable_new(const char *id, int type, uint32_t size, uint32_t ex
     t->type = type;
     t->size = size;
     t->expire = expire;
-    t->current = 0;
-
-    /* Initialize hash table with prime size for better distribution */
-    t->hash.size = size | 1;  // Make it odd
-    t->hash.entries = calloc(t->hash.size, sizeof(stick_entry_t*));
-    t->hash.locks = calloc(t->hash.size, sizeof(pthread_spinlock_t));
+    t->rate_period = STKTABLE_RATE_PERIOD;
+    t->seed = murmur3_64(id, strlen(id), 0x73746b74);
 
-    if (!t->hash.entries || !t->hash.locks) {
-        free(t->hash.entries);
-        free(t->hash.locks);
+    t->shards = aligned_alloc(64, STKTABLE_SHARDS * sizeof(*t->shards));
+    if (!t->id || !t->shards) {
+        free(t->shards);
         free(t->id);
         free(t);
         return NULL;
     }
-
-    /* Initialize per-bucket spinlocks for fine-grained locking */
-    for (uint32_t i = 0; i < t->hash.size; i++) {
-        pthread_spin_init(&t->hash.locks[i], PTHREAD_PROCESS_PRIVATE);
+    memset(t->shards, 0, STKTABLE_SHARDS * sizeof(*t->shards));
+
+    /* Shards start small and double as they fill, up to their share of
+     * `size` */
+    uint32_t limit = size / STKTABLE_SHARDS + 1;
+    for (uint32_t i = 0; i < STKTABLE_SHARDS; i++) {
+        stktable_shard_t *sh = &t->shards[i];
+        pthread_spin_init(&sh->lock, PTHREAD_PROCESS_PRIVATE);
+        sh->lru.n = sh->lru.p = &sh->lru;
+        sh->limit = limit;
+        sh->wheel_now = stktable_now() - 1;
+        for (uint32_t w = 0; w < STKTABLE_WHEEL_SLOTS; w++)
+            sh->wheel[w].n = sh->wheel[w].p = &sh->wheel[w];
+
+        if (stktable_shard_alloc(sh, STK_MIN_CAP) < 0) {
+            t->next = NULL;
+            stktable_free(t);
+            return NULL;
+        }
     }
 
-    t->keys = EB_ROOT;
-    LIST_INIT(&t->lru);
-    pthread_rwlock_init(&t->lock, NULL);
-
     /* Add to global list */
     pthread_rwlock_wrlock(&stick_tables_lock);
     t->next = stick_tables;
@@ -49,279 +289,560 @@ stick_table_t* stktable_new(const char *id, int type, uint32_t size, uint32_t ex
     return t;
 }
 
-/* Hash function for stick table keys - uses MurmurHash3 algorithm */
-static uint32_t stktable_hash(stick_key_t *key) {
-    uint32_t hash = 0x12345678;
-    const uint8_t *data = NULL;
-    size_t len = 0;
+static inline struct list *stktable_bucket(stktable_shard_t *sh, time_t expire) {
+    return &sh->wheel[(uint64_t)expire % STKTABLE_WHEEL_SLOTS];
+}
 
-    switch (key->type) {
-        case STKTABLE_TYPE_IP:
-            data = (uint8_t*)&key->data.ipv4;
-            len = sizeof(key->data.ipv4);
-            break;
-        case STKTABLE_TYPE_IPV6:
-            data = (uint8_t*)&key->data.ipv6;
-            len = sizeof(key->data.ipv6);
-            break;
-        case STKTABLE_TYPE_INTEGER:
-            data = (uint8_t*)&key->data.integer;
-            len = sizeof(key->data.integer);
-            break;
-        case STKTABLE_TYPE_STRING:
-            data = (uint8_t*)key->data.str.ptr;
-            len = key->data.str.len;
-            break;
-        case STKTABLE_TYPE_BINARY:
-            data = (uint8_t*)key->data.bin.ptr;
-            len = key->data.bin.len;
-            break;
-    }
+static uint64_t stktable_hash(const stick_table_t *t, const void *key, size_t len) {
+    return murmur3_64(key, len, t->seed);
+}
 
-    /* Simple hash for now - replace with MurmurHash3 for production */
-    for (size_t i = 0; i < len; i++) {
-        hash = ((hash << 5) + hash) + data[i];
-    }
+/* Moves a found entry to the front of its LRU and pushes its expiry;
+ * both only change once per second, so hot entries are not rewritten
+ * on every hit */
+static void stktable_refresh(stick_table_t *t, stktable_shard_t *sh, stick_entry_t *entry, time_t now) {
+    if (entry->last_access == now)
+        return;
 
-    return hash;
+    entry->last_access = now;
+    entry->expire = now + t->expire;
+    LIST_DEL(&entry->list);
+    LIST_ADD(&sh->lru, &entry->list);
+    LIST_DEL(&entry->wheel);
+    LIST_ADDQ(stktable_bucket(sh, entry->expire), &entry->wheel);
 }
 
-stick_entry_t* stktable_lookup(stick_table_t *t, stick_key_t *key) {
-    uint32_t hash = stktable_hash(key);
-    uint32_t idx = hash % t->hash.size;
-
-    /* Use per-bucket locking for better concurrency */
-    pthread_spin_lock(&t->hash.locks[idx]);
-
-    stick_entry_t *entry = t->hash.entries[idx];
-    while (entry) {
-        if (entry->key.type == key->type) {
-            bool match = false;
-
-            switch (key->type) {
-                case STKTABLE_TYPE_IP:
-                    match = memcmp(&entry->key.data.ipv4, &key->data.ipv4,
-                                  sizeof(struct in_addr)) == 0;
-                    break;
-                case STKTABLE_TYPE_IPV6:
-                    match = memcmp(&entry->key.data.ipv6, &key->data.ipv6,
-                                  sizeof(struct in6_addr)) == 0;
-                    break;
-                case STKTABLE_TYPE_INTEGER:
-                    match = entry->key.data.integer == key->data.integer;
-                    break;
-                case STKTABLE_TYPE_STRING:
-                    match = entry->key.data.str.len == key->data.str.len &&
-                           memcmp(entry->key.data.str.ptr, key->data.str.ptr,
-                                 key->data.str.len) == 0;
-                    break;
-            }
+static stick_entry_t *stktable_lookup_common(stick_table_t *t, stick_key_t *key, int refresh) {
+    if (key->type != t->type)
+        return NULL;
 
-            if (match) {
-                /* Update LRU and access time */
-                entry->last_access = time(NULL);
-                atomic_fetch_add(&t->stats.hits, 1);
-                pthread_spin_unlock(&t->hash.locks[idx]);
-                return entry;
-            }
-        }
-        entry = entry->node.node_p;
-    }
+    size_t len;
+    const void *bytes = stktable_key_bytes(key, &len);
+    uint64_t hash = stktable_hash(t, bytes, len);
+    stktable_shard_t *sh = stktable_shard(t, hash);
 
-    atomic_fetch_add(&t->stats.misses, 1);
-    pthread_spin_unlock(&t->hash.locks[idx]);
-    return NULL;
+    atomic_fetch_add_explicit(&t->stats.lookups, 1, memory_order_relaxed);
+
+    pthread_spin_lock(&sh->lock);
+    int64_t at = stktable_find(sh, hash, bytes, len);
+    stick_entry_t *entry = at >= 0 ? sh->slots[at].entry : NULL;
+    if (entry && refresh)
+        stktable_refresh(t, sh, entry, stktable_now());
+    pthread_spin_unlock(&sh->lock);
+
+    atomic_fetch_add_explicit(entry ? &t->stats.hits : &t->stats.misses, 1, memory_order_relaxed);
+    return entry;
 }
 
-stick_entry_t* stktable_get(stick_table_t *t, stick_key_t *key) {
-    stick_entry_t *entry = stktable_lookup(t, key);
-    if (entry) return entry;
-
-    /* Check if table is full - evict LRU entry if needed */
-    if (t->current >= t->size) {
-        stktable_expire(t);
-
-        if (t->current >= t->size) {
-            /* Still full - evict LRU entry */
-            pthread_rwlock_wrlock(&t->lock);
-
-            stick_entry_t *lru = LIST_ELEM(t->lru.p, stick_entry_t *, list);
-            if (lru && lru->ref_cnt == 0) {
-                uint32_t hash = stktable_hash(&lru->key);
-                uint32_t idx = hash % t->hash.size;
-
-                pthread_spin_lock(&t->hash.locks[idx]);
-                /* Remove from hash table */
-                stick_entry_t **p = &t->hash.entries[idx];
-                while (*p) {
-                    if (*p == lru) {
-                        *p = lru->node.node_p;
-                        break;
-                    }
-                    p = &(*p)->node.node_p;
-                }
-                pthread_spin_unlock(&t->hash.locks[idx]);
-
-                LIST_DEL(&lru->list);
-                pthread_rwlock_destroy(&lru->lock);
-
-                /* Free key data if needed */
-                if (lru->key.type == STKTABLE_TYPE_STRING && lru->key.data.str.ptr) {
-                    free(lru->key.data.str.ptr);
-                }
-
-                free(lru);
-                t->current--;
-                atomic_fetch_add(&t->stats.expires, 1);
-            }
+stick_entry_t* stktable_lookup(stick_table_t *t, stick_key_t *key) {
+    return stktable_lookup_common(t, key, 1);
+}
 
-            pthread_rwlock_unlock(&t->lock);
-        }
-    }
+stick_entry_t* stktable_lookup_key(stick_table_t *t, stick_key_t *key) {
+    return stktable_lookup_common(t, key, 0);
+}
 
-    /* Create new entry */
-    entry = calloc(1, sizeof(*entry));
+static stick_entry_t *stktable_entry_new(stick_table_t *t, const stick_key_t *key,
+                                         const void *bytes, size_t len, uint64_t hash, time_t now) {
+    stick_entry_t *entry = calloc(1, sizeof(*entry));
     if (!entry) return NULL;
 
-    /* Copy key */
     entry->key = *key;
-    if (key->type == STKTABLE_TYPE_STRING) {
-        entry->key.data.str.ptr = malloc(key->data.str.len);
-        if (!entry->key.data.str.ptr) {
+    if (key->type == STKTABLE_TYPE_STRING || key->type == STKTABLE_TYPE_BINARY) {
+        char *copy = len <= STKTABLE_KEY_INLINE ? (char *)entry->key_buf : malloc(len ? len : 1);
+        if (!copy) {
             free(entry);
             return NULL;
         }
-        memcpy(entry->key.data.str.ptr, key->data.str.ptr, key->data.str.len);
+        memcpy(copy, bytes, len);
+        /* str and bin share their layout */
+        entry->key.data.str.ptr = copy;
+        entry->key.data.str.len = len;
     }
 
-    entry->expire = time(NULL) + t->expire;
-    entry->last_access = time(NULL);
-    pthread_rwlock_init(&entry->lock, NULL);
+    entry->hash = hash;
+    entry->last_access = now;
+    entry->expire = now + t->expire;
+    return entry;
+}
 
-    /* Insert into hash table */
-    uint32_t hash = stktable_hash(key);
-    uint32_t idx = hash % t->hash.size;
+static void stktable_remove(stick_table_t *t, stktable_shard_t *sh, stick_entry_t *entry) {
+    size_t len;
+    const void *bytes = stktable_key_bytes(&entry->key, &len);
+    int64_t at = stktable_find(sh, entry->hash, bytes, len);
+    if (at >= 0) {
+        stktable_remove_slot(t, sh, at, 1);
+        atomic_fetch_add_explicit(&t->stats.expires, 1, memory_order_relaxed);
+    }
+}
 
-    pthread_spin_lock(&t->hash.locks[idx]);
-    entry->node.node_p = t->hash.entries[idx];
-    t->hash.entries[idx] = entry;
-    pthread_spin_unlock(&t->hash.locks[idx]);
+/* Evicts from the LRU tail until the shard is within its limit or the
+ * budget runs out. A referenced entry cannot go; it moves to the head so
+ * the next pass does not trip over it again. Returns the budget left. */
+static uint32_t stktable_evict(stick_table_t *t, stktable_shard_t *sh, uint32_t budget) {
+    while (sh->count > sh->limit && budget) {
+        stick_entry_t *lru = LIST_ELEM(sh->lru.p, stick_entry_t, list);
+        budget--;
+
+        if (atomic_load_explicit(&lru->ref_cnt, memory_order_acquire)) {
+            LIST_DEL(&lru->list);
+            LIST_ADD(&sh->lru, &lru->list);
+            continue;
+        }
+        stktable_remove(t, sh, lru);
+    }
+    return budget;
+}
 
-    /* Add to LRU list */
-    pthread_rwlock_wrlock(&t->lock);
-    LIST_ADDQ(&t->lru, &entry->list);
-    t->current++;
-    pthread_rwlock_unlock(&t->lock);
+/* Finds or creates the entry for key; when `ref` is set the entry's
+ * reference is taken before the shard lock drops, so it cannot be
+ * evicted in between */
+static stick_entry_t *stktable_get_common(stick_table_t *t, stick_key_t *key, int ref) {
+    if (key->type != t->type)
+        return NULL;
 
-    atomic_fetch_add(&t->stats.inserts, 1);
+    size_t len;
+    const void *bytes = stktable_key_bytes(key, &len);
+    uint64_t hash = stktable_hash(t, bytes, len);
+    stktable_shard_t *sh = stktable_shard(t, hash);
+    time_t now = stktable_now();
+
+    atomic_fetch_add_explicit(&t->stats.lookups, 1, memory_order_relaxed);
+
+    pthread_spin_lock(&sh->lock);
+
+    stick_entry_t *entry;
+    int64_t at = stktable_find(sh, hash, bytes, len);
+    if (at >= 0) {
+        entry = sh->slots[at].entry;
+        stktable_refresh(t, sh, entry, now);
+        if (ref)
+            atomic_fetch_add_explicit(&entry->ref_cnt, 1, memory_order_relaxed);
+        pthread_spin_unlock(&sh->lock);
+        atomic_fetch_add_explicit(&t->stats.hits, 1, memory_order_relaxed);
+        return entry;
+    }
+
+    /* Eviction is stktable_expire()'s job. Only when it falls well
+     * behind does an insert make room itself, for one entry at most */
+    if (sh->count >= sh->limit + sh->limit / 2 && !stktable_evict(t, sh, 1) &&
+        sh->count >= sh->limit + sh->limit / 2) {
+        pthread_spin_unlock(&sh->lock);
+        return NULL;
+    }
+
+    if (!sh->growth_left) {
+        /* Mostly tombstones: clean up in place; otherwise double */
+        uint32_t cap = sh->count * 2 >= sh->cap - sh->cap / 8 ? sh->cap * 2 : sh->cap;
+        if (stktable_rehash(sh, cap) < 0) {
+            pthread_spin_unlock(&sh->lock);
+            return NULL;
+        }
+    }
 
+    entry = stktable_entry_new(t, key, bytes, len, hash, now);
+    if (!entry) {
+        pthread_spin_unlock(&sh->lock);
+        return NULL;
+    }
+    if (ref)
+        entry->ref_cnt = 1;
+
+    uint32_t slot = stktable_find_free(sh, hash);
+    if (sh->ctrl[slot] == STK_EMPTY)
+        sh->growth_left--;
+    sh->ctrl[slot] = hash & 0x7f;
+
+    struct stktable_slot *s = &sh->slots[slot];
+    memset(s->key, 0, sizeof(s->key));
+    memcpy(s->key, bytes, len < STKTABLE_KEY_INLINE ? len : STKTABLE_KEY_INLINE);
+    s->key_len = len;
+    s->entry = entry;
+    sh->count++;
+
+    LIST_ADD(&sh->lru, &entry->list);
+    LIST_ADDQ(stktable_bucket(sh, entry->expire), &entry->wheel);
+    pthread_spin_unlock(&sh->lock);
+
+    atomic_fetch_add(&t->current, 1);
+    atomic_fetch_add_explicit(&t->stats.misses, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&t->stats.inserts, 1, memory_order_relaxed);
     return entry;
 }
 
+stick_entry_t* stktable_get(stick_table_t *t, stick_key_t *key) {
+    return stktable_get_common(t, key, 0);
+}
+
 void stktable_touch(stick_table_t *t, stick_entry_t *entry) {
-    /* Update access time and move to head of LRU */
-    entry->last_access = time(NULL);
+    stktable_shard_t *sh = stktable_shard(t, entry->hash);
 
-    pthread_rwlock_wrlock(&t->lock);
-    LIST_DEL(&entry->list);
-    LIST_ADD(&t->lru, &entry->list);
-    pthread_rwlock_unlock(&t->lock);
+    pthread_spin_lock(&sh->lock);
+    stktable_refresh(t, sh, entry, stktable_now());
+    pthread_spin_unlock(&sh->lock);
 }
 
-void stktable_expire(stick_table_t *t) {
-    time_t now = time(NULL);
-    stick_entry_t *entry, *next;
+/* Turns one shard's wheel up to `now`, visiting at most `budget`
+ * entries. A bucket is detached while it is worked on: entries not due
+ * yet (a later turn of the wheel) go back to it, and what the budget
+ * did not reach is put back in front to be seen first next time. */
+static uint32_t stktable_expire_shard(stick_table_t *t, stktable_shard_t *sh, time_t now,
+                                      uint32_t budget) {
+    /* After a long pause one turn covers every bucket */
+    if (now - sh->wheel_now > STKTABLE_WHEEL_SLOTS)
+        sh->wheel_now = now - STKTABLE_WHEEL_SLOTS;
+
+    while (sh->wheel_now < now && budget) {
+        time_t sec = sh->wheel_now + 1;
+        struct list *bucket = stktable_bucket(sh, sec);
+        struct list work;
+
+        if (bucket->n == bucket) {
+            sh->wheel_now = sec;
+            continue;
+        }
+        work.n = bucket->n;
+        work.p = bucket->p;
+        work.n->p = work.p->n = &work;
+        bucket->n = bucket->p = bucket;
+
+        while (work.n != &work && budget) {
+            stick_entry_t *entry = LIST_ELEM(work.n, stick_entry_t, wheel);
+            LIST_DEL(&entry->wheel);
+            budget--;
+
+            if (entry->expire > now) {
+                LIST_ADDQ(bucket, &entry->wheel);
+            } else if (atomic_load_explicit(&entry->ref_cnt, memory_order_acquire)) {
+                /* In use: look again in a second */
+                LIST_ADDQ(stktable_bucket(sh, now + 1), &entry->wheel);
+            } else {
+                entry->wheel.n = entry->wheel.p = &entry->wheel;
+                stktable_remove(t, sh, entry);
+            }
+        }
+
+        if (work.n != &work) {
+            work.p->n = bucket->n;
+            bucket->n->p = work.p;
+            bucket->n = work.n;
+            work.n->p = bucket;
+            break;
+        }
+        sh->wheel_now = sec;
+    }
+    return budget;
+}
 
-    pthread_rwlock_wrlock(&t->lock);
+void stktable_expire(stick_table_t *t) {
+    time_t now = stktable_now();
 
-    /* Walk LRU list from tail (oldest entries) */
-    list_for_each_entry_safe_rev(entry, next, &t->lru, list) {
-        if (entry->expire > now && entry->ref_cnt > 0)
-            break;  /* Still valid or in use */
+    for (uint32_t i = 0; i < STKTABLE_SHARDS; i++) {
+        stktable_shard_t *sh = &t->shards[i];
 
-        if (entry->ref_cnt > 0)
-            continue;  /* Skip if referenced */
+        pthread_spin_lock(&sh->lock);
+        uint32_t budget = stktable_expire_shard(t, sh, now, STKTABLE_EXPIRE_BUDGET);
+        stktable_evict(t, sh, budget);
+        pthread_spin_unlock(&sh->lock);
+    }
+}
 
-        /* Remove from hash table */
-        uint32_t hash = stktable_hash(&entry->key);
-        uint32_t idx = hash % t->hash.size;
+void stktable_purge(stick_table_t *t) {
+    for (uint32_t i = 0; i < STKTABLE_SHARDS; i++) {
+        stktable_shard_t *sh = &t->shards[i];
 
-        pthread_spin_lock(&t->hash.locks[idx]);
-        stick_entry_t **p = &t->hash.entries[idx];
-        while (*p) {
-            if (*p == entry) {
-                *p = entry->node.node_p;
-                break;
-            }
-            p = &(*p)->node.node_p;
+        pthread_spin_lock(&sh->lock);
+        for (uint32_t at = 0; at < sh->cap; at++) {
+            if (!(sh->ctrl[at] & 0x80) && !atomic_load(&sh->slots[at].entry->ref_cnt))
+                stktable_remove_slot(t, sh, at, 1);
         }
-        pthread_spin_unlock(&t->hash.locks[idx]);
+        pthread_spin_unlock(&sh->lock);
+    }
+}
 
-        /* Remove from LRU list */
-        LIST_DEL(&entry->list);
+/* Queues n more events of data_type for the table's peers. A hot entry
+ * goes on the sync list once per flush however often it changes. */
+static void stktable_sync_mark(stick_table_t *t, stick_entry_t *entry, int data_type, uint64_t n) {
+    if (!t->peers || !(data_type & STKTABLE_SYNC_MASK) || !n)
+        return;
+
+    atomic_fetch_add_explicit(&entry->sync_pend[__builtin_ctz(data_type)], n, memory_order_relaxed);
+    if (atomic_exchange_explicit(&entry->sync_dirty, 1, memory_order_acq_rel))
+        return;
+
+    atomic_fetch_add_explicit(&entry->ref_cnt, 1, memory_order_relaxed);
+    stick_entry_t *head = atomic_load_explicit(&t->sync_head, memory_order_relaxed);
+    do {
+        entry->sync_next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&t->sync_head, &head, entry,
+                                                    memory_order_release, memory_order_relaxed));
+}
 
-        /* Free entry */
-        if (entry->key.type == STKTABLE_TYPE_STRING && entry->key.data.str.ptr) {
-            free(entry->key.data.str.ptr);
-        }
-        pthread_rwlock_destroy(&entry->lock);
-        free(entry);
+stick_entry_t* stktable_sync_take(stick_table_t *t) {
+    stick_entry_t *e = atomic_exchange_explicit(&t->sync_head, NULL, memory_order_acquire);
+
+    /* The list was pushed newest first */
+    stick_entry_t *list = NULL;
+    while (e) {
+        stick_entry_t *next = e->sync_next;
+        e->sync_next = list;
+        list = e;
+        e = next;
+    }
+    return list;
+}
 
-        t->current--;
-        atomic_fetch_add(&t->stats.expires, 1);
+uint32_t stktable_sync_collect(stick_entry_t *entry, uint64_t vals[STKTABLE_DATA_BITS]) {
+    /* Cleared first, so a change racing with the collect queues the
+     * entry again rather than being lost. An exchange rather than a
+     * store: it pairs with the one in stktable_sync_mark so the pending
+     * counts written before it are visible below. */
+    atomic_exchange_explicit(&entry->sync_dirty, 0, memory_order_acq_rel);
+
+    uint32_t mask = 0;
+    for (uint32_t m = STKTABLE_SYNC_MASK; m; m &= m - 1) {
+        int bit = __builtin_ctz(m);
+        uint64_t v = atomic_exchange_explicit(&entry->sync_pend[bit], 0, memory_order_relaxed);
+        if (!v)
+            continue;
+
+        mask |= 1u << bit;
+        vals[bit] = (1u << bit) == STKTABLE_DATA_SERVER_ID ?
+                    atomic_load(&entry->counters.server_id) : v;
     }
+    return mask;
+}
 
-    pthread_rwlock_unlock(&t->lock);
+void stktable_sync_done(stick_entry_t *entry) {
+    atomic_fetch_sub_explicit(&entry->ref_cnt, 1, memory_order_release);
 }
 
+static stk_rate_t *stktable_rate(stick_entry_t *entry, int data_type) {
+    switch (data_type) {
+        case STKTABLE_DATA_CONN_RATE:     return &entry->counters.conn_rate;
+        case STKTABLE_DATA_SESS_RATE:     return &entry->counters.sess_rate;
+        case STKTABLE_DATA_HTTP_REQ_RATE: return &entry->counters.http_req_rate;
+        case STKTABLE_DATA_HTTP_ERR_RATE: return &entry->counters.http_err_rate;
+    }
+    return NULL;
+}
+
+int stktable_read_rate(stick_table_t *t, stick_entry_t *entry, int data_type) {
+    stk_rate_t *r = stktable_rate(entry, data_type);
+    if (!r) return -1;
+
+    return stk_rate_read(r, t->rate_period);
+}
+
+/* Rate types count `value` more events; the others store it */
 int stktable_update_key(stick_table_t *t, stick_key_t *key, int data_type, void *value) {
     stick_entry_t *entry = stktable_get(t, key);
     if (!entry) return -1;
 
-    pthread_rwlock_wrlock(&entry->lock);
+    stk_rate_t *r = stktable_rate(entry, data_type);
+    if (r) {
+        stk_rate_add(r, t->rate_period, *(uint32_t*)value);
+        stktable_sync_mark(t, entry, data_type, *(uint32_t*)value);
+        atomic_fetch_add(&t->stats.updates, 1);
+        return 0;
+    }
 
+    /* Peers get what a counter grew by */
+    uint64_t old = 0, val = 0;
     switch (data_type) {
         case STKTABLE_DATA_CONN_CNT:
-            atomic_store(&entry->counters.conn_cnt, *(uint32_t*)value);
+            old = atomic_exchange(&entry->counters.conn_cnt, val = *(uint32_t*)value);
             break;
         case STKTABLE_DATA_CONN_CUR:
             atomic_store(&entry->counters.conn_cur, *(uint32_t*)value);
             break;
         case STKTABLE_DATA_SESS_CNT:
-            atomic_store(&entry->counters.sess_cnt, *(uint32_t*)value);
+            old = atomic_exchange(&entry->counters.sess_cnt, val = *(uint32_t*)value);
             break;
         case STKTABLE_DATA_HTTP_REQ_CNT:
-            atomic_store(&entry->counters.http_req_cnt, *(uint32_t*)value);
+            old = atomic_exchange(&entry->counters.http_req_cnt, val = *(uint32_t*)value);
             break;
         case STKTABLE_DATA_BYTES_IN:
-            atomic_store(&entry->counters.bytes_in, *(uint64_t*)value);
+            old = atomic_exchange(&entry->counters.bytes_in, val = *(uint64_t*)value);
             break;
         case STKTABLE_DATA_BYTES_OUT:
-            atomic_store(&entry->counters.bytes_out, *(uint64_t*)value);
+            old = atomic_exchange(&entry->counters.bytes_out, val = *(uint64_t*)value);
             break;
         case STKTABLE_DATA_SERVER_ID:
-            atomic_store(&entry->counters.server_id, *(uint32_t*)value);
+            old = atomic_exchange(&entry->counters.server_id, val = *(uint32_t*)value);
+            /* Any change is sent as the new value */
+            old = old != val ? 0 : val;
             break;
     }
+    stktable_sync_mark(t, entry, data_type, val > old ? val - old : 0);
 
-    pthread_rwlock_unlock(&entry->lock);
     atomic_fetch_add(&t->stats.updates, 1);
 
     return 0;
 }
 
-/* Track a session with stick table */
-int stksess_track(struct session *sess, stick_table_t *t, stick_key_t *key) {
+static _Atomic uint32_t *stktable_counter(stick_entry_t *entry, int counter) {
+    switch (counter) {
+        case STKTABLE_DATA_CONN_CNT:     return &entry->counters.conn_cnt;
+        case STKTABLE_DATA_CONN_CUR:     return &entry->counters.conn_cur;
+        case STKTABLE_DATA_SESS_CNT:     return &entry->counters.sess_cnt;
+        case STKTABLE_DATA_HTTP_REQ_CNT: return &entry->counters.http_req_cnt;
+        case STKTABLE_DATA_HTTP_ERR_CNT: return &entry->counters.http_err_cnt;
+        case STKTABLE_DATA_GPC0:         return &entry->counters.gpc0;
+        case STKTABLE_DATA_GPC1:         return &entry->counters.gpc1;
+    }
+    return NULL;
+}
+
+/* For a rate type, returns the rate including this event */
+int stktable_inc_counter(stick_table_t *t, stick_key_t *key, int counter) {
     stick_entry_t *entry = stktable_get(t, key);
     if (!entry) return -1;
 
-    /* Increment reference count to prevent eviction */
-    entry->ref_cnt++;
+    stk_rate_t *r = stktable_rate(entry, counter);
+    if (r) {
+        uint64_t now = stk_rate_now_ms();
+        stk_rate_add_at(r, t->rate_period, 1, now);
+        stktable_sync_mark(t, entry, counter, 1);
+        return stk_rate_read_at(r, t->rate_period, now);
+    }
+
+    _Atomic uint32_t *c = stktable_counter(entry, counter);
+    if (!c) return -1;
+
+    stktable_sync_mark(t, entry, counter, 1);
+    return atomic_fetch_add_explicit(c, 1, memory_order_relaxed) + 1;
+}
+
+int stktable_dec_counter(stick_table_t *t, stick_key_t *key, int counter) {
+    stick_entry_t *entry = stktable_lookup(t, key);
+    _Atomic uint32_t *c = entry ? stktable_counter(entry, counter) : NULL;
+    if (!c) return -1;
+
+    uint32_t v = atomic_load_explicit(c, memory_order_relaxed);
+    while (v && !atomic_compare_exchange_weak_explicit(c, &v, v - 1, memory_order_relaxed,
+                                                       memory_order_relaxed))
+        ;
+    return v ? v - 1 : 0;
+}
+
+static _Atomic uint64_t *stktable_counter64(stick_entry_t *entry, int data_type) {
+    switch (data_type) {
+        case STKTABLE_DATA_BYTES_IN:  return &entry->counters.bytes_in;
+        case STKTABLE_DATA_BYTES_OUT: return &entry->counters.bytes_out;
+    }
+    return NULL;
+}
+
+uint32_t stktable_sync_snapshot(stick_table_t *t, stick_entry_t *entry,
+                                uint64_t vals[STKTABLE_DATA_BITS]) {
+    uint64_t now = stk_rate_now_ms();
+    uint32_t mask = 0;
+
+    for (uint32_t m = STKTABLE_SYNC_MASK; m; m &= m - 1) {
+        int bit = __builtin_ctz(m);
+        int type = 1 << bit;
+        stk_rate_t *r = stktable_rate(entry, type);
+        _Atomic uint32_t *c = stktable_counter(entry, type);
+        _Atomic uint64_t *c64 = stktable_counter64(entry, type);
+        uint64_t v;
+
+        if (r)
+            v = stk_rate_read_at(r, t->rate_period, now);
+        else if (c)
+            v = atomic_load_explicit(c, memory_order_relaxed);
+        else if (c64)
+            v = atomic_load_explicit(c64, memory_order_relaxed);
+        else
+            v = atomic_load_explicit(&entry->counters.server_id, memory_order_relaxed);
+
+        if (v) {
+            mask |= type;
+            vals[bit] = v;
+        }
+    }
+    return mask;
+}
+
+int stktable_sync_apply(stick_table_t *t, stick_key_t *key, uint32_t mask,
+                        const uint64_t vals[STKTABLE_DATA_BITS], bool full) {
+    stick_entry_t *entry = stktable_get(t, key);
+    if (!entry) return -1;
+
+    uint64_t now = stk_rate_now_ms();
+    for (uint32_t m = mask & STKTABLE_SYNC_MASK; m; m &= m - 1) {
+        int bit = __builtin_ctz(m);
+        int type = 1 << bit;
+        uint64_t v = vals[bit];
+        stk_rate_t *r = stktable_rate(entry, type);
+        _Atomic uint32_t *c = stktable_counter(entry, type);
+        _Atomic uint64_t *c64 = stktable_counter64(entry, type);
+
+        if (r) {
+            if (full) {
+                uint32_t cur = stk_rate_read_at(r, t->rate_period, now);
+                v = v > cur ? v - cur : 0;
+            }
+            if (v)
+                stk_rate_add_at(r, t->rate_period, v, now);
+        } else if (c) {
+            if (!full) {
+                atomic_fetch_add_explicit(c, v, memory_order_relaxed);
+                continue;
+            }
+            uint32_t cur = atomic_load_explicit(c, memory_order_relaxed);
+            while (cur < v && !atomic_compare_exchange_weak(c, &cur, v))
+                ;
+        } else if (c64) {
+            if (!full) {
+                atomic_fetch_add_explicit(c64, v, memory_order_relaxed);
+                continue;
+            }
+            uint64_t cur = atomic_load_explicit(c64, memory_order_relaxed);
+            while (cur < v && !atomic_compare_exchange_weak(c64, &cur, v))
+                ;
+        } else if (full) {
+            /* A resync never overrides a choice this node already made */
+            uint32_t none = 0;
+            atomic_compare_exchange_strong(&entry->counters.server_id, &none, (uint32_t)v);
+        } else {
+            atomic_store(&entry->counters.server_id, (uint32_t)v);
+        }
+    }
+
+    atomic_fetch_add(&t->stats.updates, 1);
+    return 0;
+}
+
+void stktable_walk(stick_table_t *t, void (*fn)(stick_entry_t *entry, void *arg), void *arg) {
+    for (uint32_t i = 0; i < STKTABLE_SHARDS; i++) {
+        stktable_shard_t *sh = &t->shards[i];
+
+        pthread_spin_lock(&sh->lock);
+        for (uint32_t at = 0; at < sh->cap; at++) {
+            if (!(sh->ctrl[at] & 0x80))
+                fn(sh->slots[at].entry, arg);
+        }
+        pthread_spin_unlock(&sh->lock);
+    }
+}
+
+/* Track a session with stick table */
+int stksess_track(struct session *sess, stick_table_t *t, stick_key_t *key) {
+    /* The reference keeps the entry from eviction while tracked */
+    stick_entry_t *entry = stktable_get_common(t, key, 1);
+    if (!entry) return -1;
 
     /* Update counters */
     atomic_fetch_add(&entry->counters.conn_cnt, 1);
     atomic_fetch_add(&entry->counters.conn_cur, 1);
     atomic_fetch_add(&entry->counters.sess_cnt, 1);
+    stk_rate_add(&entry->counters.conn_rate, t->rate_period, 1);
+    stk_rate_add(&entry->counters.sess_rate, t->rate_period, 1);
+    stktable_sync_mark(t, entry, STKTABLE_DATA_CONN_CNT, 1);
+    stktable_sync_mark(t, entry, STKTABLE_DATA_SESS_CNT, 1);
+    stktable_sync_mark(t, entry, STKTABLE_DATA_CONN_RATE, 1);
+    stktable_sync_mark(t, entry, STKTABLE_DATA_SESS_RATE, 1);
 
     /* Store in session for later use */
     if (sess->stkctr) {
@@ -332,6 +853,16 @@ int stksess_track(struct session *sess, stick_table_t *t, stick_key_t *key) {
     return 0;
 }
 
+void stksess_untrack(struct session *sess, stick_table_t *t) {
+    if (!sess->stkctr || sess->stkctr->table != t || !sess->stkctr->entry)
+        return;
+
+    stick_entry_t *entry = sess->stkctr->entry;
+    atomic_fetch_sub(&entry->counters.conn_cur, 1);
+    atomic_fetch_sub_explicit(&entry->ref_cnt, 1, memory_order_release);
+    sess->stkctr->entry = NULL;
+}
+
 /* Get stored server for sticky session */
 struct server* stksess_get_server(struct session *sess, stick_table_t *t) {
     if (!sess->stkctr || sess->stkctr->table != t)
@@ -368,30 +899,24 @@ void stick_tables_deinit() {
     pthread_rwlock_destroy(&stick_tables_lock);
 }
 
+/* Nothing may use the table any more; entries go immediately */
 void stktable_free(stick_table_t *t) {
     if (!t) return;
 
-    /* Free all entries */
-    for (uint32_t i = 0; i < t->hash.size; i++) {
-        stick_entry_t *entry = t->hash.entries[i];
-        while (entry) {
-            stick_entry_t *next = entry->node.node_p;
-
-            if (entry->key.type == STKTABLE_TYPE_STRING && entry->key.data.str.ptr) {
-                free(entry->key.data.str.ptr);
-            }
+    for (uint32_t i = 0; t->shards && i < STKTABLE_SHARDS; i++) {
+        stktable_shard_t *sh = &t->shards[i];
 
-            pthread_rwlock_destroy(&entry->lock);
-            free(entry);
-            entry = next;
+        for (uint32_t at = 0; sh->ctrl && at < sh->cap; at++) {
+            if (!(sh->ctrl[at] & 0x80))
+                stktable_entry_free(sh->slots[at].entry);
         }
 
-        pthread_spin_destroy(&t->hash.locks[i]);
+        free(sh->ctrl);
+        free(sh->slots);
+        pthread_spin_destroy(&sh->lock);
     }
 
-    free(t->hash.entries);
-    free(t->hash.locks);
+    free(t->shards);
     free(t->id);
-    pthread_rwlock_destroy(&t->lock);
     free(t);
-}
\ No newline at end of file
+}
@@ -1,34 +1,268 @@
 #include "utils/log.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include <pthread.h>
 
+// Each logging thread owns a single-producer ring of fixed size records;
+// the writer thread is the only consumer. Producers never block: when a
+// ring is full the line is counted as dropped and reported later.
+#define LOG_RING_SLOTS 1024         // power of two
+#define LOG_LINE_MAX   256
+#define LOG_OUT_BUF    (64 * 1024)
+#define LOG_IDLE_NS    1000000      // writer poll interval when idle
+
+typedef struct log_record {
+    time_t ts;
+    int level;
+    char msg[LOG_LINE_MAX];
+} log_record_t;
+
+typedef struct log_ring {
+    _Atomic uint32_t head __attribute__((aligned(64)));  // producer
+    _Atomic uint32_t tail __attribute__((aligned(64)));  // writer
+    _Atomic uint64_t dropped;
+    _Atomic bool in_use;
+    struct log_ring* next;
+    log_record_t slots[LOG_RING_SLOTS];
+} log_ring_t;
+
+typedef struct log_ts_cache {
+    time_t sec;
+    char text[32];
+} log_ts_cache_t;
+
+#ifdef LB_LOG_DEBUG
+static int log_level = LOG_DEBUG;
+#else
 static int log_level = LOG_INFO;
+#endif
 static const char *log_ident = "ultrabalancer";
 
+static const char *level_str[] = {
+    "EMERG", "ALERT", "CRIT", "ERROR",
+    "WARN", "NOTICE", "INFO", "DEBUG"
+};
+
+static _Atomic(log_ring_t*) log_rings = NULL;
+static _Atomic bool log_async = false;
+static _Atomic bool log_running = false;
+static pthread_t log_writer;
+
+static pthread_key_t log_ring_key;
+static pthread_once_t log_key_once = PTHREAD_ONCE_INIT;
+static __thread log_ring_t* log_ring_self = NULL;
+
+// Synchronous path (startup, shutdown, or rings unavailable)
+static pthread_mutex_t log_sync_lock = PTHREAD_MUTEX_INITIALIZER;
+static log_ts_cache_t log_sync_ts;
+
 void log_init(const char *ident, int level) {
     if (ident) log_ident = ident;
     log_level = level;
 }
 
+// localtime_r() and strftime() run at most once per second per cache
+static const char* log_timestamp(log_ts_cache_t* cache, time_t sec) {
+    if (cache->sec != sec || !cache->text[0]) {
+        struct tm tm;
+        localtime_r(&sec, &tm);
+        strftime(cache->text, sizeof(cache->text), "%Y-%m-%d %H:%M:%S", &tm);
+        cache->sec = sec;
+    }
+    return cache->text;
+}
+
+static size_t log_format_line(char* out, size_t cap, log_ts_cache_t* cache,
+                              time_t ts, int level, const char* msg) {
+    int n = snprintf(out, cap, "[%s] %s %s: %s\n",
+                     log_timestamp(cache, ts), log_ident, level_str[level], msg);
+    if (n < 0) return 0;
+    if ((size_t)n >= cap) {
+        // Truncated line: keep the newline
+        out[cap - 2] = '\n';
+        return cap - 1;
+    }
+    return n;
+}
+
+static void log_write_all(const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(STDERR_FILENO, buf, len);
+        if (n <= 0) return;
+        buf += n;
+        len -= n;
+    }
+}
+
+static void log_ring_release(void* arg) {
+    log_ring_t* ring = arg;
+    // Leftover records are still drained; the next thread reuses the ring
+    atomic_store_explicit(&ring->in_use, false, memory_order_release);
+}
+
+static void log_key_create(void) {
+    pthread_key_create(&log_ring_key, log_ring_release);
+}
+
+static log_ring_t* log_ring_get(void) {
+    if (log_ring_self) return log_ring_self;
+
+    pthread_once(&log_key_once, log_key_create);
+
+    log_ring_t* ring = atomic_load_explicit(&log_rings, memory_order_acquire);
+    for (; ring; ring = ring->next) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&ring->in_use, &expected, true)) break;
+    }
+
+    if (!ring) {
+        ring = calloc(1, sizeof(*ring));
+        if (!ring) return NULL;
+        atomic_store(&ring->in_use, true);
+
+        log_ring_t* head = atomic_load_explicit(&log_rings, memory_order_relaxed);
+        do {
+            ring->next = head;
+        } while (!atomic_compare_exchange_weak_explicit(&log_rings, &head, ring,
+                                                        memory_order_release,
+                                                        memory_order_relaxed));
+    }
+
+    pthread_setspecific(log_ring_key, ring);
+    log_ring_self = ring;
+    return ring;
+}
+
+static void log_write_sync(int level, const char *fmt, va_list ap) {
+    char msg[LOG_LINE_MAX];
+    char line[LOG_LINE_MAX + 64];
+
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+
+    pthread_mutex_lock(&log_sync_lock);
+    size_t len = log_format_line(line, sizeof(line), &log_sync_ts, time(NULL), level, msg);
+    log_write_all(line, len);
+    pthread_mutex_unlock(&log_sync_lock);
+}
+
 static void log_write(int level, const char *fmt, va_list ap) {
     if (level > log_level)
         return;
 
-    time_t now = time(NULL);
-    struct tm *tm = localtime(&now);
+    log_ring_t* ring = atomic_load_explicit(&log_async, memory_order_acquire) ? log_ring_get() : NULL;
+    if (!ring) {
+        log_write_sync(level, fmt, ap);
+        return;
+    }
+
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail >= LOG_RING_SLOTS) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    log_record_t* rec = &ring->slots[head & (LOG_RING_SLOTS - 1)];
+    rec->ts = time(NULL);
+    rec->level = level;
+    vsnprintf(rec->msg, sizeof(rec->msg), fmt, ap);
+
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// Empty every ring into stderr, batching lines into as few write()s as
+// possible. Returns the number of records written.
+static size_t log_drain(char* out, log_ts_cache_t* cache) {
+    size_t used = 0;
+    size_t total = 0;
+
+    for (log_ring_t* ring = atomic_load_explicit(&log_rings, memory_order_acquire);
+         ring; ring = ring->next) {
+        uint64_t dropped = atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+        if (dropped) {
+            char msg[64];
+            snprintf(msg, sizeof(msg), "%llu log lines dropped (ring full)",
+                     (unsigned long long)dropped);
+            if (LOG_OUT_BUF - used < LOG_LINE_MAX + 64) {
+                log_write_all(out, used);
+                used = 0;
+            }
+            used += log_format_line(out + used, LOG_OUT_BUF - used, cache,
+                                    time(NULL), LOG_WARNING, msg);
+        }
+
+        uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+        while (tail != head) {
+            if (LOG_OUT_BUF - used < LOG_LINE_MAX + 64) {
+                log_write_all(out, used);
+                used = 0;
+            }
 
-    char timestamp[32];
-    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", tm);
+            log_record_t* rec = &ring->slots[tail & (LOG_RING_SLOTS - 1)];
+            used += log_format_line(out + used, LOG_OUT_BUF - used, cache,
+                                    rec->ts, rec->level, rec->msg);
+            tail++;
+            total++;
 
-    const char *level_str[] = {
-        "EMERG", "ALERT", "CRIT", "ERROR",
-        "WARN", "NOTICE", "INFO", "DEBUG"
-    };
+            // Hand slots back in batches so a busy producer is not starved
+            if ((tail & 63) == 0) {
+                atomic_store_explicit(&ring->tail, tail, memory_order_release);
+            }
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
 
-    fprintf(stderr, "[%s] %s %s: ", timestamp, log_ident, level_str[level]);
-    vfprintf(stderr, fmt, ap);
-    fprintf(stderr, "\n");
+    if (used) log_write_all(out, used);
+    return total;
+}
+
+static void* log_writer_thread(void* arg) {
+    char* out = malloc(LOG_OUT_BUF);
+    log_ts_cache_t cache = {0};
+    struct timespec idle = { .tv_sec = 0, .tv_nsec = LOG_IDLE_NS };
+
+    if (!out) return NULL;
+
+    while (atomic_load_explicit(&log_running, memory_order_acquire)) {
+        if (log_drain(out, &cache) == 0) {
+            nanosleep(&idle, NULL);
+        }
+    }
+
+    // Producers have fallen back to the synchronous path; flush what is left
+    log_drain(out, &cache);
+    free(out);
+    return NULL;
+}
+
+int log_start(void) {
+    if (atomic_load(&log_running)) return 0;
+
+    atomic_store(&log_running, true);
+    if (pthread_create(&log_writer, NULL, log_writer_thread, NULL) != 0) {
+        atomic_store(&log_running, false);
+        return -1;
+    }
+
+    atomic_store_explicit(&log_async, true, memory_order_release);
+    atexit(log_stop);
+    return 0;
+}
+
+void log_stop(void) {
+    if (!atomic_exchange(&log_running, false)) return;
+
+    atomic_store_explicit(&log_async, false, memory_order_release);
+    pthread_join(log_writer, NULL);
 }
 
 void log_error(const char *fmt, ...) {
@@ -57,4 +291,4 @@ void log_debug(const char *fmt, ...) {
     va_start(ap, fmt);
     log_write(LOG_DEBUG, fmt, ap);
     va_end(ap);
-}
\ No newline at end of file
+}
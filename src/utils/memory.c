@@ -1,4 +1,5 @@
 #include "core/loadbalancer.h"
+#include "core/lb_rcu.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -6,55 +7,173 @@
 
 #define ALIGN_SIZE(size) (((size) + 7) & ~7)
 
-void* memory_pool_alloc(memory_pool_t* pool, size_t size) {
-    size = ALIGN_SIZE(size);
+slab_t* slab_create(size_t obj_size, uint32_t objs_per_chunk) {
+    slab_t* slab = calloc(1, sizeof(slab_t));
+    if (!slab) return NULL;
 
-    pthread_spin_lock(&pool->lock);
+    // Objects must be able to hold the free-list link and keep alignment
+    if (obj_size < sizeof(slab_free_obj_t)) obj_size = sizeof(slab_free_obj_t);
+    slab->obj_size = ALIGN_SIZE(obj_size);
+    slab->objs_per_chunk = objs_per_chunk ? objs_per_chunk : 256;
+    atomic_store(&slab->remote_free, NULL);
 
-    if (pool->free_list) {
-        memory_chunk_t* prev = NULL;
-        memory_chunk_t* chunk = pool->free_list;
+    return slab;
+}
 
-        while (chunk) {
-            if (chunk->size >= size) {
-                if (prev) {
-                    prev->next = chunk->next;
-                } else {
-                    pool->free_list = chunk->next;
-                }
+void slab_destroy(slab_t* slab) {
+    if (!slab) return;
 
-                pthread_spin_unlock(&pool->lock);
-                return chunk;
-            }
-            prev = chunk;
-            chunk = chunk->next;
-        }
+    slab_chunk_t* chunk = slab->chunks;
+    while (chunk) {
+        slab_chunk_t* next = chunk->next;
+        lb_free(chunk);
+        chunk = next;
     }
+    free(slab);
+}
 
-    if (pool->used + size > pool->size) {
-        pthread_spin_unlock(&pool->lock);
-        return NULL;
+static int slab_grow(slab_t* slab) {
+    size_t header = ALIGN_SIZE(sizeof(slab_chunk_t));
+    slab_chunk_t* chunk = lb_alloc(header + slab->obj_size * slab->objs_per_chunk);
+    if (!chunk) return -1;
+
+    chunk->next = slab->chunks;
+    slab->chunks = chunk;
+
+    // Thread the new objects onto the free list in address order
+    char* base = (char*)chunk + header;
+    for (uint32_t i = slab->objs_per_chunk; i > 0; i--) {
+        slab_free_obj_t* obj = (slab_free_obj_t*)(base + (size_t)(i - 1) * slab->obj_size);
+        obj->next = slab->free_list;
+        slab->free_list = obj;
+    }
+    return 0;
+}
+
+void* slab_alloc(slab_t* slab) {
+    if (!slab->free_list) {
+        slab->free_list = atomic_exchange(&slab->remote_free, NULL);
+        if (!slab->free_list && slab_grow(slab) < 0) {
+            return NULL;
+        }
     }
 
-    void* ptr = (char*)pool->base + pool->used;
-    pool->used += size;
+    slab_free_obj_t* obj = slab->free_list;
+    slab->free_list = obj->next;
+    slab->in_use++;
+
+    memset(obj, 0, slab->obj_size);
+    return obj;
+}
+
+void slab_free(slab_t* slab, void* ptr) {
+    if (!ptr) return;
 
-    pthread_spin_unlock(&pool->lock);
-    return ptr;
+    slab_free_obj_t* obj = (slab_free_obj_t*)ptr;
+    obj->next = slab->free_list;
+    slab->free_list = obj;
+    slab->in_use--;
 }
 
-void memory_pool_free(memory_pool_t* pool, void* ptr, size_t size) {
+void slab_free_remote(slab_t* slab, void* ptr) {
     if (!ptr) return;
 
-    size = ALIGN_SIZE(size);
+    // Single consumer takes the whole stack at once, so a plain CAS push
+    // cannot suffer from ABA
+    slab_free_obj_t* obj = (slab_free_obj_t*)ptr;
+    slab_free_obj_t* head = atomic_load(&slab->remote_free);
+    do {
+        obj->next = head;
+    } while (!atomic_compare_exchange_weak(&slab->remote_free, &head, obj));
+}
+
+lb_buffer_pool_t* buffer_pool_create(void) {
+    lb_buffer_pool_t* pool = calloc(1, sizeof(lb_buffer_pool_t));
+    if (!pool) return NULL;
+
+    for (int i = 0; i < BUFFER_POOL_CLASSES; i++) {
+        pthread_spin_init(&pool->classes[i].lock, PTHREAD_PROCESS_PRIVATE);
+    }
+    return pool;
+}
+
+void buffer_pool_destroy(lb_buffer_pool_t* pool) {
+    if (!pool) return;
+
+    for (int i = 0; i < BUFFER_POOL_CLASSES; i++) {
+        slab_free_obj_t* buf = pool->classes[i].free_list;
+        while (buf) {
+            slab_free_obj_t* next = buf->next;
+            lb_free(buf);
+            buf = next;
+        }
+        pthread_spin_destroy(&pool->classes[i].lock);
+    }
+    free(pool);
+}
+
+static inline int buffer_pool_class_of(size_t size) {
+    int cls = 0;
+    size_t cap = (size_t)1 << BUFFER_POOL_MIN_SHIFT;
+    while (cap < size && cls < BUFFER_POOL_CLASSES) {
+        cap <<= 2;
+        cls++;
+    }
+    return cls;
+}
+
+static inline size_t buffer_pool_class_size(int cls) {
+    return (size_t)1 << (BUFFER_POOL_MIN_SHIFT + 2 * cls);
+}
+
+uint8_t* buffer_pool_get(lb_buffer_pool_t* pool, size_t min_size, size_t* capacity) {
+    int cls = buffer_pool_class_of(min_size);
+
+    // Oversized requests bypass the pool entirely
+    if (cls >= BUFFER_POOL_CLASSES) {
+        *capacity = min_size;
+        return lb_alloc(min_size);
+    }
+
+    // Classes the allocator covers come from the thread cache
+    *capacity = buffer_pool_class_size(cls);
+    if (*capacity <= LB_ALLOC_SMALL_MAX) return lb_alloc(*capacity);
+
+    buffer_pool_class_t* c = &pool->classes[cls];
+
+    pthread_spin_lock(&c->lock);
+    slab_free_obj_t* buf = c->free_list;
+    if (buf) {
+        c->free_list = buf->next;
+        c->cached--;
+    }
+    pthread_spin_unlock(&c->lock);
+
+    return buf ? (uint8_t*)buf : lb_alloc(*capacity);
+}
+
+void buffer_pool_put(lb_buffer_pool_t* pool, uint8_t* buf, size_t capacity) {
+    if (!buf) return;
 
-    memory_chunk_t* chunk = (memory_chunk_t*)ptr;
-    chunk->size = size;
+    int cls = buffer_pool_class_of(capacity);
+    if (cls >= BUFFER_POOL_CLASSES || buffer_pool_class_size(cls) != capacity ||
+        capacity <= LB_ALLOC_SMALL_MAX) {
+        lb_free(buf);
+        return;
+    }
+
+    buffer_pool_class_t* c = &pool->classes[cls];
+    pthread_spin_lock(&c->lock);
+    if (c->cached < BUFFER_POOL_MAX_CACHED) {
+        slab_free_obj_t* obj = (slab_free_obj_t*)buf;
+        obj->next = c->free_list;
+        c->free_list = obj;
+        c->cached++;
+        buf = NULL;
+    }
+    pthread_spin_unlock(&c->lock);
 
-    pthread_spin_lock(&pool->lock);
-    chunk->next = pool->free_list;
-    pool->free_list = chunk;
-    pthread_spin_unlock(&pool->lock);
+    lb_free(buf);
 }
 
 uint64_t murmur3_64(const void* key, size_t len, uint64_t seed) {
@@ -67,7 +186,9 @@ uint64_t murmur3_64(const void* key, size_t len, uint64_t seed) {
     const uint64_t* end = data + (len / 8);
 
     while (data != end) {
-        uint64_t k = *data++;
+        // Callers hash substrings at any offset
+        uint64_t k;
+        memcpy(&k, data++, sizeof(k));
 
         k *= m;
         k ^= k >> r;
@@ -103,19 +224,116 @@ uint64_t murmur3_64(const void* key, size_t len, uint64_t seed) {
     return h;
 }
 
-consistent_hash_t* consistent_hash_create(uint32_t size, uint32_t virtual_nodes) {
+#define MM3_C1 0x87c37b91114253d5ULL
+#define MM3_C2 0x4cf5ad432745937fULL
+
+static inline uint64_t mm3_rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t mm3_fmix(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+static inline void mm3_block(lb_hash128_t* st, const uint8_t* p) {
+    uint64_t k1, k2;
+    memcpy(&k1, p, 8);
+    memcpy(&k2, p + 8, 8);
+
+    k1 *= MM3_C1; k1 = mm3_rotl(k1, 31); k1 *= MM3_C2; st->h1 ^= k1;
+    st->h1 = mm3_rotl(st->h1, 27); st->h1 += st->h2; st->h1 = st->h1 * 5 + 0x52dce729;
+    k2 *= MM3_C2; k2 = mm3_rotl(k2, 33); k2 *= MM3_C1; st->h2 ^= k2;
+    st->h2 = mm3_rotl(st->h2, 31); st->h2 += st->h1; st->h2 = st->h2 * 5 + 0x38495ab5;
+}
+
+void lb_hash128_init(lb_hash128_t* st, uint64_t seed) {
+    st->h1 = st->h2 = seed;
+    st->total = 0;
+    st->tail_len = 0;
+}
+
+void lb_hash128_update(lb_hash128_t* st, const void* data, size_t len) {
+    const uint8_t* p = data;
+    st->total += len;
+
+    if (st->tail_len) {
+        size_t n = 16 - st->tail_len;
+        if (n > len) n = len;
+        memcpy(st->tail + st->tail_len, p, n);
+        st->tail_len += n;
+        p += n;
+        len -= n;
+        if (st->tail_len < 16) return;
+        mm3_block(st, st->tail);
+        st->tail_len = 0;
+    }
+
+    for (; len >= 16; p += 16, len -= 16)
+        mm3_block(st, p);
+
+    memcpy(st->tail, p, len);
+    st->tail_len = len;
+}
+
+void lb_hash128_final(const lb_hash128_t* st, uint64_t out[2]) {
+    uint64_t h1 = st->h1, h2 = st->h2;
+    uint64_t k1 = 0, k2 = 0;
+    const uint8_t* t = st->tail;
+
+    switch (st->tail_len) {
+        case 15: k2 ^= (uint64_t)t[14] << 48; __attribute__((fallthrough));
+        case 14: k2 ^= (uint64_t)t[13] << 40; __attribute__((fallthrough));
+        case 13: k2 ^= (uint64_t)t[12] << 32; __attribute__((fallthrough));
+        case 12: k2 ^= (uint64_t)t[11] << 24; __attribute__((fallthrough));
+        case 11: k2 ^= (uint64_t)t[10] << 16; __attribute__((fallthrough));
+        case 10: k2 ^= (uint64_t)t[9] << 8;   __attribute__((fallthrough));
+        case 9:  k2 ^= (uint64_t)t[8];
+                 k2 *= MM3_C2; k2 = mm3_rotl(k2, 33); k2 *= MM3_C1; h2 ^= k2;
+                 __attribute__((fallthrough));
+        case 8:  k1 ^= (uint64_t)t[7] << 56; __attribute__((fallthrough));
+        case 7:  k1 ^= (uint64_t)t[6] << 48; __attribute__((fallthrough));
+        case 6:  k1 ^= (uint64_t)t[5] << 40; __attribute__((fallthrough));
+        case 5:  k1 ^= (uint64_t)t[4] << 32; __attribute__((fallthrough));
+        case 4:  k1 ^= (uint64_t)t[3] << 24; __attribute__((fallthrough));
+        case 3:  k1 ^= (uint64_t)t[2] << 16; __attribute__((fallthrough));
+        case 2:  k1 ^= (uint64_t)t[1] << 8;  __attribute__((fallthrough));
+        case 1:  k1 ^= (uint64_t)t[0];
+                 k1 *= MM3_C1; k1 = mm3_rotl(k1, 31); k1 *= MM3_C2; h1 ^= k1;
+    }
+
+    h1 ^= st->total; h2 ^= st->total;
+    h1 += h2; h2 += h1;
+    h1 = mm3_fmix(h1); h2 = mm3_fmix(h2);
+    h1 += h2; h2 += h1;
+
+    out[0] = h1;
+    out[1] = h2;
+}
+
+static bool maglev_is_prime(uint32_t n) {
+    if (n < 2) return false;
+    for (uint32_t d = 2; (uint64_t)d * d <= n; d++) {
+        if (n % d == 0) return false;
+    }
+    return true;
+}
+
+consistent_hash_t* consistent_hash_create(uint32_t size) {
     consistent_hash_t* ch = calloc(1, sizeof(consistent_hash_t));
     if (!ch) return NULL;
 
-    ch->size = size;
-    ch->virtual_nodes = virtual_nodes;
-    ch->table = calloc(size, sizeof(hash_node_t*));
-    if (!ch->table) {
-        free(ch);
-        return NULL;
-    }
+    // Permutations only cover every slot when the table size is prime
+    if (size < 3) size = MAGLEV_DEFAULT_SIZE;
+    while (!maglev_is_prime(size)) size++;
 
-    pthread_spin_init(&ch->lock, PTHREAD_PROCESS_PRIVATE);
+    ch->size = size;
+    atomic_init(&ch->table, NULL);
+    pthread_mutex_init(&ch->lock, NULL);
 
     return ch;
 }
@@ -123,79 +341,248 @@ consistent_hash_t* consistent_hash_create(uint32_t size, uint32_t virtual_nodes)
 void consistent_hash_add(consistent_hash_t* ch, backend_t* backend) {
     char key[512];
 
-    pthread_spin_lock(&ch->lock);
+    pthread_mutex_lock(&ch->lock);
+
+    if (ch->member_count < MAX_BACKENDS) {
+        // Each backend walks the table in its own fixed order, derived
+        // from its name so that restarts rebuild the same table
+        int len = snprintf(key, sizeof(key), "%s:%u", backend->host, backend->port);
+        maglev_member_t* m = &ch->members[ch->member_count++];
+        m->backend = backend;
+        m->offset = murmur3_64(key, len, 0x6d61676c) % ch->size;
+        m->skip = murmur3_64(key, len, 0x65763031) % (ch->size - 1) + 1;
+        m->weight = 0;
+    }
 
-    for (uint32_t i = 0; i < ch->virtual_nodes; i++) {
-        snprintf(key, sizeof(key), "%s:%u#%u", backend->host, backend->port, i);
-        uint64_t hash = murmur3_64(key, strlen(key), 0);
+    pthread_mutex_unlock(&ch->lock);
+}
 
-        uint32_t idx = hash % ch->size;
+// Weighted Maglev population: backends take turns claiming the next free
+// slot of their permutation, weight turns per round, until the table is
+// full. Called with ch->lock held.
+static maglev_table_t* maglev_build(consistent_hash_t* ch) {
+    uint32_t size = ch->size;
+    maglev_table_t* t = calloc(1, sizeof(*t) + (size_t)size * sizeof(backend_t*));
+    uint32_t* next = calloc(ch->member_count ? ch->member_count : 1, sizeof(uint32_t));
+    if (!t || !next) {
+        free(t);
+        free(next);
+        return NULL;
+    }
 
-        hash_node_t* node = malloc(sizeof(hash_node_t));
-        node->hash = hash;
-        node->backend = backend;
-        node->next = ch->table[idx];
-        ch->table[idx] = node;
+    t->size = size;
+    for (uint32_t i = 0; i < ch->member_count; i++) {
+        maglev_member_t* m = &ch->members[i];
+        m->weight = 0;
+        if (atomic_load(&m->backend->state) == BACKEND_UP) {
+            uint32_t weight = atomic_load(&m->backend->weight);
+            m->weight = weight ? weight : 1;
+            t->count++;
+        }
     }
 
-    pthread_spin_unlock(&ch->lock);
-}
+    uint32_t filled = 0;
+    while (t->count > 0 && filled < size) {
+        for (uint32_t i = 0; i < ch->member_count && filled < size; i++) {
+            maglev_member_t* m = &ch->members[i];
+            for (uint32_t turn = 0; turn < m->weight && filled < size; turn++) {
+                uint32_t slot;
+                do {
+                    slot = (uint32_t)((m->offset + (uint64_t)next[i] * m->skip) % size);
+                    next[i]++;
+                } while (t->entry[slot]);
+
+                t->entry[slot] = m->backend;
+                filled++;
+            }
+        }
+    }
 
-backend_t* consistent_hash_get(consistent_hash_t* ch, const char* key) {
-    uint64_t hash = murmur3_64(key, strlen(key), 0);
-    uint32_t idx = hash % ch->size;
+    free(next);
+    return t;
+}
 
-    pthread_spin_lock(&ch->lock);
+void consistent_hash_rebuild(consistent_hash_t* ch) {
+    pthread_mutex_lock(&ch->lock);
+    maglev_table_t* t = maglev_build(ch);
+    maglev_table_t* old = NULL;
+    if (t) {
+        old = atomic_exchange_explicit(&ch->table, t, memory_order_acq_rel);
+    }
+    pthread_mutex_unlock(&ch->lock);
 
-    hash_node_t* node = ch->table[idx];
-    backend_t* result = NULL;
-    uint64_t min_distance = UINT64_MAX;
+    // Workers may still be reading the old table until their next
+    // quiescent state
+    lb_rcu_retire(old, free);
+}
 
-    while (node) {
-        if (atomic_load(&node->backend->state) == BACKEND_UP) {
-            uint64_t distance = (node->hash > hash) ?
-                (node->hash - hash) : (UINT64_MAX - hash + node->hash);
+bool consistent_hash_sync(consistent_hash_t* ch) {
+    bool changed = !atomic_load_explicit(&ch->table, memory_order_relaxed);
 
-            if (distance < min_distance) {
-                min_distance = distance;
-                result = node->backend;
-            }
-        }
-        node = node->next;
-    }
-
-    if (!result) {
-        for (uint32_t i = 0; i < ch->size; i++) {
-            node = ch->table[i];
-            while (node) {
-                if (atomic_load(&node->backend->state) == BACKEND_UP) {
-                    result = node->backend;
-                    break;
-                }
-                node = node->next;
-            }
-            if (result) break;
+    pthread_mutex_lock(&ch->lock);
+    for (uint32_t i = 0; i < ch->member_count && !changed; i++) {
+        maglev_member_t* m = &ch->members[i];
+        uint32_t weight = 0;
+        if (atomic_load(&m->backend->state) == BACKEND_UP) {
+            weight = atomic_load(&m->backend->weight);
+            if (!weight) weight = 1;
         }
+        changed = (weight != m->weight);
+    }
+    pthread_mutex_unlock(&ch->lock);
+
+    if (changed) consistent_hash_rebuild(ch);
+    lb_rcu_reclaim();
+    return changed;
+}
+
+backend_t* consistent_hash_lookup(consistent_hash_t* ch, uint64_t hash) {
+    maglev_table_t* t = atomic_load_explicit(&ch->table, memory_order_acquire);
+    if (!t || t->count == 0) return NULL;
+
+    uint32_t idx = hash % t->size;
+    backend_t* b = t->entry[idx];
+    if (atomic_load_explicit(&b->state, memory_order_relaxed) == BACKEND_UP) {
+        return b;
     }
 
-    pthread_spin_unlock(&ch->lock);
+    // Went down after the last rebuild: the neighbouring slots give a
+    // stable stand-in until the table is rebuilt without it
+    for (uint32_t i = 1; i <= 64; i++) {
+        b = t->entry[(idx + i) % t->size];
+        if (atomic_load_explicit(&b->state, memory_order_relaxed) == BACKEND_UP) return b;
+    }
+    return NULL;
+}
 
-    return result;
+backend_t* consistent_hash_get(consistent_hash_t* ch, const char* key) {
+    return consistent_hash_lookup(ch, murmur3_64(key, strlen(key), 0));
 }
 
 void consistent_hash_destroy(consistent_hash_t* ch) {
     if (!ch) return;
 
-    for (uint32_t i = 0; i < ch->size; i++) {
-        hash_node_t* node = ch->table[i];
-        while (node) {
-            hash_node_t* next = node->next;
-            free(node);
-            node = next;
+    // No readers are left at this point
+    free(atomic_load(&ch->table));
+    pthread_mutex_destroy(&ch->lock);
+    free(ch);
+}
+
+lb_wrr_t* lb_wrr_create(void) {
+    lb_wrr_t* wrr = calloc(1, sizeof(lb_wrr_t));
+    if (!wrr) return NULL;
+
+    atomic_init(&wrr->schedule, NULL);
+    atomic_init(&wrr->cursor, 0);
+    pthread_mutex_init(&wrr->lock, NULL);
+    return wrr;
+}
+
+static uint32_t wrr_gcd(uint32_t a, uint32_t b) {
+    while (b) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Reduce the weights by their common divisor and, if the schedule would
+// still be too long, scale them down keeping every backend at least 1.
+// Called with wrr->lock held.
+static wrr_schedule_t* wrr_build(lb_wrr_t* wrr, backend_t** backends, uint32_t count) {
+    uint32_t weight[MAX_BACKENDS];
+    uint32_t divisor = 0;
+    uint64_t total = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        weight[i] = wrr->weights[i];
+        if (weight[i]) divisor = wrr_gcd(weight[i], divisor);
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (divisor > 1) weight[i] /= divisor;
+        total += weight[i];
+    }
+    if (total > WRR_MAX_SCHEDULE) {
+        uint64_t scaled = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            if (!weight[i]) continue;
+            weight[i] = (uint32_t)((uint64_t)weight[i] * WRR_MAX_SCHEDULE / total);
+            if (!weight[i]) weight[i] = 1;
+            scaled += weight[i];
         }
+        total = scaled;
     }
 
-    free(ch->table);
-    pthread_spin_destroy(&ch->lock);
-    free(ch);
-}
\ No newline at end of file
+    wrr_schedule_t* s = malloc(sizeof(*s) + total * sizeof(backend_t*));
+    if (!s) return NULL;
+    s->length = (uint32_t)total;
+
+    // Each step every backend gains its weight and the leader pays back
+    // the total, which interleaves heavy backends instead of bursting them
+    int64_t current[MAX_BACKENDS] = {0};
+    for (uint32_t n = 0; n < s->length; n++) {
+        int best = -1;
+        for (uint32_t i = 0; i < count; i++) {
+            if (!weight[i]) continue;
+            current[i] += weight[i];
+            if (best < 0 || current[i] > current[best]) best = i;
+        }
+        current[best] -= (int64_t)total;
+        s->slots[n] = backends[best];
+    }
+
+    return s;
+}
+
+bool lb_wrr_sync(lb_wrr_t* wrr, backend_t** backends, uint32_t count) {
+    bool changed = !atomic_load_explicit(&wrr->schedule, memory_order_relaxed);
+    if (count > MAX_BACKENDS) count = MAX_BACKENDS;
+
+    pthread_mutex_lock(&wrr->lock);
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t weight = 0;
+        if (backends[i] && atomic_load(&backends[i]->state) == BACKEND_UP) {
+            weight = atomic_load(&backends[i]->weight);
+            if (!weight) weight = 1;
+        }
+        if (weight != wrr->weights[i]) {
+            wrr->weights[i] = weight;
+            changed = true;
+        }
+    }
+
+    wrr_schedule_t* old = NULL;
+    if (changed) {
+        wrr_schedule_t* s = wrr_build(wrr, backends, count);
+        if (s) {
+            old = atomic_exchange_explicit(&wrr->schedule, s, memory_order_acq_rel);
+        }
+    }
+    pthread_mutex_unlock(&wrr->lock);
+
+    lb_rcu_retire(old, free);
+    lb_rcu_reclaim();
+    return changed;
+}
+
+backend_t* lb_wrr_next(lb_wrr_t* wrr) {
+    wrr_schedule_t* s = atomic_load_explicit(&wrr->schedule, memory_order_acquire);
+    if (!s || s->length == 0) return NULL;
+
+    uint32_t n = atomic_fetch_add_explicit(&wrr->cursor, 1, memory_order_relaxed);
+    for (uint32_t i = 0; i < s->length && i < 64; i++) {
+        backend_t* b = s->slots[(n + i) % s->length];
+        // Skip backends that went down since the last rebuild
+        if (atomic_load_explicit(&b->state, memory_order_relaxed) == BACKEND_UP) return b;
+    }
+    return NULL;
+}
+
+void lb_wrr_destroy(lb_wrr_t* wrr) {
+    if (!wrr) return;
+
+    free(atomic_load(&wrr->schedule));
+    pthread_mutex_destroy(&wrr->lock);
+    free(wrr);
+}
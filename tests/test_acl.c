@@ -0,0 +1,339 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../include/core/proxy.h"
+#include "../include/http/http.h"
+#include "../include/acl/acl.h"
+#include "../include/acl/acl_lpm.h"
+#include "../include/core/lb_rcu.h"
+#include <unistd.h>
+#include <arpa/inet.h>
+
+static int acl_test_fetches;
+
+static int acl_test_fetch(struct proxy *px, struct session *sess, void *l7,
+                          unsigned int opt, const struct arg *args,
+                          struct sample *smp) {
+    acl_test_fetches++;
+    smp->data.type = SMP_T_STR;
+    smp->data.u.str.ptr = "yes";
+    smp->data.u.str.len = 3;
+    return 1;
+}
+
+static acl_cond_t *acl_test_cond(const char *text, acl_t *acls) {
+    static char buf[512];
+    const char *args[32];
+    int n = 0;
+
+    snprintf(buf, sizeof(buf), "%s", text);
+    for (char *tok = strtok(buf, " "); tok && n < 31; tok = strtok(NULL, " "))
+        args[n++] = tok;
+    args[n] = NULL;
+
+    char *err = NULL;
+    acl_cond_t *cond = acl_cond_parse(args, acls, &err);
+    free(err);
+    return cond;
+}
+
+static void acl_test_add(acl_t **acls, const char *name, const char *text) {
+    static char buf[512];
+    const char *args[32];
+    int n = 0;
+
+    snprintf(buf, sizeof(buf), "%s", text);
+    for (char *tok = strtok(buf, " "); tok && n < 31; tok = strtok(NULL, " "))
+        args[n++] = tok;
+    args[n] = NULL;
+
+    char *err = NULL;
+    acl_expr_t *expr = acl_expr_parse(args, &err);
+    assert(expr != NULL);
+    assert(acl_add_expr(acls, name, expr) != NULL);
+}
+
+static void test_acl_engine() {
+    printf("Testing compiled ACL conditions...\n");
+
+    static acl_keyword_t test_kw[] = {
+        {"test_cnt", pattern_parse_str, acl_match_str, acl_test_fetch, 0, 0},
+        {NULL, NULL, NULL, NULL, 0, 0}
+    };
+    acl_init();
+    acl_register_keywords(test_kw);
+
+    char raw[] = "POST /api/v1/users?id=7&debug=1 HTTP/1.1\r\n"
+                 "Host: example.com\r\nX-Token: abc123\r\n\r\n";
+    struct channel req = {0};
+    req.buf.area = raw;
+    req.buf.size = req.buf.data = sizeof(raw) - 1;
+
+    http_txn_t txn = {0};
+    http_msg_reset(&txn.req);
+    assert(http_msg_analyzer(&txn.req, &req.buf) == 1);
+
+    session_t sess = {0};
+    stream_t strm = {0};
+    strm.sess = &sess;
+    strm.req = &req;
+    strm.txn = &txn;
+
+    acl_t *acls = NULL;
+    acl_test_add(&acls, "is_api", "path_beg /api/");
+    acl_test_add(&acls, "is_post", "method POST");
+    acl_test_add(&acls, "is_get", "method GET");
+    acl_test_add(&acls, "host_ok", "hdr(host) example.com other.com");
+    acl_test_add(&acls, "has_token", "hdr(x-token)");
+    acl_test_add(&acls, "has_auth", "hdr(authorization)");
+    acl_test_add(&acls, "debug", "url_param(debug) 1");
+    // Several lines naming one ACL are ORed
+    acl_test_add(&acls, "static", "path_end .css");
+    acl_test_add(&acls, "static", "path_end /users");
+
+    static const struct { const char *cond; int expect; } cases[] = {
+        {"if is_api", 1},
+        {"unless is_api", 0},
+        {"if is_api is_post host_ok", 1},
+        {"if is_api is_get", 0},
+        {"if is_get || is_post", 1},
+        {"if is_get or has_auth", 0},
+        {"if !has_auth has_token", 1},
+        {"if ! has_token", 0},
+        {"if is_get is_api || !is_post || debug static", 1},
+        {"if is_get || has_auth || !debug", 0},
+        {"if { path_sub /v1/ } { url_param(id) 7 }", 1},
+        {"if { hdr_beg(host) www. }", 0},
+        {"unless is_get || has_auth", 1},
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        acl_cond_t *cond = acl_test_cond(cases[i].cond, acls);
+        assert(cond != NULL);
+        assert(acl_exec_cond(cond, NULL, &sess, &strm, SMP_OPT_DIR_REQ) == cases[i].expect);
+        acl_cond_free(cond);
+    }
+
+    // Bad conditions are rejected
+    assert(acl_test_cond("if", acls) == NULL);
+    assert(acl_test_cond("if nope", acls) == NULL);
+    assert(acl_test_cond("if is_api ||", acls) == NULL);
+    assert(acl_test_cond("if { path_beg /x", acls) == NULL);
+
+    // 50 rules on one sample fetch it once per stream
+    acl_test_add(&acls, "cnt", "test_cnt yes");
+    acl_test_add(&acls, "cnt_no", "test_cnt no");
+    acl_cond_t *conds[50];
+    for (int i = 0; i < 50; i++) {
+        conds[i] = acl_test_cond(i & 1 ? "if cnt_no || cnt" : "if cnt", acls);
+        assert(conds[i] != NULL);
+    }
+    for (int i = 0; i < 50; i++)
+        assert(acl_exec_cond(conds[i], NULL, &sess, &strm, SMP_OPT_DIR_REQ) == 1);
+    assert(acl_test_fetches == 1);
+
+    acl_smp_cache_reset(&strm);
+    assert(acl_exec_cond(conds[0], NULL, &sess, &strm, SMP_OPT_DIR_REQ) == 1);
+    assert(acl_test_fetches == 2);
+
+    // Short-circuit: once is_get fails, cnt is never fetched
+    acl_smp_cache_reset(&strm);
+    acl_cond_t *sc = acl_test_cond("if is_get cnt", acls);
+    assert(acl_exec_cond(sc, NULL, &sess, &strm, SMP_OPT_DIR_REQ) == 0);
+    assert(acl_test_fetches == 2);
+    acl_cond_free(sc);
+
+    for (int i = 0; i < 50; i++)
+        acl_cond_free(conds[i]);
+
+    // Rule lists: allow stops access rules, deny sets the status
+    proxy_t *fe = proxy_new("acl_test_fe", PR_MODE_HTTP);
+    proxy_t *be = proxy_new("acl_test_be", PR_MODE_HTTP);
+    assert(fe && be);
+    strm.fe = fe;
+    sess.frontend = fe;
+
+    http_req_rule_t allow = {0}, deny = {0}, route = {0};
+    allow.action = ACL_ALLOW;
+    allow.cond = acl_test_cond("if has_auth", acls);
+    deny.action = ACL_DENY;
+    deny.arg.deny.status = 429;
+    deny.cond = acl_test_cond("if is_post !has_auth", acls);
+    route.action = ACL_USE_BACKEND;
+    route.arg.backend.name = "acl_test_be";
+    route.cond = acl_test_cond("if is_api", acls);
+    LIST_ADDQ(&fe->http_req_rules, &route.list);
+    LIST_ADDQ(&fe->http_req_rules, &allow.list);
+    LIST_ADDQ(&fe->http_req_rules, &deny.list);
+
+    acl_smp_cache_reset(&strm);
+    assert(apply_http_req_rules(&strm, &req, fe) == ACL_RULES_DENY);
+    assert(txn.status == 429);
+    assert(strm.be == be);
+
+    LIST_DEL(&deny.list);
+    txn.status = 0;
+    assert(apply_http_req_rules(&strm, &req, fe) == ACL_RULES_CONT);
+    assert(txn.status == 0);
+
+    acl_cond_free(allow.cond);
+    acl_cond_free(deny.cond);
+    acl_cond_free(route.cond);
+    acl_smp_cache_free(&strm);
+    http_msg_release(&txn.req);
+
+    printf("Compiled ACL condition test passed\n");
+}
+
+static int lpm_cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int acl_test_src(session_t *sess, acl_cond_t *cond, const char *ip) {
+    struct connection conn = {0};
+    if (strchr(ip, ':')) {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&conn.addr.from;
+        sin6->sin6_family = AF_INET6;
+        inet_pton(AF_INET6, ip, &sin6->sin6_addr);
+    } else {
+        struct sockaddr_in *sin = (struct sockaddr_in *)&conn.addr.from;
+        sin->sin_family = AF_INET;
+        inet_pton(AF_INET, ip, &sin->sin_addr);
+    }
+    sess->cli_conn = &conn;
+    int ret = acl_exec_cond(cond, NULL, sess, NULL, SMP_OPT_DIR_REQ);
+    sess->cli_conn = NULL;
+    return ret;
+}
+
+static void test_acl_lpm() {
+    printf("Testing IP prefix sets...\n");
+
+    // 200k random hosts plus a few ranges, checked against a sorted array
+    enum { HOSTS = 200000, RANGES = 64, PROBES = 200000 };
+    uint32_t *hosts = malloc(HOSTS * sizeof(*hosts));
+    uint32_t range_addr[RANGES], range_mask[RANGES];
+    acl_lpm_t *lpm = acl_lpm_new();
+    assert(hosts && lpm);
+
+    srand(42);
+    for (int i = 0; i < HOSTS; i++) {
+        hosts[i] = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+        struct in_addr a = { htonl(hosts[i]) };
+        assert(acl_lpm_add4(lpm, a, 32) == 0);
+    }
+    for (int i = 0; i < RANGES; i++) {
+        int len = 8 + rand() % 23;
+        range_mask[i] = ~0u << (32 - len);
+        range_addr[i] = (((uint32_t)rand() << 16) ^ (uint32_t)rand()) & range_mask[i];
+        struct in_addr a = { htonl(range_addr[i] | 1) };   // host bits are masked off
+        assert(acl_lpm_add4(lpm, a, len) == 0);
+    }
+    assert(acl_lpm_build(lpm) == 0);
+    assert(acl_lpm_count(lpm) == HOSTS + RANGES);
+    qsort(hosts, HOSTS, sizeof(*hosts), lpm_cmp_u32);
+
+    for (int i = 0; i < HOSTS; i += 97) {
+        struct in_addr a = { htonl(hosts[i]) };
+        assert(acl_lpm_lookup4(lpm, a));
+    }
+    for (int i = 0; i < PROBES; i++) {
+        // Half the probes land next to a listed host
+        uint32_t ip = i & 1 ? hosts[rand() % HOSTS] ^ (rand() & 0xff)
+                            : ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+        int expect = bsearch(&ip, hosts, HOSTS, sizeof(*hosts), lpm_cmp_u32) != NULL;
+        for (int r = 0; r < RANGES && !expect; r++)
+            expect = (ip & range_mask[r]) == range_addr[r];
+
+        struct in_addr a = { htonl(ip) };
+        assert(acl_lpm_lookup4(lpm, a) == expect);
+    }
+    acl_lpm_free(lpm);
+    free(hosts);
+
+    // IPv6 prefixes ending on and off byte boundaries
+    lpm = acl_lpm_new();
+    static const struct { const char *addr; int len; } v6[] = {
+        {"2001:db8::", 32}, {"2001:db9:1:2::", 64}, {"fe80::1234", 127},
+        {"::1", 128}, {"4000::", 2},
+    };
+    for (size_t i = 0; i < sizeof(v6) / sizeof(v6[0]); i++) {
+        struct in6_addr a;
+        inet_pton(AF_INET6, v6[i].addr, &a);
+        assert(acl_lpm_add6(lpm, &a, v6[i].len) == 0);
+    }
+    assert(acl_lpm_build(lpm) == 0);
+
+    static const struct { const char *addr; bool hit; } probes6[] = {
+        {"2001:db8:ffff::1", true}, {"2001:db7::1", false},
+        {"2001:db9:1:2:abcd::", true}, {"2001:db9:1:3::", false},
+        {"fe80::1235", true}, {"fe80::1236", false},
+        {"::1", true}, {"::2", false}, {"7fff::1", true}, {"8000::", false},
+    };
+    for (size_t i = 0; i < sizeof(probes6) / sizeof(probes6[0]); i++) {
+        struct in6_addr a;
+        inet_pton(AF_INET6, probes6[i].addr, &a);
+        assert(acl_lpm_lookup6(lpm, &a) == probes6[i].hit);
+    }
+    acl_lpm_free(lpm);
+
+    // An ACL over a pattern file, reloaded in place
+    char path[] = "/tmp/acl_lpm_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    FILE *f = fdopen(fd, "w");
+    fprintf(f, "# blocklist\n10.0.0.0/8\n192.168.1.7\n\n2001:db8::/32  # docs\n");
+    fclose(f);
+
+    acl_t *acls = NULL;
+    char spec[128];
+    snprintf(spec, sizeof(spec), "src 172.16.0.0/12 -f %s", path);
+    acl_test_add(&acls, "blocked", spec);
+    acl_cond_t *cond = acl_test_cond("if blocked", acls);
+    assert(cond != NULL);
+
+    session_t sess = {0};
+    assert(acl_test_src(&sess, cond, "10.20.30.40") == 1);
+    assert(acl_test_src(&sess, cond, "192.168.1.7") == 1);
+    assert(acl_test_src(&sess, cond, "192.168.1.8") == 0);
+    assert(acl_test_src(&sess, cond, "172.31.255.255") == 1);
+    assert(acl_test_src(&sess, cond, "::ffff:10.1.1.1") == 1);
+    assert(acl_test_src(&sess, cond, "2001:db8::42") == 1);
+    assert(acl_test_src(&sess, cond, "2001:db9::42") == 0);
+
+    f = fopen(path, "w");
+    fprintf(f, "192.168.1.8\n");
+    fclose(f);
+    char *err = NULL;
+    assert(acl_reload(acls, &err) == 1);
+    assert(acl_test_src(&sess, cond, "10.20.30.40") == 0);
+    assert(acl_test_src(&sess, cond, "192.168.1.8") == 1);
+    assert(acl_test_src(&sess, cond, "172.16.0.1") == 1);    // inline patterns stay
+
+    // A bad file leaves the current set in place
+    f = fopen(path, "w");
+    fprintf(f, "192.168.1.9\nnot-an-address\n");
+    fclose(f);
+    assert(acl_reload(acls, &err) == -1);
+    assert(err != NULL);
+    free(err);
+    assert(acl_test_src(&sess, cond, "192.168.1.8") == 1);
+    assert(acl_test_src(&sess, cond, "192.168.1.9") == 0);
+
+    acl_cond_free(cond);
+    unlink(path);
+    lb_rcu_reclaim();
+
+    printf("IP prefix set test passed\n");
+}
+
+int main() {
+    printf("Running UltraBalancer ACL tests...\n\n");
+
+    test_acl_engine();
+    test_acl_lpm();
+
+    printf("\nAll tests passed!\n");
+    return 0;
+}
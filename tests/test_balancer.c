@@ -0,0 +1,452 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../include/core/loadbalancer.h"
+#include "../include/core/proxy.h"
+#include "../include/core/lb_rcu.h"
+
+void test_maglev() {
+    printf("Testing Maglev consistent hash...\n");
+
+    enum { N = 10, KEYS = 100000 };
+    static backend_t backends[N];
+    consistent_hash_t *ch = consistent_hash_create(MAGLEV_DEFAULT_SIZE);
+    assert(ch != NULL && ch->size == MAGLEV_DEFAULT_SIZE);
+
+    assert(consistent_hash_lookup(ch, 1) == NULL);  // nothing published yet
+
+    for (int i = 0; i < N; i++) {
+        memset(&backends[i], 0, sizeof(backends[i]));
+        snprintf(backends[i].host, sizeof(backends[i].host), "10.0.0.%d", i + 1);
+        backends[i].port = 80;
+        backends[i].weight = 1;
+        backends[i].state = BACKEND_UP;
+        consistent_hash_add(ch, &backends[i]);
+    }
+    assert(consistent_hash_sync(ch));       // first sync builds the table
+    assert(!consistent_hash_sync(ch));      // and nothing changed since
+
+    // Every backend owns close to 1/N of the table
+    maglev_table_t *t = atomic_load(&ch->table);
+    int owned[N] = {0};
+    for (uint32_t i = 0; i < t->size; i++) {
+        owned[t->entry[i] - backends]++;
+    }
+    for (int i = 0; i < N; i++) {
+        assert(owned[i] > (int)t->size / N * 9 / 10);
+        assert(owned[i] < (int)t->size / N * 11 / 10);
+    }
+
+    static backend_t *before[KEYS];
+    for (int k = 0; k < KEYS; k++) {
+        before[k] = consistent_hash_lookup(ch, murmur3_64(&k, sizeof(k), 7));
+    }
+
+    // Taking one backend down is served around immediately, then the
+    // rebuild only moves the keys it owned
+    backends[3].state = BACKEND_DOWN;
+    for (int k = 0; k < KEYS; k++) {
+        assert(consistent_hash_lookup(ch, murmur3_64(&k, sizeof(k), 7)) != &backends[3]);
+    }
+    assert(consistent_hash_sync(ch));
+
+    int moved = 0;
+    for (int k = 0; k < KEYS; k++) {
+        backend_t *b = consistent_hash_lookup(ch, murmur3_64(&k, sizeof(k), 7));
+        assert(b != &backends[3]);
+        if (before[k] != &backends[3] && b != before[k]) moved++;
+    }
+    // Maglev allows a little churn among the survivors
+    assert(moved < KEYS / 50);
+
+    // Weight doubles the share
+    backends[3].state = BACKEND_UP;
+    backends[5].weight = 2;
+    assert(consistent_hash_sync(ch));
+    t = atomic_load(&ch->table);
+    memset(owned, 0, sizeof(owned));
+    for (uint32_t i = 0; i < t->size; i++) {
+        owned[t->entry[i] - backends]++;
+    }
+    assert(owned[5] > owned[0] * 18 / 10);
+
+    consistent_hash_destroy(ch);
+    printf("Maglev consistent hash test passed\n");
+}
+
+void test_wrr() {
+    printf("Testing smooth weighted round-robin...\n");
+
+    static backend_t backends[3];
+    backend_t *list[3];
+    for (int i = 0; i < 3; i++) {
+        memset(&backends[i], 0, sizeof(backends[i]));
+        backends[i].state = BACKEND_UP;
+        list[i] = &backends[i];
+    }
+    backends[0].weight = 50;
+    backends[1].weight = 10;
+    backends[2].weight = 10;
+
+    lb_wrr_t *wrr = lb_wrr_create();
+    assert(wrr != NULL);
+    assert(lb_wrr_next(wrr) == NULL);
+    assert(lb_wrr_sync(wrr, list, 3));
+    assert(!lb_wrr_sync(wrr, list, 3));
+
+    // Weights reduce to 5:1:1 and come out interleaved, nginx order
+    wrr_schedule_t *sched = atomic_load(&wrr->schedule);
+    assert(sched->length == 7);
+    const int expect[7] = {0, 0, 1, 0, 2, 0, 0};
+    for (int i = 0; i < 7; i++) {
+        assert(lb_wrr_next(wrr) == &backends[expect[i]]);
+    }
+
+    // A backend that went down is skipped before and after the rebuild
+    backends[0].state = BACKEND_DOWN;
+    for (int i = 0; i < 20; i++) {
+        assert(lb_wrr_next(wrr) != &backends[0]);
+    }
+    assert(lb_wrr_sync(wrr, list, 3));
+    assert(atomic_load(&wrr->schedule)->length == 2);
+
+    backends[1].state = BACKEND_DOWN;
+    backends[2].state = BACKEND_DOWN;
+    lb_wrr_sync(wrr, list, 3);
+    assert(lb_wrr_next(wrr) == NULL);
+
+    lb_wrr_destroy(wrr);
+    printf("Smooth weighted round-robin test passed\n");
+}
+
+void test_peak_ewma() {
+    printf("Testing peak-EWMA latency tracking...\n");
+
+    static backend_t fast, slow;
+    memset(&fast, 0, sizeof(fast));
+    memset(&slow, 0, sizeof(slow));
+
+    uint64_t now = 1000000000ULL;
+    const uint64_t ms = 1000000ULL;
+
+    // A slow sample is taken at face value
+    lb_backend_observe_latency(&fast, 2 * ms, now);
+    lb_backend_observe_latency(&slow, 2 * ms, now);
+    lb_backend_observe_latency(&slow, 200 * ms, now + ms);
+    assert(atomic_load(&slow.ewma_cost_ns) == 200 * ms);
+    assert(lb_backend_ewma_load(&slow, now + ms) > lb_backend_ewma_load(&fast, now + ms));
+
+    // Faster samples only pull it down gradually
+    uint64_t t = now + ms;
+    lb_backend_observe_latency(&slow, 2 * ms, t + 100 * ms);
+    uint64_t cost = atomic_load(&slow.ewma_cost_ns);
+    assert(cost < 200 * ms && cost > 150 * ms);
+    for (int i = 1; i <= 600; i++) {
+        lb_backend_observe_latency(&slow, 2 * ms, t + 100 * ms * (i + 1));
+    }
+    assert(atomic_load(&slow.ewma_cost_ns) < 3 * ms);
+
+    // Outstanding requests scale the estimate
+    t += 100 * ms * 602;
+    lb_backend_observe_latency(&fast, 2 * ms, t);
+    lb_backend_observe_latency(&slow, 2 * ms, t);
+    uint64_t idle = lb_backend_ewma_load(&fast, t);
+    atomic_store(&fast.pending_requests, 3);
+    assert(lb_backend_ewma_load(&fast, t) >= 3 * idle);
+    assert(lb_backend_ewma_load(&fast, t) > lb_backend_ewma_load(&slow, t));
+
+    // Unmeasured backends with queued requests rank behind measured ones
+    static backend_t fresh;
+    memset(&fresh, 0, sizeof(fresh));
+    assert(lb_backend_ewma_load(&fresh, t) == 0);
+    atomic_store(&fresh.pending_requests, 1);
+    assert(lb_backend_ewma_load(&fresh, t) > lb_backend_ewma_load(&fast, t));
+
+    printf("Peak-EWMA latency tracking test passed\n");
+}
+
+void test_select_view() {
+    printf("Testing backend selection view...\n");
+
+    // Selection only needs the backend table, not a running balancer
+    loadbalancer_t *lb = calloc(1, sizeof(*lb));
+    assert(lb != NULL);
+    lb->algorithm = LB_ALGO_LEASTCONN;
+    char host[32];
+    for (int i = 0; i < 200; i++) {
+        snprintf(host, sizeof(host), "10.0.%d.%d", i / 256, i % 256);
+        assert(lb_add_backend(lb, host, 80, 1) == 0);
+        assert(lb->backends[i]->slot == (uint32_t)i);
+    }
+    // Nothing is selectable until it is marked up
+    assert(lb_select_backend(lb, NULL) == NULL);
+
+    for (int i = 0; i < 200; i++) {
+        lb_backend_set_state(lb, lb->backends[i], BACKEND_UP);
+        lb_backend_conn_get(lb, lb->backends[i]);
+    }
+    assert(atomic_load(&lb->view.up[0]) == UINT64_MAX);
+    assert(atomic_load(&lb->view.up[3]) == (1ULL << (200 - 192)) - 1);
+
+    // Least loaded by connections per weight, across bitmap words
+    backend_t *target = lb->backends[150];
+    lb_backend_conn_put(lb, target);
+    assert(lb_select_backend(lb, NULL) == target);
+
+    lb_backend_set_state(lb, target, BACKEND_DOWN);
+    assert(!lb_backend_slot_up(lb, 150));
+    assert(lb_select_backend(lb, NULL) != target);
+
+    lb_backend_set_weight(lb, lb->backends[70], 4);
+    assert(lb_select_backend(lb, NULL) == lb->backends[70]);
+    assert(lb_backend_conns(lb, lb->backends[70]) == 1);
+
+    for (uint32_t i = 0; i < lb->backend_count; i++) free(lb->backends[i]);
+    free(lb);
+    printf("Backend selection view test passed\n");
+}
+
+void test_p2c() {
+    printf("Testing power-of-two-choices selection...\n");
+
+    loadbalancer_t *lb = calloc(1, sizeof(*lb));
+    assert(lb != NULL);
+    lb->algorithm = LB_ALGO_LEASTCONN_P2C;
+    char host[32];
+    for (int i = 0; i < 4; i++) {
+        snprintf(host, sizeof(host), "10.0.0.%d", i + 1);
+        assert(lb_add_backend(lb, host, 80, 1) == 0);
+        lb_backend_set_state(lb, lb->backends[i], BACKEND_UP);
+    }
+    backend_t *light = lb->backends[0], *down = lb->backends[3];
+    for (int i = 1; i < 3; i++) {
+        for (int c = 0; c < 20; c++) lb_backend_conn_get(lb, lb->backends[i]);
+    }
+    lb_backend_set_state(lb, down, BACKEND_DOWN);
+
+    // The idle backend wins every pair it is sampled into, about 2/3 of
+    // picks, while the busy ones still take the rest between them
+    enum { PICKS = 30000 };
+    int picked[4] = {0};
+    for (int i = 0; i < PICKS; i++) {
+        backend_t *b = lb_select_backend(lb, NULL);
+        assert(b != NULL && b != down);
+        picked[b->slot]++;
+    }
+    assert(picked[0] > PICKS * 6 / 10);
+    assert(picked[1] > PICKS / 10 && picked[2] > PICKS / 10);
+
+    // Weight divides the load: equal connections, four times the weight
+    for (int c = 0; c < 20; c++) lb_backend_conn_get(lb, light);
+    lb_backend_set_weight(lb, lb->backends[2], 4);
+    memset(picked, 0, sizeof(picked));
+    for (int i = 0; i < PICKS; i++) {
+        backend_t *b = lb_select_backend(lb, NULL);
+        assert(b != NULL && b != down);
+        picked[b->slot]++;
+    }
+    assert(picked[2] > PICKS * 6 / 10);
+
+    // With one backend left up there is no pair to sample, and the scan
+    // still finds it
+    lb_backend_set_state(lb, lb->backends[1], BACKEND_DOWN);
+    lb_backend_set_state(lb, lb->backends[2], BACKEND_DOWN);
+    for (int i = 0; i < 100; i++) assert(lb_select_backend(lb, NULL) == light);
+    lb_backend_set_state(lb, light, BACKEND_DOWN);
+    assert(lb_select_backend(lb, NULL) == NULL);
+
+    for (uint32_t i = 0; i < lb->backend_count; i++) free(lb->backends[i]);
+    free(lb);
+    printf("Power-of-two-choices selection test passed\n");
+}
+
+void test_slow_start() {
+    printf("Testing slow-start ramp...\n");
+
+    loadbalancer_t *lb = calloc(1, sizeof(*lb));
+    assert(lb != NULL);
+    lb->algorithm = LB_ALGO_LEASTCONN;
+    lb->config.slow_start_ms = 10000;
+    assert(lb_add_backend(lb, "10.0.0.1", 80, 1) == 0);
+    assert(lb_add_backend(lb, "10.0.0.2", 80, 1) == 0);
+    backend_t *a = lb->backends[0], *b = lb->backends[1];
+
+    // The first UP at startup is not a recovery
+    lb_backend_set_state(lb, a, BACKEND_UP);
+    lb_backend_set_state(lb, b, BACKEND_UP);
+    assert(atomic_load(&lb->view.warming[0]) == 0);
+
+    lb_backend_set_state(lb, b, BACKEND_DOWN);
+    lb_backend_set_state(lb, b, BACKEND_UP);
+    assert(atomic_load(&lb->view.warming[0]) == 2);
+
+    uint64_t since = atomic_load(&b->up_since_ns);
+    uint32_t f = lb_slow_start_factor(lb, b, since + 1000000000ULL);
+    assert(f > LB_SLOW_START_FULL / 11 && f < LB_SLOW_START_FULL / 9);
+
+    lb->config.slow_start_exp = true;
+    assert(lb_slow_start_factor(lb, b, since + 1000000000ULL) < f);
+    assert(lb_slow_start_factor(lb, b, since + 9500000000ULL) > LB_SLOW_START_FULL / 2);
+    lb->config.slow_start_exp = false;
+
+    // Even idle, the warming backend loses to a busy one at full weight
+    for (int i = 0; i < 3; i++) lb_backend_conn_get(lb, a);
+    assert(lb_select_backend(lb, NULL) == a);
+
+    // Past the window it is a regular backend again
+    assert(lb_slow_start_factor(lb, b, since + 10000000000ULL) == LB_SLOW_START_FULL);
+    assert(atomic_load(&lb->view.warming[0]) == 0);
+    assert(lb_select_backend(lb, NULL) == b);
+
+    free(a);
+    free(b);
+    free(lb);
+    printf("Slow-start ramp test passed\n");
+}
+
+void test_proxy_usable() {
+    printf("Testing proxy usable-server arrays...\n");
+
+    proxy_t *px = proxy_new("usable_test", PR_MODE_HTTP);
+    server_t *srv[4];
+    char name[16];
+    for (int i = 0; i < 4; i++) {
+        snprintf(name, sizeof(name), "s%d", i);
+        srv[i] = server_new(name);
+        srv[i]->max_conns = 100;
+        proxy_add_server(px, srv[i]);
+    }
+
+    // Servers start in maintenance, so nothing is published yet
+    assert(atomic_load(&px->usable)->count == 0);
+    assert(select_server_roundrobin(px) == NULL);
+    assert(select_server_leastconn(px) == NULL);
+
+    for (int i = 0; i < 4; i++) server_set_state(srv[i], SRV_RUNNING);
+    srv_usable_t *set = atomic_load(&px->usable);
+    assert(set->count == 4);
+    assert(set->ring_size == 4 * CHASH_POINTS_PER_WEIGHT);
+
+    // Round-robin walks the array from the proxy's own index
+    int picked[4] = {0};
+    for (int i = 0; i < 400; i++) {
+        server_t *s = select_server_roundrobin(px);
+        assert(s != NULL);
+        for (int j = 0; j < 4; j++) picked[j] += s == srv[j];
+    }
+    for (int j = 0; j < 4; j++) assert(picked[j] == 100);
+
+    // A server going down is rebuilt out of the array and the ring
+    server_set_state(srv[1], SRV_MAINTAIN);
+    assert(atomic_load(&px->usable) != set);
+    set = atomic_load(&px->usable);
+    assert(set->count == 3);
+    assert(set->ring_size == 3 * CHASH_POINTS_PER_WEIGHT);
+    for (uint32_t i = 0; i < set->ring_size; i++) assert(set->ring[i].srv != srv[1]);
+    for (int i = 0; i < 300; i++) assert(select_server_roundrobin(px) != srv[1]);
+
+    // A full server stays published but is skipped on every pick
+    atomic_store(&srv[2]->cur_conns, 100);
+    for (int i = 0; i < 300; i++) {
+        server_t *s = select_server_roundrobin(px);
+        assert(s == srv[0] || s == srv[3]);
+    }
+    atomic_store(&srv[2]->cur_conns, 0);
+
+    // Least connections reads the same array
+    atomic_store(&srv[0]->cur_conns, 5);
+    atomic_store(&srv[2]->cur_conns, 3);
+    atomic_store(&srv[3]->cur_conns, 4);
+    assert(select_server_leastconn(px) == srv[2]);
+    server_set_weight(srv[3], 2);
+    assert(select_server_leastconn(px) == srv[3]);
+
+    server_set_state(srv[1], SRV_RUNNING);
+    assert(atomic_load(&px->usable)->count == 4);
+    assert(select_server_leastconn(px) == srv[1]);
+
+    // Replaced arrays were retired, not freed under a reader
+    lb_rcu_reclaim();
+    printf("Proxy usable-server array test passed\n");
+}
+
+void test_proxy_chash() {
+    printf("Testing bounded-load consistent hashing...\n");
+
+    enum { N = 5, KEYS = 10000 };
+    proxy_t *px = proxy_new("chash_test", PR_MODE_HTTP);
+    server_t *srv[N];
+    char name[16];
+    for (int i = 0; i < N; i++) {
+        snprintf(name, sizeof(name), "s%d", i);
+        srv[i] = server_new(name);
+        srv[i]->max_conns = KEYS;
+        proxy_add_server(px, srv[i]);
+        server_set_state(srv[i], SRV_RUNNING);
+    }
+
+    // Without load every key keeps its server, and every server owns some
+    static server_t *owner[KEYS];
+    int owned[N] = {0};
+    for (int k = 0; k < KEYS; k++) {
+        uint64_t h = murmur3_64(&k, sizeof(k), 3);
+        owner[k] = select_server_chash(px, h);
+        assert(owner[k] != NULL);
+        assert(select_server_chash(px, h) == owner[k]);
+        for (int i = 0; i < N; i++) owned[i] += owner[k] == srv[i];
+    }
+    for (int i = 0; i < N; i++) assert(owned[i] > KEYS / N / 3);
+
+    // Placing connections one by one never pushes a server past
+    // ceil(factor x average), counting the one being placed
+    for (int k = 0; k < KEYS; k++) {
+        server_t *s = select_server_chash(px, murmur3_64(&k, sizeof(k), 3));
+        int32_t total = 1;
+        for (int i = 0; i < N; i++) total += atomic_load(&srv[i]->cur_conns);
+        uint64_t cap = ((uint64_t)total * px->hash_balance_factor + N * 100 - 1) / (N * 100);
+        assert((uint64_t)atomic_load(&s->cur_conns) + 1 <= cap);
+        atomic_fetch_add(&s->cur_conns, 1);
+    }
+
+    // A hot key spills over to the next servers instead of piling up
+    for (int i = 0; i < N; i++) atomic_store(&srv[i]->cur_conns, 0);
+    uint64_t hot = murmur3_64("hot", 3, 0);
+    for (int c = 0; c < 1000; c++) atomic_fetch_add(&select_server_chash(px, hot)->cur_conns, 1);
+    for (int i = 0; i < N; i++) assert(atomic_load(&srv[i]->cur_conns) <= 1000 * 125 / 100 / N + 1);
+
+    // Taking a server down rebuilds the ring; only its keys move
+    for (int i = 0; i < N; i++) atomic_store(&srv[i]->cur_conns, 0);
+    server_set_state(srv[2], SRV_MAINTAIN);
+    assert(atomic_load(&px->usable)->count == N - 1);
+    for (int k = 0; k < KEYS; k++) {
+        server_t *s = select_server_chash(px, murmur3_64(&k, sizeof(k), 3));
+        assert(s != NULL && s != srv[2]);
+        if (owner[k] != srv[2]) assert(s == owner[k]);
+    }
+
+    // And bringing it back restores the original mapping
+    server_set_state(srv[2], SRV_RUNNING);
+    for (int k = 0; k < KEYS; k++) {
+        assert(select_server_chash(px, murmur3_64(&k, sizeof(k), 3)) == owner[k]);
+    }
+
+    lb_rcu_reclaim();
+    printf("Bounded-load consistent hashing test passed\n");
+}
+
+int main() {
+    printf("Running UltraBalancer load balancing tests...\n\n");
+
+    test_maglev();
+    test_wrr();
+    test_peak_ewma();
+    test_select_view();
+    test_p2c();
+    test_slow_start();
+    test_proxy_usable();
+    test_proxy_chash();
+
+    printf("\nAll tests passed!\n");
+    return 0;
+}
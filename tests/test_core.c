@@ -2,36 +2,56 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
-#include "../include/stick_tables.h"
 #include "../include/cache/cache.h"
+#include "../include/cache/cache_slab.h"
 #include "../include/health/health.h"
+#include "../include/core/proxy.h"
+#include "../include/http/http.h"
+#include "../include/core/loadbalancer.h"
+#include "../include/core/lb_shm.h"
+#include "../include/core/lb_clock.h"
+#include "../include/core/lb_utils.h"
+#include <zlib.h>
+#include <brotli/decode.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
-void test_stick_tables() {
-    printf("Testing stick tables...\n");
+static void test_clock() {
+    printf("Testing cached clock...\n");
 
-    stick_table_t *table = stktable_new("test", STKTABLE_TYPE_IP, 1000, 3600);
-    assert(table != NULL);
+    // Without a snapshot every read is live
+    assert(!lb_clock.valid);
+    uint64_t a = lb_now_ns();
+    usleep(2000);
+    assert(lb_now_ns() >= a + 2000000);
 
-    stick_key_t key = {
-        .type = STKTABLE_TYPE_IP,
-        .data.ipv4.s_addr = 0x0100007f  // 127.0.0.1
-    };
-
-    stick_entry_t *entry = stktable_get(table, &key);
-    assert(entry != NULL);
+    // With one, reads stay put until the next update
+    lb_clock_update();
+    uint64_t snap = lb_now_ns();
+    assert(lb_now_ms() == snap / 1000000);
+    assert(lb_now_sec() == time(NULL) || lb_now_sec() + 1 == time(NULL));
+    usleep(2000);
+    assert(lb_now_ns() == snap);
 
-    uint32_t val = 100;
-    stktable_update_key(table, &key, STKTABLE_DATA_CONN_CNT, &val);
+    // The precise clock moves on from the snapshot and tracks the real one
+    uint64_t precise = lb_clock_precise_ns();
+    uint64_t real = lb_clock_read_ns();
+    assert(precise >= snap + 2000000);
+    assert(precise <= real + 1000000 && real <= precise + 1000000);
 
-    entry = stktable_lookup(table, &key);
-    assert(entry != NULL);
-    assert(atomic_load(&entry->counters.conn_cnt) == 100);
+    lb_clock_update();
+    assert(lb_now_ns() > snap);
 
-    stktable_free(table);
-    printf("Stick tables test passed\n");
+    lb_clock_release();
+    assert(!lb_clock.valid);
+    printf("Cached clock test passed (TSC %s)\n", lb_clock_tsc_usable() ? "on" : "off");
 }
 
-void test_cache() {
+static void test_cache() {
     printf("Testing cache...\n");
 
     cache_t *cache = cache_create("test", 1024*1024, 100*1024);
@@ -54,7 +74,562 @@ void test_cache() {
     printf("Cache test passed\n");
 }
 
-void test_health_checks() {
+static void cache_put(cache_t *c, const char *key) {
+    static char body[1000];
+    cache_key_t k;
+    cache_key_str(&k, key);
+    cache_entry_t *e = cache_entry_new();
+    assert(cache_entry_set_data(c, e, &k, body, sizeof(body)) == 0);
+    assert(cache_insert(c, key, e) == 0);
+}
+
+static void test_cache_s3fifo() {
+    printf("Testing S3-FIFO cache eviction...\n");
+
+    // Ten 1000-byte objects per shard; work on the keys of shard 0
+    cache_t *c = cache_create("test", CACHE_SHARDS * 10000, 1000);
+    assert(c);
+    char keys[64][16];
+    int n = 0;
+    for (int i = 0; n < 64; i++) {
+        snprintf(keys[n], sizeof(keys[n]), "/k%d", i);
+        if ((cache_hash_key(keys[n]) >> (32 - CACHE_SHARD_BITS)) == 0)
+            n++;
+    }
+    cache_shard_t *sh = &c->shards[0];
+
+    // Hot objects, each hit once
+    for (int i = 0; i < 4; i++)
+        cache_put(c, keys[i]);
+    for (int i = 0; i < 4; i++)
+        assert(cache_lookup(c, keys[i]));
+
+    // A scan of one-hit wonders many times the cache size
+    for (int i = 4; i < 64; i++)
+        cache_put(c, keys[i]);
+    for (int i = 0; i < 4; i++) {
+        cache_entry_t *e = cache_lookup(c, keys[i]);
+        assert(e && e->queue == CACHE_Q_MAIN);
+    }
+    assert(sh->small.count + sh->main.count <= 10);
+    assert(atomic_load(&c->stats.promotions) >= 4);
+
+    // The last scan object to leave is still remembered by the ghost table
+    int gone = 63;
+    while (cache_lookup(c, keys[gone]))
+        gone--;
+    uint64_t ghosts = atomic_load(&c->stats.ghost_hits);
+    cache_put(c, keys[gone]);
+    cache_entry_t *e = cache_lookup(c, keys[gone]);
+    assert(e && e->queue == CACHE_Q_MAIN);
+    assert(atomic_load(&c->stats.ghost_hits) == ghosts + 1);
+
+    // Replacing keeps one copy
+    uint32_t count = atomic_load(&c->entry_count);
+    cache_put(c, keys[0]);
+    assert(atomic_load(&c->entry_count) == count);
+
+    cache_delete(c, keys[1]);
+    assert(!cache_lookup(c, keys[1]));
+
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < CACHE_SHARDS; i++)
+        total += c->shards[i].small.count + c->shards[i].main.count;
+    assert(total == atomic_load(&c->entry_count));
+    assert(atomic_load(&c->current_size) == total * 1000);
+
+    // Too big for the cache is refused outright
+    cache_entry_t big = { .size = 1001 };
+    assert(cache_insert(c, "/big", &big) < 0);
+
+    cache_purge(c);
+    assert(atomic_load(&c->entry_count) == 0 && atomic_load(&c->current_size) == 0);
+    assert(!cache_lookup(c, keys[2]));
+    cache_destroy(c);
+    printf("S3-FIFO cache test passed\n");
+}
+
+static cache_key_t cache_test_key(const char *str) {
+    cache_key_t k;
+    cache_key_str(&k, str);
+    return k;
+}
+
+static void test_cache_slab() {
+    printf("Testing cache slab store...\n");
+
+    cache_slab_t *slab = cache_slab_open(NULL, 4 * CACHE_SLAB_PAGE);
+    assert(slab);
+    cache_t *c = cache_create("slab", 4 * CACHE_SLAB_PAGE, 2 * CACHE_SLAB_PAGE);
+    cache_set_slab(c, slab);
+    assert(c->max_object_size == CACHE_SLAB_PAGE);
+
+    char body[3000];
+    for (size_t i = 0; i < sizeof(body); i++)
+        body[i] = 'a' + i % 26;
+    cache_entry_t *e = cache_entry_new();
+    cache_key_t k = cache_test_key("/asset");
+    assert(cache_entry_set_data(c, e, &k, body, sizeof(body)) == 0);
+    assert(e->slab == slab && slab->stats.bytes_used == 4096);
+    assert(cache_insert(c, "/asset", e) == 0);
+
+    // A hit holds its chunk across eviction until the send is done
+    cache_entry_t *hit = cache_entry_get(cache_lookup(c, "/asset"));
+    cache_delete(c, "/asset");
+    assert(!cache_lookup(c, "/asset") && slab->stats.chunks_used == 1);
+
+    int sv[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    size_t off = 0;
+    while (off < hit->data.len)
+        assert(cache_entry_send(hit, sv[0], &off) > 0);
+    char got[sizeof(body)];
+    size_t n = 0;
+    while (n < sizeof(got)) {
+        ssize_t r = read(sv[1], got + n, sizeof(got) - n);
+        assert(r > 0);
+        n += r;
+    }
+    assert(memcmp(got, body, sizeof(body)) == 0);
+    close(sv[0]);
+    close(sv[1]);
+
+    cache_entry_put(hit);
+    assert(slab->stats.chunks_used == 0);
+
+    // Freed chunks are reused before a new page is carved
+    size_t carved = slab->next_page;
+    int64_t a = cache_slab_alloc(slab, 3000);
+    assert(a >= 0 && slab->next_page == carved);
+    cache_slab_free(slab, a, 3000);
+    assert(cache_slab_alloc(slab, CACHE_SLAB_PAGE + 1) < 0);
+
+    cache_destroy(c);
+    cache_slab_close(slab);
+    printf("Cache slab test passed\n");
+}
+
+static _Atomic int cache_woken;
+
+static void cache_test_wake(struct stream *s) {
+    (void)s;
+    cache_woken++;
+}
+
+static void test_cache_collapse() {
+    printf("Testing cache request collapsing...\n");
+
+    cache_t *c = cache_create("collapse", CACHE_SHARDS * 100000, 10000);
+    cache_set_waker(c, cache_test_wake);
+    stream_t s[6];
+    memset(s, 0, sizeof(s));
+    cache_key_t kx = cache_test_key("/x"), ky = cache_test_key("/y"), kz = cache_test_key("/z");
+
+    // One fetch, the others wait for it and get its response
+    assert(cache_serve(c, &s[0], &kx) == CACHE_FILL);
+    assert(cache_serve(c, &s[1], &kx) == CACHE_PARKED);
+    assert(cache_serve(c, &s[2], &kx) == CACHE_PARKED);
+    assert(atomic_load(&c->stats.collapsed) == 2);
+    cache_put(c, "/x");
+    cache_entry_t *e = cache_lookup(c, "/x");
+    cache_fill_finish(c, &s[0], e);
+    assert(cache_woken == 2 && s[1].cache_hit == e && s[2].cache_hit == e);
+    assert(!s[1].cache_parked && !c->shards[e->key_hash >> (32 - CACHE_SHARD_BITS)].pending);
+    assert(atomic_load(&e->refs) == 3);
+    cache_stream_done(c, &s[1]);
+    cache_stream_done(c, &s[2]);
+    assert(atomic_load(&e->refs) == 1);
+    assert(cache_serve(c, &s[1], &kx) == CACHE_HIT && s[1].cache_hit == e);
+    cache_stream_done(c, &s[1]);
+
+    // A fetch that ends without storing sends its waiters to the backend
+    assert(cache_serve(c, &s[0], &ky) == CACHE_FILL);
+    assert(cache_serve(c, &s[1], &ky) == CACHE_PARKED);
+    cache_stream_done(c, &s[0]);
+    assert(cache_woken == 3 && !s[1].cache_hit && !s[1].cache_parked);
+
+    // A waiter that goes away is not woken
+    assert(cache_serve(c, &s[0], &kz) == CACHE_FILL);
+    assert(cache_serve(c, &s[1], &kz) == CACHE_PARKED);
+    assert(cache_serve(c, &s[2], &kz) == CACHE_PARKED);
+    cache_stream_done(c, &s[2]);
+    cache_fill_finish(c, &s[0], NULL);
+    assert(cache_woken == 4);
+
+    // Stale entries are served while the first to see them refreshes
+    time_t now = lb_now_sec();
+    e->expires = now - 1;
+    e->stale_until = now + 60;
+    assert(!cache_lookup(c, "/x"));
+    assert(cache_serve(c, &s[3], &kx) == CACHE_HIT_REFRESH && s[3].cache_hit == e);
+    assert(cache_serve(c, &s[4], &kx) == CACHE_HIT && s[4].cache_hit == e);
+    assert(atomic_load(&c->stats.stale_hits) == 2);
+    cache_stream_done(c, &s[3]);
+    cache_stream_done(c, &s[4]);
+
+    // Past the stale window it is a plain miss
+    e->stale_until = now - 1;
+    assert(cache_serve(c, &s[5], &kx) == CACHE_FILL && !s[5].cache_hit);
+    cache_stream_done(c, &s[5]);
+
+    cache_destroy(c);
+    printf("Cache request collapsing test passed\n");
+}
+
+typedef struct {
+    cache_t *cache;
+    stream_t *s;
+    pthread_barrier_t *start, *done;
+    bool finish;
+} cache_race_arg_t;
+
+static void *cache_race_worker(void *arg) {
+    cache_race_arg_t *a = arg;
+    for (int i = 0; i < 2000; i++) {
+        pthread_barrier_wait(a->start);
+        if (a->finish)
+            cache_fill_finish(a->cache, a->s, NULL);
+        else
+            cache_stream_done(a->cache, a->s);
+        pthread_barrier_wait(a->done);
+    }
+    return NULL;
+}
+
+static void test_cache_collapse_race() {
+    printf("Testing parked stream cleanup against fill completion...\n");
+
+    cache_t *c = cache_create("race", CACHE_SHARDS * 100000, 10000);
+    cache_set_waker(c, cache_test_wake);
+    stream_t s[2];
+    memset(s, 0, sizeof(s));
+    cache_key_t k = cache_test_key("/race");
+
+    // The filler frees its fetch while the waiter leaves; whichever takes
+    // the shard lock first, the waiter must end up unlinked and the fetch gone
+    pthread_barrier_t start, done;
+    pthread_barrier_init(&start, NULL, 3);
+    pthread_barrier_init(&done, NULL, 3);
+    cache_race_arg_t args[2] = {
+        { c, &s[0], &start, &done, true },
+        { c, &s[1], &start, &done, false },
+    };
+    pthread_t t[2];
+    for (int i = 0; i < 2; i++)
+        pthread_create(&t[i], NULL, cache_race_worker, &args[i]);
+
+    int woken = cache_woken;
+    for (int i = 0; i < 2000; i++) {
+        assert(cache_serve(c, &s[0], &k) == CACHE_FILL);
+        assert(cache_serve(c, &s[1], &k) == CACHE_PARKED);
+        cache_shard_t *sh = s[0].cache_fill->shard;
+        assert(s[1].cache_parked_shard == sh);
+        pthread_barrier_wait(&start);
+        pthread_barrier_wait(&done);
+        assert(!s[0].cache_fill && !s[1].cache_parked && !s[1].cache_parked_shard);
+        assert(!sh->pending);
+    }
+    for (int i = 0; i < 2; i++)
+        pthread_join(t[i], NULL);
+    assert(cache_woken - woken <= 2000);
+
+    pthread_barrier_destroy(&start);
+    pthread_barrier_destroy(&done);
+    cache_destroy(c);
+    printf("Parked stream race test passed\n");
+}
+
+static void cache_test_req(http_txn_t *txn, struct buffer *buf, char *area, size_t size,
+                           const char *req) {
+    size_t len = strlen(req);
+    assert(len < size);
+    memcpy(area, req, len);
+    *buf = (struct buffer){ .area = area, .size = size, .data = len };
+    http_msg_reset(&txn->req);
+    assert(http_msg_analyzer(&txn->req, buf) >= 0 && txn->req.msg_state == HTTP_MSG_DONE);
+    txn->meth = txn->req.meth;
+    txn->uri = area + txn->req.uri.pos;
+    txn->uri_len = txn->req.uri.len;
+}
+
+static void test_cache_vary() {
+    printf("Testing cache keys and Vary...\n");
+
+    // Streaming the hash in pieces matches hashing the whole
+    uint64_t whole[2], parts[2];
+    lb_hash128_t st;
+    const char *text = "GET example.com /some/rather/long/path?with=query";
+    lb_hash128_init(&st, 1);
+    lb_hash128_update(&st, text, strlen(text));
+    lb_hash128_final(&st, whole);
+    lb_hash128_init(&st, 1);
+    for (size_t off = 0, n; off < strlen(text); off += n) {
+        n = strnlen(text + off, 3);
+        lb_hash128_update(&st, text + off, n);
+    }
+    lb_hash128_final(&st, parts);
+    assert(whole[0] == parts[0] && whole[1] == parts[1]);
+
+    http_txn_t *txn = calloc(3, sizeof(*txn));
+    struct buffer buf[3];
+    char area[3][512];
+    cache_test_req(&txn[0], &buf[0], area[0], sizeof(area[0]),
+                   "GET /img HTTP/1.1\r\nHost: example.com\r\nAccept-Encoding: gzip,br\r\n\r\n");
+    cache_test_req(&txn[1], &buf[1], area[1], sizeof(area[1]),
+                   "GET /img HTTP/1.1\r\nHost: example.com\r\nAccept-Encoding: identity\r\n\r\n");
+    cache_test_req(&txn[2], &buf[2], area[2], sizeof(area[2]),
+                   "GET /img HTTP/1.1\r\nHost: example.com\r\naccept-encoding:  GZIP, br\r\n\r\n");
+
+    cache_key_t k[3];
+    for (int i = 0; i < 3; i++)
+        assert(cache_key_build(&k[i], &txn[i], &buf[i]) == 0);
+    assert(k[0].hash[0] == k[1].hash[0] && k[0].hash[1] == k[2].hash[1]);
+    assert(k[0].len == strlen("GET example.com /img"));
+
+    // Normalized values: case and whitespace do not make a new variant
+    uint64_t v0 = cache_vary_hash("Accept-Encoding", &txn[0].req, &buf[0]);
+    assert(v0 == cache_vary_hash("accept-encoding", &txn[2].req, &buf[2]));
+    assert(v0 != cache_vary_hash("Accept-Encoding", &txn[1].req, &buf[1]));
+    assert(cache_vary_hash("X-None", &txn[0].req, &buf[0]) ==
+           cache_vary_hash("X-None", &txn[1].req, &buf[1]));
+
+    cache_t *c = cache_create("vary", CACHE_SHARDS * 100000, 10000);
+    static char body[100];
+    cache_entry_t *e[2];
+    for (int i = 0; i < 2; i++) {
+        e[i] = cache_entry_new();
+        assert(cache_entry_set_data(c, e[i], &k[i], body, sizeof(body)) == 0);
+        e[i]->vary = lb_strdup("Accept-Encoding");
+        e[i]->vary_hash = cache_vary_hash(e[i]->vary, &txn[i].req, &buf[i]);
+        assert(cache_insert_key(c, &k[i], e[i]) == 0);
+    }
+    assert(strcmp(e[0]->key, "GET example.com /img") == 0);
+    assert(atomic_load(&c->entry_count) == 2);
+
+    // Each request gets its own variant
+    stream_t s;
+    memset(&s, 0, sizeof(s));
+    assert(cache_serve(c, &s, &k[0]) == CACHE_HIT && s.cache_hit == e[0]);
+    assert(cache_serve(c, &s, &k[1]) == CACHE_HIT && s.cache_hit == e[1]);
+    assert(cache_serve(c, &s, &k[2]) == CACHE_HIT && s.cache_hit == e[0]);
+    cache_stream_done(c, &s);
+
+    // A by-name lookup takes any; deleting by name drops every variant
+    assert(cache_lookup(c, "GET example.com /img"));
+    assert(!cache_lookup(c, "GET example.com /im"));
+    cache_delete(c, "GET example.com /img");
+    assert(atomic_load(&c->entry_count) == 0);
+
+    cache_destroy(c);
+    for (int i = 0; i < 3; i++)
+        http_msg_release(&txn[i].req);
+    free(txn);
+    printf("Cache key and Vary test passed\n");
+}
+
+static bool cache_test_inflate(const cache_variant_t *v, const char *body, size_t len) {
+    const char *z = memmem(v->data.ptr, v->data.len, "\r\n\r\n", 4) + 4;
+    size_t zlen = v->data.ptr + v->data.len - z;
+    char *out = malloc(len + 1);
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    assert(inflateInit2(&zs, 15 + 16) == Z_OK);
+    zs.next_in = (Bytef *)z;
+    zs.avail_in = zlen;
+    zs.next_out = (Bytef *)out;
+    zs.avail_out = len + 1;
+    bool ok = inflate(&zs, Z_FINISH) == Z_STREAM_END && zs.total_out == len && !memcmp(out, body, len);
+    inflateEnd(&zs);
+    free(out);
+    return ok;
+}
+
+static bool cache_test_unbrotli(const cache_variant_t *v, const char *body, size_t len) {
+    const char *z = memmem(v->data.ptr, v->data.len, "\r\n\r\n", 4) + 4;
+    size_t zlen = v->data.ptr + v->data.len - z;
+    size_t n = len + 1;
+    char *out = malloc(n);
+    bool ok = BrotliDecoderDecompress(zlen, (const uint8_t *)z, &n, (uint8_t *)out) == BROTLI_DECODER_RESULT_SUCCESS &&
+              n == len && !memcmp(out, body, len);
+    free(out);
+    return ok;
+}
+
+static const cache_variant_t *cache_test_pick(cache_t *c, cache_entry_t *e, const char *ae) {
+    http_txn_t *txn = calloc(1, sizeof(*txn));
+    struct buffer buf;
+    char area[512];
+    char req[256];
+    snprintf(req, sizeof(req), "GET /page HTTP/1.1\r\nHost: example.com\r\n%s%s%s\r\n",
+             ae ? "Accept-Encoding: " : "", ae ? ae : "", ae ? "\r\n" : "");
+    cache_test_req(txn, &buf, area, sizeof(area), req);
+
+    cache_key_t k;
+    assert(cache_key_build(&k, txn, &buf) == 0);
+    stream_t s;
+    memset(&s, 0, sizeof(s));
+    assert(cache_serve(c, &s, &k) == CACHE_HIT && s.cache_hit == e);
+    const cache_variant_t *v = s.cache_variant;
+    cache_stream_done(c, &s);
+    http_msg_release(&txn->req);
+    free(txn);
+    return v;
+}
+
+static cache_entry_t *cache_test_page(cache_t *c, const char *key, const char *hdrs,
+                                      const char *body, size_t len) {
+    char *raw = malloc(strlen(hdrs) + len);
+    memcpy(raw, hdrs, strlen(hdrs));
+    memcpy(raw + strlen(hdrs), body, len);
+    cache_key_t k;
+    cache_key_str(&k, key);
+    cache_entry_t *e = cache_entry_new();
+    assert(cache_entry_set_data(c, e, &k, raw, strlen(hdrs) + len) == 0);
+    free(raw);
+    e->hdr_len = strlen(hdrs);
+    e->flags |= CACHE_F_NEGOTIATED;
+    return e;
+}
+
+static void test_cache_precompress() {
+    printf("Testing precompressed cache variants...\n");
+
+    size_t len = 0;
+    char body[6000];
+    while (len + 60 < sizeof(body))
+        len += snprintf(body + len, sizeof(body) - len, "<li class=\"item\">entry number %zu</li>\n", len);
+    char hdrs[256];
+    snprintf(hdrs, sizeof(hdrs), "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\n"
+             "Content-Length: %zu\r\nVary: accept-encoding\r\n\r\n", len);
+
+    cache_t *c = cache_create("comp", CACHE_SHARDS * 200000, 100000);
+    cache_entry_t *e = cache_test_page(c, "GET example.com /page", hdrs, body, len);
+    size_t identity = e->size;
+    assert(cache_entry_precompress(c, e, 6, 5) == 0);
+    const cache_variant_t *gz = atomic_load(&e->variants[CACHE_ENC_GZIP]);
+    const cache_variant_t *br = atomic_load(&e->variants[CACHE_ENC_BR]);
+    assert(gz && br && atomic_load(&c->stats.compressed) == 2);
+    assert(e->size == identity + gz->data.len + br->data.len);
+
+    // Framing follows the encoding; Vary is not repeated
+    char want[64];
+    size_t zlen = gz->data.ptr + gz->data.len - ((char *)memmem(gz->data.ptr, gz->data.len, "\r\n\r\n", 4) + 4);
+    snprintf(want, sizeof(want), "Content-Length: %zu\r\n", zlen);
+    assert(memmem(gz->data.ptr, gz->data.len, want, strlen(want)));
+    assert(memmem(gz->data.ptr, gz->data.len, "Content-Encoding: gzip\r\n", 24));
+    assert(!memmem(gz->data.ptr, gz->data.len, "Vary: Accept-Encoding", 21));
+    assert(memmem(br->data.ptr, br->data.len, "Content-Encoding: br\r\n", 22));
+    assert(cache_test_inflate(gz, body, len) && cache_test_unbrotli(br, body, len));
+
+    // Produced once: a second pass has nothing to do
+    assert(cache_entry_precompress(c, e, 9, 11) == 0 && atomic_load(&c->stats.compressed) == 2);
+
+    // Negotiation
+    assert(cache_insert(c, "GET example.com /page", e) == 0);
+    assert(cache_test_pick(c, e, "gzip, deflate, br") == br);
+    assert(cache_test_pick(c, e, "gzip") == gz);
+    assert(cache_test_pick(c, e, "br;q=0, gzip;q=0.5") == gz);
+    assert(cache_test_pick(c, e, "br;q=0.0") == NULL);
+    assert(cache_test_pick(c, e, "*") == br);
+    assert(cache_test_pick(c, e, "identity") == NULL);
+    assert(cache_test_pick(c, e, NULL) == NULL);
+    assert(atomic_load(&c->stats.comp_hits) == 4);
+    assert(atomic_load(&c->current_size) == e->size);
+
+    // The compressor thread does the same at its own pace
+    assert(cache_compressor_start(c) == 0);
+    cache_entry_t *e2 = cache_test_page(c, "GET example.com /bg", hdrs, body, len);
+    assert(cache_insert(c, "GET example.com /bg", e2) == 0);
+    assert(cache_compressor_queue(c, e2));
+    for (int i = 0; i < 5000 && atomic_load(&c->stats.compressed) < 4; i++)
+        usleep(1000);
+    assert(atomic_load(&e2->variants[CACHE_ENC_GZIP]) && atomic_load(&e2->variants[CACHE_ENC_BR]));
+    assert(cache_test_unbrotli(atomic_load(&e2->variants[CACHE_ENC_BR]), body, len));
+    cache_compressor_stop(c);
+    assert(!cache_compressor_queue(c, e2));
+
+    cache_destroy(c);
+    printf("Precompressed cache variants test passed\n");
+}
+
+static size_t comp_test_run(compression_ctx_t *ctx, const char *body, size_t len, char *out, size_t cap) {
+    struct buffer in = { (char *)body, len, len, 0 };
+    struct buffer ob = { out, cap, 0, 0 };
+    assert(compression_process(ctx, &in, &ob, 0) == 0);
+    assert(compression_process(ctx, &in, &ob, COMP_FINISH) == 1);
+    assert(in.data == 0);
+    return ob.data;
+}
+
+static void test_compression_pool() {
+    printf("Testing pooled compression encoders...\n");
+
+    char body[8192];
+    for (size_t i = 0; i < sizeof(body); i++)
+        body[i] = "the quick brown fox "[i % 20] + (i / 1000);
+    char out[16384], plain[sizeof(body)];
+    compression_adaptive = false;
+
+    // gzip: the second stream on this thread gets the first one's encoder,
+    // reset, and switched to another level
+    compression_ctx_t ctx;
+    assert(compression_init(&ctx, COMP_TYPE_GZIP, 6) == 0);
+    comp_engine_t *eng = ctx.eng;
+    comp_test_run(&ctx, body, sizeof(body), out, sizeof(out));
+    compression_end(&ctx);
+    assert(ctx.eng == NULL);
+
+    for (int level = 1; level <= 9; level += 8) {
+        assert(compression_init(&ctx, COMP_TYPE_GZIP, level) == 0);
+        assert(ctx.eng == eng && ctx.level == level);
+        size_t n = comp_test_run(&ctx, body, sizeof(body), out, sizeof(out));
+        compression_end(&ctx);
+
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        assert(inflateInit2(&zs, 15 + 16) == Z_OK);
+        zs.next_in = (Bytef *)out;
+        zs.avail_in = n;
+        zs.next_out = (Bytef *)plain;
+        zs.avail_out = sizeof(plain);
+        assert(inflate(&zs, Z_FINISH) == Z_STREAM_END && zs.total_out == sizeof(body));
+        assert(!memcmp(plain, body, sizeof(body)));
+        inflateEnd(&zs);
+    }
+
+    // deflate streams have their own pool
+    assert(compression_init(&ctx, COMP_TYPE_DEFLATE, 6) == 0);
+    assert(ctx.eng != eng);
+    compression_end(&ctx);
+
+    // brotli: a new encoder each time, built from recycled blocks
+    for (int i = 0; i < 2; i++) {
+        assert(compression_init(&ctx, COMP_TYPE_BROTLI, 5) == 0);
+        size_t n = comp_test_run(&ctx, body, sizeof(body), out, sizeof(out));
+        compression_end(&ctx);
+        size_t plen = sizeof(plain);
+        assert(BrotliDecoderDecompress(n, (const uint8_t *)out, &plen, (uint8_t *)plain) ==
+               BROTLI_DECODER_RESULT_SUCCESS);
+        assert(plen == sizeof(body) && !memcmp(plain, body, sizeof(body)));
+    }
+
+    assert(compression_init(&ctx, COMP_TYPE_NONE, 6) < 0);
+
+    // Levels back off between the low and high load marks
+    assert(compression_scale_level(9, 0) == 9);
+    assert(compression_scale_level(9, COMP_LOAD_LOW) == 9);
+    assert(compression_scale_level(9, (COMP_LOAD_LOW + COMP_LOAD_HIGH) / 2) == 6);
+    assert(compression_scale_level(9, COMP_LOAD_HIGH) == 1);
+    assert(compression_scale_level(11, 100) == 1);
+    assert(compression_scale_level(1, 100) == 1);
+    assert(compression_thread_load() <= 100);
+
+    compression_adaptive = true;
+    compression_pool_flush();
+    printf("Pooled compression encoder test passed\n");
+}
+
+static void test_health_checks() {
     printf("Testing health checks...\n");
 
     check_t *check = check_new(HCHK_TYPE_TCP);
@@ -70,34 +645,243 @@ void test_health_checks() {
     printf("Health check test passed\n");
 }
 
-void test_compression() {
+static int health_wait_state(backend_t *b, backend_state_t state) {
+    for (int i = 0; i < 300 && atomic_load(&b->state) != state; i++) usleep(10000);
+    return atomic_load(&b->state) == state;
+}
+
+static void test_health_state() {
+    printf("Testing health check state machine...\n");
+
+    loadbalancer_t *lb = lb_create(0, LB_ALGO_ROUNDROBIN);
+    assert(lb != NULL);
+    lb->config.slow_start_ms = 10000;
+    assert(lb_add_backend(lb, "127.0.0.1", 9, 1) == 0);
+    backend_t *b = lb->backends[0];
+
+    // Failures on a backend that is already down only count
+    assert(!lb_health_report(lb, b, false, 0, "test"));
+    assert(atomic_load(&b->failed_conns) == 1);
+
+    // One pass brings it up; the first UP is not a recovery
+    assert(lb_health_report(lb, b, true, 3000000, NULL));
+    assert(atomic_load(&b->state) == BACKEND_UP && lb_backend_slot_up(lb, 0));
+    assert(atomic_load(&b->failed_conns) == 0);
+    assert(atomic_load(&b->check_rtt_ns) == 3000000);
+    assert(atomic_load(&lb->view.warming[0]) == 0);
+    assert(!lb_health_report(lb, b, true, 1000000, NULL));
+
+    // Down only after health_check_fail_threshold failures in a row
+    assert(!lb_health_report(lb, b, false, 0, "test"));
+    assert(!lb_health_report(lb, b, false, 0, "test"));
+    assert(atomic_load(&b->failed_conns) == 2);
+    assert(!lb_health_report(lb, b, true, 1000000, NULL));
+    assert(atomic_load(&b->failed_conns) == 0);
+    for (uint32_t i = 1; i < lb->config.health_check_fail_threshold; i++) {
+        assert(!lb_health_report(lb, b, false, 0, "test"));
+        assert(lb_backend_slot_up(lb, 0));
+    }
+    assert(lb_health_report(lb, b, false, 0, "test"));
+    assert(atomic_load(&b->state) == BACKEND_DOWN && !lb_backend_slot_up(lb, 0));
+    assert(!lb_health_report(lb, b, false, 0, "test"));
+
+    // Coming back is a recovery, so it starts warming
+    assert(lb_health_report(lb, b, true, 1000000, NULL));
+    assert(lb_backend_slot_up(lb, 0));
+    assert(atomic_load(&lb->view.warming[0]) == 1);
+    lb_destroy(lb);
+
+    // The probe engine against a real listener: up while it accepts,
+    // down once connects are refused
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t len = sizeof(addr);
+    assert(bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    assert(listen(lfd, 64) == 0);
+    assert(getsockname(lfd, (struct sockaddr *)&addr, &len) == 0);
+
+    lb = lb_create(0, LB_ALGO_ROUNDROBIN);
+    assert(lb != NULL);
+    lb->config.health_check_type = HCHK_TYPE_TCP;
+    lb->config.health_check_interval_ms = 20;
+    lb->config.health_check_timeout_ms = 500;
+    assert(lb_add_backend(lb, "127.0.0.1", ntohs(addr.sin_port), 1) == 0);
+    b = lb->backends[0];
+
+    lb->running = true;
+    pthread_t tid;
+    assert(pthread_create(&tid, NULL, health_check_thread, lb) == 0);
+    assert(health_wait_state(b, BACKEND_UP));
+    assert(atomic_load(&b->check_rtt_ns) > 0);
+
+    close(lfd);
+    assert(health_wait_state(b, BACKEND_DOWN));
+    assert(atomic_load(&b->failed_conns) >= lb->config.health_check_fail_threshold);
+
+    lb->running = false;
+    pthread_join(tid, NULL);
+    lb_destroy(lb);
+    printf("Health check state machine test passed\n");
+}
+
+static void test_outlier() {
+    printf("Testing passive outlier detection...\n");
+
+    loadbalancer_t *lb = calloc(1, sizeof(*lb));
+    assert(lb != NULL);
+    lb->algorithm = LB_ALGO_ROUNDROBIN;
+    lb->config.outlier_consecutive = 3;
+    lb->config.outlier_error_pct = 50;
+    lb->config.outlier_min_requests = 10;
+    lb->config.outlier_window_ms = 10000;
+    lb->config.outlier_ejection_ms = 1000;
+    lb->config.outlier_max_ejection_ms = 60000;
+    lb->config.outlier_max_pct = 50;
+    for (int i = 0; i < 4; i++) {
+        char host[32];
+        snprintf(host, sizeof(host), "10.0.1.%d", i);
+        assert(lb_add_backend(lb, host, 80, 1) == 0);
+        lb_backend_set_state(lb, lb->backends[i], BACKEND_UP);
+    }
+    backend_t *bad = lb->backends[1];
+
+    // A success in between resets the run
+    lb_outlier_report(lb, bad, LB_OUTCOME_CONNECT_FAIL);
+    lb_outlier_report(lb, bad, LB_OUTCOME_CONNECT_FAIL);
+    lb_outlier_report(lb, bad, LB_OUTCOME_OK);
+    lb_outlier_report(lb, bad, LB_OUTCOME_CONNECT_FAIL);
+    assert(lb_backend_slot_up(lb, 1));
+
+    lb_outlier_report(lb, bad, LB_OUTCOME_RESET);
+    lb_outlier_report(lb, bad, LB_OUTCOME_RESET);
+    assert(!lb_backend_slot_up(lb, 1));
+    for (int i = 0; i < 8; i++) assert(lb_select_backend(lb, NULL) != bad);
+
+    // Health checks alone do not bring it back early
+    lb_backend_set_state(lb, bad, BACKEND_UP);
+    assert(!lb_backend_slot_up(lb, 1));
+
+    uint64_t until = atomic_load(&bad->ejected_until_ns);
+    lb_outlier_sweep(lb, until - 1);
+    assert(!lb_backend_slot_up(lb, 1));
+    lb_outlier_sweep(lb, until);
+    assert(lb_backend_slot_up(lb, 1));
+
+    // Ejected again: twice as long
+    for (int i = 0; i < 3; i++) lb_outlier_report(lb, bad, LB_OUTCOME_CONNECT_FAIL);
+    uint64_t now = get_time_ns();
+    uint64_t again = atomic_load(&bad->ejected_until_ns);
+    assert(again - now > 1900000000ULL && again - now <= 2000000000ULL);
+
+    // 5xx share, and at most half of the backends out at once
+    backend_t *flaky = lb->backends[2];
+    for (int i = 0; i < 10; i++) {
+        lb_outlier_report(lb, flaky, i % 2 ? LB_OUTCOME_5XX : LB_OUTCOME_OK);
+    }
+    assert(!lb_backend_slot_up(lb, 2));
+    for (int i = 0; i < 3; i++) lb_outlier_report(lb, lb->backends[3], LB_OUTCOME_CONNECT_FAIL);
+    assert(lb_backend_slot_up(lb, 3));
+    assert(atomic_load(&lb->outlier_ejected) == 2);
+
+    for (int i = 0; i < 4; i++) free(lb->backends[i]);
+    free(lb);
+    printf("Passive outlier detection test passed\n");
+}
+
+static void test_shared_state() {
+    printf("Testing shared health state...\n");
+
+    char name[64];
+    snprintf(name, sizeof(name), "/ub-test-%d", (int)getpid());
+
+    // Same backends, listed in a different order
+    loadbalancer_t *a = calloc(1, sizeof(*a)), *b = calloc(1, sizeof(*b));
+    assert(a != NULL && b != NULL);
+    assert(lb_add_backend(a, "10.0.2.1", 80, 1) == 0);
+    assert(lb_add_backend(a, "10.0.2.2", 80, 1) == 0);
+    assert(lb_add_backend(b, "10.0.2.2", 80, 1) == 0);
+    assert(lb_add_backend(b, "10.0.2.1", 80, 1) == 0);
+    for (int i = 0; i < 2; i++) {
+        lb_backend_set_state(a, a->backends[i], BACKEND_UP);
+        lb_backend_set_state(b, b->backends[i], BACKEND_UP);
+    }
+
+    lb_shm_t *leader = lb_shm_open(name), *follower = lb_shm_open(name);
+    assert(leader != NULL && follower != NULL);
+    assert(lb_shm_try_lead(leader));
+    assert(!lb_shm_try_lead(follower));
+
+    // Nothing published yet: the follower has to probe itself
+    assert(lb_shm_follow(follower, b, LB_SHM_STALE_MS) == -1);
+
+    lb_backend_set_state(a, a->backends[1], BACKEND_DOWN);
+    lb_backend_observe_latency(a->backends[0], 3000000, get_time_ns());
+    lb_shm_publish(leader, a);
+    assert(lb_shm_follow(follower, b, LB_SHM_STALE_MS) == 1);
+    assert(atomic_load(&b->backends[0]->state) == BACKEND_DOWN);
+    assert(!lb_backend_slot_up(b, 0));
+    assert(atomic_load(&b->backends[1]->state) == BACKEND_UP);
+    assert(atomic_load(&b->backends[1]->ewma_cost_ns) == 3000000);
+
+    // Unchanged on the next round
+    lb_shm_publish(leader, a);
+    assert(lb_shm_follow(follower, b, LB_SHM_STALE_MS) == 0);
+
+    // The lock goes with the leader
+    lb_shm_close(leader);
+    assert(lb_shm_try_lead(follower));
+    lb_shm_close(follower);
+    shm_unlink(name);
+
+    for (int i = 0; i < 2; i++) {
+        free(a->backends[i]);
+        free(b->backends[i]);
+    }
+    free(a);
+    free(b);
+    printf("Shared health state test passed\n");
+}
+
+static void test_compression() {
     printf("Testing compression...\n");
 
     compression_ctx_t ctx;
     int ret = compression_init(&ctx, COMP_TYPE_GZIP, 6);
     assert(ret == 0);
 
-    const char *input = "This is a test string to compress. It should be compressed well.";
-    struct buffer in_buf = { .p = (char*)input, .i = strlen(input), .size = 1024 };
-    struct buffer out_buf = { .p = malloc(1024), .i = 0, .size = 1024 };
+    const char *input = "This is a test string to compress. It should be compressed well. "
+                        "This is a test string to compress. It should be compressed well.";
+    struct buffer in_buf = { .area = (char*)input, .size = strlen(input), .data = strlen(input) };
+    struct buffer out_buf = { .area = malloc(1024), .size = 1024, .data = 0 };
 
     ret = compression_process(&ctx, &in_buf, &out_buf, COMP_FINISH);
-    assert(out_buf.i > 0);
-    assert(out_buf.i < strlen(input));  // Should be compressed
+    assert(ret == 1);
+    assert(out_buf.data > 0);
+    assert(out_buf.data < strlen(input));  // Should be compressed
 
     compression_end(&ctx);
-    free(out_buf.p);
+    free(out_buf.area);
     printf("Compression test passed\n");
 }
 
 int main() {
     printf("Running UltraBalancer unit tests...\n\n");
 
-    test_stick_tables();
+    test_clock();
     test_cache();
+    test_cache_s3fifo();
+    test_cache_slab();
+    test_cache_collapse();
+    test_cache_collapse_race();
+    test_cache_vary();
+    test_cache_precompress();
+    test_compression_pool();
     test_health_checks();
+    test_health_state();
+    test_outlier();
+    test_shared_state();
     test_compression();
 
     printf("\nAll tests passed!\n");
     return 0;
-}
\ No newline at end of file
+}
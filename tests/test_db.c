@@ -0,0 +1,503 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../include/database/db_pool.h"
+#include "../include/database/db_router.h"
+#include "../include/database/db_health.h"
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <openssl/evp.h>
+
+static uint64_t db_test_stat(db_pool_t *pool, const char *name) {
+    char buf[1024], key[64];
+    assert(db_pool_get_stats(pool, buf, sizeof(buf)) > 0);
+    snprintf(key, sizeof(key), "\"%s\":", name);
+    char *p = strstr(buf, key);
+    assert(p);
+    return strtoull(p + strlen(key), NULL, 10);
+}
+
+typedef struct {
+    db_pool_t *pool;
+    int failures;
+} db_test_worker_t;
+
+static void *db_test_worker(void *arg) {
+    db_test_worker_t *w = arg;
+    for (int i = 0; i < 5000; i++) {
+        db_connection_t *c = db_pool_acquire(w->pool, DB_QUERY_WRITE, false, 0);
+        if (!c) {
+            w->failures++;
+            continue;
+        }
+        db_pool_release(w->pool, c);
+    }
+    return NULL;
+}
+
+static void test_db_pool() {
+    printf("Testing database pool idle stacks...\n");
+
+    // The listen backlog completes connects; nothing needs to accept
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in sa = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t salen = sizeof(sa);
+    assert(bind(lfd, (struct sockaddr *)&sa, sizeof(sa)) == 0 && listen(lfd, 64) == 0);
+    assert(getsockname(lfd, (struct sockaddr *)&sa, &salen) == 0);
+
+    db_pool_t *pool = db_pool_create(4, 0, 2);
+    assert(db_pool_add_backend(pool, "127.0.0.1", ntohs(sa.sin_port),
+                               DB_BACKEND_PRIMARY, DB_PROTOCOL_POSTGRESQL) == 0);
+
+    // A released connection is handed out again, fd and all
+    db_connection_t *c = db_pool_acquire(pool, DB_QUERY_WRITE, false, 0);
+    assert(c && c->fd >= 0 && c->backend_role == DB_BACKEND_PRIMARY);
+    int fd = c->fd;
+    assert(fcntl(fd, F_GETFD) >= 0);
+    db_pool_release(pool, c);
+    c = db_pool_acquire(pool, DB_QUERY_WRITE, false, 1);
+    assert(c && c->fd == fd);
+    assert(db_test_stat(pool, "total_created") == 1);
+    db_pool_release(pool, c);
+
+    // max_connections bounds what is out; only max_idle come back
+    db_connection_t *held[5];
+    for (int i = 0; i < 4; i++)
+        assert((held[i] = db_pool_acquire(pool, DB_QUERY_WRITE, false, 0)));
+    assert(!db_pool_acquire(pool, DB_QUERY_WRITE, false, 0));
+    assert(!db_pool_acquire(pool, DB_QUERY_WRITE, false, 7));
+    for (int i = 0; i < 4; i++)
+        db_pool_release(pool, held[i]);
+    assert(db_test_stat(pool, "total_connections") == 2);
+    assert(db_test_stat(pool, "idle_connections") == 2);
+    db_pool_destroy(pool);
+
+    // Workers racing on one backend's stack never overshoot the limit
+    pool = db_pool_create(4, 0, 4);
+    assert(db_pool_add_backend(pool, "127.0.0.1", ntohs(sa.sin_port),
+                               DB_BACKEND_PRIMARY, DB_PROTOCOL_POSTGRESQL) == 0);
+    db_test_worker_t workers[4];
+    pthread_t th[4];
+    for (int i = 0; i < 4; i++) {
+        workers[i] = (db_test_worker_t){ .pool = pool };
+        pthread_create(&th[i], NULL, db_test_worker, &workers[i]);
+    }
+    for (int i = 0; i < 4; i++) {
+        pthread_join(th[i], NULL);
+        assert(workers[i].failures == 0);
+    }
+    assert(db_test_stat(pool, "total_created") <= 4);
+    assert(db_test_stat(pool, "total_acquired") == 4 * 5000);
+    assert(db_test_stat(pool, "total_connections") == db_test_stat(pool, "idle_connections"));
+    db_pool_destroy(pool);
+    close(lfd);
+
+    printf("Database pool test passed\n");
+}
+
+static void db_test_route(db_router_t *router, db_pool_t *pool, const char *cmd, uint64_t id) {
+    db_connection_t *c = db_router_route_query(router, (const uint8_t *)cmd, strlen(cmd), id);
+    assert(c);
+    db_pool_release(pool, c);
+}
+
+static void test_db_router() {
+    printf("Testing database router session table...\n");
+
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in sa = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t salen = sizeof(sa);
+    assert(bind(lfd, (struct sockaddr *)&sa, sizeof(sa)) == 0 && listen(lfd, 64) == 0);
+    assert(getsockname(lfd, (struct sockaddr *)&sa, &salen) == 0);
+
+    db_pool_t *pool = db_pool_create(8, 0, 8);
+    assert(db_pool_add_backend(pool, "127.0.0.1", ntohs(sa.sin_port),
+                               DB_BACKEND_PRIMARY, DB_PROTOCOL_REDIS) == 0);
+    db_router_t *router = db_router_create(pool, 32);
+    assert(router);
+
+    const char *multi = "*1\r\n$5\r\nMULTI\r\n";
+    const char *exec = "*1\r\n$4\r\nEXEC\r\n";
+    const char *get = "*2\r\n$3\r\nGET\r\n$1\r\nk\r\n";
+
+    // A transaction pins its session to the backend it got
+    db_test_route(router, pool, multi, 42);
+    char buf[8192];
+    assert(db_router_get_stats(router, buf, sizeof(buf)) > 0);
+    assert(strstr(buf, "\"session_count\":1,"));
+    assert(strstr(buf, "{\"session_id\":42,\"backend_id\":1,\"in_transaction\":true}"));
+
+    // Thousands of idle sessions churn through the table; the open
+    // transaction is never the one evicted
+    for (uint64_t id = 1000; id < 6000; id++) {
+        db_test_route(router, pool, multi, id);
+        db_test_route(router, pool, exec, id);
+    }
+    db_test_route(router, pool, get, 42);
+    assert(db_router_get_stats(router, buf, sizeof(buf)) > 0);
+    assert(strstr(buf, "\"session_count\":32,"));
+    assert(strstr(buf, "{\"session_id\":42,\"backend_id\":1,\"in_transaction\":true}"));
+    // The most recent sessions survived, the oldest are gone
+    assert(strstr(buf, "\"session_id\":5999,"));
+    assert(!strstr(buf, "\"session_id\":1000,"));
+
+    db_test_route(router, pool, exec, 42);
+    db_router_end_session(router, 42);
+    db_router_end_session(router, 5999);
+    assert(db_router_get_stats(router, buf, sizeof(buf)) > 0);
+    assert(strstr(buf, "\"session_count\":30,"));
+    assert(!strstr(buf, "\"session_id\":42,"));
+
+    // Stats fit whatever buffer they get
+    assert(db_router_get_stats(router, buf, 16) == 15);
+
+    db_router_destroy(router);
+    db_pool_destroy(pool);
+    close(lfd);
+    printf("Database router test passed\n");
+}
+
+// A PostgreSQL stand-in: answers every simple query with CommandComplete
+// and ReadyForQuery, and logs which backend connection ran what. A SELECT
+// also gets one row: lag_ms for the lag probe's query, else 0. A startup
+// message is answered with AuthenticationOk, or asks for the MD5 password
+// when md5 is set.
+typedef struct {
+    int lfd;
+    _Atomic bool stop;
+    int conns;
+    char log[256][64];
+    int log_conn[256];
+    _Atomic int logged;
+    const char *md5;
+    _Atomic int lag_ms;
+    _Atomic int auth_failures;
+} pg_test_server_t;
+
+static void pg_test_send(int fd, char type, const void *body, uint32_t len) {
+    uint8_t hdr[5] = { type, (len + 4) >> 24, (len + 4) >> 16, (len + 4) >> 8, len + 4 };
+    assert(send(fd, hdr, 5, MSG_NOSIGNAL) == 5);
+    if (len)
+        assert(send(fd, body, len, MSG_NOSIGNAL) == (ssize_t)len);
+}
+
+// false once the client is gone
+static bool pg_test_serve(pg_test_server_t *srv, int fd, int conn) {
+    uint8_t first;
+    if (recv(fd, &first, 1, MSG_PEEK) != 1) {
+        return false;
+    }
+
+    uint8_t hdr[5];
+    char q[512] = {0};
+    if (first == 0) {
+        // Startup: length, protocol, parameters
+        assert(recv(fd, hdr, 4, MSG_WAITALL) == 4);
+        uint32_t len = ((uint32_t)hdr[0] << 24) | (hdr[1] << 16) | (hdr[2] << 8) | hdr[3];
+        assert(len - 4 <= sizeof(q) && recv(fd, q, len - 4, MSG_WAITALL) == (ssize_t)(len - 4));
+        if (srv->md5) {
+            uint8_t req[8] = { 0, 0, 0, 5, 1, 2, 3, 4 };
+            pg_test_send(fd, 'R', req, 8);
+            return true;
+        }
+        pg_test_send(fd, 'R', (uint8_t[4]){ 0 }, 4);
+        pg_test_send(fd, 'Z', "I", 1);
+        return true;
+    }
+
+    if (recv(fd, hdr, 5, MSG_WAITALL) != 5) {
+        return false;
+    }
+    uint32_t len = ((uint32_t)hdr[1] << 24) | (hdr[2] << 16) | (hdr[3] << 8) | hdr[4];
+    assert(len - 4 <= sizeof(q));
+    assert(recv(fd, q, len - 4, MSG_WAITALL) == (ssize_t)(len - 4));
+
+    if (hdr[0] == 'p') {
+        if (srv->md5 && !strcmp(q, srv->md5)) {
+            pg_test_send(fd, 'R', (uint8_t[4]){ 0 }, 4);
+            pg_test_send(fd, 'Z', "I", 1);
+        } else {
+            atomic_fetch_add(&srv->auth_failures, 1);
+            pg_test_send(fd, 'E', "SFATAL\0\0", 9);
+        }
+        return true;
+    }
+    assert(hdr[0] == 'Q');
+
+    int at = atomic_load(&srv->logged);
+    if (at < 256) {
+        snprintf(srv->log[at], sizeof(srv->log[at]), "%s", q);
+        srv->log_conn[at] = conn;
+        atomic_store(&srv->logged, at + 1);
+    }
+    if (!strncmp(q, "SELECT", 6)) {
+        char v[16];
+        int vlen = snprintf(v, sizeof(v), "%d", !strncmp(q, "SELECT CASE", 11) ?
+                            atomic_load(&srv->lag_ms) : 0);
+        uint8_t row[32] = { 0, 1, 0, 0, 0, vlen };
+        memcpy(row + 6, v, vlen);
+        pg_test_send(fd, 'D', row, 6 + vlen);
+    }
+    pg_test_send(fd, 'C', "SELECT 1", 9);
+    pg_test_send(fd, 'Z', "I", 1);
+    return true;
+}
+
+static void *pg_test_server(void *arg) {
+    pg_test_server_t *srv = arg;
+    struct pollfd pfd[9] = { { .fd = srv->lfd, .events = POLLIN } };
+    int n = 1;
+
+    while (!atomic_load(&srv->stop)) {
+        if (poll(pfd, n, 20) <= 0) continue;
+        if ((pfd[0].revents & POLLIN) && n < 9) {
+            pfd[n] = (struct pollfd){ .fd = accept(srv->lfd, NULL, NULL), .events = POLLIN };
+            n++;
+            srv->conns++;
+        }
+        for (int i = 1; i < n; i++) {
+            if (!(pfd[i].revents & (POLLIN | POLLHUP)) || pfd[i].fd < 0) continue;
+            if (!pg_test_serve(srv, pfd[i].fd, i)) {
+                close(pfd[i].fd);
+                pfd[i].fd = -1;
+            }
+        }
+    }
+    for (int i = 1; i < n; i++)
+        if (pfd[i].fd >= 0) close(pfd[i].fd);
+    return NULL;
+}
+
+// One statement as a client of the router would run it
+static bool pg_test_query(db_router_t *router, uint64_t session, const char *sql, bool release) {
+    uint8_t msg[256];
+    uint32_t len = strlen(sql) + 5;
+    msg[0] = 'Q';
+    msg[1] = len >> 24; msg[2] = len >> 16; msg[3] = len >> 8; msg[4] = len;
+    memcpy(msg + 5, sql, strlen(sql) + 1);
+
+    db_connection_t *c = db_router_route_query(router, msg, len + 1, session);
+    if (!c) return false;
+    assert(db_protocol_run_query(c->fd, c->protocol, sql, strlen(sql), 1000) == 0);
+    if (release)
+        db_router_release(router, session, c);
+    return true;
+}
+
+static void test_db_transaction_pooling() {
+    printf("Testing transaction pooling...\n");
+
+    pg_test_server_t srv = {0};
+    srv.lfd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in sa = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t salen = sizeof(sa);
+    assert(bind(srv.lfd, (struct sockaddr *)&sa, sizeof(sa)) == 0 && listen(srv.lfd, 16) == 0);
+    assert(getsockname(srv.lfd, (struct sockaddr *)&sa, &salen) == 0);
+    pthread_t th;
+    pthread_create(&th, NULL, pg_test_server, &srv);
+
+    // Prepared statement syntax is recognized, names folded and quoted
+    const char *name;
+    size_t name_len;
+    assert(db_protocol_parse_prepared(" prepare S1 AS SELECT 1", 23, &name, &name_len) == DB_PREPARED_PREPARE &&
+           name_len == 2 && !memcmp(name, "S1", 2));
+    assert(db_protocol_parse_prepared("EXECUTE \"Q\"(1)", 14, &name, &name_len) == DB_PREPARED_EXECUTE &&
+           name_len == 3);
+    assert(db_protocol_parse_prepared("DEALLOCATE PREPARE ALL", 22, &name, &name_len) == DB_PREPARED_DEALLOCATE &&
+           name_len == 0);
+    assert(db_protocol_parse_prepared("PREPAREX s", 10, &name, &name_len) == DB_PREPARED_NONE);
+
+    db_pool_t *pool = db_pool_create(2, 0, 2);
+    assert(db_pool_add_backend(pool, "127.0.0.1", ntohs(sa.sin_port),
+                               DB_BACKEND_PRIMARY, DB_PROTOCOL_POSTGRESQL) == 0);
+    db_router_t *router = db_router_create(pool, 64);
+    db_router_set_mode(router, DB_ROUTER_TRANSACTION);
+
+    // Many clients, one statement or transaction at a time: one connection
+    for (uint64_t id = 1; id <= 20; id++) {
+        assert(pg_test_query(router, id, "BEGIN", true));
+        assert(pg_test_query(router, id, "SELECT 1", true));
+        assert(pg_test_query(router, id, "COMMIT", true));
+        assert(pg_test_query(router, id, "SELECT 1", true));
+    }
+    assert(db_test_stat(pool, "total_created") == 1);
+
+    // Session 1 prepares; session 2's transaction then holds that
+    // connection, so session 1's EXECUTE lands on a fresh one
+    assert(pg_test_query(router, 1, "PREPARE s1 AS SELECT 1", true));
+    assert(pg_test_query(router, 2, "BEGIN", true));
+    int before = atomic_load(&srv.logged);
+    assert(pg_test_query(router, 1, "EXECUTE s1", true));
+    assert(db_test_stat(pool, "total_created") == 2);
+    assert(atomic_load(&srv.logged) == before + 2);
+    assert(!strcmp(srv.log[before], "PREPARE s1 AS SELECT 1"));
+    assert(!strcmp(srv.log[before + 1], "EXECUTE s1"));
+    assert(srv.log_conn[before] == 2 && srv.log_conn[before + 1] == 2);
+
+    // Both connections have it now: no more round trips
+    assert(pg_test_query(router, 2, "COMMIT", true));
+    before = atomic_load(&srv.logged);
+    assert(pg_test_query(router, 1, "EXECUTE s1", true));
+    assert(pg_test_query(router, 1, "execute S1", true));
+    assert(atomic_load(&srv.logged) == before + 2);
+
+    // Redefined under the same name: the old one goes first
+    assert(pg_test_query(router, 3, "PREPARE s1 AS SELECT 2", true));
+    assert(pg_test_query(router, 4, "BEGIN", true));
+    before = atomic_load(&srv.logged);
+    assert(pg_test_query(router, 3, "EXECUTE s1", true));
+    assert(atomic_load(&srv.logged) == before + 3);
+    assert(!strcmp(srv.log[before], "DEALLOCATE s1"));
+    assert(pg_test_query(router, 4, "COMMIT", true));
+
+    char buf[8192];
+    assert(db_router_get_stats(router, buf, sizeof(buf)) > 0);
+    assert(strstr(buf, "\"mode\":\"transaction\""));
+    assert(strstr(buf, "\"reprepares\":2,"));
+
+    // SET keeps its connection; with the other one in a transaction the
+    // pool is dry until the session ends
+    assert(pg_test_query(router, 5, "SET search_path TO app", true));
+    assert(pg_test_query(router, 6, "BEGIN", true));
+    assert(!pg_test_query(router, 7, "SELECT 1", true));
+    assert(pg_test_query(router, 5, "SELECT 1", true));
+    db_router_end_session(router, 5);
+    assert(pg_test_query(router, 7, "SELECT 1", true));
+    assert(pg_test_query(router, 6, "COMMIT", true));
+    assert(db_test_stat(pool, "total_created") == 2);
+
+    db_router_destroy(router);
+    db_pool_destroy(pool);
+    atomic_store(&srv.stop, true);
+    pthread_join(th, NULL);
+    close(srv.lfd);
+    printf("Transaction pooling test passed\n");
+}
+
+static uint64_t db_test_read_backend(db_pool_t *pool) {
+    db_backend_t *b = db_pool_select_backend(pool, DB_QUERY_READ);
+    assert(b);
+    uint64_t id = b->id;
+    free(b);
+    return id;
+}
+
+// id 0 for any replica
+static bool db_test_wait_read_backend(db_pool_t *pool, uint64_t id) {
+    for (int i = 0; i < 300; i++) {
+        uint64_t got = db_test_read_backend(pool);
+        if (id ? got == id : got != 1) return true;
+        usleep(10000);
+    }
+    return false;
+}
+
+static db_backend_role_t db_test_route_role(db_router_t *router, db_pool_t *pool,
+                                            const char *sql, uint64_t session) {
+    uint8_t msg[128];
+    uint32_t len = strlen(sql) + 5;
+    msg[0] = 'Q';
+    msg[1] = len >> 24; msg[2] = len >> 16; msg[3] = len >> 8; msg[4] = len;
+    memcpy(msg + 5, sql, strlen(sql) + 1);
+    db_connection_t *c = db_router_route_query(router, msg, len + 1, session);
+    assert(c);
+    db_backend_role_t role = c->backend_role;
+    db_pool_release(pool, c);
+    return role;
+}
+
+static void test_db_replica_routing() {
+    printf("Testing replication lag probes and read routing...\n");
+
+    pg_test_server_t srv = {0};
+    srv.lfd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in sa = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t salen = sizeof(sa);
+    assert(bind(srv.lfd, (struct sockaddr *)&sa, sizeof(sa)) == 0 && listen(srv.lfd, 16) == 0);
+    assert(getsockname(srv.lfd, (struct sockaddr *)&sa, &salen) == 0);
+    uint16_t port = ntohs(sa.sin_port);
+
+    // "md5" + md5hex(md5hex(password + user) + salt)
+    uint8_t d[EVP_MAX_MD_SIZE];
+    char hex[33], md5[36];
+    assert(EVP_Digest("secretprobe", 11, d, NULL, EVP_md5(), NULL));
+    for (int i = 0; i < 16; i++) snprintf(hex + 2 * i, 3, "%02x", d[i]);
+    uint8_t salted[36];
+    memcpy(salted, hex, 32);
+    memcpy(salted + 32, (uint8_t[4]){ 1, 2, 3, 4 }, 4);
+    assert(EVP_Digest(salted, 36, d, NULL, EVP_md5(), NULL));
+    memcpy(md5, "md5", 3);
+    for (int i = 0; i < 16; i++) snprintf(md5 + 3 + 2 * i, 3, "%02x", d[i]);
+    srv.md5 = md5;
+    atomic_store(&srv.lag_ms, 1500);
+    pthread_t th;
+    pthread_create(&th, NULL, pg_test_server, &srv);
+
+    db_pool_t *pool = db_pool_create(16, 0, 8);
+    assert(db_pool_add_backend(pool, "127.0.0.1", port, DB_BACKEND_PRIMARY, DB_PROTOCOL_POSTGRESQL) == 0);
+    assert(db_pool_add_backend(pool, "127.0.0.1", port, DB_BACKEND_REPLICA, DB_PROTOCOL_POSTGRESQL) == 0);
+    assert(db_pool_add_backend(pool, "127.0.0.1", port, DB_BACKEND_REPLICA, DB_PROTOCOL_POSTGRESQL) == 0);
+
+    // Reads take the least loaded replica under the bound, else the primary
+    db_pool_set_max_replica_lag(pool, 100);
+    db_pool_set_backend_state(pool, 2, true, 50);
+    db_pool_set_backend_state(pool, 3, true, 200);
+    assert(db_test_read_backend(pool) == 2);
+    db_pool_set_backend_state(pool, 3, true, 20);
+    assert(db_test_read_backend(pool) == 3);
+    db_pool_set_backend_state(pool, 3, false, 20);
+    assert(db_test_read_backend(pool) == 2);
+    db_pool_set_backend_state(pool, 2, true, UINT64_MAX);
+    assert(db_test_read_backend(pool) == 1);
+    db_pool_set_backend_state(pool, 3, true, 0);
+
+    // The prober logs in, and its lag readings steer reads
+    db_health_checker_t *hc = db_health_checker_create(pool, 20, 500, 1000);
+    assert(db_health_checker_set_auth(hc, "probe", "secret", "app") == 0);
+    assert(db_health_checker_start(hc) == 0);
+    assert(db_test_wait_read_backend(pool, 1));
+    atomic_store(&srv.lag_ms, 300);
+    assert(db_test_wait_read_backend(pool, 0));
+    atomic_store(&srv.lag_ms, 5000);
+    assert(db_test_wait_read_backend(pool, 1));
+    atomic_store(&srv.lag_ms, 0);
+    assert(db_test_wait_read_backend(pool, 0));
+    assert(atomic_load(&srv.auth_failures) == 0);
+    assert(atomic_load(&hc->stats.rounds) > 0 && atomic_load(&hc->stats.failures) == 0);
+
+    // A session reads from the primary right after writing
+    db_router_t *router = db_router_create(pool, 64);
+    db_router_set_read_your_writes(router, 150);
+    db_health_checker_stop(hc);
+    assert(db_test_route_role(router, pool, "SELECT 1", 7) == DB_BACKEND_REPLICA);
+    assert(db_test_route_role(router, pool, "INSERT INTO t VALUES (1)", 7) == DB_BACKEND_PRIMARY);
+    assert(db_test_route_role(router, pool, "SELECT 1", 7) == DB_BACKEND_PRIMARY);
+    assert(db_test_route_role(router, pool, "SELECT 1", 8) == DB_BACKEND_REPLICA);
+    usleep(200000);
+    assert(db_test_route_role(router, pool, "SELECT 1", 7) == DB_BACKEND_REPLICA);
+
+    db_router_destroy(router);
+    db_health_checker_destroy(hc);
+    db_pool_destroy(pool);
+    atomic_store(&srv.stop, true);
+    pthread_join(th, NULL);
+    close(srv.lfd);
+    printf("Replica routing test passed\n");
+}
+
+int main() {
+    printf("Running UltraBalancer database tests...\n\n");
+
+    test_db_pool();
+    test_db_router();
+    test_db_transaction_pooling();
+    test_db_replica_routing();
+
+    printf("\nAll tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,370 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../include/http/http_scan.h"
+#include "../include/http/http.h"
+#include "../include/http/h2.h"
+#include "../include/core/loadbalancer.h"
+
+void test_http_scan() {
+    printf("Testing HTTP header scanner...\n");
+
+    // Each stop byte at every position of a buffer longer than one vector,
+    // so the vector body and the scalar tail both see it
+    char line[80];
+    const char token_stops[] = { ':', ' ', '\t', '"', '(', '/', '@', '[', '{', 0x7f, (char)0x80, '\r' };
+    for (size_t s = 0; s < sizeof(token_stops); s++) {
+        for (size_t at = 0; at < sizeof(line); at++) {
+            memset(line, 'a', sizeof(line));
+            line[at] = token_stops[s];
+            assert(http_scan_token(line, line + sizeof(line)) == line + at);
+        }
+    }
+
+    const char ctl_stops[] = { '\r', '\n', 0x01, 0x7f };
+    for (size_t s = 0; s < sizeof(ctl_stops); s++) {
+        for (size_t at = 0; at < sizeof(line); at++) {
+            memset(line, 'x', sizeof(line));
+            line[at] = ctl_stops[s];
+            assert(http_scan_ctl(line, line + sizeof(line)) == line + at);
+        }
+    }
+
+    // Every tchar is scanned over; HTAB, spaces and obs-text stay in values
+    const char *name = "X-Forwarded-For!#$%&'*+-.^_`|~0123456789abcdefghijklmnopqrstuvwxyz";
+    assert(http_scan_token(name, name + strlen(name)) == name + strlen(name));
+    const char *value = "text/html; q=0.9,\t\x80\xff \"quoted\" (comment) {}[]<>@padding..";
+    assert(http_scan_ctl(value, value + strlen(value)) == value + strlen(value));
+    for (int c = 0; c < 256; c++) {
+        char ch = (char)c;
+        bool tchar = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                     (c && strchr("!#$%&'*+-.^_`|~", c));
+        assert(http_is_tchar((unsigned char)c) == tchar);
+        assert((http_scan_token(&ch, &ch + 1) == &ch + 1) == tchar);
+    }
+
+    printf("HTTP header scanner test passed\n");
+}
+
+void test_http_msg() {
+    printf("Testing zero-allocation HTTP message parsing...\n");
+
+    char req[8192];
+    int len = snprintf(req, sizeof(req),
+                       "GET /api/v1/items?id=7 HTTP/1.1\r\n"
+                       "Host: example.com\r\n"
+                       "Content: 5\r\n"
+                       "Content-Length: 12  \r\n"
+                       "Connection: keep-alive\r\n");
+    for (int i = 0; i < 40; i++) {
+        len += snprintf(req + len, sizeof(req) - len, "X-Extra-%d: v%d\r\n", i, i);
+    }
+    len += snprintf(req + len, sizeof(req) - len, "Upgrade: websocket\r\n\r\n");
+
+    struct buffer buf = { .area = req, .size = sizeof(req), .data = len };
+    http_msg_t *msg = calloc(1, sizeof(*msg));
+    assert(msg != NULL);
+    http_msg_reset(msg);
+
+    assert(http_msg_analyzer(msg, &buf) == 0);
+    assert(msg->msg_state == HTTP_MSG_DATA && msg->chunk_len == 12);
+    assert(msg->meth == HTTP_METH_GET);
+    assert(msg->uri.len == 18 && memcmp(http_slice_ptr(&buf, msg->uri), "/api/v1/items?id=7", 18) == 0);
+    assert(msg->hdr_count == 45 && msg->spill_cap >= 13);
+
+    // Well-known headers come straight from the index
+    const http_hdr_t *host = http_msg_known(msg, HTTP_HDR_HOST);
+    assert(host && host->v.len == 11 && memcmp(http_slice_ptr(&buf, host->v), "example.com", 11) == 0);
+    const http_hdr_t *cl = http_msg_known(msg, HTTP_HDR_CONTENT_LENGTH);
+    assert(cl && cl->v.len == 2 && msg->body_len == 12);
+    assert(msg->flags & HTTP_MSGF_CONN_KAL);
+    assert(msg->flags & HTTP_MSGF_WEBSOCKET);      // a spilled header still counts
+    assert(http_msg_known(msg, HTTP_HDR_TRANSFER_ENCODING) == NULL);
+
+    const http_hdr_t *extra = http_msg_find(msg, &buf, "x-extra-39");
+    assert(extra && extra->v.len == 3 && memcmp(http_slice_ptr(&buf, extra->v), "v39", 3) == 0);
+    assert(http_msg_find(msg, &buf, "content-LENGTH") == cl);
+    assert(http_msg_find(msg, &buf, "X-Missing") == NULL);
+
+    // The spill array survives a reset for the next message
+    http_hdr_t *spill = msg->spill;
+    http_msg_reset(msg);
+    assert(msg->hdr_count == 0 && msg->spill == spill && !http_msg_known(msg, HTTP_HDR_HOST));
+
+    // Whitespace before the colon is refused
+    char bad[] = "GET / HTTP/1.1\r\nHost : x\r\n\r\n";
+    struct buffer bbuf = { .area = bad, .size = sizeof(bad), .data = sizeof(bad) - 1 };
+    assert(http_msg_analyzer(msg, &bbuf) < 0);
+
+    http_msg_release(msg);
+    free(msg);
+    printf("Zero-allocation HTTP message test passed\n");
+}
+
+void test_http_body_stream() {
+    printf("Testing incremental chunked body framing...\n");
+
+    char body[16384];
+    size_t body_len = 0;
+    body_len += snprintf(body, sizeof(body), "POST /up HTTP/1.1\r\nHost: x\r\nTransfer-Encoding: chunked\r\n\r\n");
+    size_t head_len = body_len;
+    for (int i = 0; i < 20; i++) {
+        body_len += snprintf(body + body_len, sizeof(body) - body_len, "%x;ext=%d\r\n", 300 + i, i);
+        memset(body + body_len, 'a' + i, 300 + i);
+        body_len += 300 + i;
+        body_len += snprintf(body + body_len, sizeof(body) - body_len, "\r\n");
+    }
+    body_len += snprintf(body + body_len, sizeof(body) - body_len, "0\r\nX-Sum: 1\r\n\r\n");
+
+    // Feed 7 bytes at a time and drop whatever is framed, the way a proxy
+    // forwards; the window never holds more than a partial line
+    http_msg_t *msg = calloc(1, sizeof(*msg));
+    assert(msg != NULL);
+    http_msg_reset(msg);
+    char window[64];
+    struct buffer buf = { .area = window, .size = sizeof(window), .data = 0 };
+    size_t fed = 0, forwarded = 0;
+    int ret = 0;
+    bool head_seen = false;
+    char head[256];
+    while (ret == 0 && fed < body_len) {
+        size_t n = body_len - fed < 7 ? body_len - fed : 7;
+        if (!head_seen) {
+            // The head is parsed in place, so it is kept whole
+            memcpy(head + buf.data, body + fed, n);
+            buf.area = head;
+            buf.size = sizeof(head);
+        } else {
+            memcpy(window + buf.data, body + fed, n);
+        }
+        buf.data += n;
+        fed += n;
+        ret = http_msg_analyzer(msg, &buf);
+        if (!head_seen && msg->msg_state > HTTP_MSG_HDR_VAL) {
+            head_seen = true;
+            assert(msg->next == (int64_t)head_len && (msg->flags & HTTP_MSGF_TE_CHNK));
+        }
+        if (head_seen) {
+            // Forward the framed prefix and keep the rest
+            size_t done = (size_t)msg->next;
+            forwarded += done;
+            memmove(window, buf.area + done, buf.data - done);
+            buf.data -= done;
+            buf.area = window;
+            buf.size = sizeof(window);
+            http_msg_consume(msg, done);
+            assert(buf.data < 32);
+        }
+    }
+    assert(ret == 1 && msg->msg_state == HTTP_MSG_DONE);
+    assert(fed == body_len && forwarded == body_len && buf.data == 0);
+
+    // Chunk sizes that are not hex or overflow are refused
+    char bad[] = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n";
+    struct buffer bbuf = { .area = bad, .size = sizeof(bad), .data = sizeof(bad) - 1 };
+    http_msg_reset(msg);
+    assert(http_msg_analyzer(msg, &bbuf) < 0);
+    char big[] = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n11111111111111111\r\n";
+    struct buffer gbuf = { .area = big, .size = sizeof(big), .data = sizeof(big) - 1 };
+    http_msg_reset(msg);
+    assert(http_msg_analyzer(msg, &gbuf) < 0);
+
+    http_msg_release(msg);
+    free(msg);
+    printf("Incremental chunked body test passed\n");
+}
+
+static size_t test_unhex(const char *hex, uint8_t *out) {
+    size_t n = 0;
+    for (const char *p = hex; p[0] && p[1]; ) {
+        if (*p == ' ') { p++; continue; }
+        unsigned v;
+        sscanf(p, "%2x", &v);
+        out[n++] = (uint8_t)v;
+        p += 2;
+    }
+    return n;
+}
+
+static bool test_hdr_is(const hpack_headers_t *hs, uint32_t i, const char *name, const char *value) {
+    return hs->h[i].nlen == strlen(name) && memcmp(hpack_name(hs, i), name, hs->h[i].nlen) == 0 &&
+           hs->h[i].vlen == strlen(value) && memcmp(hpack_value(hs, i), value, hs->h[i].vlen) == 0;
+}
+
+void test_hpack() {
+    printf("Testing HTTP/2 framing and HPACK...\n");
+
+    uint8_t frame[H2_FRAME_HDR_LEN];
+    struct h2_frame f;
+    h2_frame_encode(frame, 16383, H2_FT_HEADERS, H2_F_END_HEADERS | H2_F_END_STREAM, 0x80000007);
+    h2_frame_decode(frame, &f);
+    assert(f.len == 16383 && f.type == H2_FT_HEADERS && f.flags == 0x05 && f.sid == 7);
+
+    // RFC 7541 C.4: three requests with Huffman literals sharing one table
+    hpack_table_t *dec = malloc(sizeof(*dec));
+    hpack_headers_t *hs = malloc(sizeof(*hs));
+    assert(dec && hs);
+    hpack_table_init(dec);
+    uint8_t block[256];
+    size_t n = test_unhex("8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff", block);
+    assert(hpack_decode(dec, block, n, hs) == 0 && hs->count == 4);
+    assert(test_hdr_is(hs, 0, ":method", "GET") && test_hdr_is(hs, 1, ":scheme", "http"));
+    assert(test_hdr_is(hs, 2, ":path", "/") && test_hdr_is(hs, 3, ":authority", "www.example.com"));
+    assert(dec->count == 1 && dec->size == 57);
+
+    n = test_unhex("8286 84be 5886 a8eb 1064 9cbf", block);
+    assert(hpack_decode(dec, block, n, hs) == 0 && hs->count == 5);
+    assert(test_hdr_is(hs, 3, ":authority", "www.example.com"));
+    assert(test_hdr_is(hs, 4, "cache-control", "no-cache"));
+    assert(dec->count == 2 && dec->size == 110);
+
+    n = test_unhex("8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf", block);
+    assert(hpack_decode(dec, block, n, hs) == 0 && hs->count == 5);
+    assert(test_hdr_is(hs, 1, ":scheme", "https") && test_hdr_is(hs, 2, ":path", "/index.html"));
+    assert(test_hdr_is(hs, 4, "custom-key", "custom-value"));
+    assert(dec->count == 3 && dec->size == 164);
+
+    // Bad Huffman padding and out-of-range indexes are compression errors
+    n = test_unhex("8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 fe", block);
+    hpack_table_t *fresh = malloc(sizeof(*fresh));
+    hpack_table_init(fresh);
+    assert(hpack_decode(fresh, block, n, hs) < 0);
+    uint8_t bad_index = 0xbe;
+    hpack_table_init(fresh);
+    assert(hpack_decode(fresh, &bad_index, 1, hs) < 0);
+
+    // Encoder output decodes back; repeats come out as one-byte indexes
+    hpack_table_t *enc = malloc(sizeof(*enc));
+    hpack_table_init(enc);
+    hpack_table_init(fresh);
+    uint8_t out[512];
+    for (int round = 0; round < 2; round++) {
+        n = hpack_encode(enc, out, sizeof(out), ":status", 7, "200", 3, true);
+        assert(n == 1 && out[0] == 0x88);
+        size_t first = n;
+        n += hpack_encode(enc, out + n, sizeof(out) - n, "server", 6, "ultrabalancer", 13, true);
+        n += hpack_encode(enc, out + n, sizeof(out) - n, "content-length", 14, "30", 2, false);
+        n += hpack_encode(enc, out + n, sizeof(out) - n, "x-trace", 7, "abc", 3, true);
+        if (round == 1) assert(n == first + 1 + 5 + 1);
+        assert(hpack_decode(fresh, out, n, hs) == 0 && hs->count == 4);
+        assert(test_hdr_is(hs, 0, ":status", "200") && test_hdr_is(hs, 1, "server", "ultrabalancer"));
+        assert(test_hdr_is(hs, 2, "content-length", "30") && test_hdr_is(hs, 3, "x-trace", "abc"));
+    }
+    assert(enc->count == 2 && fresh->count == 2);
+
+    // A table size update must come first and empties a zero-sized table
+    n = hpack_encode_table_size(out, sizeof(out), 0);
+    hpack_table_resize(enc, 0);
+    n += hpack_encode(enc, out + n, sizeof(out) - n, "x-trace", 7, "abc", 3, true);
+    assert(hpack_decode(fresh, out, n, hs) == 0 && fresh->count == 0 && enc->count == 0);
+    assert(test_hdr_is(hs, 0, "x-trace", "abc"));
+
+    free(enc);
+    free(fresh);
+    free(hs);
+    free(dec);
+    printf("HTTP/2 framing and HPACK test passed\n");
+}
+
+static const struct {
+    const char *data;
+    bool response;
+    bool reusable;
+    uint32_t messages;
+} track_cases[] = {
+    // Requests
+    {"GET / HTTP/1.1\r\nHost: a\r\n\r\n", false, true, 1},
+    {"POST /p HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc", false, true, 1},
+    {"POST /p HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n0\r\n\r\n", false, true, 1},
+    {"GET /a HTTP/1.1\r\n\r\nPOST /b HTTP/1.1\r\nContent-Length: 2\r\n\r\nhiGET /c HTTP/1.1\r\n\r\n",
+     false, true, 3},
+    {"HEAD / HTTP/1.1\r\n\r\n", false, false, 0},
+    {"CONNECT a:443 HTTP/1.1\r\n\r\n", false, false, 0},
+    {"GET / HTTP/1.0\r\n\r\n", false, false, 0},
+    {"GET / HTTP/1.1\r\nConnection: close\r\n\r\n", false, false, 0},
+    {"GET / HTTP/1.1\r\nUpgrade: websocket\r\n\r\n", false, false, 0},
+    {"GET / HTTP/1.1\r\nHost: a\r\n", false, false, 0},
+    // Responses
+    {"HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello", true, true, 1},
+    {"HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n", true, true, 1},
+    {"HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n0\r\n\r\n", true, true, 1},
+    {"HTTP/1.1 200 OK\r\ntransfer-encoding: chunked\r\n\r\n"
+     "A;ext=1\r\n0123456789\r\n0\r\nX-Trailer: 1\r\n\r\n", true, true, 1},
+    {"HTTP/1.1 204 No Content\r\n\r\n", true, true, 1},
+    {"HTTP/1.1 304 Not Modified\r\nContent-Length: 100\r\n\r\n", true, true, 1},
+    {"HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 103 Early Hints\r\nLink: </a>\r\n\r\n"
+     "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok", true, true, 1},
+    {"HTTP/1.1 204 No Content\r\n\r\nHTTP/1.1 200 OK\r\nContent-Length: 1\r\n\r\nx"
+     "HTTP/1.1 304 Not Modified\r\n\r\n", true, true, 3},
+    {"HTTP/1.1 200 OK\r\n\r\nbody until close", true, false, 0},
+    {"HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: 1\r\n\r\nx", true, false, 0},
+    {"HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n\r\n", true, false, 0},
+    {"HTTP/1.0 200 OK\r\nContent-Length: 1\r\n\r\nx", true, false, 0},
+    {"HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n", true, false, 0},
+};
+
+void test_keepalive_framing() {
+    printf("Testing keep-alive framing...\n");
+
+    for (size_t i = 0; i < sizeof(track_cases) / sizeof(track_cases[0]); i++) {
+        lb_connection_t conn = {0};
+        http_track_t t = {0};
+        conn.upstream_reusable = true;
+        size_t len = strlen(track_cases[i].data);
+        size_t used = lb_net_track(&conn, &t, track_cases[i].data, len, track_cases[i].response, false);
+
+        assert(conn.upstream_reusable == track_cases[i].reusable);
+        assert(t.messages == track_cases[i].messages);
+        if (track_cases[i].reusable) {
+            assert(used == len);
+            assert(t.state == HTTP_TRACK_IDLE);
+        }
+    }
+
+    // Bodies and chunks may arrive a byte at a time after the head
+    const char *chunked = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                          "4\r\nwiki\r\n5;x\r\npedia\r\n0\r\n\r\n";
+    const char *body = strstr(chunked, "\r\n\r\n") + 4;
+    lb_connection_t conn = {0};
+    http_track_t t = {0};
+    conn.upstream_reusable = true;
+    assert(lb_net_track(&conn, &t, chunked, body - chunked, true, false) == (size_t)(body - chunked));
+    for (const char *p = body; *p; p++) {
+        assert(t.messages == 0);
+        assert(lb_net_track(&conn, &t, p, 1, true, false) == 1);
+    }
+    assert(conn.upstream_reusable && t.messages == 1 && t.state == HTTP_TRACK_IDLE);
+
+    const char *req = "PUT /x HTTP/1.1\r\nContent-Length: 10\r\n\r\n0123456789";
+    size_t head = strstr(req, "\r\n\r\n") + 4 - req;
+    memset(&t, 0, sizeof(t));
+    assert(lb_net_track(&conn, &t, req, head + 4, false, false) == head + 4);
+    assert(t.state == HTTP_TRACK_BODY && t.remaining == 6 && t.messages == 0);
+    assert(lb_net_track(&conn, &t, req + head + 4, 6, false, false) == 6);
+    assert(t.state == HTTP_TRACK_IDLE && t.messages == 1);
+
+    // one_message stops at the end of the first of two pipelined requests
+    const char *pipelined = "GET /a HTTP/1.1\r\n\r\nGET /b HTTP/1.1\r\n\r\n";
+    memset(&t, 0, sizeof(t));
+    size_t first = lb_net_track(&conn, &t, pipelined, strlen(pipelined), false, true);
+    assert(first == strlen("GET /a HTTP/1.1\r\n\r\n") && t.messages == 1);
+    assert(lb_net_track(&conn, &t, pipelined + first, strlen(pipelined) - first, false, true) ==
+           strlen(pipelined) - first);
+    assert(t.messages == 2 && conn.upstream_reusable);
+
+    printf("Keep-alive framing test passed\n");
+}
+
+int main() {
+    printf("Running UltraBalancer HTTP tests...\n\n");
+
+    test_http_scan();
+    test_http_msg();
+    test_http_body_stream();
+    test_hpack();
+    test_keepalive_framing();
+
+    printf("\nAll tests passed!\n");
+    return 0;
+}
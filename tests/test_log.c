@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "../include/utils/log.h"
+
+#define LOG_THREADS 4
+#define LOG_LINES   3000
+
+static void* log_producer(void* arg) {
+    long id = (long)arg;
+    for (int i = 0; i < LOG_LINES; i++) {
+        log_info("producer %ld line %d", id, i);
+    }
+    return NULL;
+}
+
+// Scan the captured output: every line is either delivered or reported
+// as dropped, and lines from one thread stay in order.
+static void check_output(const char* path) {
+    FILE* f = fopen(path, "r");
+    assert(f != NULL);
+
+    char line[512];
+    int next[LOG_THREADS] = {0};
+    long delivered = 0, dropped = 0;
+
+    while (fgets(line, sizeof(line), f)) {
+        assert(line[0] == '[' && strstr(line, "] ultrabalancer ") != NULL);
+
+        const char* p;
+        unsigned long long n;
+        long id;
+        int seq;
+        if ((p = strstr(line, "WARN: ")) && sscanf(p, "WARN: %llu log lines dropped", &n) == 1) {
+            dropped += n;
+        } else if ((p = strstr(line, "INFO: ")) && sscanf(p, "INFO: producer %ld line %d", &id, &seq) == 2) {
+            assert(id >= 0 && id < LOG_THREADS);
+            assert(seq >= next[id]);
+            next[id] = seq + 1;
+            delivered++;
+        }
+    }
+    fclose(f);
+
+    printf("delivered=%ld dropped=%ld\n", delivered, dropped);
+    assert(delivered + dropped == (long)LOG_THREADS * LOG_LINES + 2);
+    assert(delivered > 0);
+}
+
+void test_async_log() {
+    printf("Testing asynchronous logger...\n");
+
+    char path[] = "/tmp/test_log.XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+
+    int saved = dup(STDERR_FILENO);
+    dup2(fd, STDERR_FILENO);
+
+    log_init(NULL, LOG_INFO);
+    log_debug("filtered by level");
+    assert(log_start() == 0);
+
+    pthread_t threads[LOG_THREADS];
+    for (long i = 0; i < LOG_THREADS; i++) {
+        assert(pthread_create(&threads[i], NULL, log_producer, (void*)i) == 0);
+    }
+    for (int i = 0; i < LOG_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    log_stop();
+
+    // Synchronous again once the writer is gone
+    log_info("producer 0 line %d", LOG_LINES);
+    log_info("producer 0 line %d", LOG_LINES + 1);
+
+    fflush(stderr);
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+    close(fd);
+
+    check_output(path);
+    unlink(path);
+    printf("Asynchronous logger test passed\n");
+}
+
+int main() {
+    printf("Running UltraBalancer log tests...\n\n");
+
+    test_async_log();
+
+    printf("\nAll tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../include/core/lb_memory.h"
+#include "../include/http/http.h"
+#include <pthread.h>
+
+typedef struct {
+    uint64_t a;
+    char pad[200];
+} test_obj_t;
+
+static void test_slab() {
+    printf("Testing slab allocator...\n");
+
+    slab_t *slab = slab_create(sizeof(test_obj_t), 4);
+    assert(slab != NULL);
+
+    test_obj_t *objs[10];
+    for (int i = 0; i < 10; i++) {
+        objs[i] = slab_alloc(slab);
+        assert(objs[i] != NULL);
+        assert(objs[i]->a == 0);  // Objects come back zeroed
+        objs[i]->a = i + 1;
+    }
+    assert(slab->in_use == 10);
+
+    // Locally freed objects are reused first
+    slab_free(slab, objs[3]);
+    test_obj_t *again = slab_alloc(slab);
+    assert(again == objs[3]);
+
+    // Remote frees are reclaimed once the local list is exhausted
+    slab_free_remote(slab, objs[5]);
+    int found = 0;
+    for (int i = 0; i < 8 && !found; i++) {
+        if (slab_alloc(slab) == (void*)objs[5]) found = 1;
+    }
+    assert(found);
+
+    slab_destroy(slab);
+    printf("Slab allocator test passed\n");
+}
+
+static void test_buffer_pool() {
+    printf("Testing buffer pool...\n");
+
+    lb_buffer_pool_t *pool = buffer_pool_create();
+    assert(pool != NULL);
+
+    size_t cap = 0;
+    uint8_t *small = buffer_pool_get(pool, 100, &cap);
+    assert(small != NULL && cap == 4096);
+
+    uint8_t *mid = buffer_pool_get(pool, 5000, &cap);
+    assert(mid != NULL && cap == 16384);
+    buffer_pool_put(pool, mid, cap);
+
+    // Same class hands back the cached buffer
+    uint8_t *reused = buffer_pool_get(pool, 9000, &cap);
+    assert(reused == mid && cap == 16384);
+    buffer_pool_put(pool, reused, cap);
+
+    // Oversized requests are served exactly and freed on put
+    uint8_t *huge = buffer_pool_get(pool, 8 * 1024 * 1024, &cap);
+    assert(huge != NULL && cap == 8 * 1024 * 1024);
+    buffer_pool_put(pool, huge, cap);
+
+    buffer_pool_put(pool, small, 4096);
+    buffer_pool_destroy(pool);
+    printf("Buffer pool test passed\n");
+}
+
+static void *lb_alloc_free_thread(void *arg) {
+    void **objs = arg;
+    for (int i = 0; i < 1000; i++)
+        lb_free(objs[i]);
+    return NULL;
+}
+
+static void *lb_alloc_node_thread(void *arg) {
+    lb_alloc_set_node(1);
+    void *p = lb_alloc(256);
+    lb_free(p);
+    return p;
+}
+
+static void test_lb_alloc() {
+    printf("Testing size-classed allocator...\n");
+
+    // Every size maps to the smallest class that holds it
+    for (size_t size = 1; size <= LB_ALLOC_SMALL_MAX; size++) {
+        int cls = lb_alloc_class_of(size);
+        assert(cls >= 0 && cls < LB_ALLOC_CLASSES);
+        assert(lb_alloc_class_size(cls) >= size);
+        assert(cls == 0 || lb_alloc_class_size(cls - 1) < size);
+    }
+    assert(lb_alloc_class_size(LB_ALLOC_CLASSES - 1) == LB_ALLOC_SMALL_MAX);
+    assert(lb_alloc_class_of(LB_ALLOC_SMALL_MAX + 1) == -1);
+
+    char *p = lb_alloc(100);
+    assert(p && ((uintptr_t)p & 15) == 0 && lb_alloc_usable_size(p) == 112);
+    memset(p, 0xab, 100);
+    lb_free(p);
+    assert(lb_alloc(100) == p);         // the thread's list is LIFO
+    lb_free(p);
+
+    char *q = lb_realloc(NULL, 40);
+    strcpy(q, "spill");
+    q = lb_realloc(q, 3000);
+    assert(strcmp(q, "spill") == 0 && lb_alloc_usable_size(q) >= 3000);
+    lb_free(q);
+
+    int *z = lb_calloc(1000, sizeof(int));
+    for (int i = 0; i < 1000; i++) assert(z[i] == 0);
+    lb_free(z);
+
+    // Large allocations get their own mapping and give it back on free
+    lb_alloc_stats_t st;
+    lb_alloc_get_stats(&st);
+    uint64_t large = st.large_allocs;
+    char *big = lb_alloc(3 * 1024 * 1024);
+    assert(big && lb_alloc_usable_size(big) >= 3 * 1024 * 1024);
+    big[0] = big[3 * 1024 * 1024 - 1] = 1;
+    lb_alloc_get_stats(&st);
+    assert(st.large_allocs == large + 1);
+    lb_free(big);
+    lb_alloc_get_stats(&st);
+    assert(st.large_allocs == large);
+
+    // Objects freed on another thread move back in batches
+    static void *objs[1000];
+    for (int i = 0; i < 1000; i++) {
+        objs[i] = lb_alloc(256);
+        assert(objs[i]);
+        memset(objs[i], i, 256);
+    }
+    lb_alloc_get_stats(&st);
+    uint64_t puts = st.central_puts;
+    pthread_t t;
+    pthread_create(&t, NULL, lb_alloc_free_thread, objs);
+    pthread_join(t, NULL);
+    lb_alloc_get_stats(&st);
+    assert(st.central_puts > puts);
+    for (int i = 0; i < 1000; i++) {
+        objs[i] = lb_alloc(256);
+        assert(objs[i]);
+    }
+    for (int i = 0; i < 1000; i++)
+        lb_free(objs[i]);
+    lb_alloc_thread_flush();
+
+    // Another node's thread carves its own region and keeps to its pools
+    const uintptr_t region = ~(((uintptr_t)1 << LB_ALLOC_REGION_SHIFT) - 1);
+    lb_alloc_get_stats(&st);
+    uint64_t regions = st.regions;
+    void *remote;
+    pthread_create(&t, NULL, lb_alloc_node_thread, NULL);
+    pthread_join(t, &remote);
+    lb_alloc_get_stats(&st);
+    assert(remote && st.regions == regions + 1);
+    for (int i = 0; i < 1000; i++)
+        assert(((uintptr_t)objs[i] & region) != ((uintptr_t)remote & region));
+    for (int i = 0; i < 1000; i++) {
+        objs[i] = lb_alloc(256);
+        assert(objs[i] && objs[i] != remote);
+    }
+    for (int i = 0; i < 1000; i++)
+        lb_free(objs[i]);
+    lb_alloc_thread_flush();
+
+    printf("Size-classed allocator test passed\n");
+}
+
+static void test_lb_arena() {
+    printf("Testing request arenas...\n");
+
+    lb_arena_t a;
+    lb_arena_init(&a, 1024);
+    char *first = lb_arena_alloc(&a, 10);
+    char *second = lb_arena_alloc(&a, 10);
+    assert(first && second == first + 16);
+
+    // Mark and release scope a nested use, even across chunks
+    lb_arena_mark_t m = lb_arena_mark(&a);
+    char *s = lb_arena_strndup(&a, "hello world", 5);
+    assert(strcmp(s, "hello") == 0);
+    char *spilled = lb_arena_alloc(&a, 4000);
+    assert(spilled && a.first->next && a.cur == a.first->next);
+    lb_arena_release(&a, m);
+    assert(lb_arena_alloc(&a, 10) == s);
+
+    // A reset rewinds in place and keeps every chunk for the next request
+    lb_arena_chunk_t *chunk = a.first->next;
+    lb_arena_reset(&a);
+    assert(lb_arena_alloc(&a, 10) == first);
+    assert(lb_arena_alloc(&a, 4000) == spilled && a.first->next == chunk);
+    lb_arena_destroy(&a);
+    assert(!a.first && lb_arena_alloc(&a, 8) != NULL);
+    lb_arena_destroy(&a);
+
+    // An arena-backed message takes its spill array from the arena
+    char req[4096];
+    int len = snprintf(req, sizeof(req), "GET / HTTP/1.1\r\nHost: a\r\n");
+    for (int i = 0; i < 40; i++)
+        len += snprintf(req + len, sizeof(req) - len, "X-%d: %d\r\n", i, i);
+    len += snprintf(req + len, sizeof(req) - len, "\r\n");
+    struct buffer buf = { .area = req, .size = sizeof(req), .data = len };
+
+    lb_arena_t *local = lb_arena_local(LB_ARENA_HTTP);
+    assert(local == lb_arena_local(LB_ARENA_HTTP) && local != lb_arena_local(LB_ARENA_ACL));
+    lb_arena_reset(local);
+    http_msg_t *msg = calloc(1, sizeof(*msg));
+    msg->arena = local;
+    http_msg_reset(msg);
+    assert(http_msg_analyzer(msg, &buf) == 1 && msg->hdr_count == 41);
+    assert(local->first && (char *)msg->spill >= local->first->data &&
+           (char *)msg->spill < local->first->data + local->first->size);
+    const http_hdr_t *h = http_msg_find(msg, &buf, "x-39");
+    assert(h && h->v.len == 2 && memcmp(http_slice_ptr(&buf, h->v), "39", 2) == 0);
+
+    // The arena goes with the request, so a reset forgets the array
+    http_msg_reset(msg);
+    assert(msg->arena == local && !msg->spill && !msg->spill_cap);
+    lb_arena_reset(local);
+    http_msg_release(msg);
+    free(msg);
+
+    printf("Request arena test passed\n");
+}
+
+int main() {
+    printf("Running UltraBalancer memory tests...\n\n");
+
+    test_slab();
+    test_buffer_pool();
+    test_lb_alloc();
+    test_lb_arena();
+
+    printf("\nAll tests passed!\n");
+    return 0;
+}
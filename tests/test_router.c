@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../include/core/request_router.h"
+#include <unistd.h>
+#include <pthread.h>
+
+static void test_request_router() {
+    printf("Testing compiled request router...\n");
+
+    void *r = create_request_router();
+    assert(router_route_request(r, "GET", "/", NULL) == NULL);
+    router_set_default_backend(r, "fallback");
+
+    // Many sibling prefixes sharing edges in the trie
+    char name[64], pat[64], be[64];
+    for (int i = 0; i < 2000; i++) {
+        snprintf(name, sizeof(name), "svc%d", i);
+        snprintf(pat, sizeof(pat), "/svc/%d/", i);
+        snprintf(be, sizeof(be), "be%d", i);
+        router_add_route(r, name, 10);
+        assert(router_add_rule(r, name, ROUTER_MATCH_PREFIX, pat) == 0);
+        assert(router_add_target(r, name, be, 100) == 0);
+    }
+    assert(strcmp(router_route_request(r, "GET", "/svc/1234/x", NULL), "be1234") == 0);
+    assert(strcmp(router_route_request(r, "GET", "/svc/12/", NULL), "be12") == 0);
+    assert(strcmp(router_route_request(r, "GET", "/svc/12", NULL), "fallback") == 0);
+    assert(strcmp(router_route_request(r, "GET", "/other", NULL), "fallback") == 0);
+
+    // Priority decides between an exact and a prefix key, not specificity
+    router_add_route(r, "health", 5);
+    router_add_rule(r, "health", ROUTER_MATCH_EXACT, "/svc/7/health");
+    router_add_target(r, "health", "health", 100);
+    assert(strcmp(router_route_request(r, "GET", "/svc/7/health", NULL), "be7") == 0);
+    router_add_route(r, "health-hi", 20);
+    router_add_rule(r, "health-hi", ROUTER_MATCH_EXACT, "/svc/7/health");
+    router_add_target(r, "health-hi", "health-hi", 100);
+    assert(strcmp(router_route_request(r, "GET", "/svc/7/health", NULL), "health-hi") == 0);
+    assert(strcmp(router_route_request(r, "GET", "/svc/7/healthz", NULL), "be7") == 0);
+
+    // Extra rules are predicates; a failed one falls through to lower routes
+    router_add_route(r, "post", 30);
+    router_add_rule(r, "post", ROUTER_MATCH_PREFIX, "/svc/");
+    router_add_rule(r, "post", ROUTER_MATCH_METHOD, "POST");
+    router_add_target(r, "post", "writer", 100);
+    assert(strcmp(router_route_request(r, "POST", "/svc/3/a", NULL), "writer") == 0);
+    assert(strcmp(router_route_request(r, "GET", "/svc/3/a", NULL), "be3") == 0);
+    router_add_route(r, "canary", 40);
+    router_add_rule(r, "canary", ROUTER_MATCH_PREFIX, "/svc/3/");
+    router_add_rule(r, "canary", ROUTER_MATCH_HEADER, "x-canary:1");
+    router_add_target(r, "canary", "canary", 100);
+    assert(strcmp(router_route_request(r, "GET", "/svc/3/a", NULL), "be3") == 0);
+
+    // Routes without a path key still win when their priority is higher
+    router_add_route(r, "api", 15);
+    router_add_rule(r, "api", ROUTER_MATCH_REGEX, "/svc/[0-9]+/api/.*");
+    router_add_target(r, "api", "api", 100);
+    assert(strcmp(router_route_request(r, "GET", "/svc/42/api/v1", NULL), "api") == 0);
+    assert(strcmp(router_route_request(r, "POST", "/svc/42/api/v1", NULL), "writer") == 0);
+    assert(strcmp(router_route_request(r, "GET", "/nope/api/v1", NULL), "fallback") == 0);
+
+    // A route without targets yields to the next match
+    router_add_route(r, "empty", 50);
+    router_add_rule(r, "empty", ROUTER_MATCH_PREFIX, "/svc/9");
+    assert(strcmp(router_route_request(r, "GET", "/svc/9/", NULL), "be9") == 0);
+    assert(router_add_rule(r, "missing", ROUTER_MATCH_EXACT, "/") < 0);
+
+    destroy_request_router(r);
+    printf("Compiled request router test passed\n");
+}
+
+static void test_regex_set() {
+    printf("Testing regex rule set...\n");
+
+    void *r = create_request_router();
+    router_set_default_backend(r, "fallback");
+    router_add_route(r, "svc", 10);
+    router_add_rule(r, "svc", ROUTER_MATCH_PREFIX, "/svc/");
+    router_add_target(r, "svc", "svc", 100);
+
+    // Regex rules run as one set; (a*)*b must not backtrack on a long miss
+    router_add_route(r, "slow", 60);
+    router_add_rule(r, "slow", ROUTER_MATCH_REGEX, "/(a*)*b");
+    router_add_target(r, "slow", "slow", 100);
+    router_add_route(r, "backref", 60);
+    router_add_rule(r, "backref", ROUTER_MATCH_REGEX, "/(x+)\\1");
+    router_add_target(r, "backref", "backref", 100);
+    char *longpath = malloc(20002);
+    longpath[0] = '/';
+    memset(longpath + 1, 'a', 20000);
+    longpath[20001] = '\0';
+    assert(strcmp(router_route_request(r, "GET", longpath, NULL), "fallback") == 0);
+    longpath[20000] = 'b';
+    assert(strcmp(router_route_request(r, "GET", longpath, NULL), "slow") == 0);
+    free(longpath);
+    assert(strcmp(router_route_request(r, "GET", "/xxxx", NULL), "backref") == 0);
+    assert(strcmp(router_route_request(r, "GET", "/xxx", NULL), "fallback") == 0);
+
+    // Higher-priority trie routes still win over a matching regex
+    router_add_route(r, "api", 5);
+    router_add_rule(r, "api", ROUTER_MATCH_REGEX, "/svc/[0-9]+/api/.*");
+    router_add_target(r, "api", "api", 100);
+    assert(strcmp(router_route_request(r, "GET", "/svc/42/api/v1", NULL), "svc") == 0);
+    assert(strcmp(router_route_request(r, "GET", "/nope/api/v1", NULL), "fallback") == 0);
+
+    destroy_request_router(r);
+    printf("Regex rule set test passed\n");
+}
+
+static void test_rate_limiter() {
+    printf("Testing route rate limiters...\n");
+
+    void *r = create_request_router();
+    router_add_route(r, "api", 10);
+    router_add_rule(r, "api", ROUTER_MATCH_PREFIX, "/api/");
+    router_add_target(r, "api", "api", 100);
+    router_add_route(r, "post", 20);
+    router_add_rule(r, "post", ROUTER_MATCH_METHOD, "POST");
+    router_add_target(r, "post", "writer", 100);
+
+    // GCRA: a burst of 3 back to back, then one request per 100ms
+    assert(router_check_rate_limit(r, "api") == 1);
+    router_enable_rate_limit(r, "api", 10, 3);
+    int allowed = 0;
+    for (int i = 0; i < 10; i++) allowed += router_check_rate_limit(r, "api");
+    assert(allowed == 3);
+    usleep(120000);
+    assert(router_check_rate_limit(r, "api") == 1);
+    assert(router_check_rate_limit(r, "api") == 0);
+
+    // Per-client limits are independent of each other
+    router_enable_client_rate_limit(r, "post", 1, 2);
+    assert(router_check_client_rate_limit(r, "post", "10.0.0.1") == 1);
+    assert(router_check_client_rate_limit(r, "post", "10.0.0.1") == 1);
+    assert(router_check_client_rate_limit(r, "post", "10.0.0.1") == 0);
+    assert(router_check_client_rate_limit(r, "post", "10.0.0.2") == 1);
+
+    destroy_request_router(r);
+    printf("Route rate limiter test passed\n");
+}
+
+static void *test_router_worker(void *router) {
+    for (int i = 0; i < 1000; i++) {
+        const char *be = router_route_request(router, "GET", "/svc/1234/x", NULL);
+        assert(be && strcmp(be, "be1234") == 0);
+    }
+    return NULL;
+}
+
+static void test_router_stats() {
+    printf("Testing per-thread routing statistics...\n");
+
+    void *r = create_request_router();
+    router_add_route(r, "svc1234", 10);
+    router_add_rule(r, "svc1234", ROUTER_MATCH_PREFIX, "/svc/1234/");
+    router_add_target(r, "svc1234", "be1234", 100);
+    router_set_default_backend(r, "fallback");
+
+    // Counters are per thread and summed on read
+    router_reset_stats(r);
+    pthread_t workers[4];
+    for (int i = 0; i < 4; i++) assert(pthread_create(&workers[i], NULL, test_router_worker, r) == 0);
+    for (int i = 0; i < 4; i++) pthread_join(workers[i], NULL);
+    router_route_request(r, "GET", "/missing", NULL);
+    char json[8192];
+    assert(router_get_stats(r, json, sizeof(json)) > 0);
+    assert(strstr(json, "\"total_requests\":4001,"));
+    assert(strstr(json, "\"routed_requests\":4000,"));
+    assert(strstr(json, "\"default_route_hits\":1,"));
+    assert(strstr(json, "\"svc1234\":4000") && strstr(json, "\"be1234\":4000"));
+    router_reset_stats(r);
+    assert(router_get_stats(r, json, sizeof(json)) > 0);
+    assert(strstr(json, "\"total_requests\":0,") && !strstr(json, "be1234"));
+
+    destroy_request_router(r);
+    printf("Per-thread routing statistics test passed\n");
+}
+
+static _Atomic int test_reload_done;
+
+static void *test_reload_reader(void *arg) {
+    (void)arg;
+    void *r = router_manager_get("edge");
+    while (!test_reload_done) {
+        const char *be = router_route_request(r, "GET", "/api/x", NULL);
+        assert(be && (strcmp(be, "blue") == 0 || strcmp(be, "green") == 0));
+    }
+    return NULL;
+}
+
+static void test_router_reload() {
+    printf("Testing route table hot reload...\n");
+
+    const char *blue =
+        "{\"routers\": {\"edge\": {\"default_backend\": \"www\", \"routes\": ["
+        "{\"name\": \"api\", \"priority\": 10,"
+        " \"rules\": [{\"type\": \"prefix\", \"pattern\": \"/api/\"}],"
+        " \"targets\": [{\"backend\": \"blue\", \"weight\": 100}],"
+        " \"rate_limit\": {\"rps\": 50, \"burst\": 5}}]}}}";
+    const char *green =
+        "{\"routers\": {\"edge\": {\"routes\": ["
+        "{\"name\": \"api\", \"priority\": 10,"
+        " \"rules\": [{\"type\": \"regex\", \"pattern\": \"/api/.*\"}],"
+        " \"targets\": [{\"backend\": \"green\"}]}]}}}";
+
+    assert(router_manager_configure(blue) == 0);
+    void *r = router_manager_get("edge");
+    assert(r && strcmp(router_route_request(r, "GET", "/api/x", NULL), "blue") == 0);
+    assert(strcmp(router_route_request(r, "GET", "/", NULL), "www") == 0);
+
+    char json[4096];
+    assert(router_manager_export(json, sizeof(json)) > 0);
+    assert(strstr(json, "\"edge\":{\"default_backend\":\"www\""));
+    assert(strstr(json, "\"rate_limit\":{\"rps\":50,\"burst\":5}"));
+
+    // Readers never see a torn table while configs are swapped under them
+    pthread_t readers[4];
+    test_reload_done = 0;
+    for (int i = 0; i < 4; i++) assert(pthread_create(&readers[i], NULL, test_reload_reader, NULL) == 0);
+    for (int i = 0; i < 200; i++) assert(router_manager_configure(i & 1 ? blue : green) == 0);
+    test_reload_done = 1;
+    for (int i = 0; i < 4; i++) pthread_join(readers[i], NULL);
+
+    // The same router object is updated in place; bad documents change nothing
+    assert(router_manager_configure(green) == 0);
+    assert(router_manager_get("edge") == r);
+    assert(strcmp(router_route_request(r, "GET", "/api/x", NULL), "green") == 0);
+    assert(router_route_request(r, "GET", "/", NULL) == NULL);
+    assert(router_manager_configure("{\"routers\": {\"edge\": {\"routes\": [{}]}}}") < 0);
+    assert(router_manager_configure("{\"routers\": ") < 0);
+    assert(strcmp(router_route_request(r, "GET", "/api/x", NULL), "green") == 0);
+
+    printf("Route table hot reload test passed\n");
+}
+
+int main() {
+    printf("Running UltraBalancer request router tests...\n\n");
+
+    test_request_router();
+    test_regex_set();
+    test_rate_limiter();
+    test_router_stats();
+    test_router_reload();
+
+    printf("\nAll tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,517 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../include/ssl/ssl.h"
+#include "../include/core/lb_clock.h"
+#include <unistd.h>
+#include <sys/mman.h>
+#include <openssl/pem.h>
+#include <openssl/evp.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+static X509 *ssl_test_cert_cn(EVP_PKEY **pkey, const char *cn) {
+    *pkey = EVP_EC_gen("P-256");
+    X509 *x = X509_new();
+    ASN1_INTEGER_set(X509_get_serialNumber(x), 1);
+    X509_gmtime_adj(X509_getm_notBefore(x), 0);
+    X509_gmtime_adj(X509_getm_notAfter(x), 3600);
+    X509_set_pubkey(x, *pkey);
+    X509_NAME *name = X509_get_subject_name(x);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)cn, -1, -1, 0);
+    X509_set_issuer_name(x, name);
+    assert(X509_sign(x, *pkey, EVP_sha256()) > 0);
+    return x;
+}
+
+static X509 *ssl_test_cert(EVP_PKEY **pkey) {
+    return ssl_test_cert_cn(pkey, "example.com");
+}
+
+static SSL_CTX *ssl_test_server(ssl_bind_conf_t *conf, X509 *cert, EVP_PKEY *pkey) {
+    conf->session_cache.size = 64;
+    conf->session_cache.lifetime = 300;
+    SSL_CTX *ctx = ssl_ctx_new(conf);
+    assert(ctx && SSL_CTX_use_certificate(ctx, cert) == 1 && SSL_CTX_use_PrivateKey(ctx, pkey) == 1);
+    return ctx;
+}
+
+// A full handshake over a BIO pair, offering *sess when set, which is then
+// replaced by the session the client ends up with. True when resumed.
+static bool ssl_test_connect_sni(SSL_CTX *cctx, SSL_CTX *sctx, SSL_SESSION **sess,
+                                 const char *sni, char *cn, size_t cn_len) {
+    SSL *c = SSL_new(cctx), *s = SSL_new(sctx);
+    if (sni)
+        SSL_set_tlsext_host_name(c, sni);
+    BIO *cbio, *sbio;
+    assert(BIO_new_bio_pair(&cbio, 0, &sbio, 0) == 1);
+    SSL_set_bio(c, cbio, cbio);
+    SSL_set_bio(s, sbio, sbio);
+    SSL_set_connect_state(c);
+    SSL_set_accept_state(s);
+    if (*sess)
+        assert(SSL_set_session(c, *sess) == 1);
+
+    bool cdone = false, sdone = false;
+    for (int i = 0; i < 16 && !(cdone && sdone); i++) {
+        int r;
+        if (!cdone && !(cdone = (r = SSL_do_handshake(c)) == 1))
+            assert(SSL_get_error(c, r) == SSL_ERROR_WANT_READ);
+        if (!sdone && !(sdone = (r = SSL_do_handshake(s)) == 1))
+            assert(SSL_get_error(s, r) == SSL_ERROR_WANT_READ);
+    }
+    assert(cdone && sdone);
+
+    // TLS 1.3 tickets arrive after the handshake
+    char byte;
+    int r = SSL_read(c, &byte, 1);
+    assert(r <= 0 && SSL_get_error(c, r) == SSL_ERROR_WANT_READ);
+
+    bool reused = SSL_session_reused(s);
+    assert(reused == (bool)SSL_session_reused(c));
+    if (cn) {
+        X509 *peer = SSL_get1_peer_certificate(c);
+        X509_NAME_get_text_by_NID(X509_get_subject_name(peer), NID_commonName, cn, cn_len);
+        X509_free(peer);
+    }
+    // Closed cleanly, or OpenSSL drops the session as bad
+    SSL_shutdown(c);
+    SSL_shutdown(s);
+    if (*sess)
+        SSL_SESSION_free(*sess);
+    *sess = SSL_get1_session(c);
+    SSL_free(c);
+    SSL_free(s);
+    return reused;
+}
+
+static bool ssl_test_connect(SSL_CTX *cctx, SSL_CTX *sctx, SSL_SESSION **sess) {
+    return ssl_test_connect_sni(cctx, sctx, sess, NULL, NULL, 0);
+}
+
+static void test_ssl_resumption() {
+    printf("Testing TLS session resumption across processes...\n");
+
+    EVP_PKEY *pkey;
+    X509 *cert = ssl_test_cert(&pkey);
+    SSL_CTX *cctx = SSL_CTX_new(TLS_client_method());
+    SSL_SESSION *sess = NULL;
+
+    // Two processes with the same ticket secret resume each other's sessions
+    static const char secret[] = "0123456789abcdef0123456789abcdef";
+    ssl_bind_conf_t conf[2];
+    SSL_CTX *sctx[2];
+    for (int i = 0; i < 2; i++) {
+        memset(&conf[i], 0, sizeof(conf[i]));
+        conf[i].ticket_keys = ssl_tickets_new(3600);
+        assert(ssl_tickets_set_secret(conf[i].ticket_keys, secret, sizeof(secret) - 1) == 0);
+        sctx[i] = ssl_test_server(&conf[i], cert, pkey);
+    }
+    ssl_tickets_t *t0 = conf[0].ticket_keys, *t1 = conf[1].ticket_keys;
+    assert(memcmp(atomic_load(&t0->keys), atomic_load(&t1->keys), sizeof(ssl_ticket_keys_t)) == 0);
+
+    assert(!ssl_test_connect(cctx, sctx[0], &sess));
+    assert(atomic_load(&t0->stats.issued) > 0);
+    assert(ssl_test_connect(cctx, sctx[1], &sess));
+    assert(atomic_load(&t1->stats.resumed) == 1);
+
+    // One period later the ticket still decrypts, and is renewed
+    lb_clock_update();
+    lb_clock.sec += 3600;
+    assert(ssl_test_connect(cctx, sctx[0], &sess));
+    assert(atomic_load(&t0->stats.renewed) == 1);
+    assert(ssl_test_connect(cctx, sctx[1], &sess));
+    assert(atomic_load(&t1->stats.resumed) == 2);
+
+    // Two periods on with no traffic, it is gone
+    lb_clock.sec += 2 * 3600;
+    assert(!ssl_test_connect(cctx, sctx[0], &sess));
+    assert(atomic_load(&t0->stats.unknown) == 1);
+    lb_clock_release();
+
+    // Keys file: the first key encrypts, a bad file is refused
+    char path[] = "/tmp/ub-ticketsXXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    unsigned char raw[SSL_TICKET_KEY_SIZE];
+    char line[2 * SSL_TICKET_KEY_SIZE];
+    for (int i = 0; i < 2; i++) {
+        memset(raw, 0x11 * (i + 1), sizeof(raw));
+        int n = EVP_EncodeBlock((unsigned char *)line, raw, sizeof(raw));
+        line[n++] = '\n';
+        assert(write(fd, line, n) == n);
+    }
+    close(fd);
+
+    ssl_tickets_t *t = ssl_tickets_new(0);
+    assert(ssl_tickets_load_file(t, path) == 0);
+    ssl_ticket_keys_t *keys = atomic_load(&t->keys);
+    assert(keys->count == 2 && keys->keys[0].name[0] == 0x11 && keys->keys[1].hmac[31] == 0x22);
+    FILE *f = fopen(path, "w");
+    fputs("not a key\n", f);
+    fclose(f);
+    assert(ssl_tickets_load_file(t, path) < 0 && atomic_load(&t->keys) == keys);
+    assert(ssl_tickets_set_secret(t, "short", 5) < 0);
+    ssl_tickets_free(t);
+    unlink(path);
+
+    // Without tickets, two processes share session IDs through the segment
+    char shm[64];
+    snprintf(shm, sizeof(shm), "ub-test-sess-%d", (int)getpid());
+    ssl_bind_conf_t idconf[2];
+    SSL_CTX *idctx[2];
+    for (int i = 0; i < 2; i++) {
+        memset(&idconf[i], 0, sizeof(idconf[i]));
+        idconf[i].session_cache.shm = shm;
+        idctx[i] = ssl_test_server(&idconf[i], cert, pkey);
+        assert(idconf[i].sess_cache);
+        SSL_CTX_set_options(idctx[i], SSL_OP_NO_TICKET);
+        SSL_CTX_set_max_proto_version(idctx[i], TLS1_2_VERSION);
+    }
+
+    assert(idconf[0].sess_cache != idconf[1].sess_cache);
+
+    SSL_SESSION_free(sess);
+    sess = NULL;
+    assert(!ssl_test_connect(cctx, idctx[0], &sess));
+    assert(ssl_test_connect(cctx, idctx[1], &sess));
+    ssl_sess_cache_stats_t st[2];
+    ssl_sess_cache_get_stats(idconf[0].sess_cache, &st[0]);
+    ssl_sess_cache_get_stats(idconf[1].sess_cache, &st[1]);
+    assert(st[0].stores == 1 && st[1].hits == 1 && st[0].hits == 0);
+
+    // An unknown ID misses
+    SSL_SESSION_set1_id(sess, (const unsigned char *)"0123456789abcdef", 16);
+    assert(!ssl_test_connect(cctx, idctx[1], &sess));
+    ssl_sess_cache_get_stats(idconf[1].sess_cache, &st[1]);
+    assert(st[1].misses == 1 && st[1].stores == 1);
+
+    for (int i = 0; i < 2; i++) {
+        SSL_CTX_free(sctx[i]);
+        ssl_tickets_free(conf[i].ticket_keys);
+        SSL_CTX_free(idctx[i]);
+        ssl_tickets_free(idconf[i].ticket_keys);
+        ssl_sess_cache_close(idconf[i].sess_cache);
+    }
+    char shm_path[80];
+    snprintf(shm_path, sizeof(shm_path), "/%s", shm);
+    shm_unlink(shm_path);
+    SSL_SESSION_free(sess);
+    SSL_CTX_free(cctx);
+    X509_free(cert);
+    EVP_PKEY_free(pkey);
+    printf("TLS session resumption test passed\n");
+}
+
+typedef struct ktls_test_peer {
+    int fd;
+    size_t expect;
+    size_t got;
+    bool match;
+} ktls_test_peer_t;
+
+static char ktls_test_byte(size_t i) {
+    return 'a' + i % 23;
+}
+
+// The client end: reads what the server sends, then answers
+static void *ktls_test_client(void *arg) {
+    ktls_test_peer_t *p = arg;
+    SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+    SSL *ssl = SSL_new(ctx);
+    SSL_set_fd(ssl, p->fd);
+    assert(SSL_connect(ssl) == 1);
+
+    char buf[4096];
+    p->match = true;
+    while (p->got < p->expect) {
+        int n = SSL_read(ssl, buf, sizeof(buf));
+        if (n <= 0) break;
+        for (int i = 0; i < n; i++)
+            p->match &= buf[i] == ktls_test_byte(p->got + i);
+        p->got += n;
+    }
+    assert(SSL_write(ssl, "bye", 3) == 3);
+    SSL_shutdown(ssl);
+    SSL_free(ssl);
+    SSL_CTX_free(ctx);
+    return NULL;
+}
+
+static void test_ssl_ktls() {
+    printf("Testing kernel TLS data path...\n");
+
+    EVP_PKEY *pkey;
+    X509 *cert = ssl_test_cert(&pkey);
+    ssl_bind_conf_t conf;
+    memset(&conf, 0, sizeof(conf));
+    conf.ktls = 1;
+    SSL_CTX *sctx = ssl_test_server(&conf, cert, pkey);
+
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in sa = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t salen = sizeof(sa);
+    assert(bind(lfd, (struct sockaddr *)&sa, sizeof(sa)) == 0 && listen(lfd, 1) == 0);
+    assert(getsockname(lfd, (struct sockaddr *)&sa, &salen) == 0);
+    int cfd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(connect(cfd, (struct sockaddr *)&sa, sizeof(sa)) == 0);
+    int sfd = accept(lfd, NULL, NULL);
+    assert(sfd >= 0);
+
+    // A file for the sendfile path
+    char path[] = "/tmp/ub-ktlsXXXXXX";
+    int ffd = mkstemp(path);
+    char body[100000];
+    for (size_t i = 0; i < sizeof(body); i++)
+        body[i] = ktls_test_byte(5 + i);
+    assert(write(ffd, body, sizeof(body)) == (ssize_t)sizeof(body));
+    unlink(path);
+
+    ktls_test_peer_t peer = { .fd = cfd, .expect = 5 + sizeof(body) };
+    pthread_t th;
+    pthread_create(&th, NULL, ktls_test_client, &peer);
+
+    struct connection conn = { .fd = sfd, .flags = CO_FL_CONNECTED };
+    ssl_sock_ctx_t sc = { .conn = &conn, .ssl = SSL_new(sctx) };
+    conn.xprt_ctx = &sc;
+    SSL_set_fd(sc.ssl, sfd);
+    assert(ssl_sock_handshake(&conn, 0) == 1);
+    bool tx = sc.flags & SSL_SOCK_FL_KTLS_TX;
+    assert(ssl_sock_ktls_fd(&conn) == (tx ? sfd : -1));
+
+    // Same bytes on the wire either way: the client sees plain TLS
+    char hello[5];
+    for (size_t i = 0; i < sizeof(hello); i++)
+        hello[i] = ktls_test_byte(i);
+    assert(ssl_sock_send(&conn, hello, sizeof(hello), 0) == (int)sizeof(hello));
+    size_t sent = 0;
+    while (sent < sizeof(body)) {
+        ssize_t n = ssl_sock_sendfile(&conn, ffd, sent, sizeof(body) - sent);
+        assert(n > 0);
+        sent += n;
+    }
+
+    char reply[8];
+    int got = 0;
+    while (got < 3) {
+        int n = ssl_sock_recv(&conn, reply + got, sizeof(reply) - got, 0);
+        assert(n > 0);
+        got += n;
+    }
+    assert(got == 3 && !memcmp(reply, "bye", 3));
+    pthread_join(th, NULL);
+    assert(peer.got == peer.expect && peer.match);
+
+    SSL_shutdown(sc.ssl);
+    SSL_free(sc.ssl);
+    close(ffd);
+    close(sfd);
+    close(cfd);
+    close(lfd);
+    SSL_CTX_free(sctx);
+    ssl_tickets_free(conf.ticket_keys);
+    X509_free(cert);
+    EVP_PKEY_free(pkey);
+    printf("kTLS test passed (TX %s, RX %s)\n", tx ? "kernel" : "user space",
+           (sc.flags & SSL_SOCK_FL_KTLS_RX) ? "kernel" : "user space");
+}
+
+static int ssl_async_test_calls;
+
+static void ssl_async_test_cb(struct connection *conn, int ret, void *arg) {
+    *(int *)arg = ret;
+    ssl_async_test_calls++;
+}
+
+// One handshake step on the pool, waited for as a worker's epoll would
+static int ssl_async_test_step(ssl_async_t *a, struct connection *conn) {
+    int ret = -2;
+    assert(ssl_async_handshake(a, conn) == 0);
+    struct pollfd pfd = { .fd = a->fd, .events = POLLIN };
+    assert(poll(&pfd, 1, 5000) == 1);
+    assert(ssl_async_complete(a, ssl_async_test_cb, &ret) == 1);
+    return ret;
+}
+
+static void test_ssl_async() {
+    printf("Testing TLS handshakes on the crypto pool...\n");
+
+    EVP_PKEY *pkey;
+    X509 *cert = ssl_test_cert(&pkey);
+    ssl_bind_conf_t conf;
+    memset(&conf, 0, sizeof(conf));
+    SSL_CTX *sctx = ssl_test_server(&conf, cert, pkey);
+    SSL_CTX *cctx = SSL_CTX_new(TLS_client_method());
+
+    ssl_crypto_pool_t *pool = ssl_crypto_pool_new(2);
+    assert(pool && pool->nthreads == 2);
+    ssl_async_t *a = ssl_async_new(pool);
+    assert(a && a->fd >= 0);
+
+    SSL *c = SSL_new(cctx);
+    struct connection conn = { .flags = CO_FL_CONNECTED };
+    ssl_sock_ctx_t sc = { .conn = &conn, .ssl = SSL_new(sctx) };
+    conn.xprt_ctx = &sc;
+    BIO *cbio, *sbio;
+    assert(BIO_new_bio_pair(&cbio, 0, &sbio, 0) == 1);
+    SSL_set_bio(c, cbio, cbio);
+    SSL_set_bio(sc.ssl, sbio, sbio);
+    SSL_set_connect_state(c);
+
+    bool cdone = false, sdone = false;
+    for (int i = 0; i < 16 && !(cdone && sdone); i++) {
+        int r;
+        if (!cdone && !(cdone = (r = SSL_do_handshake(c)) == 1))
+            assert(SSL_get_error(c, r) == SSL_ERROR_WANT_READ);
+        if (!sdone) {
+            int ret = ssl_async_test_step(a, &conn);
+            assert(ret >= 0 && sc.async == NULL);
+            if (!(sdone = ret == 1))
+                assert(conn.flags & CO_FL_WAIT_RD);
+        }
+    }
+    assert(cdone && sdone && (sc.flags & SSL_SOCK_FL_HANDSHAKE_DONE));
+    assert(atomic_load(&pool->stats.steps) >= 2 && atomic_load(&pool->stats.queued) == 0);
+    assert(a->in_flight == 0 && ssl_async_complete(a, ssl_async_test_cb, NULL) == 0);
+    SSL_free(c);
+    SSL_free(sc.ssl);
+
+    // A client that does not speak TLS fails on the pool too
+    memset(&sc, 0, sizeof(sc));
+    sc.conn = &conn;
+    sc.ssl = SSL_new(sctx);
+    conn.flags = CO_FL_CONNECTED;
+    assert(BIO_new_bio_pair(&cbio, 0, &sbio, 0) == 1);
+    SSL_set_bio(sc.ssl, sbio, sbio);
+    assert(BIO_write(cbio, "GET / HTTP/1.1\r\n\r\n", 18) == 18);
+    assert(ssl_async_test_step(a, &conn) == -1 && (conn.flags & CO_FL_ERROR));
+    SSL_free(sc.ssl);
+    BIO_free(cbio);
+
+    int calls = ssl_async_test_calls;
+    ssl_crypto_pool_free(pool);
+    ssl_async_free(a);
+    assert(calls >= 3);
+    SSL_CTX_free(sctx);
+    SSL_CTX_free(cctx);
+    ssl_tickets_free(conf.ticket_keys);
+    X509_free(cert);
+    EVP_PKEY_free(pkey);
+    printf("TLS crypto pool test passed\n");
+}
+
+static void ssl_test_write_pem(const char *dir, const char *file, const char *cn, time_t mtime) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    EVP_PKEY *pkey;
+    X509 *cert = ssl_test_cert_cn(&pkey, cn);
+    FILE *f = fopen(path, "w");
+    assert(f && PEM_write_X509(f, cert) && PEM_write_PrivateKey(f, pkey, NULL, NULL, 0, NULL, NULL));
+    fclose(f);
+    struct timespec ts[2] = { { mtime, 0 }, { mtime, 0 } };
+    assert(utimensat(AT_FDCWD, path, ts, 0) == 0);
+    X509_free(cert);
+    EVP_PKEY_free(pkey);
+}
+
+// Which certificate the server picks for sni: its CN, "" for the default
+static const char *ssl_test_sni(SSL_CTX *cctx, SSL_CTX *sctx, const char *sni) {
+    static char cn[64];
+    SSL_SESSION *sess = NULL;
+    cn[0] = '\0';
+    ssl_test_connect_sni(cctx, sctx, &sess, sni, cn, sizeof(cn));
+    SSL_SESSION_free(sess);
+    return strcmp(cn, "default") ? cn : "";
+}
+
+static void test_ssl_sni() {
+    printf("Testing SNI certificate index...\n");
+
+    char dir[] = "/tmp/ub-sniXXXXXX";
+    assert(mkdtemp(dir));
+    ssl_test_write_pem(dir, "a.example.com.pem", "a.example.com", 1000);
+    ssl_test_write_pem(dir, "*.example.org.pem", "*.example.org", 1000);
+    ssl_test_write_pem(dir, "_.example.net.pem", "*.example.net", 1000);
+    char junk[256];
+    snprintf(junk, sizeof(junk), "%s/README", dir);
+    fclose(fopen(junk, "w"));
+
+    EVP_PKEY *pkey;
+    X509 *cert = ssl_test_cert_cn(&pkey, "default");
+    ssl_bind_conf_t conf;
+    memset(&conf, 0, sizeof(conf));
+    conf.crt_dir = dir;
+    conf.sni_cache_size = 2;
+    SSL_CTX *sctx = ssl_test_server(&conf, cert, pkey);
+    SSL_CTX *cctx = SSL_CTX_new(TLS_client_method());
+    ssl_sni_t *sni = conf.sni;
+    assert(sni && atomic_load(&sni->index)->count == 3);
+    assert(atomic_load(&sni->stats.builds) == 0);
+
+    // Exact names, wildcards one label deep, case-insensitive
+    assert(!strcmp(ssl_test_sni(cctx, sctx, "A.Example.COM"), "a.example.com"));
+    assert(!strcmp(ssl_test_sni(cctx, sctx, "www.example.org"), "*.example.org"));
+    assert(!strcmp(ssl_test_sni(cctx, sctx, "mail.example.net"), "*.example.net"));
+    assert(!strcmp(ssl_test_sni(cctx, sctx, "a.b.example.org"), ""));
+    assert(!strcmp(ssl_test_sni(cctx, sctx, "example.org"), ""));
+    assert(!strcmp(ssl_test_sni(cctx, sctx, "b.example.com"), ""));
+    assert(!strcmp(ssl_test_sni(cctx, sctx, NULL), ""));
+    assert(atomic_load(&sni->stats.hits) == 3 && atomic_load(&sni->stats.misses) == 3);
+
+    // Built lazily, and no more than two at a time
+    assert(atomic_load(&sni->stats.builds) == 3 && sni->built == 2);
+    assert(atomic_load(&sni->stats.evictions) == 1);
+    assert(!strcmp(ssl_test_sni(cctx, sctx, "www.example.org"), "*.example.org"));
+    assert(sni->built == 2);
+
+    // Hot swap: one replaced, one removed, one added
+    ssl_test_write_pem(dir, "a.example.com.pem", "a2.example.com", 2000);
+    snprintf(junk, sizeof(junk), "%s/*.example.org.pem", dir);
+    unlink(junk);
+    ssl_test_write_pem(dir, "b.example.com.pem", "b.example.com", 1000);
+    struct timespec later[2] = { { 0, UTIME_OMIT }, { time(NULL) + 5, 0 } };
+    assert(utimensat(AT_FDCWD, dir, later, 0) == 0);
+    assert(ssl_sni_update(sni, lb_now_sec()) == 0);
+    assert(ssl_sni_update(sni, lb_now_sec() + SSL_SNI_CHECK_SEC) == 1);
+    assert(atomic_load(&sni->index)->count == 3 && sni->built <= 1);
+    assert(!strcmp(ssl_test_sni(cctx, sctx, "a.example.com"), "a2.example.com"));
+    assert(!strcmp(ssl_test_sni(cctx, sctx, "www.example.org"), ""));
+    assert(!strcmp(ssl_test_sni(cctx, sctx, "b.example.com"), "b.example.com"));
+
+    // A pinned context wins over the directory and survives reloads
+    assert(ssl_sni_add(sni, "b.example.com", sctx) == 0);
+    assert(ssl_sni_reload(sni) == 3);
+    assert(!strcmp(ssl_test_sni(cctx, sctx, "b.example.com"), ""));
+    assert(!strcmp(ssl_test_sni(cctx, sctx, "x.example.net"), "*.example.net"));
+    assert(atomic_load(&sni->stats.failures) == 0);
+
+    SSL_CTX_free(sctx);
+    SSL_CTX_free(cctx);
+    ssl_sni_free(sni);
+    ssl_tickets_free(conf.ticket_keys);
+    X509_free(cert);
+    EVP_PKEY_free(pkey);
+    const char *files[] = { "a.example.com.pem", "_.example.net.pem", "b.example.com.pem", "README" };
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        snprintf(junk, sizeof(junk), "%s/%s", dir, files[i]);
+        unlink(junk);
+    }
+    rmdir(dir);
+    printf("SNI certificate index test passed\n");
+}
+
+int main() {
+    printf("Running UltraBalancer TLS tests...\n\n");
+
+    test_ssl_resumption();
+    test_ssl_ktls();
+    test_ssl_async();
+    test_ssl_sni();
+
+    printf("\nAll tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../include/core/proxy.h"
+#include "../include/stats/metrics.h"
+#include "../include/stats/stats.h"
+#include "../include/stats/stats_snapshot.h"
+#include <unistd.h>
+#include <pthread.h>
+
+static void *metrics_test_worker(void *arg) {
+    metrics_metric_t *m = arg;
+    for (uint64_t i = 1; i <= 100000; i++)
+        metrics_record_ns(m, i * 1000);
+    return NULL;
+}
+
+static void test_metrics_histogram() {
+    printf("Testing metrics histogram...\n");
+
+    // 1us..100ms: percentiles within a bucket's width of the exact ones
+    metrics_metric_t *m = metrics_register("test.latency", METRICS_TIMER);
+    assert(m && metrics_register("test.latency", METRICS_TIMER) == m);
+    pthread_t th[4];
+    for (int i = 0; i < 4; i++)
+        pthread_create(&th[i], NULL, metrics_test_worker, m);
+    for (int i = 0; i < 4; i++)
+        pthread_join(th[i], NULL);
+
+    assert(metrics_get_counter("test.latency") == 400000);
+    double mean = metrics_get_timer_mean("test.latency");
+    assert(mean > 50.0 && mean < 50.001);
+    double p50 = 0, p95 = 0, p99 = 0;
+    metrics_get_percentiles("test.latency", &p50, &p95, &p99);
+    assert(p50 >= 50.0 && p50 < 50.0 * 1.016);
+    assert(p95 >= 95.0 && p95 < 95.0 * 1.016);
+    assert(p99 >= 99.0 && p99 <= 100.0);
+
+    // The top bucket is capped at the largest value seen
+    metrics_metric_t *one = metrics_register("test.single", METRICS_TIMER);
+    metrics_record_ns(one, 123456789);
+    metrics_get_percentiles("test.single", &p50, NULL, &p99);
+    assert(p50 == 123.456789 && p99 == 123.456789);
+
+    // Reset zeroes in place; handles keep working
+    metrics_metric_t *hits = metrics_register("test.hits", METRICS_COUNTER);
+    metrics_increment(hits, 1);
+    metrics_increment_counter("test.hits", 1);
+    assert(metrics_get_counter("test.hits") == 2);
+    metrics_reset();
+    assert(metrics_get_counter("test.latency") == 0 && metrics_get_counter("test.hits") == 0);
+    metrics_get_percentiles("test.latency", &p50, &p95, &p99);
+    assert(p50 == 0 && p95 == 0 && p99 == 0);
+    metrics_record_ns(m, 2000000);
+    metrics_increment(hits, 1);
+    assert(metrics_get_counter("test.latency") == 1 && metrics_get_counter("test.hits") == 1);
+    assert(metrics_get_timer_mean("test.latency") == 2.0);
+
+    printf("Metrics histogram test passed\n");
+}
+
+static char *stats_test_dump(stats_snapshot_t *snap, stats_snap_format_t fmt, size_t *len) {
+    static char area[1 << 16];
+    struct channel chn = {0};
+    chn.buf.area = area;
+    chn.buf.size = sizeof(area) - 1;
+    int n = snap ? stats_snapshot_dump(snap, fmt, &chn) : stats_snapshot_dump_default(fmt, &chn);
+    assert(n >= 0);
+    area[n] = '\0';
+    if (len) *len = n;
+    return area;
+}
+
+static void test_stats_snapshot() {
+    printf("Testing preformatted stats snapshots...\n");
+
+    proxy_t *px = proxy_new("web\"1", PR_MODE_HTTP);
+    px->type = PR_TYPE_LISTEN;
+    px->state |= PR_FL_READY;
+    const char *names[] = { "s3", "s2", "s1" };
+    server_t *srv[3];
+    for (int i = 0; i < 3; i++) {
+        srv[i] = server_new(names[i]);
+        srv[i]->hostname = strdup("10.0.0.1");
+        srv[i]->port = 80;
+        proxy_add_server(px, srv[i]);
+    }
+    srv[2]->cur_state = SRV_RUNNING;
+    atomic_store(&px->fe_counters[5], 42);
+
+    // Labels are escaped once, at build time
+    stats_snapshot_t *snap = stats_snapshot_new(20);
+    assert(snap);
+    char *out = stats_test_dump(snap, STATS_SNAP_PROMETHEUS, NULL);
+    assert(strstr(out, "# TYPE ultrabalancer_server_up gauge\n"));
+    assert(strstr(out, "ultrabalancer_server_up{proxy=\"web\\\"1\",server=\"s1\"} 1\n"));
+    assert(strstr(out, "ultrabalancer_server_up{proxy=\"web\\\"1\",server=\"s2\"} 0\n"));
+    assert(strstr(out, "ultrabalancer_frontend_connections_total{proxy=\"web\\\"1\"} 42\n"));
+
+    // Scrapes copy the last rendering
+    atomic_store(&px->fe_counters[5], 43);
+    out = stats_test_dump(snap, STATS_SNAP_PROMETHEUS, NULL);
+    assert(strstr(out, "ultrabalancer_frontend_connections_total{proxy=\"web\\\"1\"} 42\n"));
+    assert(stats_snapshot_render(snap) == 0);
+    out = stats_test_dump(snap, STATS_SNAP_PROMETHEUS, NULL);
+    assert(strstr(out, "ultrabalancer_frontend_connections_total{proxy=\"web\\\"1\"} 43\n"));
+
+    // Without a default snapshot, a dump renders on the spot
+    size_t len;
+    char copy[1 << 16];
+    memcpy(copy, out, strlen(out) + 1);
+    out = stats_test_dump(NULL, STATS_SNAP_PROMETHEUS, &len);
+    assert(len == strlen(copy) && memcmp(out, copy, len) == 0);
+
+    // The renderer thread picks up changes
+    assert(stats_snapshot_start(snap) == 0);
+    atomic_store(&srv[1]->cum_conns, 7);
+    bool seen = false;
+    for (int i = 0; i < 200 && !seen; i++) {
+        out = stats_test_dump(snap, STATS_SNAP_PROMETHEUS, NULL);
+        seen = strstr(out, "ultrabalancer_server_total_sessions{proxy=\"web\\\"1\",server=\"s2\"} 7\n");
+        if (!seen) usleep(10000);
+    }
+    assert(seen);
+    stats_snapshot_stop(snap);
+
+    stats_snapshot_set_default(snap);
+    struct channel chn = {0};
+    char area[1 << 16];
+    chn.buf.area = area;
+    chn.buf.size = sizeof(area) - 1;
+    int n = stats_dump_json_to_buffer(NULL, &chn);
+    assert(n > 0);
+    area[n] = '\0';
+    assert(strstr(area, "\"name\": \"web\\\"1\",\n      \"type\": \"http\",\n      \"status\": \"UP\""));
+    assert(strstr(area, "\"address\": \"10.0.0.1:80\",\n            \"status\": \"MAINT\""));
+    assert(strstr(area, "\"connections\": 43,"));
+    assert(strstr(area, "\"total_connections\": 7\n"));
+
+    // Binary samples follow the layout, line for line
+    char layout[1 << 16];
+    memcpy(layout, stats_test_dump(snap, STATS_SNAP_LAYOUT, NULL), sizeof(layout));
+    out = stats_test_dump(snap, STATS_SNAP_BINARY, &len);
+    stats_snap_header_t hdr;
+    memcpy(&hdr, out, sizeof(hdr));
+    assert(hdr.magic == STATS_SNAP_MAGIC && hdr.version == STATS_SNAP_VERSION);
+    assert(hdr.header_len == sizeof(hdr) && len == sizeof(hdr) + hdr.count * 8);
+    uint32_t lines = 0, want = UINT32_MAX;
+    for (char *line = layout, *nl; (nl = strchr(line, '\n')); line = nl + 1, lines++) {
+        if (!strncmp(line, "ultrabalancer_server_total_sessions{proxy=\"web\\\"1\",server=\"s2\"}\n",
+                     nl - line + 1))
+            want = lines;
+    }
+    assert(lines == hdr.count && want < lines);
+    uint64_t v;
+    memcpy(&v, out + sizeof(hdr) + want * 8, 8);
+    assert(v == 7);
+
+    // New servers appear after a rebuild, under a new generation
+    uint32_t gen = hdr.generation;
+    server_t *s4 = server_new("s4");
+    s4->hostname = strdup("10.0.0.4");
+    proxy_add_server(px, s4);
+    assert(!strstr(stats_test_dump(snap, STATS_SNAP_LAYOUT, NULL), "server=\"s4\""));
+    assert(stats_snapshot_rebuild(snap) == 0);
+    assert(strstr(stats_test_dump(snap, STATS_SNAP_LAYOUT, NULL), "server=\"s4\""));
+    out = stats_test_dump(snap, STATS_SNAP_BINARY, NULL);
+    memcpy(&hdr, out, sizeof(hdr));
+    assert(hdr.generation == gen + 1 && hdr.count == lines + 4);
+
+    // Output larger than the channel is refused whole
+    char tiny[16];
+    chn.buf.area = tiny;
+    chn.buf.size = sizeof(tiny);
+    chn.buf.data = 0;
+    assert(stats_dump_prometheus(NULL, &chn) < 0 && chn.buf.data == 0);
+    assert(atomic_load(&snap->stats.overflows) == 1);
+    assert(atomic_load(&snap->stats.renders) >= 3);
+
+    stats_snapshot_set_default(NULL);
+    stats_snapshot_free(snap);
+    printf("Stats snapshot test passed\n");
+}
+
+int main() {
+    printf("Running UltraBalancer stats tests...\n\n");
+
+    test_metrics_histogram();
+    test_stats_snapshot();
+
+    printf("\nAll tests passed!\n");
+    return 0;
+}
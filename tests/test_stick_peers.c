@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "../include/stick_tables.h"
+#include "../include/stick_peers.h"
+
+static stick_entry_t *wait_entry(stick_table_t *t, const char *name, int data_type, uint32_t want) {
+    stick_key_t key = { .type = STKTABLE_TYPE_STRING, .data.str = { (char *)name, strlen(name) } };
+    for (int i = 0; i < 500; i++) {
+        stick_entry_t *e = stktable_lookup_key(t, &key);
+        if (e) {
+            uint32_t v = data_type == STKTABLE_DATA_SERVER_ID ? atomic_load(&e->counters.server_id) :
+                         data_type == STKTABLE_DATA_HTTP_REQ_CNT ? atomic_load(&e->counters.http_req_cnt) :
+                         (uint32_t)stktable_read_rate(t, e, data_type);
+            if (v == want)
+                return e;
+        }
+        usleep(10000);
+    }
+    return NULL;
+}
+
+void test_stick_peers() {
+    printf("Testing stick table peers...\n");
+
+    stick_table_t *ta = stktable_new("sessions", STKTABLE_TYPE_STRING, 10000, 3600);
+    stick_table_t *tb = stktable_new("sessions", STKTABLE_TYPE_STRING, 10000, 3600);
+
+    // Written before replication starts: only the resync carries it
+    uint32_t srv = 3;
+    stick_key_t alice = { .type = STKTABLE_TYPE_STRING, .data.str = { "alice", 5 } };
+    stktable_update_key(ta, &alice, STKTABLE_DATA_SERVER_ID, &srv);
+
+    stk_peers_t *pa = stk_peers_new("lb1", 20);
+    stk_peers_t *pb = stk_peers_new("lb2", 20);
+    for (int i = 0; i < 2; i++) {
+        stk_peers_t *ps = i ? pb : pa;
+        assert(stk_peers_add(ps, "lb1", "127.0.0.1:27101") == 0);
+        assert(stk_peers_add(ps, "lb2", "127.0.0.1:27102") == 0);
+    }
+    stk_peers_attach(pa, ta);
+    stk_peers_attach(pb, tb);
+    assert(stk_peers_start(pa) == 0);
+    assert(stk_peers_start(pb) == 0);
+
+    assert(wait_entry(tb, "alice", STKTABLE_DATA_SERVER_ID, 3) != NULL);
+    assert(stk_peers_connected(pa) == 1 && stk_peers_connected(pb) == 1);
+
+    // A hot key is sent once per flush, not once per change
+    stick_key_t bob = { .type = STKTABLE_TYPE_STRING, .data.str = { "bob", 3 } };
+    for (int i = 0; i < 1000; i++)
+        stktable_inc_counter(ta, &bob, STKTABLE_DATA_HTTP_REQ_CNT);
+    assert(wait_entry(tb, "bob", STKTABLE_DATA_HTTP_REQ_CNT, 1000) != NULL);
+
+    stk_peers_stats_t st;
+    stk_peers_get_stats(pa, &st);
+    assert(st.updates_sent < 100);
+
+    // Rates add up across nodes
+    stick_key_t carol = { .type = STKTABLE_TYPE_STRING, .data.str = { "carol", 5 } };
+    uint32_t n = 7;
+    stktable_update_key(ta, &carol, STKTABLE_DATA_HTTP_REQ_RATE, &n);
+    stktable_update_key(tb, &carol, STKTABLE_DATA_HTTP_REQ_RATE, &n);
+    assert(wait_entry(ta, "carol", STKTABLE_DATA_HTTP_REQ_RATE, 14) != NULL);
+    assert(wait_entry(tb, "carol", STKTABLE_DATA_HTTP_REQ_RATE, 14) != NULL);
+
+    stk_peers_free(pa);
+    stk_peers_free(pb);
+    stktable_free(ta);
+    stktable_free(tb);
+    printf("Stick table peers test passed\n");
+}
+
+// A hand-driven peer for the wire tests: messages are
+// [u8 type][u32 length, big endian][payload], see stick_peers.h
+#define WIRE_HELLO  1
+#define WIRE_UPDATE 2
+#define WIRE_RESYNC 3
+
+typedef struct {
+    uint8_t p[4096];
+    size_t len;
+} wire_msg_t;
+
+static void wire_varint(wire_msg_t *m, uint64_t v) {
+    do {
+        m->p[m->len] = v & 0x7f;
+        v >>= 7;
+        if (v)
+            m->p[m->len] |= 0x80;
+        m->len++;
+    } while (v);
+}
+
+static void wire_str(wire_msg_t *m, const char *s) {
+    size_t n = strlen(s);
+    wire_varint(m, n);
+    memcpy(m->p + m->len, s, n);
+    m->len += n;
+}
+
+static void wire_be32(wire_msg_t *m, uint32_t v) {
+    uint8_t be[4] = { v >> 24, v >> 16, v >> 8, v };
+    memcpy(m->p + m->len, be, 4);
+    m->len += 4;
+}
+
+static void wire_begin(wire_msg_t *m, uint8_t type) {
+    m->len = 0;
+    m->p[m->len++] = type;
+    wire_be32(m, 0);
+}
+
+static void wire_send(int fd, wire_msg_t *m) {
+    uint32_t len = m->len - 5;
+    uint8_t be[4] = { len >> 24, len >> 16, len >> 8, len };
+    memcpy(m->p + 1, be, 4);
+    assert(send(fd, m->p, m->len, MSG_NOSIGNAL) == (ssize_t)m->len);
+}
+
+// An UPDATE or RESYNC with one entry: key, one counter, its value
+static void wire_entry(wire_msg_t *m, uint8_t type, const char *table, const char *key,
+                       uint32_t data_type, uint64_t val) {
+    wire_begin(m, type);
+    wire_str(m, table);
+    wire_varint(m, STKTABLE_TYPE_STRING);
+    wire_be32(m, 1);
+    wire_str(m, key);
+    wire_varint(m, data_type);
+    wire_varint(m, val);
+}
+
+static bool wire_read_full(int fd, uint8_t *p, size_t n) {
+    while (n) {
+        ssize_t r = recv(fd, p, n, 0);
+        if (r <= 0)
+            return false;
+        p += r;
+        n -= r;
+    }
+    return true;
+}
+
+// Next message's type with its payload in m, -1 on EOF or timeout
+static int wire_recv(int fd, wire_msg_t *m) {
+    uint8_t hdr[5];
+    if (!wire_read_full(fd, hdr, sizeof(hdr)))
+        return -1;
+    m->len = (uint32_t)hdr[1] << 24 | (uint32_t)hdr[2] << 16 | (uint32_t)hdr[3] << 8 | hdr[4];
+    assert(m->len <= sizeof(m->p));
+    if (!wire_read_full(fd, m->p, m->len))
+        return -1;
+    return hdr[0];
+}
+
+static int wire_connect(uint16_t port, int rcvbuf) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(fd >= 0);
+    if (rcvbuf)
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    struct timeval tv = { .tv_sec = 2 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    struct sockaddr_in sa = { .sin_family = AF_INET, .sin_port = htons(port) };
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for (int i = 0; i < 100; i++) {
+        if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) == 0)
+            return fd;
+        usleep(10000);
+    }
+    assert(!"peer listener never came up");
+    return -1;
+}
+
+static void wire_hello(int fd, const char *name) {
+    wire_msg_t m;
+    wire_begin(&m, WIRE_HELLO);
+    wire_varint(&m, STK_PEERS_VERSION);
+    wire_str(&m, name);
+    wire_send(fd, &m);
+}
+
+static bool wait_connected(stk_peers_t *ps, uint32_t want) {
+    for (int i = 0; i < 500; i++) {
+        if (stk_peers_connected(ps) == want)
+            return true;
+        usleep(10000);
+    }
+    return false;
+}
+
+void test_stick_peers_wire() {
+    printf("Testing stick table peer protocol...\n");
+
+    stick_table_t *t = stktable_new("sessions", STKTABLE_TYPE_STRING, 10000, 3600);
+    uint32_t srv = 9;
+    stick_key_t erin = { .type = STKTABLE_TYPE_STRING, .data.str = { "erin", 4 } };
+    stktable_update_key(t, &erin, STKTABLE_DATA_SERVER_ID, &srv);
+
+    // lb1 sorts first, so the node under test waits for it to dial
+    stk_peers_t *ps = stk_peers_new("lb2", 20);
+    assert(stk_peers_add(ps, "lb1", "127.0.0.1:27111") == 0);
+    assert(stk_peers_add(ps, "lb2", "127.0.0.1:27112") == 0);
+    stk_peers_attach(ps, t);
+    assert(stk_peers_start(ps) == 0);
+
+    // A HELLO from a name that is not a peer is refused
+    int fd = wire_connect(27112, 0);
+    wire_hello(fd, "stranger");
+    wire_msg_t m;
+    assert(wire_recv(fd, &m) == -1);
+    close(fd);
+
+    // The handshake is answered with HELLO, then the whole table
+    fd = wire_connect(27112, 0);
+    wire_hello(fd, "lb1");
+    assert(wire_recv(fd, &m) == WIRE_HELLO);
+    assert(memmem(m.p, m.len, "lb2", 3) != NULL);
+    assert(wire_recv(fd, &m) == WIRE_RESYNC);
+    assert(memmem(m.p, m.len, "sessions", 8) != NULL && memmem(m.p, m.len, "erin", 4) != NULL);
+    assert(wait_connected(ps, 1));
+
+    // UPDATE values are deltas
+    wire_entry(&m, WIRE_UPDATE, "sessions", "frank", STKTABLE_DATA_HTTP_REQ_CNT, 5);
+    wire_send(fd, &m);
+    wire_send(fd, &m);
+    assert(wait_entry(t, "frank", STKTABLE_DATA_HTTP_REQ_CNT, 10) != NULL);
+
+    // A table this node does not have is skipped, and unknown message
+    // types are ignored; neither drops the connection
+    wire_entry(&m, WIRE_UPDATE, "elsewhere", "frank", STKTABLE_DATA_HTTP_REQ_CNT, 5);
+    wire_send(fd, &m);
+    wire_begin(&m, 42);
+    wire_send(fd, &m);
+    wire_entry(&m, WIRE_UPDATE, "sessions", "frank", STKTABLE_DATA_HTTP_REQ_CNT, 1);
+    wire_send(fd, &m);
+    assert(wait_entry(t, "frank", STKTABLE_DATA_HTTP_REQ_CNT, 11) != NULL);
+    assert(stk_peers_connected(ps) == 1);
+
+    // A hundred local changes to one key leave as one entry holding
+    // their sum
+    stick_key_t gina = { .type = STKTABLE_TYPE_STRING, .data.str = { "gina", 4 } };
+    for (int i = 0; i < 100; i++)
+        stktable_inc_counter(t, &gina, STKTABLE_DATA_HTTP_REQ_CNT);
+    wire_msg_t want;
+    wire_entry(&want, WIRE_UPDATE, "sessions", "gina", STKTABLE_DATA_HTTP_REQ_CNT, 100);
+    bool seen = false;
+    while (!seen) {
+        int type = wire_recv(fd, &m);
+        assert(type != -1);
+        seen = type == WIRE_UPDATE && m.len == want.len - 5 && memcmp(m.p, want.p + 5, m.len) == 0;
+    }
+
+    // An entry count past the end of the payload is a protocol error
+    wire_entry(&m, WIRE_UPDATE, "sessions", "frank", STKTABLE_DATA_HTTP_REQ_CNT, 1);
+    m.p[5 + 1 + 8 + 1 + 3] = 2;
+    wire_send(fd, &m);
+    while (wire_recv(fd, &m) != -1)
+        ;
+    assert(wait_connected(ps, 0));
+    close(fd);
+
+    stk_peers_stats_t st;
+    stk_peers_get_stats(ps, &st);
+    assert(st.connects == 1 && st.resyncs_sent == 1);
+    // Entries are applied as they are parsed, so the malformed
+    // message's first entry counts too
+    assert(st.updates_received == 4);
+
+    stk_peers_free(ps);
+    stktable_free(t);
+    printf("Stick table peer protocol test passed\n");
+}
+
+void test_stick_peers_backlog() {
+    printf("Testing stick table peer backlog limit...\n");
+
+    stick_table_t *t = stktable_new("bulk", STKTABLE_TYPE_STRING, 400000, 3600);
+    stk_peers_t *ps = stk_peers_new("lb2", 10);
+    assert(stk_peers_add(ps, "lb1", "127.0.0.1:27113") == 0);
+    assert(stk_peers_add(ps, "lb2", "127.0.0.1:27114") == 0);
+    stk_peers_attach(ps, t);
+    assert(stk_peers_start(ps) == 0);
+
+    // A peer that handshakes and then stops reading
+    int fd = wire_connect(27114, 4096);
+    wire_hello(fd, "lb1");
+    assert(wait_connected(ps, 1));
+
+    // Every pass changes every key, so each flush queues them all again
+    // until the unsent backlog passes its limit and the peer is dropped
+    char buf[64];
+    stk_peers_stats_t st = { 0 };
+    for (int pass = 0; pass < 400 && !st.errors; pass++) {
+        for (int i = 0; i < 200000; i++) {
+            int n = snprintf(buf, sizeof(buf), "backlog-client-%08d-session", i);
+            stick_key_t key = { .type = STKTABLE_TYPE_STRING, .data.str = { buf, (size_t)n } };
+            stktable_inc_counter(t, &key, STKTABLE_DATA_HTTP_REQ_CNT);
+        }
+        stk_peers_get_stats(ps, &st);
+    }
+    assert(st.errors == 1);
+    assert(wait_connected(ps, 0));
+    close(fd);
+
+    stk_peers_free(ps);
+    stktable_free(t);
+    printf("Stick table peer backlog limit test passed\n");
+}
+
+int main() {
+    printf("Running UltraBalancer stick table peer tests...\n\n");
+
+    test_stick_peers();
+    test_stick_peers_wire();
+    test_stick_peers_backlog();
+
+    printf("\nAll tests passed!\n");
+    return 0;
+}
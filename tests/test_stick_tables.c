@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include "../include/stick_tables.h"
+#include "../include/core/proxy.h"
+
+void test_stick_tables() {
+    printf("Testing stick tables...\n");
+
+    stick_table_t *table = stktable_new("test", STKTABLE_TYPE_IP, 1000, 3600);
+    assert(table != NULL);
+
+    stick_key_t key = {
+        .type = STKTABLE_TYPE_IP,
+        .data.ipv4.s_addr = 0x0100007f  // 127.0.0.1
+    };
+
+    stick_entry_t *entry = stktable_get(table, &key);
+    assert(entry != NULL);
+
+    uint32_t val = 100;
+    stktable_update_key(table, &key, STKTABLE_DATA_CONN_CNT, &val);
+
+    entry = stktable_lookup(table, &key);
+    assert(entry != NULL);
+    assert(atomic_load(&entry->counters.conn_cnt) == 100);
+
+    stktable_free(table);
+    printf("Stick tables test passed\n");
+}
+
+void test_stick_table_keys() {
+    printf("Testing stick table key types...\n");
+
+    stick_table_t *table = stktable_new("keys", STKTABLE_TYPE_STRING, 100000, 3600);
+    assert(table != NULL);
+
+    // Short keys are stored inline, long ones out of line; both must
+    // come back by value, not by pointer
+    char buf[128];
+    for (int i = 0; i < 20000; i++) {
+        int n = snprintf(buf, sizeof(buf), i & 1 ? "client-%d" : "a-rather-long-cookie-value-for-client-%d", i);
+        stick_key_t key = { .type = STKTABLE_TYPE_STRING, .data.str = { buf, (size_t)n } };
+        stick_entry_t *e = stktable_get(table, &key);
+        assert(e != NULL);
+        atomic_store(&e->counters.server_id, i + 1);
+    }
+    assert(atomic_load(&table->current) == 20000);
+
+    for (int i = 0; i < 20000; i++) {
+        int n = snprintf(buf, sizeof(buf), i & 1 ? "client-%d" : "a-rather-long-cookie-value-for-client-%d", i);
+        stick_key_t key = { .type = STKTABLE_TYPE_STRING, .data.str = { buf, (size_t)n } };
+        stick_entry_t *e = stktable_lookup_key(table, &key);
+        assert(e != NULL);
+        assert(atomic_load(&e->counters.server_id) == (uint32_t)i + 1);
+    }
+
+    stick_key_t missing = { .type = STKTABLE_TYPE_STRING, .data.str = { "nobody", 6 } };
+    assert(stktable_lookup(table, &missing) == NULL);
+
+    // A key of the wrong type never matches
+    stick_key_t ip = { .type = STKTABLE_TYPE_IP, .data.ipv4.s_addr = 0x0100007f };
+    assert(stktable_get(table, &ip) == NULL);
+    stktable_free(table);
+
+    table = stktable_new("v6", STKTABLE_TYPE_IPV6, 1000, 3600);
+    stick_key_t v6 = { .type = STKTABLE_TYPE_IPV6 };
+    v6.data.ipv6.s6_addr[0] = 0x20;
+    v6.data.ipv6.s6_addr[15] = 1;
+    assert(stktable_inc_counter(table, &v6, STKTABLE_DATA_GPC0) == 1);
+    assert(stktable_inc_counter(table, &v6, STKTABLE_DATA_GPC0) == 2);
+    v6.data.ipv6.s6_addr[15] = 2;
+    assert(stktable_lookup(table, &v6) == NULL);
+    stktable_free(table);
+
+    table = stktable_new("bin", STKTABLE_TYPE_BINARY, 1000, 3600);
+    uint8_t raw[40] = { 0 };
+    stick_key_t bin = { .type = STKTABLE_TYPE_BINARY, .data.bin = { raw, sizeof(raw) } };
+    assert(stktable_get(table, &bin) != NULL);
+    raw[39] = 1;        // differs only past the inline prefix
+    assert(stktable_lookup(table, &bin) == NULL);
+    stktable_free(table);
+
+    printf("Stick table key types test passed\n");
+}
+
+void test_stick_table_eviction() {
+    printf("Testing stick table eviction...\n");
+
+    // The maintenance pass evicts least recently used entries down to the
+    // size; inserts only cap the overshoot
+    stick_table_t *table = stktable_new("lru", STKTABLE_TYPE_INTEGER, 6400, 3600);
+    assert(table != NULL);
+
+    for (uint32_t i = 0; i < 100000; i++) {
+        stick_key_t key = { .type = STKTABLE_TYPE_INTEGER, .data.integer = i };
+        assert(stktable_get(table, &key) != NULL);
+        if (i % 4096 == 0)
+            stktable_expire(table);
+    }
+    assert(atomic_load(&table->current) <= (6400 + STKTABLE_SHARDS) * 3 / 2);
+    stktable_expire(table);
+    assert(atomic_load(&table->current) <= 6400 + STKTABLE_SHARDS);
+    assert(atomic_load(&table->stats.expires) > 0);
+
+    stick_key_t last = { .type = STKTABLE_TYPE_INTEGER, .data.integer = 99999 };
+    assert(stktable_lookup(table, &last) != NULL);
+    stick_key_t first = { .type = STKTABLE_TYPE_INTEGER, .data.integer = 0 };
+    assert(stktable_lookup(table, &first) == NULL);
+    stktable_free(table);
+
+    printf("Stick table eviction test passed\n");
+}
+
+void test_stick_table_expiry() {
+    printf("Testing stick table expiry...\n");
+
+    // An expiry of zero makes every entry stale immediately
+    stick_table_t *table = stktable_new("exp", STKTABLE_TYPE_INTEGER, 1000, 0);
+    for (uint32_t i = 0; i < 500; i++) {
+        stick_key_t key = { .type = STKTABLE_TYPE_INTEGER, .data.integer = i };
+        stktable_get(table, &key);
+    }
+    stktable_expire(table);
+    assert(atomic_load(&table->current) == 0);
+    stktable_free(table);
+
+    // Work per pass is bounded: a large batch due at once drains over
+    // several passes, and tracked entries stay
+    table = stktable_new("exp", STKTABLE_TYPE_INTEGER, 1000000, 0);
+    uint32_t n = STKTABLE_SHARDS * STKTABLE_EXPIRE_BUDGET * 3;
+    for (uint32_t i = 0; i < n; i++) {
+        stick_key_t key = { .type = STKTABLE_TYPE_INTEGER, .data.integer = i };
+        stktable_get(table, &key);
+    }
+    stick_match_t match = { 0 };
+    session_t sess = { .stkctr = &match };
+    stick_key_t held = { .type = STKTABLE_TYPE_INTEGER, .data.integer = n };
+    assert(stksess_track(&sess, table, &held) == 0);
+
+    stktable_expire(table);
+    assert(atomic_load(&table->current) > 0);
+    for (int i = 0; i < 8 && atomic_load(&table->current) > 1; i++)
+        stktable_expire(table);
+    assert(atomic_load(&table->current) == 1);
+    assert(stktable_lookup_key(table, &held) != NULL);
+    stksess_untrack(&sess, table);
+    stktable_free(table);
+
+    printf("Stick table expiry test passed\n");
+}
+
+static stk_rate_t shared_rate;
+
+static void *rate_worker(void *arg) {
+    (void)arg;
+    for (int i = 0; i < 100000; i++)
+        stk_rate_add_at(&shared_rate, 1000, 1, 42500);
+    return NULL;
+}
+
+void test_stick_table_rates() {
+    printf("Testing stick table rate counters...\n");
+
+    stk_rate_t r = { 0 };
+    stk_rate_add_at(&r, 1000, 100, 5000);
+    assert(stk_rate_read_at(&r, 1000, 5500) == 100);
+
+    // Three quarters of the previous period is still in the window
+    stk_rate_add_at(&r, 1000, 40, 6250);
+    assert(stk_rate_read_at(&r, 1000, 6250) == 40 + 75);
+    assert(stk_rate_read_at(&r, 1000, 7999) == 0);
+    assert(stk_rate_read_at(&r, 1000, 9000) == 0);
+
+    // A cell two periods old is reused, not added to
+    stk_rate_add_at(&r, 1000, 1, 7000);
+    assert(stk_rate_read_at(&r, 1000, 7000) == 1 + 40);
+
+    pthread_t th[4];
+    for (int i = 0; i < 4; i++)
+        pthread_create(&th[i], NULL, rate_worker, NULL);
+    for (int i = 0; i < 4; i++)
+        pthread_join(th[i], NULL);
+    assert(stk_rate_read_at(&shared_rate, 1000, 42500) == 400000);
+
+    stick_table_t *table = stktable_new("rates", STKTABLE_TYPE_IP, 1000, 3600);
+    stick_key_t key = { .type = STKTABLE_TYPE_IP, .data.ipv4.s_addr = 0x0100007f };
+    for (int i = 1; i <= 10; i++)
+        assert(stktable_inc_counter(table, &key, STKTABLE_DATA_HTTP_REQ_RATE) >= i);
+
+    uint32_t burst = 5;
+    stktable_update_key(table, &key, STKTABLE_DATA_HTTP_REQ_RATE, &burst);
+    stick_entry_t *entry = stktable_lookup(table, &key);
+    assert(stktable_read_rate(table, entry, STKTABLE_DATA_HTTP_REQ_RATE) >= 15);
+    assert(stktable_read_rate(table, entry, STKTABLE_DATA_CONN_CNT) == -1);
+    stktable_free(table);
+
+    printf("Stick table rate counters test passed\n");
+}
+
+int main() {
+    printf("Running UltraBalancer stick table tests...\n\n");
+
+    test_stick_tables();
+    test_stick_table_keys();
+    test_stick_table_eviction();
+    test_stick_table_expiry();
+    test_stick_table_rates();
+
+    printf("\nAll tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../include/core/lb_timer.h"
+
+#define TIMER_COUNT 2000
+
+typedef struct {
+    lb_timer_t timer;
+    uint64_t deadline_ms;
+    uint64_t fired_ms;
+    int fired;
+} test_timer_t;
+
+static uint64_t test_now_ms;
+
+static void on_expire(lb_timer_t* timer, void* arg) {
+    test_timer_t* t = (test_timer_t*)timer;  // timer is the first member
+    int* total = arg;
+    t->fired++;
+    t->fired_ms = test_now_ms;
+    (*total)++;
+}
+
+void test_wheel_expiry() {
+    printf("Testing timing wheel expiry...\n");
+
+    uint64_t start = 123457;  // not tick aligned
+    lb_timer_wheel_t* wheel = lb_timer_wheel_create(start);
+    assert(wheel != NULL);
+
+    static test_timer_t timers[TIMER_COUNT];
+    srand(42);
+    for (int i = 0; i < TIMER_COUNT; i++) {
+        lb_timer_init(&timers[i].timer);
+        // Spread across the first three levels, up to ~12 minutes out
+        uint64_t delay = (i % 3 == 0) ? rand() % 2000
+                       : (i % 3 == 1) ? rand() % 60000
+                                      : rand() % 720000;
+        timers[i].deadline_ms = start + delay;
+        lb_timer_schedule(wheel, &timers[i].timer, timers[i].deadline_ms);
+    }
+    assert(wheel->count == TIMER_COUNT);
+
+    // Cancelled timers never fire
+    for (int i = 0; i < TIMER_COUNT; i += 10) {
+        lb_timer_cancel(wheel, &timers[i].timer);
+        assert(!lb_timer_pending(&timers[i].timer));
+    }
+
+    int total = 0;
+    for (test_now_ms = start; test_now_ms <= start + 730000; test_now_ms += 37) {
+        lb_timer_advance(wheel, test_now_ms, on_expire, &total);
+    }
+
+    for (int i = 0; i < TIMER_COUNT; i++) {
+        if (i % 10 == 0) {
+            assert(timers[i].fired == 0);
+            continue;
+        }
+        assert(timers[i].fired == 1);
+        // Never early, and late by at most one tick plus one advance step
+        assert(timers[i].fired_ms >= timers[i].deadline_ms);
+        assert(timers[i].fired_ms < timers[i].deadline_ms + LB_TIMER_TICK_MS + 37);
+    }
+    assert(total == TIMER_COUNT - TIMER_COUNT / 10);
+    assert(wheel->count == 0);
+
+    lb_timer_wheel_destroy(wheel);
+    printf("Timing wheel expiry test passed\n");
+}
+
+static void on_rearm(lb_timer_t* timer, void* arg) {
+    lb_timer_wheel_t* wheel = arg;
+    test_timer_t* t = (test_timer_t*)timer;
+    t->fired++;
+    if (t->fired < 3) lb_timer_schedule(wheel, timer, test_now_ms + 500);
+}
+
+void test_wheel_rearm() {
+    printf("Testing timer re-arm from callback...\n");
+
+    lb_timer_wheel_t* wheel = lb_timer_wheel_create(0);
+    test_timer_t t;
+    memset(&t, 0, sizeof(t));
+    lb_timer_init(&t.timer);
+
+    lb_timer_schedule(wheel, &t.timer, 100);
+    // Re-scheduling a pending timer moves it instead of adding another
+    lb_timer_schedule(wheel, &t.timer, 200);
+    assert(wheel->count == 1);
+
+    for (test_now_ms = 0; test_now_ms <= 5000; test_now_ms += 10) {
+        lb_timer_advance(wheel, test_now_ms, on_rearm, wheel);
+    }
+    assert(t.fired == 3);
+    assert(!lb_timer_pending(&t.timer));
+
+    lb_timer_wheel_destroy(wheel);
+
+    // Level 3 timer (~3.5 days) cascades down and fires on time
+    wheel = lb_timer_wheel_create(0);
+    lb_timer_init(&t.timer);
+    t.fired = 0;
+    uint64_t far = 300000000;
+    lb_timer_schedule(wheel, &t.timer, far);
+    int total = 0;
+    for (test_now_ms = 0; test_now_ms < far; test_now_ms += 60000) {
+        lb_timer_advance(wheel, test_now_ms, on_expire, &total);
+    }
+    assert(total == 0);
+    test_now_ms = far + LB_TIMER_TICK_MS;
+    lb_timer_advance(wheel, test_now_ms, on_expire, &total);
+    assert(total == 1);
+
+    lb_timer_wheel_destroy(wheel);
+    printf("Timer re-arm test passed\n");
+}
+
+int main() {
+    printf("Running UltraBalancer timer tests...\n\n");
+
+    test_wheel_expiry();
+    test_wheel_rearm();
+
+    printf("\nAll tests passed!\n");
+    return 0;
+}